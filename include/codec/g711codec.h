@@ -42,23 +42,90 @@
 
 ///////////////////////////////////////////////////////////////////////////////
 
+/**Base class for G.711 decoders.
+   Converts a whole frame at a time via a 256 entry lookup table, rather
+   than calling ConvertOne() for each sample.
+  */
 class Opal_G711_PCM : public OpalStreamedTranscoder {
   public:
     Opal_G711_PCM(const OpalMediaFormat & inputMediaFormat);
 
-#if OPAL_G711PLC 
-   virtual PBoolean Convert(
+    virtual PBoolean Convert(
       const RTP_DataFrame & input,  ///<  Input data
       RTP_DataFrame & output        ///<  Output data
     );
 
   protected:
+    /**Convert a block of G.711 samples to 16 bit linear PCM.
+      */
+    virtual void ConvertBlock(
+      const BYTE * input,   ///<  G.711 samples
+      short * output,       ///<  Linear samples, at least count in size
+      PINDEX count          ///<  Number of samples
+    ) const = 0;
+
+#if OPAL_G711PLC 
     OpalG711_PLC plc;
     PINDEX       lastPayloadSize;
 #endif
 };
 
 
+///////////////////////////////////////////////////////////////////////////////
+
+/**Base class for G.711 encoders.
+   Converts a whole frame at a time via lookup tables, rather than calling
+   ConvertOne() for each sample.
+  */
+class Opal_PCM_G711 : public OpalStreamedTranscoder {
+  public:
+    Opal_PCM_G711(const OpalMediaFormat & outputMediaFormat);
+
+    virtual PBoolean Convert(
+      const RTP_DataFrame & input,  ///<  Input data
+      RTP_DataFrame & output        ///<  Output data
+    );
+
+  protected:
+    /**Convert a block of 16 bit linear PCM samples to G.711.
+      */
+    virtual void ConvertBlock(
+      const short * input,  ///<  Linear samples
+      BYTE * output,        ///<  G.711 samples, at least count in size
+      PINDEX count          ///<  Number of samples
+    ) const = 0;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**Base class for direct conversion between G.711 A-Law and uLaw.
+   Each sample is mapped through a 256 byte table, giving the identical
+   result to decoding to linear PCM and encoding again.
+  */
+class Opal_G711_G711 : public OpalStreamedTranscoder {
+  public:
+    Opal_G711_G711(
+      const OpalMediaFormat & inputMediaFormat,
+      const OpalMediaFormat & outputMediaFormat
+    );
+
+    virtual PBoolean Convert(
+      const RTP_DataFrame & input,  ///<  Input data
+      RTP_DataFrame & output        ///<  Output data
+    );
+
+  protected:
+    /**Convert a block of G.711 samples to the other G.711 law.
+      */
+    virtual void ConvertBlock(
+      const BYTE * input,   ///<  Input G.711 samples
+      BYTE * output,        ///<  Output G.711 samples, at least count in size
+      PINDEX count          ///<  Number of samples
+    ) const = 0;
+};
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 class Opal_G711_uLaw_PCM : public Opal_G711_PCM {
@@ -66,16 +133,22 @@ class Opal_G711_uLaw_PCM : public Opal_G711_PCM {
     Opal_G711_uLaw_PCM();
     virtual int ConvertOne(int sample) const;
     static int ConvertSample(int sample);
+    static void ConvertSamples(const BYTE * input, short * output, PINDEX count);
+  protected:
+    virtual void ConvertBlock(const BYTE * input, short * output, PINDEX count) const;
 };
 
 
 ///////////////////////////////////////////////////////////////////////////////
 
-class Opal_PCM_G711_uLaw : public OpalStreamedTranscoder {
+class Opal_PCM_G711_uLaw : public Opal_PCM_G711 {
   public:
     Opal_PCM_G711_uLaw();
     virtual int ConvertOne(int sample) const;
     static int ConvertSample(int sample);
+    static void ConvertSamples(const short * input, BYTE * output, PINDEX count);
+  protected:
+    virtual void ConvertBlock(const short * input, BYTE * output, PINDEX count) const;
 };
 
 
@@ -86,16 +159,48 @@ class Opal_G711_ALaw_PCM : public Opal_G711_PCM {
     Opal_G711_ALaw_PCM();
     virtual int ConvertOne(int sample) const;
     static int ConvertSample(int sample);
+    static void ConvertSamples(const BYTE * input, short * output, PINDEX count);
+  protected:
+    virtual void ConvertBlock(const BYTE * input, short * output, PINDEX count) const;
 };
 
 
 ///////////////////////////////////////////////////////////////////////////////
 
-class Opal_PCM_G711_ALaw : public OpalStreamedTranscoder {
+class Opal_PCM_G711_ALaw : public Opal_PCM_G711 {
   public:
     Opal_PCM_G711_ALaw();
     virtual int ConvertOne(int sample) const;
     static int ConvertSample(int sample);
+    static void ConvertSamples(const short * input, BYTE * output, PINDEX count);
+  protected:
+    virtual void ConvertBlock(const short * input, BYTE * output, PINDEX count) const;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+class Opal_G711_uLaw_ALaw : public Opal_G711_G711 {
+  public:
+    Opal_G711_uLaw_ALaw();
+    virtual int ConvertOne(int sample) const;
+    static int ConvertSample(int sample);
+    static void ConvertSamples(const BYTE * input, BYTE * output, PINDEX count);
+  protected:
+    virtual void ConvertBlock(const BYTE * input, BYTE * output, PINDEX count) const;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+class Opal_G711_ALaw_uLaw : public Opal_G711_G711 {
+  public:
+    Opal_G711_ALaw_uLaw();
+    virtual int ConvertOne(int sample) const;
+    static int ConvertSample(int sample);
+    static void ConvertSamples(const BYTE * input, BYTE * output, PINDEX count);
+  protected:
+    virtual void ConvertBlock(const BYTE * input, BYTE * output, PINDEX count) const;
 };
 
 
@@ -105,7 +210,9 @@ class Opal_PCM_G711_ALaw : public OpalStreamedTranscoder {
 OPAL_REGISTER_TRANSCODER(Opal_G711_uLaw_PCM, OpalG711_ULAW_64K, OpalPCM16); \
 OPAL_REGISTER_TRANSCODER(Opal_PCM_G711_uLaw, OpalPCM16,         OpalG711_ULAW_64K); \
 OPAL_REGISTER_TRANSCODER(Opal_G711_ALaw_PCM, OpalG711_ALAW_64K, OpalPCM16); \
-OPAL_REGISTER_TRANSCODER(Opal_PCM_G711_ALaw, OpalPCM16,         OpalG711_ALAW_64K)
+OPAL_REGISTER_TRANSCODER(Opal_PCM_G711_ALaw, OpalPCM16,         OpalG711_ALAW_64K); \
+OPAL_REGISTER_TRANSCODER(Opal_G711_uLaw_ALaw, OpalG711_ULAW_64K, OpalG711_ALAW_64K); \
+OPAL_REGISTER_TRANSCODER(Opal_G711_ALaw_uLaw, OpalG711_ALAW_64K, OpalG711_ULAW_64K)
 
 #endif // OPAL_CODEC_G711CODEC_H
 
@@ -412,7 +412,10 @@ class OpalPluginTranscoderFactory : public OpalTranscoderFactory
       public:
         Worker(const OpalTranscoderKey & key, const PluginCodec_Definition * codec, bool enc)
           : OpalTranscoderFactory::WorkerBase(), codecDefn(codec), isEncoder(enc)
-        { OpalTranscoderFactory::Register(key, this); }
+        {
+          OpalTranscoderFactory::Register(key, this);
+          OpalTranscoder::RegistrationChanged();
+        }
 
       protected:
         virtual OpalTranscoder * Create(const OpalTranscoderKey &) const
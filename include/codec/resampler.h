@@ -0,0 +1,209 @@
+/*
+ * resampler.h
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Linear PCM sample rate conversion transcoders
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifndef OPAL_CODEC_RESAMPLER_H
+#define OPAL_CODEC_RESAMPLER_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <opal/buildopts.h>
+
+#include <opal/transcoders.h>
+
+#include <vector>
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**Base class for 16 bit linear PCM sample rate conversion.
+   This converts between the PCM-16 formats at 8, 16, 32 and 48kHz using a
+   polyphase FIR filter, so a wideband codec such as G.722 may be patched
+   to a narrowband one such as G.711 via the raw formats.
+
+   The filter is a Kaiser windowed sinc, designed once per rate pair and
+   shared by all instances. Each phase has its coefficients stored in
+   reverse, so an output sample is a single contiguous dot product with
+   the input, which is done with SSE2 where available.
+
+   In low latency mode a shorter filter is used, which roughly thirds the
+   group delay at the cost of a wider transition band and less stop band
+   attenuation.
+  */
+class OpalPCM16Resampler : public OpalTranscoder
+{
+  PCLASSINFO(OpalPCM16Resampler, OpalTranscoder);
+  public:
+  /**@name Construction */
+  //@{
+    /**Create a resampler between the PCM-16 formats of the clock rates.
+      */
+    OpalPCM16Resampler(
+      unsigned inputRate,   ///<  Input sample rate, 8000, 16000, 32000 or 48000
+      unsigned outputRate   ///<  Output sample rate, 8000, 16000, 32000 or 48000
+    );
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Get the optimal size for data frames to be converted.
+       This will be 10ms worth of samples.
+      */
+    virtual PINDEX GetOptimalDataFrameSize(
+      PBoolean input      ///<  Flag for input or output data size
+    ) const;
+
+    /**Convert the data from one format to another.
+       The filter history is kept between calls, and reset if there is a
+       discontinuity in the input timestamps.
+      */
+    virtual PBoolean Convert(
+      const RTP_DataFrame & input,  ///<  Input data
+      RTP_DataFrame & output        ///<  Output data
+    );
+
+    /**Resample a block of samples, continuing from the previous block.
+       The output must have space for GetMaxOutputSamples(count) samples.
+
+       @return number of samples written to output.
+      */
+    PINDEX Resample(
+      const short * input,  ///<  Input samples
+      PINDEX count,         ///<  Number of input samples
+      short * output        ///<  Output samples
+    );
+
+    /**Get the maximum number of output samples for the number of input
+       samples.
+      */
+    PINDEX GetMaxOutputSamples(
+      PINDEX count          ///<  Number of input samples
+    ) const;
+
+    /**Clear the filter history, as for the start of a new stream.
+      */
+    void Reset();
+  //@}
+
+  /**@name Member variable access */
+  //@{
+    /**Set low latency mode, this also resets the filter history.
+      */
+    void SetLowLatency(
+      bool lowLatency       ///<  Use shorter filter
+    );
+
+    /**Get low latency mode.
+      */
+    bool IsLowLatency() const { return m_lowLatency; }
+
+    /**Set the low latency mode for resamplers created after this call,
+       including those created by the media patch. Default is false.
+      */
+    static void SetDefaultLowLatency(
+      bool lowLatency       ///<  Use shorter filter
+    );
+
+    /**Get the low latency mode for new resamplers.
+      */
+    static bool GetDefaultLowLatency();
+
+    /**Get the delay through the filter in output samples.
+      */
+    double GetGroupDelay() const;
+
+    /**Get the PCM-16 media format for the sample rate.
+       Returns an invalid format if the rate is not supported.
+      */
+    static OpalMediaFormat GetPCM16Format(
+      unsigned rate         ///<  Sample rate
+    );
+  //@}
+
+    struct Filter;
+
+  protected:
+    void SelectFilter();
+
+    unsigned       m_inputRate;
+    unsigned       m_outputRate;
+    bool           m_lowLatency;
+    const Filter * m_filter;
+
+    std::vector<short> m_buffer;      // History followed by the current input block
+    unsigned           m_position;    // Of next output, in upsampled samples from buffer start
+    DWORD              m_nextTimestamp;
+    bool               m_started;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+#define OPAL_DECLARE_PCM16_RESAMPLER(inKHz, outKHz) \
+class Opal_PCM16_##inKHz##_##outKHz##KHz : public OpalPCM16Resampler { \
+  public: \
+    Opal_PCM16_##inKHz##_##outKHz##KHz() \
+      : OpalPCM16Resampler(inKHz##000, outKHz##000) { } \
+}
+
+OPAL_DECLARE_PCM16_RESAMPLER(8, 16);
+OPAL_DECLARE_PCM16_RESAMPLER(8, 32);
+OPAL_DECLARE_PCM16_RESAMPLER(8, 48);
+OPAL_DECLARE_PCM16_RESAMPLER(16, 8);
+OPAL_DECLARE_PCM16_RESAMPLER(16, 32);
+OPAL_DECLARE_PCM16_RESAMPLER(16, 48);
+OPAL_DECLARE_PCM16_RESAMPLER(32, 8);
+OPAL_DECLARE_PCM16_RESAMPLER(32, 16);
+OPAL_DECLARE_PCM16_RESAMPLER(32, 48);
+OPAL_DECLARE_PCM16_RESAMPLER(48, 8);
+OPAL_DECLARE_PCM16_RESAMPLER(48, 16);
+OPAL_DECLARE_PCM16_RESAMPLER(48, 32);
+
+
+#define OPAL_REGISTER_PCM16_RESAMPLERS() \
+OPAL_REGISTER_TRANSCODER(Opal_PCM16_8_16KHz,  OpalPCM16,         OpalPCM16_16KHZ); \
+OPAL_REGISTER_TRANSCODER(Opal_PCM16_8_32KHz,  OpalPCM16,         OpalPCM16_32KHZ); \
+OPAL_REGISTER_TRANSCODER(Opal_PCM16_8_48KHz,  OpalPCM16,         OpalPCM16_48KHZ); \
+OPAL_REGISTER_TRANSCODER(Opal_PCM16_16_8KHz,  OpalPCM16_16KHZ,   OpalPCM16); \
+OPAL_REGISTER_TRANSCODER(Opal_PCM16_16_32KHz, OpalPCM16_16KHZ,   OpalPCM16_32KHZ); \
+OPAL_REGISTER_TRANSCODER(Opal_PCM16_16_48KHz, OpalPCM16_16KHZ,   OpalPCM16_48KHZ); \
+OPAL_REGISTER_TRANSCODER(Opal_PCM16_32_8KHz,  OpalPCM16_32KHZ,   OpalPCM16); \
+OPAL_REGISTER_TRANSCODER(Opal_PCM16_32_16KHz, OpalPCM16_32KHZ,   OpalPCM16_16KHZ); \
+OPAL_REGISTER_TRANSCODER(Opal_PCM16_32_48KHz, OpalPCM16_32KHZ,   OpalPCM16_48KHZ); \
+OPAL_REGISTER_TRANSCODER(Opal_PCM16_48_8KHz,  OpalPCM16_48KHZ,   OpalPCM16); \
+OPAL_REGISTER_TRANSCODER(Opal_PCM16_48_16KHz, OpalPCM16_48KHZ,   OpalPCM16_16KHZ); \
+OPAL_REGISTER_TRANSCODER(Opal_PCM16_48_32KHz, OpalPCM16_48KHZ,   OpalPCM16_32KHZ)
+
+
+#endif // OPAL_CODEC_RESAMPLER_H
+
+
+/////////////////////////////////////////////////////////////////////////////
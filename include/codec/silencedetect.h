@@ -37,6 +37,8 @@
 #include <opal/buildopts.h>
 #include <rtp/rtp.h>
 
+#include <vector>
+
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -123,6 +125,16 @@ class OpalSilenceDetector : public PObject
   protected:
     PDECLARE_NOTIFIER(RTP_DataFrame, OpalSilenceDetector, ReceivedPacket);
 
+    /**Run the detection algorithm on a frame whose average signal level has
+       already been measured, silencing the frame if not in a talk burst.
+       The \p level is ignored for the first frame, which only sets the
+       timestamp.
+      */
+    void DetectSilence(
+      RTP_DataFrame & frame,  ///<  Frame to detect
+      unsigned level          ///<  Average signal level of the frame
+    );
+
     PNotifier receiveHandler;
 
     Params param;
@@ -138,6 +150,8 @@ class OpalSilenceDetector : public PObject
 };
 
 
+class OpalSilenceDetectorWorker;
+
 class OpalPCM16SilenceDetector : public OpalSilenceDetector
 {
     PCLASSINFO(OpalPCM16SilenceDetector, OpalSilenceDetector);
@@ -146,7 +160,7 @@ class OpalPCM16SilenceDetector : public OpalSilenceDetector
       */
     OpalPCM16SilenceDetector(
       const Params & newParam ///<  New parameters for silence detector
-    ) : OpalSilenceDetector(newParam) { }
+    ) : OpalSilenceDetector(newParam), m_worker(NULL) { }
 
   /**@name Overrides from OpalSilenceDetector */
   //@{
@@ -163,6 +177,127 @@ class OpalPCM16SilenceDetector : public OpalSilenceDetector
       PINDEX size           ///<  Size of payload buffer
     );
   //@}
+
+  /**@name Signal measurement */
+  //@{
+    /**Signal levels of a block of audio, all measured in one pass.
+      */
+    struct SignalLevels {
+      unsigned m_average;   /// Mean of the absolute sample values
+      unsigned m_rms;       /// Root mean square of the sample values
+      unsigned m_peak;      /// Largest absolute sample value
+    };
+
+    /**Get the mean of the absolute values of the samples, as used by the
+       detection algorithm. Uses SSE2 or AVX2 if the CPU has them.
+      */
+    static unsigned GetAverageLevel(
+      const short * pcm,    ///<  Samples to measure
+      PINDEX count          ///<  Number of samples
+    );
+
+    /**Get the average, RMS and peak levels of the samples in one pass.
+      */
+    static void GetSignalLevels(
+      const short * pcm,    ///<  Samples to measure
+      PINDEX count,         ///<  Number of samples
+      SignalLevels & levels ///<  Levels of the samples
+    );
+  //@}
+
+  /**@name Shared worker */
+  //@{
+    /**Set the worker thread that does the detection for this detector,
+       along with the other detectors that use it. The frames are then
+       handed to the worker from the media patch thread, which waits for the
+       result. NULL does the detection in the media patch thread.
+
+       This changes the notifier returned by GetReceiveHandler(), so must be
+       called before it is added to a patch.
+      */
+    void SetWorker(
+      OpalSilenceDetectorWorker * worker  ///<  Worker to use, or NULL
+    );
+
+    /**Get the worker thread that does the detection, NULL if none.
+      */
+    OpalSilenceDetectorWorker * GetWorker() const { return m_worker; }
+  //@}
+
+  protected:
+    PDECLARE_NOTIFIER(RTP_DataFrame, OpalPCM16SilenceDetector, ReceivedPacketByWorker);
+
+    /**Get the average signal level of the frame as ReceivedPacket() would,
+       UINT_MAX for the first frame.
+      */
+    unsigned MeasureFrame(
+      const RTP_DataFrame & frame   ///<  Frame to measure
+    ) const;
+
+    OpalSilenceDetectorWorker * m_worker;
+    PSyncPoint                  m_workerDone;
+
+  friend class OpalSilenceDetectorWorker;
+};
+
+
+/**This class does the silence detection for many streams on one thread.
+   Each media patch thread queues its frame and waits. The worker takes
+   every frame queued since its last pass, measures all of their levels in
+   one go, and then runs the adaptive threshold of each detector, so with
+   thousands of legs detection happens in batches rather than in every
+   patch thread. The decisions are the same as detecting in the patch.
+  */
+class OpalSilenceDetectorWorker : public PObject
+{
+    PCLASSINFO(OpalSilenceDetectorWorker, PObject);
+  public:
+  /**@name Construction */
+  //@{
+    /**Create the worker and start its thread.
+      */
+    OpalSilenceDetectorWorker();
+
+    /**Stop the worker thread. Any detector still using the worker detects
+       in its own thread from then on.
+      */
+    ~OpalSilenceDetectorWorker();
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Detect silence in the frame for the detector, returning when the
+       worker has done so.
+      */
+    void Detect(
+      OpalPCM16SilenceDetector & detector,  ///<  Detector for the stream
+      RTP_DataFrame & frame                 ///<  Frame to detect
+    );
+
+    /**Get the number of passes the worker has made over queued frames.
+      */
+    PUInt64 GetBatchCount() const;
+
+    /**Get the number of frames the worker has detected.
+      */
+    PUInt64 GetFrameCount() const;
+  //@}
+
+  protected:
+    PDECLARE_NOTIFIER(PThread, OpalSilenceDetectorWorker, WorkerMain);
+
+    struct Request {
+      OpalPCM16SilenceDetector * m_detector;
+      RTP_DataFrame            * m_frame;
+    };
+
+    std::vector<Request> m_pending;
+    mutable PMutex       m_mutex;
+    PSyncPoint           m_wakeup;
+    PThread            * m_thread;
+    bool                 m_running;
+    PUInt64              m_batchCount;
+    PUInt64              m_frameCount;
 };
 
 
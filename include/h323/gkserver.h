@@ -50,6 +50,9 @@
 #include <h323/h323pdu.h>
 #include <h323/h323trans.h>
 
+#include <map>
+#include <vector>
+
 
 class PASN_Sequence;
 class PASN_Choice;
@@ -1692,16 +1695,93 @@ class H323GatekeeperServer : public H323TransactionServer
 
     PSafeDictionary<PString, H323RegisteredEndPoint> byIdentifier;
 
-    class StringMap : public PString {
-        PCLASSINFO(StringMap, PString);
+    typedef std::vector<PString> IdentifierList;
+
+    /**Map of signal addresses or aliases to endpoint identifiers. The
+       strings are hashed over shards with their own read/write mutex, so
+       lookups only contend with registrations that land on the same shard.
+       If more than one endpoint has the same string the first to register
+       is found.
+      */
+    class StringIndex
+    {
       public:
-        StringMap(const PString & from, const PString & id)
-          : PString(from), identifier(id) { }
-        PString identifier;
+        void Add(const PString & key, const PString & identifier);
+        void Remove(const PString & key, const PString & identifier);
+
+        // Return empty string if not found
+        PString Find(const PString & key) const;
+
+        // Find the lowest key starting with partial, as PSortedStringList::GetNextStringsIndex()
+        PString FindPartial(const PString & partial, PString & key) const;
+
+      protected:
+        enum { NumShards = 64 };
+
+        struct Shard
+        {
+          std::map<PString, IdentifierList> m_map;
+          PReadWriteMutex                   m_mutex;
+        };
+
+        Shard & GetShard(const PString & key) const;
+
+        mutable Shard m_shards[NumShards];
     };
-    PSortedStringList byAddress;
-    PSortedStringList byAlias;
-    PSortedStringList byVoicePrefix;
+
+    /**Trie of voice prefixes for longest prefix matching of dialled numbers,
+       branching directly on digits, '*' and '#' with a map for any other
+       characters.
+      */
+    class PrefixIndex
+    {
+      public:
+        PrefixIndex();
+
+        void Add(const PString & prefix, const PString & identifier);
+        void Remove(const PString & prefix, const PString & identifier);
+
+        // Return empty string if no prefix of number is registered
+        PString FindLongest(const PString & number) const;
+
+      protected:
+        enum { NumDigits = 12 };
+
+        struct Node
+        {
+          Node();
+          ~Node();
+
+          Node * GetChild(char c) const;
+          Node * & MakeChild(char c);
+          bool IsEmpty() const;
+
+          Node                 * m_digits[NumDigits];
+          std::map<char, Node *> m_others;
+          IdentifierList         m_identifiers;
+        };
+
+        Node                    m_root;
+        PINDEX                  m_count;
+        mutable PReadWriteMutex m_mutex;
+    };
+
+    StringIndex byAddress;
+    StringIndex byAlias;
+    PrefixIndex byVoicePrefix;
+
+    /* What each endpoint was indexed under, so it can be taken out again
+       when its addresses or aliases have since changed. */
+    struct IndexedKeys
+    {
+      std::vector<PString> m_addresses;
+      std::vector<PString> m_aliases;
+      std::vector<PString> m_prefixes;
+    };
+    std::map<PString, IndexedKeys> m_indexedKeys;
+    PMutex                         m_indexedKeysMutex;
+
+    void RemoveFromIndexes(const PString & identifier, const IndexedKeys & keys);
 
     PSafeSortedList<H323GatekeeperCall> activeCalls;
 
@@ -44,6 +44,9 @@
 
 #include <ptclib/asner.h>
 
+#include <map>
+#include <vector>
+
 
 class H323EndPoint;
 
@@ -57,6 +60,11 @@ class H323TransactionPDU {
 
     virtual PBoolean Read(H323Transport & transport);
     virtual PBoolean Write(H323Transport & transport);
+    virtual PBoolean WriteTo(H323Transport & transport, const H323TransportAddress & address);
+
+    /**Encode the PDU, finalising any security, ready for writing.
+      */
+    void EncodePDU(PPER_Stream & strm);
 
     virtual PASN_Object & GetPDU() = 0;
     virtual PASN_Choice & GetChoice() = 0;
@@ -90,9 +98,15 @@ class H323TransactionPDU {
       unsigned cryptoOptionalField
     ) { authenticators.PreparePDU(*this, clearTokens, clearOptionalField, cryptoTokens, cryptoOptionalField); }
 
+    /**Get the address the PDU was received from by Read(), empty if it was
+       not read from a transport.
+      */
+    const H323TransportAddress & GetReceivedAddress() const { return receivedAddress; }
+
   protected:
     mutable H235Authenticators authenticators;
     PPER_Stream rawPDU;
+    H323TransportAddress receivedAddress;
 };
 
 
@@ -186,6 +200,19 @@ class H323Transactor : public PObject
       const H323TransportAddressArray & addresses,
       PBoolean callback = PTrue
     );
+
+    /**Write reply PDU to the addresses after executing callback.
+       The reply is cached against the address the request came from, so a
+       retransmission of the request is answered without processing it again.
+       Each address is written to directly, the remote address of the
+       transport is not changed, so replies may be sent from several threads
+       at once.
+      */
+    PBoolean WriteReply(
+      H323TransactionPDU & pdu,
+      const H323TransportAddressArray & addresses,
+      const H323TransportAddress & requestAddress
+    );
   //@}
 
   /**@name Member variable access */
@@ -284,23 +311,88 @@ class H323Transactor : public PObject
     );
 
     void AgeResponses();
+    bool GetRequestAddress(
+      H323TransportAddress & address
+    ) const;
     PBoolean SendCachedResponse(
       const H323TransactionPDU & pdu
     );
+    PBoolean WritePDUTo(
+      H323TransactionPDU & pdu,
+      const H323TransportAddress & address,
+      PBoolean callback
+    );
+
+    /**Replies to recently received requests, so a retransmitted request is
+       answered with the same reply without being processed again.
 
-    class Response : public PString
+       Entries are keyed on the sequence number and the address the request
+       came from, spread over shards each with its own mutex, so requests
+       from different peers rarely contend. The reply is held already encoded
+       and is sent straight to the peer, the shared transport is not touched.
+       Expiry is kept in one second buckets so ageing only visits entries
+       that may be due, not the whole cache.
+      */
+    class ResponseCache
     {
-        PCLASSINFO(Response, PString);
       public:
-        Response(const H323TransportAddress & addr, unsigned seqNum);
-        ~Response();
+        ResponseCache();
+
+        /**Check if a request has been seen before. If it has, true is
+           returned and the reply is copied to the parameter, this may be
+           empty if the reply has not been sent yet. If it has not, an entry
+           is created for the request and false returned.
+          */
+        bool Check(
+          const H323TransportAddress & address,
+          unsigned seqNum,
+          PBYTEArray & reply
+        );
+
+        /**Record the reply for a request, if the request is in the cache.
+          */
+        void SetReply(
+          const H323TransportAddress & address,
+          unsigned seqNum,
+          const PBYTEArray & reply,
+          unsigned delay
+        );
+
+        /**Remove expired entries. Only does any work once a second.
+          */
+        void Age();
 
-        void SetPDU(const H323TransactionPDU & pdu);
-        PBoolean SendCachedResponse(H323Transport & transport);
+        /**Get the number of requests in the cache.
+          */
+        PINDEX GetSize() const;
 
-        PTime                lastUsedTime;
-        PTimeInterval        retirementAge;
-        H323TransactionPDU * replyPDU;
+      protected:
+        typedef std::pair<unsigned, PString> Key;
+
+        struct Entry
+        {
+          PBYTEArray m_reply;
+          PInt64     m_retirementAge;   // Milliseconds after last use
+          PInt64     m_expiry;          // PTimer::Tick() milliseconds
+        };
+
+        typedef std::map<Key, Entry> EntryMap;
+        typedef std::map<PInt64, std::vector<Key> > ExpiryMap;
+
+        enum { NumShards = 32 };
+
+        struct Shard
+        {
+          EntryMap      m_entries;
+          ExpiryMap     m_expiries;   // Keyed on expiry in seconds
+          PMutex        m_mutex;
+        };
+
+        Shard & GetShard(const Key & key);
+        static void ScheduleExpiry(Shard & shard, const Key & key, PInt64 expiry);
+
+        mutable Shard m_shards[NumShards];
+        PInt64        m_nextAge;
     };
 
     // Configuration variables
@@ -317,8 +409,13 @@ class H323Transactor : public PObject
     PMutex                            requestsMutex;
     Request                         * lastRequest;
 
-    PMutex                pduWriteMutex;
-    PSortedList<Response> responses;
+    /* The PDU the transactor thread is handling, a PDU written by that thread
+       while it is set is a reply, cached against the address this came from. */
+    PThread                  * handlerThread;
+    const H323TransactionPDU * handlingPDU;
+
+    PReadWriteMutex pduWriteMutex;
+    ResponseCache   responses;
 };
 
 
@@ -385,6 +482,7 @@ class H323Transaction : public PObject
 
     H323Transactor         & transactor;
     unsigned                 requestSequenceNumber;
+    H323TransportAddress     requestAddress;
     H323TransportAddressArray replyAddresses;
     PBoolean                     fastResponseRequired;
     H323TransactionPDU     * request;
@@ -63,6 +63,7 @@ class OpalWAVRecordManager : public OpalRecordManager
         OpalWAVFile m_file;
         bool        m_mono;
         bool        m_started;
+        std::vector<short> m_stereo;
 
       public:
         Mixer_T();
@@ -613,6 +613,23 @@ class OpalEndPoint : public PObject
         Default behaviour deletes the objects in the connectionsActive list.
       */
     virtual PBoolean GarbageCollection();
+
+    /** Execute garbage collection for only what has been queued since the
+        last call, see QueueGarbageCollection().
+        Returns true if all garbage has been collected, if not the endpoint
+        is tried again shortly.
+        Default behaviour collects the queued connections' media streams and
+        deletes the released objects in the connectionsActive list, without
+        visiting every active connection.
+      */
+    virtual bool CollectQueuedGarbage();
+
+    /** Queue a connection for the garbage collector thread, after one of its
+        media streams was removed.
+      */
+    void QueueGarbageCollection(
+      OpalConnection & connection   ///< Connection with something to collect
+    );
   //@}
 
   /**@name Member variable access */
@@ -743,6 +760,9 @@ class OpalEndPoint : public PObject
     } connectionsActive;
     PBoolean AddConnection(OpalConnection * connection);
 
+    PMutex            m_garbageQueueMutex;
+    std::set<PString> m_garbageQueuedConnections;
+
     PMutex inUseFlag;
 
     friend void OpalManager::GarbageCollection();
@@ -41,6 +41,9 @@
 #include <opal/call.h>
 #include <opal/connection.h> //OpalConnection::AnswerCallResponse
 #include <opal/guid.h>
+#include <opal/scheduler.h>
+#include <rtp/statsreg.h>
+#include <opal/routetable.h>
 #include <opal/audiorecord.h>
 #include <codec/silencedetect.h>
 #include <codec/echocancel.h>
@@ -50,8 +53,11 @@
 #include <ptlib/videoio.h>
 #endif
 
+#include <set>
+
 class OpalEndPoint;
 class OpalMediaPatch;
+class RTP_Reactor;
 
 /**This class is the central manager for OPAL.
    The OpalManager embodies the root of the tree of objects that constitute an
@@ -612,6 +618,20 @@ class OpalManager : public PObject
       PBoolean requiresPatchThread = PTrue
     );
 
+    /**Create a OpalMediaPatch instance for the first sink stream.
+       This allows the patch type to depend on both streams.
+
+       The default behaviour returns an OpalRelayMediaPatch if the two streams
+       are RTP with identical media formats and the call is not being
+       recorded, so packets are forwarded by the RTP reactor without a patch
+       thread. Otherwise it calls CreateMediaPatch(source, requiresPatchThread).
+      */
+    virtual OpalMediaPatch * CreateMediaPatch(
+      OpalMediaStream & source,         ///<  Source media stream
+      OpalMediaStream & sink,           ///<  First sink media stream
+      PBoolean requiresPatchThread
+    );
+
     /**Destroy a OpalMediaPatch instance.
 
        The default behaviour simply calls delete patch.
@@ -1057,6 +1077,52 @@ class OpalManager : public PObject
      */
     void SetRtpIpTypeofService(unsigned tos) { rtpIpTypeofService = (BYTE)tos; }
 
+#if OPAL_RTP_AGGREGATE
+    /**Get the number of threads in the shared RTP reactor.
+       Zero indicates that each RTP session uses its own thread to read media.
+       Defaults to zero.
+     */
+    unsigned GetRTPReactorThreads() const;
+
+    /**Set the number of threads in the shared RTP reactor.
+       If zero, each RTP session uses its own thread blocked in select() to
+       read media. Otherwise all RTP and RTCP sockets are read by a pool of
+       this many threads.
+
+       This only affects sessions opened after the call. It will fail if
+       there are any RTP sessions currently using the existing reactor.
+     */
+    bool SetRTPReactorThreads(
+      unsigned count    ///< Number of reactor threads, zero to disable
+    );
+
+    /**Get the shared RTP reactor, NULL if not enabled.
+     */
+    RTP_Reactor * GetRTPReactor() const { return m_rtpReactor; }
+#endif
+
+    /**Get the shared work scheduler.
+       This bounded pool of threads executes the short lived background jobs,
+       such as OpalConnection::OnReleased(), that used to have a thread each.
+       Work should be posted with the call token as its key where it must not
+       run concurrently with other work for the same call.
+     */
+    OpalWorkScheduler & GetWorkScheduler() { return m_workScheduler; }
+
+    /**Get the work scheduler counters, for monitoring.
+     */
+    void GetWorkSchedulerStatistics(
+      OpalWorkScheduler::Statistics & statistics  ///< Counters to fill in
+    ) const { m_workScheduler.GetStatistics(statistics); }
+
+#if OPAL_STATISTICS
+    /**Get the registry of all RTP sessions, for exporting their statistics
+       in one pass, e.g. with RTP_StatisticsRegistry::ExportPrometheus().
+       This does not lock or even look at any call or connection.
+     */
+    RTP_StatisticsRegistry & GetStatisticsRegistry() { return m_statisticsRegistry; }
+#endif
+
     /**Get the maximum RTP payload size.
        Defaults to maximum safe MTU size (576 bytes as per RFC879) minus the
        typical size of the IP, UDP an RTP headers.
@@ -1125,6 +1191,19 @@ class OpalManager : public PObject
     /**Get the default parameters for the silence detector.
      */
     const OpalSilenceDetector::Params & GetSilenceDetectParams() const { return silenceDetectParams; }
+
+    /**Set whether the silence detectors of new connections do their
+       detection in batches on one shared worker thread, rather than each in
+       its own media patch thread. This is for gateways with silence
+       detection on many legs at once. Defaults to false.
+     */
+    void SetSilenceDetectBatching(
+      bool enable   ///< Use the shared worker
+    );
+
+    /**Get the shared silence detection worker, NULL if batching is off.
+     */
+    OpalSilenceDetectorWorker * GetSilenceDetectWorker() const;
     
     /**Set the default parameters for the echo cancelation.
      */
@@ -1221,6 +1300,20 @@ class OpalManager : public PObject
     // needs to be public for gcc 3.4
     void GarbageCollection();
 
+    /**Queue the call dictionary for the garbage collector thread, after a
+       call was removed from it. The thread is woken to delete the call as
+       soon as nothing references it, rather than at the next sweep.
+      */
+    void QueueGarbageCollection();
+
+    /**Queue an endpoint for the garbage collector thread, after one of its
+       connections, or anything else it collects, was released. Only the
+       queued endpoints are visited, see OpalEndPoint::CollectQueuedGarbage().
+      */
+    void QueueGarbageCollection(
+      OpalEndPoint & endpoint   ///< Endpoint with something to collect
+    );
+
     /**Call back for a new connection has been constructed.
        This is called after CreateConnection has returned a new connection.
        It allows an application to make any custom adjustments to the
@@ -1293,6 +1386,9 @@ class OpalManager : public PObject
     PString       ilsServer;
 
     OpalSilenceDetector::Params silenceDetectParams;
+    OpalSilenceDetectorWorker * m_silenceDetectWorker;
+    bool                        m_silenceDetectBatching;
+    mutable PMutex              m_silenceDetectMutex;
     OpalEchoCanceler::Params echoCancelParams;
 
 #if OPAL_VIDEO
@@ -1341,8 +1437,18 @@ class OpalManager : public PObject
     PSTUNClient      * stun;
     InterfaceMonitor * interfaceMonitor;
 
-    RouteTable routeTable;
-    PMutex     routeTableMutex;
+    RouteTable    routeTable;
+    PMutex        routeTableMutex;
+    OpalCompiledRouteTablePtr m_compiledRouteTable;      // NULL after AddRouteEntry(), rebuilt on next use
+    PMutex                    m_compiledRouteTableMutex; // Only held to copy the pointer
+
+    /**Build the compiled form of the route table searched by
+       ApplyRouteTable(), replacing any previous one. This is done by
+       SetRouteTable() and, after AddRouteEntry(), on the next search.
+       Entries that cannot be compiled are removed from the route table,
+       so entry indexes are the same in both.
+      */
+    OpalCompiledRouteTablePtr CompileRouteTable();
 
     // Dynamic variables
     PReadWriteMutex     endpointsMutex;
@@ -1364,16 +1470,33 @@ class OpalManager : public PObject
     PSyncPoint     m_allCallsCleared;
     void InternalClearAllCalls(OpalConnection::CallEndReason reason, bool wait, bool first);
 
+    OpalWorkScheduler m_workScheduler;
+
+#if OPAL_STATISTICS
+    RTP_StatisticsRegistry m_statisticsRegistry;
+#endif
+
     PThread    * garbageCollector;
-    PSyncPoint   garbageCollectExit;
+    PSyncPoint   garbageCollectSignal;
+    bool         garbageCollectStop;
     PDECLARE_NOTIFIER(PThread, OpalManager, GarbageMain);
 
+    PMutex                   m_garbageQueueMutex;
+    bool                     m_garbageQueuedCalls;
+    std::set<OpalEndPoint *> m_garbageQueuedEndPoints;
+    bool CollectQueuedGarbage();
+
 #ifdef OPAL_ZRTP
     bool zrtpEnabled;
 #endif
 
     OpalRecordManager * m_recordManager;
 
+#if OPAL_RTP_AGGREGATE
+    RTP_Reactor * m_rtpReactor;
+    PMutex        m_rtpReactorMutex;
+#endif
+
     friend OpalCall::OpalCall(OpalManager & mgr);
     friend void OpalCall::OnReleased(OpalConnection & connection);
 };
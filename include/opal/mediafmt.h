@@ -49,6 +49,7 @@
 #include <rtp/rtp.h>
 
 #include <limits>
+#include <vector>
 
 #ifdef min
 #undef min
@@ -223,6 +224,44 @@ class OpalMediaFormatList : public OpalMediaFormatBaseList
 
 ///////////////////////////////////////////////////////////////////////////////
 
+/**Interned identifier for a media option name.
+   Each distinct option name, compared without regard to case, is given a
+   small integer once, the first time an OpalMediaOption of that name is
+   created. Options are then found in a media format by comparing integers
+   rather than strings.
+  */
+class OpalMediaOptionKey
+{
+  public:
+    /**Create an invalid key, which matches no option.
+      */
+    OpalMediaOptionKey() : m_id(0) { }
+
+    /**Get the key for the option name, registering it if new.
+      */
+    explicit OpalMediaOptionKey(
+      const PString & name    ///< Name of option
+    );
+
+    /**Get the key for an option name, if it has been registered. This does
+       not add new names, so an unknown name gives an invalid key.
+      */
+    static OpalMediaOptionKey Find(
+      const PString & name    ///< Name of option
+    );
+
+    bool IsValid() const { return m_id != 0; }
+    unsigned GetId() const { return m_id; }
+
+    bool operator==(const OpalMediaOptionKey & other) const { return m_id == other.m_id; }
+    bool operator!=(const OpalMediaOptionKey & other) const { return m_id != other.m_id; }
+    bool operator< (const OpalMediaOptionKey & other) const { return m_id <  other.m_id; }
+
+  protected:
+    unsigned m_id;
+};
+
+
 /**Base class for options attached to an OpalMediaFormat.
   */
 class OpalMediaOption : public PObject
@@ -269,6 +308,7 @@ class OpalMediaOption : public PObject
     bool FromString(const PString & value);
 
     const PString & GetName() const { return m_name; }
+    const OpalMediaOptionKey & GetKey() const { return m_key; }
 
     bool IsReadOnly() const { return m_readOnly; }
     void SetReadOnly(bool readOnly) { m_readOnly = readOnly; }
@@ -308,17 +348,18 @@ class OpalMediaOption : public PObject
 #endif // OPAL_H323
 
   protected:
-    PCaselessString m_name;
-    bool            m_readOnly;
-    MergeType       m_merge;
+    PCaselessString    m_name;
+    OpalMediaOptionKey m_key;
+    bool               m_readOnly;
+    MergeType          m_merge;
 
 #if OPAL_SIP
-    PCaselessString m_FMTPName;
-    PString         m_FMTPDefault;
+    PCaselessString    m_FMTPName;
+    PString            m_FMTPDefault;
 #endif // OPAL_SIP
 
 #if OPAL_H323
-    H245GenericInfo m_H245Generic;
+    H245GenericInfo    m_H245Generic;
 #endif // OPAL_H323
 };
 
@@ -550,6 +591,7 @@ class OpalMediaFormatInternal : public PObject
       unsigned clockRate,
       time_t timeStamp
     );
+    OpalMediaFormatInternal(const OpalMediaFormatInternal & other);
 
     virtual PObject * Clone() const;
     virtual void PrintOn(ostream & strm) const;
@@ -576,6 +618,16 @@ class OpalMediaFormatInternal : public PObject
     virtual bool AddOption(OpalMediaOption * option, PBoolean overwrite = PFalse);
     virtual OpalMediaOption * FindOption(const PString & name) const;
 
+    /* Interned key versions of the above. These do not lock, the instance is
+       only changed once it is not shared, see OpalMediaFormat::MakeUnique(). */
+    OpalMediaOption * FindOption(const OpalMediaOptionKey & key) const;
+    bool GetOptionValue(const OpalMediaOptionKey & key, PString & value) const;
+    bool GetOptionBoolean(const OpalMediaOptionKey & key, bool dflt) const;
+    int GetOptionInteger(const OpalMediaOptionKey & key, int dflt) const;
+    double GetOptionReal(const OpalMediaOptionKey & key, double dflt) const;
+    PINDEX GetOptionEnum(const OpalMediaOptionKey & key, PINDEX dflt) const;
+    PString GetOptionString(const OpalMediaOptionKey & key, const PString & dflt) const;
+
     virtual bool ToNormalisedOptions();
     virtual bool ToCustomisedOptions();
     virtual bool Merge(const OpalMediaFormatInternal & mediaFormat);
@@ -591,6 +643,15 @@ class OpalMediaFormatInternal : public PObject
     time_t                       codecVersionTime;
     bool                         forceIsTransportable;
 
+    // The options again, as a flat array sorted by key
+    struct OptionIndexEntry {
+      unsigned          m_key;
+      OpalMediaOption * m_option;
+      bool operator<(const OptionIndexEntry & other) const { return m_key < other.m_key; }
+    };
+    std::vector<OptionIndexEntry> m_optionIndex;
+    void BuildOptionIndex();
+
   friend bool operator==(const char * other, const OpalMediaFormat & fmt);
   friend bool operator!=(const char * other, const OpalMediaFormat & fmt);
   friend bool operator==(const PString & other, const OpalMediaFormat & fmt);
@@ -794,27 +855,31 @@ class OpalMediaFormat : public PContainer
     /**Determine if the media format requires a jitter buffer. As a rule an
        audio codec needs a jitter buffer and all others do not.
       */
-    bool NeedsJitterBuffer() const { PWaitAndSignal m(_mutex); return m_info != NULL && m_info->GetOptionBoolean(NeedsJitterOption(), PFalse); }
+    bool NeedsJitterBuffer() const { PWaitAndSignal m(_mutex); return m_info != NULL && m_info->GetOptionBoolean(NeedsJitterKey(), PFalse); }
     static const PString & NeedsJitterOption();
+    static const OpalMediaOptionKey & NeedsJitterKey();
 
     /**Get the average bandwidth used in bits/second.
       */
-    unsigned GetBandwidth() const { PWaitAndSignal m(_mutex); return m_info == NULL ? 0 : m_info->GetOptionInteger(MaxBitRateOption(), 0); }
+    unsigned GetBandwidth() const { PWaitAndSignal m(_mutex); return m_info == NULL ? 0 : m_info->GetOptionInteger(MaxBitRateKey(), 0); }
     static const PString & MaxBitRateOption();
+    static const OpalMediaOptionKey & MaxBitRateKey();
     static const PString & TargetBitRateOption();
 
     /**Get the maximum frame size in bytes. If this returns zero then the
        media format has no intrinsic maximum frame size, eg a video format
        would return zero but G.723.1 would return 24.
       */
-    PINDEX GetFrameSize() const { PWaitAndSignal m(_mutex); return m_info == NULL ? 0 : m_info->GetOptionInteger(MaxFrameSizeOption(), 0); }
+    PINDEX GetFrameSize() const { PWaitAndSignal m(_mutex); return m_info == NULL ? 0 : m_info->GetOptionInteger(MaxFrameSizeKey(), 0); }
     static const PString & MaxFrameSizeOption();
+    static const OpalMediaOptionKey & MaxFrameSizeKey();
 
     /**Get the frame time in RTP timestamp units. If this returns zero then
        the media format is not real time and has no intrinsic timing eg T.120
       */
-    unsigned GetFrameTime() const { PWaitAndSignal m(_mutex); return m_info == NULL ? 0 : m_info->GetOptionInteger(FrameTimeOption(), 0); }
+    unsigned GetFrameTime() const { PWaitAndSignal m(_mutex); return m_info == NULL ? 0 : m_info->GetOptionInteger(FrameTimeKey(), 0); }
     static const PString & FrameTimeOption();
+    static const OpalMediaOptionKey & FrameTimeKey();
 
     /**Get the number of RTP timestamp units per millisecond.
       */
@@ -827,8 +892,9 @@ class OpalMediaFormat : public PContainer
 
     /**Get the clock rate in Hz for this format.
       */
-    unsigned GetClockRate() const { PWaitAndSignal m(_mutex); return m_info == NULL ? 0 : m_info->GetOptionInteger(ClockRateOption(), 1000); }
+    unsigned GetClockRate() const { PWaitAndSignal m(_mutex); return m_info == NULL ? 0 : m_info->GetOptionInteger(ClockRateKey(), 1000); }
     static const PString & ClockRateOption();
+    static const OpalMediaOptionKey & ClockRateKey();
 
     /**Get the name of the OpalMediaOption indicating the protocol the format is being used on.
       */
@@ -1004,11 +1070,21 @@ class OpalMediaFormat : public PContainer
 
     /**Set the options on the master format list entry.
        The media format must already be registered. Returns false if not.
+
+       Searches for registered formats use a read only copy of the master
+       list, so this is the way to change a registered format. Changes made
+       directly to the object that was registered may not be seen by searches.
       */
     static bool SetRegisteredMediaFormat(
       const OpalMediaFormat & mediaFormat  ///<  Media format to copy to master list
     );
 
+    /**Get a value that changes whenever a media format is registered, or the
+       options of a registered media format are set. This allows information
+       derived from the master format list to be cached.
+      */
+    static unsigned GetRegistrationSequence();
+
     /**
       * Add a new option to this media format
       */
@@ -1030,6 +1106,25 @@ class OpalMediaFormat : public PContainer
       const PString & name
     ) const { PWaitAndSignal m(_mutex); return m_info == NULL ? NULL : m_info->FindOption(name); }
 
+    /**Versions of the option access functions using an interned key, which
+       avoids comparing strings. Best used with a static key, e.g.
+         static const OpalMediaOptionKey key(OpalAudioFormat::TxFramesPerPacketOption());
+         unsigned frames = mediaFormat.GetOptionInteger(key, 1);
+
+       These do not lock this OpalMediaFormat, only the internal it shares
+       with its copies is safe to read from several threads. A thread should
+       use its own copy of a format that another thread may assign to, which
+       is cheap as the copy shares the internal until it is changed.
+      */
+    bool HasOption(const OpalMediaOptionKey & key) const { return m_info != NULL && m_info->FindOption(key) != NULL; }
+    OpalMediaOption * FindOption(const OpalMediaOptionKey & key) const { return m_info == NULL ? NULL : m_info->FindOption(key); }
+    bool GetOptionValue(const OpalMediaOptionKey & key, PString & value) const { return m_info != NULL && m_info->GetOptionValue(key, value); }
+    bool GetOptionBoolean(const OpalMediaOptionKey & key, bool dflt = PFalse) const { return m_info != NULL && m_info->GetOptionBoolean(key, dflt); }
+    int GetOptionInteger(const OpalMediaOptionKey & key, int dflt = 0) const { return m_info == NULL ? dflt : m_info->GetOptionInteger(key, dflt); }
+    double GetOptionReal(const OpalMediaOptionKey & key, double dflt = 0) const { return m_info == NULL ? dflt : m_info->GetOptionReal(key, dflt); }
+    PINDEX GetOptionEnum(const OpalMediaOptionKey & key, PINDEX dflt = 0) const { return m_info == NULL ? dflt : m_info->GetOptionEnum(key, dflt); }
+    PString GetOptionString(const OpalMediaOptionKey & key, const PString & dflt = PString::Empty()) const { return m_info == NULL ? dflt : m_info->GetOptionString(key, dflt); }
+
     /** Returns PTrue if the media format is valid for the protocol specified
         This allow plugin codecs to customise which protocols they are valid for
         The default implementation returns true unless the protocol is H.323
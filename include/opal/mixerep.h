@@ -0,0 +1,466 @@
+/*
+ * mixerep.h
+ *
+ * Conference mixer EndPoint/Connection.
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifndef OPAL_OPAL_MIXEREP_H
+#define OPAL_OPAL_MIXEREP_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <opal/buildopts.h>
+
+#include <opal/localep.h>
+#include <opal/opalmixer.h>
+#include <codec/silencedetect.h>
+
+#include <map>
+#include <vector>
+
+class OpalMixerConnection;
+class OpalTranscoder;
+
+
+///////////////////////////////////////////////////////////////////////////////
+/**A conference, mixing the audio of every participant connected to it.
+
+   Each frame time the node reads a block of audio from every participant,
+   picks the loudest few as the speakers and mixes only those, once. A
+   speaker hears the mix less its own audio, which is taken back out of the
+   mix rather than mixing everyone else again. Everybody else hears the
+   whole mix, which is encoded once for each codec in use however many
+   participants use that codec.
+
+   Only codecs that keep no state from one frame to the next, PCM-16 and
+   G.711, are shared. A participant switches between the shared encoder and
+   its own as it starts and stops speaking, which would glitch a codec such
+   as G.729 or GSM, so those participants always use their own encoder, fed
+   every frame.
+
+   All audio is 8kHz PCM-16 inside the node. A participant may write and
+   read any format there is a transcoder for to and from PCM-16.
+  */
+class OpalMixerNode : public PObject
+{
+    PCLASSINFO(OpalMixerNode, PObject);
+  public:
+    struct Params {
+      Params(
+        unsigned frameTime = 20,   ///<  Milliseconds of audio mixed at a time
+        unsigned maxSpeakers = 3   ///<  Most participants mixed at once
+      )
+        : m_frameTime(frameTime),
+          m_maxSpeakers(maxSpeakers)
+        { }
+
+      unsigned m_frameTime;    /// Milliseconds of audio mixed at a time
+      unsigned m_maxSpeakers;  /// Most participants mixed at once
+    };
+
+  protected:
+    struct SharedEncoder;
+
+  public:
+    /**A connection to the node. The writer of the participant's audio and
+       the node share a ring of blocks without a lock. Mixed audio is left
+       for the reader, who waits for the node to produce it.
+      */
+    class Participant : public PSmartObject
+    {
+        PCLASSINFO(Participant, PSmartObject);
+      public:
+        Participant(
+          const PString & token,   ///<  Token of the connection
+          PINDEX frameSamples      ///<  Samples mixed at a time
+        );
+        ~Participant();
+
+        /**Set the format of audio written to the node.
+          */
+        bool SetInputFormat(
+          const OpalMediaFormat & format
+        );
+
+        /**Set the format of audio read from the node.
+          */
+        bool SetOutputFormat(
+          const OpalMediaFormat & format
+        );
+
+        /**Write audio from the participant, in the input format. Only one
+           thread may write for a participant.
+          */
+        bool WriteFrame(
+          const RTP_DataFrame & frame
+        );
+
+        /**Read the next mixed frame for the participant, in the output
+           format, waiting up to \p timeout for the node to produce it.
+
+           @return false if there was no frame in time.
+          */
+        bool ReadFrame(
+          RTP_DataFrame & frame,
+          const PTimeInterval & timeout
+        );
+
+        const PString & GetToken() const { return m_token; }
+        const PTimeInterval & GetFrameTime() const { return m_frameTime; }
+        unsigned GetLevel() const { return m_level; }
+        bool IsSpeaking() const { return m_speaking; }
+        bool IsRemoved() const { return m_removed; }
+
+      protected:
+        void DeliverFrame(const BYTE * payload, PINDEX size, DWORD timestamp);
+
+        PString       m_token;
+        PTimeInterval m_frameTime;
+
+        // Writer side
+        PMutex                m_inputMutex;
+        OpalAudioMixerStream  m_input;
+        OpalMediaFormat       m_inputFormat;
+        OpalTranscoder      * m_decoder;
+        RTP_DataFrame         m_decoded;
+
+        // Reader side
+        PMutex          m_outputMutex;
+        OpalMediaFormat m_outputFormat;
+        bool            m_outputChanged;
+        RTP_DataFrame   m_output;
+        bool            m_outputReady;
+        PSyncPoint      m_outputSignal;
+        bool            m_removed;
+
+        // Only used by the node while mixing
+        OpalMediaFormat  m_encoderFormat;
+        OpalTranscoder * m_encoder;
+        RTP_DataFrame    m_encoded;
+        bool             m_encoderOK;
+        SharedEncoder  * m_sharedEncoder;   ///< NULL if the format has state
+        unsigned         m_level;
+        bool             m_speaking;
+
+      friend class OpalMixerNode;
+    };
+
+  /**@name Construction */
+  //@{
+    /**Create a new node.
+      */
+    OpalMixerNode(
+      const PString & name,               ///<  Name of the conference
+      const Params & params = Params()    ///<  Mixing parameters
+    );
+
+    /**Destroy node, stopping its thread.
+      */
+    ~OpalMixerNode();
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Add a participant. The node holds a reference until the participant
+       is removed, the caller may hold another to write and read audio.
+      */
+    PSmartPointer AddParticipant(
+      const PString & token   ///<  Token of the connection
+    );
+
+    /**Remove a participant. A reader waiting for audio is released.
+      */
+    void RemoveParticipant(
+      const PString & token   ///<  Token of the connection
+    );
+
+    /**Mix one frame for every participant.
+       This is called by the node's thread every frame time, once started,
+       but may be called directly instead.
+      */
+    void MixFrame();
+
+    /**Start a thread calling MixFrame() every frame time. This is done
+       when the first participant is added, unless SetAutoStart(false) was
+       called.
+      */
+    void StartThread();
+
+    /**Stop the thread calling MixFrame().
+      */
+    void StopThread();
+  //@}
+
+  /**@name Member variable access */
+  //@{
+    const PString & GetName() const { return m_name; }
+    const Params & GetParams() const { return m_params; }
+    PINDEX GetFrameSamples() const { return m_frameSamples; }
+    PINDEX GetParticipantCount() const;
+
+    /**Indicate if the thread is started when the first participant is
+       added. Default true.
+      */
+    void SetAutoStart(bool autoStart) { m_autoStart = autoStart; }
+
+    /**Get the number of frames mixed and encoded since the node was created.
+      */
+    void GetStatistics(
+      PUInt64 & framesMixed,   ///<  Calls to MixFrame()
+      PUInt64 & encodes        ///<  Frames encoded, for all participants
+    ) const;
+  //@}
+
+  protected:
+    void ThreadMain();
+    bool Encode(OpalTranscoder * transcoder, RTP_DataFrame & output, const BYTE * & payload, PINDEX & size);
+
+    struct SharedEncoder {
+      SharedEncoder() : m_transcoder(NULL), m_output(0), m_payload(NULL), m_size(0), m_frame(0), m_ok(false) { }
+
+      OpalMediaFormat  m_format;
+      OpalTranscoder * m_transcoder;
+      RTP_DataFrame    m_output;
+      const BYTE     * m_payload;
+      PINDEX           m_size;
+      PUInt64          m_frame;
+      bool             m_ok;
+    };
+    typedef std::map<PString, SharedEncoder> SharedEncoderMap;
+
+    PString m_name;
+    Params  m_params;
+    PINDEX  m_frameSamples;
+
+    mutable PMutex             m_mutex;         ///< Held to change participants, and while mixing
+    std::vector<PSmartPointer> m_participants;
+
+    // Reused every frame
+    std::vector<short>  m_samples;
+    std::vector<int>    m_accumulator;
+    std::vector<PINDEX> m_speakers;
+    RTP_DataFrame       m_mixed;
+    SharedEncoderMap    m_sharedEncoders;
+
+    DWORD   m_timestamp;
+    PUInt64 m_framesMixed;
+    PUInt64 m_encodes;
+
+    PMutex    m_threadMutex;
+    PThread * m_thread;
+    bool      m_running;
+    bool      m_autoStart;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/**Conference mixer EndPoint.
+   This class represents an endpoint that mixes the audio of calls to the
+   same conference node, addressed as "mcu:name". A node is created by the
+   first call to it.
+ */
+class OpalMixerEndPoint : public OpalLocalEndPoint
+{
+    PCLASSINFO(OpalMixerEndPoint, OpalLocalEndPoint);
+  public:
+  /**@name Construction */
+  //@{
+    /**Create a new endpoint.
+     */
+    OpalMixerEndPoint(
+      OpalManager & manager,        ///<  Manager of all endpoints.
+      const char * prefix = "mcu"   ///<  Prefix for URL style address strings
+    );
+
+    /**Destroy endpoint, and all its nodes.
+     */
+    ~OpalMixerEndPoint();
+  //@}
+
+  /**@name Overrides from OpalEndPoint */
+  //@{
+    /**Set up a connection to a conference node.
+       The party is of the form "mcu:name", the node is created if it
+       does not exist.
+     */
+    virtual PBoolean MakeConnection(
+      OpalCall & call,           ///<  Owner of connection
+      const PString & party,     ///<  Remote party to call
+      void * userData = NULL,    ///<  Arbitrary data to pass to connection
+      unsigned int options = 0,  ///<  options to pass to conneciton
+      OpalConnection::StringOptions * stringOptions  = NULL
+    );
+
+    /**Get the data formats this endpoint is capable of operating.
+       This is PCM-16 and every 8kHz audio format that can be transcoded to
+       and from it, so a node can encode once for all participants using the
+       same codec.
+      */
+    virtual OpalMediaFormatList GetMediaFormats() const;
+  //@}
+
+  /**@name Overrides from OpalLocalEndPoint */
+  //@{
+    /**Read the next frame mixed for the connection.
+      */
+    virtual bool OnReadMediaFrame(
+      const OpalLocalConnection & connection, ///<  Connection for media
+      const OpalMediaStream & mediaStream,    ///<  Media stream data is required for
+      RTP_DataFrame & frame                   ///<  RTP frame for data
+    );
+
+    /**Pass a frame from the connection to its node.
+      */
+    virtual bool OnWriteMediaFrame(
+      const OpalLocalConnection & connection, ///<  Connection for media
+      const OpalMediaStream & mediaStream,    ///<  Media stream data is required for
+      RTP_DataFrame & frame                   ///<  RTP frame for data
+    );
+
+    /**Media is only exchanged as frames, so returns false to close the
+       stream if the node has no frame for it.
+      */
+    virtual bool OnReadMediaData(
+      const OpalLocalConnection & connection, ///<  Connection for media
+      const OpalMediaStream & mediaStream,    ///<  Media stream data is required for
+      void * data,                            ///<  Data to send
+      PINDEX size,                            ///<  Maximum size of data buffer
+      PINDEX & length                         ///<  Number of bytes placed in buffer
+    );
+  //@}
+
+  /**@name Conference nodes */
+  //@{
+    /**Create a connection to a node.
+       The default implementation is to create a OpalMixerConnection.
+      */
+    virtual OpalMixerConnection * CreateConnection(
+      OpalMixerNode & node, ///<  Node to connect to
+      OpalCall & call,      ///<  Owner of connection
+      void * userData       ///<  Arbitrary data to pass to connection
+    );
+
+    /**Create a node.
+       The default implementation is to create a OpalMixerNode with the
+       parameters from SetNodeParams().
+      */
+    virtual OpalMixerNode * CreateNode(
+      const PString & name  ///<  Name of the conference
+    );
+
+    /**Find a node by name, creating it if \p create is true.
+      */
+    OpalMixerNode * FindNode(
+      const PString & name,  ///<  Name of the conference
+      bool create = false    ///<  Create the node if not found
+    );
+
+    /**Remove a node, if there is nobody left in it. This is done when the
+       last participant is released. The node's thread is stopped before it
+       is deleted.
+      */
+    bool RemoveNode(
+      const PString & name   ///<  Name of the conference
+    );
+
+    /**Set the parameters for nodes created after this call.
+      */
+    void SetNodeParams(const OpalMixerNode::Params & params) { m_nodeParams = params; }
+
+    /**Get the parameters for new nodes.
+      */
+    const OpalMixerNode::Params & GetNodeParams() const { return m_nodeParams; }
+  //@}
+
+  protected:
+    typedef std::map<PString, OpalMixerNode *> NodeMap;
+    PMutex                m_nodesMutex;
+    NodeMap               m_nodes;
+    OpalMixerNode::Params m_nodeParams;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/**Conference mixer connection, a participant in a node.
+ */
+class OpalMixerConnection : public OpalLocalConnection
+{
+    PCLASSINFO(OpalMixerConnection, OpalLocalConnection);
+  public:
+  /**@name Construction */
+  //@{
+    /**Create a new connection to the node.
+     */
+    OpalMixerConnection(
+      OpalCall & call,              ///<  Owner calll for connection
+      OpalMixerEndPoint & endpoint, ///<  Owner endpoint for connection
+      OpalMixerNode & node,         ///<  Node to connect to
+      void * userData               ///<  Arbitrary data to pass to connection
+    );
+
+    /**Destroy connection.
+     */
+    ~OpalMixerConnection();
+  //@}
+
+  /**@name Overrides from OpalConnection */
+  //@{
+    /**Call back for opening a media stream.
+       Tells the participant the format of the stream.
+      */
+    virtual PBoolean OnOpenMediaStream(
+      OpalMediaStream & stream    ///<  New media stream being opened
+    );
+
+    /**Clean up the termination of the connection.
+       Leaves the node, and removes it if this was the last participant.
+      */
+    virtual void OnReleased();
+  //@}
+
+    /**Get the node. This is deleted once the last participant has been
+       released, so is only valid until OnReleased().
+      */
+    OpalMixerNode & GetNode() const { return m_node; }
+
+    /**Get the participant, which remains valid as long as the connection.
+      */
+    OpalMixerNode::Participant * GetParticipant() const { return (OpalMixerNode::Participant *)m_participant.GetObject(); }
+
+  protected:
+    OpalMixerEndPoint & m_endpoint;
+    OpalMixerNode     & m_node;
+    PSmartPointer       m_participant;
+};
+
+
+#endif // OPAL_OPAL_MIXEREP_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
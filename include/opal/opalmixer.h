@@ -39,7 +39,7 @@
 
 #include <opal/buildopts.h>
 
-#include <queue>
+#include <vector>
 
 #include <ptlib/psync.h>
 #include <ptclib/delaychan.h>
@@ -267,13 +267,20 @@ class PMemBuffer
 //       breaks in it. To avoid this, the creation of the output data is triggered 
 //       by whatever thread (write or read) occurs after each 10ms interval
 //
+//  The input streams are kept in fixed size blocks of 10ms, in a ring buffer
+//  per stream that the writer of that stream and the mixer share without a
+//  lock. Mixing uses pre-allocated frames and SIMD kernels where available, so
+//  nothing is allocated per frame once the mixer is running.
+//
 
 /////////////////////////////////////////////////////////////////////////////
 //
 //  define a class that encapsulates an audio stream for the purposes of the mixer
 //
 
-class OpalAudioMixerStream {
+class OpalAudioMixerStream : public PSmartObject
+{
+  PCLASSINFO(OpalAudioMixerStream, PSmartObject);
   public:
     class StreamFrame : public PMemBuffer<PMutex> {
       public:
@@ -287,23 +294,62 @@ class OpalAudioMixerStream {
 
         StreamFrame(const RTP_DataFrame & rtp);
     };
-    typedef std::queue<StreamFrame> StreamFrameQueue_T;
 
-    PMutex mutex;
-    StreamFrameQueue_T frameQueue;
-    StreamFrame frameCache;
-    DWORD cacheTimeStamp;
-    DWORD writtenTimeStamp;
+    /**Create a stream of blocks of the given number of samples. The ring
+       holds \p ringBlocks blocks, which is rounded up to a power of two.
+      */
+    OpalAudioMixerStream(
+      PINDEX blockSamples = 80,
+      PINDEX ringBlocks = 32
+    );
+
+    /**Write PCM-16 samples to the stream, split into blocks. A trailing
+       partial block is padded with silence. If the ring is full, the samples
+       that do not fit are dropped.
+
+       Only one thread may write to a stream, and only one may read from it.
+      */
+    void WriteSamples(
+      const short * samples,
+      PINDEX count,
+      DWORD timestamp
+    );
+
+    /**Write a frame of PCM-16 data to the stream.
+      */
+    void WriteFrame(const StreamFrame & frame);
+
+    /**Read the next block of samples into \p samples, which must be big
+       enough for a block.
+
+       @return false if there is no audio for this block time, and nothing
+       was written to \p samples.
+      */
+    bool ReadSamples(
+      short * samples
+    );
+
+    PINDEX GetBlockSamples() const { return blockSamples; }
+    unsigned GetOverflows() const { return overflows; }
 
-    PBoolean active;
-    PBoolean first;
     unsigned channelNumber;
 
-    OpalAudioMixerStream();
-    void WriteFrame(const StreamFrame & frame);
-    void FillSilence(StreamFrame & retFrame, PINDEX ms);
-    void PopFrame(StreamFrame & retFrame, PINDEX ms);
-    PBoolean ReadFrame(StreamFrame & retFrame, PINDEX ms);
+  protected:
+    PINDEX             blockSamples;
+    PINDEX             ringMask;
+    std::vector<short> ringSamples;     ///< ring of blocks, blockSamples each
+    std::vector<DWORD> ringTimestamps;  ///< timestamp of each block in the ring
+    PAtomicInteger     written;         ///< blocks written, only changed by the writer
+    PAtomicInteger     read;            ///< blocks read, only changed by the reader
+
+    // Writer state
+    DWORD    writtenTimeStamp;
+    unsigned overflows;
+
+    // Reader state
+    DWORD cacheTimeStamp;
+    bool  active;
+    bool  first;
 };
 
 /////////////////////////////////////////////////////////////////////////////
@@ -316,32 +362,121 @@ class OpalAudioMixer
 {
   public:
     typedef std::string Key_T;
-    typedef std::map<Key_T, OpalAudioMixerStream *> StreamInfoMap_T;
-    typedef std::map<Key_T, OpalAudioMixerStream::StreamFrame> MixerPCMMap_T;
 
     class MixerFrame
     {
-      protected:
-        MixerPCMMap_T channelData;
+      public:
+        MixerFrame(PINDEX _frameLength);
 
-        PINDEX frameLengthSamples;
-        mutable PIntArray mixedData;
-        mutable PMutex mutex;
+        /**Clear the frame for reuse, keeping its buffers.
+          */
+        void Clear();
+
+        /**Get the buffer for the next channel's samples. The channel is only
+           part of the frame once InsertChannel() is called.
+          */
+        short * GetChannelBuffer();
+
+        /**Add the samples written to GetChannelBuffer() as a channel.
+          */
+        void InsertChannel(const Key_T & key, unsigned channelNumber);
+
+        void InsertFrame(Key_T key, OpalAudioMixerStream::StreamFrame & frame);
+
+        /**Get the mix of all the channels. The samples remain valid until the
+           frame is cleared.
+          */
+        const short * GetMixedSamples() const;
+
+        /**Get two channels as interleaved stereo, into a buffer of twice the
+           frame length.
+          */
+        bool GetStereoSamples(short * samples) const;
+
+        /**Get the mix of all channels except the one for \p key, into a
+           buffer of the frame length.
+          */
+        bool GetChannelSamples(const Key_T & key, short * samples) const;
 
-      public:
-		MixerFrame(PINDEX _frameLength);
-        void CreateMixedData() const;
         PBoolean GetMixedFrame(OpalAudioMixerStream::StreamFrame & frame) const;
         PBoolean GetStereoFrame(OpalAudioMixerStream::StreamFrame & frame) const;
         PBoolean GetChannelFrame(Key_T key, OpalAudioMixerStream::StreamFrame & frame) const;
-        void InsertFrame(Key_T key, OpalAudioMixerStream::StreamFrame & frame);
-	};
+
+        PINDEX GetFrameLength() const { return frameLengthSamples; }
+        PINDEX GetChannelCount() const { return channelCount; }
+        DWORD GetTimestamp() const { return timestamp; }
+        void SetTimestamp(DWORD ts) { timestamp = ts; }
+
+      protected:
+        void CreateMixedData() const;
+        PINDEX FindChannel(const Key_T & key) const;
+
+        struct Channel {
+          Key_T    key;
+          unsigned channelNumber;
+        };
+
+        PINDEX frameLengthSamples;
+        DWORD  timestamp;
+
+        std::vector<Channel> channels;       ///< grown as needed, then reused
+        PINDEX               channelCount;
+        std::vector<short>   channelSamples; ///< frameLengthSamples per channel
+
+        mutable std::vector<int>   accumulator;
+        mutable std::vector<short> mixedSamples;
+        mutable bool               mixedValid;
+        mutable PMutex             mutex;
+    };
+
+    /**Add PCM-16 samples to 32 bit accumulators. The SIMD level is capped
+       at what OpalGetSIMDLevel() allows, -1 uses the best of those.
+      */
+    static void AccumulateSamples(
+      int * accumulator,
+      const short * samples,
+      PINDEX count,
+      int simdLevel = -1
+    );
+
+    /**Convert accumulators to PCM-16, saturating. If \p exclude is not NULL
+       those samples are taken out of the mix first. The SIMD level is as
+       for AccumulateSamples().
+      */
+    static void SaturateSamples(
+      short * samples,
+      const int * accumulator,
+      const short * exclude,
+      PINDEX count,
+      int simdLevel = -1
+    );
 
   protected:
+    /**Read-only list of streams, sorted by key, replaced as a whole when a
+       stream is added or removed so writers and the mixer need no lock.
+      */
+    class StreamList : public PSmartObject
+    {
+      public:
+        struct Entry {
+          Key_T         key;
+          PSmartPointer stream;
+        };
+        std::vector<Entry> entries;
+
+        OpalAudioMixerStream * Find(const Key_T & key) const;
+    };
+
+    PSmartPointer GetStreams() const;
+    void SetStreams(StreamList * newList);
+
     PINDEX frameLengthMs;                  ///< size of each audio chunk in milliseconds
 
-    PMutex mutex;                          ///< mutex for list of streams and thread handle
-    StreamInfoMap_T streamInfoMap;         ///< list of streams
+    PMutex mutex;                          ///< mutex for reading mixed output and thread handle
+    mutable PMutex streamsMutex;           ///< only held to change or copy streams
+    PSmartPointer streams;                 ///< StreamList of streams
+    const StreamList * volatile activeStreams; ///< streams, for Write() to read without a lock
+    std::vector<PSmartPointer> retiredStreams; ///< replaced lists, kept until RemoveAllStreams()
     unsigned channelNumber;                ///< counter for channels
 
     PBoolean realTime;                         ///< PTrue if realtime mixing
@@ -355,16 +490,31 @@ class OpalAudioMixer
     PTime timeOfNextRead;                  ///< absolute timestamp for next scheduled read
     DWORD outputTimestamp;                 ///< RTP timestamp for output data
 
+    std::vector<MixerFrame *> outputFrames; ///< ring of frames reused for output
+    PINDEX nextOutputFrame;
+
   public:
     OpalAudioMixer(PBoolean realTime = PTrue, PBoolean _pushThread = PTrue);
-    virtual ~OpalAudioMixer() { }
+    virtual ~OpalAudioMixer();
+
+    /**Called with each mixed frame. The frame is reused once the output ring
+       wraps, so must be copied if it is to be kept.
+      */
     virtual PBoolean OnWriteAudio(const MixerFrame &);
     void AddStream(const Key_T & key, OpalAudioMixerStream * stream);
     void RemoveStream(const Key_T & key);
+
+    /**Remove all the streams, and free those removed earlier. Nothing may be
+       in Write() at the time.
+      */
     void RemoveAllStreams();
     void StartThread();
     void ThreadMain();
     void ReadRoutine();
+
+    /**Mix a frame from each stream and pass it to OnWriteAudio(). Called by
+       the push thread, or by the owner when there is none.
+      */
     void WriteMixedFrame();
     PBoolean Write(const Key_T & key, const RTP_DataFrame & rtp);
 };
@@ -41,6 +41,7 @@
 #include <opal/mediastrm.h>
 #include <opal/mediacmd.h>
 #include <codec/ratectl.h>
+#include <rtp/rtp.h>
 
 #include <list>
 
@@ -114,7 +115,7 @@ class OpalMediaPatch : public PObject
        The stream must not be a ReadOnly media stream for the patch to be
        able to write to it.
       */
-    PBoolean AddSink(
+    virtual PBoolean AddSink(
       const OpalMediaStreamPtr & stream            ///< Media stream to add.
     );
 
@@ -122,7 +123,7 @@ class OpalMediaPatch : public PObject
        If the stream is not a sink of this patch then this function does
        nothing.
       */
-    void RemoveSink(
+    virtual void RemoveSink(
       const OpalMediaStreamPtr & stream  ///<  Media stream to remove
     );
 
@@ -142,7 +143,7 @@ class OpalMediaPatch : public PObject
        Use PDECLARE_NOTIFIER(RTP_DataFrame, YourClass, YourFunction) for the
        filter function notifier.
       */
-    void AddFilter(
+    virtual void AddFilter(
       const PNotifier & filter,
       const OpalMediaFormat & stage = OpalMediaFormat()
     );
@@ -218,6 +219,9 @@ class OpalMediaPatch : public PObject
         
     OpalMediaStream & source;
 
+    // Frames used by the sinks transcoders, must be destroyed after sinks
+    RTP_DataFramePool framePool;
+
     class Sink : public PObject {
         PCLASSINFO(Sink, PObject);
       public:
@@ -290,6 +294,75 @@ class OpalPassiveMediaPatch : public OpalMediaPatch
 };
 
 
+#if OPAL_RTP_AGGREGATE
+
+/**Relay Media Patch
+   When the source and the only sink are both RTP streams of the same media
+   format, with no filters, there is nothing for a patch thread to do but
+   copy packets from one socket to the other. This patch does that directly
+   from the RTP reactor threads, reading and writing the packets in batches
+   and leaving the sink session to rewrite the SSRC, sequence number and
+   timestamp as it does for any other sent packet.
+
+   If the patch is not eligible when started, or a filter or another sink
+   is added later, it reverts to being a normal threaded media patch.
+  */
+class OpalRelayMediaPatch : public OpalMediaPatch, public RTP_UDP::RelayHandler
+{
+    PCLASSINFO(OpalRelayMediaPatch, OpalMediaPatch);
+  public:
+  /**@name Construction */
+  //@{
+    OpalRelayMediaPatch(
+      OpalMediaStream & source       ///<  Source media stream
+    );
+
+    ~OpalRelayMediaPatch();
+  //@}
+
+  /**@name Overrides from OpalMediaPatch */
+  //@{
+    virtual void Start();
+    virtual void Close();
+    virtual PBoolean AddSink(const OpalMediaStreamPtr & stream);
+    virtual void RemoveSink(const OpalMediaStreamPtr & stream);
+    virtual void AddFilter(const PNotifier & filter, const OpalMediaFormat & stage = OpalMediaFormat());
+  //@}
+
+  /**@name Overrides from RTP_UDP::RelayHandler */
+  //@{
+    virtual void OnRelayData(RTP_UDP & session, RTP_DataFrame * const * frames, PINDEX count);
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Determine if the two streams could be relayed without a patch thread.
+       Both must be RTP streams on UDP sessions that are attached to an RTP
+       reactor, and have the same media format and payload type.
+      */
+    static bool CanRelay(
+      const OpalMediaStream & source,  ///<  Source media stream
+      const OpalMediaStream & sink     ///<  Sink media stream
+    );
+
+    /**Indicate the patch is currently relaying.
+      */
+    bool IsRelaying() const { return m_relaySession != NULL; }
+  //@}
+
+  protected:
+    bool StartRelay();
+    void StopRelay();
+
+    RTP_UDP  * m_relaySession;   // Source session while relaying
+    RTP_UDP  * m_relaySink;      // Sink session while relaying
+    OpalMediaStreamPtr m_relaySinkStream;
+    PMutex     m_relayMutex;
+};
+
+#endif // OPAL_RTP_AGGREGATE
+
+
 #endif // OPAL_OPAL_PATCH_H
 
 
@@ -0,0 +1,208 @@
+/*
+ * routetable.h
+ *
+ * Compiled call routing table
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifndef OPAL_OPAL_ROUTETABLE_H
+#define OPAL_OPAL_ROUTETABLE_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <opal/buildopts.h>
+
+#include <ptlib/pregex.h>
+
+#include <map>
+#include <vector>
+
+
+///////////////////////////////////////////////////////////////////////////////
+/**This class is a read only form of the OpalManager route table, built
+   when the table changes, that finds the first matching entry without
+   executing every regular expression in turn.
+
+   Each entry pattern is classified when it is added:
+     - Prefix entries are of the usual "proto:.*\tdigits.*" form, with a
+       literal start to the B-party. They are indexed in a trie on that
+       literal, so only those whose prefix the B-party begins with are
+       examined.
+     - Scheme entries are of the form "proto:.*", matching any B-party
+       from an A-party starting with that literal.
+     - Wildcard entries contain nothing but literal characters, '.' and
+       ".*", so are matched without the regular expression engine.
+     - Regex entries need the full regular expression engine.
+
+   Candidates are always tried in table order, so the first entry that the
+   regular expression would have matched is the one found.
+
+   The table is not changed after it is built, so any number of threads may
+   search it at once. The manager replaces it as a whole.
+  */
+class OpalCompiledRouteTable : public PSmartObject
+{
+  PCLASSINFO(OpalCompiledRouteTable, PSmartObject);
+
+  public:
+    enum Kinds {
+      PrefixEntry,
+      SchemeEntry,
+      WildcardEntry,
+      RegexEntry,
+      NumKinds
+    };
+
+  /**@name Construction */
+  //@{
+    /**Create an empty table.
+      */
+    OpalCompiledRouteTable();
+
+    /**Destroy the table.
+      */
+    ~OpalCompiledRouteTable();
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Get the regular expression a route pattern is matched with, including
+       the backward compatible "proto:digits" form.
+      */
+    static PString GetRegularExpression(
+      const PString & pattern   ///< Pattern from route table entry
+    );
+
+    /**Add an entry to the end of the table. This is only used while the
+       table is being built.
+
+       @return false if the pattern could not be compiled.
+      */
+    bool Append(
+      const PString & pattern,      ///< Pattern from route table entry
+      const PString & destination   ///< Destination for the entry
+    );
+
+    /**Find the first entry, at or after the index, that matches the search
+       string of "a_party\tb_party".
+
+       @return true if one was found, the index is set to one past it.
+      */
+    bool Find(
+      const PString & search,   ///< String to match
+      PINDEX & index,           ///< Entry to start at, and next entry
+      PString & destination     ///< Destination of the entry found
+    ) const;
+  //@}
+
+  /**@name Member variable access */
+  //@{
+    /**Get the number of entries in the table.
+      */
+    PINDEX GetSize() const { return m_entries.size(); }
+
+    /**Indicate the table has no entries.
+      */
+    bool IsEmpty() const { return m_entries.empty(); }
+
+    /**Get the number of entries of each kind.
+      */
+    PINDEX GetKindCount(
+      Kinds kind
+    ) const { return m_kindCount[kind]; }
+  //@}
+
+  protected:
+    /**Pattern as a sequence of lower case characters, with these values
+       standing for a '.' and a ".*".
+      */
+    enum {
+      AnyChar = -1,
+      AnySequence = -2
+    };
+    typedef std::vector<int> Wildcard;
+
+    static bool ParseWildcard(const PString & expression, Wildcard & wildcard);
+    static bool MatchWildcard(const Wildcard & wildcard, const char * str, PINDEX length);
+
+    struct Entry
+    {
+      Entry();
+
+      Kinds                m_kind;
+      PString              m_destination;
+      Wildcard             m_wildcard;    // Whole search, if not a regex
+      bool                 m_split;       // Has exactly one literal tab
+      Wildcard             m_aParty;      // Before the tab, if split
+      Wildcard             m_bParty;      // After the tab, if split
+      PString              m_scheme;      // Lower case A-party literal, scheme entries
+      PRegularExpression * m_regex;       // Regex entries only
+    };
+
+    bool Matches(const Entry & entry, const PString & search, PINDEX tab) const;
+
+    struct Node
+    {
+      Node() { }
+      ~Node();
+
+      std::map<char, Node *> m_children;
+      std::vector<PINDEX>    m_entries;
+    };
+
+    std::vector<Entry *> m_entries;
+    std::vector<PINDEX>  m_unindexed;   // Everything but prefix entries
+    Node                 m_root;        // Prefix entries on lower case B-party literal
+    PINDEX               m_kindCount[NumKinds];
+
+  private:
+    OpalCompiledRouteTable(const OpalCompiledRouteTable &) { }
+    void operator=(const OpalCompiledRouteTable &) { }
+};
+
+
+/**Reference to a compiled route table, which is read only once built.
+  */
+class OpalCompiledRouteTablePtr : public PSmartPointer
+{
+  PCLASSINFO(OpalCompiledRouteTablePtr, PSmartPointer);
+
+  public:
+    OpalCompiledRouteTablePtr(
+      OpalCompiledRouteTable * table = NULL  ///< Table to reference, taking ownership
+    ) : PSmartPointer(table) { }
+
+    const OpalCompiledRouteTable * operator->() const { return (const OpalCompiledRouteTable *)object; }
+    const OpalCompiledRouteTable & operator*() const { return *(const OpalCompiledRouteTable *)object; }
+};
+
+
+#endif // OPAL_OPAL_ROUTETABLE_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
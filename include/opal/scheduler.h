@@ -0,0 +1,257 @@
+/*
+ * scheduler.h
+ *
+ * Shared bounded work scheduler
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifndef OPAL_OPAL_SCHEDULER_H
+#define OPAL_OPAL_SCHEDULER_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <opal/buildopts.h>
+
+#include <deque>
+#include <map>
+#include <vector>
+
+
+///////////////////////////////////////////////////////////////////////////////
+/**This class is a bounded pool of worker threads for the short lived jobs
+   that were previously given a thread each, e.g. connection release.
+
+   Each worker has its own queue, posted work is distributed over the queues
+   round robin and a worker that runs out of work of its own takes work from
+   the other queues, so a job stuck behind a slow one is picked up by the
+   next free worker.
+
+   Work may be given a key, all work with the same key is executed in the
+   order it was posted and never concurrently. Work with an empty key is not
+   serialised at all.
+
+   The pool starts with the minimum number of threads and grows, up to the
+   maximum, when work is posted and no worker is idle. Threads are not
+   reclaimed until the scheduler is shut down.
+  */
+class OpalWorkScheduler : public PObject
+{
+  PCLASSINFO(OpalWorkScheduler, PObject);
+
+  protected:
+    class Worker;
+
+  public:
+    /**A job to be executed by the scheduler. It is deleted after it has
+       been run.
+      */
+    class Work
+    {
+      public:
+        Work(
+          const PString & key = PString::Empty()  ///< Serialisation key
+        );
+        virtual ~Work();
+
+        /**Called from a worker thread to do the job.
+          */
+        virtual void Run() = 0;
+
+        /**Get the serialisation key for the job.
+          */
+        const PString & GetKey() const { return m_key; }
+
+      private:
+        PString m_key;
+        PInt64  m_posted;
+
+      friend class OpalWorkScheduler;
+    };
+
+    /**Snapshot of the scheduler counters, for monitoring.
+      */
+    struct Statistics
+    {
+      Statistics();
+
+      unsigned m_threads;         ///< Number of worker threads started
+      unsigned m_idleThreads;     ///< Number of workers waiting for work
+      PUInt64  m_posted;          ///< Total work posted
+      PUInt64  m_executed;        ///< Total work run to completion
+      PUInt64  m_stolen;          ///< Work taken from another worker's queue
+      PUInt64  m_serialised;      ///< Work held back behind the same key
+      unsigned m_queueDepth;      ///< Work posted and not yet started
+      unsigned m_peakQueueDepth;  ///< Highest queue depth seen
+      PUInt64  m_totalLatency;    ///< Sum of microseconds from post to start
+      PUInt64  m_maxLatency;      ///< Longest microseconds from post to start
+      PUInt64  m_totalRunTime;    ///< Sum of microseconds spent running work
+      PUInt64  m_maxRunTime;      ///< Longest microseconds spent running work
+
+      /**Get the average microseconds from post to start.
+        */
+      PUInt64 GetAverageLatency() const { return m_executed > 0 ? m_totalLatency/m_executed : 0; }
+
+      /**Get the average microseconds spent running work.
+        */
+      PUInt64 GetAverageRunTime() const { return m_executed > 0 ? m_totalRunTime/m_executed : 0; }
+    };
+
+  /**@name Construction */
+  //@{
+    /**Create the scheduler, starting the minimum number of threads.
+      */
+    OpalWorkScheduler(
+      unsigned minThreads = 2,                 ///< Threads started immediately
+      unsigned maxThreads = 32,                ///< Limit on number of threads
+      const char * threadName = "Opal Worker"  ///< Prefix for thread names
+    );
+
+    /**Destroy the scheduler, calling Shutdown().
+      */
+    ~OpalWorkScheduler();
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Post work to be executed on a worker thread. The scheduler takes
+       ownership of the object.
+
+       @return false if the scheduler has been shut down, in which case the
+               work is not deleted and the caller must dispose of it.
+      */
+    bool Post(
+      Work * work   ///< Work to execute
+    );
+
+    /**Post a notifier to be executed on a worker thread. The notifier is
+       called with the worker thread as its object, so functions declared
+       with PDECLARE_NOTIFIER(PThread, ...) for PThread::Create() may be used
+       without change.
+
+       @return false if the scheduler has been shut down.
+      */
+    bool Post(
+      const PNotifier & notifier,              ///< Function to call
+      INT extra = 0,                           ///< Extra parameter to function
+      const PString & key = PString::Empty()   ///< Serialisation key
+    );
+
+    /**Stop accepting new work, run everything already posted and stop the
+       worker threads.
+      */
+    void Shutdown();
+  //@}
+
+  /**@name Member variable access */
+  //@{
+    /**Get the limit on the number of worker threads.
+      */
+    unsigned GetMaxThreads() const { return m_workers.capacity(); }
+
+    /**Get a snapshot of the scheduler counters.
+      */
+    void GetStatistics(
+      Statistics & statistics   ///< Counters to fill in
+    ) const;
+  //@}
+
+  protected:
+    typedef std::deque<Work *> WorkQueue;
+
+    class Worker : public PThread
+    {
+      PCLASSINFO(Worker, PThread);
+      public:
+        Worker(OpalWorkScheduler & scheduler, unsigned index, const PString & name);
+
+        virtual void Main();
+
+        void Push(Work * work, bool next);
+        Work * Pop();
+        Work * Steal();
+
+        void GetStatistics(Statistics & statistics) const;
+
+      protected:
+        OpalWorkScheduler & m_scheduler;
+        unsigned            m_index;
+        WorkQueue           m_queue;
+        PMutex              m_mutex;
+
+        PUInt64 m_executed;
+        PUInt64 m_stolen;
+        PUInt64 m_totalLatency;
+        PUInt64 m_maxLatency;
+        PUInt64 m_totalRunTime;
+        PUInt64 m_maxRunTime;
+
+      friend class OpalWorkScheduler;
+    };
+
+    enum { NumKeyStripes = 16 };
+
+    /**Work waiting behind the currently executing work with the same key.
+       A key is in the map only while work for it is queued or running.
+      */
+    struct KeyStripe
+    {
+      std::map<PString, WorkQueue> m_active;
+      PMutex                       m_mutex;
+    };
+
+    KeyStripe & GetKeyStripe(const PString & key);
+    void Enqueue(Work * work, Worker * current);
+    void AddWorker();
+    Work * TakeWork(Worker & worker);
+    void Execute(Worker & worker, Work * work);
+    void OnCompleted(Worker & worker, const PString & key);
+
+    std::vector<Worker *> m_workers;
+    PAtomicInteger        m_workerCount;
+    PAtomicInteger        m_idleCount;
+    PAtomicInteger        m_nextWorker;
+    PMutex                m_workersMutex;
+    PSemaphore            m_available;
+    PReadWriteMutex       m_runningMutex;
+    bool                  m_running;
+    PString               m_threadName;
+
+    KeyStripe m_keyStripes[NumKeyStripes];
+
+    PAtomicInteger m_queueDepth;
+    PINDEX         m_peakQueueDepth;
+    PUInt64        m_posted;
+    PUInt64        m_serialised;
+    PMutex         m_countersMutex;
+};
+
+
+#endif // OPAL_OPAL_SCHEDULER_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,200 @@
+/*
+ * seqlock.h
+ *
+ * Sequence lock for values with a single writer
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifndef OPAL_OPAL_SEQLOCK_H
+#define OPAL_OPAL_SEQLOCK_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <opal/buildopts.h>
+
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+  #define OPAL_SEQLOCK_ATOMIC_BUILTINS 1
+#elif defined(_MSC_VER)
+  #include <intrin.h>
+  #pragma intrinsic(_ReadWriteBarrier)
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+/**A sequence lock. The writer never waits, it makes the sequence number odd
+   while it changes the protected data and even again when it has finished.
+   A reader copies the data and tries again if the sequence number was odd,
+   or changed while it was copying.
+
+   Only one thread may write at a time, if there can be more than one
+   writer they must be serialised by some other means. The protected data
+   must be safe to copy while it is being changed, i.e. plain old data.
+  */
+class OpalSeqLock
+{
+  public:
+    OpalSeqLock()
+      : m_sequence(0)
+    {
+    }
+
+    /**Start changing the protected data.
+      */
+    void BeginWrite()
+    {
+#if OPAL_SEQLOCK_ATOMIC_BUILTINS
+      __atomic_store_n(&m_sequence, m_sequence+1, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+#elif defined(_MSC_VER)
+      // Stores are not reordered on x86, only the compiler needs stopping
+      m_sequence = m_sequence+1;
+      _ReadWriteBarrier();
+#else
+      m_sequence = m_sequence+1;
+      __sync_synchronize();
+#endif
+    }
+
+    /**Finish changing the protected data.
+      */
+    void EndWrite()
+    {
+#if OPAL_SEQLOCK_ATOMIC_BUILTINS
+      __atomic_store_n(&m_sequence, m_sequence+1, __ATOMIC_RELEASE);
+#elif defined(_MSC_VER)
+      _ReadWriteBarrier();
+      m_sequence = m_sequence+1;
+#else
+      __sync_synchronize();
+      m_sequence = m_sequence+1;
+#endif
+    }
+
+    /**Start reading the protected data, waiting for any write in progress.
+       @return sequence number to pass to EndRead().
+      */
+    unsigned BeginRead() const
+    {
+      unsigned spins = 0;
+      for (;;) {
+#if OPAL_SEQLOCK_ATOMIC_BUILTINS
+        unsigned sequence = __atomic_load_n(&m_sequence, __ATOMIC_ACQUIRE);
+#else
+        unsigned sequence = m_sequence;
+  #if defined(_MSC_VER)
+        _ReadWriteBarrier();
+  #else
+        __sync_synchronize();
+  #endif
+#endif
+        if ((sequence&1) == 0)
+          return sequence;
+
+        // The writer may have been preempted, let it run
+        if (++spins > 100)
+          PThread::Yield();
+      }
+    }
+
+    /**Finish reading the protected data.
+       @return false if the data changed while reading, and must be read again.
+      */
+    bool EndRead(unsigned sequence) const
+    {
+#if OPAL_SEQLOCK_ATOMIC_BUILTINS
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      return __atomic_load_n(&m_sequence, __ATOMIC_RELAXED) == sequence;
+#elif defined(_MSC_VER)
+      _ReadWriteBarrier();
+      return m_sequence == sequence;
+#else
+      __sync_synchronize();
+      return m_sequence == sequence;
+#endif
+    }
+
+  protected:
+    volatile unsigned m_sequence;
+};
+
+
+/**A value protected by a sequence lock. The writer changes the value in
+   place between BeginWrite() and EndWrite(), and any thread may take a
+   consistent copy with Get() without ever blocking the writer.
+  */
+template <class T>
+class OpalSeqLocked : public OpalSeqLock
+{
+  public:
+    OpalSeqLocked()
+      : m_value()
+    {
+    }
+
+    /**Start changing the value, only the writer may call this.
+      */
+    T & BeginWrite()
+    {
+      OpalSeqLock::BeginWrite();
+      return m_value;
+    }
+
+    /**Get the value as the writer, no copy or check is needed as only
+       the writer changes it.
+      */
+    const T & GetWriterValue() const { return m_value; }
+
+    /**Get a consistent copy of the value.
+      */
+    void Get(T & value) const
+    {
+      unsigned sequence;
+      do {
+        sequence = BeginRead();
+        value = m_value;
+      } while (!EndRead(sequence));
+    }
+
+    /**Get a consistent copy of the value.
+      */
+    T Get() const
+    {
+      T value;
+      Get(value);
+      return value;
+    }
+
+  protected:
+    T m_value;
+};
+
+
+#endif // OPAL_OPAL_SEQLOCK_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,115 @@
+/*
+ * simd.h
+ *
+ * Run time selection of SIMD versions of media inner loops
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifndef OPAL_OPAL_SIMD_H
+#define OPAL_OPAL_SIMD_H
+
+#include <opal/buildopts.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/* The library is built for the baseline CPU. SIMD versions of inner loops
+   are compiled with per function target attributes, and the caller picks
+   the best one the CPU can run with OpalGetSIMDLevel(). Every version must
+   give the same output as the C one.
+
+   Setting the OPAL_SIMD environment variable to "none" or "sse2" caps the
+   choice, for comparing speed and output against the C code.
+ */
+
+#define OPAL_SIMD_NONE 0
+#define OPAL_SIMD_SSE2 1
+#define OPAL_SIMD_AVX2 2
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+  #define OPAL_SIMD        1
+  #define OPAL_SIMD_AVX2_OK 1
+  #define OPAL_TARGET_SSE2 __attribute__((target("sse2")))
+  #define OPAL_TARGET_AVX2 __attribute__((target("avx2")))
+  #include <immintrin.h>
+#elif defined(_MSC_VER) && _MSC_VER >= 1400 && (defined(_M_X64) || defined(_M_IX86))
+  // No AVX2 intrinsics in the compilers the project files are for
+  #define OPAL_SIMD        1
+  #define OPAL_SIMD_AVX2_OK 0
+  #define OPAL_TARGET_SSE2
+  #include <emmintrin.h>
+  #include <intrin.h>
+#else
+  #define OPAL_SIMD        0
+  #define OPAL_SIMD_AVX2_OK 0
+#endif
+
+
+/**Get the SIMD level to use, OPAL_SIMD_NONE if the library was built
+   without them or the CPU has neither.
+  */
+inline int OpalGetSIMDLevel()
+{
+  static int level = -1;
+  if (level >= 0)
+    return level;
+
+  int cpu = OPAL_SIMD_NONE;
+#if OPAL_SIMD
+#if defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    cpu = OPAL_SIMD_AVX2;
+  else if (__builtin_cpu_supports("sse2"))
+    cpu = OPAL_SIMD_SSE2;
+#else
+  int info[4];
+  __cpuid(info, 1);
+  if (info[3] & (1 << 26))
+    cpu = OPAL_SIMD_SSE2;
+#endif
+
+  const char * cap = getenv("OPAL_SIMD");
+  if (cap != NULL) {
+    if (strcmp(cap, "none") == 0)
+      cpu = OPAL_SIMD_NONE;
+    else if (strcmp(cap, "sse2") == 0 && cpu > OPAL_SIMD_SSE2)
+      cpu = OPAL_SIMD_SSE2;
+  }
+#endif
+
+  // Any thread getting here sets the same value, so no lock is needed
+  level = cpu;
+  return level;
+}
+
+
+#endif // OPAL_OPAL_SIMD_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
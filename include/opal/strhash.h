@@ -0,0 +1,76 @@
+/*
+ * strhash.h
+ *
+ * String hash for sharding tables
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifndef OPAL_OPAL_STRHASH_H
+#define OPAL_OPAL_STRHASH_H
+
+#include <opal/buildopts.h>
+
+#include <ctype.h>
+
+
+/* FNV-1a, for spreading strings over shards and hash buckets, as
+   PString::HashFunction() only has 127 buckets.
+ */
+
+static const DWORD OpalHashBasis = 2166136261U;
+static const DWORD OpalHashPrime = 16777619U;
+
+
+/**Add a value to a hash from OpalStringHash(), for keys that are a string
+   and something else.
+  */
+inline DWORD OpalHashMix(DWORD hash, DWORD value)
+{
+  return (hash ^ value) * OpalHashPrime;
+}
+
+
+/**Hash a nul terminated string, optionally ignoring case.
+  */
+inline DWORD OpalStringHash(const char * str, bool caseless = false)
+{
+  DWORD hash = OpalHashBasis;
+  if (caseless) {
+    for (const char * ptr = str; *ptr != '\0'; ++ptr)
+      hash = OpalHashMix(hash, (BYTE)tolower((BYTE)*ptr));
+  }
+  else {
+    for (const char * ptr = str; *ptr != '\0'; ++ptr)
+      hash = OpalHashMix(hash, (BYTE)*ptr);
+  }
+  return hash;
+}
+
+
+#endif // OPAL_OPAL_STRHASH_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,197 @@
+/*
+ * timerwheel.h
+ *
+ * Shared hierarchical timer wheel
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifndef OPAL_OPAL_TIMERWHEEL_H
+#define OPAL_OPAL_TIMERWHEEL_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <opal/buildopts.h>
+
+#include <vector>
+
+
+///////////////////////////////////////////////////////////////////////////////
+/**This class is a hierarchical timer wheel, allowing very large numbers of
+   timers to be scheduled and cancelled in constant time, and serviced by a
+   small fixed number of threads rather than a thread per timer.
+
+   Timers are distributed over the threads by their address, each thread has
+   its own wheel of four levels of 64 slots, so with the default 1ms
+   resolution the first level covers 64ms, the second about 4 seconds, the
+   third about 4 minutes and the last about 4.6 hours. Longer delays are
+   cascaded through the top level until they are due.
+
+   The OnTimeout() function of a timer is called on one of the wheel threads
+   and should not block for any significant time.
+  */
+class OpalTimerWheel : public PObject
+{
+  PCLASSINFO(OpalTimerWheel, PObject);
+
+  protected:
+    class Shard;
+
+  public:
+    /**A timer that may be placed on the wheel. The owner must make sure the
+       timer is cancelled before it is destroyed.
+      */
+    class Timer
+    {
+      public:
+        Timer();
+        virtual ~Timer();
+
+        /**Called from a wheel thread when the timer expires. The timer is no
+           longer scheduled, and may be rescheduled from within this call.
+          */
+        virtual void OnTimeout() = 0;
+
+        /**Indicate the timer is currently scheduled.
+          */
+        bool IsScheduled() const { return m_shard != NULL; }
+
+      private:
+        Timer  * m_next;
+        Timer  * m_prev;
+        Timer ** m_list;
+        PUInt64  m_expiry;
+        Shard  * m_shard;
+
+      friend class OpalTimerWheel;
+      friend class Shard;
+    };
+
+  /**@name Construction */
+  //@{
+    /**Create the timer wheel, starting the service threads.
+      */
+    OpalTimerWheel(
+      unsigned threadCount = 1,                ///< Number of threads to service wheel
+      const PTimeInterval & resolution = 1,    ///< Resolution of a wheel tick
+      const char * threadName = "Timer Wheel"  ///< Prefix for thread names
+    );
+
+    /**Destroy the wheel, stopping the service threads. Timers still on the
+       wheel are discarded without their OnTimeout() being called.
+      */
+    ~OpalTimerWheel();
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Schedule the timer to expire after the delay. If the timer is already
+       scheduled, it is rescheduled.
+      */
+    void Schedule(
+      Timer & timer,               ///< Timer to schedule
+      const PTimeInterval & delay  ///< Delay before OnTimeout() is called
+    );
+
+    /**Cancel the timer. If wait is true, on return it is guaranteed that
+       OnTimeout() is not being called on another thread for this timer, so
+       it may be deleted. Use false if the caller holds a lock that the
+       OnTimeout() of another timer on the wheel may be waiting for.
+
+       @return true if the timer was scheduled.
+      */
+    bool Cancel(
+      Timer & timer,    ///< Timer to cancel
+      bool wait = true  ///< Wait for any OnTimeout() in progress
+    );
+  //@}
+
+  /**@name Member variable access */
+  //@{
+    /**Get the number of threads servicing the wheel.
+      */
+    unsigned GetThreadCount() const { return m_shards.size(); }
+
+    /**Get the resolution of the wheel.
+      */
+    const PTimeInterval & GetResolution() const { return m_resolution; }
+
+    /**Get the total number of timers currently scheduled.
+      */
+    PINDEX GetTimerCount() const;
+  //@}
+
+  protected:
+    enum {
+      LevelBits     = 6,
+      SlotsPerLevel = 1 << LevelBits,
+      SlotMask      = SlotsPerLevel - 1,
+      NumLevels     = 4
+    };
+
+    class Shard : public PThread
+    {
+      PCLASSINFO(Shard, PThread);
+      public:
+        Shard(OpalTimerWheel & wheel, const PString & name);
+
+        virtual void Main();
+
+        void Schedule(Timer & timer, PInt64 delay);
+        bool Cancel(Timer & timer, bool wait);
+        void Shutdown();
+        PINDEX GetTimerCount() const { return m_count; }
+
+      protected:
+        void Insert(Timer & timer);
+        void Unlink(Timer & timer);
+        PUInt64 GetNowTick() const;
+        void Advance(PUInt64 target);
+
+        OpalTimerWheel & m_wheel;
+        Timer          * m_slots[NumLevels][SlotsPerLevel];
+        Timer          * m_expired;
+        PUInt64          m_currentTick;
+        PINDEX           m_count;
+        bool             m_running;
+        PMutex           m_mutex;
+        PMutex           m_dispatchMutex;
+        PSyncPoint       m_wake;
+    };
+
+    Shard & GetShard(const Timer & timer) const;
+
+    PTimeInterval         m_resolution;
+    PTimeInterval         m_epoch;
+    std::vector<Shard *>  m_shards;
+};
+
+
+#endif // OPAL_OPAL_TIMERWHEEL_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -262,6 +262,44 @@ class OpalTranscoder : public OpalMediaFormatPair
       OpalMediaFormat & intermediateFormat  ///<  Intermediate format that can be used
     );
 
+    /**Find media intermediate formats for a chain of transcoders.
+       This function attempts to find the cheapest sequence of intermediate
+       media formats that will allow a chain of transcoders to be used to get
+       data from the source format to the destination format. Chains of up
+       to four transcoders are considered.
+
+       The cost of a chain is the sum of the CPU cost of each transcoder in
+       it, see SetTranscoderCost(), plus a penalty for every intermediate
+       format that would degrade quality, e.g. a lossy codec or a lower
+       clock rate than both the source and destination.
+
+       The paths between each pair of formats are calculated once and cached
+       until the registered transcoders or media formats change.
+
+       If there is a transcoder that can go directly from the source format to
+       the destination format then the function returns true but the
+       intermediateFormats list is empty.
+
+       Returns false if there is no chain of registered media transcoders that
+       can be used between the two named formats.
+      */
+    static bool FindIntermediateFormats(
+      const OpalMediaFormat & srcFormat,        ///<  Selected source format to be used
+      const OpalMediaFormat & dstFormat,        ///<  Selected destination format to be used
+      OpalMediaFormatList & intermediateFormats ///<  Intermediate formats, in order
+    );
+
+    /**Set the CPU cost of the transcoder between the two formats, as used
+       by FindIntermediateFormats() to select a chain of transcoders. If not
+       set, a decoder is given a cost of 5, an encoder 10 and a transcoder
+       between two raw, or two encoded, formats a cost of 2.
+      */
+    static void SetTranscoderCost(
+      const OpalMediaFormat & srcFormat,    ///<  Source format of transcoder
+      const OpalMediaFormat & dstFormat,    ///<  Destination format of transcoder
+      unsigned cost                         ///<  Relative CPU cost per frame
+    );
+
     /**Get a list of possible destination media formats for the destination.
       */
     static OpalMediaFormatList GetDestinationFormats(
@@ -279,6 +317,17 @@ class OpalTranscoder : public OpalMediaFormatPair
     static OpalMediaFormatList GetPossibleFormats(
       const OpalMediaFormatList & formats    ///<  Destination format list
     );
+
+    /**Indicate a transcoder has been registered with, or removed from, the
+       OpalTranscoderFactory, so paths between formats are recalculated. The
+       plug in codec manager does this, an application registering its own
+       transcoders after start up, or removing any, must also call it.
+      */
+    static void RegistrationChanged();
+
+    /**Get a value that changes whenever RegistrationChanged() is called.
+      */
+    static unsigned GetRegistrationGeneration();
   //@}
 
   /**@name Operations */
@@ -488,6 +537,79 @@ class OpalStreamedTranscoder : public OpalTranscoder
 };
 
 
+///////////////////////////////////////////////////////////////////////////////
+
+/**This class is a transcoder that passes data through a chain of other
+   transcoders, for when there is no pair of transcoders that can get from
+   the input format to the output format.
+  */
+class OpalTranscoderChain : public OpalTranscoder
+{
+    PCLASSINFO(OpalTranscoderChain, OpalTranscoder);
+  public:
+  /**@name Construction */
+  //@{
+    /** Create a chain of transcoders through each of the formats in turn.
+        The first format is the input format and the last is the output format.
+      */
+    OpalTranscoderChain(
+      const OpalMediaFormatList & formats,  ///<  Formats to transcode through
+      const BYTE * instance = NULL,         ///<  Unique instance identifier for transcoders
+      unsigned instanceLen = 0              ///<  Length of instance identifier
+    );
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Indicate all of the transcoders in the chain could be created.
+      */
+    bool IsValid() const { return isValid; }
+
+    /**Get the number of transcoders in the chain.
+      */
+    PINDEX GetStageCount() const { return stages.GetSize(); }
+
+    virtual bool UpdateMediaFormats(
+      const OpalMediaFormat & inputMediaFormat,  ///<  Input media format
+      const OpalMediaFormat & outputMediaFormat  ///<  Output media format
+    );
+    virtual PBoolean ExecuteCommand(
+      const OpalMediaCommand & command    ///<  Command to execute.
+    );
+    virtual PINDEX GetOptimalDataFrameSize(
+      PBoolean input      ///<  Flag for input or output data size
+    ) const;
+    virtual PBoolean ConvertFrames(
+      const RTP_DataFrame & input,  ///<  Input data
+      RTP_DataFrameList & output    ///<  Output data
+    );
+    virtual PBoolean Convert(
+      const RTP_DataFrame & input,  ///<  Input data
+      RTP_DataFrame & output        ///<  Output data
+    );
+    virtual void SetInstanceID(
+      const BYTE * instance,              ///<  Unique instance identifier for transcoder
+      unsigned instanceLen                ///<  Length of instance identifier
+    );
+
+    virtual bool AcceptComfortNoise() const;
+    virtual bool AcceptEmptyPayload() const;
+    virtual bool AcceptOtherPayloads() const;
+
+#if OPAL_STATISTICS
+    virtual void GetStatistics(OpalMediaStatistics & statistics) const;
+#endif
+  //@}
+
+  protected:
+    PDECLARE_NOTIFIER(OpalMediaCommand, OpalTranscoderChain, OnStageCommand);
+
+    PList<OpalTranscoder>    stages;
+    PList<RTP_DataFrameList> stageFrames;
+    bool                     isValid;
+};
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 class Opal_Linear16Mono_PCM : public OpalStreamedTranscoder {
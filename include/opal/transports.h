@@ -753,6 +753,19 @@ class OpalTransport : public PIndirectChannel
       const PBYTEArray & pdu     ///<  Packet to write
     ) = 0;
 
+    /**Write a packet to the specified address.
+       This writes a single PDU to a remote other than the one the transport
+       is connected to, without changing the remote address, so replies to
+       many peers may be sent from several threads at once.
+
+       The default behaviour calls WritePDU(), temporarily setting the remote
+       address under the write mutex if it is not already the same.
+      */
+    virtual PBoolean WritePDUTo(
+      const PBYTEArray & pdu,                ///<  Packet to write
+      const OpalTransportAddress & address   ///<  Address to write packet to
+    );
+
     typedef PBoolean (*WriteConnectCallback)(OpalTransport & transport, void * userData);
 
     /**Write the first packet to the transport, after a connect.
@@ -1078,6 +1091,15 @@ class OpalTransportUDP : public OpalTransportIP
       const PBYTEArray & pdu     ///<  Packet to write
     );
 
+    /**Write a packet to the specified address.
+       This sends directly to the address through the socket bundle, the
+       remote address of the transport is not used or changed.
+      */
+    virtual PBoolean WritePDUTo(
+      const PBYTEArray & pdu,                ///<  Packet to write
+      const OpalTransportAddress & address   ///<  Address to write packet to
+    );
+
     /**Write the first packet to the transport, after a connect.
        This will adjust the transport object and call the callback function,
        possibly multiple times for some transport types.
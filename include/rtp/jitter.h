@@ -105,6 +105,10 @@ class OpalJitterBuffer : public PSafeObject
       */
     DWORD GetJitterTime() const { return currentJitterTime; }
 
+    /**Get maximum delay for jitter buffer.
+      */
+    DWORD GetMaxJitterTime() const { return maxJitterTime; }
+
     /**Get time units.
       */
     unsigned GetTimeUnits() const { return timeUnits; }
@@ -125,10 +129,33 @@ class OpalJitterBuffer : public PSafeObject
       */
     void SetMaxConsecutiveMarkerBits(DWORD max) { maxConsecutiveMarkerBits = max; }
 
-    /**Start jitter thread
+    /**Set the jitter buffer to have frames written to it with WriteData()
+       by whichever thread receives them, rather than creating a thread of
+       its own which calls OnReadPacket(). This must be called before the
+       first Resume().
+      */
+    void SetInlineIngest(bool enable) { inlineIngest = enable; }
+
+    /**Get flag for frames being written via WriteData().
+      */
+    bool IsInlineIngest() const { return inlineIngest; }
+
+    /**Write a received frame into the jitter buffer. This is used instead
+       of OnReadPacket() when SetInlineIngest() has been enabled.
+
+    @return PFalse if the jitter buffer is shutting down. */
+    virtual PBoolean WriteData(
+      const RTP_DataFrame & frame   ///<  Frame received from network
+    );
+
+    /**Start jitter thread, if not using inline ingest.
       */
     virtual void Resume();
 
+    /**Stop the jitter buffer, any subsequent ReadData() calls will fail.
+      */
+    void Shutdown() { shuttingDown = true; }
+
     PDECLARE_NOTIFIER(PThread, OpalJitterBuffer, JitterThreadMain);
 
     PBoolean WaitForTermination(const PTimeInterval & t)
@@ -141,6 +168,13 @@ class OpalJitterBuffer : public PSafeObject
 
     bool IsEmpty() { return jitterBuffer.size() == 0; }
 
+    /**Compare the frames into and out of this jitter buffer with another,
+       as recorded by the analyser. The timestamps, depths and states are
+       compared, but not when they happened. Neither buffer should be in use.
+       Always true if the analyser is not compiled in.
+      */
+    bool HasSameAnalysis(const OpalJitterBuffer & other) const;
+
   protected:
     void Start(unsigned _minJitterTime, unsigned _maxJitterTime);
 
@@ -198,12 +232,17 @@ class OpalJitterBuffer : public PSafeObject
     bool   shuttingDown;
     bool   preBuffering;
     bool   firstReadData;
+    bool   inlineIngest;
+    PBoolean inlineMarkerWarning;
 
     RTP_JitterBufferAnalyser * analyser;
 
     PThread * jitterThread;
     PINDEX    jitterStackSize;
 
+    Entry * GetFreeFrame();
+    void InsertFrame(Entry * frame, PBoolean & markerWarning);
+
     PBoolean Init(Entry * & currentReadFrame, PBoolean & markerWarning);
     PBoolean PreRead(Entry * & currentReadFrame, PBoolean & markerWarning);
     PBoolean OnRead(Entry * & currentReadFrame, PBoolean & markerWarning, PBoolean loop);
@@ -0,0 +1,241 @@
+/*
+ * metrics.h
+ *
+ * Call quality metrics for RTCP extended reports (RFC 3611)
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifndef OPAL_RTP_METRICS_H
+#define OPAL_RTP_METRICS_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <opal/buildopts.h>
+
+
+///////////////////////////////////////////////////////////////////////////////
+/**The burst and gap model of RFC 3611 section 4.7.2. A burst is a run of
+   packets starting and ending with a loss, in which no more than Gmin-1
+   packets in a row were received, the gaps are the rest. A lone loss
+   inside a gap is counted in the gap.
+
+   Also kept are the transitions between received and lost packets, for the
+   burst ratio used by the E-model.
+
+   This is plain data, so it can be held in an OpalSeqLocked value, and
+   zero is the initial state.
+  */
+struct RTP_LossModel
+{
+  enum { Gmin = 16 };  ///< Packets received in a row that end a burst
+
+  /**Report of the model, from the start of the stream.
+    */
+  struct Report {
+    unsigned m_burstDensity;  ///< Fraction of packets lost in bursts, 0 to 255
+    unsigned m_gapDensity;    ///< Fraction of packets lost in gaps, 0 to 255
+    double   m_burstLength;   ///< Average length of a burst in packets
+    double   m_gapLength;     ///< Average length of a gap in packets
+    double   m_burstRatio;    ///< Burst ratio, 1 for random loss, higher if bursty
+  };
+
+  /**Note the arrival of a packet.
+    */
+  void OnReceived()
+  {
+    ++m_received;
+    ++m_sinceLoss;
+    if (m_lastLost) {
+      ++m_toReceived;
+      m_lastLost = false;
+    }
+  }
+
+  /**Note packets missing before the one that just arrived.
+    */
+  void OnLost(
+    unsigned count    ///< Number of consecutive packets lost
+  );
+
+  /**Get the report, including the burst or gap still in progress.
+    */
+  void GetReport(
+    Report & report
+  ) const;
+
+  DWORD m_received;         ///< Packets received
+  DWORD m_lost;             ///< Packets lost
+  DWORD m_toLost;           ///< Received packets followed by a loss
+  DWORD m_toReceived;       ///< Lost packets followed by a received one
+  bool  m_lastLost;         ///< Last packet was lost
+  DWORD m_sinceLoss;        ///< Packets received since the last loss
+  DWORD m_pendingPackets;   ///< Packets in the burst being built
+  DWORD m_pendingLost;      ///< Lost packets in the burst being built
+  DWORD m_burstPackets;     ///< Packets in completed bursts
+  DWORD m_burstLost;        ///< Lost packets in completed bursts
+  DWORD m_bursts;           ///< Completed bursts
+  DWORD m_gapPackets;       ///< Packets in gaps, but those since the last loss
+  DWORD m_gapLost;          ///< Lost packets in gaps
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/**Count of packets by the variation in the time between them, in buckets
+   doubling in width: under 5ms, 5 to 10ms, 10 to 20ms and so on, the last
+   being 320ms and over. Plain data, zero is empty.
+  */
+struct RTP_JitterHistogram
+{
+  enum { Buckets = 8 };
+
+  /**Count a packet.
+    */
+  void Add(
+    DWORD milliseconds    ///< Variation in the time since the previous packet
+  )
+  {
+    unsigned bucket = 0;
+    for (DWORD units = milliseconds/5; units > 0 && bucket < Buckets-1; units >>= 1)
+      ++bucket;
+    ++m_counts[bucket];
+  }
+
+  /**Get the smallest variation, in milliseconds, counted in a bucket.
+    */
+  static unsigned GetBucketStart(unsigned bucket) { return bucket == 0 ? 0 : 5U << (bucket-1); }
+
+  DWORD m_counts[Buckets];
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/**The ITU-T G.107 E-model, with the default values for everything but the
+   codec, the packet loss and the delay, as is usual for estimating call
+   quality from RTP.
+  */
+class RTP_EModel
+{
+  public:
+    /**Get the equipment impairment factor and packet loss robustness of a
+       codec from ITU-T G.113 Appendix I, by RTP payload type. Unknown and
+       dynamic payload types get the values for G.711 with packet loss
+       concealment.
+      */
+    static void GetCodecImpairments(
+      unsigned payloadType, ///< RTP payload type
+      double & Ie,          ///< Equipment impairment factor
+      double & Bpl          ///< Packet loss robustness factor
+    );
+
+    /**Calculate the R factor.
+      */
+    static double GetRFactor(
+      double lossPercent,   ///< Packets lost or discarded, percent
+      double burstRatio,    ///< Burst ratio, 1 for random loss
+      unsigned delay,       ///< One way delay in milliseconds, zero for listening quality
+      double Ie,            ///< Equipment impairment factor
+      double Bpl            ///< Packet loss robustness factor
+    );
+
+    /**Convert an R factor to a mean opinion score, 1 to 4.5, as in G.107
+       Annex B.
+      */
+    static double GetMOS(
+      double rFactor        ///< R factor, 0 to 100
+    );
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/**The VoIP Metrics report block of RFC 3611 section 4.7, with each field in
+   the units it has on the wire. Plain data, so it can be held in an
+   OpalSeqLocked value.
+  */
+struct RTP_VoIPMetrics
+{
+  enum {
+    BlockType   = 7,    ///< Report block type
+    BlockSize   = 36,   ///< Size of the block, including the header
+    Unavailable = 127   ///< Value of the 8 bit metrics that are unavailable
+  };
+
+  /**Set every metric to unavailable, or zero if it has no such value.
+    */
+  void SetUnavailable();
+
+  /**Encode as an RTCP XR report block of BlockSize bytes.
+    */
+  void Encode(
+    BYTE * block    ///< Block to encode into
+  ) const;
+
+  /**Decode an RTCP XR report block.
+     @return false if the block is too short or not a VoIP metrics block.
+    */
+  bool Decode(
+    const BYTE * block,   ///< Block to decode
+    PINDEX size           ///< Bytes available in the block
+  );
+
+  void PrintOn(ostream & strm) const;
+
+  DWORD m_ssrc;                   ///< Source the metrics are for
+  BYTE  m_lossRate;               ///< Fraction of packets lost, 0 to 255
+  BYTE  m_discardRate;            ///< Fraction of packets discarded, late or early
+  BYTE  m_burstDensity;           ///< Fraction of packets lost or discarded in bursts
+  BYTE  m_gapDensity;             ///< Fraction of packets lost or discarded in gaps
+  WORD  m_burstDuration;          ///< Average burst in milliseconds
+  WORD  m_gapDuration;            ///< Average gap in milliseconds
+  WORD  m_roundTripDelay;         ///< Milliseconds, zero if not known
+  WORD  m_endSystemDelay;         ///< Milliseconds, zero if not known
+  signed char m_signalLevel;      ///< dBm0, Unavailable if not known
+  signed char m_noiseLevel;       ///< dBm0, Unavailable if not known
+  BYTE  m_residualEchoReturnLoss; ///< dB, Unavailable if not known
+  BYTE  m_gmin;                   ///< Gmin used for bursts
+  BYTE  m_rFactor;                ///< R factor, 0 to 100, Unavailable if not known
+  BYTE  m_externalRFactor;        ///< R factor of the other network
+  BYTE  m_mosLQ;                  ///< Listening quality MOS times ten
+  BYTE  m_mosCQ;                  ///< Conversational quality MOS times ten
+  BYTE  m_receiverConfig;         ///< Packet loss concealment and jitter buffer
+  WORD  m_jitterNominal;          ///< Jitter buffer delay in milliseconds
+  WORD  m_jitterMaximum;          ///< Current maximum jitter buffer delay
+  WORD  m_jitterAbsoluteMaximum;  ///< Absolute maximum jitter buffer delay
+};
+
+
+inline ostream & operator<<(ostream & strm, const RTP_VoIPMetrics & metrics)
+{
+  metrics.PrintOn(strm);
+  return strm;
+}
+
+
+#endif // OPAL_RTP_METRICS_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
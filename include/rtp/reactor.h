@@ -0,0 +1,169 @@
+/*
+ * reactor.h
+ *
+ * Shared RTP socket reactor
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifndef OPAL_RTP_REACTOR_H
+#define OPAL_RTP_REACTOR_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <opal/buildopts.h>
+
+#if OPAL_RTP_AGGREGATE
+
+#include <opal/timerwheel.h>
+#include <rtp/rtp.h>
+
+#include <map>
+#include <vector>
+
+
+///////////////////////////////////////////////////////////////////////////////
+/**This class aggregates the data and control sockets of many RTP_UDP
+   sessions onto a small, fixed pool of threads, each of which waits on an
+   epoll descriptor. When a socket becomes readable the worker thread reads
+   the PDU and dispatches it to the session via RTP_UDP::OnReactorReadable(),
+   which then queues data frames for the thread calling RTP_UDP::ReadData().
+
+   Both sockets of a session are always owned by the same worker, so RTP and
+   RTCP for a session are never processed concurrently.
+
+   The reactor also has a timer wheel, serviced by the same number of
+   threads, which drives the RTCP report and receive timeouts of attached
+   sessions, as there is no longer a thread per session to do so.
+  */
+class RTP_Reactor : public PObject
+{
+  PCLASSINFO(RTP_Reactor, PObject);
+
+  public:
+  /**@name Construction */
+  //@{
+    /**Create the reactor with the specified number of worker threads.
+      */
+    RTP_Reactor(
+      unsigned threadCount    ///< Number of worker threads to start
+    );
+
+    /**Destroy the reactor, stopping all worker threads. All sessions should
+       have been removed before this is called.
+      */
+    ~RTP_Reactor();
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Add the sockets of the session to the reactor. The session is placed
+       on the worker thread with the fewest sessions.
+
+       @return false if the session sockets could not be added.
+      */
+    bool AddSession(
+      RTP_UDP & session   ///< Session to add
+    );
+
+    /**Remove the sockets of the session from the reactor. On return it is
+       guaranteed that no worker thread is, or will be, dispatching to the
+       session, so it may be safely deleted.
+
+       This must not be called with the session dataMutex held.
+      */
+    void RemoveSession(
+      RTP_UDP & session   ///< Session to remove
+    );
+  //@}
+
+  /**@name Member variable access */
+  //@{
+    /**Get the number of worker threads.
+      */
+    unsigned GetThreadCount() const { return m_workers.size(); }
+
+    /**Get the total number of sessions currently in the reactor.
+      */
+    PINDEX GetSessionCount() const;
+
+    /**Get the timer wheel used for session timeouts.
+      */
+    OpalTimerWheel & GetTimerWheel() { return m_timerWheel; }
+
+    /**Get the pool of frames used for received packets.
+      */
+    RTP_DataFramePool & GetFramePool() { return m_framePool; }
+  //@}
+
+  protected:
+    class Worker : public PThread
+    {
+      PCLASSINFO(Worker, PThread);
+      public:
+        Worker(unsigned index);
+        ~Worker();
+
+        virtual void Main();
+
+        bool IsOpen() const { return m_epoll >= 0; }
+        bool Add(RTP_UDP & session);
+        bool Remove(RTP_UDP & session);
+        PINDEX GetSessionCount() const;
+        void Shutdown();
+
+      protected:
+        bool AddSocket(int handle, PUInt64 registration, bool isControl);
+
+        unsigned          m_index;
+        int               m_epoll;
+        int               m_wakeFd[2];
+        bool              m_running;
+
+        /* Events are tagged with a registration number, never reused, rather
+           than the session pointer, as a session deleted after epoll_wait()
+           returned could have been replaced by a new one at the same address. */
+        std::map<PUInt64, RTP_UDP *> m_registrations;
+        std::map<RTP_UDP *, PUInt64> m_sessions;
+        PUInt64                      m_nextRegistration;
+        mutable PMutex               m_sessionsMutex;
+        PMutex                       m_dispatchMutex;
+    };
+
+    std::vector<Worker *> m_workers;
+    PMutex                m_mutex;
+    OpalTimerWheel        m_timerWheel;
+    RTP_DataFramePool     m_framePool;
+};
+
+
+#endif // OPAL_RTP_AGGREGATE
+
+#endif // OPAL_RTP_REACTOR_H
+
+
+/////////////////////////////////////////////////////////////////////////////
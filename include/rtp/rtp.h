@@ -39,12 +39,24 @@
 #endif
 
 #include <opal/buildopts.h>
+#include <opal/seqlock.h>
+
+#include <rtp/metrics.h>
 
 #include <ptlib/sockets.h>
 #include <ptlib/safecoll.h>
 
+#include <vector>
+
+#if OPAL_RTP_AGGREGATE
+#include <opal/timerwheel.h>
+#endif
+
 
 class RTP_JitterBuffer;
+class RTP_Reactor;
+class RTP_StatisticsRegistry;
+struct RTP_StatisticsRecord;
 class PNatMethod;
 class OpalSecurityMode;
 
@@ -156,6 +168,7 @@ class RTP_DataFrame : public PBYTEArray
 
     PINDEX GetPayloadSize() const { return payloadSize - GetPaddingSize(); }
     PBoolean   SetPayloadSize(PINDEX sz);
+    PINDEX GetPacketSize() const { return GetHeaderSize()+payloadSize; } // Header, payload and padding
     BYTE * GetPayloadPtr()     const { return (BYTE *)(theArray+GetHeaderSize()); }
 
     virtual void PrintOn(ostream & strm) const;
@@ -166,9 +179,157 @@ class RTP_DataFrame : public PBYTEArray
 #if PTRACING
     friend ostream & operator<<(ostream & o, PayloadTypes t);
 #endif
+  friend class RTP_DataFramePool;
 };
 
-PLIST(RTP_DataFrameList, RTP_DataFrame);
+
+/**A pool of RTP data frames, so frames may be reused on the media path
+   without going to the heap for every packet.
+
+   Free frames are kept in size classes, so a frame for a small audio packet
+   does not tie up a buffer big enough for a raw video frame. Frames taken
+   from the pool are ordinary heap allocated RTP_DataFrame objects, so it is
+   always safe to simply delete one rather than return it.
+
+   The pool is thread safe, so a frame may be returned by a different thread
+   to the one that got it, though contention is least when a pool is used by
+   one thread, e.g. one per media patch.
+  */
+class RTP_DataFramePool : public PObject
+{
+  PCLASSINFO(RTP_DataFramePool, PObject);
+
+  public:
+    enum SizeClasses {
+      AudioClass,     ///< Frames up to AudioFrameSize bytes
+      PacketClass,    ///< Frames up to PacketFrameSize bytes, e.g. video packets
+      RawClass,       ///< Larger frames, e.g. raw YUV video
+      NumSizeClasses
+    };
+
+    enum {
+      AudioFrameSize  = 1500,  ///< Enough for typical audio packets
+      PacketFrameSize = 4096,  ///< Enough for any packet, including a video plug in 2048 byte minimum
+      MaxFreeRawFrames = 4     ///< Raw frames are big, so only keep a few
+    };
+
+    /**Create a pool keeping at most maxFreeFrames unused frames in the audio
+       and packet size classes.
+      */
+    RTP_DataFramePool(
+      PINDEX maxFreeFrames = 32   ///< Maximum frames kept per size class
+    );
+
+    /**Delete the pool and all unused frames in it. Frames still in use are
+       not affected, and are deleted in the usual way.
+      */
+    ~RTP_DataFramePool();
+
+    /**Get a frame from the pool, allocating a new one if none is free. The
+       frame has a cleared header, as for a new RTP_DataFrame, but the
+       payload contents are undefined.
+      */
+    RTP_DataFrame * GetFrame(
+      PINDEX payloadSize,     ///< Initial payload size
+      PINDEX bufferSize = 0   ///< Minimum size of buffer for frame
+    );
+
+    /**Return a frame to the pool. If the pool is full, or the frame cannot
+       be reused, e.g. it shares its data with another frame, it is deleted.
+      */
+    void ReleaseFrame(
+      RTP_DataFrame * frame   ///< Frame to return, may be NULL
+    );
+
+    /**Get the size class for a buffer size.
+      */
+    static SizeClasses GetSizeClass(
+      PINDEX bufferSize   ///< Size of buffer including header
+    );
+
+    /**Get number of frames obtained from the pool without an allocation.
+      */
+    unsigned GetHits() const { return m_hits; }
+
+    /**Get number of frames that had to be allocated from the heap.
+      */
+    unsigned GetMisses() const { return m_misses; }
+
+    /**Get number of returned frames that had to be deleted.
+      */
+    unsigned GetDiscards() const { return m_discards; }
+
+    /**Get the number of unused frames in the pool.
+      */
+    PINDEX GetFreeCount() const;
+
+  protected:
+    std::vector<RTP_DataFrame *> m_free[NumSizeClasses];
+    PINDEX                       m_maxFreeFrames;
+    unsigned                     m_hits;
+    unsigned                     m_misses;
+    unsigned                     m_discards;
+    mutable PMutex               m_mutex;
+};
+
+
+/**A list of RTP data frames, which may optionally use a RTP_DataFramePool
+   for the frames it holds. Note that only the Recycle functions return
+   frames to the pool, the usual PList functions delete them.
+  */
+class RTP_DataFrameList : public PList<RTP_DataFrame>
+{
+  PCLASSINFO(RTP_DataFrameList, PList<RTP_DataFrame>);
+
+  protected:
+    RTP_DataFrameList(int dummy, const RTP_DataFrameList * c)
+      : PList<RTP_DataFrame>(dummy, c), m_pool(c->m_pool) { }
+
+  public:
+    RTP_DataFrameList(
+      RTP_DataFramePool * pool = NULL   ///< Pool to use for frames
+    ) : m_pool(pool) { }
+
+    virtual PObject * Clone() const { return new RTP_DataFrameList(0, this); }
+
+    /**Set the pool used by NewFrame() and the Recycle functions.
+      */
+    void SetPool(RTP_DataFramePool * pool) { m_pool = pool; }
+
+    /**Get the pool used by NewFrame() and the Recycle functions.
+      */
+    RTP_DataFramePool * GetPool() const { return m_pool; }
+
+    /**Create a new frame, from the pool if there is one. Note the frame is
+       not added to the list.
+      */
+    RTP_DataFrame * NewFrame(
+      PINDEX payloadSize,     ///< Initial payload size
+      PINDEX bufferSize = 0   ///< Minimum size of buffer for frame
+    );
+
+    /**Remove the frame at the index, returning it to the pool if there is
+       one, otherwise it is deleted.
+      */
+    void RecycleAt(
+      PINDEX index    ///< Index of frame to remove
+    );
+
+    /**Remove all frames, returning them to the pool if there is one,
+       otherwise they are deleted.
+      */
+    void RecycleAll();
+
+    /**Return a frame that is not in the list to the pool if there is one,
+       otherwise it is deleted.
+      */
+    void RecycleFrame(
+      RTP_DataFrame * frame   ///< Frame to return
+    );
+
+  protected:
+    RTP_DataFramePool * m_pool;
+};
 
 
 /**An RTP control frame encapsulation.
@@ -191,7 +352,8 @@ class RTP_ControlFrame : public PBYTEArray
       e_ReceiverReport,
       e_SourceDescription,
       e_Goodbye,
-      e_ApplDefined
+      e_ApplDefined,
+      e_ExtendedReport = 207
     };
 
     unsigned GetPayloadType() const { return (BYTE)theArray[compoundOffset+1]; }
@@ -307,6 +469,20 @@ class OpalMediaStatistics : public PObject
     unsigned m_averageJitter;
     unsigned m_maximumJitter;
 
+    /// Packets by the variation of the time between them, see RTP_JitterHistogram
+    unsigned m_jitterHistogram[RTP_JitterHistogram::Buckets];
+
+    // Loss and quality, as in RFC 3611 VoIP metrics. For the transmitter
+    // these are as last reported by the remote.
+    unsigned m_burstDensity;      ///< Fraction of packets lost in bursts, 0 to 255
+    unsigned m_burstDuration;     ///< Average burst in milliseconds
+    unsigned m_gapDensity;        ///< Fraction of packets lost in gaps, 0 to 255
+    unsigned m_gapDuration;       ///< Average gap in milliseconds
+    unsigned m_roundTripTime;     ///< Milliseconds, zero if not known
+    unsigned m_rFactor;           ///< E-model R factor, 0 to 100, 127 if not known
+    unsigned m_mosListening;      ///< MOS-LQ times ten, 127 if not known
+    unsigned m_mosConversational; ///< MOS-CQ times ten, 127 if not known
+
     // Video
     unsigned m_totalFrames;
     unsigned m_keyFrames;
@@ -465,6 +641,13 @@ class RTP_Session : public PObject
      */
     unsigned GetJitterTimeUnits() const;
 
+    /**Indicate that received packets are written directly into the jitter
+       buffer by the thread receiving them, so the jitter buffer does not
+       need a thread of its own reading from the session.
+       Default behaviour returns false.
+     */
+    virtual bool UseInlineJitterBuffer() const { return false; }
+
     /**Modifies the QOS specifications for this RTP session*/
     virtual PBoolean ModifyQOS(RTP_QOS * )
     { return PFalse; }
@@ -599,6 +782,134 @@ class RTP_Session : public PObject
 
     virtual void OnRxApplDefined(const PString & type, unsigned subtype, DWORD src,
                                  const BYTE * data, PINDEX size);
+
+    /**Callback from the RTP session when an RTCP extended report (RFC 3611)
+       with a VoIP metrics block is received. The metrics are those of the
+       remote receiving our media.
+
+       The default behaviour does nothing.
+      */
+    virtual void OnRxVoIPMetrics(DWORD src, const RTP_VoIPMetrics & metrics);
+  //@}
+
+  /**@name Statistics */
+  //@{
+    /**Statistics of data sent. These are only changed by the thread sending
+       data, and GetSendCounters() may be called from any thread at any time
+       without blocking it.
+      */
+    struct SendCounters {
+      DWORD    m_packets;
+      DWORD    m_octets;           ///< Payload octets
+      DWORD    m_markers;
+      DWORD    m_averageTime;      ///< Milliseconds between packets, over the last interval
+      DWORD    m_maximumTime;
+      DWORD    m_minimumTime;
+
+      // Accumulated over the current txStatisticsInterval
+      unsigned m_intervalCount;
+      DWORD    m_averageTimeAccum;
+      DWORD    m_maximumTimeAccum;
+      DWORD    m_minimumTimeAccum;
+    };
+
+    /**Statistics of data received. These are only changed by the thread
+       receiving data, and GetReceiveCounters() may be called from any
+       thread at any time without blocking it.
+      */
+    struct ReceiveCounters {
+      DWORD    m_packets;
+      DWORD    m_octets;           ///< Payload octets
+      DWORD    m_lost;
+      DWORD    m_outOfOrder;
+      DWORD    m_markers;
+      DWORD    m_averageTime;      ///< Milliseconds between packets, over the last interval
+      DWORD    m_maximumTime;
+      DWORD    m_minimumTime;
+      DWORD    m_jitterLevel;      ///< Average jitter in 1/128 milliseconds
+      DWORD    m_maximumJitterLevel;
+      DWORD    m_baseSequence;     ///< Extended sequence number of first packet
+      DWORD    m_highestSequence;  ///< Highest extended sequence number received
+      BYTE     m_payloadType;      ///< Last payload type received
+
+      RTP_JitterHistogram m_jitterHistogram;
+      RTP_LossModel       m_lossModel;
+
+      // Accumulated over the current rxStatisticsInterval
+      unsigned m_intervalCount;
+      DWORD    m_averageTimeAccum;
+      DWORD    m_maximumTimeAccum;
+      DWORD    m_minimumTimeAccum;
+      DWORD    m_lastTransitTime;
+    };
+
+    /**Get a consistent copy of the statistics of data sent.
+      */
+    SendCounters GetSendCounters() const { return m_sendCounters.Get(); }
+
+    /**Get a consistent copy of the statistics of data received.
+      */
+    ReceiveCounters GetReceiveCounters() const { return m_receiveCounters.Get(); }
+
+    /**Get the RFC 3611 VoIP metrics for the data received, as sent in
+       extended reports.
+       @return false if nothing has been received.
+      */
+    bool GetVoIPMetrics(
+      RTP_VoIPMetrics & metrics   ///< Metrics for data received
+    ) const;
+
+    /**Get the RFC 3611 VoIP metrics in the last extended report from the
+       remote, which are for the data we send.
+       @return false if no extended report has been received.
+      */
+    bool GetRemoteVoIPMetrics(
+      RTP_VoIPMetrics & metrics   ///< Metrics for data sent
+    ) const;
+
+    /**Get the round trip time, from the last receiver report from the
+       remote for our data.
+       @return milliseconds, zero if not known.
+      */
+    DWORD GetRoundTripTime() const;
+
+    /**Indicate RFC 3611 extended reports are sent with each RTCP report.
+      */
+    bool GetExtendedReports() const { return m_extendedReports; }
+
+    /**Set flag for sending RFC 3611 extended reports, these are sent for
+       audio sessions by default.
+      */
+    void SetExtendedReports(
+      bool enable   ///< Send VoIP metrics in extended reports
+    ) { m_extendedReports = enable; }
+
+#if OPAL_STATISTICS
+    /**Set the registry the statistics of this session are exported from,
+       removing it from any previous registry.
+
+       Whoever deletes the session should remove it first, with a NULL
+       registry. An export makes a virtual call to GetStatisticsRecord(),
+       which is not safe once the destructor of a derived class has begun.
+       The destructors of RTP_UDP and RTP_Session also remove it, but only
+       as a fallback.
+      */
+    void SetStatisticsRegistry(
+      RTP_StatisticsRegistry * registry,  ///< Registry to add to, NULL to remove
+      const PString & label               ///< Label in the registry, e.g. call token
+    );
+
+    /**Get the registry the statistics of this session are exported from.
+      */
+    RTP_StatisticsRegistry * GetStatisticsRegistry() const { return m_statisticsRegistry; }
+
+    /**Get the statistics of the session as exported by the registry. The
+       label is not filled in. This never blocks the media path.
+      */
+    virtual void GetStatisticsRecord(
+      RTP_StatisticsRecord & record   ///< Record to fill in
+    ) const;
+#endif
   //@}
 
   /**@name Member variable access */
@@ -715,27 +1026,27 @@ class RTP_Session : public PObject
 
     /**Get total number of packets sent in session.
       */
-    DWORD GetPacketsSent() const { return packetsSent; }
+    DWORD GetPacketsSent() const { return GetSendCounters().m_packets; }
 
     /**Get total number of octets sent in session.
       */
-    DWORD GetOctetsSent() const { return octetsSent; }
+    DWORD GetOctetsSent() const { return GetSendCounters().m_octets; }
 
     /**Get total number of packets received in session.
       */
-    DWORD GetPacketsReceived() const { return packetsReceived; }
+    DWORD GetPacketsReceived() const { return GetReceiveCounters().m_packets; }
 
     /**Get total number of octets received in session.
       */
-    DWORD GetOctetsReceived() const { return octetsReceived; }
+    DWORD GetOctetsReceived() const { return GetReceiveCounters().m_octets; }
 
     /**Get total number received packets lost in session.
       */
-    DWORD GetPacketsLost() const { return packetsLost; }
+    DWORD GetPacketsLost() const { return GetReceiveCounters().m_lost; }
 
     /**Get total number of packets received out of order in session.
       */
-    DWORD GetPacketsOutOfOrder() const { return packetsOutOfOrder; }
+    DWORD GetPacketsOutOfOrder() const { return GetReceiveCounters().m_outOfOrder; }
 
     /**Get total number received packets too late to go into jitter buffer.
       */
@@ -749,60 +1060,60 @@ class RTP_Session : public PObject
        This is averaged over the last txStatisticsInterval packets and is in
        milliseconds.
       */
-    DWORD GetAverageSendTime() const { return averageSendTime; }
+    DWORD GetAverageSendTime() const { return GetSendCounters().m_averageTime; }
 
     /**Get the number of marker packets received this session.
        This can be used to find out the number of frames received in a video
        RTP stream.
       */
-    DWORD GetMarkerRecvCount() const { return markerRecvCount; }
+    DWORD GetMarkerRecvCount() const { return GetReceiveCounters().m_markers; }
 
     /**Get the number of marker packets sent this session.
        This can be used to find out the number of frames sent in a video
        RTP stream.
       */
-    DWORD GetMarkerSendCount() const { return markerSendCount; }
+    DWORD GetMarkerSendCount() const { return GetSendCounters().m_markers; }
 
     /**Get maximum time between sent packets.
        This is over the last txStatisticsInterval packets and is in
        milliseconds.
       */
-    DWORD GetMaximumSendTime() const { return maximumSendTime; }
+    DWORD GetMaximumSendTime() const { return GetSendCounters().m_maximumTime; }
 
     /**Get minimum time between sent packets.
        This is over the last txStatisticsInterval packets and is in
        milliseconds.
       */
-    DWORD GetMinimumSendTime() const { return minimumSendTime; }
+    DWORD GetMinimumSendTime() const { return GetSendCounters().m_minimumTime; }
 
     /**Get average time between received packets.
        This is averaged over the last rxStatisticsInterval packets and is in
        milliseconds.
       */
-    DWORD GetAverageReceiveTime() const { return averageReceiveTime; }
+    DWORD GetAverageReceiveTime() const { return GetReceiveCounters().m_averageTime; }
 
     /**Get maximum time between received packets.
        This is over the last rxStatisticsInterval packets and is in
        milliseconds.
       */
-    DWORD GetMaximumReceiveTime() const { return maximumReceiveTime; }
+    DWORD GetMaximumReceiveTime() const { return GetReceiveCounters().m_maximumTime; }
 
     /**Get minimum time between received packets.
        This is over the last rxStatisticsInterval packets and is in
        milliseconds.
       */
-    DWORD GetMinimumReceiveTime() const { return minimumReceiveTime; }
+    DWORD GetMinimumReceiveTime() const { return GetReceiveCounters().m_minimumTime; }
 
     /**Get averaged jitter time for received packets.
        This is the calculated statistical variance of the interarrival
        time of received packets in milliseconds.
       */
-    DWORD GetAvgJitterTime() const { return jitterLevel>>7; }
+    DWORD GetAvgJitterTime() const { return GetReceiveCounters().m_jitterLevel>>7; }
 
     /**Get averaged jitter time for received packets.
        This is the maximum value of jitterLevel for the session.
       */
-    DWORD GetMaxJitterTime() const { return maximumJitterLevel>>7; }
+    DWORD GetMaxJitterTime() const { return GetReceiveCounters().m_maximumJitterLevel>>7; }
   //@}
 
   /**@name Functions added to support RTP aggregation */
@@ -855,6 +1166,8 @@ class RTP_Session : public PObject
     virtual void SendBYE();
     void AddReceiverReport(RTP_ControlFrame::ReceiverReport & receiver);
     PBoolean InsertReportPacket(RTP_ControlFrame & report);
+    void InsertExtendedReport(RTP_ControlFrame & report);
+    void OnRxReportBlocks(const RTP_ControlFrame & frame, PINDEX offset);
 
     PString             m_encoding;
     PMutex              m_encodingMutex;
@@ -885,7 +1198,6 @@ class RTP_Session : public PObject
     WORD          expectedSequenceNumber;
     PTimeInterval lastSentPacketTime;
     PTimeInterval lastReceivedPacketTime;
-    WORD          lastRRSequenceNumber;
     PINDEX        consecutiveOutOfOrderPackets;
 
     PMutex        dataMutex;
@@ -894,43 +1206,37 @@ class RTP_Session : public PObject
     DWORD         oobTimeStampOutBase;         // base timestamp value for oob data
     PTimeInterval oobTimeStampBase;            // base time for oob timestamp
 
-    // Statistics
-    DWORD packetsSent;
-    DWORD rtcpPacketsSent;
-    DWORD octetsSent;
-    DWORD packetsReceived;
-    DWORD octetsReceived;
-    DWORD packetsLost;
-    DWORD packetsOutOfOrder;
-    DWORD averageSendTime;
-    DWORD maximumSendTime;
-    DWORD minimumSendTime;
-    DWORD averageReceiveTime;
-    DWORD maximumReceiveTime;
-    DWORD minimumReceiveTime;
-    DWORD jitterLevel;
-    DWORD maximumJitterLevel;
-
-    DWORD markerSendCount;
-    DWORD markerRecvCount;
-
-    unsigned txStatisticsCount;
-    unsigned rxStatisticsCount;
-
-    DWORD    averageSendTimeAccum;
-    DWORD    maximumSendTimeAccum;
-    DWORD    minimumSendTimeAccum;
-    DWORD    averageReceiveTimeAccum;
-    DWORD    maximumReceiveTimeAccum;
-    DWORD    minimumReceiveTimeAccum;
-    DWORD    packetsLostSinceLastRR;
-    DWORD    lastTransitTime;
-    
+    // Statistics, each with one writer and readable by anyone without locking
+    OpalSeqLocked<SendCounters>    m_sendCounters;
+    OpalSeqLocked<ReceiveCounters> m_receiveCounters;
+    DWORD                          rtcpPacketsSent;
+
+    /**What was heard from the remote in RTCP, only changed by the thread
+       receiving control packets.
+      */
+    struct RemoteReports {
+      DWORD           m_roundTripTime;      ///< Milliseconds, zero if not known
+      DWORD           m_lastSenderReport;   ///< Middle of the NTP time in the last SR
+      PInt64          m_lastSenderReportTick; ///< When the last SR arrived, zero if none
+      bool            m_haveMetrics;
+      RTP_VoIPMetrics m_metrics;            ///< Last VoIP metrics for our data
+    };
+    OpalSeqLocked<RemoteReports> m_remoteReports;
+
     RTP_DataFrame::PayloadTypes lastReceivedPayloadType;
     PBoolean ignorePayloadTypeChanges;
 
     PMutex reportMutex;
     PTimer reportTimer;
+    DWORD  m_lastReportExpected;  ///< Packets expected at the last receiver report
+    DWORD  m_lastReportLost;      ///< Packets lost at the last receiver report
+    bool   m_extendedReports;
+
+#if OPAL_STATISTICS
+    RTP_StatisticsRegistry * m_statisticsRegistry;
+    PINDEX                   m_statisticsIndex;   ///< Position in the registry, changed by it
+    friend class RTP_StatisticsRegistry;
+#endif
 
     PBoolean closeOnBye;
     PBoolean byeSent;
@@ -1022,6 +1328,139 @@ class RTP_UDP : public RTP_Session
     virtual void Reopen(PBoolean isReading);
   //@}
 
+#if OPAL_RTP_AGGREGATE
+  /**@name Shared reactor support */
+  //@{
+    /**Set the reactor to use for reading this session. This must be called
+       before Open(). If NULL, or the RTP encoding is not plain RTP/AVP, then
+       the session uses its own thread blocked in select() as before.
+      */
+    void SetReactor(
+      RTP_Reactor * reactor   ///< Reactor to attach sockets to on Open()
+    ) { m_reactor = reactor; }
+
+    /**Get the reactor used by this session, if any.
+      */
+    RTP_Reactor * GetReactor() const { return m_reactor; }
+
+    /**Indicate the session is currently being read by the shared reactor.
+      */
+    bool IsReactorAttached() const { return m_reactorAttached; }
+
+    /**Called by a reactor worker thread when the data or control socket is
+       readable. The default behaviour reads the PDU and passes it through
+       OnReceiveData() or OnReceiveControl() as appropriate, then calls
+       OnReactorData() for data frames that are to be processed.
+      */
+    virtual void OnReactorReadable(
+      bool fromDataChannel    ///< Data socket is readable, else control socket
+    );
+
+    /**Called by a reactor worker thread when a data frame has been received
+       and has passed OnReceiveData(). The function takes ownership of the
+       frame. The default behaviour queues the frame and wakes the thread
+       blocked in ReadData().
+      */
+    virtual void OnReactorData(
+      RTP_DataFrame * frame   ///< Received frame
+    );
+
+    /**Called by a timer wheel thread when the RTCP report timer expires for
+       a session attached to the reactor. The default behaviour calls
+       OnReadTimeout() and reschedules the timer.
+      */
+    virtual void OnReactorTimeout();
+
+    /**Indicate the jitter buffer is to be fed from the reactor thread.
+       Returns true if attached to the reactor.
+      */
+    virtual bool UseInlineJitterBuffer() const { return m_reactorAttached; }
+
+    /**Change the RTP encoding. If the session is attached to a reactor and
+       the new encoding is not plain RTP/AVP then the session is detached and
+       reverts to reading via its own thread.
+      */
+    virtual void SetEncoding(const PString & newEncoding);
+  //@}
+
+  /**@name Same codec relay support */
+  //@{
+    /**Receiver of data frames relayed directly from the reactor thread.
+      */
+    class RelayHandler
+    {
+      public:
+        virtual ~RelayHandler() { }
+
+        /**Called by a reactor worker thread with a batch of data frames
+           that have passed OnReceiveData(). The frames belong to the
+           session and are only valid for the duration of the call, though
+           they may be modified, e.g. by WriteRelayData() on another session.
+          */
+        virtual void OnRelayData(
+          RTP_UDP & session,              ///< Session frames were received on
+          RTP_DataFrame * const * frames, ///< Received frames
+          PINDEX count                    ///< Number of frames
+        ) = 0;
+    };
+
+    /**Set the handler for relayed data. When set, and the session is
+       attached to the reactor, received data frames are read in batches and
+       passed to the handler instead of being queued for ReadData().
+
+       Setting NULL waits for any call to the handler in progress, so the
+       handler may be deleted on return. This must not be called from the
+       handler itself.
+
+       @return false if the session cannot relay as it is not attached to a
+               reactor.
+      */
+    bool SetRelayHandler(
+      RelayHandler * handler    ///< Handler for received data, NULL to stop
+    );
+
+    /**Indicate the session is relaying received data to a handler.
+      */
+    bool IsRelaying() const { return m_relayHandler != NULL; }
+
+    /**Write a batch of data frames, usually from the handler of another
+       session. Each frame is passed through OnSendData(), so the SSRC,
+       sequence number and timestamp are rewritten for this session, then
+       all are sent with as few system calls as possible.
+      */
+    bool WriteRelayData(
+      RTP_DataFrame * const * frames, ///< Frames to send
+      PINDEX count                    ///< Number of frames
+    );
+
+    /**Called by WriteRelayData() for a batch of frames about to be sent, as
+       OnSendData() is for one. Frames that are not to be sent are removed
+       from the array, keeping the order of the rest. The default behaviour
+       calls OnSendData() for each frame.
+      */
+    virtual SendReceiveStatus OnSendRelayData(
+      RTP_DataFrame ** frames,  ///< Frames to send
+      PINDEX & count            ///< Number of frames, updated
+    );
+
+    enum {
+      RelayFrameSize   = 2048, ///< Largest packet the reactor reads for relaying
+      RelayTrailerSize = 32    ///< Room left after it, so OnSendRelayData() can add an SRTP tag in place
+    };
+
+    /**Called by the reactor for a batch of received frames before they are
+       passed to the relay handler, as OnReceiveData() is for one. Frames
+       that are not to be processed are removed from the array, keeping the
+       order of the rest. The default behaviour calls OnReceiveData() for
+       each frame.
+      */
+    virtual SendReceiveStatus OnReceiveRelayData(
+      RTP_DataFrame ** frames,  ///< Received frames
+      PINDEX & count            ///< Number of frames, updated
+    );
+  //@}
+#endif
+
   /**@name Member variable access */
   //@{
     /**Get local address of session.
@@ -1042,6 +1481,15 @@ class RTP_UDP : public RTP_Session
       */
     virtual WORD GetLocalDataPort() const { return localDataPort; }
 
+#if OPAL_STATISTICS
+    /**Get the statistics of the session as exported by the registry,
+       including the local data port.
+      */
+    virtual void GetStatisticsRecord(
+      RTP_StatisticsRecord & record   ///< Record to fill in
+    ) const;
+#endif
+
     /**Get local control port of session.
       */
     virtual WORD GetLocalControlPort() const { return localControlPort; }
@@ -1100,7 +1548,12 @@ class RTP_UDP : public RTP_Session
       PINDEX frameSize,
       PBoolean fromDataChannel
     );
-    
+    SendReceiveStatus CheckReceivedAddress(
+      const PIPSocket::Address & addr,
+      WORD port,
+      PBoolean fromDataChannel
+    );
+
     virtual bool WriteDataPDU(RTP_DataFrame & frame);
     virtual bool WriteDataOrControlPDU(
       const BYTE * framePtr,
@@ -1131,6 +1584,53 @@ class RTP_UDP : public RTP_Session
     bool first;
     int  badTransmitCounter;
     PTime badTransmitStart;
+
+#if OPAL_RTP_AGGREGATE
+    bool AttachReactor();
+    void DetachReactor();
+    void AbortReactor();
+    void ScheduleReactorTimer();
+    PBoolean ReadReactorData(RTP_DataFrame & frame, PBoolean loop);
+    bool ReadRelayData();
+
+    class ReactorTimer : public OpalTimerWheel::Timer
+    {
+      public:
+        ReactorTimer(RTP_UDP & session) : m_session(session) { }
+        virtual void OnTimeout() { m_session.OnReactorTimeout(); }
+      protected:
+        RTP_UDP & m_session;
+    };
+
+    enum { MaxReactorQueueSize = 100, RelayBatchSize = 16 };
+
+    /* Fixed ring of frames from the reactor waiting for the reader, so that
+       queueing a packet never goes to the heap as std::queue would. */
+    class ReactorQueue
+    {
+      public:
+        ReactorQueue() : m_head(0), m_count(0) { }
+        bool empty() const { return m_count == 0; }
+        PINDEX size() const { return m_count; }
+        RTP_DataFrame * front() const { return m_frames[m_head]; }
+        void push(RTP_DataFrame * frame) { m_frames[(m_head+m_count++)%MaxReactorQueueSize] = frame; }
+        void pop() { m_head = (m_head+1)%MaxReactorQueueSize; --m_count; }
+      protected:
+        RTP_DataFrame * m_frames[MaxReactorQueueSize];
+        PINDEX          m_head;
+        PINDEX          m_count;
+    };
+
+    RTP_Reactor                 * m_reactor;
+    bool                          m_reactorAttached;
+    bool                          m_reactorAborted;
+    ReactorQueue                  m_reactorQueue;
+    PMutex                        m_reactorMutex;
+    PSyncPoint                    m_reactorSignal;
+    ReactorTimer                  m_reactorTimer;
+    RelayHandler                * m_relayHandler;
+    PMutex                        m_relayMutex;
+#endif
 };
 
 /////////////////////////////////////////////////////////////////////////////
@@ -47,11 +47,7 @@
 #include <rtp/rtp.h>
 #include <opal/rtpconn.h>
 
-#if OPAL_SRTP
-
-namespace PWLibStupidLinkerHacks {
-  extern int libSRTPLoader;
-};
+#if OPAL_SRTP || OPAL_PTLIB_SSL
 
 ////////////////////////////////////////////////////////////////////
 //
@@ -66,6 +62,10 @@ namespace PWLibStupidLinkerHacks {
 //     NULL_CIPHER_HMAC_SHA1_80
 //     STRONGHOLD
 //
+//  With OpenSSL available these are implemented in-tree, see srtpcrypto.h,
+//  along with AEAD_AES_128_GCM and AEAD_AES_256_GCM, and the libSRTP
+//  versions are registered with the "LibSRTP|" prefix instead.
+//
 
 class OpalSRTPSecurityMode : public OpalSecurityMode
 {
@@ -108,6 +108,15 @@ class OpalSRTP_UDP : public SecureRTP_UDP
     virtual SendReceiveStatus OnReceiveControl(RTP_ControlFrame & frame) = 0;
 };
 
+#endif // OPAL_SRTP || OPAL_PTLIB_SSL
+
+
+#if OPAL_SRTP
+
+namespace PWLibStupidLinkerHacks {
+  extern int libSRTPLoader;
+};
+
 
 ////////////////////////////////////////////////////////////////////
 //
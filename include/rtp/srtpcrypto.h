@@ -0,0 +1,353 @@
+/*
+ * srtpcrypto.h
+ *
+ * SRTP and SRTCP packet protection using OpenSSL
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifndef OPAL_RTP_SRTPCRYPTO_H
+#define OPAL_RTP_SRTPCRYPTO_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <opal/buildopts.h>
+
+#include <rtp/srtp.h>
+
+#if OPAL_PTLIB_SSL
+
+#include <map>
+#include <vector>
+
+namespace PWLibStupidLinkerHacks {
+  extern int nativeSRTPLoader;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/**An SRTP crypto suite, by the name used for it in SDP (RFC 4568, and
+   RFC 7714 for AES-GCM).
+  */
+struct OpalSRTPCryptoSuite
+{
+  enum Ciphers {
+    e_NullCipher,
+    e_AES_CM,
+    e_AES_GCM
+  };
+
+  const char * m_name;          ///< Name of suite, NULL ends the table
+  Ciphers      m_cipher;        ///< Cipher for both SRTP and SRTCP
+  PINDEX       m_keyLength;     ///< Master and session key length in bytes
+  PINDEX       m_saltLength;    ///< Master and session salt length in bytes
+  PINDEX       m_authKeyLength; ///< HMAC-SHA1 session key length, zero if none
+  PINDEX       m_rtpTagLength;  ///< Authentication tag on SRTP packets
+  PINDEX       m_rtcpTagLength; ///< Authentication tag on SRTCP packets
+
+  /**Get the table of suites, ending in an entry with a NULL name.
+    */
+  static const OpalSRTPCryptoSuite * GetSuites();
+
+  /**Find a suite by name.
+     @return NULL if the suite is not known.
+    */
+  static const OpalSRTPCryptoSuite * Find(
+    const PString & name    ///< Name of suite, e.g. "AES_CM_128_HMAC_SHA1_80"
+  );
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/**The SRTP and SRTCP cryptographic context for one direction of a session.
+
+   The session keys are derived once from the master key (RFC 3711 section
+   4.3), and each packet is protected or unprotected in place. For AES-CM
+   the keystream for a whole batch of packets is generated by one call to
+   the cipher, which lets AES-NI work on many blocks at once, and the
+   HMAC-SHA1 key pads are hashed once so each packet costs only its own
+   data. Each SSRC seen has its own rollover counter and a 128 packet replay
+   window, for SRTP and for SRTCP.
+
+   A context is thread safe, the lock is taken once for each batch.
+  */
+class OpalSRTPContext : public PObject
+{
+    PCLASSINFO(OpalSRTPContext, PObject);
+  public:
+    /// Largest batch processed in one go, bigger batches are split up
+    enum { MaxBatchSize = 32 };
+
+    /// Number of packets in the replay window
+    enum { ReplayWindowSize = 128 };
+
+    /**A packet for the raw batch functions.
+      */
+    struct Packet {
+      BYTE * m_data;    ///< Packet, with room for the trailer if protecting
+      PINDEX m_length;  ///< Length of packet, updated on success
+      bool   m_ok;      ///< Set if packet was protected or unprotected
+    };
+
+    struct Statistics {
+      Statistics();
+
+      PUInt64  m_packets;       ///< Packets protected or unprotected
+      PUInt64  m_octets;        ///< Octets of those packets, as given
+      unsigned m_streams;       ///< SSRCs with a rollover counter and window
+      unsigned m_authFailures;  ///< Packets failing authentication
+      unsigned m_replays;       ///< Packets replayed or too old for the window
+      unsigned m_malformed;     ///< Packets too short or not RTP/RTCP
+    };
+
+  /**@name Construction */
+  //@{
+    /**Create a context for the crypto suite. It must be keyed with
+       SetMasterKey() before use.
+      */
+    OpalSRTPContext(
+      const OpalSRTPCryptoSuite & suite   ///< Crypto suite to use
+    );
+
+    /// Destroy context, clearing the keys
+    ~OpalSRTPContext();
+  //@}
+
+  /**@name Keys */
+  //@{
+    /**Set the master key and salt, deriving the session keys. Any rollover
+       counters and replay windows are reset.
+      */
+    bool SetMasterKey(
+      const BYTE * key,   ///< Master key, suite key length
+      const BYTE * salt   ///< Master salt, suite salt length
+    );
+
+    /**Indicate SetMasterKey() has succeeded.
+      */
+    bool IsKeyed() const { return m_rtp != NULL; }
+
+    /**Derive a session key, or salt, from a master key, as in RFC 3711
+       section 4.3.1 with a key derivation rate of zero.
+      */
+    static bool DeriveSessionKey(
+      const OpalSRTPCryptoSuite & suite,  ///< Crypto suite, for key and salt lengths
+      const BYTE * masterKey,             ///< Master key
+      const BYTE * masterSalt,            ///< Master salt
+      BYTE label,                         ///< Label, 0 to 5
+      BYTE * sessionKey,                  ///< Derived key
+      PINDEX length                       ///< Length of derived key
+    );
+
+    /// Get the crypto suite
+    const OpalSRTPCryptoSuite & GetSuite() const { return m_suite; }
+
+    /// Get the number of bytes protection adds to an RTP packet
+    PINDEX GetRTPTrailerSize() const { return m_suite.m_rtpTagLength; }
+
+    /// Get the number of bytes protection adds to an RTCP packet
+    PINDEX GetRTCPTrailerSize() const { return 4 + m_suite.m_rtcpTagLength; }
+  //@}
+
+  /**@name Packets */
+  //@{
+    /**Protect an RTP packet in place. The buffer must have room for
+       GetRTPTrailerSize() bytes after the packet.
+      */
+    bool ProtectRTP(
+      BYTE * packet,      ///< RTP packet
+      PINDEX & length     ///< Length of packet, updated
+    );
+
+    /**Unprotect an SRTP packet in place, checking it is authentic and not a
+       replay.
+      */
+    bool UnprotectRTP(
+      BYTE * packet,      ///< SRTP packet
+      PINDEX & length     ///< Length of packet, updated
+    );
+
+    /**Protect an RTCP packet in place. The buffer must have room for
+       GetRTCPTrailerSize() bytes after the packet.
+      */
+    bool ProtectRTCP(
+      BYTE * packet,      ///< RTCP packet
+      PINDEX & length     ///< Length of packet, updated
+    );
+
+    /**Unprotect an SRTCP packet in place, checking it is authentic and not a
+       replay.
+      */
+    bool UnprotectRTCP(
+      BYTE * packet,      ///< SRTCP packet
+      PINDEX & length     ///< Length of packet, updated
+    );
+
+    /**Protect a batch of RTP packets in place.
+       @return number of packets protected.
+      */
+    PINDEX ProtectRTP(
+      Packet * packets,   ///< Packets to protect
+      PINDEX count        ///< Number of packets
+    );
+
+    /**Unprotect a batch of SRTP packets in place.
+       @return number of packets unprotected.
+      */
+    PINDEX UnprotectRTP(
+      Packet * packets,   ///< Packets to unprotect
+      PINDEX count        ///< Number of packets
+    );
+  //@}
+
+  /**@name Frames */
+  //@{
+    /**Protect an RTP data frame in place, enlarging the frame only if it
+       has no room for the trailer.
+      */
+    bool ProtectRTP(
+      RTP_DataFrame & frame   ///< Frame to protect
+    );
+
+    /**Unprotect an SRTP data frame in place.
+      */
+    bool UnprotectRTP(
+      RTP_DataFrame & frame   ///< Frame to unprotect
+    );
+
+    /**Protect a batch of RTP data frames in place. Frames that could not be
+       protected are removed from the array, keeping the order of the rest.
+       @return number of frames left in the array.
+      */
+    PINDEX ProtectRTP(
+      RTP_DataFrame ** frames,  ///< Frames to protect
+      PINDEX count              ///< Number of frames
+    );
+
+    /**Unprotect a batch of SRTP data frames in place. Frames that are not
+       authentic, or are replays, are removed from the array, keeping the
+       order of the rest.
+       @return number of frames left in the array.
+      */
+    PINDEX UnprotectRTP(
+      RTP_DataFrame ** frames,  ///< Frames to unprotect
+      PINDEX count              ///< Number of frames
+    );
+  //@}
+
+    /**Get the statistics for the context.
+      */
+    Statistics GetStatistics() const;
+
+  protected:
+    struct SessionKeys;
+
+    struct ReplayWindow {
+      ReplayWindow() : m_started(false), m_highest(0) { m_bits[0] = m_bits[1] = 0; }
+
+      bool    m_started;
+      PUInt64 m_highest;  ///< Highest index seen, with bit 0 of m_bits
+      PUInt64 m_bits[2];  ///< Bit n set if index m_highest-n seen
+
+      bool IsReplay(PUInt64 index) const;
+      void Update(PUInt64 index);
+    };
+
+    struct Stream {
+      Stream() : m_rtcpIndex(0) { }
+
+      ReplayWindow m_rtp;       ///< Index is ROC and sequence number
+      ReplayWindow m_rtcp;      ///< Index is SRTCP index
+      DWORD        m_rtcpIndex; ///< Next SRTCP index to send
+    };
+
+    Stream * FindStream(DWORD ssrc);
+    Stream & GetStream(DWORD ssrc);
+    void ProtectBatch(Packet * packets, PINDEX count);
+    void UnprotectBatch(Packet * packets, PINDEX count);
+    BYTE * GetKeyStream(PINDEX blocks);
+
+    const OpalSRTPCryptoSuite & m_suite;
+
+    SessionKeys * m_rtp;
+    SessionKeys * m_rtcp;
+
+    typedef std::map<DWORD, Stream> StreamMap;
+    StreamMap  m_streams;
+    DWORD      m_lastSSRC;
+    Stream   * m_lastStream;
+
+    std::vector<BYTE> m_keyStream;
+    Statistics        m_statistics;
+    PMutex            m_mutex;
+
+  private:
+    OpalSRTPContext(const OpalSRTPContext &);
+    void operator=(const OpalSRTPContext &);
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/**SRTP over UDP using the in-tree OpalSRTPContext, for the security modes
+   registered as "SRTP|<suite>". When relaying, the batches read and written
+   by the reactor are protected and unprotected a batch at a time.
+  */
+class OpalNativeSRTP_UDP : public OpalSRTP_UDP
+{
+  PCLASSINFO(OpalNativeSRTP_UDP, OpalSRTP_UDP);
+  public:
+    OpalNativeSRTP_UDP(
+      const Params & options ///< Parameters to construct with session.
+    );
+
+    PBoolean Open(
+      PIPSocket::Address localAddress,  ///<  Local interface to bind to
+      WORD portBase,                    ///<  Base of ports to search
+      WORD portMax,                     ///<  end of ports to search (inclusive)
+      BYTE ipTypeOfService,             ///<  Type of Service byte
+      PNatMethod * natMethod = NULL,    ///<  NAT traversal method to use createing sockets
+      RTP_QOS * rtpqos = NULL           ///<  QOS spec (or NULL if no QoS)
+    );
+
+    virtual SendReceiveStatus OnSendData   (RTP_DataFrame & frame);
+    virtual SendReceiveStatus OnReceiveData(RTP_DataFrame & frame);
+    virtual SendReceiveStatus OnSendControl(RTP_ControlFrame & frame, PINDEX & len);
+    virtual SendReceiveStatus OnReceiveControl(RTP_ControlFrame & frame);
+
+#if OPAL_RTP_AGGREGATE
+    virtual SendReceiveStatus OnSendRelayData(RTP_DataFrame ** frames, PINDEX & count);
+    virtual SendReceiveStatus OnReceiveRelayData(RTP_DataFrame ** frames, PINDEX & count);
+#endif
+};
+
+
+#endif // OPAL_PTLIB_SSL
+
+#endif // OPAL_RTP_SRTPCRYPTO_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
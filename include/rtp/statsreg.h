@@ -0,0 +1,194 @@
+/*
+ * statsreg.h
+ *
+ * Registry of RTP session statistics for bulk export
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifndef OPAL_RTP_STATSREG_H
+#define OPAL_RTP_STATSREG_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <opal/buildopts.h>
+
+#if OPAL_STATISTICS
+
+#include <rtp/metrics.h>
+
+#include <vector>
+
+
+class RTP_Session;
+
+
+///////////////////////////////////////////////////////////////////////////////
+/**The statistics of one RTP session, as exported in bulk. The layout is
+   fixed, every field is a DWORD in host byte order after the label, so an
+   array of these can be written out and read back as is.
+  */
+struct RTP_StatisticsRecord
+{
+  enum {
+    LabelSize   = 64,   ///< Bytes for the label, including the nul
+    Unavailable = RTP_VoIPMetrics::Unavailable
+  };
+
+  char  m_label[LabelSize];   ///< Call token, nul terminated, truncated to fit
+  DWORD m_sessionID;
+  DWORD m_localPort;          ///< Local RTP data port, zero if not open
+  DWORD m_syncSourceOut;
+  DWORD m_syncSourceIn;
+  DWORD m_packetsSent;
+  DWORD m_octetsSent;
+  DWORD m_packetsReceived;
+  DWORD m_octetsReceived;
+  DWORD m_packetsLost;
+  DWORD m_packetsOutOfOrder;
+  DWORD m_averageJitter;      ///< Milliseconds
+  DWORD m_maximumJitter;      ///< Milliseconds
+  DWORD m_roundTripTime;      ///< Milliseconds, zero if not known
+  DWORD m_jitterHistogram[RTP_JitterHistogram::Buckets];
+  DWORD m_burstDensity;       ///< Fraction of packets lost in bursts, 0 to 255
+  DWORD m_gapDensity;         ///< Fraction of packets lost in gaps, 0 to 255
+  DWORD m_mosListening;       ///< MOS-LQ times ten from loss alone, Unavailable if nothing received
+  DWORD m_remoteRFactor;      ///< R factor the remote reported for our media, or Unavailable
+  DWORD m_remoteMOSListening; ///< MOS-LQ times ten the remote reported, or Unavailable
+  DWORD m_remoteMOSConversational; ///< MOS-CQ times ten the remote reported, or Unavailable
+};
+
+
+/**Header of the binary export, followed by m_count records.
+  */
+struct RTP_StatisticsHeader
+{
+  enum {
+    Magic   = 0x4f505354,   ///< "OPST"
+    Version = 2
+  };
+
+  DWORD m_magic;
+  DWORD m_version;
+  DWORD m_recordSize;       ///< sizeof(RTP_StatisticsRecord)
+  DWORD m_count;            ///< Number of records following
+  PInt64 m_timestamp;       ///< Microseconds since 1970 of the snapshot
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/**Registry of every live RTP session, for exporting the statistics of all
+   of them in one pass. Usually the one in OpalManager is used.
+
+   Sessions are added by OpalRTPConnection when they are created and remove
+   themselves when destroyed. The export copies each session's counters,
+   which are behind a sequence lock, so it never waits for the media path,
+   and it never touches a call or connection, so it cannot hold up
+   signalling. Only the registry's own mutex is held while copying, which
+   delays the adding and removing of sessions by no more than the copy.
+  */
+class RTP_StatisticsRegistry : public PObject
+{
+  PCLASSINFO(RTP_StatisticsRegistry, PObject);
+
+  public:
+  /**@name Construction */
+  //@{
+    RTP_StatisticsRegistry();
+
+    /**Destroy the registry. All sessions should have been removed.
+      */
+    ~RTP_StatisticsRegistry();
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Add a session. This is usually done via
+       RTP_Session::SetStatisticsRegistry(). If the session is already in
+       this registry its label is changed, if it is in another it is removed
+       from that one first.
+
+       The label need not be unique, a call has a session of each ID for
+       every connection, the records are told apart by the local port.
+      */
+    void Add(
+      RTP_Session & session,  ///< Session to add
+      const PString & label   ///< Label for the session, e.g. call token
+    );
+
+    /**Remove a session. On return the registry is guaranteed not to be
+       reading the session, so it may be deleted.
+      */
+    void Remove(
+      RTP_Session & session   ///< Session to remove
+    );
+
+    /**Get a snapshot of the statistics of all sessions.
+      */
+    void GetRecords(
+      std::vector<RTP_StatisticsRecord> & records  ///< Records to fill in
+    ) const;
+
+    /**Export the statistics of all sessions as an RTP_StatisticsHeader
+       followed by the records.
+      */
+    void ExportBinary(
+      PBYTEArray & data       ///< Buffer to fill, reused if large enough
+    ) const;
+
+    /**Export the statistics of all sessions in the Prometheus text
+       exposition format, labelled with the call token, session ID and
+       local port.
+      */
+    void ExportPrometheus(
+      ostream & strm          ///< Stream to write to
+    ) const;
+  //@}
+
+  /**@name Member variable access */
+  //@{
+    /**Get the number of sessions in the registry.
+      */
+    PINDEX GetSessionCount() const;
+  //@}
+
+  protected:
+    struct Entry {
+      RTP_Session * m_session;
+      char          m_label[RTP_StatisticsRecord::LabelSize];
+    };
+    std::vector<Entry> m_entries;
+    PMutex             m_mutex;
+};
+
+
+#endif // OPAL_STATISTICS
+
+#endif // OPAL_RTP_STATSREG_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
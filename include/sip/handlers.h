@@ -48,6 +48,9 @@
 #include <opal/connection.h>
 #include <sip/sippdu.h>
 
+#include <map>
+#include <vector>
+
 
 /* Class to handle SIP REGISTER, SUBSCRIBE, MESSAGE, and renew
  * the 'bindings' before they expire.
@@ -334,21 +337,30 @@ public:
 
 /** This dictionary is used both to contain the active and successful
  * registrations, and subscriptions. 
+ *
+ * As well as the list itself, the handlers are indexed by Call-ID, method
+ * and address of record, method and domain, and authentication user name
+ * and realm, so the Find functions do not have to search every handler
+ * for each incoming PDU. The indexes give candidates which are then
+ * checked exactly as a search of the whole list would.
  */
 class SIPHandlersList
 {
   public:
     /** Append a new handler to the list
       */
-    void Append(SIPHandler * handler)
-      { m_handlersList.Append(handler); }
+    void Append(SIPHandler * handler);
 
     /** Remove a handler from the list.
         Handler is not immediately deleted but marked for deletion later by
         DeleteObjectsToBeRemoved() when all references are done with the handler.
       */
-    void Remove(SIPHandler * handler)
-      { m_handlersList.Remove(handler); }
+    void Remove(SIPHandler * handler);
+
+    /** Update the indexes for a handler whose authentication user name or
+        realm has changed. Does nothing if the handler is not in the list.
+      */
+    void Refresh(SIPHandler * handler);
 
     /** Clean up lists of handler.
       */
@@ -399,7 +411,35 @@ class SIPHandlersList
     PSafePtr <SIPHandler> FindSIPHandlerByDomain(const PString & name, SIP_PDU::Methods meth, PSafetyMode m);
 
   protected:
+    typedef std::vector< PSafePtr<SIPHandler> > Candidates;
+    typedef std::map<PString, std::vector<SIPHandler *> > Index;
+
+    // Keys a handler was indexed under, as user name and realm can change
+    struct IndexKeys {
+      PString m_method;
+      PString m_callID;
+      PString m_addressOfRecord;
+      PString m_domain;
+      PString m_aorUserName;
+      PString m_username;
+      PString m_realm;
+    };
+
+    void AddToIndex(Index & index, const PString & key, SIPHandler * handler);
+    void RemoveFromIndex(Index & index, const PString & key, SIPHandler * handler);
+    void GetCandidates(const Index & index, const PString & key, Candidates & candidates) const;
+
     PSafeList<SIPHandler> m_handlersList;
+
+    mutable PMutex                       m_indexMutex;
+    std::map<SIPHandler *, IndexKeys>    m_indexed;
+    Index                                m_byMethod;
+    Index                                m_byCallID;
+    Index                                m_byAddressOfRecord;
+    Index                                m_byDomain;
+    Index                                m_byAORUserName;
+    Index                                m_byUsername;
+    Index                                m_byRealm;
 };
 
 
@@ -181,6 +181,13 @@ class SIPEndPoint : public OpalRTPEndPoint
         Default behaviour deletes the objects in the connectionsActive list.
       */
     virtual PBoolean GarbageCollection();
+
+    /** Execute garbage collection for only what has been queued since the
+        last call. This reaps the terminated transactions and shuts down
+        the handlers that became unsubscribed, without visiting every
+        handler.
+      */
+    virtual bool CollectQueuedGarbage();
   //@}
 
   /**@name Customisation call backs */
@@ -659,10 +666,40 @@ class SIPEndPoint : public OpalRTPEndPoint
 
     void AddTransaction(
       SIPTransaction * transaction
-    ) { transactions.SetAt(transaction->GetTransactionID(), transaction); }
+    ) { transactions.Add(transaction); }
 
     PSafePtr<SIPTransaction> GetTransaction(const PString & transactionID, PSafetyMode mode = PSafeReadWrite)
-    { return transactions.FindWithLock(transactionID, mode); }
+    { return transactions.Find(transactionID, mode); }
+
+    /**Called by a transaction as it is terminated, so it is removed on the
+       next garbage collection.
+      */
+    void OnTransactionTerminated(
+      SIPTransaction & transaction
+    ) { transactions.OnTerminated(transaction); GetManager().QueueGarbageCollection(*this); }
+
+    /**Called by a handler as it becomes unsubscribed, so it is shut down and
+       removed on the next garbage collection.
+      */
+    void OnHandlerUnsubscribed(
+      SIPHandler & handler
+    );
+
+    /**Get the number of transactions in progress or awaiting removal.
+      */
+    PINDEX GetTransactionCount() const { return transactions.GetSize(); }
+
+    /**Get the timer wheel used for the transaction retry and completion
+       timers.
+      */
+    OpalTimerWheel & GetTransactionTimers() { return m_transactionTimers; }
+
+    /**Called by a handler when its authentication user name or realm has
+       changed, so it is still found by the authentication realm lookup.
+      */
+    void OnHandlerCredentialsChanged(
+      SIPHandler & handler
+    ) { activeSIPHandlers.Refresh(&handler); }
     
     /**Return the next CSEQ for the next transaction.
      */
@@ -803,9 +840,13 @@ class SIPEndPoint : public OpalRTPEndPoint
 
     bool              m_shuttingDown;
     SIPHandlersList   activeSIPHandlers;
+    PMutex               m_unsubscribedHandlersMutex;
+    std::vector<PString> m_unsubscribedHandlers;   // Call-ID's
     PStringToString   m_receivedConnectionTokens;
 
-    PSafeDictionary<PString, SIPTransaction> transactions;
+    // Timers must outlive the transactions that use them
+    OpalTimerWheel      m_transactionTimers;
+    SIPTransactionTable transactions;
 
     PTimer                  natBindingTimer;
     NATBindingRefreshMethod natMethod;
@@ -44,6 +44,9 @@
 #include <ptclib/url.h>
 #include <sip/sdp.h>
 #include <opal/rtpconn.h>
+#include <opal/timerwheel.h>
+
+#include <vector>
 
  
 class OpalTransport;
@@ -246,6 +249,11 @@ class SIPMIMEInfo : public PMIMEInfo
     virtual void PrintOn(ostream & strm) const;
     virtual void ReadFrom(istream & strm);
 
+    /**Convert any headers stored in compact form ("i") to the full form
+       ("Call-ID"), as ReadFrom() does after reading.
+      */
+    void ExpandCompactForms();
+
     void SetCompactForm(bool form) { compactForm = form; }
 
     PCaselessString GetContentType(bool includeParameters = false) const;
@@ -421,6 +429,99 @@ class SIPMIMEInfo : public PMIMEInfo
 };
 
 
+/////////////////////////////////////////////////////////////////////////
+// SIPMessageParser
+
+/**Single pass parser for the start line and headers of a SIP message.
+   The buffer is scanned once, recording where each header line is in
+   place, so nothing is copied until a header is asked for. The results
+   are the same as reading the text with PString and SIPMIMEInfo stream
+   extraction, including folded lines, lines without a colon and repeated
+   headers, but without the per character stream overhead.
+
+   The buffer is not copied, so must remain valid while the parser is in
+   use.
+  */
+class SIPMessageParser
+{
+  public:
+    enum Result {
+      Parsed,         ///< Start line and headers up to the blank line found
+      BadStartLine,   ///< Start line empty or not terminated
+      BadHeaders      ///< Headers not terminated by a blank line
+    };
+
+    SIPMessageParser();
+
+    /**Parse the start line and headers of the message in the buffer.
+       Anything after the blank line ending the headers is the body.
+      */
+    Result Parse(
+      const char * data,    ///<  Message, need not be null terminated
+      PINDEX length         ///<  Length of message
+    );
+
+    /**Get the start line, without the line terminator.
+      */
+    PString GetStartLine() const;
+
+    /**Get the number of header lines, including any without a colon.
+      */
+    PINDEX GetHeaderCount() const { return (PINDEX)m_headers.size(); }
+
+    /**Get the header name and value at the index, with white space trimmed
+       and any continuation lines joined.
+       @return false if the line has no colon, so is not a header.
+      */
+    bool GetHeader(
+      PINDEX index,             ///<  Index of header line
+      PCaselessString & name,   ///<  Header name
+      PString & value           ///<  Header value
+    ) const;
+
+    /**Find the first header with the name, or its compact form.
+       @return index of header, or P_MAX_INDEX if not present.
+      */
+    PINDEX FindHeader(
+      const char * name,        ///<  Full header name, e.g. "Call-ID"
+      char compact = '\0'       ///<  Compact form, e.g. 'i'
+    ) const;
+
+    /**Set all of the headers into the MIME info. Repeated headers are
+       joined by '\n' and compact forms expanded, as SIPMIMEInfo::ReadFrom()
+       does.
+      */
+    void GetMIME(
+      SIPMIMEInfo & mime        ///<  MIME info to add headers to
+    ) const;
+
+    /**Get the offset of the body in the buffer.
+      */
+    PINDEX GetBodyOffset() const { return m_bodyOffset; }
+
+    /**Get the length of the data after the headers, regardless of any
+       Content-Length header.
+      */
+    PINDEX GetBodyLength() const { return m_length - m_bodyOffset; }
+
+  protected:
+    struct Line {
+      PINDEX m_start;   // Offset of first character
+      PINDEX m_end;     // Offset after the last character, before the CR LF
+      PINDEX m_colon;   // Offset of first colon, P_MAX_INDEX if not in the first line
+      bool   m_folded;  // Has continuation lines, m_end is that of the last one
+    };
+
+    PString GetFoldedLine(const Line & line) const;
+
+    const char      * m_data;
+    PINDEX            m_length;
+    PINDEX            m_startLineEnd;
+    PINDEX            m_bodyOffset;
+    std::vector<Line> m_headers;
+};
+
+
 /////////////////////////////////////////////////////////////////////////
 // SIPAuthentication
 
@@ -617,6 +718,7 @@ class SIP_PDU : public PSafeObject
     };
 
 	static const char * GetStatusCodeDescription(int code);
+    static const char * GetMethodName(Methods method);
     friend ostream & operator<<(ostream & strm, StatusCodes status);
 
     enum {
@@ -696,11 +798,23 @@ class SIP_PDU : public PSafeObject
     void AdjustVia(OpalTransport & transport);
     
     /**Read PDU from the specified transport.
+       For a datagram transport the whole PDU is read and decoded in place,
+       for a stream transport the headers are read up to the blank line and
+       then the body according to the Content-Length.
       */
     PBoolean Read(
       OpalTransport & transport
     );
 
+    /**Decode a PDU from a buffer holding the complete message, as would be
+       received in a datagram. The request URI is kept as text and only
+       parsed when GetURI() is first called, which may be from any thread.
+      */
+    bool Decode(
+      const char * data,    ///<  Message, need not be null terminated
+      PINDEX length         ///<  Length of message
+    );
+
     /**Write the PDU to the transport.
       */
     PBoolean Write(
@@ -733,7 +847,7 @@ class SIP_PDU : public PSafeObject
 
     Methods GetMethod() const                { return method; }
     StatusCodes GetStatusCode () const       { return statusCode; }
-    const SIPURL & GetURI() const            { return uri; }
+    const SIPURL & GetURI() const;
     unsigned GetVersionMajor() const         { return versionMajor; }
     unsigned GetVersionMinor() const         { return versionMinor; }
     const PString & GetEntityBody() const    { return entityBody; }
@@ -741,14 +855,26 @@ class SIP_PDU : public PSafeObject
     const PString & GetInfo() const          { return info; }
     const SIPMIMEInfo & GetMIME() const      { return mime; }
           SIPMIMEInfo & GetMIME()            { return mime; }
-    void SetURI(const SIPURL & newuri)       { uri = newuri; }
+    void SetURI(const SIPURL & newuri)       { uri = newuri; m_uriText.MakeEmpty(); }
     SDPSessionDescription * GetSDP();
     void SetSDP(SDPSessionDescription * sdp);
 
   protected:
+    enum DecodeResult {
+      DecodedHeaders,
+      UnreadableStartLine,
+      InvalidStartLine,
+      InvalidMIME
+    };
+    DecodeResult DecodeHeaders(SIPMessageParser & parser, const char * data, PINDEX length);
+    void DecodeBody(const SIPMessageParser & parser, const char * data, PINDEX length);
+    PINDEX GetBodyLength(PINDEX maxLength) const;
+
     Methods     method;                 // Request type, ==NumMethods for Response
     StatusCodes statusCode;
-    SIPURL      uri;                    // display name & URI, no tag
+    mutable SIPURL  uri;                // display name & URI, no tag
+    mutable PString m_uriText;          // Received URI not yet parsed into uri
+    mutable PMutex  m_uriMutex;         // Protects the deferred parse of m_uriText
     unsigned    versionMajor;
     unsigned    versionMinor;
     PString     info;
@@ -891,8 +1017,8 @@ class SIPTransaction : public SIP_PDU
     bool SendPDU(SIP_PDU & pdu);
     bool ResendCANCEL();
 
-    PDECLARE_NOTIFIER(PTimer, SIPTransaction, OnRetry);
-    PDECLARE_NOTIFIER(PTimer, SIPTransaction, OnTimeout);
+    void OnRetry();
+    void OnTimeout();
 
     enum States {
       NotStarted,
@@ -916,16 +1042,116 @@ class SIPTransaction : public SIP_PDU
     PTimeInterval           retryTimeoutMin; 
     PTimeInterval           retryTimeoutMax; 
 
+    /* The RFC3261 timers are all one of two kinds, the retransmit timers
+       A, E and G are the retry timer and the transaction timeouts B, D, F,
+       H, J and K are the completion timer. Both run on the endpoint timer
+       wheel rather than as PTimer, so a registration storm does not load
+       the single PTLib timer list. */
+    class Timer : public OpalTimerWheel::Timer
+    {
+      public:
+        typedef void (SIPTransaction::*Callback)();
+
+        Timer(SIPTransaction & transaction, Callback callback);
+        ~Timer();
+
+        void Start(const PTimeInterval & interval);
+        void Restart() { Start(m_interval); }
+        void Stop(bool wait = true);
+        const PTimeInterval & GetResetTime() const { return m_interval; }
+
+        virtual void OnTimeout();
+
+      protected:
+        SIPTransaction & m_transaction;
+        Callback         m_callback;
+        PTimeInterval    m_interval;
+    };
+
     States     state;
     unsigned   retry;
-    PTimer     retryTimer;
-    PTimer     completionTimer;
+    Timer      retryTimer;
+    Timer      completionTimer;
     PSyncPoint completed;
     PString              m_localInterface;
     OpalTransportAddress m_remoteAddress;
 };
 
 
+/////////////////////////////////////////////////////////////////////////
+// SIPTransactionTable
+
+/** Table of transactions in progress, keyed by transaction ID.
+    The table is split into shards by a hash of the ID, which is mostly the
+    Via branch, each shard being a PSafeDictionary with its own lock. So
+    under a registration storm the lookups for responses and the additions
+    of new transactions rarely contend with each other.
+
+    Transactions are queued for removal as they are terminated, so garbage
+    collection only visits those, rather than scanning every transaction.
+ */
+class SIPTransactionTable : public PObject
+{
+    PCLASSINFO(SIPTransactionTable, PObject);
+  public:
+    SIPTransactionTable(
+      PINDEX shardCount = 64    ///< Number of shards, rounded up to power of two
+    );
+    ~SIPTransactionTable();
+
+    /**Add a transaction, the table takes ownership of it.
+      */
+    void Add(
+      SIPTransaction * transaction
+    );
+
+    /**Find a transaction and lock it.
+      */
+    PSafePtr<SIPTransaction> Find(
+      const PString & transactionID,
+      PSafetyMode mode = PSafeReadWrite
+    ) const;
+
+    /**Remove a transaction, it is deleted by a later ReapTerminated().
+      */
+    bool Remove(
+      const PString & transactionID
+    );
+
+    /**Get any transaction still in the table, NULL if empty.
+      */
+    PSafePtr<SIPTransaction> GetFirst(
+      PSafetyMode mode = PSafeReference
+    ) const;
+
+    /**Queue the transaction for removal by the next ReapTerminated().
+      */
+    void OnTerminated(
+      const SIPTransaction & transaction
+    );
+
+    /**Remove the transactions terminated since the last call, and delete
+       any that are no longer referenced.
+
+       @return true if there are no removed transactions left to delete.
+      */
+    bool ReapTerminated();
+
+    /**Get the total number of transactions in the table.
+      */
+    PINDEX GetSize() const;
+
+  protected:
+    typedef PSafeDictionary<PString, SIPTransaction> Shard;
+    Shard & GetShard(const PString & transactionID) const;
+
+    std::vector<Shard *> m_shards;
+    PINDEX               m_shardMask;
+    std::vector<PString> m_terminated;
+    PMutex               m_terminatedMutex;
+};
+
+
 /////////////////////////////////////////////////////////////////////////
 // SIPInvite
 
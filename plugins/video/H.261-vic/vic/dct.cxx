@@ -85,8 +85,11 @@
  *
  ********/
 
+#include <stdlib.h>
+
 #include "bsd-endian.h"
 #include "dct.h"
+#include "simd.h"
 
 /*
  * Macros for fix-point (integer) arithmetic.  FP_NBITS gives the number
@@ -903,6 +906,534 @@ rdct(register short *bp, u_int m0, u_int m1, u_char* p,
 	}
 }
 
+#if VIC_SIMD
+static int
+vic_cpu_level()
+{
+#if defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return VIC_SIMD_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return VIC_SIMD_SSE2;
+#else
+	int info[4];
+	__cpuid(info, 1);
+	if (info[3] & (1 << 26))
+		return VIC_SIMD_SSE2;
+#endif
+	return VIC_SIMD_NONE;
+}
+#endif
+
+int
+vic_simd_level()
+{
+	static int level = -1;
+	if (level < 0) {
+		int l = VIC_SIMD_NONE;
+#if VIC_SIMD
+		l = vic_cpu_level();
+		const char* cap = getenv("PTLIB_H261_SIMD");
+		if (cap != 0) {
+			if (strcmp(cap, "none") == 0)
+				l = VIC_SIMD_NONE;
+			else if (strcmp(cap, "sse2") == 0 && l > VIC_SIMD_SSE2)
+				l = VIC_SIMD_SSE2;
+		}
+#endif
+		level = l;
+	}
+	return (level);
+}
+
+/*
+ * SIMD versions of the forward DCT and the H.261 inverse DCT.
+ *
+ * These do exactly the same arithmetic as the C code, in the same order,
+ * on a row or column of the block in each lane: SSE2 with the eight lanes
+ * split over two registers, AVX2 with them in one. Both 1-D passes want
+ * the lanes across the block, so it is transposed before, between and
+ * after them. The shortcuts the C code takes for zero coefficients give
+ * the same result as doing the sums in full, so they are not needed.
+ */
+#if VIC_SIMD
+
+static const int dct_simd = vic_simd_level();
+
+/*
+ * Transpose an 8x8 block of 16 bit values, a row in each register.
+ */
+static inline VIC_TARGET_SSE2 void
+transpose8x8_epi16(__m128i* r)
+{
+	__m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+	__m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+	__m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+	__m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+	__m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+	__m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+	__m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+	__m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+
+	__m128i b0 = _mm_unpacklo_epi32(a0, a2);
+	__m128i b1 = _mm_unpackhi_epi32(a0, a2);
+	__m128i b2 = _mm_unpacklo_epi32(a1, a3);
+	__m128i b3 = _mm_unpackhi_epi32(a1, a3);
+	__m128i b4 = _mm_unpacklo_epi32(a4, a6);
+	__m128i b5 = _mm_unpackhi_epi32(a4, a6);
+	__m128i b6 = _mm_unpacklo_epi32(a5, a7);
+	__m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+	r[0] = _mm_unpacklo_epi64(b0, b4);
+	r[1] = _mm_unpackhi_epi64(b0, b4);
+	r[2] = _mm_unpacklo_epi64(b1, b5);
+	r[3] = _mm_unpackhi_epi64(b1, b5);
+	r[4] = _mm_unpacklo_epi64(b2, b6);
+	r[5] = _mm_unpackhi_epi64(b2, b6);
+	r[6] = _mm_unpacklo_epi64(b3, b7);
+	r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+/*
+ * Transpose an 8x8 block of 32 bit values, row k being in lo[k] and hi[k].
+ */
+static inline VIC_TARGET_SSE2 void
+transpose4x4_epi32(__m128i& a, __m128i& b, __m128i& c, __m128i& d)
+{
+	__m128i t0 = _mm_unpacklo_epi32(a, b);
+	__m128i t1 = _mm_unpacklo_epi32(c, d);
+	__m128i t2 = _mm_unpackhi_epi32(a, b);
+	__m128i t3 = _mm_unpackhi_epi32(c, d);
+	a = _mm_unpacklo_epi64(t0, t1);
+	b = _mm_unpackhi_epi64(t0, t1);
+	c = _mm_unpacklo_epi64(t2, t3);
+	d = _mm_unpackhi_epi64(t2, t3);
+}
+
+static inline VIC_TARGET_SSE2 void
+transpose8x8_epi32(__m128i* lo, __m128i* hi)
+{
+	transpose4x4_epi32(lo[0], lo[1], lo[2], lo[3]);
+	transpose4x4_epi32(hi[0], hi[1], hi[2], hi[3]);
+	transpose4x4_epi32(lo[4], lo[5], lo[6], lo[7]);
+	transpose4x4_epi32(hi[4], hi[5], hi[6], hi[7]);
+	for (int k = 0; k < 4; ++k) {
+		__m128i t = hi[k];
+		hi[k] = lo[k + 4];
+		lo[k + 4] = t;
+	}
+}
+
+static inline VIC_TARGET_SSE2 void
+transpose8x8_ps(__m128* lo, __m128* hi)
+{
+	_MM_TRANSPOSE4_PS(lo[0], lo[1], lo[2], lo[3]);
+	_MM_TRANSPOSE4_PS(hi[0], hi[1], hi[2], hi[3]);
+	_MM_TRANSPOSE4_PS(lo[4], lo[5], lo[6], lo[7]);
+	_MM_TRANSPOSE4_PS(hi[4], hi[5], hi[6], hi[7]);
+	for (int k = 0; k < 4; ++k) {
+		__m128 t = hi[k];
+		hi[k] = lo[k + 4];
+		lo[k + 4] = t;
+	}
+}
+
+/*
+ * Load row i of the coefficients, with those not in the mask zeroed
+ * as rdct() never reads them and they need not have been set.
+ */
+static inline VIC_TARGET_SSE2 __m128i
+rdct_load_row(const short* bp, u_int m)
+{
+	const __m128i bits = _mm_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128);
+	m &= 0xff;
+	if (m == 0)
+		return _mm_setzero_si128();
+	__m128i sel = _mm_and_si128(_mm_set1_epi16((short)m), bits);
+	return _mm_and_si128(_mm_loadu_si128((const __m128i*)bp),
+			     _mm_cmpeq_epi16(sel, bits));
+}
+
+/*
+ * Normalise eight rows of results, one column in each register, and
+ * store them, adding the input if there is one.  Saturating to 16 bits
+ * on the way gives the same result as clamping at the end does.
+ */
+static inline VIC_TARGET_SSE2 void
+rdct_store(__m128i* o, u_char* p, int stride, const u_char* in)
+{
+	transpose8x8_epi16(o);
+	const __m128i zero = _mm_setzero_si128();
+	for (int i = 0; i < 8; ++i) {
+		__m128i v = o[i];
+		if (in != 0) {
+			__m128i x = _mm_loadl_epi64((const __m128i*)in);
+			v = _mm_adds_epi16(v, _mm_unpacklo_epi8(x, zero));
+			in += stride;
+		}
+		_mm_storel_epi64((__m128i*)p, _mm_packus_epi16(v, v));
+		p += stride;
+	}
+}
+
+/*
+ * The 1-D inverse transform of rdct() below on eight registers,
+ * t[0] to t[7] being the coefficients in and the values out.
+ */
+#define RDCT_1D(t, V, ADD, SUB, MUL) \
+{ \
+	V t4 = t[1]; \
+	V t5 = t[3]; \
+	V t6 = t[5]; \
+	V t7 = t[7]; \
+	V x0 = SUB(t6, t5); \
+	t6 = ADD(t6, t5); \
+	V x1 = SUB(t4, t7); \
+	t7 = ADD(t7, t4); \
+	t5 = MUL(SUB(t7, t6), A3); \
+	t7 = ADD(t7, t6); \
+	t4 = MUL(ADD(x1, x0), A5); \
+	t6 = SUB(MUL(x1, A4), t4); \
+	t4 = ADD(t4, MUL(x0, A2)); \
+	t7 = ADD(t7, t6); \
+	t6 = ADD(t6, t5); \
+	t5 = ADD(t5, t4); \
+	V t0 = t[0]; \
+	V t1 = t[2]; \
+	V t2 = t[4]; \
+	V t3 = t[6]; \
+	x0 = MUL(SUB(t1, t3), A1); \
+	t3 = ADD(t3, t1); \
+	t1 = SUB(t0, t2); \
+	t0 = ADD(t0, t2); \
+	t2 = ADD(t3, x0); \
+	t3 = SUB(t0, t2); \
+	t0 = ADD(t0, t2); \
+	t2 = SUB(t1, x0); \
+	t1 = ADD(t1, x0); \
+	t[0] = ADD(t0, t7); \
+	t[1] = ADD(t1, t6); \
+	t[2] = ADD(t2, t5); \
+	t[3] = ADD(t3, t4); \
+	t[4] = SUB(t3, t4); \
+	t[5] = SUB(t2, t5); \
+	t[6] = SUB(t1, t6); \
+	t[7] = SUB(t0, t7); \
+}
+
+/*
+ * The 1-D forward transform of fdct() below, on t0 to t7 which have had
+ * the first stage of sums and differences done, into t[0] to t[7].
+ */
+#define FDCT_1D(t, V, ADD, SUB, MUL, SET1) \
+{ \
+	V x0 = ADD(t0, t3); \
+	V x2 = ADD(t1, t2); \
+	t[0] = ADD(x0, x2); \
+	t[4] = SUB(x0, x2); \
+	V x1 = SUB(t0, t3); \
+	V x3 = SUB(t1, t2); \
+	t0 = MUL(ADD(x1, x3), SET1(FA1)); \
+	t[2] = ADD(x1, t0); \
+	t[6] = SUB(x1, t0); \
+	x0 = ADD(t4, t5); \
+	x1 = ADD(t5, t6); \
+	x2 = ADD(t6, t7); \
+	t3 = MUL(x1, SET1(FA1)); \
+	t4 = SUB(t7, t3); \
+	t0 = MUL(SUB(x0, x2), SET1(FA5)); \
+	t1 = ADD(MUL(x0, SET1(FA2)), t0); \
+	t[3] = SUB(t4, t1); \
+	t[5] = ADD(t4, t1); \
+	t7 = ADD(t7, t3); \
+	t2 = ADD(MUL(x2, SET1(FA4)), t0); \
+	t[1] = ADD(t7, t2); \
+	t[7] = SUB(t7, t2); \
+}
+
+#define FDCT_1D_PASS2(t, V, ADD, SUB, MUL, SET1) \
+{ \
+	V t0 = ADD(t[0], t[7]); \
+	V t7 = SUB(t[0], t[7]); \
+	V t1 = ADD(t[1], t[6]); \
+	V t6 = SUB(t[1], t[6]); \
+	V t2 = ADD(t[2], t[5]); \
+	V t5 = SUB(t[2], t[5]); \
+	V t3 = ADD(t[3], t[4]); \
+	V t4 = SUB(t[3], t[4]); \
+	FDCT_1D(t, V, ADD, SUB, MUL, SET1) \
+}
+
+/* Low 32 bits of the products, as the C multiply gives */
+static inline VIC_TARGET_SSE2 __m128i
+mullo_epi32_sse2(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+				  _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline VIC_TARGET_SSE2 __m128i
+fp_mul_sse2(__m128i a, int b)
+{
+	return _mm_srai_epi32(mullo_epi32_sse2(_mm_srai_epi32(a, 5),
+					       _mm_set1_epi32(b >> 5)),
+			      FP_NBITS - 10);
+}
+
+static VIC_TARGET_SSE2 void
+rdct_sse2(const short* bp, u_int m0, u_int m1, u_char* p, int stride, const u_char* in)
+{
+	/* Columns of the coefficients, row i in lane i */
+	__m128i c[8];
+	int i;
+	for (i = 0; i < 8; ++i)
+		c[i] = rdct_load_row(bp + 8 * i, i < 4 ? m0 >> (8 * i) : m1 >> (8 * (i - 4)));
+	transpose8x8_epi16(c);
+
+	/*
+	 * cross_stage[] is symmetric, so row k of it is the column
+	 * of multipliers for column k of the coefficients.
+	 */
+	__m128i lo[8], hi[8];
+	for (int k = 0; k < 8; ++k) {
+		lo[k] = mullo_epi32_sse2(_mm_srai_epi32(_mm_unpacklo_epi16(c[k], c[k]), 16),
+					 _mm_loadu_si128((const __m128i*)&cross_stage[8 * k]));
+		hi[k] = mullo_epi32_sse2(_mm_srai_epi32(_mm_unpackhi_epi16(c[k], c[k]), 16),
+					 _mm_loadu_si128((const __m128i*)&cross_stage[8 * k + 4]));
+	}
+
+	RDCT_1D(lo, __m128i, _mm_add_epi32, _mm_sub_epi32, fp_mul_sse2);
+	RDCT_1D(hi, __m128i, _mm_add_epi32, _mm_sub_epi32, fp_mul_sse2);
+	transpose8x8_epi32(lo, hi);
+	RDCT_1D(lo, __m128i, _mm_add_epi32, _mm_sub_epi32, fp_mul_sse2);
+	RDCT_1D(hi, __m128i, _mm_add_epi32, _mm_sub_epi32, fp_mul_sse2);
+
+	const __m128i round = _mm_set1_epi32(1 << (FP_NBITS - 1));
+	__m128i o[8];
+	for (int k = 0; k < 8; ++k)
+		o[k] = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(lo[k], round), FP_NBITS),
+				       _mm_srai_epi32(_mm_add_epi32(hi[k], round), FP_NBITS));
+	rdct_store(o, p, stride, in);
+}
+
+#if VIC_SIMD_FLOAT
+static VIC_TARGET_SSE2 void
+fdct_sse2(const u_char* in, int stride, short* out, const float* qt)
+{
+	/* Columns of the pixels, row i in lane i */
+	const __m128i zero = _mm_setzero_si128();
+	__m128i c[8];
+	int i;
+	for (i = 0; i < 8; ++i) {
+		c[i] = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)in), zero);
+		in += stride;
+	}
+	transpose8x8_epi16(c);
+
+	/* The first sums are of integers, as in the C code */
+	__m128i s[8];
+	s[0] = _mm_add_epi16(c[0], c[7]);
+	s[7] = _mm_sub_epi16(c[0], c[7]);
+	s[1] = _mm_add_epi16(c[1], c[6]);
+	s[6] = _mm_sub_epi16(c[1], c[6]);
+	s[2] = _mm_add_epi16(c[2], c[5]);
+	s[5] = _mm_sub_epi16(c[2], c[5]);
+	s[3] = _mm_add_epi16(c[3], c[4]);
+	s[4] = _mm_sub_epi16(c[3], c[4]);
+
+	__m128 lo[8], hi[8];
+	{
+#define CVT_LO(x) _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16))
+#define CVT_HI(x) _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16))
+		__m128 t0 = CVT_LO(s[0]), t1 = CVT_LO(s[1]), t2 = CVT_LO(s[2]), t3 = CVT_LO(s[3]);
+		__m128 t4 = CVT_LO(s[4]), t5 = CVT_LO(s[5]), t6 = CVT_LO(s[6]), t7 = CVT_LO(s[7]);
+		FDCT_1D(lo, __m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps)
+	}
+	{
+		__m128 t0 = CVT_HI(s[0]), t1 = CVT_HI(s[1]), t2 = CVT_HI(s[2]), t3 = CVT_HI(s[3]);
+		__m128 t4 = CVT_HI(s[4]), t5 = CVT_HI(s[5]), t6 = CVT_HI(s[6]), t7 = CVT_HI(s[7]);
+		FDCT_1D(hi, __m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps)
+#undef CVT_LO
+#undef CVT_HI
+	}
+
+	transpose8x8_ps(lo, hi);
+	FDCT_1D_PASS2(lo, __m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps)
+	FDCT_1D_PASS2(hi, __m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps)
+	transpose8x8_ps(lo, hi);
+
+	/*
+	 * Quantize and truncate, keeping the low 16 bits of the integer
+	 * as the conversion to short does.
+	 */
+	for (i = 0; i < 8; ++i) {
+		__m128i a = _mm_cvttps_epi32(_mm_mul_ps(lo[i], _mm_loadu_ps(qt)));
+		__m128i b = _mm_cvttps_epi32(_mm_mul_ps(hi[i], _mm_loadu_ps(qt + 4)));
+		a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+		b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+		_mm_storeu_si128((__m128i*)out, _mm_packs_epi32(a, b));
+		out += 8;
+		qt += 8;
+	}
+}
+#endif
+
+#if VIC_AVX2
+static inline VIC_TARGET_AVX2 void
+transpose8x8_ps(__m256* r)
+{
+	__m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+	__m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+	__m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+	__m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+	__m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+	__m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+	__m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+	__m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+
+	__m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+	__m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+	__m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+	__m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+	r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+	r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+	r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+	r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+	r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+	r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+	r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+	r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+static inline VIC_TARGET_AVX2 void
+transpose8x8_epi32(__m256i* r)
+{
+	__m256 f[8];
+	int k;
+	for (k = 0; k < 8; ++k)
+		f[k] = _mm256_castsi256_ps(r[k]);
+	transpose8x8_ps(f);
+	for (k = 0; k < 8; ++k)
+		r[k] = _mm256_castps_si256(f[k]);
+}
+
+static inline VIC_TARGET_AVX2 __m256i
+fp_mul_avx2(__m256i a, int b)
+{
+	return _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_srai_epi32(a, 5),
+						    _mm256_set1_epi32(b >> 5)),
+				 FP_NBITS - 10);
+}
+
+static VIC_TARGET_AVX2 void
+rdct_avx2(const short* bp, u_int m0, u_int m1, u_char* p, int stride, const u_char* in)
+{
+	__m128i c[8];
+	int i;
+	for (i = 0; i < 8; ++i)
+		c[i] = rdct_load_row(bp + 8 * i, i < 4 ? m0 >> (8 * i) : m1 >> (8 * (i - 4)));
+	transpose8x8_epi16(c);
+
+	/* cross_stage[] is symmetric, as in rdct_sse2() */
+	__m256i t[8];
+	int k;
+	for (k = 0; k < 8; ++k)
+		t[k] = _mm256_mullo_epi32(_mm256_cvtepi16_epi32(c[k]),
+					  _mm256_loadu_si256((const __m256i*)&cross_stage[8 * k]));
+
+	RDCT_1D(t, __m256i, _mm256_add_epi32, _mm256_sub_epi32, fp_mul_avx2);
+	transpose8x8_epi32(t);
+	RDCT_1D(t, __m256i, _mm256_add_epi32, _mm256_sub_epi32, fp_mul_avx2);
+
+	const __m256i round = _mm256_set1_epi32(1 << (FP_NBITS - 1));
+	__m128i o[8];
+	for (k = 0; k < 8; ++k) {
+		__m256i v = _mm256_srai_epi32(_mm256_add_epi32(t[k], round), FP_NBITS);
+		o[k] = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	}
+	rdct_store(o, p, stride, in);
+}
+
+#if VIC_SIMD_FLOAT
+static VIC_TARGET_AVX2 void
+fdct_avx2(const u_char* in, int stride, short* out, const float* qt)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i c[8];
+	int i;
+	for (i = 0; i < 8; ++i) {
+		c[i] = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)in), zero);
+		in += stride;
+	}
+	transpose8x8_epi16(c);
+
+	__m256 t[8];
+	{
+#define CVT(x) _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x))
+		__m256 t0 = CVT(_mm_add_epi16(c[0], c[7]));
+		__m256 t7 = CVT(_mm_sub_epi16(c[0], c[7]));
+		__m256 t1 = CVT(_mm_add_epi16(c[1], c[6]));
+		__m256 t6 = CVT(_mm_sub_epi16(c[1], c[6]));
+		__m256 t2 = CVT(_mm_add_epi16(c[2], c[5]));
+		__m256 t5 = CVT(_mm_sub_epi16(c[2], c[5]));
+		__m256 t3 = CVT(_mm_add_epi16(c[3], c[4]));
+		__m256 t4 = CVT(_mm_sub_epi16(c[3], c[4]));
+#undef CVT
+		FDCT_1D(t, __m256, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_set1_ps)
+	}
+
+	transpose8x8_ps(t);
+	FDCT_1D_PASS2(t, __m256, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_set1_ps)
+	transpose8x8_ps(t);
+
+	for (i = 0; i < 8; ++i) {
+		__m256i v = _mm256_cvttps_epi32(_mm256_mul_ps(t[i], _mm256_loadu_ps(qt)));
+		v = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+		_mm_storeu_si128((__m128i*)out, _mm_packs_epi32(_mm256_castsi256_si128(v),
+								_mm256_extracti128_si256(v, 1)));
+		out += 8;
+		qt += 8;
+	}
+}
+#endif
+#endif /* VIC_AVX2 */
+
+static void
+rdct_simd(const short* bp, u_int m0, u_int m1, u_char* p, int stride, const u_char* in)
+{
+#if VIC_AVX2
+	if (dct_simd >= VIC_SIMD_AVX2) {
+		rdct_avx2(bp, m0, m1, p, stride, in);
+		return;
+	}
+#endif
+	rdct_sse2(bp, m0, m1, p, stride, in);
+}
+
+#if VIC_SIMD_FLOAT
+static void
+fdct_simd(const u_char* in, int stride, short* out, const float* qt)
+{
+#if VIC_AVX2
+	if (dct_simd >= VIC_SIMD_AVX2) {
+		fdct_avx2(in, stride, out, qt);
+		return;
+	}
+#endif
+	fdct_sse2(in, stride, out, qt);
+}
+#endif
+
+#endif /* VIC_SIMD */
+
 /*
  * Inverse 2-D transform, similar to routine above (see comment above),
  * but more appropriate for H.261 instead of JPEG.  This routine does
@@ -922,6 +1453,16 @@ rdct(register short *bp, INT_64 m0, u_char* p, int stride, const u_char* in)
 rdct(register short *bp, u_int m0, u_int m1, u_char* p, int stride, const u_char *in)
 #endif
 {
+#if VIC_SIMD
+	if (dct_simd != VIC_SIMD_NONE) {
+#ifdef INT_64
+		rdct_simd(bp, (u_int)m0, (u_int)(m0 >> 32), p, stride, in);
+#else
+		rdct_simd(bp, m0, m1, p, stride, in);
+#endif
+		return;
+	}
+#endif
 	int tmp[64];
 	int* tp = tmp;
 	const int* qt = cross_stage;
@@ -1124,6 +1665,12 @@ rdct(register short *bp, u_int m0, u_int m1, u_char* p, int stride, const u_char
 
 void fdct(const u_char* in, int stride, short* out, const float* qt)
 {
+#if VIC_SIMD_FLOAT
+	if (dct_simd != VIC_SIMD_NONE) {
+		fdct_simd(in, stride, out, qt);
+		return;
+	}
+#endif
 	float tmp[64];
 	float* tp = tmp;
 
@@ -1222,6 +1769,101 @@ void fdct(const u_char* in, int stride, short* out, const float* qt)
 	}
 }
 
+/*
+ * Find the largest magnitude of the ac coefficients in nblk blocks
+ * from fdct(), so the encoder can see if they fit the quantizer.
+ */
+#if VIC_SIMD
+static VIC_TARGET_SSE2 int
+dct_maxac_sse2(const short* bp, int nblk)
+{
+	const __m128i nodc = _mm_setr_epi16(0, -1, -1, -1, -1, -1, -1, -1);
+	__m128i cmin = _mm_setzero_si128();
+	__m128i cmax = _mm_setzero_si128();
+	for (int i = nblk; --i >= 0; ) {
+		/* A zero dc changes neither, as both start at zero */
+		__m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*)bp), nodc);
+		cmin = _mm_min_epi16(cmin, v);
+		cmax = _mm_max_epi16(cmax, v);
+		for (int j = 1; j < 8; ++j) {
+			v = _mm_loadu_si128((const __m128i*)(bp + 8 * j));
+			cmin = _mm_min_epi16(cmin, v);
+			cmax = _mm_max_epi16(cmax, v);
+		}
+		bp += 64;
+	}
+	cmin = _mm_min_epi16(cmin, _mm_shuffle_epi32(cmin, _MM_SHUFFLE(1, 0, 3, 2)));
+	cmin = _mm_min_epi16(cmin, _mm_shuffle_epi32(cmin, _MM_SHUFFLE(2, 3, 0, 1)));
+	cmin = _mm_min_epi16(cmin, _mm_shufflelo_epi16(cmin, _MM_SHUFFLE(2, 3, 0, 1)));
+	cmax = _mm_max_epi16(cmax, _mm_shuffle_epi32(cmax, _MM_SHUFFLE(1, 0, 3, 2)));
+	cmax = _mm_max_epi16(cmax, _mm_shuffle_epi32(cmax, _MM_SHUFFLE(2, 3, 0, 1)));
+	cmax = _mm_max_epi16(cmax, _mm_shufflelo_epi16(cmax, _MM_SHUFFLE(2, 3, 0, 1)));
+	int lo = (short)_mm_cvtsi128_si32(cmin);
+	int hi = (short)_mm_cvtsi128_si32(cmax);
+	return (hi < -lo ? -lo : hi);
+}
+
+static VIC_TARGET_SSE2 void
+dct_shiftac_sse2(short* bp, int nblk, int s)
+{
+	const __m128i count = _mm_cvtsi32_si128(s);
+	for (int i = nblk; --i >= 0; ) {
+		short dc = bp[0];
+		for (int j = 0; j < 8; ++j) {
+			__m128i* p = (__m128i*)(bp + 8 * j);
+			_mm_storeu_si128(p, _mm_sra_epi16(_mm_loadu_si128(p), count));
+		}
+		bp[0] = dc;
+		bp += 64;
+	}
+}
+#endif
+
+int
+dct_maxac(const short* bp, int nblk)
+{
+#if VIC_SIMD
+	if (dct_simd != VIC_SIMD_NONE)
+		return (dct_maxac_sse2(bp, nblk));
+#endif
+	int cmin = 0, cmax = 0;
+	for (int i = nblk; --i >= 0; ) {
+		++bp;	// ignore dc coef
+		for (int j = 63; --j >= 0; ) {
+			int v = *bp++;
+			if (v < cmin)
+				cmin = v;
+			else if (v > cmax)
+				cmax = v;
+		}
+	}
+	if (cmax < -cmin)
+		cmax = -cmin;
+	return (cmax);
+}
+
+/*
+ * Divide the ac coefficients of nblk blocks by 1 << s, for a coarser
+ * quantizer than fdct() was given.
+ */
+void
+dct_shiftac(short* bp, int nblk, int s)
+{
+#if VIC_SIMD
+	if (dct_simd != VIC_SIMD_NONE) {
+		dct_shiftac_sse2(bp, nblk, s);
+		return;
+	}
+#endif
+	for (int i = nblk; --i >= 0; ) {
+		++bp;	// ignore dc coef
+		for (int j = 63; --j >= 0; ) {
+			int v = *bp;
+			*bp++ = v >> s;
+		}
+	}
+}
+
 /*
  * decimate the *rows* of the two input 8x8 DCT matrices into
  * a single output matrix.  we decimate rows rather than
@@ -103,6 +103,8 @@ void dcfill(int dc, u_char* out, int stride);
 void dcsum(int dc, u_char* in, u_char* out, int stride);
 void dcsum2(int dc, u_char* in, u_char* out, int stride);
 void dct_decimate(const short* in0, const short* in1, short* out);
+int dct_maxac(const short* blk, int nblk);
+void dct_shiftac(short* blk, int nblk, int s);
 
 /*XXX*/
 void rdct_fold_q(const int* in, int* qt);
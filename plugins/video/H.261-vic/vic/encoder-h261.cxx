@@ -467,34 +467,14 @@ H261PixelEncoder::encode_mb(u_int mba, // address of macroblock to encode
 	 * coef. would significantly overflow.
 	 */
 	if (q < 8) {
-		register int cmin = 0, cmax = 0;
-		register short* bp = blk;
-		for (register int i = 6; --i >= 0; ) {
-			++bp;	// ignore dc coef
-			for (register int j = 63; --j >= 0; ) {
-				register int v = *bp++;
-				if (v < cmin)
-					cmin = v;
-				else if (v > cmax)
-					cmax = v;
-			}
-		}
-		if (cmax < -cmin)
-			cmax = -cmin;
+		register int cmax = dct_maxac(blk, 6);
 		if (cmax >= 128) {
 			/* need to re-quantize */
 			register int s;
 			for (s = 1; cmax >= (128 << s); ++s) {
 			}
 			q <<= s;
-			register short* bp = blk;
-			for (register int i = 6; --i >= 0; ) {
-				++bp;	// ignore dc coef
-				for (register int j = 63; --j >= 0; ) {
-					register int v = *bp;
-					*bp++ = v >> s;
-				}
-			}
+			dct_shiftac(blk, 6, s);
 		}
 	}
 
@@ -559,24 +539,8 @@ H261DCTEncoder::encode_mb(u_int mba, const u_char* frm,
 	 * coef. would significantly overflow.
 	 */
 	if (q < 8) {
-		register int cmin = 0, cmax = 0;
-		register short* bp = lblk;
-		register int i, j;
-
 		// Y U and V blocks
-		for (i = 6; --i >= 0; ) {
-			++bp;	// ignore dc coef
-			for (j = 63; --j >= 0; ) {
-				register int v = *bp++;
-				if (v < cmin)
-					cmin = v;
-				else if (v > cmax)
-					cmax = v;
-			}
-		}
-
-		if (cmax < -cmin)
-			cmax = -cmin;
+		register int cmax = dct_maxac(lblk, 6);
 		cmax /= (q << 1);
 		if (cmax >= 128) {
 			/* need to re-quantize */
@@ -0,0 +1,85 @@
+/*
+ * simd.h
+ *
+ * Run time selection of the SIMD versions of the H.261 codec's inner loops
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifndef _VIC_SIMD_H
+#define _VIC_SIMD_H
+
+/*
+ * The DCTs, the quantiser range check and the conditional replenishment
+ * block differences have SSE2 and AVX2 versions as well as the C ones.
+ * The plugin is built for the baseline CPU, the versions are compiled with
+ * per function target attributes, and the best one the CPU can run is
+ * picked the first time it is needed. All versions give the same output,
+ * bit for bit.
+ *
+ * Setting the PTLIB_H261_SIMD environment variable to "none" or "sse2"
+ * caps the choice, for comparing speed and output against the C code.
+ */
+
+#define VIC_SIMD_NONE	0
+#define VIC_SIMD_SSE2	1
+#define VIC_SIMD_AVX2	2
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define VIC_SIMD 1
+#define VIC_AVX2 1
+#define VIC_TARGET_SSE2 __attribute__((target("sse2")))
+#define VIC_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && _MSC_VER >= 1400 && (defined(_M_X64) || defined(_M_IX86))
+/* No AVX2 intrinsics in the compilers the project files are for */
+#define VIC_SIMD 1
+#define VIC_AVX2 0
+#define VIC_TARGET_SSE2
+#include <emmintrin.h>
+#include <intrin.h>
+#else
+#define VIC_SIMD 0
+#define VIC_AVX2 0
+#endif
+
+/*
+ * The forward DCT is in single precision floating point, so its SIMD
+ * versions only match the C one when that is done one operation at a time
+ * in SSE registers: not on the x87, and not contracted into FMAs.
+ */
+#if VIC_SIMD && !defined(__FMA__) && \
+    (defined(__x86_64__) || defined(__SSE2_MATH__) || defined(_M_X64))
+#define VIC_SIMD_FLOAT 1
+#else
+#define VIC_SIMD_FLOAT 0
+#endif
+
+/*
+ * Get the SIMD level to use, VIC_SIMD_NONE if the plugin was built without
+ * them or the CPU has neither.
+ */
+int vic_simd_level();
+
+#endif /* _VIC_SIMD_H */
@@ -67,6 +67,7 @@
 
 
 #include "vid_coder.h"
+#include "simd.h"
 
 void Pre_Vid_Coder::SetSize(int _width,int _height)
 {
@@ -152,6 +153,71 @@ void Pre_Vid_Coder::allocref()
 	ABS(left); \
 	ABS(center);
 
+#if VIC_SIMD
+static const int cr_simd = vic_simd_level();
+
+/*
+ * DIFFLINE on both lines, with a SAD for the even and for the odd groups
+ * of four pixels in each line, the other groups masked out.
+ */
+static inline VIC_TARGET_SSE2 void
+crdiff_sse2(const u_char* in, const u_char* frm, int ds, int rs,
+	    int& left, int& top, int& right, int& bottom)
+{
+	const __m128i even = _mm_set_epi32(0, -1, 0, -1);
+	const __m128i odd = _mm_set_epi32(-1, 0, -1, 0);
+	const __m128i zero = _mm_setzero_si128();
+	int g[2][4];
+	for (int line = 0; line < 2; ++line) {
+		__m128i a = _mm_loadu_si128((const __m128i*)in);
+		__m128i b = _mm_loadu_si128((const __m128i*)frm);
+		__m128i e = _mm_sub_epi32(_mm_sad_epu8(_mm_and_si128(a, even), zero),
+					  _mm_sad_epu8(_mm_and_si128(b, even), zero));
+		__m128i o = _mm_sub_epi32(_mm_sad_epu8(_mm_and_si128(a, odd), zero),
+					  _mm_sad_epu8(_mm_and_si128(b, odd), zero));
+		g[line][0] = _mm_cvtsi128_si32(e);
+		g[line][1] = _mm_cvtsi128_si32(o);
+		g[line][2] = _mm_cvtsi128_si32(_mm_srli_si128(e, 8));
+		g[line][3] = _mm_cvtsi128_si32(_mm_srli_si128(o, 8));
+		in += ds << 3;
+		frm += rs << 3;
+	}
+	/* The sides take in both lines, the first made positive on the way */
+	left = g[0][0];
+	ABS(left);
+	left += g[1][0];
+	ABS(left);
+	right = g[0][3];
+	ABS(right);
+	right += g[1][3];
+	ABS(right);
+	top = g[0][1] + g[0][2];
+	ABS(top);
+	bottom = g[1][1] + g[1][2];
+	ABS(bottom);
+}
+#endif
+
+/*
+ * Sum the differences between the input and the reference in line scan
+ * and line scan + 8 of a block, for the replenishment decision.
+ */
+static inline void
+crdiff(const u_char* in, const u_char* frm, int ds, int rs,
+       int& left, int& top, int& right, int& bottom)
+{
+#if VIC_SIMD
+	if (cr_simd != VIC_SIMD_NONE) {
+		crdiff_sse2(in, frm, ds, rs, left, top, right, bottom);
+		return;
+	}
+#endif
+	DIFFLINE(in, frm, left, top, right);
+	in += ds << 3;
+	frm += rs << 3;
+	DIFFLINE(in, frm, left, bottom, right);
+}
+
 void Pre_Vid_Coder::suppress(const u_char* devbuf)
 {
 	REPLENISH(devbuf, ref, outw, 1, 0, blkw, 0, blkh);
@@ -280,12 +280,7 @@ class Pre_Vid_Coder : public Encoder {
 			int right = 0; \
 			int top = 0; \
 			int bottom = 0; \
-			DIFFLINE(db, rb, left, top, right); \
-			db += _ds << 3; \
-			rb += _rs << 3; \
-			DIFFLINE(db, rb, left, bottom, right); \
-			db -= _ds << 3; \
-			rb -= _rs << 3; \
+			crdiff(db, rb, _ds, _rs, left, top, right, bottom); \
  \
 			int center = 0; \
 			if (left >= 48 && x > 0) { \
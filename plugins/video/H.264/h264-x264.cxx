@@ -101,59 +101,59 @@ static char * num2str(int num)
 
 H264EncoderContext::H264EncoderContext()
 {
-  H264EncCtxInstance.call(H264ENCODERCONTEXT_CREATE);
+  _context = H264EncCtxInstance.createContext();
 }
 
 H264EncoderContext::~H264EncoderContext()
 {
   WaitAndSignal m(_mutex);
-  H264EncCtxInstance.call(H264ENCODERCONTEXT_DELETE);
+  H264EncCtxInstance.deleteContext(_context);
 }
 
 void H264EncoderContext::ApplyOptions()
 {
-  H264EncCtxInstance.call(APPLY_OPTIONS);
+  H264EncCtxInstance.call(_context, APPLY_OPTIONS);
 }
 
 void H264EncoderContext::SetMaxRTPFrameSize(unsigned size)
 {
-  H264EncCtxInstance.call(SET_MAX_FRAME_SIZE, size);
+  H264EncCtxInstance.call(_context, SET_MAX_FRAME_SIZE, size);
 }
 
 void H264EncoderContext::SetMaxKeyFramePeriod (unsigned period)
 {
-  H264EncCtxInstance.call(SET_MAX_KEY_FRAME_PERIOD, period);
+  H264EncCtxInstance.call(_context, SET_MAX_KEY_FRAME_PERIOD, period);
 }
 
 void H264EncoderContext::SetTargetBitrate(unsigned rate)
 {
-  H264EncCtxInstance.call(SET_TARGET_BITRATE, rate);
+  H264EncCtxInstance.call(_context, SET_TARGET_BITRATE, rate);
 }
 
 void H264EncoderContext::SetFrameWidth(unsigned width)
 {
-  H264EncCtxInstance.call(SET_FRAME_WIDTH, width);
+  H264EncCtxInstance.call(_context, SET_FRAME_WIDTH, width);
 }
 
 void H264EncoderContext::SetFrameHeight(unsigned height)
 {
-  H264EncCtxInstance.call(SET_FRAME_HEIGHT, height);
+  H264EncCtxInstance.call(_context, SET_FRAME_HEIGHT, height);
 }
 
 void H264EncoderContext::SetFrameRate(unsigned rate)
 {
-  H264EncCtxInstance.call(SET_FRAME_RATE, rate);
+  H264EncCtxInstance.call(_context, SET_FRAME_RATE, rate);
 }
 
 void H264EncoderContext::SetTSTO (unsigned tsto)
 {
-  H264EncCtxInstance.call(SET_TSTO, tsto);
+  H264EncCtxInstance.call(_context, SET_TSTO, tsto);
 }
 
 void H264EncoderContext::SetProfileLevel (unsigned profile, unsigned constraints, unsigned level)
 {
   unsigned profileLevel = (profile << 16) + (constraints << 8) + level;
-  H264EncCtxInstance.call(SET_PROFILE_LEVEL, profileLevel);
+  H264EncCtxInstance.call(_context, SET_PROFILE_LEVEL, profileLevel);
 }
 
 int H264EncoderContext::EncodeFrames(const u_char * src, unsigned & srcLen, u_char * dst, unsigned & dstLen, unsigned int & flags)
@@ -166,7 +166,7 @@ int H264EncoderContext::EncodeFrames(const u_char * src, unsigned & srcLen, u_ch
   RTPFrame dstRTP(dst, dstLen);
   headerLen = dstRTP.GetHeaderSize();
 
-  H264EncCtxInstance.call(ENCODE_FRAMES, src, srcLen, dst, dstLen, headerLen, flags, ret);
+  H264EncCtxInstance.call(_context, ENCODE_FRAMES, src, srcLen, dst, dstLen, headerLen, flags, ret);
 
   return ret;
 }
@@ -103,6 +103,7 @@ class H264EncoderContext
 
   protected:
     CriticalSection _mutex;
+    int _context;
 };
 
 class H264DecoderContext
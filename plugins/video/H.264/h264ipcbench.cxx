@@ -0,0 +1,544 @@
+/*
+ * H.264 Plugin codec for OpenH323/OPAL
+ *
+ * Benchmark of passing frames to the encoder helper process
+ *
+ * Copyright (C) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ */
+
+/*
+  Notes
+  -----
+
+  Encodes moving pictures with x264 in the real helper, found the way the
+  plugin finds it, through the shared memory with and without pipelining.
+  The CPU time of both processes is counted, giving frames per second for
+  each core they keep busy.
+
+  With -s the helper is instead a forked copy of this program, with an
+  encoder that packetises a fixed fraction of each frame, and the same
+  frames also go through the named pipes the plugin used to talk to the
+  helper over. That measures only the cost of moving frames and packets
+  between the processes, for comparing the two. I frames are forced now
+  and then, and a run fails unless each request gives exactly one.
+
+  More than PTLIB_H264_CONTEXTS encoders may be asked for with -c, the
+  benchmark raises the limit to match.
+
+    h264ipcbench [-f frames] [-c contexts] [-s]
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fstream>
+#include <vector>
+#include "trace.h"
+#include "rtpframe.h"
+#include "h264pipe_unix.h"
+#include <string.h>
+
+#define MAX_RTP_SIZE    1400
+#define COMPRESSION     100      // raw frame bytes for each encoded byte
+#define PAYLOAD_TYPE    96
+#define PICTURES        16       // different pictures, cycled through
+#define FORCE_PERIOD    10       // frames between forced I frames, with the stub encoder
+#define IS_IFRAME       2        // PluginCodec_ReturnCoderIFrame
+
+
+/* Has the methods of X264EncoderContext, but only cuts a frame's worth of
+   bytes into RTP packets. Frames are only I frames when forced. */
+class StubEncoder
+{
+  public:
+    StubEncoder() : _remaining(0), _timestamp(0), _checksum(0), _maxRTPSize(MAX_RTP_SIZE), _iframe(false) { }
+
+    int EncodeFrames(const unsigned char * src, unsigned & srcLen, unsigned char * dst, unsigned & dstLen, unsigned int & flags)
+    {
+      RTPFrame srcRTP(src, srcLen);
+      RTPFrame dstRTP(dst, dstLen);
+      dstLen = 0;
+
+      if (_remaining == 0) {
+        // An encoder reads all of the picture
+        const unsigned char * pixels = srcRTP.GetPayloadPtr();
+        for (unsigned i = 0; i < srcRTP.GetPayloadSize(); i += 64)
+          _checksum += pixels[i];
+        _remaining = srcRTP.GetPayloadSize()/COMPRESSION + 1;
+        _timestamp = srcRTP.GetTimestamp();
+        _iframe = (flags & H264_SHM_FORCE_IFRAME) != 0;
+      }
+
+      unsigned size = _remaining < _maxRTPSize ? _remaining : _maxRTPSize;
+      memset(dstRTP.GetPayloadPtr(), (int)(_checksum & 0xff), size);
+      dstRTP.SetPayloadSize(size);
+      dstRTP.SetTimestamp(_timestamp);
+      _remaining -= size;
+      dstRTP.SetMarker(_remaining == 0);
+      flags = (_remaining == 0 ? H264_SHM_LAST_PACKET : 0) | (_iframe ? IS_IFRAME : 0);
+      dstLen = dstRTP.GetFrameLen();
+      return 1;
+    }
+
+    void SetMaxRTPFrameSize(unsigned size) { _maxRTPSize = size; }
+    void SetMaxKeyFramePeriod(unsigned) { }
+    void SetTargetBitrate(unsigned) { }
+    void SetFrameWidth(unsigned) { }
+    void SetFrameHeight(unsigned) { }
+    void SetFrameRate(unsigned) { }
+    void SetTSTO(unsigned) { }
+    void SetProfileLevel(unsigned) { }
+    void ApplyOptions() { }
+
+  protected:
+    unsigned _remaining;
+    unsigned long _timestamp;
+    unsigned long _checksum;
+    unsigned _maxRTPSize;
+    bool _iframe;
+};
+
+
+/* The plugin's side of the shared memory, with the stub encoder in a
+   forked copy of this process */
+class BenchEncCtx : public H264EncCtx
+{
+  public:
+    bool Start() { return startGplProcess(); }
+
+  protected:
+    virtual void execGplProcess()
+    {
+      int status;
+      {
+        H264ShmServer<StubEncoder> server(area, true);
+        status = server.Run();
+      }
+      _exit(status);
+    }
+};
+
+
+/* The named pipes the plugin used before, one round trip for each packet
+   and a single encoder in the helper */
+class LegacyEncCtx
+{
+  public:
+    LegacyEncCtx() : startNewFrame(true), pid(0)
+    {
+      snprintf(dlName, sizeof(dlName), "/tmp/x264bench-dl-%d", getpid());
+      snprintf(ulName, sizeof(ulName), "/tmp/x264bench-ul-%d", getpid());
+    }
+
+    ~LegacyEncCtx()
+    {
+      if (pid > 0) {
+        dlStream.close();
+        ulStream.close();
+        waitpid(pid, NULL, 0);
+      }
+      remove(dlName);
+      remove(ulName);
+    }
+
+    bool Start()
+    {
+      if (mkfifo(dlName, S_IRUSR | S_IWUSR) != 0 || mkfifo(ulName, S_IRUSR | S_IWUSR) != 0)
+        return false;
+
+      pid = fork();
+      if (pid < 0)
+        return false;
+      if (pid == 0)
+        _exit(Serve());
+
+      dlStream.open(dlName, std::ios::binary);
+      ulStream.open(ulName, std::ios::binary);
+      return dlStream.good() && ulStream.good();
+    }
+
+    void call(unsigned msg , const u_char * src, unsigned & srcLen, u_char * dst, unsigned & dstLen, unsigned & headerLen, unsigned int & flags, int & ret)
+    {
+      if (startNewFrame) {
+        dlStream.write((char*) &msg, sizeof(msg));
+        dlStream.write((char*) &srcLen, sizeof(srcLen));
+        dlStream.write((char*) src, srcLen);
+        dlStream.write((char*) &headerLen, sizeof(headerLen));
+        dlStream.write((char*) dst, headerLen);
+        dlStream.write((char*) &flags, sizeof(flags) );
+      }
+      else {
+        msg = ENCODE_FRAMES_BUFFERED;
+        dlStream.write((char*) &msg, sizeof(msg));
+      }
+      dlStream.flush();
+
+      ulStream.read((char*) &msg, sizeof(msg));
+      ulStream.read((char*) &dstLen, sizeof(dstLen));
+      ulStream.read((char*) dst, dstLen);
+      ulStream.read((char*) &flags, sizeof(flags));
+      ulStream.read((char*) &ret, sizeof(ret));
+      if (ulStream.fail())
+        ret = 0;
+
+      startNewFrame = (flags & 1) != 0;
+    }
+
+  protected:
+    int Serve()
+    {
+      std::ifstream dl(dlName, std::ios::binary);
+      std::ofstream ul(ulName, std::ios::binary);
+      std::vector<unsigned char> src(H264_SHM_MAX_INPUT), dst(H264_SHM_MAX_INPUT);
+      StubEncoder encoder;
+      unsigned msg, srcLen = 0, headerLen, flags = 0, dstLen;
+
+      while (dl.read((char*)&msg, sizeof(msg))) {
+        if (msg == ENCODE_FRAMES) {
+          dl.read((char*)&srcLen, sizeof(srcLen));
+          dl.read((char*)&src[0], srcLen);
+          dl.read((char*)&headerLen, sizeof(headerLen));
+          dl.read((char*)&dst[0], headerLen);
+          dl.read((char*)&flags, sizeof(flags));
+        }
+        dstLen = MAX_RTP_SIZE + 12;
+        int ret = encoder.EncodeFrames(&src[0], srcLen, &dst[0], dstLen, flags);
+        ul.write((char*)&msg, sizeof(msg));
+        ul.write((char*)&dstLen, sizeof(dstLen));
+        ul.write((char*)&dst[0], dstLen);
+        ul.write((char*)&flags, sizeof(flags));
+        ul.write((char*)&ret, sizeof(ret));
+        ul.flush();
+      }
+      return 0;
+    }
+
+    char dlName [512];
+    char ulName [512];
+    std::ofstream dlStream;
+    std::ifstream ulStream;
+    bool startNewFrame;
+    pid_t pid;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/* Pictures that move a little from one to the next, with some noise, so
+   the encoder has work like a camera's to do on every frame */
+struct BenchFrame
+{
+  BenchFrame(unsigned width, unsigned height)
+    : width(width)
+    , height(height)
+  {
+    unsigned seed = 1;
+    for (unsigned picture = 0; picture < PICTURES; ++picture) {
+      data[picture].resize(12 + sizeof(frameHeader) + width*height*3/2);
+      RTPFrame rtp(&data[picture][0], data[picture].size(), PAYLOAD_TYPE);
+      frameHeader * header = (frameHeader *)rtp.GetPayloadPtr();
+      header->x = header->y = 0;
+      header->width = width;
+      header->height = height;
+      unsigned char * pixels = rtp.GetPayloadPtr() + sizeof(frameHeader);
+      for (unsigned y = 0; y < height*3/2; ++y) {
+        for (unsigned x = 0; x < width; ++x) {
+          seed = seed*1103515245 + 12345;
+          pixels[y*width+x] = (unsigned char)(((x + picture*4)*3 + y*2) + ((seed >> 16) & 7));
+        }
+      }
+    }
+  }
+
+  unsigned width;
+  unsigned height;
+  std::vector<unsigned char> data[PICTURES];
+};
+
+
+struct BenchStream
+{
+  H264EncCtx   * shm;
+  LegacyEncCtx * legacy;
+  int context;
+  const BenchFrame * frame;
+  std::vector<unsigned char> * pictures;
+  unsigned frames;
+  unsigned forcePeriod;
+  unsigned long packets;
+  unsigned long bytes;
+  unsigned requests;
+  unsigned iframes;
+  bool failed;
+};
+
+
+static void * RunStream(void * arg)
+{
+  BenchStream & stream = *(BenchStream *)arg;
+  unsigned char dst[MAX_RTP_SIZE + 100];
+
+  if (stream.shm != NULL) {
+    const BenchFrame & frame = *stream.frame;
+    stream.shm->call(stream.context, SET_FRAME_WIDTH, frame.width);
+    stream.shm->call(stream.context, SET_FRAME_HEIGHT, frame.height);
+    stream.shm->call(stream.context, SET_FRAME_RATE, 30);
+    stream.shm->call(stream.context, SET_TARGET_BITRATE, frame.width*frame.height/200); // kbit/s
+    stream.shm->call(stream.context, SET_MAX_FRAME_SIZE, MAX_RTP_SIZE);
+    stream.shm->call(stream.context, APPLY_OPTIONS);
+  }
+
+  // I frames are forced as OpalPluginVideoTranscoder does, asking with every
+  // frame until the packets handed back are of an I frame
+  bool forceIFrame = false;
+
+  // When pipelined the last frame is still held back at the end, deleting
+  // the context waits for it
+  for (unsigned frame = 0; frame < stream.frames && !stream.failed; ++frame) {
+    std::vector<unsigned char> & src = stream.pictures[frame%PICTURES];
+    RTPFrame srcRTP(&src[0], src.size());
+    srcRTP.SetTimestamp(frame*3000);
+    if (stream.forcePeriod != 0 && frame%stream.forcePeriod == stream.forcePeriod/2 && !forceIFrame) {
+      forceIFrame = true;
+      ++stream.requests;
+    }
+    unsigned flags = 0;
+    do {
+      flags = forceIFrame ? H264_SHM_FORCE_IFRAME : 0;
+      RTPFrame dstRTP(dst, sizeof(dst), PAYLOAD_TYPE);
+      unsigned srcLen = src.size();
+      unsigned dstLen = sizeof(dst);
+      unsigned headerLen = dstRTP.GetHeaderSize();
+      int ret;
+      if (stream.shm != NULL)
+        stream.shm->call(stream.context, ENCODE_FRAMES, &src[0], srcLen, dst, dstLen, headerLen, flags, ret);
+      else
+        stream.legacy->call(ENCODE_FRAMES, &src[0], srcLen, dst, dstLen, headerLen, flags, ret);
+      if (ret == 0) {
+        stream.failed = true;
+        break;
+      }
+      if (dstLen > headerLen) {
+        ++stream.packets;
+        stream.bytes += dstLen;
+      }
+    } while ((flags & 1) == 0);
+
+    if ((flags & IS_IFRAME) != 0) {
+      ++stream.iframes;
+      forceIFrame = false;
+    }
+  }
+
+  // The last request may not have been answered yet
+  if (forceIFrame)
+    --stream.requests;
+
+  return NULL;
+}
+
+
+static double GetCPUSeconds()
+{
+  struct rusage self, children;
+  getrusage(RUSAGE_SELF, &self);
+  getrusage(RUSAGE_CHILDREN, &children);
+  return self.ru_utime.tv_sec + self.ru_stime.tv_sec + children.ru_utime.tv_sec + children.ru_stime.tv_sec +
+         (self.ru_utime.tv_usec + self.ru_stime.tv_usec + children.ru_utime.tv_usec + children.ru_stime.tv_usec)/1e6;
+}
+
+
+static double GetWallSeconds()
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return now.tv_sec + now.tv_usec/1e6;
+}
+
+
+enum BenchMode {
+  Legacy,
+  Shared,
+  Pipelined,
+  X264,
+  X264Pipelined
+};
+
+
+static bool RunBenchmark(BenchMode mode, const char * size, const BenchFrame & frame, unsigned frames, unsigned count)
+{
+  static const char * const Names[] = { "pipes", "shared", "pipelined", "x264", "x264 pipelined" };
+
+  H264EncCtx * shm = NULL;
+  LegacyEncCtx * legacy = NULL;
+  bool started;
+
+  // x264 makes I frames of its own accord, so only the stub's are checked
+  bool stub = mode != X264 && mode != X264Pipelined;
+
+  // The helper is counted from its start, and reaped at the end
+  double cpu = GetCPUSeconds();
+  double wall = GetWallSeconds();
+
+  switch (mode) {
+    case Legacy :
+      legacy = new LegacyEncCtx;
+      started = legacy->Start();
+      count = 1;
+      break;
+    case X264 :
+    case X264Pipelined :
+      shm = new H264EncCtx;
+      started = shm->Load();
+      shm->setPipelined(mode == X264Pipelined);
+      break;
+    default :
+      shm = new BenchEncCtx;
+      shm->setPipelined(mode == Pipelined);
+      started = ((BenchEncCtx *)shm)->Start();
+  }
+
+  // Each stream has its own copy of the pictures, the encoder writes to them
+  std::vector<BenchStream> streams(count);
+  std::vector<pthread_t> threads(count);
+  std::vector< std::vector<unsigned char> > pictures(count*PICTURES);
+  for (unsigned i = 0; started && i < count; ++i) {
+    BenchStream & stream = streams[i];
+    memset(&stream, 0, sizeof(stream));
+    for (unsigned p = 0; p < PICTURES; ++p)
+      pictures[i*PICTURES+p] = frame.data[p];
+    stream.shm = shm;
+    stream.legacy = legacy;
+    stream.context = shm != NULL ? shm->createContext() : 0;
+    stream.frame = &frame;
+    stream.pictures = &pictures[i*PICTURES];
+    stream.frames = frames;
+    stream.forcePeriod = stub ? FORCE_PERIOD : 0;
+    stream.failed = stream.context < 0;
+    pthread_create(&threads[i], NULL, RunStream, &stream);
+  }
+
+  unsigned long packets = 0, bytes = 0;
+  unsigned requests = 0, iframes = 0;
+  bool failed = !started;
+  for (unsigned i = 0; started && i < count; ++i) {
+    pthread_join(threads[i], NULL);
+    packets += streams[i].packets;
+    bytes += streams[i].bytes;
+    requests += streams[i].requests;
+    iframes += streams[i].iframes;
+    failed = failed || streams[i].failed;
+    if (shm != NULL)
+      shm->deleteContext(streams[i].context);
+  }
+
+  delete shm;
+  delete legacy;
+
+  wall = GetWallSeconds() - wall;
+  cpu = GetCPUSeconds() - cpu;
+
+  cout << "  " << setw(4) << size << ' ' << setw(14) << Names[mode] << " x" << count << ": ";
+  if (!started)
+    cout << "FAILED, could not start the helper";
+  else if (failed)
+    cout << "FAILED";
+  else if (stub && iframes != requests) {
+    // Each forced I frame must be reported once, and only for its own frame
+    cout << "FAILED, " << iframes << " I frames for " << requests << " requests";
+    failed = true;
+  }
+  else
+    cout << "frames/s=" << (unsigned)(frames*count/wall)
+         << " frames/s/core=" << (unsigned)(frames*count/cpu)
+         << " cpu/frame=" << (unsigned)(cpu*1e6/(frames*count)) << "us"
+         << " packets/frame=" << (double)packets/(frames*count)
+         << " kbytes/frame=" << (double)bytes/(frames*count)/1024;
+  cout << endl;
+
+  return !failed;
+}
+
+
+int main(int argc, char *argv[])
+{
+  unsigned frames = 300;
+  unsigned count = 1;
+  bool stub = false;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-f") == 0 && i+1 < argc)
+      frames = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-c") == 0 && i+1 < argc)
+      count = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-s") == 0)
+      stub = true;
+    else {
+      fprintf(stderr, "usage: %s [-f frames] [-c contexts] [-s]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (frames == 0)
+    frames = 1;
+  if (count == 0 || count > H264_SHM_MAX_CONTEXTS)
+    count = 1;
+  if (count > H264ShmGetContextCount()) {
+    char contexts[20];
+    snprintf(contexts, sizeof(contexts), "%u", count);
+    setenv("PTLIB_H264_CONTEXTS", contexts, 1);
+  }
+
+  char * debug_level = getenv ("PTLIB_TRACE_CODECS");
+  Trace::SetLevel(debug_level != NULL ? atoi(debug_level) : 0);
+  Trace::SetLevelUserPlane(0);
+
+  cout << "H.264 helper " << (stub ? "IPC" : "x264") << " benchmark, " << frames << " frames for each encoder" << endl;
+
+  static const struct {
+    const char * name;
+    unsigned width;
+    unsigned height;
+  } Sizes[] = {
+    { "CIF",  352,  288 },
+    { "720p", 1280, 720 }
+  };
+
+  bool ok = true;
+  for (unsigned s = 0; s < sizeof(Sizes)/sizeof(Sizes[0]); ++s) {
+    BenchFrame frame(Sizes[s].width, Sizes[s].height);
+    if (!stub) {
+      ok = RunBenchmark(X264, Sizes[s].name, frame, frames, count) && ok;
+      ok = RunBenchmark(X264Pipelined, Sizes[s].name, frame, frames, count) && ok;
+      continue;
+    }
+    ok = RunBenchmark(Legacy, Sizes[s].name, frame, frames, 1) && ok;
+    ok = RunBenchmark(Shared, Sizes[s].name, frame, frames, 1) && ok;
+    ok = RunBenchmark(Pipelined, Sizes[s].name, frame, frames, 1) && ok;
+    if (count > 1) {
+      ok = RunBenchmark(Shared, Sizes[s].name, frame, frames, count) && ok;
+      ok = RunBenchmark(Pipelined, Sizes[s].name, frame, frames, count) && ok;
+    }
+  }
+
+  return ok ? 0 : 1;
+}
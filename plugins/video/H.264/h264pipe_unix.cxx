@@ -27,225 +27,388 @@
 
 #include <stdlib.h>
 #include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include "trace.h"
 #include "rtpframe.h"
 #include "h264pipe_unix.h"
 #include <string.h>
 
-#define HAVE_MKFIFO 1
 #define GPL_PROCESS_FILENAME "h264_video_pwplugin_helper"
 #define DIR_SEPERATOR "/"
 #define DIR_TOKENISER ":"
+#define DOORBELL_TIMEOUT 1000
 
 H264EncCtx::H264EncCtx()
 {
-  width  = 0;
-  height = 0;
-  size = 0;
-  startNewFrame = true;
+  area = NULL;
+  areaFd = -1;
+  pid = 0;
+  pipelined = false;
   loaded = false;  
-  pipesCreated = false;
-  pipesOpened = false;
 }
 
 H264EncCtx::~H264EncCtx()
 {
-  closeAndRemovePipes();
+  stopGplProcess();
 }
 
 bool 
 H264EncCtx::Load()
 {
-  snprintf ( dlName, sizeof(dlName), "/tmp/x264-dl-%d", getpid());
-  snprintf ( ulName, sizeof(ulName), "/tmp/x264-ul-%d", getpid());
-  if (!createPipes()) {
-  
-    closeAndRemovePipes(); 
-    return false;
-  }
-  pipesCreated = true;  
-
   if (!findGplProcess()) { 
 
     TRACE(1, "H264\tIPC\tPP: Couldn't find GPL process executable: " << GPL_PROCESS_FILENAME)
-    closeAndRemovePipes(); 
     return false;
   }
-    // Check if file is executable!!!!
-  int pid = fork();
 
-  if(pid == 0) 
+  if (::getenv("PTLIB_H264_PIPELINE") != NULL)
+    pipelined = true;
 
-    execGplProcess();
+  return startGplProcess();
+}
 
-  else if(pid < 0) {
+bool H264EncCtx::startGplProcess()
+{
+  unsigned contextCount = H264ShmGetContextCount();
+  size_t size = H264ShmAreaSize(contextCount);
 
-    TRACE(1, "H264\tIPC\tPP: Error when trying to fork");
-    closeAndRemovePipes(); 
+  areaFd = H264ShmCreateMemory(size);
+  if (areaFd < 0) {
+
+    TRACE(1, "H264\tIPC\tPP: Error when trying to create shared memory - " << strerror(errno));
     return false;
   }
 
-  dlStream.open(dlName, std::ios::binary);
-  if (dlStream.fail()) { 
+  area = (H264ShmArea *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, areaFd, 0);
+  if (area == MAP_FAILED) {
 
-    TRACE(1, "H264\tIPC\tPP: Error when opening DL named pipe");
-    closeAndRemovePipes(); 
+    TRACE(1, "H264\tIPC\tPP: Error when trying to map shared memory - " << strerror(errno));
+    area = NULL;
+    stopGplProcess();
     return false;
   }
-  ulStream.open(ulName, std::ios::binary);
-  if (ulStream.fail()) { 
 
-    TRACE(1, "H264\tIPC\tPP: Error when opening UL named pipe")
-    closeAndRemovePipes(); 
+  area->magic = H264_SHM_MAGIC;
+  area->version = H264_SHM_VERSION;
+  area->size = size;
+  area->contextCount = contextCount;
+  contexts.assign(contextCount, ContextState());
+  area->submitDoorbell[0] = area->submitDoorbell[1] = -1;
+  area->controlDoorbell[0] = area->controlDoorbell[1] = -1;
+  for (unsigned i = 0; i < contextCount; ++i)
+    H264ShmGetContext(area, i).doorbell[0] = H264ShmGetContext(area, i).doorbell[1] = -1;
+
+  bool opened = H264ShmOpenDoorbell(area->submitDoorbell) && H264ShmOpenDoorbell(area->controlDoorbell);
+  for (unsigned i = 0; opened && i < contextCount; ++i)
+    opened = H264ShmOpenDoorbell(H264ShmGetContext(area, i).doorbell);
+  if (!opened) {
+
+    TRACE(1, "H264\tIPC\tPP: Error when trying to create doorbells - " << strerror(errno));
+    stopGplProcess();
     return false;
   }
-  pipesOpened = true;
-  
-  unsigned msg = INIT;
-  unsigned status;
-  writeStream((char*) &msg, sizeof(msg));
-  flushStream();
-  readStream((char*) &msg, sizeof(msg));
-  readStream((char*) &status, sizeof(status));
-
-  if (status == 0) {
+
+  pid = fork();
+
+  if (pid == 0) 
+
+    execGplProcess();
+
+  else if (pid < 0) {
+
+    TRACE(1, "H264\tIPC\tPP: Error when trying to fork");
+    pid = 0;
+    stopGplProcess();
+    return false;
+  }
+
+  // The helper has its copies, keep them from any other process we start
+  fcntl(areaFd, F_SETFD, FD_CLOEXEC);
+  fcntl(area->submitDoorbell[0], F_SETFD, FD_CLOEXEC);
+  fcntl(area->submitDoorbell[1], F_SETFD, FD_CLOEXEC);
+  fcntl(area->controlDoorbell[0], F_SETFD, FD_CLOEXEC);
+  fcntl(area->controlDoorbell[1], F_SETFD, FD_CLOEXEC);
+  for (unsigned i = 0; i < contextCount; ++i) {
+    fcntl(H264ShmGetContext(area, i).doorbell[0], F_SETFD, FD_CLOEXEC);
+    fcntl(H264ShmGetContext(area, i).doorbell[1], F_SETFD, FD_CLOEXEC);
+  }
+
+  if (!control(0, INIT, 0)) {
     TRACE(1, "H264\tIPC\tPP: GPL Process returned failure on initialization - plugin disabled")
-    closeAndRemovePipes(); 
+    stopGplProcess();
     return false;
   }
 
-  TRACE(1, "H264\tIPC\tPP: Successfully forked child process "<<  pid << " and established communication")
+  TRACE(1, "H264\tIPC\tPP: Successfully forked child process "<<  pid << " and established communication, " << contextCount << " encoder contexts")
   loaded = true;  
   return true;
 }
 
-void H264EncCtx::call(unsigned msg)
+void H264EncCtx::stopGplProcess()
+{
+  loaded = false;
+
+  if (pid > 0) {
+    area->shutdown = 1;
+    H264_SHM_BARRIER();
+    H264ShmRing(area->submitDoorbell);
+
+    // Give it a while to finish the frame it may be encoding
+    int tries = 100;
+    while (waitpid(pid, NULL, WNOHANG) == 0) {
+      if (--tries == 0) {
+        TRACE(1, "H264\tIPC\tPP: GPL process " << pid << " did not terminate - killing it");
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        break;
+      }
+      usleep(10000);
+    }
+    pid = 0;
+  }
+
+  if (area != NULL) {
+    H264ShmCloseDoorbell(area->submitDoorbell);
+    H264ShmCloseDoorbell(area->controlDoorbell);
+    for (unsigned i = 0; i < area->contextCount; ++i)
+      H264ShmCloseDoorbell(H264ShmGetContext(area, i).doorbell);
+    munmap(area, area->size);
+    area = NULL;
+  }
+
+  if (areaFd >= 0) {
+    close(areaFd);
+    areaFd = -1;
+  }
+}
+
+int H264EncCtx::createContext()
 {
-  if (msg == H264ENCODERCONTEXT_CREATE) 
-    startNewFrame = true;
-  writeStream((char*) &msg, sizeof(msg));
-  flushStream();
-  readStream((char*) &msg, sizeof(msg));
+  int context = -1;
+  {
+    WaitAndSignal m(mutex);
+    for (int i = 0; i < (int)contexts.size(); ++i) {
+      if (!contexts[i].inUse) {
+        memset(&contexts[i], 0, sizeof(contexts[i]));
+        contexts[i].inUse = true;
+        contexts[i].pending = contexts[i].collecting = -1;
+        context = i;
+        break;
+      }
+    }
+  }
+
+  if (context < 0) {
+    TRACE(1, "H264\tIPC\tPP: All " << contexts.size() << " encoder contexts are in use, see PTLIB_H264_CONTEXTS");
+    return -1;
+  }
+
+  if (!control(context, H264ENCODERCONTEXT_CREATE, 0)) {
+    WaitAndSignal m(mutex);
+    contexts[context].inUse = false;
+    return -1;
+  }
+
+  return context;
 }
 
-void H264EncCtx::call(unsigned msg, unsigned value)
+void H264EncCtx::deleteContext(int context)
 {
-  switch (msg) {
-    case SET_FRAME_WIDTH:  width  = value; size = (unsigned) (width * height * 1.5) + sizeof(frameHeader) + 40; break;
-    case SET_FRAME_HEIGHT: height = value; size = (unsigned) (width * height * 1.5) + sizeof(frameHeader) + 40; break;
-    default: return;
-   }
-  
-  writeStream((char*) &msg, sizeof(msg));
-  writeStream((char*) &value, sizeof(value));
-  flushStream();
-  readStream((char*) &msg, sizeof(msg));
+  if (context < 0 || context >= (int)contexts.size() || !contexts[context].inUse)
+    return;
+
+  // A pipelined frame may still be encoding, the helper must be done with it
+  ContextState & state = contexts[context];
+  if (state.pending >= 0)
+    waitForSlot(context, state.pending);
+
+  if (area != NULL) {
+    for (unsigned i = 0; i < H264_SHM_SLOTS; ++i)
+      H264ShmGetContext(area, context).slots[i].state = H264_SHM_FREE;
+  }
+
+  control(context, H264ENCODERCONTEXT_DELETE, 0);
+
+  WaitAndSignal m(mutex);
+  state.inUse = false;
+}
+
+void H264EncCtx::call(int context, unsigned msg)
+{
+  control(context, msg, 0);
+}
+
+void H264EncCtx::call(int context, unsigned msg, unsigned value)
+{
+  control(context, msg, value);
 }
      
-void H264EncCtx::call(unsigned msg , const u_char * src, unsigned & srcLen, u_char * dst, unsigned & dstLen, unsigned & headerLen, unsigned int & flags, int & ret)
+void H264EncCtx::call(int context, unsigned msg , const u_char * src, unsigned & srcLen, u_char * dst, unsigned & dstLen, unsigned & headerLen, unsigned int & flags, int & ret)
 {
-  if (startNewFrame) {
-
-    writeStream((char*) &msg, sizeof(msg));
-    if (size) {
-      writeStream((char*) &size, sizeof(size));
-      writeStream((char*) src, size);
-      writeStream((char*) &headerLen, sizeof(headerLen));
-      writeStream((char*) dst, headerLen);
-      writeStream((char*) &flags, sizeof(flags) );
+  unsigned capacity = dstLen;
+  dstLen = 0;
+  ret = 0;
+
+  if (area == NULL || msg != ENCODE_FRAMES || context < 0 || context >= (int)contexts.size() || !contexts[context].inUse) {
+    flags = H264_SHM_LAST_PACKET;
+    return;
+  }
+
+  ContextState & state = contexts[context];
+  if (state.collecting < 0) {
+    int slot = state.nextSlot;
+
+    // The caller cannot see a forced frame still in the pipeline, so asks again
+    unsigned submitFlags = flags;
+    if (state.pending >= 0 && state.forced[state.pending])
+      submitFlags &= ~H264_SHM_FORCE_IFRAME;
+
+    if (!submitFrame(context, src, srcLen, dst, capacity, headerLen, submitFlags)) {
+      flags = H264_SHM_LAST_PACKET;
+      return;
     }
-    else {
-      writeStream((char*) &srcLen, sizeof(srcLen));
-      writeStream((char*) src, srcLen);
-      writeStream((char*) &headerLen, sizeof(headerLen));
-      writeStream((char*) dst, headerLen);
-      writeStream((char*) &flags, sizeof(flags) );
+    state.forced[slot] = (submitFlags & H264_SHM_FORCE_IFRAME) != 0;
+
+    if (pipelined) {
+      int previous = state.pending;
+      state.pending = slot;
+      if (previous < 0) {
+        // Nothing to send until the frame after this one
+        flags = H264_SHM_LAST_PACKET;
+        ret = 1;
+        return;
+      }
+      slot = previous;
     }
+
+    if (!waitForSlot(context, slot)) {
+      flags = H264_SHM_LAST_PACKET;
+      return;
+    }
+
+    if (state.pending == slot)
+      state.pending = -1;
+    state.collecting = slot;
+    state.nextPacket = 0;
   }
-  else {
-  
-    msg = ENCODE_FRAMES_BUFFERED;
-    writeStream((char*) &msg, sizeof(msg));
+
+  // The packets of the frame are all in the slot, hand them out one by one
+  H264ShmSlot & slot = H264ShmGetContext(area, context).slots[state.collecting];
+  const H264ShmPacket & packet = slot.packets[state.nextPacket++];
+  dstLen = packet.length <= capacity ? packet.length : capacity;
+  memcpy(dst, slot.output + packet.offset, dstLen);
+  flags = packet.flags;
+  ret = packet.ret;
+
+  if (state.nextPacket >= slot.packetCount) {
+    flags |= H264_SHM_LAST_PACKET;
+    H264_SHM_BARRIER();
+    slot.state = H264_SHM_FREE;
+    state.forced[state.collecting] = false;
+    state.collecting = -1;
   }
-  
-  flushStream();
-  
-  readStream((char*) &msg, sizeof(msg));
-  readStream((char*) &dstLen, sizeof(dstLen));
-  readStream((char*) dst, dstLen);
-  readStream((char*) &flags, sizeof(flags));
-  readStream((char*) &ret, sizeof(ret));
-
-  if (flags & 1) 
-    startNewFrame = true;
-   else
-    startNewFrame = false;
 }
 
-bool H264EncCtx::createPipes()
+bool H264EncCtx::control(int context, unsigned msg, unsigned value)
 {
-  umask(0);
-#ifdef HAVE_MKFIFO
-  if (mkfifo((const char*) &dlName, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP)) {
+  WaitAndSignal m(mutex);
 
-    TRACE(1, "H264\tIPC\tPP: Error when trying to create DL named pipe");
+  if (area == NULL || context < 0 || context >= (int)contexts.size())
     return false;
-  }
-  if (mkfifo((const char*) &ulName, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP)) {
 
-    TRACE(1, "H264\tIPC\tPP: Error when trying to create UL named pipe");
+  H264ShmControl & request = area->control;
+  request.context = context;
+  request.msg = msg;
+  request.value = value;
+  request.status = 0;
+  H264_SHM_BARRIER();
+  request.state = H264_SHM_SUBMITTED;
+  H264ShmRing(area->submitDoorbell);
+
+  if (!waitForDoorbell(area->controlDoorbell, request.state))
     return false;
-  }
-#else
-  if (mknod((const char*) &dlName, S_IFIFO | S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP, 0)) {
 
-    TRACE(1, "H264\tIPC\tPP: Error when trying to create named pipe");
+  bool ok = request.status != 0;
+  request.state = H264_SHM_FREE;
+  if (!ok) { TRACE(1, "H264\tIPC\tPP: GPL process failed request " << msg << " for context " << context); }
+  return ok;
+}
+
+bool H264EncCtx::submitFrame(int context, const u_char * src, unsigned srcLen, const u_char * dst, unsigned dstLen, unsigned headerLen, unsigned flags)
+{
+  ContextState & state = contexts[context];
+  H264ShmSlot & slot = H264ShmGetContext(area, context).slots[state.nextSlot];
+
+  if (slot.state != H264_SHM_FREE) {
+    TRACE(1, "H264\tIPC\tPP: Frame submitted to context " << context << " before the last was collected");
     return false;
   }
-  if (mknod((const char*) &ulName, S_IFIFO | S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP, 0)) {
-
-    TRACE(1, "H264\tIPC\tPP: Error when trying to create named pipe");
+  if (srcLen > H264_SHM_MAX_INPUT || headerLen > H264_SHM_MAX_HEADER || headerLen > dstLen) {
+    TRACE(1, "H264\tIPC\tPP: Frame of " << srcLen << " bytes too large for shared memory");
     return false;
   }
-#endif /* HAVE_MKFIFO */
+
+  memcpy(slot.input, src, srcLen);
+  memcpy(slot.header, dst, headerLen);
+  slot.srcLen = srcLen;
+  slot.headerLen = headerLen;
+  slot.dstLen = dstLen <= H264_SHM_MAX_OUTPUT/2 ? dstLen : H264_SHM_MAX_OUTPUT/2;
+  slot.flags = flags;
+  slot.packetCount = 0;
+  slot.sequence = ++state.sequence;
+  H264_SHM_BARRIER();
+  slot.state = H264_SHM_SUBMITTED;
+  H264ShmRing(area->submitDoorbell);
+
+  state.nextSlot = (state.nextSlot + 1) % H264_SHM_SLOTS;
   return true;
 }
 
-void H264EncCtx::closeAndRemovePipes()
+bool H264EncCtx::waitForSlot(int context, int slot)
 {
-  if (pipesOpened) {
-    dlStream.close();
-    if (dlStream.fail()) { TRACE(1, "H264\tIPC\tPP: Error when closing DL named pipe"); }
-    ulStream.close();
-    if (ulStream.fail()) { TRACE(1, "H264\tIPC\tPP: Error when closing UL named pipe"); }  
-    pipesOpened = false;
-  }
-  if (pipesCreated) {
-    if (std::remove((const char*) &ulName) == -1) TRACE(1, "H264\tIPC\tPP: Error when trying to remove UL named pipe - " << strerror(errno));
-    if (std::remove((const char*) &dlName) == -1) TRACE(1, "H264\tIPC\tPP: Error when trying to remove DL named pipe - " << strerror(errno));
-    pipesCreated = false;
+  H264ShmContext & shared = H264ShmGetContext(area, context);
+  if (!waitForDoorbell(shared.doorbell, shared.slots[slot].state))
+    return false;
+
+  if (shared.slots[slot].packetCount == 0) {
+    TRACE(1, "H264\tIPC\tPP: GPL process returned no packets");
+    return false;
   }
-}
 
-void H264EncCtx::readStream (char* data, unsigned bytes)
-{
-  ulStream.read(data, bytes);
-  if (ulStream.fail()) { TRACE(1, "H264\tIPC\tPP: Failure on reading - terminating"); closeAndRemovePipes();      }
-  if (ulStream.bad())  { TRACE(1, "H264\tIPC\tPP: Bad flag set on reading - terminating"); closeAndRemovePipes(); }
-  if (ulStream.eof())  { TRACE(1, "H264\tIPC\tPP: Received EOF - terminating"); closeAndRemovePipes();            }
+  return true;
 }
 
-void H264EncCtx::writeStream (const char* data, unsigned bytes)
+bool H264EncCtx::waitForDoorbell(const int doorbell[2], volatile uint32_t & state)
 {
-  dlStream.write(data, bytes);
-  if (dlStream.bad())  { TRACE(1, "H264\tIPC\tPP: Bad flag set on writing - terminating"); closeAndRemovePipes(); }
+  while (state != H264_SHM_DONE) {
+    int result = H264ShmWait(doorbell, DOORBELL_TIMEOUT);
+    if (result < 0) {
+      TRACE(1, "H264\tIPC\tPP: Failure on waiting for GPL process - " << strerror(errno));
+      return false;
+    }
+    if (result == 0 && !gplProcessExists()) {
+      TRACE(1, "H264\tIPC\tPP: GPL process " << pid << " has terminated");
+      loaded = false;
+      return false;
+    }
+  }
+
+  H264_SHM_BARRIER();
+  return true;
 }
 
-void H264EncCtx::flushStream ()
+bool H264EncCtx::gplProcessExists()
 {
-  dlStream.flush();
-  if (dlStream.bad())  { TRACE(1, "H264\tIPC\tPP: Bad flag set on flushing - terminating"); closeAndRemovePipes(); }
+  int result = waitpid(pid, NULL, WNOHANG);
+  if (result == 0)
+    return true;
+
+  // Someone else may reap our children
+  return result < 0 && errno == ECHILD && kill(pid, 0) == 0;
 }
 
 bool H264EncCtx::findGplProcess()
@@ -305,38 +468,13 @@ bool H264EncCtx::checkGplProcessExists (const char * dir)
 
 void H264EncCtx::execGplProcess() 
 {
-  unsigned msg;
-  unsigned status = 0;
-  if (execl(gplProcess,"h264_video_pwplugin_helper", dlName,ulName, NULL) == -1) {
-
-    TRACE(1, "H264\tIPC\tPP: Error when trying to execute GPL process  " << gplProcess << " - " << strerror(errno));
-    cpDLStream.open(dlName, std::ios::binary);
-    if (cpDLStream.fail()) { TRACE (1, "H264\tIPC\tCP: Error when opening DL named pipe"); exit (1); }
-    cpULStream.open(ulName,std::ios::binary);
-    if (cpULStream.fail()) { TRACE (1, "H264\tIPC\tCP: Error when opening UL named pipe"); exit (1); }
-
-    cpDLStream.read((char*)&msg, sizeof(msg));
-    if (cpDLStream.fail()) { TRACE (1, "H264\tIPC\tCP: Failure on reading - terminating");       cpCloseAndExit(); }
-    if (cpDLStream.bad())  { TRACE (1, "H264\tIPC\tCP: Bad flag set on reading - terminating");  cpCloseAndExit(); }
-    if (cpDLStream.eof())  { TRACE (1, "H264\tIPC\tCP: Received EOF - terminating"); exit (1);   cpCloseAndExit(); }
-
-    cpULStream.write((char*)&msg, sizeof(msg));
-    if (cpULStream.bad())  { TRACE (1, "H264\tIPC\tCP: Bad flag set on writing - terminating");  cpCloseAndExit(); }
-
-    cpULStream.write((char*)&status, sizeof(status));
-    if (cpULStream.bad())  { TRACE (1, "H264\tIPC\tCP: Bad flag set on writing - terminating");  cpCloseAndExit(); }
-
-    cpULStream.flush();
-    if (cpULStream.bad())  { TRACE (1, "H264\tIPC\tCP: Bad flag set on flushing - terminating"); }
-    cpCloseAndExit();
-  }
-}
+  char fd[20], size[20];
+  snprintf(fd, sizeof(fd), "%d", areaFd);
+  snprintf(size, sizeof(size), "%u", (unsigned)area->size);
 
-void H264EncCtx::cpCloseAndExit()
-{
-  cpDLStream.close();
-  if (cpDLStream.fail()) { TRACE (1, "H264\tIPC\tCP: Error when closing DL named pipe"); }
-  cpULStream.close();
-  if (cpULStream.fail()) { TRACE (1, "H264\tIPC\tCP: Error when closing UL named pipe"); }
-  exit(1);
+  execl(gplProcess, GPL_PROCESS_FILENAME, fd, size, NULL);
+
+  // The plugin sees the helper has gone while waiting for it to initialise
+  TRACE(1, "H264\tIPC\tPP: Error when trying to execute GPL process  " << gplProcess << " - " << strerror(errno));
+  _exit(1);
 }
@@ -23,12 +23,27 @@
   Notes
   -----
 
+  The encoders run in a GPL helper process, which this class forks and
+  shares a region of memory with, see shared/h264shm.h. Each encoder in the
+  plugin has a context of its own in the region. The number of contexts is
+  set when the helper is started, see PTLIB_H264_CONTEXTS in h264shm.h.
+
+  Setting the environment variable PTLIB_H264_PIPELINE has each context
+  submit frame N+1 for encoding before it hands out the packets of frame N,
+  which keeps the helper busy while the patch thread sends them, at the cost
+  of one frame of latency. The packets handed out carry the I frame flag of
+  frame N, so a forced I frame is only reported a call after it was asked
+  for. Until then the caller keeps asking, and the request is not passed on
+  again while a forced frame is still in the pipeline, so it gives exactly
+  one I frame.
  */
 
 #ifndef __H264PIPE_H__
 #define __H264PIPE_H__ 1
-#include "shared/pipes.h"
-#include <fstream>
+#include "shared/h264shm.h"
+#include "critsect.h"
+#include <sys/types.h>
+#include <vector>
 
 typedef unsigned char u_char;
 
@@ -36,39 +51,45 @@ class H264EncCtx
 {
   public:
      H264EncCtx();
-     ~H264EncCtx();
+     virtual ~H264EncCtx();
      bool Load();
      bool isLoaded() { return loaded; };
-     void call(unsigned msg);
-     void call(unsigned msg, unsigned value);
-     void call(unsigned msg , const u_char * src, unsigned & srcLen, u_char * dst, unsigned & dstLen, unsigned & headerLen, unsigned int & flags, int & ret);
+     void setPipelined(bool enable) { pipelined = enable; };
+     int createContext();
+     void deleteContext(int context);
+     void call(int context, unsigned msg);
+     void call(int context, unsigned msg, unsigned value);
+     void call(int context, unsigned msg , const u_char * src, unsigned & srcLen, u_char * dst, unsigned & dstLen, unsigned & headerLen, unsigned int & flags, int & ret);
 
   protected:
-     bool createPipes();
-     void closeAndRemovePipes();
-     void writeStream (const char* data, unsigned bytes);
-     void readStream (char* data, unsigned bytes);
-     void flushStream ();
+     bool startGplProcess();
+     void stopGplProcess();
+     bool control(int context, unsigned msg, unsigned value);
+     bool submitFrame(int context, const u_char * src, unsigned srcLen, const u_char * dst, unsigned dstLen, unsigned headerLen, unsigned flags);
+     bool waitForSlot(int context, int slot);
+     bool waitForDoorbell(const int doorbell[2], volatile uint32_t & state);
+     bool gplProcessExists();
      bool findGplProcess();
      bool checkGplProcessExists (const char * dir);
-     void execGplProcess();
-     void cpCloseAndExit();
+     virtual void execGplProcess();
+
+     struct ContextState {
+       bool inUse;
+       int nextSlot;    // slot the next frame is submitted to
+       int pending;     // slot of a frame submitted but not yet collected, when pipelined
+       int collecting;  // slot packets are being handed out from
+       unsigned nextPacket;
+       uint32_t sequence;
+       bool forced[H264_SHM_SLOTS];  // frame in the slot was submitted with a forced I frame
+     };
 
-     char dlName [512];
-     char ulName [512];
      char gplProcess [512];
-     std::ofstream dlStream;
-     std::ifstream ulStream;
-     unsigned width;
-     unsigned height;
-     unsigned size;
-     bool startNewFrame;
+     CriticalSection mutex;
+     H264ShmArea * area;
+     int areaFd;
+     pid_t pid;
+     std::vector<ContextState> contexts;
+     bool pipelined;
      bool loaded;
-     bool pipesCreated;
-     bool pipesOpened;
-     
-     // only for signaling failed execution of helper process
-     std::ifstream cpDLStream;
-     std::ofstream cpULStream;
 };
 #endif /* __PIPE_H__ */
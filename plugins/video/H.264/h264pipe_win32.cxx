@@ -105,7 +105,7 @@ bool H264EncCtx::Load()
   return true;
 }
 
-void H264EncCtx::call(unsigned msg)
+void H264EncCtx::call(int /*context*/, unsigned msg)
 {
   if (msg == H264ENCODERCONTEXT_CREATE) 
      startNewFrame = true;
@@ -114,7 +114,7 @@ void H264EncCtx::call(unsigned msg)
   readStream((LPVOID)&msg, sizeof(msg));
 }
 
-void H264EncCtx::call(unsigned msg, unsigned value)
+void H264EncCtx::call(int /*context*/, unsigned msg, unsigned value)
 {
   switch (msg) {
     case SET_FRAME_WIDTH:  width  = value; size = (unsigned) (width * height * 1.5) + sizeof(frameHeader) + 40; break;
@@ -128,7 +128,7 @@ void H264EncCtx::call(unsigned msg, unsigned value)
 }
 
      
-void H264EncCtx::call(unsigned msg , const u_char * src, unsigned & srcLen, u_char * dst, unsigned & dstLen, unsigned & headerLen, unsigned int & flags, int & ret)
+void H264EncCtx::call(int /*context*/, unsigned msg , const u_char * src, unsigned & srcLen, u_char * dst, unsigned & dstLen, unsigned & headerLen, unsigned int & flags, int & ret)
 {
   if (startNewFrame) {
 
@@ -39,9 +39,12 @@ class H264EncCtx
      ~H264EncCtx();
      bool Load();
      bool isLoaded() { return loaded; };
-     void call(unsigned msg);
-     void call(unsigned msg, unsigned value);
-     void call(unsigned msg , const u_char * src, unsigned & srcLen, u_char * dst, unsigned & dstLen, unsigned & headerLen, unsigned int & flags, int & ret);
+     // The Windows helper has a single encoder, shared by every context
+     int createContext() { call(0, H264ENCODERCONTEXT_CREATE); return 0; };
+     void deleteContext(int context) { call(context, H264ENCODERCONTEXT_DELETE); };
+     void call(int context, unsigned msg);
+     void call(int context, unsigned msg, unsigned value);
+     void call(int context, unsigned msg , const u_char * src, unsigned & srcLen, u_char * dst, unsigned & dstLen, unsigned & headerLen, unsigned int & flags, int & ret);
 
   protected:
      bool createPipes();
@@ -0,0 +1,449 @@
+/*****************************************************************************/
+/* The contents of this file are subject to the Mozilla Public License       */
+/* Version 1.0 (the "License"); you may not use this file except in          */
+/* compliance with the License.  You may obtain a copy of the License at     */
+/* http://www.mozilla.org/MPL/                                               */
+/*                                                                           */
+/* Software distributed under the License is distributed on an "AS IS"       */
+/* basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See the  */
+/* License for the specific language governing rights and limitations under  */
+/* the License.                                                              */
+/*                                                                           */
+/* The Original Code is the Open H323 Library.                               */
+/*                                                                           */
+/* The Initial Developer of the Original Code is Matthias Schneider          */
+/* Copyright (C) 2007 Matthias Schneider, All Rights Reserved.               */
+/*                                                                           */
+/* Contributor(s): Matthias Schneider (ma30002000@yahoo.de)                  */
+/*                 Equivalence Pty. Ltd.                                     */
+/*                                                                           */
+/* Alternatively, the contents of this file may be used under the terms of   */
+/* the GNU General Public License Version 2 or later (the "GPL"), in which   */
+/* case the provisions of the GPL are applicable instead of those above.  If */
+/* you wish to allow use of your version of this file only under the terms   */
+/* of the GPL and not to allow others to use your version of this file under */
+/* the MPL, indicate your decision by deleting the provisions above and      */
+/* replace them with the notice and other provisions required by the GPL.    */
+/* If you do not delete the provisions above, a recipient may use your       */
+/* version of this file under either the MPL or the GPL.                     */
+/*****************************************************************************/
+
+/*
+  Notes
+  -----
+
+  The plugin and the GPL helper process share one region of memory, created
+  by the plugin before it forks the helper and passed to it as a descriptor.
+  Each encoder the plugin creates gets a context in the region, with its own
+  encoder in the helper, so one helper serves every encoder in the process.
+
+  A context has two frame slots. The plugin copies a frame into a free slot,
+  marks it submitted and rings the helper's doorbell; the helper encodes the
+  whole frame, leaving every RTP packet of it in the slot, marks it done and
+  rings the context's doorbell. With two slots the plugin may submit the
+  next frame before it collects the packets of the last.
+
+  Setting encoder options goes through the single control block, one
+  request at a time.
+
+  The helper has a single thread, which encodes the submitted frames of
+  every context in turn, so all the encoders of a process share one core
+  between them. Pipelining only overlaps that core with the plugin's own
+  threads. Once the frames submitted each frame time take longer than that
+  to encode, they queue and latency grows with the number of busy
+  contexts; going past one core would need more than one helper.
+
+  Doorbells are eventfds on Linux and pipes elsewhere.
+
+  The number of contexts, and so of encoders the process can have open at
+  once, is fixed when the helper is started. It is H264_SHM_DEFAULT_CONTEXTS
+  unless the environment variable PTLIB_H264_CONTEXTS says otherwise, up to
+  H264_SHM_MAX_CONTEXTS; opening an encoder when they are all in use fails.
+  Each context takes about 3.8MB of the region, but pages are only backed
+  by memory once a context has encoded frames of that size.
+ */
+
+#ifndef __H264SHM_H__
+#define __H264SHM_H__ 1
+
+#include "pipes.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <inttypes.h>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#define H264_SHM_EVENTFD 1
+#endif
+
+#define H264_SHM_MAGIC        0x34363248 /* "H264" */
+#define H264_SHM_VERSION      2
+
+#define H264_SHM_DEFAULT_CONTEXTS 32
+#define H264_SHM_MAX_CONTEXTS     1024
+#define H264_SHM_SLOTS        2
+#define H264_SHM_MAX_INPUT    (1280*720*3/2 + 1024)   /* 720p YUV420P, frame header and RTP header */
+#define H264_SHM_MAX_OUTPUT   (512*1024)
+#define H264_SHM_MAX_PACKETS  1024
+#define H264_SHM_MAX_HEADER   128
+
+#define H264_SHM_LAST_PACKET  1                        /* PluginCodec_ReturnCoderLastFrame */
+#define H264_SHM_FORCE_IFRAME 2                        /* PluginCodec_CoderForceIFrame */
+
+#define H264_SHM_BARRIER()    __sync_synchronize()
+
+enum {
+  H264_SHM_FREE,
+  H264_SHM_SUBMITTED,
+  H264_SHM_DONE
+};
+
+struct H264ShmPacket
+{
+  uint32_t offset;
+  uint32_t length;
+  uint32_t flags;
+  int32_t  ret;
+};
+
+struct H264ShmSlot
+{
+  volatile uint32_t state;
+  uint32_t sequence;
+  uint32_t srcLen;
+  uint32_t headerLen;
+  uint32_t dstLen;         /* largest packet the plugin will take, at most half the output */
+  uint32_t flags;
+  uint32_t packetCount;
+  H264ShmPacket packets[H264_SHM_MAX_PACKETS];
+  unsigned char header[H264_SHM_MAX_HEADER];
+  unsigned char input[H264_SHM_MAX_INPUT];
+  unsigned char output[H264_SHM_MAX_OUTPUT];
+};
+
+struct H264ShmContext
+{
+  int doorbell[2];         /* rung by the helper when a slot is done */
+  H264ShmSlot slots[H264_SHM_SLOTS];
+};
+
+struct H264ShmControl
+{
+  volatile uint32_t state;
+  uint32_t context;
+  uint32_t msg;
+  uint32_t value;
+  uint32_t status;
+};
+
+/* The contexts follow the area in the region */
+struct H264ShmArea
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;
+  uint32_t contextCount;
+  volatile uint32_t shutdown;
+  int submitDoorbell[2];   /* rung by the plugin for any request */
+  int controlDoorbell[2];  /* rung by the helper when a control request is done */
+  H264ShmControl control;
+};
+
+
+static inline size_t H264ShmAreaSize(unsigned contextCount)
+{
+  size_t header = (sizeof(H264ShmArea) + 63) & ~(size_t)63;
+  return header + contextCount*sizeof(H264ShmContext);
+}
+
+
+static inline H264ShmContext & H264ShmGetContext(H264ShmArea * area, unsigned context)
+{
+  return ((H264ShmContext *)((char *)area + H264ShmAreaSize(0)))[context];
+}
+
+
+/* The number of contexts to create the region with */
+static inline unsigned H264ShmGetContextCount()
+{
+  const char * env = getenv("PTLIB_H264_CONTEXTS");
+  if (env == NULL)
+    return H264_SHM_DEFAULT_CONTEXTS;
+
+  unsigned count = (unsigned)strtoul(env, NULL, 10);
+  if (count == 0)
+    return H264_SHM_DEFAULT_CONTEXTS;
+  return count < H264_SHM_MAX_CONTEXTS ? count : H264_SHM_MAX_CONTEXTS;
+}
+
+
+/* Memory for the region, which the helper maps from the descriptor it inherits */
+static inline int H264ShmCreateMemory(size_t size)
+{
+  int fd = -1;
+#if defined(__linux__) && defined(__NR_memfd_create)
+  fd = (int)syscall(__NR_memfd_create, "x264-shm", 0);
+#endif
+  if (fd < 0) {
+    char name[64];
+    snprintf(name, sizeof(name), "/tmp/x264-shm-%d-XXXXXX", (int)getpid());
+    fd = mkstemp(name);
+    if (fd < 0)
+      return -1;
+    unlink(name);
+  }
+
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+
+static inline bool H264ShmOpenDoorbell(int doorbell[2])
+{
+#ifdef H264_SHM_EVENTFD
+  doorbell[0] = doorbell[1] = eventfd(0, 0);
+  return doorbell[0] >= 0;
+#else
+  return pipe(doorbell) == 0;
+#endif
+}
+
+
+static inline void H264ShmCloseDoorbell(int doorbell[2])
+{
+  if (doorbell[0] >= 0)
+    close(doorbell[0]);
+  if (doorbell[1] >= 0 && doorbell[1] != doorbell[0])
+    close(doorbell[1]);
+  doorbell[0] = doorbell[1] = -1;
+}
+
+
+static inline void H264ShmRing(const int doorbell[2])
+{
+  uint64_t one = 1;
+  while (write(doorbell[1], &one, sizeof(one)) < 0 && errno == EINTR)
+    ;
+}
+
+
+/* Returns 1 when the doorbell was rung, 0 on timeout and -1 on error. Rings
+   that arrive together are all consumed, so callers check the state they
+   were waiting for rather than counting rings. */
+static inline int H264ShmWait(const int doorbell[2], int timeout)
+{
+  struct pollfd pfd;
+  pfd.fd = doorbell[0];
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  int result = poll(&pfd, 1, timeout);
+  if (result < 0)
+    return errno == EINTR ? 0 : -1;
+  if (result == 0)
+    return 0;
+  if ((pfd.revents & POLLIN) == 0)
+    return -1;
+
+  uint64_t rings[32];
+  if (read(doorbell[0], rings, sizeof(rings)) < 0 && errno != EINTR && errno != EAGAIN)
+    return -1;
+  return 1;
+}
+
+
+/* Serves requests from the plugin in the helper process, one Encoder for
+   each context. Encoder has the methods of X264EncoderContext. */
+template <class Encoder>
+class H264ShmServer
+{
+  public:
+    H264ShmServer(H264ShmArea * area, bool loaded)
+      : _area(area)
+      , _loaded(loaded)
+      , _encoders(area->contextCount)
+    {
+    }
+
+    ~H264ShmServer()
+    {
+      for (unsigned i = 0; i < _encoders.size(); ++i)
+        delete _encoders[i];
+    }
+
+    /* Returns when told to shut down, the plugin process goes away or the
+       helper could not load its encoder. */
+    int Run()
+    {
+      pid_t parent = getppid();
+
+      for (;;) {
+        int result = H264ShmWait(_area->submitDoorbell, 1000);
+        if (result < 0) {
+          TRACE(1, "H264\tIPC\tCP: Failure on waiting for requests - terminating");
+          return 1;
+        }
+
+        H264_SHM_BARRIER();
+        if (_area->shutdown)
+          return 0;
+
+        if (result == 0) {
+          if (getppid() != parent) {
+            TRACE(1, "H264\tIPC\tCP: Plugin process has gone - terminating");
+            return 1;
+          }
+          continue;
+        }
+
+        if (_area->control.state == H264_SHM_SUBMITTED && !HandleControl())
+          return 1;
+
+        // One context after another on this thread, see the notes above
+        for (unsigned context = 0; context < _encoders.size(); ++context) {
+          H264ShmSlot * slot;
+          while ((slot = GetSubmittedSlot(context)) != NULL) {
+            Encode(context, *slot);
+            H264_SHM_BARRIER();
+            slot->state = H264_SHM_DONE;
+            H264ShmRing(H264ShmGetContext(_area, context).doorbell);
+          }
+        }
+      }
+    }
+
+  protected:
+    bool HandleControl()
+    {
+      H264ShmControl & control = _area->control;
+      H264_SHM_BARRIER();
+
+      bool keepRunning = true;
+      control.status = 1;
+
+      Encoder * & encoder = _encoders[control.context < _encoders.size() ? control.context : 0];
+      switch (control.msg) {
+        case INIT:
+          control.status = _loaded ? 1 : 0;
+          keepRunning = _loaded;
+          break;
+        case H264ENCODERCONTEXT_CREATE:
+          delete encoder;
+          encoder = new Encoder();
+          break;
+        case H264ENCODERCONTEXT_DELETE:
+          delete encoder;
+          encoder = NULL;
+          break;
+        default:
+          if (encoder == NULL) {
+            TRACE(1, "H264\tIPC\tCP: Request " << control.msg << " for unused context " << control.context);
+            control.status = 0;
+          }
+          else {
+            switch (control.msg) {
+              case APPLY_OPTIONS:            encoder->ApplyOptions();                    break;
+              case SET_TARGET_BITRATE:       encoder->SetTargetBitrate(control.value);    break;
+              case SET_FRAME_RATE:           encoder->SetFrameRate(control.value);        break;
+              case SET_FRAME_WIDTH:          encoder->SetFrameWidth(control.value);       break;
+              case SET_FRAME_HEIGHT:         encoder->SetFrameHeight(control.value);      break;
+              case SET_MAX_FRAME_SIZE:       encoder->SetMaxRTPFrameSize(control.value);  break;
+              case SET_MAX_KEY_FRAME_PERIOD: encoder->SetMaxKeyFramePeriod(control.value); break;
+              case SET_TSTO:                 encoder->SetTSTO(control.value);             break;
+              case SET_PROFILE_LEVEL:        encoder->SetProfileLevel(control.value);     break;
+              default:
+                control.status = 0;
+            }
+          }
+      }
+
+      H264_SHM_BARRIER();
+      control.state = H264_SHM_DONE;
+      H264ShmRing(_area->controlDoorbell);
+      return keepRunning;
+    }
+
+    /* The oldest frame submitted for the context, frames of a context are
+       encoded in the order they were submitted */
+    H264ShmSlot * GetSubmittedSlot(unsigned context)
+    {
+      H264ShmSlot * oldest = NULL;
+      for (unsigned i = 0; i < H264_SHM_SLOTS; ++i) {
+        H264ShmSlot & slot = H264ShmGetContext(_area, context).slots[i];
+        if (slot.state == H264_SHM_SUBMITTED && (oldest == NULL || (int32_t)(slot.sequence - oldest->sequence) < 0))
+          oldest = &slot;
+      }
+      H264_SHM_BARRIER();
+      return oldest;
+    }
+
+    /* Drains every packet of the frame into the slot, each one starting
+       with the RTP header the plugin gave */
+    void Encode(unsigned context, H264ShmSlot & slot)
+    {
+      Encoder * encoder = _encoders[context];
+      unsigned flags = slot.flags;
+      unsigned used = 0;
+      slot.packetCount = 0;
+
+      for (;;) {
+        H264ShmPacket & packet = slot.packets[slot.packetCount++];
+        packet.offset = used;
+        packet.length = 0;
+        packet.ret = 0;
+        packet.flags = H264_SHM_LAST_PACKET;
+
+        if (encoder == NULL) {
+          TRACE(1, "H264\tIPC\tCP: Frame for unused context " << context);
+          return;
+        }
+
+        unsigned char * dst = slot.output + used;
+        memcpy(dst, slot.header, slot.headerLen);
+        unsigned srcLen = slot.srcLen;
+        unsigned dstLen = slot.dstLen;
+        packet.ret = encoder->EncodeFrames(slot.input, srcLen, dst, dstLen, flags);
+        packet.length = dstLen;
+        packet.flags = flags;
+        used += dstLen;
+
+        if (packet.ret == 0 || dstLen == 0 || (flags & H264_SHM_LAST_PACKET) != 0) {
+          packet.flags |= H264_SHM_LAST_PACKET;
+          return;
+        }
+
+        // Room is always left for one more packet, to drain into below
+        if (slot.packetCount >= H264_SHM_MAX_PACKETS || used + 2*slot.dstLen > H264_SHM_MAX_OUTPUT) {
+          TRACE(1, "H264\tIPC\tCP: Encoded frame too large, truncated after " << slot.packetCount << " packets");
+          packet.flags |= H264_SHM_LAST_PACKET;
+          // Throw away what is left, so the next frame starts afresh
+          int ret = packet.ret;
+          while (ret != 0 && dstLen != 0 && (flags & H264_SHM_LAST_PACKET) == 0) {
+            dstLen = slot.dstLen;
+            ret = encoder->EncodeFrames(slot.input, srcLen, slot.output + used, dstLen, flags);
+          }
+          return;
+        }
+      }
+    }
+
+    H264ShmArea * _area;
+    bool _loaded;
+    std::vector<Encoder *> _encoders;
+};
+
+
+#endif /* __H264SHM_H__ */
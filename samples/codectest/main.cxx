@@ -32,6 +32,7 @@
 #include "main.h"
 
 #include <codec/ratectl.h>
+#include <codec/g711codec.h>
 #include <opal/patch.h>
 
 #include <ptclib/random.h>
@@ -57,6 +58,258 @@ CodecTest::~CodecTest()
 }
 
 
+static bool CheckG711(const char * name,
+                      OpalStreamedTranscoder & transcoder,
+                      const RTP_DataFrame & input,
+                      const RTP_DataFrame * expected = NULL)
+{
+  RTP_DataFrame batchOutput(0), sampleOutput(0);
+  transcoder.Convert(input, batchOutput);
+  if (expected == NULL) {
+    transcoder.OpalStreamedTranscoder::Convert(input, sampleOutput);
+    expected = &sampleOutput;
+  }
+
+  bool ok = batchOutput.GetPayloadSize() == expected->GetPayloadSize() &&
+            memcmp(batchOutput.GetPayloadPtr(), expected->GetPayloadPtr(), batchOutput.GetPayloadSize()) == 0;
+  cout << setw(12) << name << ": " << (ok ? "bit exact" : "MISMATCH") << endl;
+  return ok;
+}
+
+
+static void BenchG711(const char * name,
+                      OpalStreamedTranscoder & transcoder,
+                      const RTP_DataFrame & input,
+                      PINDEX samplesPerFrame,
+                      unsigned count)
+{
+  RTP_DataFrame output(0);
+  unsigned i;
+
+  PTimeInterval start = PTimer::Tick();
+  for (i = 0; i < count; i++)
+    transcoder.OpalStreamedTranscoder::Convert(input, output);
+  PTimeInterval sampleTime = PTimer::Tick() - start;
+
+  start = PTimer::Tick();
+  for (i = 0; i < count; i++)
+    transcoder.Convert(input, output);
+  PTimeInterval batchTime = PTimer::Tick() - start;
+
+  double samples = (double)samplesPerFrame*count;
+  double sampleRate = samples*1000/(sampleTime.GetMilliSeconds() > 0 ? sampleTime.GetMilliSeconds() : 1);
+  double batchRate = samples*1000/(batchTime.GetMilliSeconds() > 0 ? batchTime.GetMilliSeconds() : 1);
+
+  cout << setw(12) << name << ": per sample " << setw(12) << (PUInt64)sampleRate << " samples/s,"
+          " batch " << setw(12) << (PUInt64)batchRate << " samples/s,"
+          " speed up " << setprecision(3) << batchRate/sampleRate << endl;
+}
+
+
+static void TestG711(unsigned count)
+{
+  Opal_G711_uLaw_PCM uLawDecoder;
+  Opal_PCM_G711_uLaw uLawEncoder;
+  Opal_G711_ALaw_PCM aLawDecoder;
+  Opal_PCM_G711_ALaw aLawEncoder;
+  Opal_G711_uLaw_ALaw uLawToALaw;
+  Opal_G711_ALaw_uLaw aLawToULaw;
+
+  cout << "Checking G.711 batch conversion against per sample conversion" << endl;
+
+  // Every possible input value
+  RTP_DataFrame allCodes(256);
+  PINDEX i;
+  for (i = 0; i < 256; i++)
+    allCodes.GetPayloadPtr()[i] = (BYTE)i;
+
+  RTP_DataFrame allLinear(65536*sizeof(short));
+  short * linear = (short *)allLinear.GetPayloadPtr();
+  for (i = 0; i < 65536; i++)
+    linear[i] = (short)(i - 32768);
+
+  // Direct conversion must match going via linear PCM
+  RTP_DataFrame uLawToALawExpected(256), aLawToULawExpected(256);
+  for (i = 0; i < 256; i++) {
+    uLawToALawExpected.GetPayloadPtr()[i] = (BYTE)Opal_PCM_G711_ALaw::ConvertSample(Opal_G711_uLaw_PCM::ConvertSample(i));
+    aLawToULawExpected.GetPayloadPtr()[i] = (BYTE)Opal_PCM_G711_uLaw::ConvertSample(Opal_G711_ALaw_PCM::ConvertSample(i));
+  }
+
+  bool ok = CheckG711("uLaw->PCM", uLawDecoder, allCodes);
+  ok = CheckG711("PCM->uLaw", uLawEncoder, allLinear) && ok;
+  ok = CheckG711("ALaw->PCM", aLawDecoder, allCodes) && ok;
+  ok = CheckG711("PCM->ALaw", aLawEncoder, allLinear) && ok;
+  ok = CheckG711("uLaw->ALaw", uLawToALaw, allCodes, &uLawToALawExpected) && ok;
+  ok = CheckG711("ALaw->uLaw", aLawToULaw, allCodes, &aLawToULawExpected) && ok;
+
+  if (!ok) {
+    cout << "G.711 batch conversion is NOT bit exact!" << endl;
+    return;
+  }
+
+  // 20ms frames of a sweep across the full linear range, and its encoding
+  const PINDEX FrameSamples = 160;
+  RTP_DataFrame linearFrame(FrameSamples*sizeof(short));
+  linear = (short *)linearFrame.GetPayloadPtr();
+  for (i = 0; i < FrameSamples; i++)
+    linear[i] = (short)(i*65535/FrameSamples - 32768);
+
+  RTP_DataFrame uLawFrame(0), aLawFrame(0);
+  uLawEncoder.Convert(linearFrame, uLawFrame);
+  aLawEncoder.Convert(linearFrame, aLawFrame);
+
+  cout << "\nMeasuring G.711 conversion speed, " << count << " frames of " << FrameSamples << " samples" << endl;
+
+  BenchG711("uLaw->PCM", uLawDecoder, uLawFrame, FrameSamples, count);
+  BenchG711("PCM->uLaw", uLawEncoder, linearFrame, FrameSamples, count);
+  BenchG711("ALaw->PCM", aLawDecoder, aLawFrame, FrameSamples, count);
+  BenchG711("PCM->ALaw", aLawEncoder, linearFrame, FrameSamples, count);
+  BenchG711("uLaw->ALaw", uLawToALaw, uLawFrame, FrameSamples, count);
+  BenchG711("ALaw->uLaw", aLawToULaw, aLawFrame, FrameSamples, count);
+}
+
+
+static void MakeTestFrame(RTP_DataFrame & data, unsigned width, unsigned height, unsigned frameNumber)
+{
+  data.SetPayloadSize(sizeof(OpalVideoTranscoder::FrameHeader) + width*height*3/2);
+  data.SetMarker(TRUE);
+  data.SetTimestamp(frameNumber*3000);
+
+  OpalVideoTranscoder::FrameHeader * frame = (OpalVideoTranscoder::FrameHeader *)data.GetPayloadPtr();
+  frame->x = frame->y = 0;
+  frame->width = width;
+  frame->height = height;
+
+  // Diagonal bands drifting one way and a textured box moving the other, so
+  // every frame has detail to code and blocks that change
+  BYTE * yuv = OPAL_VIDEO_FRAME_DATA_PTR(frame);
+  unsigned boxX = (frameNumber*3)%(width-48);
+  unsigned boxY = (frameNumber*2)%(height-48);
+  unsigned x, y;
+  for (y = 0; y < height; y++) {
+    for (x = 0; x < width; x++) {
+      if (x >= boxX && x < boxX+48 && y >= boxY && y < boxY+48)
+        *yuv++ = (BYTE)(((x^y)&8) != 0 ? 220 : 40);
+      else
+        *yuv++ = (BYTE)(((x+y+frameNumber*2)*4)&0xff);
+    }
+  }
+  for (y = 0; y < height; y++) {
+    for (x = 0; x < width/2; x++)
+      *yuv++ = (BYTE)(128 + ((x+frameNumber)&0x1f) - ((y/2)&0x0f));
+  }
+}
+
+
+static void HashBytes(PUInt64 & hash, const BYTE * ptr, PINDEX size)
+{
+  // FNV-1a
+  while (size-- > 0) {
+    hash ^= *ptr++;
+    hash *= 0x100000001b3ULL;
+  }
+}
+
+
+static void BenchH261(const char * sizeName, unsigned width, unsigned height, unsigned count)
+{
+  OpalMediaFormat mediaFormat = OPAL_H261;
+  mediaFormat.SetOptionInteger(OpalVideoFormat::FrameWidthOption(), width);
+  mediaFormat.SetOptionInteger(OpalVideoFormat::FrameHeightOption(), height);
+
+  OpalTranscoder * encoder = OpalTranscoder::Create(OpalYUV420P, mediaFormat);
+  OpalTranscoder * decoder = OpalTranscoder::Create(mediaFormat, OpalYUV420P);
+  if (encoder == NULL || decoder == NULL) {
+    cout << "Could not create H.261 transcoders, is the plugin installed?" << endl;
+    delete encoder;
+    delete decoder;
+    return;
+  }
+  encoder->UpdateMediaFormats(OpalMediaFormat(), mediaFormat);
+
+  // A second of frames, made up front so only the codec is timed
+  const unsigned TestFrames = 30;
+  RTP_DataFrameList input;
+  unsigned i;
+  for (i = 0; i < TestFrames; i++) {
+    RTP_DataFrame * frame = new RTP_DataFrame(0);
+    MakeTestFrame(*frame, width, height, i);
+    input.Append(frame);
+  }
+
+  PUInt64 encodedHash = 0xcbf29ce484222325ULL;
+  PUInt64 encodedBytes = 0;
+  std::vector<RTP_DataFrameList *> encoded;
+  encoded.reserve(count);
+
+  PTimeInterval start = PTimer::Tick();
+  for (i = 0; i < count; i++) {
+    RTP_DataFrameList * frames = new RTP_DataFrameList;
+    encoder->ConvertFrames(input[i%TestFrames], *frames);
+    encoded.push_back(frames);
+  }
+  PTimeInterval encodeTime = PTimer::Tick() - start;
+
+  PINDEX p;
+  for (i = 0; i < count; i++) {
+    for (p = 0; p < encoded[i]->GetSize(); p++) {
+      const RTP_DataFrame & packet = (*encoded[i])[p];
+      HashBytes(encodedHash, packet.GetPayloadPtr(), packet.GetPayloadSize());
+      encodedBytes += packet.GetPayloadSize();
+    }
+  }
+
+  // Time a decoder on its own, then check the output with a fresh one, so
+  // hashing the frames does not count against the decoder
+  RTP_DataFrameList output;
+  start = PTimer::Tick();
+  for (i = 0; i < count; i++) {
+    for (p = 0; p < encoded[i]->GetSize(); p++)
+      decoder->ConvertFrames((*encoded[i])[p], output);
+  }
+  PTimeInterval decodeTime = PTimer::Tick() - start;
+  delete decoder;
+
+  PUInt64 decodedHash = 0xcbf29ce484222325ULL;
+  unsigned decodedFrames = 0;
+  decoder = OpalTranscoder::Create(mediaFormat, OpalYUV420P);
+  for (i = 0; i < count; i++) {
+    for (p = 0; decoder != NULL && p < encoded[i]->GetSize(); p++) {
+      decoder->ConvertFrames((*encoded[i])[p], output);
+      for (PINDEX f = 0; f < output.GetSize(); f++) {
+        HashBytes(decodedHash, output[f].GetPayloadPtr(), output[f].GetPayloadSize());
+        decodedFrames++;
+      }
+    }
+    delete encoded[i];
+  }
+
+  delete encoder;
+  delete decoder;
+
+  double encodeRate = count*1000.0/(encodeTime.GetMilliSeconds() > 0 ? encodeTime.GetMilliSeconds() : 1);
+  double decodeRate = count*1000.0/(decodeTime.GetMilliSeconds() > 0 ? decodeTime.GetMilliSeconds() : 1);
+
+  cout << setw(5) << sizeName << ": encode " << setw(8) << fixed << setprecision(1) << encodeRate << " frames/s,"
+          " decode " << setw(8) << decodeRate << " frames/s, "
+       << encodedBytes << " bytes, " << decodedFrames << " frames out\n"
+          "       encoded hash " << hex << setfill('0') << setw(16) << encodedHash
+       << ", decoded hash " << setw(16) << decodedHash << dec << setfill(' ') << endl;
+}
+
+
+static void TestH261(unsigned count)
+{
+  const char * simd = getenv("PTLIB_H261_SIMD");
+  cout << "Measuring H.261 speed, " << count << " frames, SIMD "
+       << (simd != NULL ? simd : "chosen by CPU") << "\n"
+          "Run again with PTLIB_H261_SIMD=none, the hashes must be the same" << endl;
+
+  BenchH261("QCIF", PVideoFrameInfo::QCIFWidth, PVideoFrameInfo::QCIFHeight, count);
+  BenchH261("CIF",  PVideoFrameInfo::CIFWidth,  PVideoFrameInfo::CIFHeight,  count);
+}
+
+
 void CodecTest::Main()
 {
   PArgList & args = GetArguments();
@@ -90,6 +343,8 @@ void CodecTest::Main()
              "-count:"
              "-noprompt."
              "-snr."
+             "-g711-bench."
+             "-h261-bench."
 #if PTRACING
              "o-output:"             "-no-output."
              "t-trace."              "-no-trace."
@@ -102,6 +357,16 @@ void CodecTest::Main()
          PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
 #endif
 
+  if (args.HasOption("g711-bench")) {
+    TestG711(args.GetOptionString("count", "10000").AsUnsigned());
+    return;
+  }
+
+  if (args.HasOption("h261-bench")) {
+    TestH261(args.GetOptionString("count", "300").AsUnsigned());
+    return;
+  }
+
   if (args.HasOption('h') || args.GetCount() == 0) {
     PError << "usage: " << GetFile().GetTitle() << " [ options ] fmtname [ fmtname ]\n"
               "  where fmtname is the Media Format Name for the codec(s) to test, up to two\n"
@@ -137,6 +402,10 @@ void CodecTest::Main()
               "  --count n               : set number of frames to transcode\n"
               "  --noprompt              : do not prompt for commands, i.e. exit when input closes\n"
               "  --snr                   : calculate signal-to-noise ratio between input and output\n"
+              "  --g711-bench            : check G.711 batch conversion is bit exact and measure speed,\n"
+              "                            --count sets number of 20ms frames, default 10000\n"
+              "  --h261-bench            : measure H.261 encode and decode speed at QCIF and CIF,\n"
+              "                            --count sets number of frames, default 300\n"
 #if PTRACING
               "  -o or --output file     : file name for output of log messages\n"       
               "  -t or --trace           : degree of verbosity in error log (more times for more detail)\n"     
@@ -0,0 +1,238 @@
+/*
+ * gcbench.cxx
+ *
+ * OPAL application source file for benchmarking garbage collection of released calls
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+#include <ptlib/sockets.h>
+
+#include <opal/buildopts.h>
+
+#include <opal/manager.h>
+#include <opal/endpoint.h>
+#include <opal/call.h>
+
+#include "main.h"
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**Stands in for the A-party of a call, holding a UDP port as its RTP
+   session would until the connection is deleted.
+  */
+class BenchGarbageConnection : public OpalConnection
+{
+  PCLASSINFO(BenchGarbageConnection, OpalConnection);
+
+  public:
+    BenchGarbageConnection(OpalCall & call,
+                           OpalEndPoint & endpoint,
+                           const PString & token,
+                           WORD port,
+                           BenchSamples & latency,
+                           PAtomicInteger & deleted,
+                           PAtomicInteger & bindFailures)
+      : OpalConnection(call, endpoint, token)
+      , m_latency(latency)
+      , m_deleted(deleted)
+      , m_released(0)
+    {
+      if (port != 0 && !m_socket.Listen(PIPSocket::Address::GetAny(4), 0, port))
+        ++bindFailures;
+    }
+
+    ~BenchGarbageConnection()
+    {
+      m_socket.Close();
+      if (m_released != 0) {
+        m_latency.Add(PTime().GetTimestamp() - m_released);
+        ++m_deleted;
+      }
+    }
+
+    virtual bool IsNetworkConnection() const { return false; }
+    virtual PBoolean SetUpConnection() { return true; }
+    virtual PBoolean SetAlerting(const PString &, PBoolean) { return true; }
+
+    virtual void OnReleased()
+    {
+      if (m_socket.IsOpen())
+        m_released = PTime().GetTimestamp();
+      OpalConnection::OnReleased();
+    }
+
+  protected:
+    PUDPSocket       m_socket;
+    BenchSamples   & m_latency;
+    PAtomicInteger & m_deleted;
+    PInt64           m_released;
+};
+
+
+/**Creates the connections for the benchmark calls directly. In legacy mode
+   released connections are not queued, so are only found by the periodic
+   sweep, as all of them were before.
+  */
+class BenchGarbageEndPoint : public OpalEndPoint
+{
+  PCLASSINFO(BenchGarbageEndPoint, OpalEndPoint);
+
+  public:
+    BenchGarbageEndPoint(OpalManager & manager, bool legacy)
+      : OpalEndPoint(manager, "bench", CanTerminateCall)
+      , m_legacy(legacy)
+    {
+    }
+
+    virtual PBoolean MakeConnection(OpalCall &, const PString &, void *, unsigned, OpalConnection::StringOptions *)
+    {
+      return false;
+    }
+
+    virtual void OnReleased(OpalConnection & connection)
+    {
+      if (!m_legacy) {
+        OpalEndPoint::OnReleased(connection);
+        return;
+      }
+
+      connectionsActive.RemoveAt(connection.GetToken());
+      manager.OnReleased(connection);
+    }
+
+    bool AddBenchConnection(OpalCall & call, const PString & token, WORD port)
+    {
+      return AddConnection(new BenchGarbageConnection(call, *this, token, port, m_latency, m_deleted, m_bindFailures));
+    }
+
+    BenchSamples   m_latency;
+    PAtomicInteger m_deleted;
+    PAtomicInteger m_bindFailures;
+
+  protected:
+    bool m_legacy;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static bool RunGarbageBenchmark(unsigned callCount, unsigned releases, WORD basePort, bool legacy)
+{
+  OpalManager * manager = new OpalManager;
+  BenchGarbageEndPoint * endpoint = new BenchGarbageEndPoint(*manager, legacy);
+
+  PStringArray tokens(callCount);
+  for (unsigned i = 0; i < callCount; ++i) {
+    OpalCall * call = manager->CreateCall(NULL);
+    if (call == NULL)
+      break;
+    tokens[i] = call->GetToken();
+    endpoint->AddBenchConnection(*call, psprintf("a%u", i), (WORD)(basePort+i));
+    endpoint->AddBenchConnection(*call, psprintf("b%u", i), 0);
+  }
+
+  // What the collector used to cost every second, and still does as a safety net
+  PInt64 sweepStart = PTime().GetTimestamp();
+  manager->GarbageCollection();
+  PInt64 sweepTime = PTime().GetTimestamp() - sweepStart;
+
+  // Steady churn, releasing calls spread across the whole set
+  BenchUsage before;
+  unsigned step = PMAX(1U, callCount/releases);
+  unsigned released = 0;
+  for (unsigned i = 0; i < callCount && released < releases; i += step) {
+    PSafePtr<OpalCall> call = manager->FindCallWithLock(tokens[i], PSafeReference);
+    if (call != NULL) {
+      call->Clear();
+      ++released;
+    }
+    PThread::Sleep(2);
+  }
+
+  PTime deadline = PTime() + PTimeInterval(0, 10);
+  while ((unsigned)endpoint->m_deleted < released && PTime() < deadline)
+    PThread::Sleep(1);
+
+  BenchUsage after;
+
+  cout << "    " << setw(8) << (legacy ? "sweep" : "queued") << ": "
+       << "deleted=" << (unsigned)endpoint->m_deleted << '/' << released
+       << " port-reuse p50=" << endpoint->m_latency.GetPercentile(50)/1000.0 << "ms"
+       << " p99=" << endpoint->m_latency.GetPercentile(99)/1000.0 << "ms"
+       << " sweep=" << sweepTime << "us"
+       << " context-switches=" << (after.m_contextSwitches - before.m_contextSwitches)
+       << " cpu=" << (after.m_cpuTime - before.m_cpuTime)/1000000.0 << 's'
+       << endl;
+
+  // Unbound connections are never counted, so would pass without being collected
+  bool ok = true;
+  if (endpoint->m_bindFailures != 0) {
+    cout << "    " << (unsigned)endpoint->m_bindFailures << " ports from " << basePort << " could not be bound MISMATCH" << endl;
+    ok = false;
+  }
+  if ((unsigned)endpoint->m_deleted < released) {
+    cout << "    released connections not deleted MISMATCH" << endl;
+    ok = false;
+  }
+
+  manager->ClearAllCalls();
+  delete manager;
+
+  return ok;
+}
+
+
+static bool GarbageBenchmark(PArgList & args)
+{
+  PStringArray counts = args.GetOptionString('s', "5000").Tokenise(",");
+  unsigned releases = args.GetOptionString('r', "1000").AsUnsigned();
+  WORD port = (WORD)args.GetOptionString('p', "20000").AsUnsigned();
+  if (releases == 0)
+    releases = 1;
+
+  cout << "Garbage collection benchmark, " << releases
+       << " calls released while the rest stay up" << endl;
+
+  bool ok = true;
+  for (PINDEX i = 0; i < counts.GetSize(); ++i) {
+    unsigned count = counts[i].AsUnsigned();
+    if (count == 0)
+      continue;
+
+    cout << setw(7) << count << " concurrent calls" << endl;
+    ok = RunGarbageBenchmark(count, releases, port, true) && ok;
+    ok = RunGarbageBenchmark(count, releases, port, false) && ok;
+  }
+
+  return ok;
+}
+
+OPALBENCH_TEST("garbage", "Port reuse after release, periodic sweep vs queued collection",
+               "-s 5000 -r 1000 -p 20000", GarbageBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,430 @@
+/*
+ * gkbench.cxx
+ *
+ * OPAL application source file for benchmarking gatekeeper registration lookups
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <opal/manager.h>
+#include <h323/h323ep.h>
+#include <h323/gkserver.h>
+
+#include "main.h"
+
+
+#define GATEWAY_INTERVAL 20   // Every this many endpoints is a gateway with a voice prefix
+
+
+#if OPAL_H323
+
+/////////////////////////////////////////////////////////////////////////////
+
+static PString AliasName(unsigned index)
+{
+  return psprintf("user%u", index);
+}
+
+
+static PString SignalAddress(unsigned index)
+{
+  return psprintf("ip$10.%u.%u.%u:1720", (index>>16)&255, (index>>8)&255, index&255);
+}
+
+
+static PString VoicePrefix(unsigned index)
+{
+  return psprintf("%u", 1000 + index/GATEWAY_INTERVAL);
+}
+
+
+/**Registration record with its addresses set directly, rather than from an
+   RRQ.
+  */
+class BenchRegisteredEndPoint : public H323RegisteredEndPoint
+{
+  PCLASSINFO(BenchRegisteredEndPoint, H323RegisteredEndPoint);
+
+  public:
+    BenchRegisteredEndPoint(H323GatekeeperServer & server, unsigned index, const PString & voicePrefix)
+      : H323RegisteredEndPoint(server, psprintf("bench:%u", index))
+    {
+      signalAddresses.SetSize(1);
+      signalAddresses[0] = SignalAddress(index);
+      aliases.AppendString(AliasName(index));
+      if (!voicePrefix.IsEmpty())
+        voicePrefixes.AppendString(voicePrefix);
+    }
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/* This is how H323GatekeeperServer held registrations before it had hashed
+   indexes and a prefix trie, for comparison. */
+
+class LegacyRegistrations
+{
+  public:
+    class StringMap : public PString {
+        PCLASSINFO(StringMap, PString);
+      public:
+        StringMap(const PString & from, const PString & id)
+          : PString(from), identifier(id) { }
+        PString identifier;
+    };
+
+    void Add(unsigned index, const PString & voicePrefix)
+    {
+      PString identifier = psprintf("bench:%u", index);
+      PWaitAndSignal wait(mutex);
+      byAddress.Append(new StringMap(SignalAddress(index), identifier));
+      byAlias.Append(new StringMap(AliasName(index), identifier));
+      if (!voicePrefix.IsEmpty())
+        byVoicePrefix.Append(new StringMap(voicePrefix, identifier));
+    }
+
+    void Remove(unsigned index)
+    {
+      PString identifier = psprintf("bench:%u", index);
+      PWaitAndSignal wait(mutex);
+      RemoveFrom(byVoicePrefix, identifier);
+      RemoveFrom(byAlias, identifier);
+      RemoveFrom(byAddress, identifier);
+    }
+
+    PString FindByAliasString(const PString & alias)
+    {
+      {
+        PWaitAndSignal wait(mutex);
+        PINDEX pos = byAlias.GetValuesIndex(alias);
+        if (pos != P_MAX_INDEX)
+          return ((StringMap &)byAlias[pos]).identifier;
+      }
+      return FindByPrefixString(alias);
+    }
+
+    PString FindByPrefixString(const PString & prefix)
+    {
+      PWaitAndSignal wait(mutex);
+
+      if (byVoicePrefix.IsEmpty())
+        return PString::Empty();
+
+      for (PINDEX len = prefix.GetLength(); len > 0; len--) {
+        PINDEX pos = byVoicePrefix.GetValuesIndex(prefix.Left(len));
+        if (pos != P_MAX_INDEX)
+          return ((StringMap &)byVoicePrefix[pos]).identifier;
+      }
+
+      return PString::Empty();
+    }
+
+  protected:
+    static void RemoveFrom(PSortedStringList & list, const PString & identifier)
+    {
+      for (PINDEX i = 0; i < list.GetSize(); i++) {
+        if (((StringMap &)*list.GetAt(i)).identifier == identifier)
+          list.RemoveAt(i--);
+      }
+    }
+
+    PMutex            mutex;
+    PSortedStringList byAddress;
+    PSortedStringList byAlias;
+    PSortedStringList byVoicePrefix;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**Common interface so the same load can be put on either table.
+  */
+class BenchRegistrationTable
+{
+  public:
+    virtual ~BenchRegistrationTable() { }
+    virtual const char * GetName() const = 0;
+    virtual void Register(unsigned index, const PString & voicePrefix) = 0;
+    virtual void Unregister(unsigned index) = 0;
+    virtual PString FindAlias(const PString & alias) = 0;
+
+    void Register(unsigned index)
+    {
+      Register(index, index%GATEWAY_INTERVAL == 0 ? VoicePrefix(index) : PString::Empty());
+    }
+};
+
+
+class BenchLegacyTable : public BenchRegistrationTable
+{
+  public:
+    virtual const char * GetName() const { return "legacy"; }
+    using BenchRegistrationTable::Register;
+    virtual void Register(unsigned index, const PString & voicePrefix) { m_registrations.Add(index, voicePrefix); }
+    virtual void Unregister(unsigned index) { m_registrations.Remove(index); }
+    virtual PString FindAlias(const PString & alias) { return m_registrations.FindByAliasString(alias); }
+
+  protected:
+    LegacyRegistrations m_registrations;
+};
+
+
+class BenchIndexedTable : public BenchRegistrationTable
+{
+  public:
+    BenchIndexedTable(H323GatekeeperServer & server)
+      : m_server(server)
+    {
+    }
+
+    virtual const char * GetName() const { return "indexed"; }
+
+    using BenchRegistrationTable::Register;
+    virtual void Register(unsigned index, const PString & voicePrefix)
+    {
+      m_server.AddEndPoint(new BenchRegisteredEndPoint(m_server, index, voicePrefix));
+    }
+
+    virtual void Unregister(unsigned index)
+    {
+      PSafePtr<H323RegisteredEndPoint> ep = m_server.FindEndPointByIdentifier(psprintf("bench:%u", index));
+      if (ep != NULL)
+        m_server.RemoveEndPoint(ep);
+    }
+
+    virtual PString FindAlias(const PString & alias)
+    {
+      PSafePtr<H323RegisteredEndPoint> ep = m_server.FindEndPointByAliasString(alias, PSafeReference);
+      return ep != NULL ? ep->GetIdentifier() : PString::Empty();
+    }
+
+  protected:
+    H323GatekeeperServer & m_server;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**Does ARQ style lookups, half registered aliases and half numbers dialled
+   through a gateway prefix.
+  */
+class BenchLookupThread : public PThread
+{
+  PCLASSINFO(BenchLookupThread, PThread);
+
+  public:
+    BenchLookupThread(BenchRegistrationTable & table, unsigned count, unsigned lookups, unsigned seed)
+      : PThread(65536, NoAutoDeleteThread, NormalPriority, "Bench Lookup")
+      , m_table(table)
+      , m_count(count)
+      , m_lookups(lookups)
+      , m_seed(seed)
+      , m_found(0)
+    {
+      Resume();
+    }
+
+    virtual void Main()
+    {
+      PRandom random(m_seed);
+      for (unsigned i = 0; i < m_lookups; ++i) {
+        unsigned index = random.Generate()%m_count;
+        PString alias = (i&1) != 0 ? AliasName(index) : (VoicePrefix(index) + "5551234");
+        if (!m_table.FindAlias(alias).IsEmpty())
+          ++m_found;
+      }
+    }
+
+    unsigned GetFound() const { return m_found; }
+
+  protected:
+    BenchRegistrationTable & m_table;
+    unsigned                 m_count;
+    unsigned                 m_lookups;
+    unsigned                 m_seed;
+    unsigned                 m_found;
+};
+
+
+static void RunTableBenchmark(BenchRegistrationTable & table, unsigned count, unsigned lookups, unsigned threads)
+{
+  PTimeInterval start = PTimer::Tick();
+  for (unsigned i = 0; i < count; ++i)
+    table.Register(i);
+  PTimeInterval registerTime = PTimer::Tick() - start;
+
+  std::vector<BenchLookupThread *> lookupThreads;
+
+  BenchUsage before;
+  start = PTimer::Tick();
+
+  for (unsigned i = 0; i < threads; ++i)
+    lookupThreads.push_back(new BenchLookupThread(table, count, lookups, i+1));
+
+  // Re-register endpoints while the lookups run, as RRQs would
+  unsigned reregistrations = 0;
+  PRandom random(threads+1);
+  for (;;) {
+    bool running = false;
+    for (size_t i = 0; i < lookupThreads.size(); ++i) {
+      if (!lookupThreads[i]->IsTerminated())
+        running = true;
+    }
+    if (!running)
+      break;
+
+    unsigned index = random.Generate()%count;
+    table.Unregister(index);
+    table.Register(index);
+    ++reregistrations;
+  }
+
+  PTimeInterval elapsed = PTimer::Tick() - start;
+  BenchUsage after;
+
+  unsigned found = 0;
+  for (size_t i = 0; i < lookupThreads.size(); ++i) {
+    lookupThreads[i]->WaitForTermination();
+    found += lookupThreads[i]->GetFound();
+    delete lookupThreads[i];
+  }
+
+  PInt64 ms = PMAX((PInt64)1, elapsed.GetMilliSeconds());
+  cout << "    " << setw(8) << table.GetName() << ": "
+       << "register=" << (unsigned)(count*1000.0/PMAX((PInt64)1, registerTime.GetMilliSeconds())) << "/s"
+       << " lookups=" << (unsigned)((PUInt64)lookups*threads*1000/ms) << "/s"
+       << " found=" << found << '/' << lookups*threads
+       << " re-registrations=" << (unsigned)((PUInt64)reregistrations*1000/ms) << "/s"
+       << " context-switches=" << (after.m_contextSwitches - before.m_contextSwitches)
+       << endl;
+}
+
+
+/**Look up every alias and voice prefix in both tables, one at a time, and
+   check they give the same, expected, endpoint. An extra gateway has a
+   longer prefix inside the first one's, so routing must take the longest.
+  */
+static bool RunSerialCheck(H323EndPoint & endpoint, unsigned count)
+{
+  BenchLegacyTable legacy;
+  H323GatekeeperServer server(endpoint);
+  BenchIndexedTable indexed(server);
+
+  PString longPrefix = VoicePrefix(0) + "555";
+  for (unsigned i = 0; i < count; ++i) {
+    legacy.Register(i);
+    indexed.Register(i);
+  }
+  legacy.Register(count, longPrefix);
+  indexed.Register(count, longPrefix);
+
+  std::vector<PString> dialled, expected;
+  for (unsigned i = 0; i < count; ++i) {
+    dialled.push_back(AliasName(i));
+    expected.push_back(psprintf("bench:%u", i));
+    dialled.push_back(VoicePrefix(i) + "4441234");
+    expected.push_back(psprintf("bench:%u", i - i%GATEWAY_INTERVAL));
+  }
+  dialled.push_back(AliasName(count));
+  expected.push_back(psprintf("bench:%u", count));
+  dialled.push_back(longPrefix + "1234");
+  expected.push_back(psprintf("bench:%u", count));
+  dialled.push_back("0" + VoicePrefix(0));
+  expected.push_back(PString::Empty());
+
+  unsigned mismatched = 0;
+  for (size_t i = 0; i < dialled.size(); ++i) {
+    PString legacyId = legacy.FindAlias(dialled[i]);
+    PString indexedId = indexed.FindAlias(dialled[i]);
+    if (legacyId != expected[i] || indexedId != expected[i]) {
+      if (mismatched++ < 10)
+        cout << "    " << dialled[i] << ": legacy=" << legacyId << " indexed=" << indexedId
+             << " expected=" << expected[i] << " MISMATCH" << endl;
+    }
+  }
+
+  cout << "    serial lookups: " << (mismatched == 0 ? "match" : "MISMATCH") << endl;
+  return mismatched == 0;
+}
+
+#endif // OPAL_H323
+
+
+static bool GatekeeperBenchmark(PArgList & args)
+{
+#if OPAL_H323
+  PStringArray counts = args.GetOptionString('s', "10000,100000").Tokenise(",");
+  unsigned lookups = args.GetOptionString('r', "100000").AsUnsigned();
+  unsigned threads = args.GetOptionString('T', "4").AsUnsigned();
+  if (lookups == 0)
+    lookups = 1;
+  if (threads == 0)
+    threads = 1;
+
+  OpalManager manager;
+  H323EndPoint * endpoint = new H323EndPoint(manager);
+
+  bool ok = true;
+
+  cout << "Gatekeeper registration benchmark, " << threads << " threads doing "
+       << lookups << " alias and prefix lookups each, with concurrent re-registration" << endl;
+
+  for (PINDEX i = 0; i < counts.GetSize(); ++i) {
+    unsigned count = counts[i].AsUnsigned();
+    if (count == 0)
+      continue;
+
+    cout << setw(7) << count << " registrations, "
+         << (count+GATEWAY_INTERVAL-1)/GATEWAY_INTERVAL << " voice prefixes" << endl;
+
+    ok = RunSerialCheck(*endpoint, count) && ok;
+
+    {
+      BenchLegacyTable legacy;
+      RunTableBenchmark(legacy, count, lookups, threads);
+    }
+
+    {
+      H323GatekeeperServer server(*endpoint);
+      BenchIndexedTable indexed(server);
+      RunTableBenchmark(indexed, count, lookups, threads);
+    }
+  }
+  return ok;
+#else
+  cout << "H.323 not supported in this build." << endl;
+  return true;
+#endif
+}
+
+OPALBENCH_TEST("gatekeeper", "Gatekeeper ARQ lookups during re-registration, lists vs indexes",
+               "-s 10000,100000 -T 4 -r 100000", GatekeeperBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
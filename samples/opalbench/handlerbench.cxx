@@ -0,0 +1,237 @@
+/*
+ * handlerbench.cxx
+ *
+ * OPAL application source file for benchmarking SIP handler lookups
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <opal/manager.h>
+#include <sip/sipep.h>
+#include <sip/handlers.h>
+
+#include "main.h"
+
+
+#define DOMAIN_COUNT 50   // Handlers are spread over this many domains
+
+
+#if OPAL_SIP
+
+/////////////////////////////////////////////////////////////////////////////
+
+/* These are the searches of the whole list SIPHandlersList did before it
+   had indexes, for comparison. */
+
+static PSafePtr<SIPHandler> LegacyFindByCallID(const SIPHandlersList & list, const PString & callID)
+{
+  for (PSafePtr<SIPHandler> handler = list.GetFirstHandler(); handler != NULL; ++handler) {
+    if (callID == handler->GetCallID() && handler.SetSafetyMode(PSafeReadOnly))
+      return handler;
+  }
+  return NULL;
+}
+
+
+static PSafePtr<SIPHandler> LegacyFindByUrl(const SIPHandlersList & list, const PString & url, SIP_PDU::Methods meth)
+{
+  SIPURL remoteURL = url;
+  for (PSafePtr<SIPHandler> handler = list.GetFirstHandler(); handler != NULL; ++handler) {
+    if (handler->GetMethod() == meth && handler->GetAddressOfRecord() == remoteURL && handler.SetSafetyMode(PSafeReadOnly))
+      return handler;
+  }
+  return NULL;
+}
+
+
+static PSafePtr<SIPHandler> LegacyFindByAuthRealm(const SIPHandlersList & list, const PString & realm, const PString & userName)
+{
+  for (PSafePtr<SIPHandler> handler = list.GetFirstHandler(); handler != NULL; ++handler) {
+    if (handler->GetUsername() == userName &&
+        (handler->GetRealm().IsEmpty() || handler->GetRealm() == realm) &&
+        handler.SetSafetyMode(PSafeReadOnly))
+      return handler;
+  }
+  return NULL;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static PString UserName(unsigned index)
+{
+  return psprintf("user%u", index);
+}
+
+
+static PString DomainName(unsigned index)
+{
+  return psprintf("domain%u.example.com", index%DOMAIN_COUNT);
+}
+
+
+static PString AddressOfRecord(unsigned index)
+{
+  return "sip:" + UserName(index) + '@' + DomainName(index);
+}
+
+
+static void ReportRate(const char * name, unsigned lookups, const PTimeInterval & legacy, const PTimeInterval & indexed)
+{
+  cout << "    " << setw(10) << name << ": "
+       << "legacy=" << (unsigned)(lookups*1000.0/PMAX((PInt64)1, legacy.GetMilliSeconds())) << "/s"
+       << " indexed=" << (unsigned)(lookups*1000.0/PMAX((PInt64)1, indexed.GetMilliSeconds())) << "/s"
+       << endl;
+}
+
+
+static bool RunHandlerBenchmark(SIPEndPoint & endpoint, unsigned count, unsigned lookups)
+{
+  SIPHandlersList list;
+  std::vector<PString> callIDs(count);
+
+  PTimeInterval start = PTimer::Tick();
+  for (unsigned i = 0; i < count; ++i) {
+    SIPRegister::Params params;
+    params.m_addressOfRecord = AddressOfRecord(i);
+    params.m_authID = UserName(i);
+    params.m_realm = DomainName(i);
+    SIPHandler * handler = new SIPRegisterHandler(endpoint, params);
+    callIDs[i] = handler->GetCallID();
+    list.Append(handler);
+  }
+  PTimeInterval appendTime = PTimer::Tick() - start;
+
+  cout << setw(7) << count << " handlers, appended in " << appendTime.GetMilliSeconds() << "ms" << endl;
+
+  // Scale down the linear searches so big lists do not take forever
+  unsigned legacyLookups = PMAX(10U, (unsigned)((PUInt64)lookups*1000/PMAX(1000U, count)));
+  unsigned found = 0;
+  PRandom random(1);
+
+  start = PTimer::Tick();
+  for (unsigned i = 0; i < legacyLookups; ++i)
+    found += LegacyFindByCallID(list, callIDs[random.Generate()%count]) != NULL;
+  PTimeInterval legacy = (PTimer::Tick() - start)*lookups/legacyLookups;
+  start = PTimer::Tick();
+  for (unsigned i = 0; i < lookups; ++i)
+    found += list.FindSIPHandlerByCallID(callIDs[random.Generate()%count], PSafeReadOnly) != NULL;
+  ReportRate("Call-ID", lookups, legacy, PTimer::Tick() - start);
+
+  start = PTimer::Tick();
+  for (unsigned i = 0; i < legacyLookups; ++i)
+    found += LegacyFindByUrl(list, AddressOfRecord(random.Generate()%count), SIP_PDU::Method_REGISTER) != NULL;
+  legacy = (PTimer::Tick() - start)*lookups/legacyLookups;
+  start = PTimer::Tick();
+  for (unsigned i = 0; i < lookups; ++i)
+    found += list.FindSIPHandlerByUrl(AddressOfRecord(random.Generate()%count), SIP_PDU::Method_REGISTER, PSafeReadOnly) != NULL;
+  ReportRate("AOR", lookups, legacy, PTimer::Tick() - start);
+
+  start = PTimer::Tick();
+  for (unsigned i = 0; i < legacyLookups; ++i) {
+    unsigned index = random.Generate()%count;
+    found += LegacyFindByAuthRealm(list, DomainName(index), UserName(index)) != NULL;
+  }
+  legacy = (PTimer::Tick() - start)*lookups/legacyLookups;
+  start = PTimer::Tick();
+  for (unsigned i = 0; i < lookups; ++i) {
+    unsigned index = random.Generate()%count;
+    found += list.FindSIPHandlerByAuthRealm(DomainName(index), UserName(index), PSafeReadOnly) != NULL;
+  }
+  ReportRate("realm+user", lookups, legacy, PTimer::Tick() - start);
+
+  // Domain lookups find the first of many, so the linear search is not timed
+  start = PTimer::Tick();
+  for (unsigned i = 0; i < lookups; ++i)
+    found += list.FindSIPHandlerByDomain(DomainName(random.Generate()), SIP_PDU::Method_REGISTER, PSafeReadOnly) != NULL;
+  PTimeInterval domainTime = PTimer::Tick() - start;
+  cout << "    " << setw(10) << "domain" << ": indexed="
+       << (unsigned)(lookups*1000.0/PMAX((PInt64)1, domainTime.GetMilliSeconds())) << "/s" << endl;
+
+  unsigned expected = (legacyLookups + lookups)*3 + lookups;
+  bool ok = found == expected;
+  if (!ok)
+    cout << "    Only " << found << " of " << expected << " lookups succeeded!" << endl;
+
+  // Scheme and host are not case sensitive, the index must agree with the search
+  for (unsigned i = 0; i < 100; ++i) {
+    unsigned index = random.Generate()%count;
+    PString url = "SIP:" + UserName(index) + '@' + DomainName(index).ToUpper();
+    bool legacyFound = LegacyFindByUrl(list, url, SIP_PDU::Method_REGISTER) != NULL;
+    bool indexFound = list.FindSIPHandlerByUrl(url, SIP_PDU::Method_REGISTER, PSafeReadOnly) != NULL;
+    bool domainFound = list.FindSIPHandlerByDomain(DomainName(index).ToUpper(), SIP_PDU::Method_REGISTER, PSafeReadOnly) != NULL;
+    if (legacyFound != indexFound || !domainFound) {
+      cout << "    Mixed case lookup of " << url << " MISMATCH" << endl;
+      ok = false;
+      break;
+    }
+  }
+
+  start = PTimer::Tick();
+  for (PSafePtr<SIPHandler> handler = list.GetFirstHandler(); handler != NULL; )
+    list.Remove(handler++);
+  list.DeleteObjectsToBeRemoved();
+  cout << "    removed in " << (PTimer::Tick() - start).GetMilliSeconds() << "ms" << endl;
+
+  return ok;
+}
+
+#endif // OPAL_SIP
+
+
+static bool HandlerBenchmark(PArgList & args)
+{
+#if OPAL_SIP
+  PStringArray counts = args.GetOptionString('s', "1000,10000,100000").Tokenise(",");
+  unsigned lookups = args.GetOptionString('r', "100000").AsUnsigned();
+  if (lookups == 0)
+    lookups = 1;
+
+  OpalManager manager;
+  SIPEndPoint * endpoint = new SIPEndPoint(manager);
+
+  cout << "SIP handler lookup benchmark, " << lookups << " lookups of each kind" << endl;
+
+  bool ok = true;
+  for (PINDEX i = 0; i < counts.GetSize(); ++i) {
+    unsigned count = counts[i].AsUnsigned();
+    if (count > 0 && !RunHandlerBenchmark(*endpoint, count, lookups))
+      ok = false;
+  }
+  return ok;
+#else
+  cout << "SIP not supported in this build." << endl;
+  return true;
+#endif
+}
+
+OPALBENCH_TEST("handlers", "SIP handler lookups, linear search vs indexes",
+               "-s 1000,10000,100000 -r 100000", HandlerBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
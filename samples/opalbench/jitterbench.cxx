@@ -0,0 +1,336 @@
+/*
+ * jitterbench.cxx
+ *
+ * OPAL application source file for benchmarking the jitter buffer
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <rtp/jitter.h>
+
+#include <queue>
+#include <algorithm>
+
+#include "main.h"
+
+
+#define FRAME_TIME     20   // Milliseconds
+#define FRAME_SAMPLES 160   // At 8kHz
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**Jitter buffer fed from the bench, either via its own thread calling
+   OnReadPacket() as RTP_JitterBuffer does, or via WriteData(). In lock step
+   Deliver() does not return until the jitter thread has the packet in the
+   buffer, so both ways can be fed exactly the same.
+  */
+class BenchJitterBuffer : public OpalJitterBuffer
+{
+  PCLASSINFO(BenchJitterBuffer, OpalJitterBuffer);
+
+  public:
+    BenchJitterBuffer(bool inlineIngest, unsigned minDelay, unsigned maxDelay, bool lockStep = false)
+      : OpalJitterBuffer(minDelay*8, maxDelay*8)
+      , m_closed(false)
+      , m_lockStep(lockStep)
+      , m_delivered(0)
+      , m_reads(0)
+    {
+      SetInlineIngest(inlineIngest);
+      Resume();
+    }
+
+    ~BenchJitterBuffer()
+    {
+      Close();
+      WaitForTermination(10000);
+    }
+
+    void Deliver(const RTP_DataFrame & frame)
+    {
+      if (IsInlineIngest()) {
+        WriteData(frame);
+        return;
+      }
+
+      {
+        PWaitAndSignal mutex(m_queueMutex);
+        m_queue.push(frame);
+        ++m_delivered;
+      }
+      m_queueSignal.Signal();
+
+      /* The jitter thread only asks for the next packet once the last one
+         is in the buffer, so wait for that. */
+      while (m_lockStep) {
+        {
+          PWaitAndSignal mutex(m_queueMutex);
+          if (m_reads > m_delivered || m_closed)
+            break;
+        }
+        m_readSignal.Wait(10);
+      }
+    }
+
+    void Close()
+    {
+      Shutdown();
+      {
+        PWaitAndSignal mutex(m_queueMutex);
+        m_closed = true;
+      }
+      m_queueSignal.Signal();
+    }
+
+    virtual PBoolean OnReadPacket(RTP_DataFrame & frame, PBoolean)
+    {
+      {
+        PWaitAndSignal mutex(m_queueMutex);
+        ++m_reads;
+      }
+      m_readSignal.Signal();
+
+      for (;;) {
+        {
+          PWaitAndSignal mutex(m_queueMutex);
+          if (m_closed)
+            return false;
+          if (!m_queue.empty()) {
+            frame = m_queue.front();
+            m_queue.pop();
+            return true;
+          }
+        }
+        m_queueSignal.Wait();
+      }
+    }
+
+  protected:
+    std::queue<RTP_DataFrame> m_queue;
+    PMutex                    m_queueMutex;
+    PSyncPoint                m_queueSignal;
+    bool                      m_closed;
+    bool                      m_lockStep;
+    unsigned                  m_delivered;
+    unsigned                  m_reads;
+    PSyncPoint                m_readSignal;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+struct BenchArrival
+{
+  unsigned m_sequence;
+  unsigned m_arrival;   // Milliseconds since start
+
+  bool operator<(const BenchArrival & other) const { return m_arrival < other.m_arrival; }
+};
+
+
+static void RunJitterBenchmark(const std::vector<BenchArrival> & schedule,
+                               unsigned bufferCount,
+                               bool inlineIngest,
+                               unsigned minDelay,
+                               unsigned maxDelay)
+{
+  BenchUsage before;
+
+  std::vector<BenchJitterBuffer *> buffers;
+  for (unsigned i = 0; i < bufferCount; ++i)
+    buffers.push_back(new BenchJitterBuffer(inlineIngest, minDelay, maxDelay));
+
+  BenchUsage running;
+
+  RTP_DataFrame packet(FRAME_SAMPLES);
+  packet.SetPayloadType(RTP_DataFrame::PCMU);
+  memset(packet.GetPayloadPtr(), 0xff, packet.GetPayloadSize());
+
+  BenchSamples delay;
+  unsigned played = 0;
+  unsigned silent = 0;
+
+  PTime start;
+  size_t next = 0;
+  unsigned lastArrival = schedule.empty() ? 0 : schedule.back().m_arrival;
+  unsigned tick = 0;
+
+  /* Single thread both delivers packets at their arrival times, and pulls
+     from every buffer each frame time, as a media patch would. So the only
+     difference between the runs is how the jitter buffers are fed. */
+  while (next < schedule.size() || tick*FRAME_TIME < lastArrival+maxDelay*2) {
+    unsigned now = (unsigned)(PTime() - start).GetMilliSeconds();
+
+    while (next < schedule.size() && schedule[next].m_arrival <= now) {
+      packet.SetSequenceNumber((WORD)schedule[next].m_sequence);
+      packet.SetTimestamp(schedule[next].m_sequence*FRAME_SAMPLES);
+      for (size_t i = 0; i < buffers.size(); ++i)
+        buffers[i]->Deliver(packet);
+      ++next;
+    }
+
+    if (now >= tick*FRAME_TIME) {
+      RTP_DataFrame frame(0);
+      for (size_t i = 0; i < buffers.size(); ++i) {
+        frame.SetTimestamp(tick*FRAME_SAMPLES);
+        if (!buffers[i]->ReadData(frame))
+          continue;
+        if (frame.GetPayloadSize() == 0)
+          ++silent;
+        else {
+          ++played;
+          // Playout delay relative to when the packet was sent
+          delay.Add((PInt64)now - (PInt64)(frame.GetTimestamp()/FRAME_SAMPLES*FRAME_TIME));
+        }
+      }
+      ++tick;
+    }
+
+    PThread::Sleep(1);
+  }
+
+  unsigned jitterTime = buffers[0]->GetJitterTime()/8;
+
+  BenchUsage after;
+
+  for (size_t i = 0; i < buffers.size(); ++i)
+    delete buffers[i];
+
+  cout << setw(5) << bufferCount << " buffers, "
+       << (inlineIngest ? "inline  " : "threaded")
+       << ": threads=" << running.m_threads
+       << " context-switches=" << (after.m_contextSwitches - before.m_contextSwitches)
+       << " played=" << played/bufferCount << '/' << schedule.size()
+       << " silent=" << silent/bufferCount
+       << " jitter=" << jitterTime << "ms"
+       << " p50=" << delay.GetPercentile(50) << "ms"
+       << " p99=" << delay.GetPercentile(99) << "ms"
+       << endl;
+}
+
+
+/**Feed a jitter buffer with its own thread and an inline one the same
+   packets at the same times, and check the same comes out of both.
+  */
+static bool CheckIngestEquivalence(const std::vector<BenchArrival> & schedule,
+                                   unsigned minDelay,
+                                   unsigned maxDelay)
+{
+  BenchJitterBuffer threaded(false, minDelay, maxDelay, true);
+  BenchJitterBuffer inlined(true, minDelay, maxDelay);
+
+  RTP_DataFrame packet(FRAME_SAMPLES);
+  packet.SetPayloadType(RTP_DataFrame::PCMU);
+  memset(packet.GetPayloadPtr(), 0xff, packet.GetPayloadSize());
+
+  RTP_DataFrame threadedFrame(0), inlinedFrame(0);
+  unsigned differences = 0;
+
+  PTime start;
+  size_t next = 0;
+  unsigned lastArrival = schedule.empty() ? 0 : schedule.back().m_arrival;
+  unsigned tick = 0;
+
+  while (next < schedule.size() || tick*FRAME_TIME < lastArrival+maxDelay*2) {
+    unsigned now = (unsigned)(PTime() - start).GetMilliSeconds();
+
+    while (next < schedule.size() && schedule[next].m_arrival <= now) {
+      packet.SetSequenceNumber((WORD)schedule[next].m_sequence);
+      packet.SetTimestamp(schedule[next].m_sequence*FRAME_SAMPLES);
+      threaded.Deliver(packet);
+      inlined.Deliver(packet);
+      ++next;
+    }
+
+    if (now >= tick*FRAME_TIME) {
+      threadedFrame.SetTimestamp(tick*FRAME_SAMPLES);
+      inlinedFrame.SetTimestamp(tick*FRAME_SAMPLES);
+      bool threadedRead = threaded.ReadData(threadedFrame) != PFalse;
+      bool inlinedRead = inlined.ReadData(inlinedFrame) != PFalse;
+      if (threadedRead != inlinedRead ||
+          threadedFrame.GetPayloadSize() != inlinedFrame.GetPayloadSize() ||
+          (threadedFrame.GetPayloadSize() > 0 && threadedFrame.GetTimestamp() != inlinedFrame.GetTimestamp()))
+        ++differences;
+      ++tick;
+    }
+
+    PThread::Sleep(1);
+  }
+
+  threaded.Close();
+  threaded.WaitForTermination(10000);
+  inlined.Close();
+
+  bool sameAnalysis = threaded.HasSameAnalysis(inlined);
+  cout << "  threaded and inline output: " << (differences == 0 && sameAnalysis ? "match" : "DIFFER");
+  if (differences > 0)
+    cout << ", " << differences << " of " << tick << " frames read differ";
+  if (!sameAnalysis)
+    cout << ", analyser records differ";
+  cout << endl;
+
+  return differences == 0 && sameAnalysis;
+}
+
+
+static bool JitterBenchmark(PArgList & args)
+{
+  unsigned count = args.GetOptionString('b', "200").AsUnsigned();
+  unsigned rounds = args.GetOptionString('r', "250").AsUnsigned();
+  unsigned jitter = args.GetOptionString('j', "40").AsUnsigned();
+  if (count == 0)
+    count = 1;
+
+  cout << "Jitter buffer benchmark, " << rounds << " packets with up to "
+       << jitter << "ms network jitter" << endl;
+
+  // Same pseudo random arrival pattern, including reordering, for each run
+  std::vector<BenchArrival> schedule;
+  srand(1);
+  for (unsigned i = 0; i < rounds; ++i) {
+    BenchArrival arrival;
+    arrival.m_sequence = i;
+    arrival.m_arrival = i*FRAME_TIME + (jitter > 0 ? rand()%jitter : 0);
+    schedule.push_back(arrival);
+  }
+  std::stable_sort(schedule.begin(), schedule.end());
+
+  bool ok = CheckIngestEquivalence(schedule, 40, 200);
+
+  RunJitterBenchmark(schedule, count, false, 40, 200);
+  RunJitterBenchmark(schedule, count, true, 40, 200);
+
+  return ok;
+}
+
+OPALBENCH_TEST("jitter", "Jitter buffer with own thread vs inline ingest",
+               "-b 200 -r 250 -j 40", JitterBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
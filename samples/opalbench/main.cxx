@@ -0,0 +1,315 @@
+/*
+ * main.cxx
+ *
+ * OPAL application source file for benchmarking library internals
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include "main.h"
+
+#include <algorithm>
+
+#ifdef P_LINUX
+#include <sys/resource.h>
+#endif
+
+
+PCREATE_PROCESS(OpalBench);
+
+
+OpalBench::OpalBench()
+  : PProcess("OPAL Benchmarks", "OpalBench", 1, 0, ReleaseCode, 0)
+{
+}
+
+
+void OpalBench::Main()
+{
+  PArgList & args = GetArguments();
+
+  args.Parse("h-help."
+             "s-sessions:"
+             "T-threads:"
+             "r-rounds:"
+             "i-interval:"
+             "p-port:"
+             "b-buffers:"
+             "j-jitter:"
+             "c-codecs:"
+             "O-overhead:"
+#if PTRACING
+             "o-output:"             "-no-output."
+             "t-trace."              "-no-trace."
+#endif
+             , FALSE);
+
+#if PTRACING
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+         PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
+#endif
+
+  if (args.HasOption('h') || args.GetCount() == 0) {
+    PError << "usage: " << GetFile().GetTitle() << " [ options ] test [ test ... ]\n"
+              "\n"
+              "Available tests, with the options they use and their defaults, are:\n";
+    BenchTest::PrintUsage(PError);
+    PError << "\n"
+              "Available options are:\n"
+              "  --help                   : print this help message.\n"
+              "  -s or --sessions N[,N]   : Sessions, calls, streams etc per run, see above\n"
+              "  -T or --threads N        : Number of worker threads\n"
+              "  -r or --rounds N         : Number of packets, frames, lookups etc per run\n"
+              "  -i or --interval N       : Milliseconds between rounds, or blocked per release\n"
+              "  -p or --port N           : Base UDP port\n"
+              "  -b or --buffers N        : Number of jitter buffers\n"
+              "  -j or --jitter N         : Maximum network jitter in milliseconds\n"
+              "  -c or --codecs N         : Number of dummy codecs to register\n"
+              "  -O or --overhead N       : Largest overhead allowed, in nanoseconds per packet\n"
+#if PTRACING
+              "  -o or --output file     : file name for output of log messages\n"
+              "  -t or --trace           : degree of verbosity in error log (more times for more detail)\n"
+#endif
+              "\n"
+              "Tests that check their results as well as timing them exit with a\n"
+              "non-zero status if any check fails.\n"
+              "\n"
+              "Note that large session counts need the open file limit (ulimit -n)\n"
+              "to be at least four times the number of sessions.\n"
+              "\n"
+              "e.g. " << GetFile().GetTitle() << " --sessions 2000 reactor\n\n";
+    return;
+  }
+
+  unsigned failed = 0;
+
+  for (PINDEX i = 0; i < args.GetCount(); ++i) {
+    const BenchTest * test = BenchTest::Find(args[i]);
+    if (test == NULL) {
+      cerr << "Unknown test \"" << args[i] << '"' << endl;
+      ++failed;
+    }
+    else if (!test->Run(args)) {
+      cerr << "Test \"" << args[i] << "\" FAILED" << endl;
+      ++failed;
+    }
+  }
+
+  if (failed > 0)
+    SetTerminationValue(1);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+BenchTest * BenchTest::s_first;
+
+BenchTest::BenchTest(const char * name, const char * description, const char * options, Function function)
+  : m_name(name)
+  , m_description(description)
+  , m_options(options)
+  , m_function(function)
+  , m_next(s_first)
+{
+  // Static initialisation, s_first is zero before any constructor runs
+  s_first = this;
+}
+
+
+const BenchTest * BenchTest::Find(const PString & name)
+{
+  for (const BenchTest * test = s_first; test != NULL; test = test->m_next) {
+    if (name *= test->m_name)
+      return test;
+  }
+  return NULL;
+}
+
+
+static bool BenchTestNameLess(const BenchTest * first, const BenchTest * second)
+{
+  return strcmp(first->GetName(), second->GetName()) < 0;
+}
+
+
+void BenchTest::PrintUsage(ostream & strm)
+{
+  std::vector<const BenchTest *> tests;
+  for (const BenchTest * test = s_first; test != NULL; test = test->m_next)
+    tests.push_back(test);
+  std::sort(tests.begin(), tests.end(), BenchTestNameLess);
+
+  for (std::vector<const BenchTest *>::iterator it = tests.begin(); it != tests.end(); ++it) {
+    strm << "  " << setiosflags(ios::left) << setw(24) << (*it)->m_name
+         << resetiosflags(ios::left) << " : " << (*it)->m_description << '\n';
+    if (*(*it)->m_options != '\0')
+      strm << setw(29) << "" << (*it)->m_options << '\n';
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+PInt64 BenchSamples::GetPercentile(unsigned percent)
+{
+  PWaitAndSignal lock(m_mutex);
+
+  if (m_samples.empty())
+    return 0;
+
+  size_t index = (m_samples.size()-1)*percent/100;
+  std::nth_element(m_samples.begin(), m_samples.begin()+index, m_samples.end());
+  return m_samples[index];
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+BenchUsage::BenchUsage()
+  : m_threads(0)
+  , m_contextSwitches(0)
+  , m_cpuTime(0)
+{
+#ifdef P_LINUX
+  PTextFile status("/proc/self/status", PFile::ReadOnly);
+  PString line;
+  while (status.ReadLine(line)) {
+    if (line.NumCompare("Threads:") == PObject::EqualTo) {
+      m_threads = line.Mid(8).AsUnsigned();
+      break;
+    }
+  }
+
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    m_contextSwitches = usage.ru_nvcsw + usage.ru_nivcsw;
+    m_cpuTime = (PInt64)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)*1000000
+              + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+  }
+#endif
+}
+
+
+ostream & operator<<(ostream & strm, const BenchUsage & usage)
+{
+  return strm << "threads=" << usage.m_threads << " context-switches=" << usage.m_contextSwitches;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+#ifdef __GLIBC__
+
+static __thread bool          CountingAllocations;
+static __thread unsigned long AllocationCount;
+
+// Other threads, e.g. the RTP reactor, when counting all of them
+static volatile bool          CountingAllThreads;
+static volatile unsigned long AllThreadsCount;
+
+static inline void CountAllocation()
+{
+  if (CountingAllThreads)
+    __sync_fetch_and_add(&AllThreadsCount, 1);
+  else if (CountingAllocations)
+    ++AllocationCount;
+}
+
+extern "C" {
+  extern void * __libc_malloc(size_t size);
+  extern void * __libc_calloc(size_t count, size_t size);
+  extern void * __libc_realloc(void * ptr, size_t size);
+
+  void * malloc(size_t size)
+  {
+    CountAllocation();
+    return __libc_malloc(size);
+  }
+
+  void * calloc(size_t count, size_t size)
+  {
+    CountAllocation();
+    return __libc_calloc(count, size);
+  }
+
+  void * realloc(void * ptr, size_t size)
+  {
+    CountAllocation();
+    return __libc_realloc(ptr, size);
+  }
+}
+
+bool BenchAllocations::IsAvailable()
+{
+  return true;
+}
+
+void BenchAllocations::Start(bool allThreads)
+{
+  if (allThreads) {
+    AllThreadsCount = 0;
+    CountingAllThreads = true;
+  }
+  else {
+    AllocationCount = 0;
+    CountingAllocations = true;
+  }
+}
+
+unsigned long BenchAllocations::Stop()
+{
+  if (CountingAllThreads) {
+    CountingAllThreads = false;
+    return AllThreadsCount;
+  }
+
+  CountingAllocations = false;
+  return AllocationCount;
+}
+
+#else
+
+bool BenchAllocations::IsAvailable()
+{
+  return false;
+}
+
+void BenchAllocations::Start(bool)
+{
+}
+
+unsigned long BenchAllocations::Stop()
+{
+  return 0;
+}
+
+#endif // __GLIBC__
+
+
+// End of File ///////////////////////////////////////////////////////////////
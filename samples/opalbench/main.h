@@ -0,0 +1,137 @@
+/*
+ * main.h
+ *
+ * OPAL application source file for benchmarking library internals
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifndef _OpalBench_MAIN_H
+#define _OpalBench_MAIN_H
+
+#include <vector>
+
+
+class OpalBench : public PProcess
+{
+  PCLASSINFO(OpalBench, PProcess)
+
+  public:
+    OpalBench();
+
+    virtual void Main();
+};
+
+
+/**A test that can be run by name from the command line. Each test source
+   file registers its tests with OPALBENCH_TEST, so a new test only needs
+   adding to the Makefile.
+  */
+class BenchTest
+{
+  public:
+    /**Run the test. Returns false if any of its checks failed, in which
+       case opalbench exits with a non-zero status.
+      */
+    typedef bool (*Function)(PArgList & args);
+
+    BenchTest(
+      const char * name,        ///< Name used on the command line
+      const char * description, ///< One line description for the usage
+      const char * options,     ///< Options used and their defaults, one per line
+      Function function         ///< Function to run the test
+    );
+
+    static const BenchTest * Find(const PString & name);
+    static void PrintUsage(ostream & strm);
+
+    bool Run(PArgList & args) const { return m_function(args); }
+    const char * GetName() const { return m_name; }
+
+  protected:
+    const char * m_name;
+    const char * m_description;
+    const char * m_options;
+    Function     m_function;
+    BenchTest  * m_next;
+
+    static BenchTest * s_first;
+};
+
+#define OPALBENCH_TEST(name, description, options, function) \
+  static BenchTest BenchTest_##function(name, description, options, function)
+
+
+/**Accumulate samples and report percentiles.
+  */
+class BenchSamples
+{
+  public:
+    void Add(PInt64 sample)
+    {
+      PWaitAndSignal lock(m_mutex);
+      m_samples.push_back(sample);
+    }
+
+    size_t GetCount() const { return m_samples.size(); }
+    PInt64 GetPercentile(unsigned percent);
+    void Clear() { m_samples.clear(); }
+
+  protected:
+    std::vector<PInt64> m_samples;
+    PMutex              m_mutex;
+};
+
+
+/**Snapshot of process resource usage, for before and after comparisons.
+  */
+struct BenchUsage
+{
+  BenchUsage();
+
+  unsigned m_threads;
+  long     m_contextSwitches;
+  PInt64   m_cpuTime;          // User plus system, in microseconds
+  PTime    m_time;
+};
+
+ostream & operator<<(ostream & strm, const BenchUsage & usage);
+
+
+/**Count heap allocations made by the calling thread, or by every thread,
+   between Start() and Stop(). Only available with glibc, where malloc() can
+   be interposed.
+  */
+class BenchAllocations
+{
+  public:
+    static bool IsAvailable();
+    static void Start(bool allThreads = false);
+    static unsigned long Stop();
+};
+
+
+#endif  // _OpalBench_MAIN_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,338 @@
+/*
+ * mcubench.cxx
+ *
+ * OPAL application source file for benchmarking the conference mixer
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <opal/mixerep.h>
+#include <opal/transcoders.h>
+
+#include "main.h"
+
+
+// 20ms of 8kHz PCM-16
+#define FRAME_TIME    20
+#define FRAME_SAMPLES 160
+#define WARMUP_FRAMES 10
+
+// Participants talking loudly, the rest are background noise
+#define TALKERS 3
+
+// PCM-16 participants, one talking and one not, whose outputs are checked
+#define CHECK_TALKER   2
+#define CHECK_LISTENER 5
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static OpalMediaFormat GetParticipantFormat(unsigned participant)
+{
+  switch (participant%3) {
+    case 0 :
+      return OpalG711_ULAW_64K;
+    case 1 :
+      return OpalG711_ALAW_64K;
+  }
+  return OpalPCM16;
+}
+
+
+static void FillAudio(RTP_DataFrame & rtp, unsigned participant, unsigned frame)
+{
+  rtp.SetPayloadSize(FRAME_SAMPLES*2);
+  short * samples = (short *)rtp.GetPayloadPtr();
+  int shift = participant < TALKERS ? 18 : 26;
+  for (PINDEX i = 0; i < FRAME_SAMPLES; ++i)
+    samples[i] = (short)((int)(((participant+1)*(frame*FRAME_SAMPLES+i)*2654435761U) >> shift) - (1 << (31-shift)));
+}
+
+
+/**Mixes the way a conference without OpalMixerNode would: every participant
+   gets a mix of everybody else, summed again for each of them, and encoded
+   by its own encoder.
+  */
+class NaiveConference
+{
+  public:
+    NaiveConference(unsigned count)
+      : m_inputs(count*FRAME_SAMPLES)
+      , m_accumulator(FRAME_SAMPLES)
+      , m_mixed(FRAME_SAMPLES*2)
+      , m_encoded(0)
+      , m_encodes(0)
+    {
+      for (unsigned i = 0; i < count; ++i) {
+        OpalMediaFormat format = GetParticipantFormat(i);
+        m_encoders.push_back(format == OpalPCM16 ? NULL : OpalTranscoder::Create(OpalPCM16, format));
+      }
+    }
+
+    ~NaiveConference()
+    {
+      for (size_t i = 0; i < m_encoders.size(); ++i)
+        delete m_encoders[i];
+    }
+
+    void Write(unsigned participant, const RTP_DataFrame & rtp)
+    {
+      memcpy(&m_inputs[participant*FRAME_SAMPLES], rtp.GetPayloadPtr(), FRAME_SAMPLES*2);
+    }
+
+    PUInt64 Mix(DWORD timestamp)
+    {
+      PUInt64 checksum = 0;
+      unsigned count = m_encoders.size();
+
+      for (unsigned i = 0; i < count; ++i) {
+        std::fill(m_accumulator.begin(), m_accumulator.end(), 0);
+        for (unsigned j = 0; j < count; ++j) {
+          if (j != i) {
+            const short * src = &m_inputs[j*FRAME_SAMPLES];
+            for (PINDEX s = 0; s < FRAME_SAMPLES; ++s)
+              m_accumulator[s] += src[s];
+          }
+        }
+
+        short * out = (short *)m_mixed.GetPayloadPtr();
+        for (PINDEX s = 0; s < FRAME_SAMPLES; ++s) {
+          int v = m_accumulator[s];
+          if (v < -32765)
+            v = -32765;
+          else if (v > 32765)
+            v = 32765;
+          out[s] = (short)v;
+        }
+
+        const RTP_DataFrame * output = &m_mixed;
+        if (m_encoders[i] != NULL) {
+          m_mixed.SetTimestamp(timestamp);
+          m_encoders[i]->Convert(m_mixed, m_encoded);
+          output = &m_encoded;
+          ++m_encodes;
+        }
+
+        checksum += output->GetPayloadPtr()[0] + output->GetPayloadSize();
+      }
+
+      return checksum;
+    }
+
+    PUInt64 GetEncodes() const { return m_encodes; }
+
+  protected:
+    std::vector<OpalTranscoder *> m_encoders;
+    std::vector<short>            m_inputs;
+    std::vector<int>              m_accumulator;
+    RTP_DataFrame                 m_mixed;
+    RTP_DataFrame                 m_encoded;
+    PUInt64                       m_encodes;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**A listener hears all the talkers, and a talker hears the same less itself,
+   so the difference is the talker's own audio. The node may be a frame
+   behind, so either of the two frames written will do.
+  */
+static bool CheckMixMinus(const RTP_DataFrame & listener,
+                          const RTP_DataFrame & talker,
+                          const std::vector<RTP_DataFrame *> & audio,
+                          unsigned count)
+{
+  if (listener.GetPayloadSize() != FRAME_SAMPLES*2 || talker.GetPayloadSize() != FRAME_SAMPLES*2)
+    return false;
+
+  const short * heard = (const short *)listener.GetPayloadPtr();
+  const short * spoken = (const short *)talker.GetPayloadPtr();
+  for (unsigned set = 0; set < 2; ++set) {
+    const short * own = (const short *)audio[set*count + CHECK_TALKER]->GetPayloadPtr();
+    PINDEX i = 0;
+    while (i < FRAME_SAMPLES && heard[i] - spoken[i] == own[i])
+      ++i;
+    if (i == FRAME_SAMPLES)
+      return true;
+  }
+  return false;
+}
+
+
+static bool RunConferenceBenchmark(unsigned count, unsigned frames, bool naive)
+{
+  std::vector<RTP_DataFrame *> audio;
+  for (unsigned i = 0; i < count*2; ++i) {
+    audio.push_back(new RTP_DataFrame(FRAME_SAMPLES*2));
+    FillAudio(*audio.back(), i%count, i/count);
+  }
+
+  NaiveConference * conference = NULL;
+  OpalMixerNode * node = NULL;
+  std::vector<PSmartPointer> participants;
+
+  if (naive)
+    conference = new NaiveConference(count);
+  else {
+    node = new OpalMixerNode("bench", OpalMixerNode::Params(FRAME_TIME));
+    node->SetAutoStart(false);
+    for (unsigned i = 0; i < count; ++i) {
+      participants.push_back(node->AddParticipant(psprintf("p%u", i)));
+      OpalMixerNode::Participant * participant = (OpalMixerNode::Participant *)participants.back().GetObject();
+      participant->SetInputFormat(OpalPCM16);
+      participant->SetOutputFormat(GetParticipantFormat(i));
+    }
+  }
+
+  RTP_DataFrame output(0);
+  RTP_DataFrame talkerOutput(0), listenerOutput(0);
+  unsigned reads = 0;
+  unsigned wrongMixes = 0;
+  PUInt64 checksum = 0;
+  BenchUsage before;
+  PTimeInterval start;
+
+  for (unsigned frame = 0; frame < WARMUP_FRAMES+frames; ++frame) {
+    if (frame == WARMUP_FRAMES) {
+      start = PTimer::Tick();
+      before = BenchUsage();
+    }
+
+    DWORD timestamp = 1000+frame*FRAME_SAMPLES;
+    PUInt64 sum = 0;
+
+    if (naive) {
+      for (unsigned i = 0; i < count; ++i)
+        conference->Write(i, *audio[(frame%2)*count + i]);
+      sum = conference->Mix(timestamp);
+    }
+    else {
+      for (unsigned i = 0; i < count; ++i) {
+        RTP_DataFrame & rtp = *audio[(frame%2)*count + i];
+        rtp.SetTimestamp(timestamp);
+        ((OpalMixerNode::Participant *)participants[i].GetObject())->WriteFrame(rtp);
+      }
+
+      node->MixFrame();
+
+      for (unsigned i = 0; i < count; ++i) {
+        RTP_DataFrame & frameRead = i == CHECK_TALKER ? talkerOutput : i == CHECK_LISTENER ? listenerOutput : output;
+        if (((OpalMixerNode::Participant *)participants[i].GetObject())->ReadFrame(frameRead, 0)) {
+          sum += frameRead.GetPayloadPtr()[0] + frameRead.GetPayloadSize();
+          ++reads;
+        }
+      }
+
+      if (frame >= WARMUP_FRAMES && count > CHECK_LISTENER)
+        wrongMixes += !CheckMixMinus(listenerOutput, talkerOutput, audio, count);
+    }
+
+    if (frame >= WARMUP_FRAMES)
+      checksum += sum;
+  }
+
+  PTimeInterval elapsed = PTimer::Tick() - start;
+  BenchUsage after;
+
+  PUInt64 encodes;
+  if (naive)
+    encodes = conference->GetEncodes();
+  else {
+    PUInt64 framesMixed;
+    node->GetStatistics(framesMixed, encodes);
+  }
+
+  // Everything ran on this thread, so the CPU time is one core's worth
+  double cpuPerFrame = (double)(after.m_cpuTime - before.m_cpuTime)/frames;
+  cout << "    " << setw(8) << (naive ? "naive" : "node") << ": "
+       << "cpu/participant=" << cpuPerFrame/count << "us/frame"
+       << " core=" << cpuPerFrame*100/(FRAME_TIME*1000) << '%'
+       << " encodes/frame=" << (double)encodes/(WARMUP_FRAMES+frames)
+       << " elapsed=" << elapsed
+       << " checksum=" << checksum
+       << endl;
+
+  /* Every participant hears something every frame, a speaker hears the mix
+     less itself, and at most one encode per speaker and one per codec. */
+  bool ok = true;
+  if (!naive) {
+    if (reads != count*(WARMUP_FRAMES+frames)) {
+      cout << "    only " << reads << " of " << count*(WARMUP_FRAMES+frames) << " frames read!" << endl;
+      ok = false;
+    }
+    if (wrongMixes > 0) {
+      cout << "    " << wrongMixes << " frames where a speaker did not hear the mix less itself!" << endl;
+      ok = false;
+    }
+    if (encodes > (PUInt64)(TALKERS+2)*(WARMUP_FRAMES+frames)) {
+      cout << "    encodes are not shared!" << endl;
+      ok = false;
+    }
+  }
+
+  participants.clear();
+  delete node;
+  delete conference;
+  for (size_t i = 0; i < audio.size(); ++i)
+    delete audio[i];
+
+  return ok;
+}
+
+
+static bool ConferenceBenchmark(PArgList & args)
+{
+  PStringArray counts = args.GetOptionString('s', "10,50,200").Tokenise(",");
+  unsigned frames = args.GetOptionString('r', "500").AsUnsigned();
+  if (frames == 0)
+    frames = 1;
+
+  cout << "Conference benchmark, " << frames << " frames of " << FRAME_TIME << "ms, "
+       << TALKERS << " talking, G.711 and PCM-16 participants" << endl;
+
+  bool ok = true;
+
+  for (PINDEX i = 0; i < counts.GetSize(); ++i) {
+    unsigned count = counts[i].AsUnsigned();
+    if (count == 0)
+      continue;
+
+    cout << setw(7) << count << " participants" << endl;
+    RunConferenceBenchmark(count, frames, true);
+    if (!RunConferenceBenchmark(count, frames, false))
+      ok = false;
+  }
+
+  return ok;
+}
+
+OPALBENCH_TEST("conference", "Conference mixing, mix per participant vs mix-minus node",
+               "-s 10,50,200 -r 500", ConferenceBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,322 @@
+/*
+ * mixbench.cxx
+ *
+ * OPAL application source file for benchmarking the audio mixer
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <opal/opalmixer.h>
+#include <opal/simd.h>
+
+#include <queue>
+
+#include "main.h"
+
+
+// 10ms of 8kHz PCM-16
+#define FRAME_SAMPLES 80
+#define WARMUP_FRAMES 100
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**This is how OpalAudioMixer moved audio before the streams were rings of
+   blocks, for comparison: a copy of every payload, a map lookup under the
+   mixer mutex, a new frame for every mix and sample by sample mixing.
+  */
+class LegacyMixer
+{
+  public:
+    typedef std::map<std::string, OpalAudioMixerStream::StreamFrame> ChannelMap;
+
+    void Write(const std::string & key, const RTP_DataFrame & rtp)
+    {
+      OpalAudioMixerStream::StreamFrame frame(rtp);
+      PWaitAndSignal m(m_mutex);
+      m_streams[key].push(frame);
+    }
+
+    PUInt64 Mix()
+    {
+      ChannelMap * channelData = new ChannelMap;
+
+      {
+        PWaitAndSignal m(m_mutex);
+        for (StreamMap::iterator it = m_streams.begin(); it != m_streams.end(); ++it) {
+          if (!it->second.empty()) {
+            channelData->insert(ChannelMap::value_type(it->first, it->second.front()));
+            it->second.pop();
+          }
+        }
+      }
+
+      PIntArray mixedData(FRAME_SAMPLES);
+      for (ChannelMap::iterator it = channelData->begin(); it != channelData->end(); ++it) {
+        const short * src = (const short *)it->second.GetPointerAndLock();
+        int * dst = mixedData.GetPointer();
+        for (PINDEX i = 0; i < FRAME_SAMPLES; ++i)
+          *dst++ += *src++;
+        it->second.Unlock();
+      }
+
+      OpalAudioMixerStream::StreamFrame output;
+      output.SetSize(FRAME_SAMPLES*2);
+      short * out = (short *)output.GetPointerAndLock();
+      PUInt64 checksum = 0;
+      for (PINDEX i = 0; i < FRAME_SAMPLES; ++i) {
+        int v = mixedData[i];
+        if (v < -32765)
+          v = -32765;
+        else if (v > 32765)
+          v = 32765;
+        out[i] = (short)v;
+        checksum += (unsigned short)v;
+      }
+      output.Unlock();
+
+      delete channelData;
+      return checksum;
+    }
+
+  protected:
+    typedef std::map<std::string, std::queue<OpalAudioMixerStream::StreamFrame> > StreamMap;
+    PMutex    m_mutex;
+    StreamMap m_streams;
+};
+
+
+/**Mixes on demand rather than from its own thread, summing the output.
+  */
+class BenchMixer : public OpalAudioMixer
+{
+  public:
+    BenchMixer()
+      : OpalAudioMixer(false, false)
+      , m_checksum(0)
+    {
+    }
+
+    virtual PBoolean OnWriteAudio(const MixerFrame & mixerFrame)
+    {
+      const short * samples = mixerFrame.GetMixedSamples();
+      for (PINDEX i = 0; i < mixerFrame.GetFrameLength(); ++i)
+        m_checksum += (unsigned short)samples[i];
+      return true;
+    }
+
+    PUInt64 m_checksum;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static DWORD BenchRandom(unsigned stream, unsigned index)
+{
+  return ((stream+1)*index*2654435761U) >> 8;
+}
+
+
+/**Fill with samples in the range that sums to no more than the mixer's
+   maximum, so the legacy mixer, which clamps at a different point, must
+   give the same result.
+  */
+static void FillPacket(RTP_DataFrame & rtp, unsigned stream, unsigned frame, unsigned streamCount)
+{
+  int amplitude = 32765/streamCount;
+  short * samples = (short *)rtp.GetPayloadPtr();
+  for (PINDEX i = 0; i < FRAME_SAMPLES; ++i)
+    samples[i] = (short)((int)(BenchRandom(stream, frame*FRAME_SAMPLES+i) % (2*amplitude+1)) - amplitude);
+}
+
+
+/**Compare every SIMD level the CPU has against the C code, over lengths
+   that leave every size of tail, with sums well beyond saturation.
+  */
+static bool CheckMixerKernels()
+{
+  const PINDEX MaxCount = 2*FRAME_SAMPLES+15;
+  const unsigned Channels = 8;
+
+  std::vector<short> channels(Channels*MaxCount);
+  for (size_t i = 0; i < channels.size(); ++i)
+    channels[i] = (short)BenchRandom(0, (unsigned)i);
+
+  int best = OpalGetSIMDLevel();
+  unsigned mismatches = 0;
+
+  for (int level = OPAL_SIMD_NONE+1; level <= best; ++level) {
+    for (PINDEX count = 1; count <= MaxCount; ++count) {
+      std::vector<int> refAccumulator(count), accumulator(count);
+      for (unsigned c = 0; c < Channels; ++c) {
+        OpalAudioMixer::AccumulateSamples(&refAccumulator[0], &channels[c*MaxCount], count, OPAL_SIMD_NONE);
+        OpalAudioMixer::AccumulateSamples(&accumulator[0], &channels[c*MaxCount], count, level);
+      }
+      if (accumulator != refAccumulator)
+        ++mismatches;
+
+      for (unsigned c = 0; c <= Channels; ++c) {
+        const short * exclude = c < Channels ? &channels[c*MaxCount] : NULL;
+        std::vector<short> refSamples(count), samples(count);
+        OpalAudioMixer::SaturateSamples(&refSamples[0], &refAccumulator[0], exclude, count, OPAL_SIMD_NONE);
+        OpalAudioMixer::SaturateSamples(&samples[0], &refAccumulator[0], exclude, count, level);
+        if (samples != refSamples)
+          ++mismatches;
+      }
+    }
+  }
+
+  cout << "  SIMD level " << best << " mixing kernels against C: " << (mismatches == 0 ? "match" : "MISMATCH") << endl;
+  return mismatches == 0;
+}
+
+
+static PUInt64 RunMixerBenchmark(const char * name,
+                                 LegacyMixer * legacy,
+                                 const PStringArray & keys,
+                                 const std::vector<RTP_DataFrame *> & packets,
+                                 unsigned frames,
+                                 bool & ok)
+{
+  BenchMixer mixer;
+  PUInt64 checksum = 0;
+  unsigned streamCount = keys.GetSize();
+
+  std::vector<std::string> streamKeys;
+  for (PINDEX i = 0; i < keys.GetSize(); ++i)
+    streamKeys.push_back((const char *)keys[i]);
+
+  BenchUsage before;
+  PTimeInterval start;
+
+  for (unsigned frame = 0; frame < WARMUP_FRAMES+frames; ++frame) {
+    if (frame == WARMUP_FRAMES) {
+      start = PTimer::Tick();
+      BenchAllocations::Start();
+    }
+
+    for (unsigned stream = 0; stream < streamCount; ++stream) {
+      // Each stream writes a new timestamp, as its media patch would
+      RTP_DataFrame & rtp = *packets[(frame%2)*streamCount + stream];
+      rtp.SetTimestamp(frame*FRAME_SAMPLES);
+      if (legacy != NULL)
+        legacy->Write(streamKeys[stream], rtp);
+      else
+        mixer.Write(streamKeys[stream], rtp);
+    }
+
+    PUInt64 sum;
+    if (legacy != NULL)
+      sum = legacy->Mix();
+    else {
+      PUInt64 previous = mixer.m_checksum;
+      mixer.WriteMixedFrame();
+      sum = mixer.m_checksum - previous;
+    }
+    if (frame >= WARMUP_FRAMES)
+      checksum += sum;
+  }
+
+  unsigned long allocations = BenchAllocations::Stop();
+  PTimeInterval elapsed = PTimer::Tick() - start;
+  BenchUsage after;
+
+  PInt64 ms = PMAX((PInt64)1, elapsed.GetMilliSeconds());
+  cout << "    " << setw(8) << name << ": "
+       << "frames=" << (unsigned)((PUInt64)frames*1000/ms) << "/s"
+       << " us/frame=" << (double)ms*1000/frames;
+  if (BenchAllocations::IsAvailable())
+    cout << " allocations/frame=" << (double)allocations/frames;
+  cout << " checksum=" << checksum
+       << " cpu=" << (after.m_cpuTime - before.m_cpuTime)/1000000.0 << 's'
+       << endl;
+
+  if (legacy == NULL && allocations > 0) {
+    cout << "    steady state allocations MISMATCH" << endl;
+    ok = false;
+  }
+
+  return checksum;
+}
+
+
+static bool MixerBenchmark(PArgList & args)
+{
+  PStringArray counts = args.GetOptionString('s', "2,8,32").Tokenise(",");
+  unsigned frames = args.GetOptionString('r', "100000").AsUnsigned();
+  // The two sets of packets alternate, so an even number of frames has the
+  // same checksum whether or not the mixer delays its output by a frame
+  frames = (frames+1) & ~1U;
+  if (frames == 0)
+    frames = 2;
+
+  cout << "Audio mixer benchmark, " << frames << " frames of 10ms after "
+       << WARMUP_FRAMES << " warm up frames" << endl;
+
+  bool ok = CheckMixerKernels();
+
+  for (PINDEX i = 0; i < counts.GetSize(); ++i) {
+    unsigned count = counts[i].AsUnsigned();
+    if (count == 0)
+      continue;
+
+    PStringArray keys;
+    for (unsigned stream = 0; stream < count; ++stream)
+      keys.AppendString(psprintf("stream-%08x", stream*2654435761U));
+
+    // Two sets of packets, so consecutive frames differ
+    std::vector<RTP_DataFrame *> packets;
+    for (unsigned set = 0; set < 2; ++set) {
+      for (unsigned stream = 0; stream < count; ++stream) {
+        packets.push_back(new RTP_DataFrame(FRAME_SAMPLES*2));
+        FillPacket(*packets.back(), stream, set, count);
+      }
+    }
+
+    cout << setw(7) << count << " streams" << endl;
+
+    LegacyMixer legacy;
+    PUInt64 legacyChecksum = RunMixerBenchmark("legacy", &legacy, keys, packets, frames, ok);
+    PUInt64 ringChecksum = RunMixerBenchmark("ring", NULL, keys, packets, frames, ok);
+    if (ringChecksum != legacyChecksum) {
+      cout << "    checksums MISMATCH" << endl;
+      ok = false;
+    }
+
+    for (size_t p = 0; p < packets.size(); ++p)
+      delete packets[p];
+  }
+
+  return ok;
+}
+
+OPALBENCH_TEST("mixer", "Audio mixing, queued frames vs stream rings and SIMD",
+               "-s 2,8,32 -r 100000", MixerBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,325 @@
+/*
+ * optbench.cxx
+ *
+ * OPAL application source file for benchmarking media format option access
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <opal/manager.h>
+#include <opal/mediafmt.h>
+#include <opal/localep.h>
+#include <sip/sipep.h>
+
+#include "main.h"
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/* The options call setup and the media patches most often read, plus one an
+   audio format does not have. */
+
+static const PString & OptionName(unsigned index)
+{
+  switch (index%6) {
+    case 0 :  return OpalMediaFormat::ClockRateOption();
+    case 1 :  return OpalMediaFormat::FrameTimeOption();
+    case 2 :  return OpalMediaFormat::MaxBitRateOption();
+    case 3 :  return OpalAudioFormat::TxFramesPerPacketOption();
+    case 4 :  return OpalMediaFormat::MaxFrameSizeOption();
+    default :
+      static PString absent = "Frame Width";
+      return absent;
+  }
+}
+
+
+/**This is how OpalMediaFormat found an option before option names were
+   interned, for comparison. The internal mutex is shared by every copy of
+   a format, as the OpalMediaFormatInternal was.
+  */
+class LegacyOptions
+{
+  public:
+    class SearchArg : public OpalMediaOption
+    {
+      public:
+        SearchArg(const PString & name) : OpalMediaOption(name) { }
+        virtual Comparison CompareValue(const OpalMediaOption &) const { return EqualTo; }
+        virtual void Assign(const OpalMediaOption &) { }
+    };
+
+    LegacyOptions(const OpalMediaFormat & format)
+    {
+      for (PINDEX i = 0; i < format.GetOptionCount(); i++)
+        m_options.Append(format.GetOption(i).Clone());
+    }
+
+    int GetOptionInteger(PMutex & handleMutex, const PString & name, int dflt)
+    {
+      PWaitAndSignal m1(handleMutex);
+      PWaitAndSignal m2(m_mutex);
+      PWaitAndSignal m3(m_mutex); // FindOption() locked again
+
+      SearchArg search(name);
+      PINDEX index = m_options.GetValuesIndex(search);
+      if (index == P_MAX_INDEX)
+        return dflt;
+
+      OpalMediaOptionUnsigned * optUnsigned = dynamic_cast<OpalMediaOptionUnsigned *>(&m_options[index]);
+      if (optUnsigned != NULL)
+        return optUnsigned->GetValue();
+
+      OpalMediaOptionInteger * optInteger = dynamic_cast<OpalMediaOptionInteger *>(&m_options[index]);
+      return optInteger != NULL ? optInteger->GetValue() : dflt;
+    }
+
+  protected:
+    PMutex                       m_mutex;
+    PSortedList<OpalMediaOption> m_options;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+class BenchOptionThread : public PThread
+{
+  PCLASSINFO(BenchOptionThread, PThread);
+
+  public:
+    enum Modes {
+      LegacyMode,
+      StringMode,
+      KeyMode
+    };
+
+    BenchOptionThread(Modes mode, LegacyOptions & legacy, const OpalMediaFormat & format, unsigned lookups)
+      : PThread(65536, NoAutoDeleteThread, NormalPriority, "Bench Option")
+      , m_mode(mode)
+      , m_legacy(legacy)
+      , m_format(format) // Shares the internal, as each connection's copy does
+      , m_lookups(lookups)
+      , m_total(0)
+    {
+      for (unsigned i = 0; i < PARRAYSIZE(m_keys); ++i)
+        m_keys[i] = OpalMediaOptionKey(OptionName(i));
+      Resume();
+    }
+
+    virtual void Main()
+    {
+      switch (m_mode) {
+        case LegacyMode :
+          for (unsigned i = 0; i < m_lookups; ++i)
+            m_total += m_legacy.GetOptionInteger(m_handleMutex, OptionName(i), 0);
+          break;
+
+        case StringMode :
+          for (unsigned i = 0; i < m_lookups; ++i)
+            m_total += m_format.GetOptionInteger(OptionName(i), 0);
+          break;
+
+        case KeyMode :
+          for (unsigned i = 0; i < m_lookups; ++i)
+            m_total += m_format.GetOptionInteger(m_keys[i%PARRAYSIZE(m_keys)], 0);
+          break;
+      }
+    }
+
+    PUInt64 GetTotal() const { return m_total; }
+
+  protected:
+    Modes              m_mode;
+    LegacyOptions    & m_legacy;
+    OpalMediaFormat    m_format;
+    PMutex             m_handleMutex;
+    unsigned           m_lookups;
+    OpalMediaOptionKey m_keys[6];
+    PUInt64            m_total;
+};
+
+
+static PUInt64 RunOptionBenchmark(BenchOptionThread::Modes mode,
+                                  LegacyOptions & legacy,
+                                  const OpalMediaFormat & format,
+                                  unsigned lookups,
+                                  unsigned threads)
+{
+  static const char * const ModeNames[] = { "legacy", "string", "key" };
+
+  std::vector<BenchOptionThread *> optionThreads;
+
+  BenchUsage before;
+  PTimeInterval start = PTimer::Tick();
+
+  for (unsigned i = 0; i < threads; ++i)
+    optionThreads.push_back(new BenchOptionThread(mode, legacy, format, lookups));
+
+  PUInt64 total = 0;
+  for (size_t i = 0; i < optionThreads.size(); ++i) {
+    optionThreads[i]->WaitForTermination();
+    total += optionThreads[i]->GetTotal();
+    delete optionThreads[i];
+  }
+
+  PTimeInterval elapsed = PTimer::Tick() - start;
+  BenchUsage after;
+
+  PInt64 ms = PMAX((PInt64)1, elapsed.GetMilliSeconds());
+  cout << "    " << setw(8) << ModeNames[mode] << ": "
+       << "lookups=" << (unsigned)((PUInt64)lookups*threads*1000/ms) << "/s"
+       << " ns/lookup=" << (double)ms*1000000/lookups
+       << " checksum=" << total
+       << " context-switches=" << (after.m_contextSwitches - before.m_contextSwitches)
+       << endl;
+
+  return total;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+#if OPAL_SIP
+
+/**Calls itself, from a local endpoint, through SIP over loopback, to the
+   same local endpoint which answers immediately.
+  */
+class BenchCallManager : public OpalManager
+{
+  public:
+    virtual void OnEstablishedCall(OpalCall & call)
+    {
+      if (!call.IsNetworkOriginated())
+        m_established.Signal();
+    }
+
+    virtual void OnClearedCall(OpalCall & call)
+    {
+      if (!call.IsNetworkOriginated())
+        m_cleared.Signal();
+    }
+
+    PSyncPoint m_established;
+    PSyncPoint m_cleared;
+};
+
+
+static bool RunCallBenchmark(unsigned calls, WORD port)
+{
+  BenchCallManager manager;
+  new OpalLocalEndPoint(manager);
+  SIPEndPoint * sip = new SIPEndPoint(manager);
+
+  PString address = psprintf("127.0.0.1:%u", port);
+  if (!sip->StartListeners(PStringArray("udp$" + address))) {
+    cout << "Could not listen on UDP port " << port << endl;
+    return false;
+  }
+
+  manager.AddRouteEntry("sip:.*=local:<du>");
+
+  BenchSamples setup;
+  unsigned failed = 0;
+
+  for (unsigned i = 0; i < calls; ++i) {
+    PString token;
+    PTimeInterval start = PTimer::Tick();
+    if (!manager.SetUpCall("local:bench", "sip:callee@" + address, token)) {
+      ++failed;
+      continue;
+    }
+
+    if (manager.m_established.Wait(5000))
+      setup.Add((PTimer::Tick() - start).GetMilliSeconds()*1000);
+    else
+      ++failed;
+
+    manager.ClearCall(token);
+    manager.m_cleared.Wait(5000);
+  }
+
+  cout << "    INVITE to 200 OK: calls=" << setup.GetCount() << '/' << calls
+       << " failed=" << failed
+       << " p50=" << setup.GetPercentile(50) << "us"
+       << " p99=" << setup.GetPercentile(99) << "us"
+       << endl;
+
+  if (failed > 0)
+    cout << "    failed calls MISMATCH" << endl;
+  return failed == 0;
+}
+
+#endif // OPAL_SIP
+
+
+static bool MediaOptionBenchmark(PArgList & args)
+{
+  unsigned lookups = args.GetOptionString('r', "1000000").AsUnsigned();
+  unsigned threads = args.GetOptionString('T', "4").AsUnsigned();
+  unsigned calls = args.GetOptionString('s', "100").AsUnsigned();
+  WORD port = (WORD)args.GetOptionString('p', "20000").AsUnsigned();
+  if (lookups == 0)
+    lookups = 1;
+  if (threads == 0)
+    threads = 1;
+
+  OpalMediaFormat format = OpalG711_ULAW_64K;
+  LegacyOptions legacy(format);
+
+  cout << "Media option benchmark, " << format << " with " << format.GetOptionCount() << " options" << endl;
+
+  bool ok = true;
+
+  // Uncontended, then with threads sharing the one format
+  unsigned threadCounts[2] = { 1, threads };
+  for (PINDEX i = 0; i < (threads > 1 ? 2 : 1); ++i) {
+    cout << "  " << threadCounts[i] << " threads doing " << lookups << " integer option lookups each" << endl;
+    PUInt64 legacyTotal = RunOptionBenchmark(BenchOptionThread::LegacyMode, legacy, format, lookups, threadCounts[i]);
+    PUInt64 stringTotal = RunOptionBenchmark(BenchOptionThread::StringMode, legacy, format, lookups, threadCounts[i]);
+    PUInt64 keyTotal    = RunOptionBenchmark(BenchOptionThread::KeyMode,    legacy, format, lookups, threadCounts[i]);
+    if (stringTotal != legacyTotal || keyTotal != legacyTotal) {
+      cout << "    checksums MISMATCH" << endl;
+      ok = false;
+    }
+  }
+
+#if OPAL_SIP
+  if (calls > 0) {
+    cout << "  " << calls << " SIP calls over loopback, one at a time" << endl;
+    ok = RunCallBenchmark(calls, port) && ok;
+  }
+#endif
+
+  return ok;
+}
+
+OPALBENCH_TEST("options", "Media format option lookups by name vs key, and SIP call setup",
+               "-s 100 -T 4 -r 1000000 -p 20000", MediaOptionBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
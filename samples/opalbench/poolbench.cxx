@@ -0,0 +1,251 @@
+/*
+ * poolbench.cxx
+ *
+ * OPAL application source file for checking media path heap allocations
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <opal/transcoders.h>
+#include <rtp/rtp.h>
+#include <rtp/reactor.h>
+
+#include "main.h"
+
+
+#define WARMUP_PACKETS 50
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**Pass packets through the transcoders in the same way as a media patch
+   sink, received packets coming from the pool as the RTP reactor does.
+   Fails if a conversion fails or, with the pool, anything is allocated.
+  */
+static bool RunFramePoolBenchmark(const OpalMediaFormat & srcFormat,
+                                  const OpalMediaFormat & dstFormat,
+                                  bool usePool,
+                                  unsigned packets)
+{
+  OpalMediaFormat intermediateFormat;
+  if (!OpalTranscoder::FindIntermediateFormat(srcFormat, dstFormat, intermediateFormat)) {
+    cout << "No transcoder from " << srcFormat << " to " << dstFormat << endl;
+    return false;
+  }
+
+  OpalTranscoder * primaryCodec;
+  OpalTranscoder * secondaryCodec = NULL;
+  if (!intermediateFormat.IsValid())
+    primaryCodec = OpalTranscoder::Create(srcFormat, dstFormat);
+  else {
+    primaryCodec = OpalTranscoder::Create(srcFormat, intermediateFormat);
+    secondaryCodec = OpalTranscoder::Create(intermediateFormat, dstFormat);
+  }
+
+  if (primaryCodec == NULL || (intermediateFormat.IsValid() && secondaryCodec == NULL)) {
+    cout << "Could not create transcoders from " << srcFormat << " to " << dstFormat << endl;
+    delete primaryCodec;
+    delete secondaryCodec;
+    return false;
+  }
+
+  RTP_DataFramePool pool;
+  RTP_DataFrameList intermediateFrames(usePool ? &pool : NULL);
+  RTP_DataFrameList finalFrames(usePool ? &pool : NULL);
+
+  // 20ms of media per packet
+  unsigned frameTime = srcFormat.GetFrameTime();
+  unsigned framesPerPacket = frameTime > 0 ? srcFormat.GetClockRate()/50/frameTime : 1;
+  if (framesPerPacket == 0)
+    framesPerPacket = 1;
+  PINDEX payloadSize = framesPerPacket*srcFormat.GetFrameSize();
+
+  bool ok = true;
+  for (unsigned i = 0; i < WARMUP_PACKETS+packets; ++i) {
+    if (i == WARMUP_PACKETS)
+      BenchAllocations::Start();
+
+    RTP_DataFrame * packet = usePool ? pool.GetFrame(payloadSize, RTP_DataFramePool::PacketFrameSize)
+                                     : new RTP_DataFrame(payloadSize, RTP_DataFramePool::PacketFrameSize);
+    packet->SetPayloadType(srcFormat.GetPayloadType());
+    packet->SetSequenceNumber((WORD)i);
+    packet->SetTimestamp(i*framesPerPacket*frameTime);
+    memset(packet->GetPayloadPtr(), i&0xff, payloadSize);
+
+    ok = primaryCodec->ConvertFrames(*packet, intermediateFrames);
+
+    if (ok && secondaryCodec != NULL) {
+      for (RTP_DataFrameList::iterator interFrame = intermediateFrames.begin(); interFrame != intermediateFrames.end(); ++interFrame) {
+        if (!secondaryCodec->ConvertFrames(*interFrame, finalFrames))
+          ok = false;
+      }
+    }
+
+    if (usePool)
+      pool.ReleaseFrame(packet);
+    else
+      delete packet;
+
+    if (!ok) {
+      cout << "Conversion failed from " << srcFormat << " to " << dstFormat << endl;
+      break;
+    }
+  }
+
+  unsigned long allocations = BenchAllocations::Stop();
+
+  cout << setw(10) << srcFormat << " -> " << setw(10) << dstFormat
+       << (usePool ? " pooled:   " : " unpooled: ")
+       << "allocations/packet=" << (double)allocations/packets;
+  if (usePool)
+    cout << " hits=" << pool.GetHits() << " misses=" << pool.GetMisses() << " discards=" << pool.GetDiscards();
+  cout << endl;
+
+  if (usePool && allocations > 0) {
+    cout << "  steady state allocations MISMATCH" << endl;
+    ok = false;
+  }
+
+  delete primaryCodec;
+  delete secondaryCodec;
+
+  return ok;
+}
+
+
+#if OPAL_RTP_AGGREGATE
+
+/**Send packets from pooled frames through one RTP_UDP session to another
+   over loopback, read through the RTP reactor, counting the allocations
+   made by every thread, so the reactor's are included.
+  */
+static bool RunSessionBenchmark(unsigned packets, WORD port)
+{
+  const PIPSocket::Address loopback(127, 0, 0, 1);
+
+  RTP_Session::Params params;
+  params.id = 1;
+  params.encoding = "rtp/avp";
+
+  RTP_Reactor reactor(1);
+  RTP_UDP sender(params);
+  RTP_UDP receiver(params);
+
+  receiver.SetReactor(&reactor);
+  if (!receiver.Open(loopback, port, 65534, 0) ||
+      !sender.Open(loopback, (WORD)(receiver.GetLocalControlPort()+1), 65534, 0)) {
+    cout << "Could not open RTP sessions from port " << port << endl;
+    return false;
+  }
+
+  sender.SetRemoteSocketInfo(loopback, receiver.GetLocalDataPort(), true);
+  sender.SetRemoteSocketInfo(loopback, receiver.GetLocalControlPort(), false);
+
+  RTP_DataFramePool pool;
+  RTP_DataFrame received(0, RTP_DataFramePool::PacketFrameSize);
+  unsigned mismatched = 0;
+
+  for (unsigned i = 0; i < WARMUP_PACKETS+packets; ++i) {
+    if (i == WARMUP_PACKETS)
+      BenchAllocations::Start(true);
+
+    RTP_DataFrame * packet = pool.GetFrame(160, RTP_DataFramePool::PacketFrameSize);
+    packet->SetPayloadType(RTP_DataFrame::PCMU);
+    packet->SetSequenceNumber((WORD)i);
+    packet->SetTimestamp(i*160);
+    memset(packet->GetPayloadPtr(), i&0xff, 160);
+
+    bool ok = sender.WriteData(*packet);
+    pool.ReleaseFrame(packet);
+
+    // One in flight at a time, so the reactor queue never overflows
+    if (!ok || !receiver.ReadData(received, true) || received.GetPayloadSize() != 160 ||
+        received.GetPayloadPtr()[159] != (BYTE)(i&0xff))
+      ++mismatched;
+  }
+
+  unsigned long allocations = BenchAllocations::Stop();
+
+  receiver.Close(true);
+  sender.Close(true);
+
+  cout << "RTP_UDP send/receive pooled: allocations/packet=" << (double)allocations/packets
+       << " hits=" << pool.GetHits() << " misses=" << pool.GetMisses()
+       << " reactor hits=" << reactor.GetFramePool().GetHits()
+       << " misses=" << reactor.GetFramePool().GetMisses() << endl;
+
+  if (mismatched > 0)
+    cout << "  " << mismatched << " packets lost or mismatched MISMATCH" << endl;
+  if (allocations > 0)
+    cout << "  steady state allocations MISMATCH" << endl;
+
+  return mismatched == 0 && allocations == 0;
+}
+
+#endif // OPAL_RTP_AGGREGATE
+
+
+static bool FramePoolBenchmark(PArgList & args)
+{
+  if (!BenchAllocations::IsAvailable()) {
+    cout << "Allocation counting not supported on this platform." << endl;
+    return true;
+  }
+
+  unsigned packets = args.GetOptionString('r', "1000").AsUnsigned();
+  if (packets == 0)
+    packets = 1;
+
+  cout << "Frame pool allocation check, " << packets << " packets after "
+       << WARMUP_PACKETS << " warm up packets" << endl;
+
+  // G.729 is usually a plug in, fall back to GSM if it is not installed
+  OpalMediaFormat compressed = OpalG729;
+  OpalMediaFormat intermediate;
+  if (!OpalTranscoder::FindIntermediateFormat(OpalG711_ULAW_64K, compressed, intermediate))
+    compressed = OpalGSM0610;
+
+  bool ok = RunFramePoolBenchmark(OpalG711_ULAW_64K, compressed, false, packets);
+  ok = RunFramePoolBenchmark(OpalG711_ULAW_64K, compressed, true, packets) && ok;
+  ok = RunFramePoolBenchmark(compressed, OpalG711_ULAW_64K, false, packets) && ok;
+  ok = RunFramePoolBenchmark(compressed, OpalG711_ULAW_64K, true, packets) && ok;
+
+#if OPAL_RTP_AGGREGATE
+  ok = RunSessionBenchmark(packets, (WORD)args.GetOptionString('p', "20000").AsUnsigned()) && ok;
+#else
+  cout << "RTP reactor not supported on this platform." << endl;
+#endif
+
+  return ok;
+}
+
+OPALBENCH_TEST("alloc", "Heap allocations per packet, with and without frame pool",
+               "-r 1000 -p 20000", FramePoolBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
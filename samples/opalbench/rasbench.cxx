@@ -0,0 +1,316 @@
+/*
+ * rasbench.cxx
+ *
+ * OPAL application source file for benchmarking RAS retransmission handling
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+#include <ptlib/sockets.h>
+
+#include <opal/buildopts.h>
+
+#include <opal/manager.h>
+#include <h323/h323ep.h>
+#include <h323/h323pdu.h>
+#include <h323/gkserver.h>
+
+#include <map>
+
+#include "main.h"
+
+
+#define NEW_REQUEST_INTERVAL 100   // Every this many RRQs is a new one, the rest are retransmissions
+
+
+#if OPAL_H323
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**Counts how many times each RRQ, by alias and sequence number, reaches the
+   registration handler, which should be once, retransmissions being
+   answered from the response cache.
+  */
+class BenchGatekeeperServer : public H323GatekeeperServer
+{
+  PCLASSINFO(BenchGatekeeperServer, H323GatekeeperServer);
+
+  public:
+    BenchGatekeeperServer(H323EndPoint & endpoint)
+      : H323GatekeeperServer(endpoint)
+    {
+    }
+
+    virtual H323GatekeeperRequest::Response OnRegistration(H323GatekeeperRRQ & info)
+    {
+      PString key = psprintf("%u ", (unsigned)info.rrq.m_requestSeqNum);
+      if (info.rrq.m_terminalAlias.GetSize() > 0)
+        key += H323GetAliasAddressString(info.rrq.m_terminalAlias[0]);
+      {
+        PWaitAndSignal lock(m_handledMutex);
+        ++m_handled[key];
+      }
+      return H323GatekeeperServer::OnRegistration(info);
+    }
+
+    void ResetHandled()
+    {
+      PWaitAndSignal lock(m_handledMutex);
+      m_handled.clear();
+    }
+
+    /**Check every request was handled exactly once.
+      */
+    bool CheckHandled(unsigned expected)
+    {
+      PWaitAndSignal lock(m_handledMutex);
+      unsigned repeated = 0;
+      for (std::map<PString, unsigned>::const_iterator it = m_handled.begin(); it != m_handled.end(); ++it) {
+        if (it->second != 1)
+          ++repeated;
+      }
+      cout << "        handled=" << m_handled.size() << '/' << expected << " handled-again=" << repeated << endl;
+      return m_handled.size() == expected && repeated == 0;
+    }
+
+  protected:
+    PMutex                      m_handledMutex;
+    std::map<PString, unsigned> m_handled;
+};
+
+
+/**Stands in for an endpoint whose RRQs keep timing out, so retransmits the
+   same request, with the same sequence number, waiting for each reply.
+  */
+class BenchRasClient : public PThread
+{
+  PCLASSINFO(BenchRasClient, PThread);
+
+  public:
+    BenchRasClient(H323EndPoint & endpoint,
+                   const PIPSocket::Address & loopback,
+                   WORD gatekeeperPort,
+                   unsigned index,
+                   unsigned requests,
+                   BenchSamples & latency)
+      : PThread(65536, NoAutoDeleteThread, NormalPriority, "Bench RAS")
+      , m_endpoint(endpoint)
+      , m_loopback(loopback)
+      , m_gatekeeperPort(gatekeeperPort)
+      , m_index(index)
+      , m_requests(requests)
+      , m_latency(latency)
+      , m_confirms(0)
+      , m_rejects(0)
+      , m_timeouts(0)
+    {
+      m_socket.Listen(loopback, 0, 0);
+      m_socket.SetReadTimeout(1000);
+      Resume();
+    }
+
+    virtual void Main()
+    {
+      PPER_Stream request;
+
+      for (unsigned i = 0; i < m_requests; ++i) {
+        bool retransmit = (i%NEW_REQUEST_INTERVAL) != 0;
+        if (!retransmit)
+          EncodeRequest(request, i/NEW_REQUEST_INTERVAL);
+
+        PInt64 sent = PTime().GetTimestamp();
+        if (!m_socket.WriteTo(request.GetPointer(), request.GetSize(), m_loopback, m_gatekeeperPort)) {
+          ++m_timeouts;
+          continue;
+        }
+
+        BYTE buffer[4096];
+        if (!m_socket.Read(buffer, sizeof(buffer))) {
+          ++m_timeouts;
+          continue;
+        }
+
+        if (retransmit)
+          m_latency.Add(PTime().GetTimestamp() - sent);
+
+        PPER_Stream strm(buffer, m_socket.GetLastReadCount());
+        H323RasPDU reply;
+        if (reply.Decode(strm) && reply.GetTag() == H225_RasMessage::e_registrationConfirm)
+          ++m_confirms;
+        else
+          ++m_rejects;
+      }
+    }
+
+    unsigned GetConfirms() const { return m_confirms; }
+    unsigned GetRejects() const { return m_rejects; }
+    unsigned GetTimeouts() const { return m_timeouts; }
+
+  protected:
+    void EncodeRequest(PPER_Stream & strm, unsigned seqNum)
+    {
+      H323RasPDU pdu;
+      H225_RegistrationRequest & rrq = pdu.BuildRegistrationRequest(seqNum%65535 + 1);
+
+      rrq.m_discoveryComplete = true;
+
+      rrq.m_rasAddress.SetSize(1);
+      H323TransportAddress(m_loopback, m_socket.GetPort()).SetPDU(rrq.m_rasAddress[0]);
+      rrq.m_callSignalAddress.SetSize(1);
+      H323TransportAddress(m_loopback, (WORD)(m_socket.GetPort()+1)).SetPDU(rrq.m_callSignalAddress[0]);
+
+      m_endpoint.SetEndpointTypeInfo(rrq.m_terminalType);
+      m_endpoint.SetVendorIdentifierInfo(rrq.m_endpointVendor);
+
+      PStringArray aliases;
+      aliases.AppendString(psprintf("ras%u", m_index));
+      rrq.IncludeOptionalField(H225_RegistrationRequest::e_terminalAlias);
+      H323SetAliasAddresses(aliases, rrq.m_terminalAlias);
+
+      strm.SetSize(0);
+      strm.ResetDecoder();
+      pdu.Encode(strm);
+      strm.CompleteEncoding();
+    }
+
+    H323EndPoint     & m_endpoint;
+    PIPSocket::Address m_loopback;
+    WORD               m_gatekeeperPort;
+    unsigned           m_index;
+    unsigned           m_requests;
+    BenchSamples     & m_latency;
+    PUDPSocket         m_socket;
+
+    unsigned m_confirms;
+    unsigned m_rejects;
+    unsigned m_timeouts;
+};
+
+
+static bool RunRasBenchmark(H323EndPoint & endpoint,
+                            BenchGatekeeperServer & gatekeeper,
+                            const PIPSocket::Address & loopback,
+                            WORD port,
+                            unsigned firstClient,
+                            unsigned clientCount,
+                            unsigned requests)
+{
+  BenchSamples latency;
+  std::vector<BenchRasClient *> clients;
+
+  gatekeeper.ResetHandled();
+
+  BenchUsage before;
+
+  // Aliases differ from the last run's, or they would be rejected as duplicates
+  for (unsigned i = 0; i < clientCount; ++i)
+    clients.push_back(new BenchRasClient(endpoint, loopback, port, firstClient+i, requests, latency));
+
+  unsigned confirms = 0, rejects = 0, timeouts = 0;
+  for (size_t i = 0; i < clients.size(); ++i) {
+    clients[i]->WaitForTermination();
+    confirms += clients[i]->GetConfirms();
+    rejects += clients[i]->GetRejects();
+    timeouts += clients[i]->GetTimeouts();
+    delete clients[i];
+  }
+
+  BenchUsage after;
+
+  double elapsed = (after.m_time - before.m_time).GetMilliSeconds()/1000.0;
+  double cpuSeconds = (after.m_cpuTime - before.m_cpuTime)/1000000.0;
+
+  cout << setw(7) << clientCount << " peers: "
+       << "replies=" << (confirms + rejects) << '/' << clientCount*requests;
+  if (elapsed > 0)
+    cout << " replies/sec=" << (unsigned)((confirms + rejects)/elapsed);
+  cout << " RCF=" << confirms
+       << " RRJ=" << rejects
+       << " timeouts=" << timeouts
+       << " retransmit-p50=" << latency.GetPercentile(50) << "us"
+       << " retransmit-p99=" << latency.GetPercentile(99) << "us"
+       << " context-switches=" << (after.m_contextSwitches - before.m_contextSwitches)
+       << " cpu=" << cpuSeconds << 's'
+       << endl;
+
+  unsigned newRequests = (requests + NEW_REQUEST_INTERVAL-1)/NEW_REQUEST_INTERVAL;
+  bool ok = gatekeeper.CheckHandled(clientCount*newRequests);
+  if (rejects > 0 || timeouts > 0) {
+    cout << "        rejected or timed out MISMATCH" << endl;
+    ok = false;
+  }
+  else if (!ok)
+    cout << "        retransmissions not answered from cache MISMATCH" << endl;
+
+  return ok;
+}
+
+#endif // OPAL_H323
+
+
+static bool RasBenchmark(PArgList & args)
+{
+#if OPAL_H323
+  PStringArray counts = args.GetOptionString('s', "10,50").Tokenise(",");
+  unsigned requests = args.GetOptionString('r', "2000").AsUnsigned();
+  WORD port = (WORD)args.GetOptionString('p', "20000").AsUnsigned();
+  if (requests == 0)
+    requests = 1;
+
+  const PIPSocket::Address loopback(127, 0, 0, 1);
+
+  OpalManager manager;
+  H323EndPoint * endpoint = new H323EndPoint(manager);
+
+  BenchGatekeeperServer gatekeeper(*endpoint);
+  if (!gatekeeper.AddListener(H323TransportAddress(loopback, port))) {
+    cout << "Could not listen on UDP port " << port << endl;
+    return false;
+  }
+
+  cout << "RAS retransmission benchmark, " << requests << " RRQs from each peer over loopback, "
+       << NEW_REQUEST_INTERVAL-1 << " of every " << NEW_REQUEST_INTERVAL << " are retransmissions" << endl;
+
+  bool ok = true;
+  unsigned firstClient = 0;
+  for (PINDEX i = 0; i < counts.GetSize(); ++i) {
+    unsigned clientCount = counts[i].AsUnsigned();
+    if (clientCount > 0) {
+      ok = RunRasBenchmark(*endpoint, gatekeeper, loopback, port, firstClient, clientCount, requests) && ok;
+      firstClient += clientCount;
+    }
+  }
+  return ok;
+#else
+  cout << "H.323 not supported in this build." << endl;
+  return true;
+#endif
+}
+
+OPALBENCH_TEST("ras", "Gatekeeper replies to retransmitted RRQs over loopback UDP",
+               "-s 10,50 -r 2000 -p 20000", RasBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,223 @@
+/*
+ * regbench.cxx
+ *
+ * OPAL application source file for benchmarking registered media format lookups
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <opal/mediafmt.h>
+
+#include "main.h"
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**This is how OpalMediaFormat found a registered format before the registry
+   was published as a snapshot, for comparison: a linear search of the
+   master list with a global mutex held.
+  */
+class LegacyRegistry
+{
+  public:
+    LegacyRegistry()
+    {
+      OpalMediaFormat::GetAllRegisteredMediaFormats(m_formats);
+    }
+
+    void Find(const PString & wildcard, OpalMediaFormat & format)
+    {
+      PWaitAndSignal mutex(m_mutex);
+
+      OpalMediaFormatList::const_iterator fmt = m_formats.FindFormat(wildcard);
+      if (fmt == m_formats.end())
+        format = OpalMediaFormat();
+      else
+        format = *fmt;
+    }
+
+  protected:
+    PMutex              m_mutex;
+    OpalMediaFormatList m_formats;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+class BenchRegistryThread : public PThread
+{
+  PCLASSINFO(BenchRegistryThread, PThread);
+
+  public:
+    BenchRegistryThread(LegacyRegistry * legacy, const PStringArray & names, unsigned lookups, unsigned seed)
+      : PThread(65536, NoAutoDeleteThread, NormalPriority, "Bench Registry")
+      , m_legacy(legacy)
+      , m_names(names)
+      , m_lookups(lookups)
+      , m_seed(seed)
+      , m_found(0)
+    {
+      Resume();
+    }
+
+    virtual void Main()
+    {
+      PRandom random(m_seed);
+      PINDEX count = m_names.GetSize();
+      OpalMediaFormat format;
+
+      for (unsigned i = 0; i < m_lookups; ++i) {
+        const PString & name = m_names[random.Generate()%count];
+        if (m_legacy != NULL)
+          m_legacy->Find(name, format);
+        else
+          format = OpalMediaFormat(name);
+        if (format.IsValid())
+          ++m_found;
+      }
+    }
+
+    unsigned GetFound() const { return m_found; }
+
+  protected:
+    LegacyRegistry * m_legacy;
+    PStringArray     m_names;
+    unsigned         m_lookups;
+    unsigned         m_seed;
+    unsigned         m_found;
+};
+
+
+static void RunRegistryBenchmark(const char * name,
+                                 LegacyRegistry * legacy,
+                                 const PStringArray & names,
+                                 unsigned lookups,
+                                 unsigned threads)
+{
+  std::vector<BenchRegistryThread *> registryThreads;
+
+  BenchUsage before;
+  PTimeInterval start = PTimer::Tick();
+
+  for (unsigned i = 0; i < threads; ++i)
+    registryThreads.push_back(new BenchRegistryThread(legacy, names, lookups, i+1));
+
+  unsigned found = 0;
+  for (size_t i = 0; i < registryThreads.size(); ++i) {
+    registryThreads[i]->WaitForTermination();
+    found += registryThreads[i]->GetFound();
+    delete registryThreads[i];
+  }
+
+  PTimeInterval elapsed = PTimer::Tick() - start;
+  BenchUsage after;
+
+  PInt64 ms = PMAX((PInt64)1, elapsed.GetMilliSeconds());
+  cout << "    " << setw(8) << name << ": "
+       << "formats=" << (unsigned)((PUInt64)lookups*threads*1000/ms) << "/s"
+       << " found=" << found << '/' << lookups*threads
+       << " context-switches=" << (after.m_contextSwitches - before.m_contextSwitches)
+       << " cpu=" << (after.m_cpuTime - before.m_cpuTime)/1000000.0 << 's'
+       << endl;
+}
+
+
+/* A registered format changed directly, not by SetRegisteredMediaFormat(),
+   must still be what later lookups find, as it was with the list search. */
+static bool CheckDirectChange()
+{
+  static OpalMediaFormat registered("Bench-Registry", OpalMediaType::Audio(), RTP_DataFrame::MaxPayloadType,
+                                    "", false, 8000, 10, 80, OpalMediaFormat::AudioClockRate);
+
+  for (unsigned bitRate = 16000; bitRate <= 64000; bitRate += 16000) {
+    // Make sure the snapshot is built, sharing the registered internal
+    OpalMediaFormat before(registered.GetName());
+
+    registered.SetOptionInteger(OpalMediaFormat::MaxBitRateOption(), bitRate);
+
+    if (OpalMediaFormat(registered.GetName()).GetBandwidth() != bitRate) {
+      cout << "    Change to registered format not seen MISMATCH" << endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+static bool MediaRegistryBenchmark(PArgList & args)
+{
+  unsigned lookups = args.GetOptionString('r', "100000").AsUnsigned();
+  unsigned threads = args.GetOptionString('T', "32").AsUnsigned();
+  if (lookups == 0)
+    lookups = 1;
+  if (threads == 0)
+    threads = 1;
+
+  // Every registered name, plus a few wildcards and one that is not there
+  OpalMediaFormatList registered = OpalMediaFormat::GetAllRegisteredMediaFormats();
+  PStringArray names;
+  for (OpalMediaFormatList::const_iterator format = registered.begin(); format != registered.end(); ++format)
+    names.AppendString(format->GetName());
+  names.AppendString("G.711*");
+  names.AppendString("@video");
+  names.AppendString("Not A Codec");
+
+  cout << "Registered media format benchmark, " << registered.GetSize() << " formats registered" << endl;
+
+  LegacyRegistry legacy;
+
+  // Both must find the same format for every name
+  unsigned mismatches = 0;
+  for (PINDEX i = 0; i < names.GetSize(); ++i) {
+    OpalMediaFormat format;
+    legacy.Find(names[i], format);
+    if (format.GetName() != OpalMediaFormat(names[i]).GetName())
+      ++mismatches;
+  }
+  if (mismatches > 0)
+    cout << "    " << mismatches << " names found differently!" << endl;
+
+  bool ok = mismatches == 0 && CheckDirectChange();
+
+  // Uncontended, then with many signalling threads at once
+  unsigned threadCounts[2] = { 1, threads };
+  for (PINDEX i = 0; i < (threads > 1 ? 2 : 1); ++i) {
+    cout << "  " << threadCounts[i] << " threads constructing " << lookups << " formats by name each" << endl;
+    RunRegistryBenchmark("legacy",   &legacy, names, lookups, threadCounts[i]);
+    RunRegistryBenchmark("snapshot", NULL,    names, lookups, threadCounts[i]);
+  }
+
+  return ok;
+}
+
+OPALBENCH_TEST("registry", "Media formats constructed by name, global list vs snapshot",
+               "-T 32 -r 100000", MediaRegistryBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,304 @@
+/*
+ * relaybench.cxx
+ *
+ * OPAL application source file for benchmarking same codec RTP relaying
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <rtp/rtp.h>
+#include <rtp/reactor.h>
+
+#include "main.h"
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static RTP_Session::Params MakeRelayParams(unsigned id)
+{
+  RTP_Session::Params params;
+  params.id = id;
+  params.encoding = "rtp/avp";
+  return params;
+}
+
+
+/**One leg of a relayed call, packets arriving at the incoming session are
+   sent on by the outgoing session. Without a reactor this is done by a
+   thread per pair as an OpalMediaPatch would, otherwise by the reactor
+   threads via the relay handler as an OpalRelayMediaPatch would.
+  */
+class RelayPair
+#if OPAL_RTP_AGGREGATE
+  : public RTP_UDP::RelayHandler
+#endif
+{
+  public:
+    RelayPair(unsigned id)
+      : m_incoming(MakeRelayParams(id*2))
+      , m_outgoing(MakeRelayParams(id*2+1))
+      , m_thread(NULL)
+    {
+    }
+
+    ~RelayPair()
+    {
+      Stop();
+    }
+
+    bool Open(const PIPSocket::Address & loopback, WORD & nextPort, WORD drainPort, RTP_Reactor * reactor)
+    {
+#if OPAL_RTP_AGGREGATE
+      m_incoming.SetReactor(reactor);
+      m_outgoing.SetReactor(reactor);
+#endif
+
+      if (!m_incoming.Open(loopback, nextPort, 65534, 0))
+        return false;
+      nextPort = (WORD)(m_incoming.GetLocalControlPort()+1);
+
+      if (!m_outgoing.Open(loopback, nextPort, 65534, 0))
+        return false;
+      nextPort = (WORD)(m_outgoing.GetLocalControlPort()+1);
+
+      m_outgoing.SetRemoteSocketInfo(loopback, drainPort, true);
+
+#if OPAL_RTP_AGGREGATE
+      if (reactor != NULL)
+        return m_incoming.SetRelayHandler(this);
+#endif
+
+      m_thread = PThread::Create(PCREATE_NOTIFIER(PatchMain), "Bench Patch");
+      return true;
+    }
+
+    void Stop()
+    {
+#if OPAL_RTP_AGGREGATE
+      m_incoming.SetRelayHandler(NULL);
+#endif
+
+      m_incoming.Close(true);
+      m_outgoing.Close(false);
+
+      if (m_thread != NULL) {
+        m_thread->WaitForTermination();
+        delete m_thread;
+        m_thread = NULL;
+      }
+    }
+
+    WORD GetLocalDataPort() const { return m_incoming.GetLocalDataPort(); }
+
+#if OPAL_RTP_AGGREGATE
+    virtual void OnRelayData(RTP_UDP &, RTP_DataFrame * const * frames, PINDEX count)
+    {
+      m_outgoing.WriteRelayData(frames, count);
+    }
+#endif
+
+  protected:
+    PDECLARE_NOTIFIER(PThread, RelayPair, PatchMain);
+
+    RTP_UDP   m_incoming;
+    RTP_UDP   m_outgoing;
+    PThread * m_thread;
+};
+
+
+void RelayPair::PatchMain(PThread &, INT)
+{
+  RTP_DataFrame frame(0, 2048);
+  while (m_incoming.ReadData(frame, true)) {
+    if (!m_outgoing.WriteData(frame))
+      break;
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**Receives everything the outgoing sessions send, to count what got through.
+  */
+class RelayDrain
+{
+  public:
+    RelayDrain(const PIPSocket::Address & loopback)
+      : m_received(0)
+    {
+      m_socket.Listen(loopback, 0, 0);
+      m_socket.SetReadTimeout(500);
+      m_thread = PThread::Create(PCREATE_NOTIFIER(DrainMain), "Bench Drain");
+    }
+
+    ~RelayDrain()
+    {
+      m_socket.Close();
+      m_thread->WaitForTermination();
+      delete m_thread;
+    }
+
+    WORD GetPort() const { return m_socket.GetPort(); }
+    unsigned GetReceived() const { return m_received; }
+
+  protected:
+    PDECLARE_NOTIFIER(PThread, RelayDrain, DrainMain);
+
+    PUDPSocket m_socket;
+    PThread  * m_thread;
+    unsigned   m_received;
+};
+
+
+void RelayDrain::DrainMain(PThread &, INT)
+{
+  BYTE buffer[2048];
+  while (m_socket.IsOpen()) {
+    if (m_socket.Read(buffer, sizeof(buffer)))
+      ++m_received;
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void RunRelayBenchmark(unsigned pairCount,
+                              unsigned reactorThreads,
+                              unsigned rounds,
+                              unsigned interval,
+                              WORD basePort)
+{
+  const PIPSocket::Address loopback(127, 0, 0, 1);
+
+#if OPAL_RTP_AGGREGATE
+  RTP_Reactor * reactor = reactorThreads > 0 ? new RTP_Reactor(reactorThreads) : NULL;
+#else
+  if (reactorThreads > 0) {
+    cout << "Reactor relay not supported on this platform." << endl;
+    return;
+  }
+  RTP_Reactor * reactor = NULL;
+#endif
+
+  RelayDrain drain(loopback);
+
+  std::vector<RelayPair *> pairs;
+  WORD nextPort = basePort;
+  for (unsigned i = 0; i < pairCount; ++i) {
+    RelayPair * pair = new RelayPair(i+1);
+    if (!pair->Open(loopback, nextPort, drain.GetPort(), reactor)) {
+      cout << "Could not open session pair " << i << ", check ulimit -n" << endl;
+      delete pair;
+      break;
+    }
+    pairs.push_back(pair);
+  }
+
+  PUDPSocket sender;
+  sender.Listen(loopback, 0, 0);
+
+  RTP_DataFrame packet(160);
+  packet.SetPayloadType(RTP_DataFrame::PCMU);
+  memset(packet.GetPayloadPtr(), 0xff, packet.GetPayloadSize());
+
+  BenchUsage before;
+  PTime start;
+
+  for (unsigned round = 0; round < rounds; ++round) {
+    packet.SetSequenceNumber((WORD)round);
+    packet.SetTimestamp(round*160);
+
+    for (size_t i = 0; i < pairs.size(); ++i) {
+      packet.SetSyncSource((DWORD)(0x10000+i));
+      sender.WriteTo(packet.GetPointer(), packet.GetHeaderSize()+packet.GetPayloadSize(),
+                     loopback, pairs[i]->GetLocalDataPort());
+    }
+
+    PTimeInterval delay = PTimeInterval(interval*(round+1)) - (PTime() - start);
+    if (delay > 0)
+      PThread::Sleep(delay);
+  }
+
+  // Allow stragglers to arrive
+  PThread::Sleep(interval*5);
+
+  BenchUsage after;
+
+  for (size_t i = 0; i < pairs.size(); ++i)
+    delete pairs[i];
+
+#if OPAL_RTP_AGGREGATE
+  delete reactor;
+#endif
+
+  /* CPU time includes the sender and drain, which do the same work in both
+     cases, so the difference between the two is all in the forwarding. */
+  unsigned relayed = drain.GetReceived();
+  double cpuSeconds = (after.m_cpuTime - before.m_cpuTime)/1000000.0;
+  double elapsed = (after.m_time - before.m_time).GetMilliSeconds()/1000.0;
+
+  cout << setw(5) << pairs.size() << " pairs, "
+       << (reactorThreads > 0 ? psprintf("relay(%u)", reactorThreads) : PString("threaded"))
+       << ": threads=" << before.m_threads
+       << " context-switches=" << (after.m_contextSwitches - before.m_contextSwitches)
+       << " relayed=" << relayed << '/' << pairs.size()*rounds
+       << " cpu=" << cpuSeconds << "s";
+  if (cpuSeconds > 0 && elapsed > 0)
+    cout << " packets/sec=" << (unsigned)(relayed/elapsed)
+         << " packets/sec/core=" << (unsigned)(relayed/cpuSeconds);
+  cout << endl;
+}
+
+
+static bool RelayBenchmark(PArgList & args)
+{
+  PStringArray counts = args.GetOptionString('s', "100,500").Tokenise(",");
+  unsigned threads = args.GetOptionString('T', "4").AsUnsigned();
+  unsigned rounds = args.GetOptionString('r', "250").AsUnsigned();
+  unsigned interval = args.GetOptionString('i', "20").AsUnsigned();
+  WORD port = (WORD)args.GetOptionString('p', "20000").AsUnsigned();
+
+  if (threads == 0)
+    threads = 1;
+
+  cout << "RTP relay benchmark, " << rounds << " packets per pair at " << interval << "ms intervals" << endl;
+
+  for (PINDEX i = 0; i < counts.GetSize(); ++i) {
+    unsigned pairCount = counts[i].AsUnsigned();
+    RunRelayBenchmark(pairCount, 0, rounds, interval, port);
+    RunRelayBenchmark(pairCount, threads, rounds, interval, port);
+  }
+
+  return true;
+}
+
+OPALBENCH_TEST("relay", "RTP to RTP forwarding with patch threads vs reactor relay",
+               "-s 100,500 -T 4 -r 250 -i 20 -p 20000", RelayBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
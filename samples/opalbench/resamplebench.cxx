@@ -0,0 +1,176 @@
+/*
+ * resamplebench.cxx
+ *
+ * OPAL application source file for checking PCM sample rate conversion
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <codec/resampler.h>
+#include <rtp/rtp.h>
+
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#include "main.h"
+
+
+#define TONE_AMPLITUDE   16000
+#define TONE_SECONDS     2
+#define SETTLE_MS        250    // Ignored at start of output for SNR
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**Resample a pure tone and compare against the ideal tone at the output
+   rate, delayed by the filter group delay. Returns SNR in dB.
+  */
+static double MeasureSNR(unsigned inputRate, unsigned outputRate, bool lowLatency, double frequency)
+{
+  OpalPCM16Resampler resampler(inputRate, outputRate);
+  resampler.SetLowLatency(lowLatency);
+
+  PINDEX blockSize = inputRate/100;
+  PINDEX inputCount = inputRate*TONE_SECONDS;
+  std::vector<short> input(inputCount);
+  for (PINDEX i = 0; i < inputCount; ++i)
+    input[i] = (short)floor(TONE_AMPLITUDE*sin(2*M_PI*frequency*i/inputRate) + 0.5);
+
+  std::vector<short> output(resampler.GetMaxOutputSamples(inputCount) + blockSize);
+  PINDEX outputCount = 0;
+  for (PINDEX i = 0; i < inputCount; i += blockSize)
+    outputCount += resampler.Resample(&input[i], blockSize, &output[outputCount]);
+
+  double delay = resampler.GetGroupDelay();
+  double signal = 0, noise = 0;
+  for (PINDEX k = outputRate*SETTLE_MS/1000; k < outputCount; ++k) {
+    double ideal = TONE_AMPLITUDE*sin(2*M_PI*frequency*(k-delay)/outputRate);
+    signal += ideal*ideal;
+    noise += (output[k]-ideal)*(output[k]-ideal);
+  }
+
+  return noise > 0 ? 10*log10(signal/noise) : 999;
+}
+
+
+/**Pass 10ms packets through the transcoder created from the factory, as
+   the media patch would. Returns millions of input samples per second.
+  */
+static double MeasureThroughput(unsigned inputRate, unsigned outputRate, bool lowLatency, unsigned rounds)
+{
+  OpalTranscoder * transcoder = OpalTranscoder::Create(OpalPCM16Resampler::GetPCM16Format(inputRate),
+                                                       OpalPCM16Resampler::GetPCM16Format(outputRate));
+  OpalPCM16Resampler * resampler = dynamic_cast<OpalPCM16Resampler *>(transcoder);
+  if (resampler == NULL) {
+    delete transcoder;
+    return 0;
+  }
+
+  resampler->SetLowLatency(lowLatency);
+
+  PINDEX blockSize = inputRate/100;
+  RTP_DataFrame packet(blockSize*sizeof(short));
+  short * samples = (short *)packet.GetPayloadPtr();
+  for (PINDEX i = 0; i < blockSize; ++i)
+    samples[i] = (short)(TONE_AMPLITUDE*sin(2*M_PI*1000*i/inputRate));
+
+  RTP_DataFrameList output;
+
+  PTimeInterval start = PTimer::Tick();
+  for (unsigned i = 0; i < rounds; ++i) {
+    packet.SetTimestamp(i*blockSize);
+    resampler->ConvertFrames(packet, output);
+  }
+  PInt64 elapsed = (PTimer::Tick() - start).GetMilliSeconds();
+
+  delete transcoder;
+
+  return elapsed > 0 ? (double)blockSize*rounds/elapsed/1000 : 0;
+}
+
+
+static bool ResamplerBenchmark(PArgList & args)
+{
+  unsigned rounds = args.GetOptionString('r', "10000").AsUnsigned();
+  if (rounds == 0)
+    rounds = 1;
+
+  static const unsigned rates[] = { 8000, 16000, 32000, 48000 };
+  static const double tones[] = { 300, 1000, 3000 };
+  static const PINDEX numRates = PARRAYSIZE(rates);
+  static const PINDEX numTones = PARRAYSIZE(tones);
+
+  cout << "Resampler benchmark, SNR is the worst of " << tones[0];
+  for (PINDEX t = 1; t < numTones; ++t)
+    cout << ',' << tones[t];
+  cout << "Hz tones, throughput over " << rounds << " 10ms packets" << endl;
+
+  for (int lowLatency = 0; lowLatency < 2; ++lowLatency) {
+    for (PINDEX in = 0; in < numRates; ++in) {
+      for (PINDEX out = 0; out < numRates; ++out) {
+        if (in == out)
+          continue;
+
+        double snr = 999;
+        for (PINDEX t = 0; t < numTones; ++t)
+          snr = PMIN(snr, MeasureSNR(rates[in], rates[out], lowLatency != 0, tones[t]));
+
+        OpalPCM16Resampler resampler(rates[in], rates[out]);
+        resampler.SetLowLatency(lowLatency != 0);
+
+        cout << setw(5) << rates[in] << " -> " << setw(5) << rates[out]
+             << (lowLatency ? " low latency:" : " normal:     ")
+             << " snr=" << setprecision(1) << setiosflags(ios::fixed) << snr << "dB"
+             << " delay=" << setprecision(2) << resampler.GetGroupDelay()*1000/rates[out] << "ms"
+             << " throughput=" << setprecision(1)
+             << MeasureThroughput(rates[in], rates[out], lowLatency != 0, rounds) << "Msamples/s"
+             << resetiosflags(ios::fixed) << endl;
+      }
+    }
+  }
+
+  // Check the patch can now bridge wideband to narrowband
+  OpalMediaFormatList intermediates;
+  if (!OpalTranscoder::FindIntermediateFormats(OpalPCM16_16KHZ, OpalG711_ULAW_64K, intermediates)) {
+    cout << "No path " << OpalPCM16_16KHZ << " -> " << OpalG711_ULAW_64K << endl;
+    return false;
+  }
+
+  cout << "Path " << OpalPCM16_16KHZ << " -> " << OpalG711_ULAW_64K
+       << " via " << setfill(',') << intermediates << setfill(' ') << endl;
+  return true;
+}
+
+OPALBENCH_TEST("resample", "PCM-16 sample rate conversion quality and throughput",
+               "-r 10000", ResamplerBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
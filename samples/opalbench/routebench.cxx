@@ -0,0 +1,290 @@
+/*
+ * routebench.cxx
+ *
+ * OPAL application source file for benchmarking call routing
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <opal/manager.h>
+#include <opal/routetable.h>
+
+#include "main.h"
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/* Dial plan of mostly gateway prefixes, as a carrier would have, with some
+   per endpoint scheme routes and some that need a full regular expression. */
+
+static PString RouteSpec(unsigned index)
+{
+  switch (index%10) {
+    case 8 :
+      return psprintf("ep%u:.*=sip:<da>", index);
+    case 9 :
+      return psprintf("h323:.*\t(%u|%u)9.*=h323:<dn>@gk%u", 10000+index, 20000+index, index);
+    default :
+      return psprintf("%s:.*\t%u.*=sip:<dn>@gw%u", (index&1) != 0 ? "h323" : "sip", 10000+index, index);
+  }
+}
+
+
+static void RouteSearch(unsigned index, PString & a_party, PString & b_party)
+{
+  a_party = (index&1) != 0 || index%10 == 8 ? "h323:user@here.net" : "sip:user@here.net";
+  b_party = psprintf("%u95551234", 10000+index);
+}
+
+
+/**This is how OpalManager::ApplyRouteTable() searched before the table was
+   compiled, for comparison.
+  */
+class LegacyRouter
+{
+  public:
+    LegacyRouter(const OpalManager::RouteTable & table)
+      : m_table(table)
+    {
+    }
+
+    PString Route(const PString & a_party, const PString & b_party)
+    {
+      PWaitAndSignal mutex(m_mutex);
+
+      PString search = a_party + '\t' + b_party;
+      PINDEX routeIndex = 0;
+      while (routeIndex < m_table.GetSize()) {
+        OpalManager::RouteEntry & entry = m_table[routeIndex++];
+        PINDEX pos;
+        if (entry.regex.Execute(search, pos)) {
+          if (entry.destination.NumCompare("label:") != PObject::EqualTo)
+            return entry.destination;
+
+          search = entry.destination;
+          routeIndex = 0;
+        }
+      }
+
+      return PString::Empty();
+    }
+
+  protected:
+    const OpalManager::RouteTable & m_table;
+    PMutex                          m_mutex;
+};
+
+
+/**Searches the compiled table the way OpalManager::ApplyRouteTable() does.
+  */
+class CompiledRouter
+{
+  public:
+    CompiledRouter(const OpalCompiledRouteTablePtr & table)
+      : m_table(table)
+    {
+    }
+
+    PString Route(const PString & a_party, const PString & b_party)
+    {
+      const OpalCompiledRouteTable & table = *m_table;
+
+      PString search = a_party + '\t' + b_party;
+      PINDEX routeIndex = 0;
+      PString found;
+      while (table.Find(search, routeIndex, found)) {
+        if (found.NumCompare("label:") != PObject::EqualTo)
+          return found;
+
+        search = found;
+        routeIndex = 0;
+      }
+
+      return PString::Empty();
+    }
+
+  protected:
+    OpalCompiledRouteTablePtr m_table;
+};
+
+
+/**Gives the benchmark the compiled table ApplyRouteTable() searches.
+  */
+class BenchRouteManager : public OpalManager
+{
+  public:
+    using OpalManager::CompileRouteTable;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+template <class Router>
+class BenchRouteThread : public PThread
+{
+  PCLASSINFO(BenchRouteThread, PThread);
+
+  public:
+    BenchRouteThread(Router & router, unsigned count, unsigned lookups, unsigned seed)
+      : PThread(65536, NoAutoDeleteThread, NormalPriority, "Bench Route")
+      , m_router(router)
+      , m_count(count)
+      , m_lookups(lookups)
+      , m_seed(seed)
+      , m_found(0)
+    {
+      Resume();
+    }
+
+    virtual void Main()
+    {
+      PRandom random(m_seed);
+      PString a_party, b_party;
+      for (unsigned i = 0; i < m_lookups; ++i) {
+        RouteSearch(random.Generate()%m_count, a_party, b_party);
+        if (!m_router.Route(a_party, b_party).IsEmpty())
+          ++m_found;
+      }
+    }
+
+    unsigned GetFound() const { return m_found; }
+
+  protected:
+    Router & m_router;
+    unsigned m_count;
+    unsigned m_lookups;
+    unsigned m_seed;
+    unsigned m_found;
+};
+
+
+template <class Router>
+static unsigned RunRouteBenchmark(const char * name, Router & router, unsigned count, unsigned lookups, unsigned threads)
+{
+  std::vector<BenchRouteThread<Router> *> routeThreads;
+
+  BenchUsage before;
+  PTimeInterval start = PTimer::Tick();
+
+  for (unsigned i = 0; i < threads; ++i)
+    routeThreads.push_back(new BenchRouteThread<Router>(router, count, lookups, i+1));
+
+  unsigned found = 0;
+  for (size_t i = 0; i < routeThreads.size(); ++i) {
+    routeThreads[i]->WaitForTermination();
+    found += routeThreads[i]->GetFound();
+    delete routeThreads[i];
+  }
+
+  PTimeInterval elapsed = PTimer::Tick() - start;
+  BenchUsage after;
+
+  PInt64 ms = PMAX((PInt64)1, elapsed.GetMilliSeconds());
+  cout << "    " << setw(8) << name << ": "
+       << "routes=" << (unsigned)((PUInt64)lookups*threads*1000/ms) << "/s"
+       << " found=" << found << '/' << lookups*threads
+       << " context-switches=" << (after.m_contextSwitches - before.m_contextSwitches)
+       << " cpu=" << (after.m_cpuTime - before.m_cpuTime)/1000000.0 << 's'
+       << endl;
+
+  return found;
+}
+
+
+static bool RouteBenchmark(PArgList & args)
+{
+  PStringArray counts = args.GetOptionString('s', "100,3000").Tokenise(",");
+  unsigned lookups = args.GetOptionString('r', "2000").AsUnsigned();
+  unsigned threads = args.GetOptionString('T', "4").AsUnsigned();
+  if (lookups == 0)
+    lookups = 1;
+  if (threads == 0)
+    threads = 1;
+
+  cout << "Call routing benchmark, " << threads << " threads doing "
+       << lookups << " route table searches each" << endl;
+
+  bool ok = true;
+
+  for (PINDEX i = 0; i < counts.GetSize(); ++i) {
+    unsigned count = counts[i].AsUnsigned();
+    if (count == 0)
+      continue;
+
+    BenchRouteManager manager;
+
+    PStringArray specs;
+    for (unsigned index = 0; index < count; ++index)
+      specs.AppendString(RouteSpec(index));
+    specs.AppendString(".*=pc:");
+
+    PTimeInterval start = PTimer::Tick();
+    manager.SetRouteTable(specs);
+    PTimeInterval compileTime = PTimer::Tick() - start;
+
+    OpalCompiledRouteTablePtr compiledTable = manager.CompileRouteTable();
+    LegacyRouter legacy(manager.GetRouteTable());
+    CompiledRouter compiled(compiledTable);
+
+    const OpalCompiledRouteTable & table = *compiledTable;
+    cout << setw(7) << count << " routes, "
+         << table.GetKindCount(OpalCompiledRouteTable::PrefixEntry) << " prefix, "
+         << table.GetKindCount(OpalCompiledRouteTable::SchemeEntry) << " scheme, "
+         << table.GetKindCount(OpalCompiledRouteTable::WildcardEntry) << " wildcard, "
+         << table.GetKindCount(OpalCompiledRouteTable::RegexEntry) << " regex, "
+         << "set in " << compileTime << 's' << endl;
+
+    // Both must pick the same entry for every search
+    unsigned mismatches = 0;
+    PString a_party, b_party;
+    for (unsigned index = 0; index < count; ++index) {
+      RouteSearch(index, a_party, b_party);
+      if (legacy.Route(a_party, b_party) != compiled.Route(a_party, b_party))
+        ++mismatches;
+    }
+    if (mismatches > 0) {
+      cout << "    " << mismatches << " searches routed differently!" << endl;
+      ok = false;
+    }
+
+    // Threads use the same seeds for both, so search the same numbers
+    unsigned legacyFound = RunRouteBenchmark("legacy", legacy, count, lookups, threads);
+    if (RunRouteBenchmark("compiled", compiled, count, lookups, threads) != legacyFound) {
+      cout << "    compiled table found a different number of routes under load!" << endl;
+      ok = false;
+    }
+  }
+
+  return ok;
+}
+
+OPALBENCH_TEST("route", "Call routing, regular expression per entry vs compiled table",
+               "-s 100,3000 -T 4 -r 2000", RouteBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
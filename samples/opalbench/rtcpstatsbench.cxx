@@ -0,0 +1,546 @@
+/*
+ * rtcpstatsbench.cxx
+ *
+ * OPAL application source file for benchmarking RTP statistics and RTCP XR
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <opal/seqlock.h>
+#include <rtp/rtp.h>
+#include <rtp/metrics.h>
+
+#include "main.h"
+
+
+#define PAYLOAD_SIZE 160
+#define POLL_INTERVAL 1      // ms between reads by a statistics poller
+#define OVERHEAD_ROUNDS 3    // best of, to keep other load out of the bound check
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**Counters as updated per packet, enough to see torn copies: the octets are
+   always PAYLOAD_SIZE times the packets.
+  */
+struct BenchCounters
+{
+  DWORD m_packets;
+  DWORD m_octets;
+  DWORD m_highest;
+  DWORD m_jitter;
+  RTP_JitterHistogram m_histogram;
+};
+
+
+static inline void UpdateCounters(BenchCounters & counters, unsigned i)
+{
+  counters.m_packets++;
+  counters.m_octets += PAYLOAD_SIZE;
+  counters.m_highest = i;
+  counters.m_jitter += (i&7) - ((counters.m_jitter+8) >> 4);
+  counters.m_histogram.Add(i&31);
+}
+
+
+static inline bool IsConsistent(const BenchCounters & counters)
+{
+  return counters.m_octets == counters.m_packets*PAYLOAD_SIZE;
+}
+
+
+/**Reads statistics while the media path runs, continuously or as a poller
+   would, counting reads that were not consistent.
+  */
+class BenchStatsReader : public PThread
+{
+  PCLASSINFO(BenchStatsReader, PThread);
+
+  public:
+    BenchStatsReader(unsigned interval = 0)
+      : PThread(65536, NoAutoDeleteThread, NormalPriority, "Bench Stats")
+      , m_interval(interval)
+      , m_running(true)
+      , m_reads(0)
+      , m_inconsistent(0)
+    {
+    }
+
+    virtual void Main()
+    {
+      while (m_running) {
+        if (!Read())
+          ++m_inconsistent;
+        ++m_reads;
+        if (m_interval > 0)
+          PThread::Sleep(m_interval);
+      }
+    }
+
+    void Stop()
+    {
+      m_running = false;
+      WaitForTermination();
+    }
+
+    unsigned GetReads() const { return m_reads; }
+    unsigned GetInconsistent() const { return m_inconsistent; }
+
+  protected:
+    virtual bool Read() = 0;
+
+    unsigned      m_interval;
+    volatile bool m_running;
+    unsigned      m_reads;
+    unsigned      m_inconsistent;
+};
+
+
+class BenchMutexReader : public BenchStatsReader
+{
+  PCLASSINFO(BenchMutexReader, BenchStatsReader);
+
+  public:
+    BenchMutexReader(PMutex & mutex, const BenchCounters & counters)
+      : m_mutex(mutex)
+      , m_counters(counters)
+    {
+      Resume();
+    }
+
+  protected:
+    virtual bool Read()
+    {
+      m_mutex.Wait();
+      BenchCounters copy = m_counters;
+      m_mutex.Signal();
+      return IsConsistent(copy);
+    }
+
+    PMutex              & m_mutex;
+    const BenchCounters & m_counters;
+};
+
+
+class BenchSeqLockReader : public BenchStatsReader
+{
+  PCLASSINFO(BenchSeqLockReader, BenchStatsReader);
+
+  public:
+    BenchSeqLockReader(const OpalSeqLocked<BenchCounters> & counters, unsigned interval = 0)
+      : BenchStatsReader(interval)
+      , m_counters(counters)
+    {
+      Resume();
+    }
+
+  protected:
+    virtual bool Read()
+    {
+      return IsConsistent(m_counters.Get());
+    }
+
+    const OpalSeqLocked<BenchCounters> & m_counters;
+};
+
+
+/**RTP session fed directly, without sockets, with access to the reports.
+  */
+class BenchStatsSession : public RTP_UDP
+{
+  PCLASSINFO(BenchStatsSession, RTP_UDP);
+
+  public:
+    BenchStatsSession(unsigned id)
+      : RTP_UDP(MakeParams(id))
+    {
+      // Reports are made explicitly, never from the media path
+      SetReportTimeInterval(PTimeInterval(0, 0, 60));
+    }
+
+    static Params MakeParams(unsigned id)
+    {
+      Params params;
+      params.id = id;
+      params.encoding = "rtp/avp";
+      params.isAudio = true;
+      return params;
+    }
+
+    void MakeReport(RTP_ControlFrame & report)
+    {
+      InsertReportPacket(report);
+      InsertExtendedReport(report);
+    }
+};
+
+
+class BenchSessionReader : public BenchStatsReader
+{
+  PCLASSINFO(BenchSessionReader, BenchStatsReader);
+
+  public:
+    BenchSessionReader(const RTP_Session & session)
+      : m_session(session)
+    {
+      Resume();
+    }
+
+  protected:
+    virtual bool Read()
+    {
+#if OPAL_STATISTICS
+      OpalMediaStatistics statistics;
+      m_session.GetStatistics(statistics, true);
+#endif
+      RTP_Session::ReceiveCounters counters = m_session.GetReceiveCounters();
+      return counters.m_octets == counters.m_packets*PAYLOAD_SIZE;
+    }
+
+    const RTP_Session & m_session;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static double ReportUpdates(const char * name, unsigned packets, const PTimeInterval & elapsed, BenchStatsReader * reader)
+{
+  double ns = elapsed.GetMilliSeconds()*1e6/packets;
+  cout << "  " << setw(20) << left << name << right
+       << setw(7) << fixed << setprecision(1) << ns << "ns/packet";
+  if (reader != NULL)
+    cout << ", " << reader->GetReads() << " reads, " << reader->GetInconsistent() << " inconsistent";
+  cout << endl;
+  return ns;
+}
+
+
+/**The cost the sequence lock adds to each packet's counter update, over
+   updating them unsynchronised, while a poller reads them. The best of a
+   few rounds of each is taken.
+  */
+static bool RunOverheadCheck(unsigned packets, double maxOverhead)
+{
+  cout << "Counter overhead per packet, with a poller every " << POLL_INTERVAL << "ms:" << endl;
+
+  PInt64 plainBest = 0, lockedBest = 0;
+  bool consistent = true;
+  for (unsigned round = 0; round < OVERHEAD_ROUNDS; ++round) {
+    BenchCounters plain;
+    memset(&plain, 0, sizeof(plain));
+    PTimeInterval start = PTimer::Tick();
+    for (unsigned i = 0; i < packets; ++i)
+      UpdateCounters(plain, i);
+    PInt64 elapsed = (PTimer::Tick() - start).GetMilliSeconds();
+    if (round == 0 || elapsed < plainBest)
+      plainBest = elapsed;
+    consistent = plain.m_highest+1 == packets && consistent;
+
+    OpalSeqLocked<BenchCounters> locked;
+    BenchSeqLockReader poller(locked, POLL_INTERVAL);
+    start = PTimer::Tick();
+    for (unsigned i = 0; i < packets; ++i) {
+      UpdateCounters(locked.BeginWrite(), i);
+      locked.EndWrite();
+    }
+    elapsed = (PTimer::Tick() - start).GetMilliSeconds();
+    poller.Stop();
+    if (round == 0 || elapsed < lockedBest)
+      lockedBest = elapsed;
+    consistent = poller.GetInconsistent() == 0 && consistent;
+  }
+
+  ReportUpdates("unsynchronised", packets, PTimeInterval(plainBest), NULL);
+  ReportUpdates("sequence lock", packets, PTimeInterval(lockedBest), NULL);
+
+  double overhead = (lockedBest - plainBest)*1e6/packets;
+  bool ok = consistent && overhead <= maxOverhead;
+  cout << "  overhead " << setprecision(1) << overhead << "ns/packet, bound " << maxOverhead << "ns "
+       << (ok ? "met" : "EXCEEDED") << endl;
+  return ok;
+}
+
+
+static bool RunCounterBenchmark(unsigned packets)
+{
+  cout << "Counter update per packet, with a reader on another thread:" << endl;
+
+  BenchCounters plain;
+  memset(&plain, 0, sizeof(plain));
+  PTimeInterval start = PTimer::Tick();
+  for (unsigned i = 0; i < packets; ++i)
+    UpdateCounters(plain, i);
+  ReportUpdates("unsynchronised", packets, PTimer::Tick() - start, NULL);
+
+  PMutex mutex;
+  BenchCounters guarded;
+  memset(&guarded, 0, sizeof(guarded));
+  BenchMutexReader mutexReader(mutex, guarded);
+  start = PTimer::Tick();
+  for (unsigned i = 0; i < packets; ++i) {
+    mutex.Wait();
+    UpdateCounters(guarded, i);
+    mutex.Signal();
+  }
+  PTimeInterval elapsed = PTimer::Tick() - start;
+  mutexReader.Stop();
+  ReportUpdates("mutex", packets, elapsed, &mutexReader);
+
+  OpalSeqLocked<BenchCounters> locked;
+  BenchSeqLockReader seqLockReader(locked);
+  start = PTimer::Tick();
+  for (unsigned i = 0; i < packets; ++i) {
+    UpdateCounters(locked.BeginWrite(), i);
+    locked.EndWrite();
+  }
+  elapsed = PTimer::Tick() - start;
+  seqLockReader.Stop();
+  ReportUpdates("sequence lock", packets, elapsed, &seqLockReader);
+
+  // Also stops the compiler discarding the unsynchronised loop
+  if (plain.m_highest+1 != packets || !IsConsistent(locked.Get()) || seqLockReader.GetInconsistent() != 0) {
+    cout << "  counters MISMATCH" << endl;
+    return false;
+  }
+  return true;
+}
+
+
+static void ReceivePackets(RTP_Session & session, unsigned count)
+{
+  RTP_DataFrame frame(PAYLOAD_SIZE);
+  frame.SetPayloadType(RTP_DataFrame::PCMU);
+  frame.SetSyncSource(0x12345678);
+  memset(frame.GetPayloadPtr(), 0xff, PAYLOAD_SIZE);
+
+  for (unsigned i = 0; i < count; ++i) {
+    frame.SetSequenceNumber((WORD)i);
+    frame.SetTimestamp(i*PAYLOAD_SIZE);
+    session.OnReceiveData(frame);
+  }
+}
+
+
+static void RunReceiveBenchmark(unsigned packets)
+{
+  cout << "RTP_Session::OnReceiveData() per packet:" << endl;
+
+  {
+    BenchStatsSession session(1);
+    PTimeInterval start = PTimer::Tick();
+    ReceivePackets(session, packets);
+    ReportUpdates("no reader", packets, PTimer::Tick() - start, NULL);
+  }
+
+  {
+    BenchStatsSession session(1);
+    BenchSessionReader reader(session);
+    PTimeInterval start = PTimer::Tick();
+    ReceivePackets(session, packets);
+    PTimeInterval elapsed = PTimer::Tick() - start;
+    reader.Stop();
+    ReportUpdates("GetStatistics reader", packets, elapsed, &reader);
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static bool CheckValue(const char * name, double value, double expected, double tolerance)
+{
+  bool ok = fabs(value - expected) <= tolerance;
+  cout << "  " << setw(32) << left << name << right << setprecision(2) << fixed << setw(8) << value
+       << " expected " << setw(8) << expected << ' ' << (ok ? "match" : "MISMATCH") << endl;
+  return ok;
+}
+
+
+static bool RunLossModelChecks()
+{
+  cout << "Loss model, RFC 3611 Gmin=" << RTP_LossModel::Gmin << " bursts:" << endl;
+
+  bool ok = true;
+
+  RTP_LossModel::Report report;
+
+  // One loss in every 50, all isolated so all in gaps
+  RTP_LossModel isolated;
+  memset(&isolated, 0, sizeof(isolated));
+  for (unsigned i = 0; i < 1000; ++i) {
+    if (i%50 == 49)
+      isolated.OnLost(1);
+    else
+      isolated.OnReceived();
+  }
+  isolated.GetReport(report);
+  ok = CheckValue("isolated burst density", report.m_burstDensity, 0, 0) && ok;
+  ok = CheckValue("isolated gap density", report.m_gapDensity, 256/50, 1) && ok;
+  ok = CheckValue("isolated burst ratio", report.m_burstRatio, 1, 0.05) && ok;
+
+  // Four lost in a row in every 100, each a burst of its own
+  RTP_LossModel bursty;
+  memset(&bursty, 0, sizeof(bursty));
+  for (unsigned i = 0; i < 1000; i += 100) {
+    for (unsigned j = 0; j < 96; ++j)
+      bursty.OnReceived();
+    bursty.OnLost(4);
+  }
+  bursty.GetReport(report);
+  ok = CheckValue("bursty burst density", report.m_burstDensity, 255, 0) && ok;
+  ok = CheckValue("bursty burst length", report.m_burstLength, 4, 0) && ok;
+  ok = CheckValue("bursty gap density", report.m_gapDensity, 0, 0) && ok;
+  ok = CheckValue("bursty gap length", report.m_gapLength, 960.0/11, 0.5) && ok;
+  // The last burst has not ended, so there are nine transitions to received
+  ok = CheckValue("bursty burst ratio", report.m_burstRatio, 1/(10.0/960 + 9.0/40), 0.05) && ok;
+
+  // Two losses 10 apart are one burst, as fewer than Gmin were received between
+  RTP_LossModel close;
+  memset(&close, 0, sizeof(close));
+  for (unsigned i = 0; i < 100; ++i) {
+    if (i == 40 || i == 50)
+      close.OnLost(1);
+    else
+      close.OnReceived();
+  }
+  close.GetReport(report);
+  ok = CheckValue("close losses burst length", report.m_burstLength, 11, 0) && ok;
+  ok = CheckValue("close losses burst density", report.m_burstDensity, 2*256/11, 1) && ok;
+
+  cout << "E-model:" << endl;
+  double Ie, Bpl;
+  RTP_EModel::GetCodecImpairments(RTP_DataFrame::PCMU, Ie, Bpl);
+  double R = RTP_EModel::GetRFactor(0, 1, 0, Ie, Bpl);
+  ok = CheckValue("G.711 no loss R", R, 93.2, 0.01) && ok;
+  ok = CheckValue("G.711 no loss MOS", RTP_EModel::GetMOS(R), 4.41, 0.01) && ok;
+  R = RTP_EModel::GetRFactor(2, 1, 0, Ie, Bpl);
+  ok = CheckValue("G.711 2% random loss R", R, 93.2 - 95*2/(2+25.1), 0.01) && ok;
+  R = RTP_EModel::GetRFactor(0, 1, 300, Ie, Bpl);
+  ok = CheckValue("G.711 300ms delay R", R, 93.2 - 0.024*300 - 0.11*(300-177.3), 0.01) && ok;
+
+  return ok;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void DeliverControl(const RTP_ControlFrame & sent, RTP_Session & receiver)
+{
+  PINDEX size = sent.GetCompoundSize();
+  RTP_ControlFrame frame(size);
+  memcpy(frame.GetPointer(), (const BYTE *)sent, size);
+  frame.SetSize(size);
+  receiver.OnReceiveControl(frame);
+}
+
+
+static void SendPackets(RTP_Session & sender, RTP_Session & receiver, unsigned count, unsigned lossInterval)
+{
+  RTP_DataFrame frame(PAYLOAD_SIZE);
+  frame.SetPayloadType(RTP_DataFrame::PCMU);
+  memset(frame.GetPayloadPtr(), 0xff, PAYLOAD_SIZE);
+
+  for (unsigned i = 0; i < count; ++i) {
+    frame.SetTimestamp(i*PAYLOAD_SIZE);
+    sender.OnSendData(frame);
+    if (lossInterval == 0 || i%lossInterval != lossInterval-1)
+      receiver.OnReceiveData(frame);
+  }
+}
+
+
+static bool RunExtendedReportChecks()
+{
+  cout << "Extended report and round trip between two sessions:" << endl;
+
+  BenchStatsSession alice(1), bob(1);
+
+  // Alice sends to Bob, who loses one in 25
+  SendPackets(alice, bob, 500, 25);
+
+  // Alice's SR takes 30ms to reach Bob, who holds it 20ms, and his RR and XR take 30ms back
+  RTP_ControlFrame senderReport;
+  alice.MakeReport(senderReport);
+  PThread::Sleep(30);
+  DeliverControl(senderReport, bob);
+  PThread::Sleep(20);
+  RTP_ControlFrame receiverReport;
+  bob.MakeReport(receiverReport);
+  PThread::Sleep(30);
+  DeliverControl(receiverReport, alice);
+
+  RTP_VoIPMetrics sent, received;
+  BYTE sentBlock[RTP_VoIPMetrics::BlockSize], receivedBlock[RTP_VoIPMetrics::BlockSize];
+  bool haveSent = bob.GetVoIPMetrics(sent);
+  bool haveReceived = alice.GetRemoteVoIPMetrics(received);
+  if (haveSent)
+    sent.Encode(sentBlock);
+  if (haveReceived)
+    received.Encode(receivedBlock);
+  bool ok = haveSent && haveReceived && memcmp(sentBlock, receivedBlock, sizeof(sentBlock)) == 0;
+  cout << "  XR VoIP metrics round trip: " << (ok ? "match" : "MISMATCH") << endl;
+  if (haveReceived)
+    cout << "  " << received << endl;
+
+  ok = CheckValue("loss rate", received.m_lossRate, 256/25, 1) && ok;
+  ok = CheckValue("round trip ms", alice.GetRoundTripTime(), 60, 15) && ok;
+
+#if OPAL_STATISTICS
+  OpalMediaStatistics statistics;
+  alice.GetStatistics(statistics, false);
+  cout << "  Alice's view of what she sends: R=" << statistics.m_rFactor
+       << " MOS-LQ=" << statistics.m_mosListening/10.0
+       << " MOS-CQ=" << statistics.m_mosConversational/10.0
+       << " rtt=" << statistics.m_roundTripTime << "ms" << endl;
+#endif
+
+  return ok;
+}
+
+
+static bool RTCPStatisticsBenchmark(PArgList & args)
+{
+  unsigned packets = args.GetOptionString('r', "2000000").AsUnsigned();
+  double maxOverhead = args.GetOptionString('O', "20").AsReal();
+  if (packets == 0)
+    packets = 1;
+
+  cout << "RTP statistics benchmark, " << packets << " packets" << endl;
+
+  bool ok = RunCounterBenchmark(packets);
+  ok = RunOverheadCheck(packets, maxOverhead) && ok;
+  RunReceiveBenchmark(packets);
+  ok = RunLossModelChecks() && ok;
+  ok = RunExtendedReportChecks() && ok;
+  return ok;
+}
+
+OPALBENCH_TEST("rtcpstats", "RTP statistics, mutex vs sequence lock counters, and RTCP XR",
+               "-r 2000000 -O 20", RTCPStatisticsBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,234 @@
+/*
+ * rtpbench.cxx
+ *
+ * OPAL application source file for benchmarking RTP handling
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <rtp/rtp.h>
+#include <rtp/reactor.h>
+
+#include "main.h"
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**RTP session that records the latency of each received packet, the send
+   time being in the first eight bytes of the payload.
+  */
+class BenchSession : public RTP_UDP
+{
+  PCLASSINFO(BenchSession, RTP_UDP);
+
+  public:
+    BenchSession(unsigned id, BenchSamples & latency)
+      : RTP_UDP(MakeParams(id))
+      , m_latency(latency)
+      , m_reader(NULL)
+    {
+    }
+
+    ~BenchSession()
+    {
+      StopReader();
+    }
+
+    static Params MakeParams(unsigned id)
+    {
+      Params params;
+      params.id = id;
+      params.encoding = "rtp/avp";
+      return params;
+    }
+
+    void Record(const RTP_DataFrame & frame)
+    {
+      if (frame.GetPayloadSize() < (PINDEX)sizeof(PInt64))
+        return;
+
+      PInt64 sent;
+      memcpy(&sent, frame.GetPayloadPtr(), sizeof(sent));
+      m_latency.Add(PTime().GetTimestamp() - sent);
+    }
+
+#if OPAL_RTP_AGGREGATE
+    // Consume directly on the reactor thread, no reader thread needed
+    virtual void OnReactorData(RTP_DataFrame * frame)
+    {
+      Record(*frame);
+      delete frame;
+    }
+#endif
+
+    void StartReader()
+    {
+      m_reader = PThread::Create(PCREATE_NOTIFIER(ReadMain), "Bench Reader");
+    }
+
+    void StopReader()
+    {
+      if (m_reader == NULL)
+        return;
+
+      Close(true);
+      m_reader->WaitForTermination();
+      delete m_reader;
+      m_reader = NULL;
+    }
+
+  protected:
+    PDECLARE_NOTIFIER(PThread, BenchSession, ReadMain);
+
+    BenchSamples & m_latency;
+    PThread      * m_reader;
+};
+
+
+void BenchSession::ReadMain(PThread &, INT)
+{
+  RTP_DataFrame frame(0, 2048);
+  while (ReadData(frame, true))
+    Record(frame);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void RunReactorBenchmark(unsigned sessionCount,
+                                unsigned reactorThreads,
+                                unsigned rounds,
+                                unsigned interval,
+                                WORD basePort)
+{
+  const PIPSocket::Address loopback(127, 0, 0, 1);
+
+#if OPAL_RTP_AGGREGATE
+  RTP_Reactor * reactor = reactorThreads > 0 ? new RTP_Reactor(reactorThreads) : NULL;
+#else
+  if (reactorThreads > 0) {
+    cout << "Reactor not supported on this platform." << endl;
+    return;
+  }
+#endif
+
+  BenchUsage before;
+  BenchSamples latency;
+
+  std::vector<BenchSession *> sessions;
+  WORD nextPort = basePort;
+  for (unsigned i = 0; i < sessionCount; ++i) {
+    BenchSession * session = new BenchSession(i+1, latency);
+#if OPAL_RTP_AGGREGATE
+    session->SetReactor(reactor);
+#endif
+    if (!session->Open(loopback, nextPort, 65534, 0)) {
+      cout << "Could not open session " << i << ", check ulimit -n" << endl;
+      delete session;
+      break;
+    }
+    nextPort = (WORD)(session->GetLocalControlPort()+1);
+    if (reactorThreads == 0)
+      session->StartReader();
+    sessions.push_back(session);
+  }
+
+  PUDPSocket sender;
+  sender.Listen(loopback, 0, 0);
+
+  RTP_DataFrame packet(160);
+  packet.SetPayloadType(RTP_DataFrame::PCMU);
+  memset(packet.GetPayloadPtr(), 0xff, packet.GetPayloadSize());
+
+  BenchUsage running;
+  PTime start;
+
+  for (unsigned round = 0; round < rounds; ++round) {
+    packet.SetSequenceNumber((WORD)round);
+    packet.SetTimestamp(round*160);
+
+    for (size_t i = 0; i < sessions.size(); ++i) {
+      packet.SetSyncSource((DWORD)(0x10000+i));
+      PInt64 now = PTime().GetTimestamp();
+      memcpy(packet.GetPayloadPtr(), &now, sizeof(now));
+      sender.WriteTo(packet.GetPointer(), packet.GetHeaderSize()+packet.GetPayloadSize(),
+                     loopback, sessions[i]->GetLocalDataPort());
+    }
+
+    PTimeInterval delay = PTimeInterval(interval*(round+1)) - (PTime() - start);
+    if (delay > 0)
+      PThread::Sleep(delay);
+  }
+
+  // Allow stragglers to arrive
+  PThread::Sleep(interval*5);
+
+  BenchUsage after;
+
+  for (size_t i = 0; i < sessions.size(); ++i)
+    delete sessions[i];
+
+#if OPAL_RTP_AGGREGATE
+  delete reactor;
+#endif
+
+  cout << setw(5) << sessions.size() << " sessions, "
+       << (reactorThreads > 0 ? psprintf("reactor(%u)", reactorThreads) : PString("threaded   "))
+       << ": threads=" << running.m_threads
+       << " context-switches=" << (after.m_contextSwitches - before.m_contextSwitches)
+       << " received=" << latency.GetCount() << '/' << sessions.size()*rounds
+       << " p50=" << latency.GetPercentile(50) << "us"
+       << " p99=" << latency.GetPercentile(99) << "us"
+       << endl;
+}
+
+
+static bool ReactorBenchmark(PArgList & args)
+{
+  PStringArray counts = args.GetOptionString('s', "500,2000,5000").Tokenise(",");
+  unsigned threads = args.GetOptionString('T', "4").AsUnsigned();
+  unsigned rounds = args.GetOptionString('r', "50").AsUnsigned();
+  unsigned interval = args.GetOptionString('i', "20").AsUnsigned();
+  WORD port = (WORD)args.GetOptionString('p', "20000").AsUnsigned();
+
+  cout << "RTP reactor benchmark, " << rounds << " packets per session at " << interval << "ms intervals" << endl;
+
+  for (PINDEX i = 0; i < counts.GetSize(); ++i) {
+    unsigned sessionCount = counts[i].AsUnsigned();
+    RunReactorBenchmark(sessionCount, 0, rounds, interval, port);
+    RunReactorBenchmark(sessionCount, threads, rounds, interval, port);
+  }
+
+  return true;
+}
+
+OPALBENCH_TEST("reactor", "RTP receive with per-session threads vs shared reactor",
+               "-s 500,2000,5000 -T 4 -r 50 -i 20 -p 20000", ReactorBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,255 @@
+/*
+ * schedbench.cxx
+ *
+ * OPAL application source file for benchmarking the work scheduler
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <opal/scheduler.h>
+
+#include "main.h"
+
+
+#define CONNECTIONS_PER_CALL 2   // Releases posted with the same call key
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**Stands in for a call being released, each of its connections blocks
+   briefly, as OnReleased() would sending a BYE or closing media. Counts any
+   time two releases for the call overlap.
+  */
+class BenchCall
+{
+  public:
+    BenchCall()
+      : m_active(0)
+      , m_overlaps(0)
+    {
+    }
+
+    void Release(BenchSamples & latency, PInt64 posted, unsigned blockTime)
+    {
+      latency.Add(PTime().GetTimestamp() - posted);
+
+      if (++m_active > 1)
+        ++m_overlaps;
+
+      if (blockTime > 0)
+        PThread::Sleep(blockTime);
+      else
+        PThread::Yield();
+
+      --m_active;
+    }
+
+    unsigned GetOverlaps() const { return m_overlaps; }
+
+  protected:
+    PAtomicInteger m_active;
+    PAtomicInteger m_overlaps;
+};
+
+
+/**What the release of each connection used to do, a thread of its own.
+  */
+class BenchReleaseThread : public PThread
+{
+  PCLASSINFO(BenchReleaseThread, PThread);
+
+  public:
+    BenchReleaseThread(BenchCall & call, BenchSamples & latency, unsigned blockTime, PAtomicInteger & completed)
+      : PThread(65536, AutoDeleteThread, NormalPriority, "OnRelease")
+      , m_call(call)
+      , m_latency(latency)
+      , m_posted(PTime().GetTimestamp())
+      , m_blockTime(blockTime)
+      , m_completed(completed)
+    {
+      Resume();
+    }
+
+    virtual void Main()
+    {
+      m_call.Release(m_latency, m_posted, m_blockTime);
+      ++m_completed;
+    }
+
+  protected:
+    BenchCall      & m_call;
+    BenchSamples   & m_latency;
+    PInt64           m_posted;
+    unsigned         m_blockTime;
+    PAtomicInteger & m_completed;
+};
+
+
+/**The same release, posted to the scheduler keyed on the call.
+  */
+class BenchReleaseWork : public OpalWorkScheduler::Work
+{
+  public:
+    BenchReleaseWork(const PString & token, BenchCall & call, BenchSamples & latency, unsigned blockTime, PAtomicInteger & completed)
+      : OpalWorkScheduler::Work(token)
+      , m_call(call)
+      , m_latency(latency)
+      , m_posted(PTime().GetTimestamp())
+      , m_blockTime(blockTime)
+      , m_completed(completed)
+    {
+    }
+
+    virtual void Run()
+    {
+      m_call.Release(m_latency, m_posted, m_blockTime);
+      ++m_completed;
+    }
+
+  protected:
+    BenchCall      & m_call;
+    BenchSamples   & m_latency;
+    PInt64           m_posted;
+    unsigned         m_blockTime;
+    PAtomicInteger & m_completed;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static bool RunReleaseBenchmark(unsigned callCount, unsigned maxThreads, unsigned blockTime)
+{
+  unsigned total = callCount*CONNECTIONS_PER_CALL;
+  bool ok = true;
+
+  for (int pass = 0; pass < 2; ++pass) {
+    BenchCall * calls = new BenchCall[callCount];
+    OpalWorkScheduler * scheduler = pass > 0 ? new OpalWorkScheduler(2, maxThreads, "Bench Worker") : NULL;
+
+    BenchSamples latency;
+    PAtomicInteger completed;
+    unsigned peakThreads = 0;
+
+    BenchUsage before;
+
+    for (unsigned i = 0; i < total; ++i) {
+      BenchCall & call = calls[i%callCount];
+      if (scheduler == NULL)
+        new BenchReleaseThread(call, latency, blockTime, completed);
+      else
+        scheduler->Post(new BenchReleaseWork(psprintf("call%u", i%callCount), call, latency, blockTime, completed));
+
+      if (i%1000 == 999) {
+        BenchUsage usage;
+        if (usage.m_threads > peakThreads)
+          peakThreads = usage.m_threads;
+      }
+    }
+
+    OpalWorkScheduler::Statistics statistics;
+    if (scheduler != NULL)
+      scheduler->GetStatistics(statistics);
+
+    PTime deadline = PTime() + PTimeInterval(0, 60);
+    while ((unsigned)completed < total && PTime() < deadline)
+      PThread::Sleep(1);
+
+    BenchUsage after;
+    if (after.m_threads > peakThreads)
+      peakThreads = after.m_threads;
+
+    double elapsed = (after.m_time - before.m_time).GetMilliSeconds()/1000.0;
+    double cpuSeconds = (after.m_cpuTime - before.m_cpuTime)/1000000.0;
+
+    cout << setw(7) << callCount << " calls, "
+         << (scheduler != NULL ? psprintf("scheduler(%u)", maxThreads) : PString("threads")) << ": "
+         << "completed=" << (unsigned)completed << '/' << total;
+    if (elapsed > 0)
+      cout << " releases/sec=" << (unsigned)((unsigned)completed/elapsed);
+    cout << " p50=" << latency.GetPercentile(50) << "us"
+         << " p99=" << latency.GetPercentile(99) << "us"
+         << " peak-threads=" << peakThreads
+         << " context-switches=" << (after.m_contextSwitches - before.m_contextSwitches)
+         << " cpu=" << cpuSeconds << 's';
+    if (scheduler != NULL)
+      cout << " peak-queue=" << statistics.m_peakQueueDepth
+           << " serialised=" << statistics.m_serialised;
+
+    delete scheduler;
+
+    unsigned overlaps = 0;
+    for (unsigned i = 0; i < callCount; ++i)
+      overlaps += calls[i].GetOverlaps();
+    cout << " same-call-overlaps=" << overlaps << endl;
+
+    // Every release must run, and the scheduler never runs two for one call at once
+    if ((unsigned)completed != total) {
+      cout << "    " << (total - (unsigned)completed) << " releases not completed!" << endl;
+      ok = false;
+    }
+    if (pass > 0 && overlaps != 0) {
+      cout << "    scheduler released connections of one call concurrently!" << endl;
+      ok = false;
+    }
+
+    // Threads still running after the deadline would use deleted calls
+    if ((unsigned)completed == total)
+      delete [] calls;
+  }
+
+  return ok;
+}
+
+
+static bool SchedulerBenchmark(PArgList & args)
+{
+  PStringArray counts = args.GetOptionString('s', "500,5000").Tokenise(",");
+  unsigned threads = args.GetOptionString('T', "32").AsUnsigned();
+  unsigned blockTime = args.GetOptionString('i', "1").AsUnsigned();
+
+  if (threads == 0)
+    threads = 1;
+
+  cout << "Connection release benchmark, " << CONNECTIONS_PER_CALL
+       << " connections per call blocking " << blockTime << "ms each" << endl;
+
+  bool ok = true;
+  for (PINDEX i = 0; i < counts.GetSize(); ++i) {
+    unsigned callCount = counts[i].AsUnsigned();
+    if (callCount > 0 && !RunReleaseBenchmark(callCount, threads, blockTime))
+      ok = false;
+  }
+
+  return ok;
+}
+
+OPALBENCH_TEST("release", "Connection release with a thread each vs work scheduler",
+               "-s 500,5000 -T 32 -i 1", SchedulerBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
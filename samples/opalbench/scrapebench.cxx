@@ -0,0 +1,245 @@
+/*
+ * scrapebench.cxx
+ *
+ * OPAL application source file for benchmarking bulk statistics export
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include "main.h"
+
+#if OPAL_STATISTICS
+
+#include <rtp/rtp.h>
+#include <rtp/statsreg.h>
+
+
+#define PACKETS_PER_SESSION 50
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static RTP_Session::Params MakeScrapeParams(unsigned id)
+{
+  RTP_Session::Params params;
+  params.id = id;
+  params.encoding = "rtp/avp";
+  params.isAudio = true;
+  return params;
+}
+
+
+/**Creates and destroys sessions in the registry while it is scraped, as
+   calls coming and going would, and records how long each took.
+  */
+class BenchChurnThread : public PThread
+{
+  PCLASSINFO(BenchChurnThread, PThread);
+
+  public:
+    BenchChurnThread(RTP_StatisticsRegistry & registry)
+      : PThread(65536, NoAutoDeleteThread, NormalPriority, "Bench Churn")
+      , m_registry(registry)
+      , m_running(true)
+    {
+      Resume();
+    }
+
+    virtual void Main()
+    {
+      while (m_running) {
+        PInt64 start = PTime().GetTimestamp();
+        RTP_UDP * session = new RTP_UDP(MakeScrapeParams(1));
+        session->SetStatisticsRegistry(&m_registry, "churn");
+        // Removed first, as OpalRTPMediaSession does, the scrapes are running
+        session->SetStatisticsRegistry(NULL, PString::Empty());
+        delete session;
+        m_latency.Add(PTime().GetTimestamp() - start);
+        PThread::Sleep(1);
+      }
+    }
+
+    void Stop()
+    {
+      m_running = false;
+      WaitForTermination();
+    }
+
+    BenchSamples & GetLatency() { return m_latency; }
+
+  protected:
+    RTP_StatisticsRegistry & m_registry;
+    volatile bool            m_running;
+    BenchSamples             m_latency;
+};
+
+
+static void FeedSession(RTP_Session & session, unsigned id)
+{
+  RTP_DataFrame frame(160);
+  frame.SetPayloadType(RTP_DataFrame::PCMU);
+  frame.SetSyncSource(0x10000+id);
+  memset(frame.GetPayloadPtr(), 0xff, frame.GetPayloadSize());
+
+  for (unsigned i = 0; i < PACKETS_PER_SESSION; ++i) {
+    // Some sessions lose a packet now and then
+    if (id%4 == 0 && i%17 == 16)
+      continue;
+    frame.SetSequenceNumber((WORD)i);
+    frame.SetTimestamp(i*160);
+    session.OnReceiveData(frame);
+  }
+}
+
+
+static void ReportScrape(const char * name, const PTimeInterval & elapsed, unsigned rounds, PINDEX bytes)
+{
+  cout << "  " << setw(24) << left << name << right
+       << setw(9) << fixed << setprecision(2) << (double)elapsed.GetMilliSeconds()/rounds << "ms/scrape";
+  if (bytes > 0)
+    cout << setw(10) << bytes << " bytes";
+  cout << endl;
+}
+
+
+static bool RunScrapeBenchmark(unsigned sessionCount, unsigned rounds)
+{
+  cout << sessionCount << " sessions:" << endl;
+
+  RTP_StatisticsRegistry registry;
+
+  std::vector<RTP_UDP *> sessions;
+  for (unsigned i = 0; i < sessionCount; ++i) {
+    RTP_UDP * session = new RTP_UDP(MakeScrapeParams(1));
+    session->SetStatisticsRegistry(&registry, psprintf("bench/%u", i));
+    FeedSession(*session, i);
+    sessions.push_back(session);
+  }
+
+  // The old way, each session's statistics on their own, without even the
+  // walk through the calls, connections, streams and patches to get to them
+  PTimeInterval start = PTimer::Tick();
+  for (unsigned round = 0; round < rounds; ++round) {
+    for (size_t i = 0; i < sessions.size(); ++i) {
+      OpalMediaStatistics tx, rx;
+      sessions[i]->GetStatistics(tx, false);
+      sessions[i]->GetStatistics(rx, true);
+    }
+  }
+  ReportScrape("per session GetStatistics", PTimer::Tick() - start, rounds, 0);
+
+  PBYTEArray binary;
+  start = PTimer::Tick();
+  for (unsigned round = 0; round < rounds; ++round)
+    registry.ExportBinary(binary);
+  ReportScrape("registry binary", PTimer::Tick() - start, rounds, binary.GetSize());
+
+  PString text;
+  start = PTimer::Tick();
+  for (unsigned round = 0; round < rounds; ++round) {
+    PStringStream strm;
+    registry.ExportPrometheus(strm);
+    text = strm;
+  }
+  ReportScrape("registry Prometheus", PTimer::Tick() - start, rounds, text.GetLength());
+
+  // Check the export has every session, and the counts went through
+  const RTP_StatisticsHeader & header = *(const RTP_StatisticsHeader *)(const BYTE *)binary;
+  const RTP_StatisticsRecord * records = (const RTP_StatisticsRecord *)((const BYTE *)binary + sizeof(header));
+  unsigned received = 0;
+  for (DWORD i = 0; i < header.m_count; ++i)
+    received += records[i].m_packetsReceived + records[i].m_packetsLost;
+  bool ok = header.m_magic == RTP_StatisticsHeader::Magic &&
+            header.m_count == sessionCount &&
+            received == sessionCount*PACKETS_PER_SESSION;
+  cout << "  binary export contents: " << (ok ? "match" : "MISMATCH") << endl;
+
+  // Adding again relabels, rather than exporting the session twice
+  if (sessionCount > 0) {
+    registry.Add(*sessions[0], "bench/relabel");
+    if (registry.GetSessionCount() != (PINDEX)sessionCount) {
+      cout << "  session added twice MISMATCH" << endl;
+      ok = false;
+    }
+  }
+
+  // Sessions coming and going while scraping
+  BenchChurnThread churn(registry);
+  start = PTimer::Tick();
+  for (unsigned round = 0; round < rounds; ++round) {
+    PStringStream strm;
+    registry.ExportPrometheus(strm);
+  }
+  PTimeInterval elapsed = PTimer::Tick() - start;
+  churn.Stop();
+  ReportScrape("Prometheus with churn", elapsed, rounds, 0);
+  cout << "  session create/destroy during scrapes: " << churn.GetLatency().GetCount() << " sessions,"
+          " p50=" << churn.GetLatency().GetPercentile(50) << "us"
+          " max=" << churn.GetLatency().GetPercentile(100) << "us" << endl;
+
+  for (size_t i = 0; i < sessions.size(); ++i)
+    delete sessions[i];
+
+  if (registry.GetSessionCount() != 0) {
+    cout << "  registry not empty MISMATCH" << endl;
+    ok = false;
+  }
+
+  return ok;
+}
+
+
+static bool ScrapeBenchmark(PArgList & args)
+{
+  PStringArray counts = args.GetOptionString('s', "1000,10000").Tokenise(",");
+  unsigned rounds = args.GetOptionString('r', "20").AsUnsigned();
+
+  cout << "Statistics scrape benchmark, " << rounds << " scrapes" << endl;
+
+  bool ok = true;
+  for (PINDEX i = 0; i < counts.GetSize(); ++i)
+    ok = RunScrapeBenchmark(counts[i].AsUnsigned(), rounds) && ok;
+  return ok;
+}
+
+
+#else // OPAL_STATISTICS
+
+static bool ScrapeBenchmark(PArgList &)
+{
+  cout << "Statistics not supported in this build." << endl;
+  return true;
+}
+
+#endif // OPAL_STATISTICS
+
+OPALBENCH_TEST("scrape", "Statistics of all sessions, per session vs registry export",
+               "-s 1000,10000 -r 20", ScrapeBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
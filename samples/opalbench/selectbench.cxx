@@ -0,0 +1,253 @@
+/*
+ * selectbench.cxx
+ *
+ * OPAL application source file for benchmarking media format selection
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <opal/transcoders.h>
+
+#include "main.h"
+
+
+#define FORMATS_PER_SIDE 10
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**Stands in for a plug in codec, only the factory registration is used as
+   format selection never creates a transcoder.
+  */
+class BenchTranscoder : public OpalEmptyFramedAudioTranscoder
+{
+  public:
+    BenchTranscoder()
+      : OpalEmptyFramedAudioTranscoder(OpalPCM16, OpalPCM16)
+    { }
+};
+
+
+static OpalMediaFormatList RegisterBenchCodecs(unsigned count)
+{
+  OpalMediaFormatList formats;
+
+  for (unsigned i = 0; i < count; ++i) {
+    // Registered media formats must exist for the life of the process
+    OpalAudioFormat * format = new OpalAudioFormat(psprintf("Bench-Codec-%u", i),
+                                                   RTP_DataFrame::MaxPayloadType,
+                                                   psprintf("+BENCH%u", i),
+                                                   33, 160, 1, 1);
+    new OpalTranscoderFactory::Worker<BenchTranscoder>(MakeOpalTranscoderKey(OpalPCM16, *format));
+    new OpalTranscoderFactory::Worker<BenchTranscoder>(MakeOpalTranscoderKey(*format, OpalPCM16));
+    formats += *format;
+  }
+
+  return formats;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/* The format selection as it was before the transcoder graph, kept here to
+   compare against. */
+
+static bool LegacyMergeFormats(const OpalMediaFormatList & masterFormats,
+                               const OpalMediaFormat & srcCapability,
+                               const OpalMediaFormat & dstCapability,
+                               OpalMediaFormat & srcFormat,
+                               OpalMediaFormat & dstFormat)
+{
+  OpalMediaFormatList::const_iterator masterFormat = masterFormats.FindFormat(srcCapability);
+  if (masterFormat == masterFormats.end())
+    srcFormat = srcCapability;
+  else {
+    srcFormat = *masterFormat;
+    if (!srcFormat.Merge(srcCapability))
+      return false;
+  }
+
+  masterFormat = masterFormats.FindFormat(dstCapability);
+  if (masterFormat == masterFormats.end())
+    dstFormat = dstCapability;
+  else {
+    dstFormat = *masterFormat;
+    if (!dstFormat.Merge(dstCapability))
+      return false;
+  }
+
+  return srcFormat.Merge(dstFormat) && dstFormat.Merge(srcFormat);
+}
+
+
+static bool LegacyFindIntermediateFormat(const OpalMediaFormat & srcFormat,
+                                         const OpalMediaFormat & dstFormat,
+                                         OpalMediaFormat & intermediateFormat)
+{
+  intermediateFormat = OpalMediaFormat();
+
+  OpalTranscoderList availableTranscoders = OpalTranscoderFactory::GetKeyList();
+  for (OpalTranscoderIterator find1 = availableTranscoders.begin(); find1 != availableTranscoders.end(); ++find1) {
+    if (find1->first == srcFormat) {
+      if (find1->second == dstFormat)
+        return true;
+      for (OpalTranscoderIterator find2 = availableTranscoders.begin(); find2 != availableTranscoders.end(); ++find2) {
+        if (find2->first == find1->second && find2->second == dstFormat) {
+          OpalMediaFormat probableFormat = find1->second;
+          if (probableFormat.Merge(srcFormat) && probableFormat.Merge(dstFormat)) {
+            intermediateFormat = probableFormat;
+            return true;
+          }
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+
+static bool LegacySelectFormats(const OpalMediaFormatList & srcFormats,
+                                const OpalMediaFormatList & dstFormats,
+                                const OpalMediaFormatList & allFormats,
+                                OpalMediaFormat & srcFormat,
+                                OpalMediaFormat & dstFormat)
+{
+  OpalMediaFormatList::const_iterator s, d;
+
+  for (d = dstFormats.begin(); d != dstFormats.end(); ++d) {
+    for (s = srcFormats.begin(); s != srcFormats.end(); ++s) {
+      if (*s == *d && LegacyMergeFormats(allFormats, *s, *d, srcFormat, dstFormat))
+        return true;
+    }
+  }
+
+  for (d = dstFormats.begin(); d != dstFormats.end(); ++d) {
+    for (s = srcFormats.begin(); s != srcFormats.end(); ++s) {
+      OpalTranscoderKey search(*s, *d);
+      OpalTranscoderList availableTranscoders = OpalTranscoderFactory::GetKeyList();
+      for (OpalTranscoderIterator i = availableTranscoders.begin(); i != availableTranscoders.end(); ++i) {
+        if (search == *i && LegacyMergeFormats(allFormats, *s, *d, srcFormat, dstFormat))
+          return true;
+      }
+    }
+  }
+
+  for (d = dstFormats.begin(); d != dstFormats.end(); ++d) {
+    for (s = srcFormats.begin(); s != srcFormats.end(); ++s) {
+      OpalMediaFormat intermediateFormat;
+      if (LegacyFindIntermediateFormat(*s, *d, intermediateFormat) && LegacyMergeFormats(allFormats, *s, *d, srcFormat, dstFormat))
+        return true;
+    }
+  }
+
+  return false;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static bool DoSelectFormats(bool legacy,
+                            const OpalMediaFormatList & srcFormats,
+                            const OpalMediaFormatList & dstFormats,
+                            const OpalMediaFormatList & allFormats,
+                            OpalMediaFormat & srcFormat,
+                            OpalMediaFormat & dstFormat)
+{
+  if (legacy)
+    return LegacySelectFormats(srcFormats, dstFormats, allFormats, srcFormat, dstFormat);
+  return OpalTranscoder::SelectFormats(srcFormats, dstFormats, allFormats, srcFormat, dstFormat);
+}
+
+
+static bool RunSelectBenchmark(bool legacy,
+                               const OpalMediaFormatList & srcFormats,
+                               const OpalMediaFormatList & dstFormats,
+                               const OpalMediaFormatList & allFormats,
+                               unsigned rounds)
+{
+  OpalMediaFormat srcFormat, dstFormat;
+
+  // First call includes building the graph and finding paths
+  PTimeInterval start = PTimer::Tick();
+  bool ok = DoSelectFormats(legacy, srcFormats, dstFormats, allFormats, srcFormat, dstFormat);
+  PTimeInterval first = PTimer::Tick() - start;
+
+  if (!ok) {
+    cout << (legacy ? "legacy:" : "graph: ") << " no formats selected!" << endl;
+    return false;
+  }
+
+  start = PTimer::Tick();
+  for (unsigned i = 0; i < rounds; ++i)
+    DoSelectFormats(legacy, srcFormats, dstFormats, allFormats, srcFormat, dstFormat);
+  PInt64 total = (PTimer::Tick() - start).GetMilliSeconds();
+
+  cout << (legacy ? "legacy: " : "graph:  ")
+       << srcFormat << " -> " << dstFormat
+       << " first=" << first.GetMilliSeconds() << "ms"
+       << " mean=" << (double)total*1000/rounds << "us"
+       << endl;
+  return true;
+}
+
+
+static bool SelectFormatsBenchmark(PArgList & args)
+{
+  unsigned codecs = args.GetOptionString('c', "40").AsUnsigned();
+  unsigned rounds = args.GetOptionString('r', "1000").AsUnsigned();
+  if (codecs < FORMATS_PER_SIDE*2)
+    codecs = FORMATS_PER_SIDE*2;
+  if (rounds == 0)
+    rounds = 1;
+
+  OpalMediaFormatList benchFormats = RegisterBenchCodecs(codecs);
+  OpalMediaFormatList allFormats = OpalMediaFormat::GetAllRegisteredMediaFormats();
+
+  cout << "Format selection benchmark, " << allFormats.GetSize() << " registered formats, "
+       << OpalTranscoderFactory::GetKeyList().size() << " transcoders, "
+       << rounds << " rounds" << endl;
+
+  /* As for a gateway, the two sides have no formats in common, so every
+     pair is checked for a direct transcoder before finding one via PCM. */
+  OpalMediaFormatList srcFormats, dstFormats;
+  for (PINDEX i = 0; i < FORMATS_PER_SIDE; ++i) {
+    srcFormats += benchFormats[i];
+    dstFormats += benchFormats[i+FORMATS_PER_SIDE];
+  }
+
+  bool ok = RunSelectBenchmark(true, srcFormats, dstFormats, allFormats, rounds);
+  ok = RunSelectBenchmark(false, srcFormats, dstFormats, allFormats, rounds) && ok;
+  return ok;
+}
+
+OPALBENCH_TEST("select", "Media format selection latency, legacy vs transcoder graph",
+               "-c 40 -r 1000", SelectFormatsBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,405 @@
+/*
+ * silencebench.cxx
+ *
+ * OPAL application source file for benchmarking silence detection
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <codec/silencedetect.h>
+
+#include <math.h>
+
+#include "main.h"
+
+
+// 20ms of 8kHz PCM-16
+#define FRAME_SAMPLES 160
+#define KERNEL_ROUNDS 1000000
+#define AUDIO_FRAMES  64
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**Measures the level sample by sample, as OpalPCM16SilenceDetector did
+   before it used SIMD, for comparison.
+  */
+class LegacySilenceDetector : public OpalSilenceDetector
+{
+    PCLASSINFO(LegacySilenceDetector, OpalSilenceDetector);
+  public:
+    LegacySilenceDetector(const Params & params)
+      : OpalSilenceDetector(params)
+    {
+    }
+
+    virtual unsigned GetAverageSignalLevel(const BYTE * buffer, PINDEX size)
+    {
+      int sum = 0;
+      PINDEX samples = size/2;
+      const short * pcm = (const short *)buffer;
+      const short * end = pcm + samples;
+      while (pcm != end) {
+        if (*pcm < 0)
+          sum -= *pcm++;
+        else
+          sum += *pcm++;
+      }
+
+      return sum/samples;
+    }
+};
+
+
+static unsigned ScalarSignalLevels(const short * pcm, PINDEX count, OpalPCM16SilenceDetector::SignalLevels & levels)
+{
+  PUInt64 sum = 0;
+  PUInt64 sumSquares = 0;
+  unsigned peak = 0;
+  for (PINDEX i = 0; i < count; ++i) {
+    unsigned v = pcm[i] < 0 ? -pcm[i] : pcm[i];
+    sum += v;
+    sumSquares += v*v;
+    if (v > peak)
+      peak = v;
+  }
+
+  levels.m_average = (unsigned)(sum/count);
+  levels.m_rms = (unsigned)sqrt((double)(PInt64)sumSquares/count);
+  levels.m_peak = peak;
+  return levels.m_average;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**Frames of talk and of background noise at a few levels, so the adaptive
+   threshold has something to follow.
+  */
+class BenchAudio
+{
+  public:
+    BenchAudio()
+      : m_samples(AUDIO_FRAMES*2*FRAME_SAMPLES)
+    {
+      unsigned seed = 12345;
+      for (PINDEX frame = 0; frame < AUDIO_FRAMES*2; ++frame) {
+        int amplitude = frame < AUDIO_FRAMES ? 20 + (frame%4)*40 : 2000 + (frame%8)*1000;
+        for (PINDEX i = 0; i < FRAME_SAMPLES; ++i) {
+          seed = seed*1103515245 + 12345;
+          m_samples[frame*FRAME_SAMPLES+i] = (short)((int)((seed >> 8)%(2*amplitude+1)) - amplitude);
+        }
+      }
+    }
+
+    // Streams talk in bursts of different lengths, and out of step
+    const short * GetFrame(unsigned stream, unsigned frame) const
+    {
+      bool talking = ((frame + stream*7)/(25 + stream%50))%2 != 0;
+      PINDEX index = (stream*31 + frame)%AUDIO_FRAMES + (talking ? AUDIO_FRAMES : 0);
+      return &m_samples[index*FRAME_SAMPLES];
+    }
+
+  protected:
+    std::vector<short> m_samples;
+};
+
+
+static bool CheckKernels()
+{
+  std::vector<short> samples(70000);
+  unsigned seed = 1;
+  unsigned mismatches = 0;
+
+  for (unsigned trial = 0; trial < 1000; ++trial) {
+    PINDEX count = trial < 990 ? (PINDEX)(trial%400) + 1 : (PINDEX)samples.size() - trial%7;
+    for (PINDEX i = 0; i < count; ++i) {
+      seed = seed*1103515245 + 12345;
+      switch (trial%3) {
+        case 0 :
+          samples[i] = (short)(seed >> 16);
+          break;
+        case 1 :
+          samples[i] = (i&1) != 0 ? 32767 : -32768;
+          break;
+        default :
+          samples[i] = (short)((int)((seed >> 16)%201) - 100);
+      }
+    }
+
+    OpalPCM16SilenceDetector::SignalLevels expected, levels;
+    ScalarSignalLevels(&samples[0], count, expected);
+    OpalPCM16SilenceDetector::GetSignalLevels(&samples[0], count, levels);
+    if (OpalPCM16SilenceDetector::GetAverageLevel(&samples[0], count) != expected.m_average ||
+        levels.m_average != expected.m_average ||
+        levels.m_rms != expected.m_rms ||
+        levels.m_peak != expected.m_peak)
+      ++mismatches;
+  }
+
+  cout << "  kernels: " << (mismatches == 0 ? "match" : "MISMATCH") << " scalar reference";
+  if (mismatches != 0)
+    cout << ", " << mismatches << " of 1000 blocks differ";
+  cout << endl;
+  return mismatches == 0;
+}
+
+
+static void RunKernelBenchmark(const char * name, unsigned (*kernel)(const short *, PINDEX, OpalPCM16SilenceDetector::SignalLevels &))
+{
+  BenchAudio audio;
+  OpalPCM16SilenceDetector::SignalLevels levels;
+  PUInt64 checksum = 0;
+
+  PTimeInterval start = PTimer::Tick();
+  for (unsigned round = 0; round < KERNEL_ROUNDS; ++round)
+    checksum += kernel(audio.GetFrame(round%50, round), FRAME_SAMPLES, levels);
+  PTimeInterval elapsed = PTimer::Tick() - start;
+
+  cout << "    " << setw(8) << name << ": "
+       << "ns/frame=" << (double)elapsed.GetMilliSeconds()*1000000/KERNEL_ROUNDS
+       << " checksum=" << checksum
+       << endl;
+}
+
+
+static unsigned LegacyAverage(const short * pcm, PINDEX count, OpalPCM16SilenceDetector::SignalLevels &)
+{
+  static LegacySilenceDetector detector(OpalSilenceDetector::Params(OpalSilenceDetector::NoSilenceDetection));
+  return detector.GetAverageSignalLevel((const BYTE *)pcm, count*2);
+}
+
+
+static unsigned Average(const short * pcm, PINDEX count, OpalPCM16SilenceDetector::SignalLevels &)
+{
+  return OpalPCM16SilenceDetector::GetAverageLevel(pcm, count);
+}
+
+
+static unsigned AllLevels(const short * pcm, PINDEX count, OpalPCM16SilenceDetector::SignalLevels & levels)
+{
+  OpalPCM16SilenceDetector::GetSignalLevels(pcm, count, levels);
+  return levels.m_average + levels.m_rms + levels.m_peak;
+}
+
+
+static unsigned ScalarLevels(const short * pcm, PINDEX count, OpalPCM16SilenceDetector::SignalLevels & levels)
+{
+  ScalarSignalLevels(pcm, count, levels);
+  return levels.m_average + levels.m_rms + levels.m_peak;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+enum DetectorMode {
+  LegacyFilter,
+  SIMDFilter,
+  SharedWorker
+};
+
+
+/**Feeds some of the streams through their detectors, as the media patch
+   threads of those calls would.
+  */
+class BenchFeederThread : public PThread
+{
+  PCLASSINFO(BenchFeederThread, PThread);
+
+  public:
+    BenchFeederThread(const BenchAudio & audio,
+                      std::vector<OpalSilenceDetector *> & detectors,
+                      std::vector<RTP_DataFrame *> & packets,
+                      std::vector<PUInt64> & hashes,
+                      unsigned first,
+                      unsigned step,
+                      unsigned frames)
+      : PThread(65536, NoAutoDeleteThread, NormalPriority, "Bench Feeder")
+      , m_audio(audio)
+      , m_detectors(detectors)
+      , m_packets(packets)
+      , m_hashes(hashes)
+      , m_first(first)
+      , m_step(step)
+      , m_frames(frames)
+      , m_talking(0)
+    {
+      Resume();
+    }
+
+    virtual void Main()
+    {
+      for (unsigned frame = 0; frame < m_frames; ++frame) {
+        for (unsigned i = m_first; i < m_detectors.size(); i += m_step) {
+          // Frames are refilled every time, as the detector empties silent ones
+          RTP_DataFrame & packet = *m_packets[i];
+          packet.SetPayloadSize(FRAME_SAMPLES*2);
+          memcpy(packet.GetPayloadPtr(), m_audio.GetFrame(i, frame), FRAME_SAMPLES*2);
+          packet.SetTimestamp(1000 + frame*FRAME_SAMPLES);
+          packet.SetMarker(false);
+
+          m_detectors[i]->GetReceiveHandler()(packet, 0);
+
+          PBoolean inTalkBurst;
+          unsigned threshold;
+          m_detectors[i]->GetStatus(&inTalkBurst, &threshold);
+          unsigned decision = (packet.GetPayloadSize() != 0 ? 1 : 0) | (packet.GetMarker() ? 2 : 0);
+          m_hashes[i] = m_hashes[i]*1099511628211ULL ^ (decision + (threshold << 2));
+          if (inTalkBurst)
+            ++m_talking;
+        }
+      }
+    }
+
+    unsigned GetTalking() const { return m_talking; }
+
+  protected:
+    const BenchAudio                   & m_audio;
+    std::vector<OpalSilenceDetector *> & m_detectors;
+    std::vector<RTP_DataFrame *>       & m_packets;
+    std::vector<PUInt64>               & m_hashes;
+    unsigned                             m_first;
+    unsigned                             m_step;
+    unsigned                             m_frames;
+    unsigned                             m_talking;
+};
+
+
+/**Runs every stream through its detector a frame at a time, and returns a
+   hash of the decisions and thresholds, which must be the same for every
+   mode. The shared worker is fed by a number of threads, each standing in
+   for the patch threads of its share of the streams.
+  */
+static PUInt64 RunDetectorBenchmark(DetectorMode mode, unsigned count, unsigned frames, unsigned threads)
+{
+  static const char * const Names[] = { "legacy", "filter", "worker" };
+
+  BenchAudio audio;
+  OpalSilenceDetector::Params params;
+  OpalSilenceDetectorWorker * worker = mode == SharedWorker ? new OpalSilenceDetectorWorker : NULL;
+
+  std::vector<OpalSilenceDetector *> detectors;
+  std::vector<RTP_DataFrame *> packets;
+  std::vector<PUInt64> hashes(count);
+  for (unsigned i = 0; i < count; ++i) {
+    if (mode == LegacyFilter)
+      detectors.push_back(new LegacySilenceDetector(params));
+    else {
+      OpalPCM16SilenceDetector * detector = new OpalPCM16SilenceDetector(params);
+      detector->SetWorker(worker);
+      detectors.push_back(detector);
+    }
+    packets.push_back(new RTP_DataFrame(FRAME_SAMPLES*2));
+  }
+
+  // The filters run in the one thread, as they always have
+  if (mode != SharedWorker)
+    threads = 1;
+  else if (threads > count)
+    threads = count;
+
+  BenchUsage before;
+
+  std::vector<BenchFeederThread *> feeders;
+  for (unsigned i = 0; i < threads; ++i)
+    feeders.push_back(new BenchFeederThread(audio, detectors, packets, hashes, i, threads, frames));
+
+  PUInt64 talking = 0;
+  for (unsigned i = 0; i < threads; ++i) {
+    feeders[i]->WaitForTermination();
+    talking += feeders[i]->GetTalking();
+    delete feeders[i];
+  }
+
+  BenchUsage after;
+
+  PUInt64 hash = 0;
+  for (unsigned i = 0; i < count; ++i)
+    hash = hash*1099511628211ULL ^ hashes[i];
+
+  // Refilling the frames is included, it is the same for every mode
+  cout << "    " << setw(8) << Names[mode] << ": "
+       << "us/stream/frame=" << (double)(after.m_cpuTime - before.m_cpuTime)/((double)count*frames)
+       << " talking=" << talking*100/((PUInt64)count*frames) << '%'
+       << " switches=" << after.m_contextSwitches - before.m_contextSwitches;
+  if (worker != NULL)
+    cout << " frames/batch=" << (double)(PInt64)worker->GetFrameCount()/(PInt64)PMAX(worker->GetBatchCount(), (PUInt64)1);
+  cout << " decisions=" << hex << hash << dec << endl;
+
+  for (unsigned i = 0; i < count; ++i) {
+    delete detectors[i];
+    delete packets[i];
+  }
+
+  delete worker;
+
+  return hash;
+}
+
+
+static bool SilenceBenchmark(PArgList & args)
+{
+  PStringArray counts = args.GetOptionString('s', "100,2000").Tokenise(",");
+  unsigned frames = args.GetOptionString('r', "500").AsUnsigned();
+  if (frames == 0)
+    frames = 1;
+  unsigned threads = args.GetOptionString('T', "16").AsUnsigned();
+  if (threads == 0)
+    threads = 1;
+
+  cout << "Silence detection benchmark, " << frames << " frames of 20ms per stream" << endl;
+
+  bool ok = CheckKernels();
+  cout << "  signal level of one frame" << endl;
+  RunKernelBenchmark("legacy", LegacyAverage);
+  RunKernelBenchmark("average", Average);
+  RunKernelBenchmark("scalar", ScalarLevels);
+  RunKernelBenchmark("levels", AllLevels);
+
+  for (PINDEX i = 0; i < counts.GetSize(); ++i) {
+    unsigned count = counts[i].AsUnsigned();
+    if (count == 0)
+      continue;
+
+    cout << setw(7) << count << " streams" << endl;
+    PUInt64 legacy = RunDetectorBenchmark(LegacyFilter, count, frames, threads);
+    bool same = RunDetectorBenchmark(SIMDFilter, count, frames, threads) == legacy;
+    same = RunDetectorBenchmark(SharedWorker, count, frames, threads) == legacy && same;
+    cout << "    decisions " << (same ? "match" : "DIFFER FROM") << " legacy detector" << endl;
+    if (!same)
+      ok = false;
+  }
+
+  return ok;
+}
+
+OPALBENCH_TEST("silence", "Silence detection, scalar filter vs SIMD filter and shared worker",
+               "-s 100,2000 -r 500 -T 16", SilenceBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
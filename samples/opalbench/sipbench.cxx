@@ -0,0 +1,284 @@
+/*
+ * sipbench.cxx
+ *
+ * OPAL application source file for benchmarking SIP transaction handling
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <opal/manager.h>
+#include <opal/transports.h>
+#include <sip/sipep.h>
+#include <sip/sippdu.h>
+
+#include "main.h"
+
+
+#define STEP_INTERVAL 10   // Milliseconds between bursts of new transactions
+
+
+#if OPAL_SIP
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**Stands in for a registrar, answering every request with 200 OK as fast
+   as it can.
+  */
+class BenchResponder
+{
+  public:
+    BenchResponder(const PIPSocket::Address & loopback)
+    {
+      m_socket.Listen(loopback, 0, 0);
+      m_socket.SetReadTimeout(500);
+      m_thread = PThread::Create(PCREATE_NOTIFIER(ResponderMain), "Bench Responder");
+    }
+
+    ~BenchResponder()
+    {
+      m_socket.Close();
+      m_thread->WaitForTermination();
+      delete m_thread;
+    }
+
+    WORD GetPort() const { return m_socket.GetPort(); }
+
+  protected:
+    PDECLARE_NOTIFIER(PThread, BenchResponder, ResponderMain);
+
+    PUDPSocket m_socket;
+    PThread  * m_thread;
+};
+
+
+static bool IsEchoedHeader(const PString & line)
+{
+  static const char * const Headers[] = { "via:", "v:", "from:", "f:", "to:", "t:", "call-id:", "i:", "cseq:" };
+
+  PString lower = line.ToLower();
+  for (PINDEX i = 0; i < PARRAYSIZE(Headers); ++i) {
+    if (lower.NumCompare(Headers[i], strlen(Headers[i])) == PObject::EqualTo)
+      return true;
+  }
+  return false;
+}
+
+
+void BenchResponder::ResponderMain(PThread &, INT)
+{
+  char buffer[SIP_PDU::MaxSize];
+  while (m_socket.IsOpen()) {
+    PIPSocket::Address addr;
+    WORD port;
+    if (!m_socket.ReadFrom(buffer, sizeof(buffer)-1, addr, port))
+      continue;
+    buffer[m_socket.GetLastReadCount()] = '\0';
+
+    PStringArray lines = PString(buffer).Lines();
+    PStringStream response;
+    response << "SIP/2.0 200 OK\r\n";
+    for (PINDEX i = 1; i < lines.GetSize(); ++i) {
+      if (IsEchoedHeader(lines[i]))
+        response << lines[i] << "\r\n";
+    }
+    response << "Content-Length: 0\r\n\r\n";
+
+    m_socket.WriteTo((const char *)response, response.GetLength(), addr, port);
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**OPTIONS transaction that records the time to its final response.
+  */
+class BenchOptions : public SIPOptions
+{
+  PCLASSINFO(BenchOptions, SIPOptions);
+
+  public:
+    BenchOptions(SIPEndPoint & ep,
+                 OpalTransport & transport,
+                 const SIPURL & address,
+                 BenchSamples & latency,
+                 PAtomicInteger & completed)
+      : SIPOptions(ep, transport, address)
+      , m_latency(latency)
+      , m_completed(completed)
+      , m_started(PTime().GetTimestamp())
+    {
+    }
+
+    virtual PBoolean OnCompleted(SIP_PDU & response)
+    {
+      m_latency.Add(PTime().GetTimestamp() - m_started);
+      ++m_completed;
+      return SIPOptions::OnCompleted(response);
+    }
+
+  protected:
+    BenchSamples   & m_latency;
+    PAtomicInteger & m_completed;
+    PInt64           m_started;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static bool RunTransactionBenchmark(SIPEndPoint & endpoint,
+                                    OpalTransport & transport,
+                                    const SIPURL & responderURL,
+                                    unsigned rate,
+                                    unsigned count)
+{
+  BenchSamples latency;
+  PAtomicInteger completed;
+  PINDEX peakTransactions = 0;
+
+  BenchUsage before;
+  PTime start;
+
+  unsigned started = 0;
+  unsigned step = 0;
+  while (started < count) {
+    ++step;
+    unsigned target = PMIN(count, (unsigned)((PUInt64)rate*step*STEP_INTERVAL/1000));
+    while (started < target) {
+      SIPTransaction * transaction = new BenchOptions(endpoint, transport, responderURL, latency, completed);
+      if (!transaction->Start()) {
+        PTRACE(2, "Bench\tCould not start transaction");
+      }
+      ++started;
+    }
+
+    PINDEX active = endpoint.GetTransactionCount();
+    if (active > peakTransactions)
+      peakTransactions = active;
+
+    PTimeInterval delay = PTimeInterval(STEP_INTERVAL*step) - (PTime() - start);
+    if (delay > 0)
+      PThread::Sleep(delay);
+  }
+
+  // Wait for the last responses
+  PTime deadline = PTime() + PTimeInterval(0, 10);
+  while ((unsigned)completed < started && PTime() < deadline)
+    PThread::Sleep(10);
+
+  PTimeInterval elapsed = PTime() - start;
+  BenchUsage after;
+
+  // Let the completion timers run out, then time the reaping
+  PThread::Sleep(endpoint.GetPduCleanUpTimeout() + 500);
+  PINDEX beforeReap = endpoint.GetTransactionCount();
+  PTimeInterval reapStart = PTimer::Tick();
+  endpoint.GarbageCollection();
+  PTimeInterval reapTime = PTimer::Tick() - reapStart;
+  PINDEX remaining = endpoint.GetTransactionCount();
+
+  cout << setw(6) << rate << "/s: "
+       << "completed=" << (unsigned)completed << '/' << started
+       << " throughput=" << (unsigned)((unsigned)completed*1000.0/PMAX((PInt64)1, elapsed.GetMilliSeconds())) << "/s"
+       << " p50=" << latency.GetPercentile(50) << "us"
+       << " p99=" << latency.GetPercentile(99) << "us"
+       << " peak-transactions=" << peakTransactions
+       << " reaped=" << (beforeReap - remaining)
+       << " in " << reapTime.GetMilliSeconds() << "ms"
+       << " threads=" << after.m_threads
+       << " context-switches=" << (after.m_contextSwitches - before.m_contextSwitches)
+       << endl;
+
+  // Loopback loss is covered by retransmission, so every transaction must end
+  bool ok = true;
+  if ((unsigned)completed != started) {
+    cout << "  " << (started - (unsigned)completed) << " transactions not completed!" << endl;
+    ok = false;
+  }
+  if (remaining != 0) {
+    cout << "  " << remaining << " transactions not reaped!" << endl;
+    ok = false;
+  }
+  return ok;
+}
+
+#endif // OPAL_SIP
+
+
+static bool TransactionBenchmark(PArgList & args)
+{
+#if OPAL_SIP
+  PStringArray rates = args.GetOptionString('s', "1000,5000").Tokenise(",");
+  unsigned count = args.GetOptionString('r', "50000").AsUnsigned();
+  WORD port = (WORD)args.GetOptionString('p', "20000").AsUnsigned();
+  if (count == 0)
+    count = 1;
+
+  const PIPSocket::Address loopback(127, 0, 0, 1);
+
+  OpalManager manager;
+  SIPEndPoint * endpoint = new SIPEndPoint(manager);
+  endpoint->SetPduCleanUpTimeout(1000);
+  if (!endpoint->StartListeners(psprintf("udp$127.0.0.1:%u", port))) {
+    cout << "Could not listen on UDP port " << port << endl;
+    return false;
+  }
+
+  BenchResponder responder(loopback);
+  SIPURL responderURL(psprintf("sip:bench@127.0.0.1:%u", responder.GetPort()));
+
+  OpalTransport * transport = endpoint->CreateTransport(responderURL);
+  if (transport == NULL) {
+    cout << "Could not create transport to " << responderURL << endl;
+    return false;
+  }
+
+  cout << "SIP transaction benchmark, " << count << " OPTIONS transactions per rate over loopback" << endl;
+
+  bool ok = true;
+  for (PINDEX i = 0; i < rates.GetSize(); ++i) {
+    unsigned rate = rates[i].AsUnsigned();
+    if (rate > 0 && !RunTransactionBenchmark(*endpoint, *transport, responderURL, rate, count))
+      ok = false;
+  }
+
+  // Transactions must all be finished with the transport before it goes
+  manager.ShutDownEndpoints();
+  transport->CloseWait();
+  delete transport;
+  return ok;
+#else
+  cout << "SIP not supported in this build." << endl;
+  return true;
+#endif
+}
+
+OPALBENCH_TEST("sip", "SIP transaction load over loopback UDP",
+               "-s 1000,5000 -r 50000 -p 20000", TransactionBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,425 @@
+/*
+ * sipparsebench.cxx
+ *
+ * OPAL application source file for benchmarking SIP message parsing
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include <sip/sippdu.h>
+
+#include "main.h"
+
+
+#if OPAL_SIP
+
+/////////////////////////////////////////////////////////////////////////////
+
+/* Corpus for checking the parser against the stream based one it replaced.
+   The first three are also the messages timed. Each is mutated at random
+   for the fuzz pass, so the odd cases only need to be near something the
+   mutations can reach. */
+static const char * const Corpus[] = {
+  "INVITE sip:bob@biloxi.example.com SIP/2.0\r\n"
+  "Via: SIP/2.0/UDP pc33.atlanta.example.com:5060;branch=z9hG4bK776asdhds;rport\r\n"
+  "Max-Forwards: 70\r\n"
+  "To: Bob <sip:bob@biloxi.example.com>\r\n"
+  "From: Alice <sip:alice@atlanta.example.com>;tag=1928301774\r\n"
+  "Call-ID: a84b4c76e66710@pc33.atlanta.example.com\r\n"
+  "CSeq: 314159 INVITE\r\n"
+  "Contact: <sip:alice@pc33.atlanta.example.com>\r\n"
+  "Allow: INVITE, ACK, CANCEL, OPTIONS, BYE, REFER, NOTIFY, MESSAGE, SUBSCRIBE, INFO\r\n"
+  "User-Agent: OPAL bench\r\n"
+  "Content-Type: application/sdp\r\n"
+  "Content-Length: 142\r\n"
+  "\r\n"
+  "v=0\r\n"
+  "o=alice 2890844526 2890844526 IN IP4 pc33.atlanta.example.com\r\n"
+  "s=-\r\n"
+  "c=IN IP4 192.0.2.101\r\n"
+  "t=0 0\r\n"
+  "m=audio 49172 RTP/AVP 0\r\n"
+  "a=rtpmap:0 PCMU/8000\r\n",
+
+  "REGISTER sip:registrar.biloxi.example.com SIP/2.0\r\n"
+  "Via: SIP/2.0/UDP bobspc.biloxi.example.com:5060;branch=z9hG4bKnashds7\r\n"
+  "Max-Forwards: 70\r\n"
+  "To: Bob <sip:bob@biloxi.example.com>\r\n"
+  "From: Bob <sip:bob@biloxi.example.com>;tag=456248\r\n"
+  "Call-ID: 843817637684230@998sdasdh09\r\n"
+  "CSeq: 1826 REGISTER\r\n"
+  "Contact: <sip:bob@192.0.2.4>\r\n"
+  "Expires: 7200\r\n"
+  "Content-Length: 0\r\n"
+  "\r\n",
+
+  "SIP/2.0 200 OK\r\n"
+  "Via: SIP/2.0/UDP server10.biloxi.example.com;branch=z9hG4bK4b43c2ff8.1;received=192.0.2.3\r\n"
+  "Via: SIP/2.0/UDP bigbox3.site3.atlanta.example.com;branch=z9hG4bK77ef4c2312983.1;received=192.0.2.2\r\n"
+  "To: Bob <sip:bob@biloxi.example.com>;tag=a6c85cf\r\n"
+  "From: Alice <sip:alice@atlanta.example.com>;tag=1928301774\r\n"
+  "Call-ID: a84b4c76e66710@pc33.atlanta.example.com\r\n"
+  "CSeq: 314159 INVITE\r\n"
+  "Contact: <sip:bob@192.0.2.4>\r\n"
+  "Content-Length: 0\r\n"
+  "\r\n",
+
+  // Compact forms, repeated headers, folding and bare LF line endings
+  "MESSAGE sip:user2@domain.com SIP/2.0\n"
+  "v: SIP/2.0/TCP user1pc.domain.com;branch=z9hG4bK776sgdkse\n"
+  "v: SIP/2.0/TCP proxy.domain.com;branch=z9hG4bK123\n"
+  "f: sip:user1@domain.com;tag=49583\n"
+  "t: sip:user2@domain.com\n"
+  "i: asd88asd77a@1.2.3.4\n"
+  "CSeq: 1 MESSAGE\n"
+  "Subject: a long\n"
+  "   subject line\n"
+  "\tcontinued\n"
+  "c: text/plain\n"
+  "l: 18\n"
+  "\n"
+  "Watson, come here.",
+
+  // No Content-Length, body runs to end of datagram
+  "NOTIFY sip:alice@pc33.atlanta.example.com SIP/2.0\r\n"
+  "Via: SIP/2.0/UDP server.example.com;branch=z9hG4bK1\r\n"
+  "To: <sip:alice@atlanta.example.com>;tag=1\r\n"
+  "From: <sip:server@example.com>;tag=2\r\n"
+  "Call-ID: notify1\r\n"
+  "CSeq: 5 NOTIFY\r\n"
+  "Event: message-summary\r\n"
+  "Content-Type: application/simple-message-summary\r\n"
+  "\r\n"
+  "Messages-Waiting: yes\r\n",
+
+  // Odd spacing, a line without a colon and mismatched lengths
+  "OPTIONS  sip:carol@chicago.example.com SIP/2.0\r\n"
+  "Via :SIP/2.0/UDP pc33.atlanta.example.com;branch=z9hG4bKhjhs8ass877\r\n"
+  "NotAHeader\r\n"
+  " Continued: line\r\n"
+  "To:<sip:carol@chicago.example.com>\r\n"
+  "Call-ID:   spaced  \r\n"
+  "CSeq: 63104 OPTIONS\r\n"
+  "Content-Length: 99999\r\n"
+  "\r\n"
+  "short",
+
+  "SIP/2.0 180\r\n"
+  "Call-ID: x\r\n"
+  "Content-Length: -5\r\n"
+  "\r\n"
+  "abc",
+
+  "SIP/2.0 401 Unauthorized\r\n"
+  "WWW-Authenticate: Digest realm=\"atlanta.example.com\", qop=\"auth\",\r\n"
+  " nonce=\"ea9c8e88df84f1cec4341ae6cbe5a359\", opaque=\"\",\r\n"
+  " stale=FALSE, algorithm=MD5\r\n"
+  "Call-ID: y\r\n"
+  "\r\n",
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**Result of decoding a message, either way.
+  */
+struct ParsedMessage
+{
+  bool               m_valid;
+  PString            m_method;
+  unsigned           m_statusCode;
+  PString            m_uri;
+  unsigned           m_versionMajor;
+  unsigned           m_versionMinor;
+  PString            m_info;
+  SIPMIMEInfo        m_mime;
+  PString            m_body;
+
+  bool operator==(const ParsedMessage & other) const;
+};
+
+
+bool ParsedMessage::operator==(const ParsedMessage & other) const
+{
+  if (m_valid != other.m_valid)
+    return false;
+  if (!m_valid)
+    return true;
+
+  if (m_method != other.m_method ||
+      m_statusCode != other.m_statusCode ||
+      m_uri != other.m_uri ||
+      m_versionMajor != other.m_versionMajor ||
+      m_versionMinor != other.m_versionMinor ||
+      m_info != other.m_info ||
+      m_body != other.m_body ||
+      m_mime.GetSize() != other.m_mime.GetSize())
+    return false;
+
+  for (PINDEX i = 0; i < m_mime.GetSize(); ++i) {
+    const PString * value = other.m_mime.GetAt(m_mime.GetKeyAt(i));
+    if (value == NULL || *value != m_mime.GetDataAt(i))
+      return false;
+  }
+
+  return true;
+}
+
+
+/* This is SIP_PDU::Read() for a datagram as it was before the in place
+   parser, using stream extraction for the lines and MIME headers. */
+static void LegacyDecode(const PString & message, ParsedMessage & result)
+{
+  result.m_valid = false;
+
+  PStringStream datagram(message);
+
+  PString cmd;
+  datagram >> cmd;
+  if (!datagram.good() || cmd.IsEmpty())
+    return;
+
+  result.m_method.MakeEmpty();
+  result.m_statusCode = 0;
+  result.m_uri.MakeEmpty();
+  result.m_info.MakeEmpty();
+
+  if (cmd.Left(4) *= "SIP/") {
+    PINDEX space = cmd.Find(' ');
+    if (space == P_MAX_INDEX)
+      return;
+
+    result.m_versionMajor = cmd.Mid(4).AsUnsigned();
+    result.m_versionMinor = cmd(cmd.Find('.')+1, space).AsUnsigned();
+    result.m_statusCode = cmd.Mid(++space).AsUnsigned();
+    result.m_info = cmd.Mid(cmd.Find(' ', space));
+  }
+  else {
+    PStringArray cmds = cmd.Tokenise(' ', PFalse);
+    if (cmds.GetSize() < 3)
+      return;
+
+    PINDEX i = 0;
+    while (!(cmds[0] *= SIP_PDU::GetMethodName((SIP_PDU::Methods)i))) {
+      if (++i >= SIP_PDU::NumMethods)
+        return;
+    }
+    result.m_method = SIP_PDU::GetMethodName((SIP_PDU::Methods)i);
+    result.m_uri = SIPURL(cmds[1]).AsString();
+
+    result.m_versionMajor = cmds[2].Mid(4).AsUnsigned();
+    result.m_versionMinor = cmds[2].Mid(cmds[2].Find('.')+1).AsUnsigned();
+  }
+
+  if (result.m_versionMajor < 2)
+    return;
+
+  datagram >> result.m_mime;
+  if (!datagram.good() || result.m_mime.IsEmpty())
+    return;
+
+  PINDEX contentLength = result.m_mime.GetContentLength();
+  bool contentLengthPresent = result.m_mime.IsContentLengthPresent();
+  if (contentLength < 0 || contentLength > message.GetLength())
+    contentLengthPresent = false;
+
+  result.m_body.MakeEmpty();
+  if (contentLengthPresent) {
+    if (contentLength > 0)
+      datagram.read(result.m_body.GetPointer(contentLength+1), contentLength);
+  }
+  else {
+    contentLength = 0;
+    int c;
+    while ((c = datagram.get()) != EOF) {
+      result.m_body += (char)c;
+      ++contentLength;
+    }
+  }
+  result.m_body[contentLength] = '\0';
+  result.m_body.MakeMinimumSize();
+
+  result.m_valid = true;
+}
+
+
+static void NewDecode(const PString & message, ParsedMessage & result)
+{
+  SIP_PDU pdu;
+  result.m_valid = pdu.Decode(message, message.GetLength());
+  if (!result.m_valid)
+    return;
+
+  if (pdu.GetMethod() != SIP_PDU::NumMethods) {
+    result.m_method = SIP_PDU::GetMethodName(pdu.GetMethod());
+    result.m_statusCode = 0;
+    result.m_uri = pdu.GetURI().AsString();
+  }
+  else {
+    result.m_method.MakeEmpty();
+    result.m_statusCode = pdu.GetStatusCode();
+    result.m_uri.MakeEmpty();
+  }
+
+  result.m_versionMajor = pdu.GetVersionMajor();
+  result.m_versionMinor = pdu.GetVersionMinor();
+  result.m_info = pdu.GetInfo();
+  result.m_mime = pdu.GetMIME();
+  result.m_body = pdu.GetEntityBody();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static PString Mutate(const PString & message, PRandom & random)
+{
+  static const char Alphabet[] = "\r\n\t :;,a";
+
+  PString mutated = message;
+  mutated.MakeUnique();
+
+  unsigned count = random.Generate()%4 + 1;
+  for (unsigned i = 0; i < count; ++i) {
+    PINDEX length = mutated.GetLength();
+    PINDEX pos = length > 0 ? random.Generate()%length : 0;
+    char c = Alphabet[random.Generate()%(sizeof(Alphabet)-1)];
+    switch (random.Generate()%3) {
+      case 0 :
+        if (length > 0)
+          mutated.Delete(pos, 1);
+        break;
+      case 1 :
+        mutated.Splice(PString(c), pos, 0);
+        break;
+      default :
+        if (length > 0)
+          mutated[pos] = c;
+    }
+  }
+
+  return mutated;
+}
+
+
+static bool CheckEquivalence(unsigned rounds)
+{
+  unsigned checked = 0;
+  unsigned valid = 0;
+  unsigned mismatches = 0;
+
+  PRandom random(1);
+
+  for (PINDEX i = 0; i < PARRAYSIZE(Corpus); ++i) {
+    PString original = Corpus[i];
+    for (unsigned round = 0; round <= rounds; ++round) {
+      // First round is the unmodified message
+      PString message = round == 0 ? original : Mutate(original, random);
+
+      ParsedMessage legacy, parsed;
+      LegacyDecode(message, legacy);
+      NewDecode(message, parsed);
+
+      ++checked;
+      if (legacy.m_valid)
+        ++valid;
+
+      if (!(legacy == parsed)) {
+        if (++mismatches <= 5)
+          cout << "Mismatch (" << (legacy.m_valid ? "valid" : "invalid") << " by legacy parser):\n"
+               << message << "\n----" << endl;
+      }
+    }
+  }
+
+  cout << "Equivalence: " << checked << " messages, " << valid << " valid, "
+       << mismatches << " mismatches" << endl;
+  return mismatches == 0;
+}
+
+
+static void RunParseBenchmark(const char * name, const PString & message, unsigned count)
+{
+  ParsedMessage result;
+  PTimeInterval start = PTimer::Tick();
+  for (unsigned i = 0; i < count; ++i)
+    LegacyDecode(message, result);
+  PTimeInterval legacyTime = PTimer::Tick() - start;
+
+  // Only the SIP_PDU is timed, as is all HandlePDU() creates
+  start = PTimer::Tick();
+  for (unsigned i = 0; i < count; ++i) {
+    SIP_PDU pdu;
+    pdu.Decode(message, message.GetLength());
+  }
+  PTimeInterval parsedTime = PTimer::Tick() - start;
+
+  start = PTimer::Tick();
+  for (unsigned i = 0; i < count; ++i) {
+    SIP_PDU pdu;
+    pdu.Decode(message, message.GetLength());
+    pdu.GetURI();
+  }
+  PTimeInterval parsedURITime = PTimer::Tick() - start;
+
+  cout << setw(9) << name << ": "
+       << "legacy=" << (unsigned)(count*1000.0/PMAX((PInt64)1, legacyTime.GetMilliSeconds())) << "/s"
+       << " in-place=" << (unsigned)(count*1000.0/PMAX((PInt64)1, parsedTime.GetMilliSeconds())) << "/s"
+       << " in-place+uri=" << (unsigned)(count*1000.0/PMAX((PInt64)1, parsedURITime.GetMilliSeconds())) << "/s"
+       << endl;
+}
+
+#endif // OPAL_SIP
+
+
+static bool ParseBenchmark(PArgList & args)
+{
+#if OPAL_SIP
+  unsigned count = args.GetOptionString('r', "100000").AsUnsigned();
+  if (count == 0)
+    count = 1;
+
+  cout << "SIP parse benchmark, " << count << " messages each" << endl;
+
+  bool ok = CheckEquivalence(count/100);
+
+  RunParseBenchmark("INVITE", Corpus[0], count);
+  RunParseBenchmark("REGISTER", Corpus[1], count);
+  RunParseBenchmark("200 OK", Corpus[2], count);
+
+  return ok;
+#else
+  cout << "SIP not supported in this build." << endl;
+  return true;
+#endif
+}
+
+OPALBENCH_TEST("sipparse", "SIP message parsing equivalence and throughput",
+               "-r 100000", ParseBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
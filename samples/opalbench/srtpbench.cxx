@@ -0,0 +1,711 @@
+/*
+ * srtpbench.cxx
+ *
+ * OPAL application source file for benchmarking SRTP protection
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <opal/buildopts.h>
+
+#include "main.h"
+
+#if OPAL_PTLIB_SSL
+
+#include <rtp/srtpcrypto.h>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#if OPAL_SRTP
+extern "C" {
+#include "srtp/srtp.h"
+};
+#endif
+
+
+#define CHUNK_PACKETS 1024
+#define PACKET_ROOM   64
+#define BENCH_SSRC    0x12345678
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static PBYTEArray FromHex(const char * hex)
+{
+  PBYTEArray data(strlen(hex)/2);
+  for (PINDEX i = 0; i < data.GetSize(); ++i) {
+    unsigned value;
+    sscanf(hex+i*2, "%2x", &value);
+    data[i] = (BYTE)value;
+  }
+  return data;
+}
+
+
+static bool CheckBytes(const char * name, const BYTE * data, const char * expectedHex)
+{
+  PBYTEArray expected = FromHex(expectedHex);
+  bool ok = memcmp(data, expected, expected.GetSize()) == 0;
+  cout << "  " << name << ": " << (ok ? "match" : "MISMATCH") << endl;
+  return ok;
+}
+
+
+/**Packets with room for a trailer, filled with a header and a payload that
+   can be checked after a round trip.
+  */
+class BenchPackets
+{
+  public:
+    BenchPackets(PINDEX count, PINDEX payloadSize)
+      : m_payloadSize(payloadSize)
+      , m_stride(RTP_DataFrame::MinHeaderSize + payloadSize + PACKET_ROOM)
+      , m_buffer(count*m_stride)
+      , m_packets(count)
+    {
+      for (PINDEX i = 0; i < count; ++i)
+        m_packets[i].m_data = &m_buffer[i*m_stride];
+    }
+
+    void Fill(PINDEX count, WORD firstSeq)
+    {
+      for (PINDEX i = 0; i < count; ++i) {
+        BYTE * data = m_packets[i].m_data;
+        WORD seq = (WORD)(firstSeq + i);
+        data[0] = 0x80;
+        data[1] = 0x00;
+        data[2] = (BYTE)(seq >> 8);
+        data[3] = (BYTE)seq;
+        memset(data+4, 0, 4);
+        data[8] = (BYTE)(BENCH_SSRC >> 24);
+        data[9] = (BYTE)(BENCH_SSRC >> 16);
+        data[10] = (BYTE)(BENCH_SSRC >> 8);
+        data[11] = (BYTE)BENCH_SSRC;
+        for (PINDEX j = 0; j < m_payloadSize; ++j)
+          data[RTP_DataFrame::MinHeaderSize+j] = (BYTE)(seq + j);
+        m_packets[i].m_length = RTP_DataFrame::MinHeaderSize + m_payloadSize;
+        m_packets[i].m_ok = false;
+      }
+    }
+
+    PINDEX CountIntact(PINDEX count) const
+    {
+      PINDEX intact = 0;
+      for (PINDEX i = 0; i < count; ++i) {
+        const BYTE * data = m_packets[i].m_data;
+        WORD seq = (WORD)((data[2] << 8) | data[3]);
+        bool ok = m_packets[i].m_length == RTP_DataFrame::MinHeaderSize + m_payloadSize;
+        for (PINDEX j = 0; ok && j < m_payloadSize; ++j)
+          ok = data[RTP_DataFrame::MinHeaderSize+j] == (BYTE)(seq + j);
+        if (ok)
+          ++intact;
+      }
+      return intact;
+    }
+
+    OpalSRTPContext::Packet * GetPackets() { return &m_packets[0]; }
+
+  protected:
+    PINDEX m_payloadSize;
+    PINDEX m_stride;
+    std::vector<BYTE> m_buffer;
+    std::vector<OpalSRTPContext::Packet> m_packets;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/**A way of protecting packets, with a sender and a receiver keyed alike.
+  */
+class BenchCipher
+{
+  public:
+    virtual ~BenchCipher() { }
+    virtual bool Protect(OpalSRTPContext::Packet * packets, PINDEX count) = 0;
+    virtual bool Unprotect(OpalSRTPContext::Packet * packets, PINDEX count) = 0;
+};
+
+
+class NativeCipher : public BenchCipher
+{
+  public:
+    NativeCipher(const OpalSRTPCryptoSuite & suite, const BYTE * key, bool batch)
+      : m_sender(suite)
+      , m_receiver(suite)
+      , m_batch(batch)
+    {
+      m_sender.SetMasterKey(key, key+suite.m_keyLength);
+      m_receiver.SetMasterKey(key, key+suite.m_keyLength);
+    }
+
+    virtual bool Protect(OpalSRTPContext::Packet * packets, PINDEX count)
+    {
+      if (m_batch)
+        return m_sender.ProtectRTP(packets, count) == count;
+
+      bool ok = true;
+      for (PINDEX i = 0; i < count; ++i)
+        ok = m_sender.ProtectRTP(packets[i].m_data, packets[i].m_length) && ok;
+      return ok;
+    }
+
+    virtual bool Unprotect(OpalSRTPContext::Packet * packets, PINDEX count)
+    {
+      if (m_batch)
+        return m_receiver.UnprotectRTP(packets, count) == count;
+
+      bool ok = true;
+      for (PINDEX i = 0; i < count; ++i)
+        ok = m_receiver.UnprotectRTP(packets[i].m_data, packets[i].m_length) && ok;
+      return ok;
+    }
+
+    OpalSRTPContext m_sender;
+    OpalSRTPContext m_receiver;
+    bool            m_batch;
+};
+
+
+/**The obvious way to use OpenSSL for SRTP, for comparison: the cipher is
+   set up with the session key for every packet, and each HMAC is computed
+   from the key. The rollover counter is kept, but there is no replay check.
+  */
+class NaiveCipher : public BenchCipher
+{
+  public:
+    NaiveCipher(const OpalSRTPCryptoSuite & suite, const BYTE * key)
+      : m_suite(suite)
+      , m_cipher(EVP_CIPHER_CTX_new())
+      , m_sendROC(0)
+      , m_sendSeq(0)
+      , m_receiveROC(0)
+      , m_receiveSeq(0)
+    {
+      memset(m_salt, 0, sizeof(m_salt));
+      OpalSRTPContext::DeriveSessionKey(suite, key, key+suite.m_keyLength, 0, m_key, suite.m_keyLength);
+      OpalSRTPContext::DeriveSessionKey(suite, key, key+suite.m_keyLength, 2, m_salt, suite.m_saltLength);
+      if (suite.m_authKeyLength > 0)
+        OpalSRTPContext::DeriveSessionKey(suite, key, key+suite.m_keyLength, 1, m_authKey, suite.m_authKeyLength);
+    }
+
+    ~NaiveCipher()
+    {
+      EVP_CIPHER_CTX_free(m_cipher);
+    }
+
+    virtual bool Protect(OpalSRTPContext::Packet * packets, PINDEX count)
+    {
+      bool ok = true;
+      for (PINDEX i = 0; i < count; ++i) {
+        OpalSRTPContext::Packet & packet = packets[i];
+        WORD seq = (WORD)((packet.m_data[2] << 8) | packet.m_data[3]);
+        if (seq < m_sendSeq && m_sendSeq - seq > 0x8000)
+          ++m_sendROC;
+        m_sendSeq = seq;
+        ok = Crypt(packet, m_sendROC, true) && ok;
+      }
+      return ok;
+    }
+
+    virtual bool Unprotect(OpalSRTPContext::Packet * packets, PINDEX count)
+    {
+      bool ok = true;
+      for (PINDEX i = 0; i < count; ++i) {
+        OpalSRTPContext::Packet & packet = packets[i];
+        WORD seq = (WORD)((packet.m_data[2] << 8) | packet.m_data[3]);
+        if (seq < m_receiveSeq && m_receiveSeq - seq > 0x8000)
+          ++m_receiveROC;
+        m_receiveSeq = seq;
+        ok = Crypt(packet, m_receiveROC, false) && ok;
+      }
+      return ok;
+    }
+
+  protected:
+    bool Crypt(OpalSRTPContext::Packet & packet, DWORD roc, bool encrypt)
+    {
+      BYTE * data = packet.m_data;
+      PINDEX header = RTP_DataFrame::MinHeaderSize;
+      PINDEX tagLength = m_suite.m_rtpTagLength;
+      PINDEX length = encrypt ? packet.m_length : packet.m_length - tagLength;
+      int outLength;
+
+      BYTE iv[16];
+      memset(iv, 0, sizeof(iv));
+      if (m_suite.m_cipher == OpalSRTPCryptoSuite::e_AES_GCM) {
+        memcpy(iv+2, data+8, 4);
+        iv[6] = (BYTE)(roc >> 24);
+        iv[7] = (BYTE)(roc >> 16);
+        iv[8] = (BYTE)(roc >> 8);
+        iv[9] = (BYTE)roc;
+        memcpy(iv+10, data+2, 2);
+        for (PINDEX i = 0; i < 12; ++i)
+          iv[i] ^= m_salt[i];
+
+        const EVP_CIPHER * cipher = m_suite.m_keyLength == 32 ? EVP_aes_256_gcm() : EVP_aes_128_gcm();
+        if (EVP_CipherInit_ex(m_cipher, cipher, NULL, m_key, iv, encrypt ? 1 : 0) <= 0 ||
+            EVP_CipherUpdate(m_cipher, NULL, &outLength, data, header) <= 0 ||
+            EVP_CipherUpdate(m_cipher, data+header, &outLength, data+header, length-header) <= 0)
+          return false;
+        if (encrypt) {
+          if (EVP_CipherFinal_ex(m_cipher, data+length, &outLength) <= 0 ||
+              EVP_CIPHER_CTX_ctrl(m_cipher, EVP_CTRL_GCM_GET_TAG, tagLength, data+length) <= 0)
+            return false;
+          packet.m_length = length + tagLength;
+          return true;
+        }
+        if (EVP_CIPHER_CTX_ctrl(m_cipher, EVP_CTRL_GCM_SET_TAG, tagLength, data+length) <= 0 ||
+            EVP_CipherFinal_ex(m_cipher, data+length, &outLength) <= 0)
+          return false;
+        packet.m_length = length;
+        return true;
+      }
+
+      BYTE tag[EVP_MAX_MD_SIZE];
+      unsigned tagSize;
+      if (!encrypt && tagLength > 0) {
+        // The rollover counter goes where the tag was, the tag is saved
+        BYTE received[EVP_MAX_MD_SIZE];
+        memcpy(received, data+length, tagLength);
+        data[length] = (BYTE)(roc >> 24);
+        data[length+1] = (BYTE)(roc >> 16);
+        data[length+2] = (BYTE)(roc >> 8);
+        data[length+3] = (BYTE)roc;
+        HMAC(EVP_sha1(), m_authKey, m_suite.m_authKeyLength, data, length+4, tag, &tagSize);
+        if (memcmp(tag, received, tagLength) != 0)
+          return false;
+      }
+
+      if (m_suite.m_cipher == OpalSRTPCryptoSuite::e_AES_CM) {
+        memcpy(iv, m_salt, 14);
+        for (PINDEX i = 0; i < 4; ++i)
+          iv[4+i] ^= data[8+i];
+        iv[8]  ^= (BYTE)(roc >> 24);
+        iv[9]  ^= (BYTE)(roc >> 16);
+        iv[10] ^= (BYTE)(roc >> 8);
+        iv[11] ^= (BYTE)roc;
+        iv[12] ^= data[2];
+        iv[13] ^= data[3];
+        if (EVP_EncryptInit_ex(m_cipher, EVP_aes_128_ctr(), NULL, m_key, iv) <= 0 ||
+            EVP_EncryptUpdate(m_cipher, data+header, &outLength, data+header, length-header) <= 0)
+          return false;
+      }
+
+      if (encrypt && tagLength > 0) {
+        data[length] = (BYTE)(roc >> 24);
+        data[length+1] = (BYTE)(roc >> 16);
+        data[length+2] = (BYTE)(roc >> 8);
+        data[length+3] = (BYTE)roc;
+        HMAC(EVP_sha1(), m_authKey, m_suite.m_authKeyLength, data, length+4, tag, &tagSize);
+        memcpy(data+length, tag, tagLength);
+      }
+
+      packet.m_length = encrypt ? length + tagLength : length;
+      return true;
+    }
+
+    const OpalSRTPCryptoSuite & m_suite;
+    EVP_CIPHER_CTX * m_cipher;
+    BYTE  m_key[32];
+    BYTE  m_salt[14];
+    BYTE  m_authKey[20];
+    DWORD m_sendROC;
+    WORD  m_sendSeq;
+    DWORD m_receiveROC;
+    WORD  m_receiveSeq;
+};
+
+
+#if OPAL_SRTP
+
+/**Cisco libSRTP, as used by LibSRTP_UDP.
+  */
+class LibSRTPCipher : public BenchCipher
+{
+  public:
+    LibSRTPCipher(const OpalSRTPCryptoSuite & suite, const BYTE * key)
+      : m_sender(NULL)
+      , m_receiver(NULL)
+    {
+      static bool initialised = false;
+      if (!initialised) {
+        srtp_init();
+        initialised = true;
+      }
+
+      memcpy(m_key, key, sizeof(m_key));
+
+      srtp_policy_t policy;
+      memset(&policy, 0, sizeof(policy));
+      if (suite.m_rtpTagLength == 4)
+        crypto_policy_set_aes_cm_128_hmac_sha1_32(&policy.rtp);
+      else
+        crypto_policy_set_aes_cm_128_hmac_sha1_80(&policy.rtp);
+      crypto_policy_set_aes_cm_128_hmac_sha1_80(&policy.rtcp);
+      policy.key = m_key;
+      policy.window_size = 128;
+
+      policy.ssrc.type = ssrc_any_outbound;
+      srtp_create(&m_sender, &policy);
+      policy.ssrc.type = ssrc_any_inbound;
+      srtp_create(&m_receiver, &policy);
+    }
+
+    ~LibSRTPCipher()
+    {
+      if (m_sender != NULL)
+        srtp_dealloc(m_sender);
+      if (m_receiver != NULL)
+        srtp_dealloc(m_receiver);
+    }
+
+    virtual bool Protect(OpalSRTPContext::Packet * packets, PINDEX count)
+    {
+      bool ok = true;
+      for (PINDEX i = 0; i < count; ++i) {
+        int length = packets[i].m_length;
+        ok = srtp_protect(m_sender, packets[i].m_data, &length) == err_status_ok && ok;
+        packets[i].m_length = length;
+      }
+      return ok;
+    }
+
+    virtual bool Unprotect(OpalSRTPContext::Packet * packets, PINDEX count)
+    {
+      bool ok = true;
+      for (PINDEX i = 0; i < count; ++i) {
+        int length = packets[i].m_length;
+        ok = srtp_unprotect(m_receiver, packets[i].m_data, &length) == err_status_ok && ok;
+        packets[i].m_length = length;
+      }
+      return ok;
+    }
+
+  protected:
+    BYTE   m_key[30];
+    srtp_t m_sender;
+    srtp_t m_receiver;
+};
+
+#endif // OPAL_SRTP
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static bool CheckVectors()
+{
+  bool ok = true;
+  BYTE output[64];
+  const OpalSRTPCryptoSuite & cm80 = *OpalSRTPCryptoSuite::Find("AES_CM_128_HMAC_SHA1_80");
+
+  // RFC 3711 appendix B.2, the PRF is AES-CM with the label in the salt, zero here
+  PBYTEArray key = FromHex("2B7E151628AED2A6ABF7158809CF4F3C");
+  PBYTEArray salt = FromHex("F0F1F2F3F4F5F6F7F8F9FAFBFCFD");
+  OpalSRTPContext::DeriveSessionKey(cm80, key, salt, 0, output, 48);
+  ok = CheckBytes("RFC 3711 B.2 AES-CM keystream", output,
+                  "E03EAD0935C95E80E166B16DD92B4EB4"
+                  "D23513162B02D0F72A43A2FE4A5F97AB"
+                  "41E95B3BB0A2E8DD477901E4FCA894C0") && ok;
+
+  // RFC 3711 appendix B.3
+  PBYTEArray masterKey = FromHex("E1F97A0D3E018BE0D64FA32C06DE4139");
+  PBYTEArray masterSalt = FromHex("0EC675AD498AFEEBB6960B3AABE6");
+  OpalSRTPContext::DeriveSessionKey(cm80, masterKey, masterSalt, 0, output, 16);
+  ok = CheckBytes("RFC 3711 B.3 cipher key", output, "C61E7A93744F39EE10734AFE3FF7A087") && ok;
+  OpalSRTPContext::DeriveSessionKey(cm80, masterKey, masterSalt, 2, output, 14);
+  ok = CheckBytes("RFC 3711 B.3 cipher salt", output, "30CBBC08863D8C85D49DB34A9AE1") && ok;
+  OpalSRTPContext::DeriveSessionKey(cm80, masterKey, masterSalt, 1, output, 20);
+  ok = CheckBytes("RFC 3711 B.3 auth key", output, "CEBE321F6FF7716B6FD4AB49AF256A156D38BAA4") && ok;
+
+  // The packet from the libSRTP test driver, with the B.3 master key
+  BYTE packet[64];
+  PBYTEArray plain = FromHex("800F1234DECAFBADCAFEBABEABABABABABABABABABABABABABABABAB");
+  memcpy(packet, plain, plain.GetSize());
+  PINDEX length = plain.GetSize();
+
+  OpalSRTPContext sender(cm80), receiver(cm80);
+  sender.SetMasterKey(masterKey, masterSalt);
+  receiver.SetMasterKey(masterKey, masterSalt);
+  bool protectedOK = sender.ProtectRTP(packet, length) && length == plain.GetSize() + 10;
+  ok = CheckBytes("libSRTP driver packet", packet,
+                  "800F1234DECAFBADCAFEBABE4E55DC4CE79978D88CA4D215949D2402B78D6ACC99EA179B8DBB") && protectedOK && ok;
+
+  BYTE copy[64];
+  memcpy(copy, packet, length);
+  PINDEX copyLength = length;
+  bool unprotected = receiver.UnprotectRTP(packet, length) && length == plain.GetSize() && memcmp(packet, plain, length) == 0;
+  bool replayed = !receiver.UnprotectRTP(copy, copyLength);
+  cout << "  libSRTP driver packet unprotect: " << (unprotected ? "match" : "MISMATCH")
+       << ", replay " << (replayed ? "rejected" : "ACCEPTED") << endl;
+  ok = unprotected && replayed && ok;
+
+  return ok;
+}
+
+
+/**Each suite must interwork with the naive implementation both ways, and
+   reject a damaged packet, a replay and one older than the window, for SRTP
+   and SRTCP.
+  */
+static bool CheckSuite(const OpalSRTPCryptoSuite & suite)
+{
+  BYTE key[64];
+  for (PINDEX i = 0; i < (PINDEX)sizeof(key); ++i)
+    key[i] = (BYTE)(i*7 + 3);
+
+  NativeCipher native(suite, key, true);
+  NaiveCipher naiveSender(suite, key), naiveReceiver(suite, key);
+
+  BenchPackets packets(300, 160);
+  bool ok = true;
+
+  // Native to naive, across a sequence number wrap
+  packets.Fill(300, 65400);
+  ok = native.Protect(packets.GetPackets(), 300) && ok;
+  ok = naiveReceiver.Unprotect(packets.GetPackets(), 300) && packets.CountIntact(300) == 300 && ok;
+
+  // Naive to native
+  packets.Fill(300, 65400);
+  ok = naiveSender.Protect(packets.GetPackets(), 300) && ok;
+  ok = native.Unprotect(packets.GetPackets(), 300) && packets.CountIntact(300) == 300 && ok;
+
+  OpalSRTPContext::Statistics before = native.m_receiver.GetStatistics();
+
+  // Damaged, then replayed, then too old, only the first of the next is good
+  OpalSRTPContext::Packet * packet = packets.GetPackets();
+  packets.Fill(4, 200);
+  native.Protect(packet, 4);
+  bool rejected = true;
+  if (suite.m_rtpTagLength > 0) {
+    packet[0].m_data[20] ^= 1;
+    rejected = native.Unprotect(packet, 1) == false;
+  }
+  rejected = native.Unprotect(packet+1, 1) && rejected;
+  BYTE copy[256];
+  memcpy(copy, packet[2].m_data, packet[2].m_length);
+  PINDEX copyLength = packet[2].m_length;
+  rejected = native.Unprotect(packet+2, 1) && rejected;
+  OpalSRTPContext::Packet replay = { copy, copyLength, false };
+  rejected = !native.Unprotect(&replay, 1) && rejected;
+  packets.Fill(4, 200 - OpalSRTPContext::ReplayWindowSize - 1);
+  naiveSender.Protect(packet, 4);
+  rejected = !native.Unprotect(packet, 1) && rejected;
+
+  OpalSRTPContext::Statistics after = native.m_receiver.GetStatistics();
+
+  // SRTCP, a receiver report and a damaged copy
+  BYTE rtcp[128];
+  static const BYTE report[] = { 0x81, 0xc9, 0x00, 0x07, 0x12, 0x34, 0x56, 0x78,
+                                 0x9a, 0xbc, 0xde, 0xf0, 0x00, 0x00, 0x00, 0x05,
+                                 0x00, 0x00, 0x12, 0x34, 0x00, 0x00, 0x00, 0x10,
+                                 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+  memcpy(rtcp, report, sizeof(report));
+  PINDEX rtcpLength = sizeof(report);
+  bool rtcpOK = native.m_sender.ProtectRTCP(rtcp, rtcpLength) &&
+                rtcpLength == (PINDEX)sizeof(report) + native.m_sender.GetRTCPTrailerSize();
+  // Without a tag the damage goes unnoticed and would take the index
+  bool rtcpRejected = true;
+  if (suite.m_rtcpTagLength > 0) {
+    memcpy(copy, rtcp, rtcpLength);
+    copyLength = rtcpLength;
+    copy[12] ^= 0x80;
+    rtcpRejected = !native.m_receiver.UnprotectRTCP(copy, copyLength);
+  }
+  memcpy(copy, rtcp, rtcpLength);
+  copyLength = rtcpLength;
+  rtcpOK = native.m_receiver.UnprotectRTCP(rtcp, rtcpLength) && rtcpLength == (PINDEX)sizeof(report) &&
+           memcmp(rtcp, report, sizeof(report)) == 0 && rtcpOK;
+  rtcpRejected = !native.m_receiver.UnprotectRTCP(copy, copyLength) && rtcpRejected;
+
+  cout << "    " << setw(24) << suite.m_name << ": "
+       << "interwork " << (ok ? "match" : "MISMATCH")
+       << ", damage/replay/old " << (rejected ? "rejected" : "ACCEPTED")
+       << " (auth=" << after.m_authFailures - before.m_authFailures
+       << " replay=" << after.m_replays - before.m_replays << ')'
+       << ", SRTCP " << (rtcpOK ? "match" : "MISMATCH")
+       << '/' << (rtcpRejected ? "rejected" : "ACCEPTED")
+       << endl;
+
+  return ok && rejected && rtcpOK && rtcpRejected;
+}
+
+
+#if OPAL_RTP_AGGREGATE
+
+/**Frames the reactor reads for relaying are protected in place, the tag
+   must fit in the room left after the largest packet read.
+  */
+static bool CheckRelayFrames(const OpalSRTPCryptoSuite & suite)
+{
+  BYTE key[64];
+  for (PINDEX i = 0; i < (PINDEX)sizeof(key); ++i)
+    key[i] = (BYTE)(i*5 + 11);
+
+  OpalSRTPContext sender(suite);
+  sender.SetMasterKey(key, key+suite.m_keyLength);
+
+  RTP_DataFramePool pool;
+  RTP_DataFrame * frames[4];
+  const BYTE * buffers[PARRAYSIZE(frames)];
+  for (PINDEX i = 0; i < PARRAYSIZE(frames); ++i) {
+    frames[i] = pool.GetFrame(0, RTP_UDP::RelayFrameSize+RTP_UDP::RelayTrailerSize);
+    frames[i]->SetPayloadSize(RTP_UDP::RelayFrameSize - frames[i]->GetHeaderSize());
+    frames[i]->SetSequenceNumber((WORD)(i+1));
+    frames[i]->SetSyncSource(0x12345678);
+    buffers[i] = frames[i]->GetPointer();
+  }
+
+  bool ok = sender.ProtectRTP(frames, PARRAYSIZE(frames)) == PARRAYSIZE(frames);
+  for (PINDEX i = 0; i < PARRAYSIZE(frames); ++i) {
+    ok = frames[i]->GetPointer() == buffers[i] &&
+         frames[i]->GetPacketSize() == RTP_UDP::RelayFrameSize + sender.GetRTPTrailerSize() && ok;
+    pool.ReleaseFrame(frames[i]);
+  }
+
+  if (!ok)
+    cout << "    " << setw(24) << suite.m_name << ": relay frame REALLOCATED or not protected" << endl;
+  return ok;
+}
+
+#endif // OPAL_RTP_AGGREGATE
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static bool RunThroughput(const char * name, BenchCipher & cipher, PINDEX payloadSize, unsigned total)
+{
+  BenchPackets packets(CHUNK_PACKETS, payloadSize);
+  PInt64 protectTime = 0;
+  PInt64 unprotectTime = 0;
+  PINDEX intact = 0;
+  WORD seq = 1;
+
+  for (unsigned done = 0; done < total; done += CHUNK_PACKETS) {
+    PINDEX count = std::min(total - done, (unsigned)CHUNK_PACKETS);
+    packets.Fill(count, seq);
+    seq = (WORD)(seq + count);
+
+    PInt64 start = PTime().GetTimestamp();
+    cipher.Protect(packets.GetPackets(), count);
+    PInt64 middle = PTime().GetTimestamp();
+    cipher.Unprotect(packets.GetPackets(), count);
+    PInt64 end = PTime().GetTimestamp();
+
+    protectTime += middle - start;
+    unprotectTime += end - middle;
+    intact += packets.CountIntact(count);
+  }
+
+  // Only one thread runs, so this is per core
+  cout << "    " << setw(8) << name << ": "
+       << "protect packets/s/core=" << (PUInt64)total*1000000/std::max(protectTime, (PInt64)1)
+       << " unprotect packets/s/core=" << (PUInt64)total*1000000/std::max(unprotectTime, (PInt64)1);
+  if (intact != (PINDEX)total)
+    cout << " FAILED " << total - intact;
+  cout << endl;
+  return intact == (PINDEX)total;
+}
+
+
+static bool SRTPBenchmark(PArgList & args)
+{
+  PStringArray sizes = args.GetOptionString('s', "160,1200").Tokenise(",");
+  unsigned total = args.GetOptionString('r', "200000").AsUnsigned();
+  if (total == 0)
+    total = 1;
+
+  cout << "SRTP benchmark, " << total << " packets per run" << endl;
+
+  bool ok = CheckVectors();
+  cout << "  suites" << endl;
+  for (const OpalSRTPCryptoSuite * suite = OpalSRTPCryptoSuite::GetSuites(); suite->m_name != NULL; ++suite) {
+    ok = CheckSuite(*suite) && ok;
+#if OPAL_RTP_AGGREGATE
+    ok = CheckRelayFrames(*suite) && ok;
+#endif
+  }
+
+  static const char * const Suites[] = {
+    "AES_CM_128_HMAC_SHA1_80",
+    "AES_CM_128_HMAC_SHA1_32",
+    "AEAD_AES_128_GCM",
+    "AEAD_AES_256_GCM"
+  };
+
+  BYTE key[64];
+  for (PINDEX i = 0; i < (PINDEX)sizeof(key); ++i)
+    key[i] = (BYTE)(i*13 + 1);
+
+  for (PINDEX i = 0; i < sizes.GetSize(); ++i) {
+    PINDEX payloadSize = sizes[i].AsUnsigned();
+    if (payloadSize == 0 || payloadSize > 1400)
+      continue;
+
+    for (PINDEX s = 0; s < PARRAYSIZE(Suites); ++s) {
+      const OpalSRTPCryptoSuite & suite = *OpalSRTPCryptoSuite::Find(Suites[s]);
+      cout << "  " << suite.m_name << ", " << payloadSize << " byte payloads" << endl;
+
+#if OPAL_SRTP
+      if (suite.m_cipher == OpalSRTPCryptoSuite::e_AES_CM) {
+        LibSRTPCipher libsrtp(suite, key);
+        ok = RunThroughput("libsrtp", libsrtp, payloadSize, total) && ok;
+      }
+#endif
+
+      {
+        NaiveCipher naive(suite, key);
+        ok = RunThroughput("naive", naive, payloadSize, total) && ok;
+      }
+      {
+        NativeCipher single(suite, key, false);
+        ok = RunThroughput("single", single, payloadSize, total) && ok;
+      }
+      {
+        NativeCipher batch(suite, key, true);
+        ok = RunThroughput("batch", batch, payloadSize, total) && ok;
+      }
+    }
+  }
+
+  return ok;
+}
+
+#else
+
+static bool SRTPBenchmark(PArgList &)
+{
+  cout << "SRTP benchmark needs OpenSSL" << endl;
+  return true;
+}
+
+#endif // OPAL_PTLIB_SSL
+
+OPALBENCH_TEST("srtp", "SRTP protection, per packet EVP vs precomputed keys and batches",
+               "-s 160,1200 -r 200000", SRTPBenchmark);
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -47,6 +47,75 @@ extern "C" {
 };
 
 
+/* The tables below are generated from the functions in g711.c, so the batch
+   conversions are bit exact with ConvertSample().
+
+   The uLaw encoder output depends only on (magnitude+131)>>3 below the clip
+   level, so the table is indexed by that and the sign bit applied after.
+   The A-Law encoder discards the bottom three bits of the sample before
+   anything else, so a table of 8192 entries covers every input value.
+ */
+#define ULAW_CLIP         (7904<<2)
+#define ULAW_BIAS         131
+#define ULAW_SHIFT        3
+#define ULAW_ENCODE_SIZE  (((ULAW_CLIP+ULAW_BIAS-1)>>ULAW_SHIFT)+1)
+#define ALAW_SHIFT        3
+#define ALAW_ENCODE_SIZE  (65536>>ALAW_SHIFT)
+
+static struct G711Tables
+{
+  G711Tables()
+  {
+    int i;
+
+    for (i = 0; i < 256; i++) {
+      uLawDecode[i] = (short)ulaw2linear(i);
+      aLawDecode[i] = (short)alaw2linear(i);
+    }
+
+    for (i = 0; i < ULAW_ENCODE_SIZE; i++) {
+      int magnitude = (i << ULAW_SHIFT) - ULAW_BIAS;
+      uLawEncode[i] = (BYTE)linear2ulaw(magnitude > 0 ? magnitude : 0);
+    }
+
+    for (i = 0; i < ALAW_ENCODE_SIZE; i++)
+      aLawEncode[i] = (BYTE)linear2alaw((i - ALAW_ENCODE_SIZE/2) << ALAW_SHIFT);
+
+    for (i = 0; i < 256; i++) {
+      uLawToALaw[i] = (BYTE)linear2alaw(uLawDecode[i]);
+      aLawToULaw[i] = (BYTE)linear2ulaw(aLawDecode[i]);
+    }
+  }
+
+  short uLawDecode[256];
+  short aLawDecode[256];
+  BYTE  uLawEncode[ULAW_ENCODE_SIZE];
+  BYTE  aLawEncode[ALAW_ENCODE_SIZE];
+  BYTE  uLawToALaw[256];
+  BYTE  aLawToULaw[256];
+} g711Tables;
+
+
+static inline BYTE EncodeULaw(int sample)
+{
+  int sign = 0;
+  if (sample < 0) {
+    sample = -sample;
+    sign = 0x80;
+  }
+
+  if (sample >= ULAW_CLIP)
+    return (BYTE)(0x80 ^ sign);
+
+  return (BYTE)(g711Tables.uLawEncode[(sample + ULAW_BIAS) >> ULAW_SHIFT] ^ sign);
+}
+
+
+static inline BYTE EncodeALaw(int sample)
+{
+  return g711Tables.aLawEncode[(sample >> ALAW_SHIFT) + ALAW_ENCODE_SIZE/2];
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -60,9 +129,9 @@ Opal_G711_PCM::Opal_G711_PCM(const OpalMediaFormat & inputMediaFormat)
 }
 
 
-#if OPAL_G711PLC 
 PBoolean Opal_G711_PCM::Convert(const RTP_DataFrame & input, RTP_DataFrame & output)
 {
+#if OPAL_G711PLC 
   PTRACE(7, "G.711\tPLC in_psz=" << input.GetPayloadSize()
          << " sn=" << input.GetSequenceNumber() << ", ts=" << input.GetTimestamp());
 
@@ -75,17 +144,61 @@ PBoolean Opal_G711_PCM::Convert(const RTP_DataFrame & input, RTP_DataFrame & out
     PTRACE(7, "G.711\tDOFE out_psz" << lastPayloadSize);
     return true;
   }
+#endif
 
-  if (!OpalStreamedTranscoder::Convert(input, output))
+  PINDEX samples = input.GetPayloadSize();
+  if (!output.SetPayloadSize(samples*sizeof(short)))
     return false;
 
+  ConvertBlock(input.GetPayloadPtr(), (short *)output.GetPayloadPtr(), samples);
+
+#if OPAL_G711PLC 
   lastPayloadSize = output.GetPayloadSize();
   plc.addtohistory((short*)output.GetPayloadPtr(), lastPayloadSize/sizeof(short));
   PTRACE(7, "G.711\tPLC ADD out_psz=" << lastPayloadSize);
+#endif
 
   return true;
 }
-#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+Opal_PCM_G711::Opal_PCM_G711(const OpalMediaFormat & outputMediaFormat)
+  : OpalStreamedTranscoder(OpalPCM16, outputMediaFormat, 16, 8)
+{
+}
+
+
+PBoolean Opal_PCM_G711::Convert(const RTP_DataFrame & input, RTP_DataFrame & output)
+{
+  PINDEX samples = input.GetPayloadSize()/sizeof(short);
+  if (!output.SetPayloadSize(samples))
+    return false;
+
+  ConvertBlock((const short *)input.GetPayloadPtr(), output.GetPayloadPtr(), samples);
+  return true;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+Opal_G711_G711::Opal_G711_G711(const OpalMediaFormat & inputMediaFormat,
+                               const OpalMediaFormat & outputMediaFormat)
+  : OpalStreamedTranscoder(inputMediaFormat, outputMediaFormat, 8, 8)
+{
+}
+
+
+PBoolean Opal_G711_G711::Convert(const RTP_DataFrame & input, RTP_DataFrame & output)
+{
+  PINDEX samples = input.GetPayloadSize();
+  if (!output.SetPayloadSize(samples))
+    return false;
+
+  ConvertBlock(input.GetPayloadPtr(), output.GetPayloadPtr(), samples);
+  return true;
+}
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -109,10 +222,23 @@ int Opal_G711_uLaw_PCM::ConvertSample(int sample)
 }
 
 
+void Opal_G711_uLaw_PCM::ConvertSamples(const BYTE * input, short * output, PINDEX count)
+{
+  while (count-- > 0)
+    *output++ = g711Tables.uLawDecode[*input++];
+}
+
+
+void Opal_G711_uLaw_PCM::ConvertBlock(const BYTE * input, short * output, PINDEX count) const
+{
+  ConvertSamples(input, output, count);
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 Opal_PCM_G711_uLaw::Opal_PCM_G711_uLaw()
-  : OpalStreamedTranscoder(OpalPCM16, OpalG711_ULAW_64K, 16, 8)
+  : Opal_PCM_G711(OpalG711_ULAW_64K)
 {
   PTRACE(3, "Codec\tG711-uLaw-64k encoder created");
 }
@@ -130,6 +256,19 @@ int Opal_PCM_G711_uLaw::ConvertSample(int sample)
 }
 
 
+void Opal_PCM_G711_uLaw::ConvertSamples(const short * input, BYTE * output, PINDEX count)
+{
+  while (count-- > 0)
+    *output++ = EncodeULaw(*input++);
+}
+
+
+void Opal_PCM_G711_uLaw::ConvertBlock(const short * input, BYTE * output, PINDEX count) const
+{
+  ConvertSamples(input, output, count);
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 Opal_G711_ALaw_PCM::Opal_G711_ALaw_PCM()
@@ -150,10 +289,24 @@ int Opal_G711_ALaw_PCM::ConvertSample(int sample)
   return alaw2linear(sample);
 }
 
+
+void Opal_G711_ALaw_PCM::ConvertSamples(const BYTE * input, short * output, PINDEX count)
+{
+  while (count-- > 0)
+    *output++ = g711Tables.aLawDecode[*input++];
+}
+
+
+void Opal_G711_ALaw_PCM::ConvertBlock(const BYTE * input, short * output, PINDEX count) const
+{
+  ConvertSamples(input, output, count);
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 Opal_PCM_G711_ALaw::Opal_PCM_G711_ALaw()
-  : OpalStreamedTranscoder(OpalPCM16, OpalG711_ALAW_64K, 16, 8)
+  : Opal_PCM_G711(OpalG711_ALAW_64K)
 {
   PTRACE(3, "Codec\tG711-ALaw-64k encoder created");
 }
@@ -171,4 +324,85 @@ int Opal_PCM_G711_ALaw::ConvertSample(int sample)
 }
 
 
+void Opal_PCM_G711_ALaw::ConvertSamples(const short * input, BYTE * output, PINDEX count)
+{
+  while (count-- > 0)
+    *output++ = EncodeALaw(*input++);
+}
+
+
+void Opal_PCM_G711_ALaw::ConvertBlock(const short * input, BYTE * output, PINDEX count) const
+{
+  ConvertSamples(input, output, count);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+Opal_G711_uLaw_ALaw::Opal_G711_uLaw_ALaw()
+  : Opal_G711_G711(OpalG711_ULAW_64K, OpalG711_ALAW_64K)
+{
+  PTRACE(3, "Codec\tG711-uLaw-64k to G711-ALaw-64k transcoder created");
+}
+
+
+int Opal_G711_uLaw_ALaw::ConvertOne(int sample) const
+{
+  return ConvertSample(sample);
+}
+
+
+int Opal_G711_uLaw_ALaw::ConvertSample(int sample)
+{
+  return linear2alaw(ulaw2linear(sample));
+}
+
+
+void Opal_G711_uLaw_ALaw::ConvertSamples(const BYTE * input, BYTE * output, PINDEX count)
+{
+  while (count-- > 0)
+    *output++ = g711Tables.uLawToALaw[*input++];
+}
+
+
+void Opal_G711_uLaw_ALaw::ConvertBlock(const BYTE * input, BYTE * output, PINDEX count) const
+{
+  ConvertSamples(input, output, count);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+Opal_G711_ALaw_uLaw::Opal_G711_ALaw_uLaw()
+  : Opal_G711_G711(OpalG711_ALAW_64K, OpalG711_ULAW_64K)
+{
+  PTRACE(3, "Codec\tG711-ALaw-64k to G711-uLaw-64k transcoder created");
+}
+
+
+int Opal_G711_ALaw_uLaw::ConvertOne(int sample) const
+{
+  return ConvertSample(sample);
+}
+
+
+int Opal_G711_ALaw_uLaw::ConvertSample(int sample)
+{
+  return linear2ulaw(alaw2linear(sample));
+}
+
+
+void Opal_G711_ALaw_uLaw::ConvertSamples(const BYTE * input, BYTE * output, PINDEX count)
+{
+  while (count-- > 0)
+    *output++ = g711Tables.aLawToULaw[*input++];
+}
+
+
+void Opal_G711_ALaw_uLaw::ConvertBlock(const BYTE * input, BYTE * output, PINDEX count) const
+{
+  ConvertSamples(input, output, count);
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
@@ -925,7 +925,7 @@ PBoolean OpalPluginVideoTranscoder::UpdateMediaFormats(const OpalMediaFormat & i
 
 PBoolean OpalPluginVideoTranscoder::ConvertFrames(const RTP_DataFrame & src, RTP_DataFrameList & dstList)
 {
-  dstList.RemoveAll();
+  dstList.RecycleAll();
   lastFrameWasIFrame = false;
 
   // get the size of the output buffer
@@ -941,7 +941,7 @@ PBoolean OpalPluginVideoTranscoder::ConvertFrames(const RTP_DataFrame & src, RTP
       if (outputDataSize < 2048)
         outputDataSize = 2048;
 
-      RTP_DataFrame * dst = new RTP_DataFrame(outputDataSize);
+      RTP_DataFrame * dst = dstList.NewFrame(outputDataSize);
       dst->SetPayloadType(GetPayloadType(false));
       dst->SetTimestamp(src.GetTimestamp());
 
@@ -951,7 +951,7 @@ PBoolean OpalPluginVideoTranscoder::ConvertFrames(const RTP_DataFrame & src, RTP
       flags = forceIFrame ? PluginCodec_CoderForceIFrame : 0;
 
       if (!Transcode((const BYTE *)src, &fromLen, dst->GetPointer(), &toLen, &flags)) {
-        delete dst;
+        dstList.RecycleFrame(dst);
         return false;
       }
 
@@ -962,7 +962,7 @@ PBoolean OpalPluginVideoTranscoder::ConvertFrames(const RTP_DataFrame & src, RTP
         dstList.Append(dst);
       }
       else
-        delete dst;
+        dstList.RecycleFrame(dst);
 
     } while ((flags & PluginCodec_ReturnCoderLastFrame) == 0);
     PTRACE(5, "OpalPlugin\tEncoded video frame into " << dstList.GetSize() << " packets.");
@@ -998,7 +998,7 @@ PBoolean OpalPluginVideoTranscoder::ConvertFrames(const RTP_DataFrame & src, RTP
     outputDataSize += sizeof(PluginCodec_Video_FrameHeader);
 
     if (m_bufferRTP == NULL)
-      m_bufferRTP = new RTP_DataFrame(outputDataSize);
+      m_bufferRTP = dstList.NewFrame(outputDataSize);
     else
       m_bufferRTP->SetPayloadSize(outputDataSize);
     m_bufferRTP->SetPayloadType(GetPayloadType(false));
@@ -1113,7 +1113,7 @@ PBoolean OpalFaxAudioTranscoder::ConvertFrames(const RTP_DataFrame & src, RTP_Da
     do {
 
       // create the output buffer
-      RTP_DataFrame * dst = new RTP_DataFrame(outputDataSize);
+      RTP_DataFrame * dst = dstList.NewFrame(outputDataSize);
       dst->SetPayloadType(GetPayloadType(false));
 
       // call the codec function
@@ -0,0 +1,364 @@
+/*
+ * resampler.cxx
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Linear PCM sample rate conversion transcoders
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#pragma implementation "resampler.h"
+#endif
+
+#include <opal/buildopts.h>
+
+#include <codec/resampler.h>
+
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define new PNEW
+
+
+/* Filter lengths are in input samples of the lower of the two rates, so
+   the transition band is the same fraction of the narrower bandwidth for
+   every rate pair. The cutoff is a fraction of the lower Nyquist rate. */
+#define NORMAL_TAPS          48
+#define NORMAL_KAISER_BETA   8.0
+#define LOW_LATENCY_TAPS     16
+#define LOW_LATENCY_BETA     6.0
+#define FILTER_CUTOFF        0.92
+
+// Taps per phase are rounded up to this so SSE2 needs no tail loop
+#define TAP_ALIGNMENT        8
+
+#define NUM_RATES            4
+
+static const unsigned SupportedRates[NUM_RATES] = { 8000, 16000, 32000, 48000 };
+
+static bool DefaultLowLatency = false;
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+struct OpalPCM16Resampler::Filter
+{
+  unsigned m_up;       // Interpolation factor (L)
+  unsigned m_down;     // Decimation factor (M)
+  unsigned m_taps;     // Taps per phase
+  std::vector<short> m_coefficients; // m_up phases of m_taps, each reversed, Q15
+
+  Filter(unsigned inputRate, unsigned outputRate, bool lowLatency);
+};
+
+
+static unsigned GreatestCommonDivisor(unsigned a, unsigned b)
+{
+  while (b != 0) {
+    unsigned t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+
+// Zeroth order modified Bessel function of the first kind, for the window
+static double BesselI0(double x)
+{
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 50; ++k) {
+    term *= (x/(2*k))*(x/(2*k));
+    sum += term;
+    if (term < sum*1e-12)
+      break;
+  }
+  return sum;
+}
+
+
+OpalPCM16Resampler::Filter::Filter(unsigned inputRate, unsigned outputRate, bool lowLatency)
+{
+  unsigned gcd = GreatestCommonDivisor(inputRate, outputRate);
+  m_up = outputRate/gcd;
+  m_down = inputRate/gcd;
+
+  unsigned ratio = PMAX(m_up, m_down);
+  unsigned taps = (lowLatency ? LOW_LATENCY_TAPS : NORMAL_TAPS)*ratio;
+  m_taps = (taps/m_up + TAP_ALIGNMENT-1)/TAP_ALIGNMENT*TAP_ALIGNMENT;
+
+  double beta = lowLatency ? LOW_LATENCY_BETA : NORMAL_KAISER_BETA;
+
+  // Prototype low pass at the upsampled rate, cutoff relative to that rate
+  unsigned length = m_taps*m_up;
+  double cutoff = FILTER_CUTOFF/2/ratio;
+  double centre = (length-1)/2.0;
+  double windowScale = BesselI0(beta);
+
+  std::vector<double> prototype(length);
+  for (unsigned n = 0; n < length; ++n) {
+    double t = n - centre;
+    double sinc = t == 0 ? 2*cutoff : sin(2*M_PI*cutoff*t)/(M_PI*t);
+    double r = 2.0*n/(length-1) - 1.0;
+    prototype[n] = sinc*BesselI0(beta*sqrt(PMAX(0.0, 1.0 - r*r)))/windowScale;
+  }
+
+  /* Each phase is normalised to unity DC gain, this supplies the gain of
+     m_up needed after interpolation, and stops the small differences
+     between phases appearing as a tone at the input rate. */
+  m_coefficients.resize(length);
+  for (unsigned phase = 0; phase < m_up; ++phase) {
+    double sum = 0;
+    for (unsigned j = 0; j < m_taps; ++j)
+      sum += prototype[phase + j*m_up];
+
+    for (unsigned j = 0; j < m_taps; ++j) {
+      long value = (long)floor(prototype[phase + j*m_up]/sum*32768 + 0.5);
+      m_coefficients[phase*m_taps + m_taps-1-j] = (short)PMAX(-32768L, PMIN(32767L, value));
+    }
+  }
+
+  PTRACE(4, "Resampler\tDesigned filter for " << inputRate << " to " << outputRate
+         << (lowLatency ? " (low latency)" : "") << ": L=" << m_up << " M=" << m_down
+         << " taps/phase=" << m_taps);
+}
+
+
+static int RateIndex(unsigned rate)
+{
+  for (int i = 0; i < NUM_RATES; ++i) {
+    if (SupportedRates[i] == rate)
+      return i;
+  }
+  return -1;
+}
+
+
+/* Filters are only dependent on the rate pair and mode, so are designed
+   on first use and shared, never deleted, by all resamplers. */
+static const OpalPCM16Resampler::Filter * GetFilter(unsigned inputRate, unsigned outputRate, bool lowLatency)
+{
+  static PMutex mutex;
+  static OpalPCM16Resampler::Filter * filters[NUM_RATES][NUM_RATES][2];
+
+  int in = RateIndex(inputRate);
+  int out = RateIndex(outputRate);
+  if (in < 0 || out < 0 || in == out)
+    return NULL;
+
+  PWaitAndSignal lock(mutex);
+
+  OpalPCM16Resampler::Filter * & filter = filters[in][out][lowLatency ? 1 : 0];
+  if (filter == NULL)
+    filter = new OpalPCM16Resampler::Filter(inputRate, outputRate, lowLatency);
+  return filter;
+}
+
+
+/* Coefficients of a phase sum to 1.0 and their magnitudes to well under
+   2.0, so the 32 bit accumulators cannot overflow even on full scale. */
+#if defined(__SSE2__)
+
+static inline int DotProduct(const short * samples, const short * coefficients, unsigned taps)
+{
+  __m128i acc = _mm_setzero_si128();
+  for (unsigned i = 0; i < taps; i += TAP_ALIGNMENT)
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(samples+i)),
+                                            _mm_loadu_si128((const __m128i *)(coefficients+i))));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(acc);
+}
+
+#else
+
+static inline int DotProduct(const short * samples, const short * coefficients, unsigned taps)
+{
+  int acc = 0;
+  for (unsigned i = 0; i < taps; ++i)
+    acc += samples[i]*coefficients[i];
+  return acc;
+}
+
+#endif
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+OpalPCM16Resampler::OpalPCM16Resampler(unsigned inputRate, unsigned outputRate)
+  : OpalTranscoder(GetPCM16Format(inputRate), GetPCM16Format(outputRate))
+  , m_inputRate(inputRate)
+  , m_outputRate(outputRate)
+  , m_lowLatency(DefaultLowLatency)
+  , m_filter(NULL)
+{
+  SelectFilter();
+}
+
+
+OpalMediaFormat OpalPCM16Resampler::GetPCM16Format(unsigned rate)
+{
+  switch (rate) {
+    case 8000 :
+      return OpalPCM16;
+    case 16000 :
+      return OpalPCM16_16KHZ;
+    case 32000 :
+      return OpalPCM16_32KHZ;
+    case 48000 :
+      return OpalPCM16_48KHZ;
+  }
+
+  return OpalMediaFormat();
+}
+
+
+void OpalPCM16Resampler::SetDefaultLowLatency(bool lowLatency)
+{
+  DefaultLowLatency = lowLatency;
+}
+
+
+bool OpalPCM16Resampler::GetDefaultLowLatency()
+{
+  return DefaultLowLatency;
+}
+
+
+void OpalPCM16Resampler::SetLowLatency(bool lowLatency)
+{
+  if (m_lowLatency == lowLatency)
+    return;
+
+  m_lowLatency = lowLatency;
+  SelectFilter();
+}
+
+
+void OpalPCM16Resampler::SelectFilter()
+{
+  m_filter = GetFilter(m_inputRate, m_outputRate, m_lowLatency);
+  PAssert(m_filter != NULL, "Unsupported resampler rates");
+  Reset();
+}
+
+
+void OpalPCM16Resampler::Reset()
+{
+  m_buffer.assign(m_filter != NULL ? m_filter->m_taps-1 : 0, 0);
+  m_position = 0;
+  m_nextTimestamp = 0;
+  m_started = false;
+}
+
+
+double OpalPCM16Resampler::GetGroupDelay() const
+{
+  if (m_filter == NULL)
+    return 0;
+  return (m_filter->m_taps*m_filter->m_up - 1)/2.0/m_filter->m_down;
+}
+
+
+PINDEX OpalPCM16Resampler::GetOptimalDataFrameSize(PBoolean input) const
+{
+  // 10ms of 16 bit samples
+  return (input ? m_inputRate : m_outputRate)/100*sizeof(short);
+}
+
+
+PINDEX OpalPCM16Resampler::GetMaxOutputSamples(PINDEX count) const
+{
+  if (m_filter == NULL)
+    return 0;
+  return (count*m_filter->m_up + m_filter->m_down-1)/m_filter->m_down + 1;
+}
+
+
+PINDEX OpalPCM16Resampler::Resample(const short * input, PINDEX count, short * output)
+{
+  if (m_filter == NULL || count <= 0)
+    return 0;
+
+  const unsigned up = m_filter->m_up;
+  const unsigned down = m_filter->m_down;
+  const unsigned taps = m_filter->m_taps;
+  const short * coefficients = &m_filter->m_coefficients[0];
+
+  // Buffer keeps taps-1 samples of history, so window for input i starts at i
+  PINDEX history = m_buffer.size();
+  m_buffer.resize(history + count);
+  memcpy(&m_buffer[history], input, count*sizeof(short));
+  const short * samples = &m_buffer[0];
+
+  PINDEX written = 0;
+  unsigned position = m_position;
+  unsigned limit = count*up;
+  while (position < limit) {
+    int acc = DotProduct(samples + position/up, coefficients + (position%up)*taps, taps);
+    acc = (acc + 16384) >> 15;
+    output[written++] = (short)(acc > 32767 ? 32767 : (acc < -32768 ? -32768 : acc));
+    position += down;
+  }
+  m_position = position - limit;
+
+  m_buffer.erase(m_buffer.begin(), m_buffer.begin()+count);
+
+  return written;
+}
+
+
+PBoolean OpalPCM16Resampler::Convert(const RTP_DataFrame & input, RTP_DataFrame & output)
+{
+  PINDEX count = input.GetPayloadSize()/sizeof(short);
+
+  if (m_started && input.GetTimestamp() != m_nextTimestamp) {
+    PTRACE(4, "Resampler\tTimestamp discontinuity, expected " << m_nextTimestamp
+           << " got " << input.GetTimestamp() << ", resetting filter");
+    Reset();
+  }
+  m_started = true;
+  m_nextTimestamp = input.GetTimestamp() + count;
+
+  if (!output.SetPayloadSize(GetMaxOutputSamples(count)*sizeof(short)))
+    return PFalse;
+
+  PINDEX written = Resample((const short *)input.GetPayloadPtr(), count, (short *)output.GetPayloadPtr());
+  output.SetPayloadSize(written*sizeof(short));
+  return PTrue;
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -37,6 +37,10 @@
 #include <codec/silencedetect.h>
 #include <opal/patch.h>
 
+#include <opal/simd.h>
+
+#include <math.h>
+
 #define new PNEW
 
 
@@ -134,6 +138,17 @@ void OpalSilenceDetector::ReceivedPacket(RTP_DataFrame & frame, INT)
   if (param.m_mode == NoSilenceDetection)
     return;
 
+  // The first frame only sets the timestamp, so is not measured
+  unsigned level = UINT_MAX;
+  if (lastTimestamp != 0)
+    level = GetAverageSignalLevel(frame.GetPayloadPtr(), frame.GetPayloadSize());
+
+  DetectSilence(frame, level);
+}
+
+
+void OpalSilenceDetector::DetectSilence(RTP_DataFrame & frame, unsigned level)
+{
   unsigned thisTimestamp = frame.GetTimestamp();
   if (lastTimestamp == 0) {
     lastTimestamp = thisTimestamp;
@@ -145,7 +160,6 @@ void OpalSilenceDetector::ReceivedPacket(RTP_DataFrame & frame, INT)
 
   // Can never have average signal level that high, this indicates that the
   // hardware cannot do silence detection.
-  unsigned level = GetAverageSignalLevel(frame.GetPayloadPtr(), frame.GetPayloadSize());
   if (level == UINT_MAX)
     return;
 
@@ -266,18 +280,365 @@ void OpalSilenceDetector::ReceivedPacket(RTP_DataFrame & frame, INT)
 unsigned OpalPCM16SilenceDetector::GetAverageSignalLevel(const BYTE * buffer, PINDEX size)
 {
   // Calculate the average signal level of this frame
-  int sum = 0;
-  PINDEX samples = size/2;
-  const short * pcm = (const short *)buffer;
-  const short * end = pcm + samples;
-  while (pcm != end) {
-    if (*pcm < 0)
-      sum -= *pcm++;
-    else
-      sum += *pcm++;
+  return GetAverageLevel((const short *)buffer, size/2);
+}
+
+
+static unsigned RootMeanSquare(PUInt64 sumSquares, PINDEX count)
+{
+  return (unsigned)sqrt((double)(PInt64)sumSquares/count);
+}
+
+
+static unsigned AverageLevelC(const short * pcm, PINDEX i, PINDEX count, PUInt64 sum)
+{
+  for (; i < count; ++i)
+    sum += pcm[i] < 0 ? -pcm[i] : pcm[i];
+
+  return (unsigned)(sum/count);
+}
+
+static void SignalLevelsC(const short * pcm, PINDEX i, PINDEX count,
+                          PUInt64 sum, PUInt64 sumSquares, int peak,
+                          OpalPCM16SilenceDetector::SignalLevels & levels)
+{
+  for (; i < count; ++i) {
+    int v = pcm[i] < 0 ? -pcm[i] : pcm[i];
+    sum += v;
+    sumSquares += v*v;
+    if (v > peak)
+      peak = v;
+  }
+
+  levels.m_average = (unsigned)(sum/count);
+  levels.m_rms = RootMeanSquare(sumSquares, count);
+  levels.m_peak = peak;
+}
+
+
+#if OPAL_SIMD
+
+// Sum of the absolute values of each pair of samples, in 32 bit lanes
+static inline OPAL_TARGET_SSE2 __m128i AbsolutePairsSSE2(__m128i v)
+{
+  return _mm_madd_epi16(v, _mm_or_si128(_mm_srai_epi16(v, 15), _mm_set1_epi16(1)));
+}
+
+static inline OPAL_TARGET_SSE2 PUInt64 SumLanesSSE2(__m128i v)
+{
+  DWORD lanes[4];
+  _mm_storeu_si128((__m128i *)lanes, v);
+  return (PUInt64)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+static OPAL_TARGET_SSE2 unsigned AverageLevelSSE2(const short * pcm, PINDEX count)
+{
+  PUInt64 sum = 0;
+  PINDEX i = 0;
+  while (i+8 <= count) {
+    // Each lane can take 32768 pairs before it could overflow
+    PINDEX end = PMIN(count, i+8*32768);
+    __m128i acc = _mm_setzero_si128();
+    for (; i+8 <= end; i += 8)
+      acc = _mm_add_epi32(acc, AbsolutePairsSSE2(_mm_loadu_si128((const __m128i *)(pcm+i))));
+    sum += SumLanesSSE2(acc);
+  }
+
+  return AverageLevelC(pcm, i, count, sum);
+}
+
+static OPAL_TARGET_SSE2 void SignalLevelsSSE2(const short * pcm, PINDEX count, OpalPCM16SilenceDetector::SignalLevels & levels)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i squares = zero;
+  __m128i maximum = zero;
+  __m128i minimum = zero;
+  PUInt64 sum = 0;
+
+  PINDEX i = 0;
+  while (i+8 <= count) {
+    PINDEX end = PMIN(count, i+8*32768);
+    __m128i acc = zero;
+    for (; i+8 <= end; i += 8) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(pcm+i));
+      acc = _mm_add_epi32(acc, AbsolutePairsSSE2(v));
+      // A pair of squares may be 2^31, so is widened before it is added
+      __m128i pairs = _mm_madd_epi16(v, v);
+      squares = _mm_add_epi64(squares, _mm_unpacklo_epi32(pairs, zero));
+      squares = _mm_add_epi64(squares, _mm_unpackhi_epi32(pairs, zero));
+      maximum = _mm_max_epi16(maximum, v);
+      minimum = _mm_min_epi16(minimum, v);
+    }
+    sum += SumLanesSSE2(acc);
+  }
+
+  PUInt64 lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, squares);
+
+  short high[8], low[8];
+  _mm_storeu_si128((__m128i *)high, maximum);
+  _mm_storeu_si128((__m128i *)low, minimum);
+  int peak = 0;
+  for (PINDEX lane = 0; lane < 8; ++lane)
+    peak = PMAX(peak, PMAX((int)high[lane], -(int)low[lane]));
+
+  SignalLevelsC(pcm, i, count, sum, lanes[0] + lanes[1], peak, levels);
+}
+
+#if OPAL_SIMD_AVX2_OK
+
+static inline OPAL_TARGET_AVX2 __m256i AbsolutePairsAVX2(__m256i v)
+{
+  return _mm256_madd_epi16(v, _mm256_or_si256(_mm256_srai_epi16(v, 15), _mm256_set1_epi16(1)));
+}
+
+static inline OPAL_TARGET_AVX2 PUInt64 SumLanesAVX2(__m256i v)
+{
+  DWORD lanes[8];
+  _mm256_storeu_si256((__m256i *)lanes, v);
+  PUInt64 sum = 0;
+  for (PINDEX i = 0; i < 8; ++i)
+    sum += lanes[i];
+  return sum;
+}
+
+static OPAL_TARGET_AVX2 unsigned AverageLevelAVX2(const short * pcm, PINDEX count)
+{
+  PUInt64 sum = 0;
+  PINDEX i = 0;
+  while (i+16 <= count) {
+    PINDEX end = PMIN(count, i+16*32768);
+    __m256i acc = _mm256_setzero_si256();
+    for (; i+16 <= end; i += 16)
+      acc = _mm256_add_epi32(acc, AbsolutePairsAVX2(_mm256_loadu_si256((const __m256i *)(pcm+i))));
+    sum += SumLanesAVX2(acc);
+  }
+
+  return AverageLevelC(pcm, i, count, sum);
+}
+
+static OPAL_TARGET_AVX2 void SignalLevelsAVX2(const short * pcm, PINDEX count, OpalPCM16SilenceDetector::SignalLevels & levels)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i squares = zero;
+  __m256i maximum = zero;
+  __m256i minimum = zero;
+  PUInt64 sum = 0;
+
+  PINDEX i = 0;
+  while (i+16 <= count) {
+    PINDEX end = PMIN(count, i+16*32768);
+    __m256i acc = zero;
+    for (; i+16 <= end; i += 16) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(pcm+i));
+      acc = _mm256_add_epi32(acc, AbsolutePairsAVX2(v));
+      __m256i pairs = _mm256_madd_epi16(v, v);
+      squares = _mm256_add_epi64(squares, _mm256_unpacklo_epi32(pairs, zero));
+      squares = _mm256_add_epi64(squares, _mm256_unpackhi_epi32(pairs, zero));
+      maximum = _mm256_max_epi16(maximum, v);
+      minimum = _mm256_min_epi16(minimum, v);
+    }
+    sum += SumLanesAVX2(acc);
+  }
+
+  PUInt64 lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, squares);
+
+  short high[16], low[16];
+  _mm256_storeu_si256((__m256i *)high, maximum);
+  _mm256_storeu_si256((__m256i *)low, minimum);
+  int peak = 0;
+  for (PINDEX lane = 0; lane < 16; ++lane)
+    peak = PMAX(peak, PMAX((int)high[lane], -(int)low[lane]));
+
+  SignalLevelsC(pcm, i, count, sum, lanes[0] + lanes[1] + lanes[2] + lanes[3], peak, levels);
+}
+
+#endif // OPAL_SIMD_AVX2_OK
+
+#endif // OPAL_SIMD
+
+
+unsigned OpalPCM16SilenceDetector::GetAverageLevel(const short * pcm, PINDEX count)
+{
+  if (count <= 0)
+    return 0;
+
+#if OPAL_SIMD
+  static const int simd = OpalGetSIMDLevel();
+#if OPAL_SIMD_AVX2_OK
+  if (simd >= OPAL_SIMD_AVX2)
+    return AverageLevelAVX2(pcm, count);
+#endif
+  if (simd >= OPAL_SIMD_SSE2)
+    return AverageLevelSSE2(pcm, count);
+#endif
+
+  return AverageLevelC(pcm, 0, count, 0);
+}
+
+
+void OpalPCM16SilenceDetector::GetSignalLevels(const short * pcm, PINDEX count, SignalLevels & levels)
+{
+  levels.m_average = levels.m_rms = levels.m_peak = 0;
+  if (count <= 0)
+    return;
+
+#if OPAL_SIMD
+  static const int simd = OpalGetSIMDLevel();
+#if OPAL_SIMD_AVX2_OK
+  if (simd >= OPAL_SIMD_AVX2) {
+    SignalLevelsAVX2(pcm, count, levels);
+    return;
+  }
+#endif
+  if (simd >= OPAL_SIMD_SSE2) {
+    SignalLevelsSSE2(pcm, count, levels);
+    return;
+  }
+#endif
+
+  SignalLevelsC(pcm, 0, count, 0, 0, 0, levels);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+
+void OpalPCM16SilenceDetector::SetWorker(OpalSilenceDetectorWorker * worker)
+{
+  m_worker = worker;
+  if (m_worker != NULL)
+    receiveHandler = PCREATE_NOTIFIER(ReceivedPacketByWorker);
+  else
+    receiveHandler = PCREATE_NOTIFIER(ReceivedPacket);
+}
+
+
+void OpalPCM16SilenceDetector::ReceivedPacketByWorker(RTP_DataFrame & frame, INT)
+{
+  // Skipped here as for ReceivedPacket(), so they never reach the worker
+  if (frame.GetPayloadSize() == 0 || param.m_mode == NoSilenceDetection)
+    return;
+
+  m_worker->Detect(*this, frame);
+}
+
+
+unsigned OpalPCM16SilenceDetector::MeasureFrame(const RTP_DataFrame & frame) const
+{
+  if (lastTimestamp == 0)
+    return UINT_MAX;
+
+  return GetAverageLevel((const short *)frame.GetPayloadPtr(), frame.GetPayloadSize()/2);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+OpalSilenceDetectorWorker::OpalSilenceDetectorWorker()
+  : m_running(true)
+  , m_batchCount(0)
+  , m_frameCount(0)
+{
+  m_thread = PThread::Create(PCREATE_NOTIFIER(WorkerMain), "Silence Detect");
+}
+
+
+OpalSilenceDetectorWorker::~OpalSilenceDetectorWorker()
+{
+  m_mutex.Wait();
+  m_running = false;
+  m_mutex.Signal();
+
+  m_wakeup.Signal();
+  m_thread->WaitForTermination();
+  delete m_thread;
+
+  PTRACE(4, "Silence\tWorker stopped after " << m_frameCount << " frames in " << m_batchCount << " batches");
+}
+
+
+void OpalSilenceDetectorWorker::Detect(OpalPCM16SilenceDetector & detector, RTP_DataFrame & frame)
+{
+  bool queued = false;
+  {
+    PWaitAndSignal mutex(m_mutex);
+    if (m_running) {
+      Request request;
+      request.m_detector = &detector;
+      request.m_frame = &frame;
+      m_pending.push_back(request);
+      queued = true;
+    }
+  }
+
+  if (!queued) {
+    detector.DetectSilence(frame, detector.MeasureFrame(frame));
+    return;
+  }
+
+  m_wakeup.Signal();
+  detector.m_workerDone.Wait();
+}
+
+
+PUInt64 OpalSilenceDetectorWorker::GetBatchCount() const
+{
+  PWaitAndSignal mutex(m_mutex);
+  return m_batchCount;
+}
+
+
+PUInt64 OpalSilenceDetectorWorker::GetFrameCount() const
+{
+  PWaitAndSignal mutex(m_mutex);
+  return m_frameCount;
+}
+
+
+void OpalSilenceDetectorWorker::WorkerMain(PThread &, INT)
+{
+  PTRACE(4, "Silence\tWorker started");
+
+  std::vector<Request> batch;
+  std::vector<unsigned> levels;
+
+  for (;;) {
+    bool running;
+    {
+      PWaitAndSignal mutex(m_mutex);
+      batch.swap(m_pending);
+      running = m_running;
+      if (!batch.empty()) {
+        ++m_batchCount;
+        m_frameCount += batch.size();
+      }
+    }
+
+    if (batch.empty()) {
+      if (!running)
+        break;
+      m_wakeup.Wait();
+      continue;
+    }
+
+    // Measure every frame first, so the kernels run back to back
+    levels.resize(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i)
+      levels[i] = batch[i].m_detector->MeasureFrame(*batch[i].m_frame);
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+      OpalPCM16SilenceDetector & detector = *batch[i].m_detector;
+      detector.DetectSilence(*batch[i].m_frame, levels[i]);
+      // The patch thread may delete the detector as soon as this is done
+      detector.m_workerDone.Signal();
+    }
+
+    batch.clear();
   }
 
-  return sum/samples;
+  PTRACE(4, "Silence\tWorker ended");
 }
 
 
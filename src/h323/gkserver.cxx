@@ -45,6 +45,9 @@
 #include <h323/h323ep.h>
 #include <h323/h323pdu.h>
 #include <h323/peclient.h>
+#include <opal/strhash.h>
+
+#include <algorithm>
 
 
 const char AnswerCallStr[] = "-Answer";
@@ -2913,34 +2916,277 @@ H323GatekeeperRequest::Response H323GatekeeperServer::OnInfoResponse(H323Gatekee
 }
 
 
+H323GatekeeperServer::StringIndex::Shard & H323GatekeeperServer::StringIndex::GetShard(const PString & key) const
+{
+  return m_shards[OpalStringHash(key) % NumShards];
+}
+
+
+void H323GatekeeperServer::StringIndex::Add(const PString & key, const PString & identifier)
+{
+  Shard & shard = GetShard(key);
+  PWriteWaitAndSignal lock(shard.m_mutex);
+  shard.m_map[key].push_back(identifier);
+}
+
+
+void H323GatekeeperServer::StringIndex::Remove(const PString & key, const PString & identifier)
+{
+  Shard & shard = GetShard(key);
+  PWriteWaitAndSignal lock(shard.m_mutex);
+
+  std::map<PString, IdentifierList>::iterator it = shard.m_map.find(key);
+  if (it == shard.m_map.end())
+    return;
+
+  IdentifierList & identifiers = it->second;
+  identifiers.erase(std::remove(identifiers.begin(), identifiers.end(), identifier), identifiers.end());
+  if (identifiers.empty())
+    shard.m_map.erase(it);
+}
+
+
+PString H323GatekeeperServer::StringIndex::Find(const PString & key) const
+{
+  Shard & shard = GetShard(key);
+  PReadWaitAndSignal lock(shard.m_mutex);
+
+  std::map<PString, IdentifierList>::const_iterator it = shard.m_map.find(key);
+  return it != shard.m_map.end() ? it->second.front() : PString::Empty();
+}
+
+
+PString H323GatekeeperServer::StringIndex::FindPartial(const PString & partial, PString & key) const
+{
+  // Rarely used, so is not worth an ordered index of its own
+  PString identifier;
+
+  for (PINDEX i = 0; i < NumShards; ++i) {
+    Shard & shard = m_shards[i];
+    PReadWaitAndSignal lock(shard.m_mutex);
+
+    std::map<PString, IdentifierList>::const_iterator it = shard.m_map.lower_bound(partial);
+    if (it != shard.m_map.end() &&
+        it->first.NumCompare(partial) == PObject::EqualTo &&
+        (identifier.IsEmpty() || it->first < key)) {
+      key = it->first;
+      identifier = it->second.front();
+    }
+  }
+
+  return identifier;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+static int PrefixDigitIndex(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c == '*')
+    return 10;
+  if (c == '#')
+    return 11;
+  return -1;
+}
+
+
+H323GatekeeperServer::PrefixIndex::Node::Node()
+{
+  memset(m_digits, 0, sizeof(m_digits));
+}
+
+
+H323GatekeeperServer::PrefixIndex::Node::~Node()
+{
+  for (PINDEX i = 0; i < NumDigits; ++i)
+    delete m_digits[i];
+
+  for (std::map<char, Node *>::iterator it = m_others.begin(); it != m_others.end(); ++it)
+    delete it->second;
+}
+
+
+H323GatekeeperServer::PrefixIndex::Node * H323GatekeeperServer::PrefixIndex::Node::GetChild(char c) const
+{
+  int digit = PrefixDigitIndex(c);
+  if (digit >= 0)
+    return m_digits[digit];
+
+  std::map<char, Node *>::const_iterator it = m_others.find(c);
+  return it != m_others.end() ? it->second : NULL;
+}
+
+
+H323GatekeeperServer::PrefixIndex::Node * & H323GatekeeperServer::PrefixIndex::Node::MakeChild(char c)
+{
+  int digit = PrefixDigitIndex(c);
+  return digit >= 0 ? m_digits[digit] : m_others[c];
+}
+
+
+bool H323GatekeeperServer::PrefixIndex::Node::IsEmpty() const
+{
+  if (!m_identifiers.empty() || !m_others.empty())
+    return false;
+
+  for (PINDEX i = 0; i < NumDigits; ++i) {
+    if (m_digits[i] != NULL)
+      return false;
+  }
+
+  return true;
+}
+
+
+H323GatekeeperServer::PrefixIndex::PrefixIndex()
+  : m_count(0)
+{
+}
+
+
+void H323GatekeeperServer::PrefixIndex::Add(const PString & prefix, const PString & identifier)
+{
+  // An empty prefix was never matched, so do not store one
+  if (prefix.IsEmpty())
+    return;
+
+  PWriteWaitAndSignal lock(m_mutex);
+
+  Node * node = &m_root;
+  for (const char * ptr = prefix; *ptr != '\0'; ++ptr) {
+    Node * & child = node->MakeChild(*ptr);
+    if (child == NULL)
+      child = new Node;
+    node = child;
+  }
+
+  node->m_identifiers.push_back(identifier);
+  ++m_count;
+}
+
+
+void H323GatekeeperServer::PrefixIndex::Remove(const PString & prefix, const PString & identifier)
+{
+  if (prefix.IsEmpty())
+    return;
+
+  PWriteWaitAndSignal lock(m_mutex);
+
+  std::vector<Node *> path;
+  Node * node = &m_root;
+  for (const char * ptr = prefix; *ptr != '\0'; ++ptr) {
+    path.push_back(node);
+    node = node->GetChild(*ptr);
+    if (node == NULL)
+      return;
+  }
+
+  IdentifierList & identifiers = node->m_identifiers;
+  IdentifierList::iterator it = std::remove(identifiers.begin(), identifiers.end(), identifier);
+  if (it == identifiers.end())
+    return;
+
+  m_count -= identifiers.end() - it;
+  identifiers.erase(it, identifiers.end());
+
+  // Prune branches left with nothing in them
+  for (PINDEX len = prefix.GetLength(); len > 0 && node->IsEmpty(); ) {
+    Node * parent = path[--len];
+    char c = prefix[len];
+    int digit = PrefixDigitIndex(c);
+    if (digit >= 0)
+      parent->m_digits[digit] = NULL;
+    else
+      parent->m_others.erase(c);
+    delete node;
+    node = parent;
+  }
+}
+
+
+PString H323GatekeeperServer::PrefixIndex::FindLongest(const PString & number) const
+{
+  PReadWaitAndSignal lock(m_mutex);
+
+  if (m_count == 0)
+    return PString::Empty();
+
+  const Node * longest = NULL;
+  const Node * node = &m_root;
+  for (const char * ptr = number; *ptr != '\0'; ++ptr) {
+    node = node->GetChild(*ptr);
+    if (node == NULL)
+      break;
+    if (!node->m_identifiers.empty())
+      longest = node;
+  }
+
+  return longest != NULL ? longest->m_identifiers.front() : PString::Empty();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
 void H323GatekeeperServer::AddEndPoint(H323RegisteredEndPoint * ep)
 {
   PTRACE(3, "RAS\tAdding registered endpoint: " << *ep);
 
   PINDEX i;
+  PString identifier = ep->GetIdentifier();
 
   mutex.Wait();
 
-  if (byIdentifier.FindWithLock(ep->GetIdentifier(), PSafeReference) != ep) {
-    byIdentifier.SetAt(ep->GetIdentifier(), ep);
+  if (byIdentifier.FindWithLock(identifier, PSafeReference) != ep) {
+    byIdentifier.SetAt(identifier, ep);
 
     if (byIdentifier.GetSize() > peakRegistrations)
       peakRegistrations = byIdentifier.GetSize();
     totalRegistrations++;
   }
 
+  mutex.Signal();
+
+  IndexedKeys keys;
+
   for (i = 0; i < ep->GetSignalAddressCount(); i++)
-    byAddress.Append(new StringMap(ep->GetSignalAddress(i), ep->GetIdentifier()));
+    keys.m_addresses.push_back(ep->GetSignalAddress(i));
 
-  for (i = 0; i < ep->GetAliasCount(); i++) {
-    PString alias = ep->GetAlias(i);
-    byAlias.Append(new StringMap(ep->GetAlias(i), ep->GetIdentifier()));
-  }
+  for (i = 0; i < ep->GetAliasCount(); i++)
+    keys.m_aliases.push_back(ep->GetAlias(i));
 
   for (i = 0; i < ep->GetPrefixCount(); i++)
-    byVoicePrefix.Append(new StringMap(ep->GetPrefix(i), ep->GetIdentifier()));
+    keys.m_prefixes.push_back(ep->GetPrefix(i));
 
-  mutex.Signal();
+  PWaitAndSignal wait(m_indexedKeysMutex);
+
+  // A heavy RRQ from a registered endpoint replaces what it had before
+  std::map<PString, IndexedKeys>::iterator it = m_indexedKeys.find(identifier);
+  if (it != m_indexedKeys.end())
+    RemoveFromIndexes(identifier, it->second);
+
+  std::vector<PString>::iterator key;
+  for (key = keys.m_addresses.begin(); key != keys.m_addresses.end(); ++key)
+    byAddress.Add(*key, identifier);
+  for (key = keys.m_aliases.begin(); key != keys.m_aliases.end(); ++key)
+    byAlias.Add(*key, identifier);
+  for (key = keys.m_prefixes.begin(); key != keys.m_prefixes.end(); ++key)
+    byVoicePrefix.Add(*key, identifier);
+
+  m_indexedKeys[identifier] = keys;
+}
+
+
+void H323GatekeeperServer::RemoveFromIndexes(const PString & identifier, const IndexedKeys & keys)
+{
+  std::vector<PString>::const_iterator key;
+  for (key = keys.m_addresses.begin(); key != keys.m_addresses.end(); ++key)
+    byAddress.Remove(*key, identifier);
+  for (key = keys.m_aliases.begin(); key != keys.m_aliases.end(); ++key)
+    byAlias.Remove(*key, identifier);
+  for (key = keys.m_prefixes.begin(); key != keys.m_prefixes.end(); ++key)
+    byVoicePrefix.Remove(*key, identifier);
 }
 
 
@@ -2956,30 +3202,17 @@ PBoolean H323GatekeeperServer::RemoveEndPoint(H323RegisteredEndPoint * ep)
   while (ep->GetAliasCount() > 0)
     ep->RemoveAlias(ep->GetAlias(0));
 
-  PWaitAndSignal wait(mutex);
-
-  PINDEX i;
-
-  // remove prefixes belonging to this endpoint
-  for (i = 0; i < byVoicePrefix.GetSize(); i++) {
-    StringMap & prefixMap = (StringMap &)*byVoicePrefix.GetAt(i);
-    if (prefixMap.identifier == ep->GetIdentifier())
-      byVoicePrefix.RemoveAt(i);
-  }
-
-  // remove aliases belonging to this endpoint
-  for (i = 0; i < byAlias.GetSize(); i++) {
-    StringMap & aliasMap = (StringMap &)*byAlias.GetAt(i);
-    if (aliasMap.identifier == ep->GetIdentifier())
-      byAlias.RemoveAt(i);
+  // remove prefixes and call signalling addresses belonging to this endpoint
+  {
+    PWaitAndSignal wait(m_indexedKeysMutex);
+    std::map<PString, IndexedKeys>::iterator it = m_indexedKeys.find(ep->GetIdentifier());
+    if (it != m_indexedKeys.end()) {
+      RemoveFromIndexes(it->first, it->second);
+      m_indexedKeys.erase(it);
+    }
   }
 
-  // remove call signalling addresses
-  for (i = 0; i < byAddress.GetSize(); i++) {
-    StringMap & aliasMap = (StringMap &)*byAddress.GetAt(i);
-    if (aliasMap.identifier == ep->GetIdentifier())
-      byAddress.RemoveAt(i);
-  }
+  PWaitAndSignal wait(mutex);
 
 #if OPAL_H501
   // remove the descriptor
@@ -2998,27 +3231,20 @@ void H323GatekeeperServer::RemoveAlias(H323RegisteredEndPoint & ep,
 {
   PTRACE(3, "RAS\tRemoving registered endpoint alias: " << alias);
 
-  mutex.Wait();
+  {
+    PWaitAndSignal wait(m_indexedKeysMutex);
 
-  PINDEX pos = byAlias.GetValuesIndex(alias);
-  if (pos != P_MAX_INDEX) {
-    // Allow for possible multiple aliases
-    while (pos < byAlias.GetSize()) {
-      StringMap & aliasMap = (StringMap &)byAlias[pos];
-      if (aliasMap != alias)
-        break;
+    byAlias.Remove(alias, ep.GetIdentifier());
 
-      if (aliasMap.identifier == ep.GetIdentifier())
-        byAlias.RemoveAt(pos);
-      else
-        pos++;
+    std::map<PString, IndexedKeys>::iterator it = m_indexedKeys.find(ep.GetIdentifier());
+    if (it != m_indexedKeys.end()) {
+      std::vector<PString> & aliases = it->second.m_aliases;
+      aliases.erase(std::remove(aliases.begin(), aliases.end(), alias), aliases.end());
     }
   }
 
   if (ep.ContainsAlias(alias))
     ep.RemoveAlias(alias);
-
-  mutex.Signal();
 }
 
 
@@ -3047,12 +3273,10 @@ PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointByIdentifier(
 PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointBySignalAddresses(
                             const H225_ArrayOf_TransportAddress & addresses, PSafetyMode mode)
 {
-  PWaitAndSignal wait(mutex);
-
   for (PINDEX i = 0; i < addresses.GetSize(); i++) {
-    PINDEX pos = byAddress.GetValuesIndex(H323TransportAddress(addresses[i]));
-    if (pos != P_MAX_INDEX)
-      return FindEndPointByIdentifier(((StringMap &)byAddress[pos]).identifier, mode);
+    PString identifier = byAddress.Find(H323TransportAddress(addresses[i]));
+    if (!identifier.IsEmpty())
+      return FindEndPointByIdentifier(identifier, mode);
   }
 
   return (H323RegisteredEndPoint *)NULL;
@@ -3062,11 +3286,9 @@ PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointBySignalAddre
 PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointBySignalAddress(
                                      const H323TransportAddress & address, PSafetyMode mode)
 {
-  PWaitAndSignal wait(mutex);
-
-  PINDEX pos = byAddress.GetValuesIndex(address);
-  if (pos != P_MAX_INDEX)
-    return FindEndPointByIdentifier(((StringMap &)byAddress[pos]).identifier, mode);
+  PString identifier = byAddress.Find(address);
+  if (!identifier.IsEmpty())
+    return FindEndPointByIdentifier(identifier, mode);
 
   return (H323RegisteredEndPoint *)NULL;
 }
@@ -3082,13 +3304,9 @@ PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointByAliasAddres
 PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointByAliasString(
                                                   const PString & alias, PSafetyMode mode)
 {
-  {
-    PWaitAndSignal wait(mutex);
-    PINDEX pos = byAlias.GetValuesIndex(alias);
-
-    if (pos != P_MAX_INDEX)
-      return FindEndPointByIdentifier(((StringMap &)byAlias[pos]).identifier, mode);
-  }
+  PString identifier = byAlias.Find(alias);
+  if (!identifier.IsEmpty())
+    return FindEndPointByIdentifier(identifier, mode);
 
   return FindEndPointByPrefixString(alias, mode);
 }
@@ -3097,16 +3315,13 @@ PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointByAliasString
 PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointByPartialAlias(
                                                   const PString & alias, PSafetyMode mode)
 {
-  PWaitAndSignal wait(mutex);
-  PINDEX pos = byAlias.GetNextStringsIndex(alias);
-
-  if (pos != P_MAX_INDEX) {
-    StringMap & possible = (StringMap &)byAlias[pos];
-    if (possible.NumCompare(alias) == EqualTo) {
-      PTRACE(4, "RAS\tPartial endpoint search for "
-                "\"" << alias << "\" found \"" << possible << '"');
-      return FindEndPointByIdentifier(possible.identifier, mode);
-    }
+  PString possible;
+  PString identifier = byAlias.FindPartial(alias, possible);
+
+  if (!identifier.IsEmpty()) {
+    PTRACE(4, "RAS\tPartial endpoint search for "
+              "\"" << alias << "\" found \"" << possible << '"');
+    return FindEndPointByIdentifier(identifier, mode);
   }
 
   PTRACE(4, "RAS\tPartial endpoint search for \"" << alias << "\" failed");
@@ -3117,16 +3332,9 @@ PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointByPartialAlia
 PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointByPrefixString(
                                                   const PString & prefix, PSafetyMode mode)
 {
-  PWaitAndSignal wait(mutex);
-
-  if (byVoicePrefix.IsEmpty())
-    return (H323RegisteredEndPoint *)NULL;
-
-  for (PINDEX len = prefix.GetLength(); len > 0; len--) {
-    PINDEX pos = byVoicePrefix.GetValuesIndex(prefix.Left(len));
-    if (pos != P_MAX_INDEX)
-      return FindEndPointByIdentifier(((StringMap &)byVoicePrefix[pos]).identifier, mode);
-  }
+  PString identifier = byVoicePrefix.FindLongest(prefix);
+  if (!identifier.IsEmpty())
+    return FindEndPointByIdentifier(identifier, mode);
 
   return (H323RegisteredEndPoint *)NULL;
 }
@@ -3442,8 +3650,6 @@ PBoolean H323GatekeeperServer::TranslateAliasAddress(const H225_AliasAddress & a
 PBoolean H323GatekeeperServer::TranslateAliasAddressToSignalAddress(const H225_AliasAddress & alias,
                                                                 H323TransportAddress & address)
 {
-  PWaitAndSignal wait(mutex);
-
   PString aliasString = H323GetAliasAddressString(alias);
 
   if (isGatekeeperRouted) {
@@ -3493,8 +3699,6 @@ PBoolean H323GatekeeperServer::CheckAliasAddressPolicy(const H323RegisteredEndPo
                                                    const H225_AdmissionRequest & arq,
                                                    const H225_AliasAddress & alias)
 {
-  PWaitAndSignal wait(mutex);
-
   if (arq.m_answerCall ? canOnlyAnswerRegisteredEP : canOnlyCallRegisteredEP) {
     PSafePtr<H323RegisteredEndPoint> ep = FindEndPointByAliasAddress(alias);
     if (ep == NULL)
@@ -3509,8 +3713,6 @@ PBoolean H323GatekeeperServer::CheckAliasStringPolicy(const H323RegisteredEndPoi
                                                   const H225_AdmissionRequest & arq,
                                                   const PString & alias)
 {
-  PWaitAndSignal wait(mutex);
-
   if (arq.m_answerCall ? canOnlyAnswerRegisteredEP : canOnlyCallRegisteredEP) {
     PSafePtr<H323RegisteredEndPoint> ep = FindEndPointByAliasString(alias);
     if (ep == NULL)
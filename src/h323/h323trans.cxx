@@ -41,6 +41,8 @@
 
 #include <h323/h323ep.h>
 #include <h323/h323pdu.h>
+#include <opal/manager.h>
+#include <opal/strhash.h>
 
 #include <ptclib/random.h>
 
@@ -94,6 +96,8 @@ PBoolean H323TransactionPDU::Read(H323Transport & transport)
     return PFalse;
   }
 
+  receivedAddress = transport.GetLastReceivedAddress();
+
   rawPDU.ResetDecoder();
   PBoolean ok = GetPDU().Decode(rawPDU);
   if (!ok) {
@@ -109,9 +113,8 @@ PBoolean H323TransactionPDU::Read(H323Transport & transport)
 }
 
 
-PBoolean H323TransactionPDU::Write(H323Transport & transport)
+void H323TransactionPDU::EncodePDU(PPER_Stream & strm)
 {
-  PPER_Stream strm;
   GetPDU().Encode(strm);
   strm.CompleteEncoding();
 
@@ -120,6 +123,13 @@ PBoolean H323TransactionPDU::Write(H323Transport & transport)
     iterAuth->Finalise(strm);
 
   H323TraceDumpPDU("Trans", PTrue, strm, GetPDU(), GetChoice(), GetSequenceNumber());
+}
+
+
+PBoolean H323TransactionPDU::Write(H323Transport & transport)
+{
+  PPER_Stream strm;
+  EncodePDU(strm);
 
   if (transport.WritePDU(strm))
     return PTrue;
@@ -131,6 +141,21 @@ PBoolean H323TransactionPDU::Write(H323Transport & transport)
 }
 
 
+PBoolean H323TransactionPDU::WriteTo(H323Transport & transport, const H323TransportAddress & address)
+{
+  PPER_Stream strm;
+  EncodePDU(strm);
+
+  if (transport.WritePDUTo(strm, address))
+    return PTrue;
+
+  PTRACE(1, GetProtocolName() << "\tWrite PDU to " << address << " failed ("
+         << transport.GetErrorNumber(PChannel::LastWriteError)
+         << "): " << transport.GetErrorText(PChannel::LastWriteError));
+  return PFalse;
+}
+
+
 /////////////////////////////////////////////////////////////////////////////////
 
 H323Transactor::H323Transactor(H323EndPoint & ep,
@@ -175,6 +200,8 @@ void H323Transactor::Construct()
   nextSequenceNumber = PRandom::Number()%65536;
   checkResponseCryptoTokens = PTrue;
   lastRequest = NULL;
+  handlerThread = NULL;
+  handlingPDU = NULL;
 
   requests.DisallowDeleteObjects();
 }
@@ -208,7 +235,7 @@ void H323Transactor::PrintOn(ostream & strm) const
 
 PBoolean H323Transactor::SetTransport(const H323TransportAddress & iface)
 {
-  PWaitAndSignal mutex(pduWriteMutex);
+  PWriteWaitAndSignal mutex(pduWriteMutex);
 
   if (transport != NULL && transport->GetLocalAddress().IsEquivalent(iface)) {
     PTRACE(2, "Trans\tAlready have listener for " << iface);
@@ -271,6 +298,8 @@ void H323Transactor::HandleTransactions(PThread &, INT)
 
   transport->SetReadTimeout(PMaxTimeInterval);
 
+  handlerThread = PThread::Current();
+
   PINDEX consecutiveErrors = 0;
 
   PBoolean ok = PTrue;
@@ -280,8 +309,10 @@ void H323Transactor::HandleTransactions(PThread &, INT)
     if (response->Read(*transport)) {
       consecutiveErrors = 0;
       lastRequest = NULL;
+      handlingPDU = response;
       if (HandleTransaction(response->GetPDU()))
         lastRequest->responseHandled.Signal();
+      handlingPDU = NULL;
       if (lastRequest != NULL)
         lastRequest->responseMutex.Signal();
     }
@@ -344,17 +375,18 @@ unsigned H323Transactor::GetNextSequenceNumber()
 
 void H323Transactor::AgeResponses()
 {
-  PTime now;
+  responses.Age();
+}
 
-  PWaitAndSignal mutex(pduWriteMutex);
 
-  for (PINDEX i = 0; i < responses.GetSize(); i++) {
-    const Response & response = responses[i];
-    if ((now - response.lastUsedTime) > response.retirementAge) {
-      PTRACE(4, "Trans\tRemoving cached response: " << response);
-      responses.RemoveAt(i--);
-    }
-  }
+bool H323Transactor::GetRequestAddress(H323TransportAddress & address) const
+{
+  // Anything written by another thread, or not while handling a PDU, is not a reply
+  if (handlerThread != PThread::Current() || handlingPDU == NULL)
+    return false;
+
+  address = handlingPDU->GetReceivedAddress();
+  return !address.IsEmpty();
 }
 
 
@@ -363,16 +395,28 @@ PBoolean H323Transactor::SendCachedResponse(const H323TransactionPDU & pdu)
   if (PAssertNULL(transport) == NULL)
     return PFalse;
 
-  Response key(transport->GetLastReceivedAddress(), pdu.GetSequenceNumber());
+  const H323TransportAddress & address = pdu.GetReceivedAddress();
+  if (address.IsEmpty())
+    return PFalse;
 
-  PWaitAndSignal mutex(pduWriteMutex);
+  PBYTEArray reply;
+  if (!responses.Check(address, pdu.GetSequenceNumber(), reply))
+    return PFalse;
 
-  PINDEX idx = responses.GetValuesIndex(key);
-  if (idx != P_MAX_INDEX)
-    return responses[idx].SendCachedResponse(*transport);
+  if (reply.IsEmpty()) {
+    PTRACE(2, "Trans\tRetry made by remote before sending response: " << address << '#' << pdu.GetSequenceNumber());
+    return PTrue;
+  }
 
-  responses.Append(new Response(key));
-  return PFalse;
+  PTRACE(3, "Trans\tSending cached response: " << address << '#' << pdu.GetSequenceNumber());
+
+  PReadWaitAndSignal mutex(pduWriteMutex);
+  if (!transport->WritePDUTo(reply, address)) {
+    PTRACE(1, "Trans\tWrite of cached response to " << address << " failed: "
+           << transport->GetErrorText(PChannel::LastWriteError));
+  }
+
+  return PTrue;
 }
 
 
@@ -383,14 +427,20 @@ PBoolean H323Transactor::WritePDU(H323TransactionPDU & pdu)
 
   OnSendingPDU(pdu.GetPDU());
 
-  PWaitAndSignal mutex(pduWriteMutex);
+  PReadWaitAndSignal mutex(pduWriteMutex);
+
+  PPER_Stream strm;
+  pdu.EncodePDU(strm);
+
+  H323TransportAddress requestAddress;
+  if (GetRequestAddress(requestAddress))
+    responses.SetReply(requestAddress, pdu.GetSequenceNumber(), strm, pdu.GetRequestInProgressDelay());
 
-  Response key(transport->GetLastReceivedAddress(), pdu.GetSequenceNumber());
-  PINDEX idx = responses.GetValuesIndex(key);
-  if (idx != P_MAX_INDEX)
-    responses[idx].SetPDU(pdu);
+  if (transport->WritePDU(strm))
+    return PTrue;
 
-  return pdu.Write(*transport);
+  PTRACE(1, "Trans\tWrite PDU failed: " << transport->GetErrorText(PChannel::LastWriteError));
+  return PFalse;
 }
 
 
@@ -408,24 +458,71 @@ PBoolean H323Transactor::WriteTo(H323TransactionPDU & pdu,
     return pdu.Write(*transport);
   }
 
-  pduWriteMutex.Wait();
-
-  H323TransportAddress oldAddress = transport->GetRemoteAddress();
+  PReadWaitAndSignal mutex(pduWriteMutex);
 
   PBoolean ok = PFalse;
   for (PINDEX i = 0; i < addresses.GetSize(); i++) {
-    if (transport->SetRemoteAddress(addresses[i])) {
-      PTRACE(3, "Trans\tWrite address set to " << addresses[i]);
-      if (callback)
-        ok = WritePDU(pdu);
-      else
-        ok = pdu.Write(*transport);
-    }
+    PTRACE(3, "Trans\tWriting to " << addresses[i]);
+    if (WritePDUTo(pdu, addresses[i], callback))
+      ok = PTrue;
   }
 
-  transport->SetRemoteAddress(oldAddress);
+  return ok;
+}
+
 
-  pduWriteMutex.Signal();
+PBoolean H323Transactor::WritePDUTo(H323TransactionPDU & pdu,
+                                    const H323TransportAddress & address,
+                                    PBoolean callback)
+{
+  if (!callback)
+    return pdu.WriteTo(*transport, address);
+
+  OnSendingPDU(pdu.GetPDU());
+
+  PPER_Stream strm;
+  pdu.EncodePDU(strm);
+
+  H323TransportAddress requestAddress;
+  if (GetRequestAddress(requestAddress))
+    responses.SetReply(requestAddress, pdu.GetSequenceNumber(), strm, pdu.GetRequestInProgressDelay());
+
+  if (transport->WritePDUTo(strm, address))
+    return PTrue;
+
+  PTRACE(1, "Trans\tWrite PDU to " << address << " failed: " << transport->GetErrorText(PChannel::LastWriteError));
+  return PFalse;
+}
+
+
+PBoolean H323Transactor::WriteReply(H323TransactionPDU & pdu,
+                                    const H323TransportAddressArray & addresses,
+                                    const H323TransportAddress & requestAddress)
+{
+  if (PAssertNULL(transport) == NULL)
+    return PFalse;
+
+  OnSendingPDU(pdu.GetPDU());
+
+  PReadWaitAndSignal mutex(pduWriteMutex);
+
+  PPER_Stream strm;
+  pdu.EncodePDU(strm);
+  responses.SetReply(requestAddress, pdu.GetSequenceNumber(), strm, pdu.GetRequestInProgressDelay());
+
+  if (addresses.IsEmpty())
+    return transport->WritePDUTo(strm, requestAddress);
+
+  PBoolean ok = PFalse;
+  for (PINDEX i = 0; i < addresses.GetSize(); i++) {
+    PTRACE(4, "Trans\tWriting reply to " << addresses[i]);
+    if (transport->WritePDUTo(strm, addresses[i]))
+      ok = PTrue;
+    else {
+      PTRACE(1, "Trans\tWrite reply to " << addresses[i] << " failed: "
+             << transport->GetErrorText(PChannel::LastWriteError));
+    }
+  }
 
   return ok;
 }
@@ -666,53 +763,132 @@ void H323Transactor::Request::OnReceiveRIP(unsigned milliseconds)
 
 /////////////////////////////////////////////////////////////////////////////
 
-H323Transactor::Response::Response(const H323TransportAddress & addr, unsigned seqNum)
-  : PString(addr),
-    retirementAge(ResponseRetirementAge)
+H323Transactor::ResponseCache::ResponseCache()
+  : m_nextAge(0)
 {
-  sprintf("#%u", seqNum);
-  replyPDU = NULL;
 }
 
 
-H323Transactor::Response::~Response()
+H323Transactor::ResponseCache::Shard & H323Transactor::ResponseCache::GetShard(const Key & key)
 {
-  if (replyPDU != NULL)
-    replyPDU->DeletePDU();
+  return m_shards[OpalHashMix(OpalStringHash(key.second), key.first) % NumShards];
 }
 
 
-void H323Transactor::Response::SetPDU(const H323TransactionPDU & pdu)
+static PString MakeResponseCacheAddress(const H323TransportAddress & address)
 {
-  PTRACE(4, "Trans\tAdding cached response: " << *this);
+  // So "ip$" and "udp$" forms of the same peer are the same key
+  PIPSocket::Address ip;
+  WORD port = 0;
+  if (address.GetIpAndPort(ip, port))
+    return ip.AsString(true) + ':' + PString(PString::Unsigned, port);
+  return address;
+}
 
-  if (replyPDU != NULL)
-    replyPDU->DeletePDU();
-  replyPDU = pdu.ClonePDU();
-  lastUsedTime = PTime();
 
-  unsigned delay = pdu.GetRequestInProgressDelay();
-  if (delay > 0)
-    retirementAge = ResponseRetirementAge + delay;
+void H323Transactor::ResponseCache::ScheduleExpiry(Shard & shard, const Key & key, PInt64 expiry)
+{
+  // Round up, so when a bucket falls due everything in it may have expired
+  shard.m_expiries[(expiry+999)/1000].push_back(key);
 }
 
 
-PBoolean H323Transactor::Response::SendCachedResponse(H323Transport & transport)
+bool H323Transactor::ResponseCache::Check(const H323TransportAddress & address,
+                                          unsigned seqNum,
+                                          PBYTEArray & reply)
 {
-  PTRACE(3, "Trans\tSending cached response: " << *this);
-
-  if (replyPDU != NULL) {
-    H323TransportAddress oldAddress = transport.GetRemoteAddress();
-    transport.ConnectTo(Left(FindLast('#')));
-    replyPDU->Write(transport);
-    transport.ConnectTo(oldAddress);
+  Key key(seqNum, MakeResponseCacheAddress(address));
+  Shard & shard = GetShard(key);
+  PInt64 now = PTimer::Tick().GetMilliSeconds();
+
+  PWaitAndSignal mutex(shard.m_mutex);
+
+  EntryMap::iterator it = shard.m_entries.find(key);
+  if (it == shard.m_entries.end()) {
+    Entry & entry = shard.m_entries[key];
+    entry.m_retirementAge = ResponseRetirementAge.GetMilliSeconds();
+    entry.m_expiry = now + entry.m_retirementAge;
+    ScheduleExpiry(shard, key, entry.m_expiry);
+    return false;
   }
-  else {
-    PTRACE(2, "Trans\tRetry made by remote before sending response: " << *this);
+
+  // Expiry is only pushed back, Age() reschedules the entry when it gets to it
+  it->second.m_expiry = now + it->second.m_retirementAge;
+
+  // Copy, rather than share, as it is written outside the mutex
+  reply = PBYTEArray(it->second.m_reply, it->second.m_reply.GetSize());
+  return true;
+}
+
+
+void H323Transactor::ResponseCache::SetReply(const H323TransportAddress & address,
+                                             unsigned seqNum,
+                                             const PBYTEArray & reply,
+                                             unsigned delay)
+{
+  Key key(seqNum, MakeResponseCacheAddress(address));
+  Shard & shard = GetShard(key);
+
+  PWaitAndSignal mutex(shard.m_mutex);
+
+  EntryMap::iterator it = shard.m_entries.find(key);
+  if (it == shard.m_entries.end())
+    return;
+
+  PTRACE(4, "Trans\tAdding cached response: " << key.second << '#' << seqNum);
+
+  Entry & entry = it->second;
+  entry.m_reply = PBYTEArray(reply, reply.GetSize());
+  if (delay > 0)
+    entry.m_retirementAge = ResponseRetirementAge.GetMilliSeconds() + delay;
+  entry.m_expiry = PTimer::Tick().GetMilliSeconds() + entry.m_retirementAge;
+}
+
+
+void H323Transactor::ResponseCache::Age()
+{
+  // Only called from the transactor thread, so no need to protect this
+  PInt64 now = PTimer::Tick().GetMilliSeconds();
+  if (now < m_nextAge)
+    return;
+  m_nextAge = now + 1000;
+
+  PInt64 second = now/1000;
+
+  for (PINDEX i = 0; i < NumShards; ++i) {
+    Shard & shard = m_shards[i];
+    PWaitAndSignal mutex(shard.m_mutex);
+
+    while (!shard.m_expiries.empty() && shard.m_expiries.begin()->first <= second) {
+      std::vector<Key> keys;
+      keys.swap(shard.m_expiries.begin()->second);
+      shard.m_expiries.erase(shard.m_expiries.begin());
+
+      for (std::vector<Key>::iterator key = keys.begin(); key != keys.end(); ++key) {
+        EntryMap::iterator it = shard.m_entries.find(*key);
+        if (it == shard.m_entries.end())
+          continue; // Already removed, and the key reused before this bucket came up
+
+        if (it->second.m_expiry > now)
+          ScheduleExpiry(shard, *key, it->second.m_expiry);
+        else {
+          PTRACE(4, "Trans\tRemoving cached response: " << key->second << '#' << key->first);
+          shard.m_entries.erase(it);
+        }
+      }
+    }
   }
+}
 
-  lastUsedTime = PTime();
-  return PTrue;
+
+PINDEX H323Transactor::ResponseCache::GetSize() const
+{
+  PINDEX size = 0;
+  for (PINDEX i = 0; i < NumShards; ++i) {
+    PWaitAndSignal mutex(m_shards[i].m_mutex);
+    size += m_shards[i].m_entries.size();
+  }
+  return size;
 }
 
 
@@ -723,7 +899,9 @@ H323Transaction::H323Transaction(H323Transactor & trans,
                                  H323TransactionPDU * conf,
                                  H323TransactionPDU * rej)
   : transactor(trans),
-    replyAddresses(trans.GetTransport().GetLastReceivedAddress()),
+    requestAddress(!requestToCopy.GetReceivedAddress().IsEmpty() ? requestToCopy.GetReceivedAddress()
+                                                                 : trans.GetTransport().GetLastReceivedAddress()),
+    replyAddresses(requestAddress),
     request(requestToCopy.ClonePDU())
 {
   confirm = conf;
@@ -770,10 +948,11 @@ PBoolean H323Transaction::HandlePDU()
 
   if (fastResponseRequired) {
     fastResponseRequired = PFalse;
-    PThread::Create(PCREATE_NOTIFIER(SlowHandler), 0,
-                                     PThread::AutoDeleteThread,
-                                     PThread::NormalPriority,
-                                     "Transaction");
+    if (!transactor.GetEndPoint().GetManager().GetWorkScheduler().Post(PCREATE_NOTIFIER(SlowHandler)))
+      PThread::Create(PCREATE_NOTIFIER(SlowHandler), 0,
+                                       PThread::AutoDeleteThread,
+                                       PThread::NormalPriority,
+                                       "Transaction");
   }
 
   return PTrue;
@@ -782,21 +961,21 @@ PBoolean H323Transaction::HandlePDU()
 
 void H323Transaction::SlowHandler(PThread &, INT)
 {
-  PTRACE(4, "Trans\tStarted slow PDU handler thread.");
+  PTRACE(4, "Trans\tStarted slow PDU handler.");
 
   while (HandlePDU())
     ;
 
   delete this;
 
-  PTRACE(4, "Trans\tEnded slow PDU handler thread.");
+  PTRACE(4, "Trans\tEnded slow PDU handler.");
 }
 
 
 PBoolean H323Transaction::WritePDU(H323TransactionPDU & pdu)
 {
   pdu.SetAuthenticators(authenticators);
-  return transactor.WriteTo(pdu, replyAddresses, PTrue);
+  return transactor.WriteReply(pdu, replyAddresses, requestAddress);
 }
 
 
@@ -43,6 +43,7 @@
 #include <h323/h323ep.h>
 #include <h323/h323annexg.h>
 #include <h323/h323pdu.h>
+#include <opal/manager.h>
 
 
 #define new PNEW
@@ -294,7 +295,7 @@ void H323PeerElement::MonitorMain(PThread &, INT)
       }
     }
 
-    // if any descriptor needs updating, then spawn a thread to do it
+    // if any descriptor needs updating, then post a job to do it
     {
       for (PSafePtr<H323PeerElementDescriptor> descriptor = GetFirstDescriptor(PSafeReadOnly); descriptor != NULL; descriptor++) {
         PWaitAndSignal m(localPeerListMutex);
@@ -305,7 +306,9 @@ void H323PeerElement::MonitorMain(PThread &, INT)
               !localServiceOrdinals.Contains(descriptor->creator)
              )
             ) {
-          PThread::Create(PCREATE_NOTIFIER(UpdateAllDescriptors), 0, PThread::AutoDeleteThread, PThread::NormalPriority, "UpdateDescriptors");
+          // Keyed so a slow update is never overlapped by the next one
+          if (!GetEndPoint().GetManager().GetWorkScheduler().Post(PCREATE_NOTIFIER(UpdateAllDescriptors), 0, psprintf("PE:%p", this)))
+            PThread::Create(PCREATE_NOTIFIER(UpdateAllDescriptors), 0, PThread::AutoDeleteThread, PThread::NormalPriority, "UpdateDescriptors");
           break;
         }
       }
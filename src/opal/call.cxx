@@ -471,8 +471,8 @@ PBoolean OpalCall::OpenSourceMediaStreams(OpalConnection & connection,
     if (sinkStream != NULL) {
       startedOne = true;
       if (patch == NULL) {
-        patch = manager.CreateMediaPatch(*sourceStream, sinkStream->RequiresPatchThread(sourceStream) &&
-                                                        sourceStream->RequiresPatchThread(sinkStream));
+        patch = manager.CreateMediaPatch(*sourceStream, *sinkStream, sinkStream->RequiresPatchThread(sourceStream) &&
+                                                                      sourceStream->RequiresPatchThread(sinkStream));
         if (patch == NULL)
           return false;
       }
@@ -586,6 +586,7 @@ void OpalCall::OnReleased(OpalConnection & connection)
   if (connectionsActive.IsEmpty() && manager.activeCalls.Contains(GetToken())) {
     OnCleared();
     manager.activeCalls.RemoveAt(GetToken());
+    manager.QueueGarbageCollection();
   }
 }
 
@@ -355,10 +355,15 @@ void OpalConnection::Release(CallEndReason reason)
       return;
     }
 
-    // Add a reference for the thread we are about to start
+    // Add a reference for the worker we are about to post to
     SafeReference();
   }
 
+  // Keyed on the call so releases for one call are never concurrent
+  if (endpoint.GetManager().GetWorkScheduler().Post(PCREATE_NOTIFIER(OnReleaseThreadMain), 0, GetCall().GetToken()))
+    return;
+
+  // Scheduler is shut down, fall back to a thread of its own
   PThread::Create(PCREATE_NOTIFIER(OnReleaseThreadMain), 0,
                   PThread::AutoDeleteThread,
                   PThread::NormalPriority,
@@ -370,9 +375,9 @@ void OpalConnection::OnReleaseThreadMain(PThread &, INT)
 {
   OnReleased();
 
-  PTRACE(4, "OpalCon\tOnRelease thread completed for " << *this);
+  PTRACE(4, "OpalCon\tOnRelease completed for " << *this);
 
-  // Dereference on the way out of the thread
+  // Dereference on the way out
   SafeDereference();
 }
 
@@ -569,6 +574,7 @@ OpalMediaStreamPtr OpalConnection::OpenMediaStream(const OpalMediaFormat & media
   }
 
   mediaStreams.Remove(stream);
+  endpoint.QueueGarbageCollection(*this);
 
   return NULL;
 }
@@ -605,7 +611,11 @@ PBoolean OpalConnection::RemoveMediaStream(OpalMediaStream & stream)
 {
   stream.Close();
   PTRACE(3, "OpalCon\tRemoved media stream " << stream);
-  return mediaStreams.Remove(&stream);
+  if (!mediaStreams.Remove(&stream))
+    return false;
+
+  endpoint.QueueGarbageCollection(*this);
+  return true;
 }
 
 
@@ -120,6 +120,41 @@ PBoolean OpalEndPoint::GarbageCollection()
 }
 
 
+bool OpalEndPoint::CollectQueuedGarbage()
+{
+  std::set<PString> tokens;
+  m_garbageQueueMutex.Wait();
+  tokens.swap(m_garbageQueuedConnections);
+  m_garbageQueueMutex.Signal();
+
+  std::set<PString> retry;
+  for (std::set<PString>::iterator token = tokens.begin(); token != tokens.end(); ++token) {
+    // If already released, the streams go with the connection
+    PSafePtr<OpalConnection> connection = connectionsActive.FindWithLock(*token, PSafeReference);
+    if (connection != NULL && !connection->GarbageCollection())
+      retry.insert(*token);
+  }
+
+  if (!retry.empty()) {
+    m_garbageQueueMutex.Wait();
+    m_garbageQueuedConnections.insert(retry.begin(), retry.end());
+    m_garbageQueueMutex.Signal();
+  }
+
+  return connectionsActive.DeleteObjectsToBeRemoved() && retry.empty();
+}
+
+
+void OpalEndPoint::QueueGarbageCollection(OpalConnection & connection)
+{
+  m_garbageQueueMutex.Wait();
+  m_garbageQueuedConnections.insert(connection.GetToken());
+  m_garbageQueueMutex.Signal();
+
+  manager.QueueGarbageCollection(*this);
+}
+
+
 PBoolean OpalEndPoint::StartListeners(const PStringArray & listenerAddresses)
 {
   PStringArray interfaces = listenerAddresses;
@@ -473,6 +508,7 @@ void OpalEndPoint::OnReleased(OpalConnection & connection)
 {
   PTRACE(4, "OpalEP\tOnReleased " << connection);
   connectionsActive.RemoveAt(connection.GetToken());
+  manager.QueueGarbageCollection(*this);
   manager.OnReleased(connection);
 }
 
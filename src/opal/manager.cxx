@@ -51,6 +51,10 @@
 #include <h224/h224.h>
 #endif
 
+#if OPAL_RTP_AGGREGATE
+#include <rtp/reactor.h>
+#endif
+
 #include <ptclib/random.h>
 
 #include "../../version.h"
@@ -158,13 +162,20 @@ OpalManager::OpalManager()
   , mediaFormatOrder(PARRAYSIZE(DefaultMediaFormatOrder), DefaultMediaFormatOrder)
   , disableDetectInBandDTMF(false)
   , noMediaTimeout(0, 0, 5)     // Minutes
+  , m_silenceDetectWorker(NULL)
+  , m_silenceDetectBatching(false)
   , translationAddress(0)       // Invalid address to disable
   , stun(NULL)
   , interfaceMonitor(NULL)
   , activeCalls(*this)
+  , garbageCollectStop(false)
+  , m_garbageQueuedCalls(false)
 #ifdef OPAL_ZRTP
   , zrtpEnabled(false)
 #endif
+#if OPAL_RTP_AGGREGATE
+  , m_rtpReactor(NULL)
+#endif
 {
   m_recordManager = new OpalWAVRecordManager();
 
@@ -211,8 +222,12 @@ OpalManager::~OpalManager()
 {
   ShutDownEndpoints();
 
+  // Run any jobs still queued, e.g. OnReleased() for the last calls
+  m_workScheduler.Shutdown();
+
   // Shut down the cleaner thread
-  garbageCollectExit.Signal();
+  garbageCollectStop = true;
+  garbageCollectSignal.Signal();
   garbageCollector->WaitForTermination();
 
   // Clean up any calls that the cleaner thread missed on the way out
@@ -220,6 +235,14 @@ OpalManager::~OpalManager()
 
   delete garbageCollector;
 
+#if OPAL_RTP_AGGREGATE
+  // All RTP sessions are gone with the calls, so safe to stop the threads
+  delete m_rtpReactor;
+#endif
+
+  // Likewise the silence detectors that used the worker
+  delete m_silenceDetectWorker;
+
   delete stun;
   delete m_recordManager;
   delete interfaceMonitor;
@@ -808,6 +831,21 @@ OpalMediaPatch * OpalManager::CreateMediaPatch(OpalMediaStream & source,
 }
 
 
+OpalMediaPatch * OpalManager::CreateMediaPatch(OpalMediaStream & source,
+                                               OpalMediaStream & sink,
+                                               PBoolean requiresPatchThread)
+{
+#if OPAL_RTP_AGGREGATE
+  if (requiresPatchThread &&
+      !source.GetConnection().GetCall().IsRecording() &&
+      OpalRelayMediaPatch::CanRelay(source, sink))
+    return new OpalRelayMediaPatch(source);
+#endif
+
+  return CreateMediaPatch(source, requiresPatchThread);
+}
+
+
 void OpalManager::DestroyMediaPatch(OpalMediaPatch * patch)
 {
   delete patch;
@@ -878,16 +916,7 @@ OpalManager::RouteEntry::RouteEntry(const PString & pat, const PString & dest)
   : pattern(pat),
     destination(dest)
 {
-  PString adjustedPattern = '^';
-
-  // Test for backward compatibility format
-  PINDEX colon = pattern.Find(':');
-  if (colon != P_MAX_INDEX && pattern.Find('\t', colon) == P_MAX_INDEX)
-    adjustedPattern += pattern.Left(colon+1) + ".*\t" + pattern.Mid(colon+1);
-  else
-    adjustedPattern += pattern;
-
-  adjustedPattern += '$';
+  PString adjustedPattern = OpalCompiledRouteTable::GetRegularExpression(pattern);
 
   if (!regex.Compile(adjustedPattern, PRegularExpression::IgnoreCase|PRegularExpression::Extended)) {
     PTRACE(1, "OpalMan\tCould not compile route regular expression \"" << adjustedPattern << '"');
@@ -939,6 +968,9 @@ PBoolean OpalManager::AddRouteEntry(const PString & spec)
   PTRACE(4, "OpalMan\tAdded route \"" << *entry << '"');
   routeTableMutex.Wait();
   routeTable.Append(entry);
+  m_compiledRouteTableMutex.Wait();
+  m_compiledRouteTable = OpalCompiledRouteTablePtr();
+  m_compiledRouteTableMutex.Signal();
   routeTableMutex.Signal();
   return true;
 }
@@ -956,6 +988,8 @@ PBoolean OpalManager::SetRouteTable(const PStringArray & specs)
       ok = true;
   }
 
+  CompileRouteTable();
+
   routeTableMutex.Signal();
 
   return ok;
@@ -967,10 +1001,37 @@ void OpalManager::SetRouteTable(const RouteTable & table)
   routeTableMutex.Wait();
   routeTable = table;
   routeTable.MakeUnique();
+  CompileRouteTable();
   routeTableMutex.Signal();
 }
 
 
+OpalCompiledRouteTablePtr OpalManager::CompileRouteTable()
+{
+  PWaitAndSignal mutex(routeTableMutex);
+
+  OpalCompiledRouteTable * table = new OpalCompiledRouteTable;
+  for (PINDEX i = 0; i < routeTable.GetSize(); i++) {
+    if (!table->Append(routeTable[i].pattern, routeTable[i].destination)) {
+      PTRACE(2, "OpalMan\tRemoved route \"" << routeTable[i] << "\", could not be compiled");
+      routeTable.RemoveAt(i--);
+    }
+  }
+
+  PTRACE(4, "OpalMan\tCompiled route table: "
+         << table->GetKindCount(OpalCompiledRouteTable::PrefixEntry) << " prefix, "
+         << table->GetKindCount(OpalCompiledRouteTable::SchemeEntry) << " scheme, "
+         << table->GetKindCount(OpalCompiledRouteTable::WildcardEntry) << " wildcard, "
+         << table->GetKindCount(OpalCompiledRouteTable::RegexEntry) << " regex entries");
+
+  OpalCompiledRouteTablePtr compiled(table);
+  m_compiledRouteTableMutex.Wait();
+  m_compiledRouteTable = compiled;
+  m_compiledRouteTableMutex.Signal();
+  return compiled;
+}
+
+
 static void ReplaceNDU(PString & destination, const PString & subst)
 {
   if (subst.Find('@') != P_MAX_INDEX) {
@@ -987,9 +1048,16 @@ static void ReplaceNDU(PString & destination, const PString & subst)
 
 PString OpalManager::ApplyRouteTable(const PString & a_party, const PString & b_party, PINDEX & routeIndex)
 {
-  PWaitAndSignal mutex(routeTableMutex);
+  // Searching is done on a reference to the compiled table, without any lock
+  m_compiledRouteTableMutex.Wait();
+  OpalCompiledRouteTablePtr compiled = m_compiledRouteTable;
+  m_compiledRouteTableMutex.Signal();
 
-  if (routeTable.IsEmpty())
+  if (compiled.IsNULL())
+    compiled = CompileRouteTable();
+
+  const OpalCompiledRouteTable & table = *compiled;
+  if (table.IsEmpty())
     return routeIndex++ == 0 ? b_party : PString::Empty();
 
   PString search = a_party + '\t' + b_party;
@@ -1017,19 +1085,16 @@ PString OpalManager::ApplyRouteTable(const PString & a_party, const PString & b_
    */
 
   PString destination;
-  while (routeIndex < routeTable.GetSize()) {
-    RouteEntry & entry = routeTable[routeIndex++];
-    PINDEX pos;
-    if (entry.regex.Execute(search, pos)) {
-      if (entry.destination.NumCompare("label:") != EqualTo) {
-        destination = entry.destination;
-        break;
-      }
-
-      // restart search in table using label.
-      search = entry.destination;
-      routeIndex = 0;
+  PString found;
+  while (table.Find(search, routeIndex, found)) {
+    if (found.NumCompare("label:") != EqualTo) {
+      destination = found;
+      break;
     }
+
+    // restart search in table using label.
+    search = found;
+    routeIndex = 0;
   }
 
   // No route found
@@ -1424,6 +1489,62 @@ WORD OpalManager::GetRtpIpPortPair()
 }
 
 
+void OpalManager::SetSilenceDetectBatching(bool enable)
+{
+  PWaitAndSignal mutex(m_silenceDetectMutex);
+
+  /* The worker is kept until the manager goes, as detectors of existing
+     connections may still be using it. */
+  if (enable && m_silenceDetectWorker == NULL)
+    m_silenceDetectWorker = new OpalSilenceDetectorWorker;
+  m_silenceDetectBatching = enable;
+
+  PTRACE(3, "OpalMan\tSilence detect batching " << (enable ? "enabled" : "disabled"));
+}
+
+
+OpalSilenceDetectorWorker * OpalManager::GetSilenceDetectWorker() const
+{
+  PWaitAndSignal mutex(m_silenceDetectMutex);
+  return m_silenceDetectBatching ? m_silenceDetectWorker : NULL;
+}
+
+
+#if OPAL_RTP_AGGREGATE
+
+unsigned OpalManager::GetRTPReactorThreads() const
+{
+  return m_rtpReactor != NULL ? m_rtpReactor->GetThreadCount() : 0;
+}
+
+
+bool OpalManager::SetRTPReactorThreads(unsigned count)
+{
+  PWaitAndSignal mutex(m_rtpReactorMutex);
+
+  if (m_rtpReactor != NULL) {
+    if (m_rtpReactor->GetThreadCount() == count)
+      return true;
+
+    if (m_rtpReactor->GetSessionCount() > 0) {
+      PTRACE(2, "OpalMan\tCannot change RTP reactor threads while sessions are active.");
+      return false;
+    }
+
+    delete m_rtpReactor;
+    m_rtpReactor = NULL;
+  }
+
+  if (count > 0)
+    m_rtpReactor = new RTP_Reactor(count);
+
+  PTRACE(3, "OpalMan\tRTP reactor threads set to " << count);
+  return true;
+}
+
+#endif // OPAL_RTP_AGGREGATE
+
+
 void OpalManager::SetAudioJitterDelay(unsigned minDelay, unsigned maxDelay)
 {
   if (minDelay == 0) {
@@ -1541,10 +1662,99 @@ void OpalManager::CallDict::DeleteObject(PObject * object) const
 }
 
 
+void OpalManager::QueueGarbageCollection()
+{
+  m_garbageQueueMutex.Wait();
+  m_garbageQueuedCalls = true;
+  m_garbageQueueMutex.Signal();
+
+  garbageCollectSignal.Signal();
+}
+
+
+void OpalManager::QueueGarbageCollection(OpalEndPoint & endpoint)
+{
+  m_garbageQueueMutex.Wait();
+  m_garbageQueuedEndPoints.insert(&endpoint);
+  m_garbageQueueMutex.Signal();
+
+  garbageCollectSignal.Signal();
+}
+
+
+bool OpalManager::CollectQueuedGarbage()
+{
+  bool calls;
+  std::set<OpalEndPoint *> endpoints;
+
+  m_garbageQueueMutex.Wait();
+  calls = m_garbageQueuedCalls;
+  m_garbageQueuedCalls = false;
+  endpoints.swap(m_garbageQueuedEndPoints);
+  m_garbageQueueMutex.Signal();
+
+  if (!calls && endpoints.empty())
+    return true;
+
+  std::set<OpalEndPoint *> retry;
+
+  /* Endpoints first, as a connection holds a reference to its call until
+     it is deleted. An endpoint may have been detached since being queued. */
+  endpointsMutex.StartRead();
+  for (std::set<OpalEndPoint *>::iterator ep = endpoints.begin(); ep != endpoints.end(); ++ep) {
+    if (endpointList.GetObjectsIndex(*ep) != P_MAX_INDEX && !(*ep)->CollectQueuedGarbage())
+      retry.insert(*ep);
+  }
+  endpointsMutex.EndRead();
+
+  bool callsCleared = !calls || activeCalls.DeleteObjectsToBeRemoved();
+
+  if (callsCleared && retry.empty()) {
+    if (calls && m_clearingAllCallsCount != 0 && activeCalls.IsEmpty())
+      m_allCallsCleared.Signal();
+    return true;
+  }
+
+  // Something is still referenced, put it back for the next pass
+  m_garbageQueueMutex.Wait();
+  if (!callsCleared)
+    m_garbageQueuedCalls = true;
+  m_garbageQueuedEndPoints.insert(retry.begin(), retry.end());
+  m_garbageQueueMutex.Signal();
+
+  return false;
+}
+
+
+static const unsigned GarbageSweepInterval = 1000; // milliseconds
+static const unsigned GarbageRetryInterval = 20;   // milliseconds
+
 void OpalManager::GarbageMain(PThread &, INT)
 {
-  while (!garbageCollectExit.Wait(1000))
-    GarbageCollection();
+  PTimeInterval nextSweep = PTimer::Tick() + GarbageSweepInterval;
+  bool pending = false;
+
+  while (!garbageCollectStop) {
+    /* Wait to be queued something, but if what was queued is still
+       referenced, try again shortly as the last reference usually goes
+       as soon as the thread releasing it has finished. */
+    PTimeInterval timeout = nextSweep - PTimer::Tick();
+    if (pending && timeout > GarbageRetryInterval)
+      timeout = GarbageRetryInterval;
+    if (timeout > 0)
+      garbageCollectSignal.Wait(timeout);
+
+    if (garbageCollectStop)
+      break;
+
+    pending = !CollectQueuedGarbage();
+
+    // Sweep everything occasionally, in case something was not queued
+    if (PTimer::Tick() >= nextSweep) {
+      GarbageCollection();
+      nextSweep = PTimer::Tick() + GarbageSweepInterval;
+    }
+  }
 }
 
 void OpalManager::OnNewConnection(OpalConnection & /*conn*/)
@@ -1682,13 +1892,14 @@ PBoolean OpalWAVRecordManager::Mixer_T::OnWriteAudio(const MixerFrame & mixerFra
   if (!m_file.IsOpen())
     return false;
 
-  OpalAudioMixerStream::StreamFrame frame;
   if (m_mono)
-    mixerFrame.GetMixedFrame(frame);
-  else
-    mixerFrame.GetStereoFrame(frame);
-  m_file.Write(frame.GetPointerAndLock(), frame.GetSize());
-  frame.Unlock();
+    m_file.Write(mixerFrame.GetMixedSamples(), mixerFrame.GetFrameLength()*sizeof(short));
+  else {
+    m_stereo.resize(mixerFrame.GetFrameLength()*2);
+    if (!mixerFrame.GetStereoSamples(&m_stereo[0]))
+      memset(&m_stereo[0], 0, m_stereo.size()*sizeof(short));
+    m_file.Write(&m_stereo[0], m_stereo.size()*sizeof(short));
+  }
 
   return true;
 }
@@ -39,11 +39,16 @@
 
 #include <opal/mediafmt.h>
 #include <opal/mediacmd.h>
+#include <opal/strhash.h>
 #include <codec/opalplugin.h>
 #include <codec/opalwavfile.h>
 #include <ptlib/videoio.h>
 #include <ptclib/cypher.h>
 
+#include <algorithm>
+#include <map>
+#include <set>
+
 
 #define new PNEW
 
@@ -179,6 +184,212 @@ static PMutex & GetMediaFormatsListMutex()
 }
 
 
+// Protected by GetMediaFormatsListMutex()
+static unsigned MediaFormatsListSequence;
+
+
+/**Read only copy of the registered media formats, indexed for the searches
+   made when a media format is constructed. It is built again after a format
+   is registered or changed and replaced as a whole, so any number of threads
+   may search it without holding GetMediaFormatsListMutex().
+
+   The copies share the internals of the registered formats, so a registered
+   format being changed directly, rather than by SetRegisteredMediaFormat(),
+   is seen by OpalMediaFormat::CloneContents() as it stops sharing, which
+   discards the snapshot.
+  */
+class OpalMediaFormatRegistrySnapshot : public PSmartObject
+{
+  PCLASSINFO(OpalMediaFormatRegistrySnapshot, PSmartObject);
+  public:
+    OpalMediaFormatRegistrySnapshot(const OpalMediaFormatList & registeredFormats, unsigned sequence)
+      : m_sequence(sequence)
+    {
+      for (OpalMediaFormatList::const_iterator format = registeredFormats.begin(); format != registeredFormats.end(); ++format) {
+        PINDEX index = m_entries.size();
+
+        OpalMediaFormat * copy = (OpalMediaFormat *)format->Clone();
+        m_formats.OpalMediaFormatBaseList::Append(copy);
+
+        Entry entry;
+        entry.m_format = copy;
+        entry.m_name = format->GetName();
+        entry.m_encodingName = format->GetEncodingName();
+        entry.m_clockRate = format->GetClockRate();
+        m_entries.push_back(entry);
+
+        // First registered wins, as with a search of the list
+        if (FindName(entry.m_name) == NULL)
+          m_byName.insert(HashIndex::value_type(OpalStringHash(entry.m_name, true), index));
+
+        if (!entry.m_encodingName.IsEmpty())
+          m_byEncodingName.insert(HashIndex::value_type(OpalStringHash(entry.m_encodingName, true), index));
+
+        RTP_DataFrame::PayloadTypes pt = format->GetPayloadType();
+        if (pt < RTP_DataFrame::DynamicBase)
+          m_byPayloadType[pt].push_back(index);
+      }
+
+      PTRACE(4, "MediaFormat\tBuilt registered media format snapshot " << sequence << " of " << m_entries.size() << " formats");
+    }
+
+
+    /**Equivalent to OpalMediaFormatList::FindFormat() with a name that has
+       no wildcard characters.
+      */
+    const OpalMediaFormat * FindName(const PString & name) const
+    {
+      DWORD hash = OpalStringHash(name, true);
+      for (HashIndex::const_iterator it = m_byName.lower_bound(hash); it != m_byName.end() && it->first == hash; ++it) {
+        if (m_entries[it->second].m_name == name)
+          return m_entries[it->second].m_format;
+      }
+      return NULL;
+    }
+
+
+    /**Equivalent to OpalMediaFormatList::FindFormat() with a payload type.
+      */
+    const OpalMediaFormat * FindPayloadType(RTP_DataFrame::PayloadTypes pt, unsigned clockRate, const char * name, const char * protocol) const
+    {
+      // Encoding name first, regardless of payload type, same as searching the list
+      if (name != NULL && *name != '\0') {
+        DWORD hash = OpalStringHash(name, true);
+        for (HashIndex::const_iterator it = m_byEncodingName.lower_bound(hash); it != m_byEncodingName.end() && it->first == hash; ++it) {
+          const Entry & entry = m_entries[it->second];
+          if (strcasecmp(entry.m_encodingName, name) == 0 && IsMatch(entry, clockRate, protocol))
+            return entry.m_format;
+        }
+      }
+
+      if (pt < RTP_DataFrame::DynamicBase) {
+        for (std::vector<PINDEX>::const_iterator it = m_byPayloadType[pt].begin(); it != m_byPayloadType[pt].end(); ++it) {
+          const Entry & entry = m_entries[*it];
+          if (IsMatch(entry, clockRate, protocol))
+            return entry.m_format;
+        }
+      }
+
+      return NULL;
+    }
+
+
+    const OpalMediaFormatList & GetFormats() const { return m_formats; }
+    PINDEX GetSize() const { return m_entries.size(); }
+    unsigned GetSequence() const { return m_sequence; }
+
+  protected:
+    struct Entry
+    {
+      const OpalMediaFormat * m_format;
+      PCaselessString         m_name;
+      PString                 m_encodingName;
+      unsigned                m_clockRate;
+    };
+
+    static bool IsMatch(const Entry & entry, unsigned clockRate, const char * protocol)
+    {
+      return (clockRate == 0    || clockRate == entry.m_clockRate) &&
+             (protocol  == NULL || entry.m_format->IsValidForProtocol(protocol));
+    }
+
+    typedef std::multimap<DWORD, PINDEX> HashIndex;
+
+    OpalMediaFormatList  m_formats;
+    std::vector<Entry>   m_entries;
+    HashIndex            m_byName;
+    HashIndex            m_byEncodingName;
+    std::vector<PINDEX>  m_byPayloadType[RTP_DataFrame::DynamicBase];
+    unsigned             m_sequence;
+
+  private:
+    OpalMediaFormatRegistrySnapshot(const OpalMediaFormatRegistrySnapshot &) { }
+    void operator=(const OpalMediaFormatRegistrySnapshot &) { }
+};
+
+
+static PMutex & GetMediaFormatsSnapshotMutex()
+{
+  static PMutex mutex;
+  return mutex;
+}
+
+
+// Protected by GetMediaFormatsSnapshotMutex(), only held to copy the pointer
+static PSmartPointer & GetMediaFormatsSnapshotPointer()
+{
+  static PSmartPointer snapshot;
+  return snapshot;
+}
+
+
+// Protected by GetMediaFormatsSnapshotMutex(), the objects in the master list
+static std::set<const OpalMediaFormat *> & GetRegisteredMediaFormatObjects()
+{
+  static std::set<const OpalMediaFormat *> objects;
+  return objects;
+}
+
+
+// Protected by GetMediaFormatsSnapshotMutex(), changes made directly to registered formats
+static unsigned RegisteredFormatChanges;
+
+
+// Must be called with GetMediaFormatsListMutex() held, after any change
+static void InvalidateMediaFormatsSnapshot()
+{
+  PWaitAndSignal mutex(GetMediaFormatsSnapshotMutex());
+  GetMediaFormatsSnapshotPointer() = NULL;
+}
+
+
+/* Called with the format's own mutex held, so must not take the list mutex,
+   which is held while building a snapshot and taking each format's mutex. */
+static void RegisteredMediaFormatChanging(const OpalMediaFormat * format)
+{
+  PWaitAndSignal mutex(GetMediaFormatsSnapshotMutex());
+  if (GetRegisteredMediaFormatObjects().find(format) == GetRegisteredMediaFormatObjects().end())
+    return;
+
+  ++RegisteredFormatChanges;
+  GetMediaFormatsSnapshotPointer() = NULL;
+}
+
+
+static PSmartPointer GetMediaFormatsSnapshot()
+{
+  {
+    PWaitAndSignal mutex(GetMediaFormatsSnapshotMutex());
+    if (!GetMediaFormatsSnapshotPointer().IsNULL())
+      return GetMediaFormatsSnapshotPointer();
+  }
+
+  /* Built under the list mutex, which every change holds while invalidating,
+     so a snapshot of an older list can never be published over a newer one. */
+  PWaitAndSignal mutex(GetMediaFormatsListMutex());
+
+  for (;;) {
+    unsigned changes;
+    {
+      PWaitAndSignal mutex(GetMediaFormatsSnapshotMutex());
+      if (!GetMediaFormatsSnapshotPointer().IsNULL())
+        return GetMediaFormatsSnapshotPointer();
+      changes = RegisteredFormatChanges;
+    }
+
+    PSmartPointer snapshot = new OpalMediaFormatRegistrySnapshot(GetMediaFormatsList(), MediaFormatsListSequence+changes);
+
+    /* A registered format changed directly does not hold the list mutex, so
+       may have done so while this was being built, if so build it again. */
+    PWaitAndSignal mutex2(GetMediaFormatsSnapshotMutex());
+    if (changes == RegisteredFormatChanges) {
+      GetMediaFormatsSnapshotPointer() = snapshot;
+      return snapshot;
+    }
+  }
+}
+
+
 static void Clamp(OpalMediaFormatInternal & fmt1, const OpalMediaFormatInternal & fmt2, const PString & variableOption, const PString & minOption, const PString & maxOption)
 {
   if (fmt1.FindOption(variableOption) == NULL)
@@ -198,10 +409,87 @@ static void Clamp(OpalMediaFormatInternal & fmt1, const OpalMediaFormatInternal
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+
+/* Option names are interned when an option of that name is first created,
+   and never removed, so there are only ever as many as there are distinct
+   option names in the codecs loaded. Once the codecs are loaded all that is
+   done is looking up names, so these only share a read lock. */
+
+class OpalMediaOptionKeyRegistry
+{
+  public:
+    OpalMediaOptionKeyRegistry()
+    {
+      m_names.push_back(PCaselessString()); // Zero is the invalid key
+    }
+
+    unsigned Find(const PString & name, bool add)
+    {
+      DWORD hash = OpalStringHash(name, true);
+
+      {
+        PReadWaitAndSignal mutex(m_mutex);
+        unsigned id = Lookup(hash, name);
+        if (id != 0 || !add)
+          return id;
+      }
+
+      PWriteWaitAndSignal mutex(m_mutex);
+
+      // May have been added while not locked
+      unsigned id = Lookup(hash, name);
+      if (id != 0)
+        return id;
+
+      id = m_names.size();
+      m_names.push_back(name);
+      m_ids.insert(std::pair<DWORD, unsigned>(hash, id));
+      return id;
+    }
+
+  protected:
+    unsigned Lookup(DWORD hash, const PString & name) const
+    {
+      for (std::multimap<DWORD, unsigned>::const_iterator it = m_ids.lower_bound(hash); it != m_ids.end() && it->first == hash; ++it) {
+        if (m_names[it->second] == name)
+          return it->second;
+      }
+      return 0;
+    }
+
+    PReadWriteMutex                m_mutex;
+    std::multimap<DWORD, unsigned> m_ids;
+    std::vector<PCaselessString>   m_names;
+};
+
+
+static OpalMediaOptionKeyRegistry & GetMediaOptionKeyRegistry()
+{
+  static OpalMediaOptionKeyRegistry registry;
+  return registry;
+}
+
+
+OpalMediaOptionKey::OpalMediaOptionKey(const PString & name)
+  : m_id(GetMediaOptionKeyRegistry().Find(name, true))
+{
+}
+
+
+OpalMediaOptionKey OpalMediaOptionKey::Find(const PString & name)
+{
+  OpalMediaOptionKey key;
+  key.m_id = GetMediaOptionKeyRegistry().Find(name, false);
+  return key;
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 
 OpalMediaOption::OpalMediaOption(const PString & name)
   : m_name(name)
+  , m_key(name)
   , m_readOnly(false)
   , m_merge(NoMerge)
 {
@@ -214,6 +502,7 @@ OpalMediaOption::OpalMediaOption(const char * name, bool readOnly, MergeType mer
   , m_merge(merge)
 {
   m_name.Replace("=", "_", true);
+  m_key = OpalMediaOptionKey(m_name);
 }
 
 
@@ -632,6 +921,12 @@ const PString & OpalMediaFormat::ClockRateOption()     { static PString s = PLUG
 const PString & OpalMediaFormat::MaxBitRateOption()    { static PString s = PLUGINCODEC_OPTION_MAX_BIT_RATE;    return s; }
 const PString & OpalMediaFormat::TargetBitRateOption() { static PString s = PLUGINCODEC_OPTION_TARGET_BIT_RATE; return s; }
 
+const OpalMediaOptionKey & OpalMediaFormat::NeedsJitterKey()  { static OpalMediaOptionKey k(NeedsJitterOption());  return k; }
+const OpalMediaOptionKey & OpalMediaFormat::MaxFrameSizeKey() { static OpalMediaOptionKey k(MaxFrameSizeOption()); return k; }
+const OpalMediaOptionKey & OpalMediaFormat::FrameTimeKey()    { static OpalMediaOptionKey k(FrameTimeOption());    return k; }
+const OpalMediaOptionKey & OpalMediaFormat::ClockRateKey()    { static OpalMediaOptionKey k(ClockRateOption());    return k; }
+const OpalMediaOptionKey & OpalMediaFormat::MaxBitRateKey()   { static OpalMediaOptionKey k(MaxBitRateOption());   return k; }
+
 #if OPAL_H323
 const PString & OpalMediaFormat::MediaPacketizationOption()  { static PString s = PLUGINCODEC_MEDIA_PACKETIZATION;  return s; }
 const PString & OpalMediaFormat::MediaPacketizationsOption() { static PString s = PLUGINCODEC_MEDIA_PACKETIZATIONS; return s; }
@@ -650,11 +945,9 @@ OpalMediaFormat::OpalMediaFormat(OpalMediaFormatInternal * info)
 OpalMediaFormat::OpalMediaFormat(RTP_DataFrame::PayloadTypes pt, unsigned clockRate, const char * name, const char * protocol)
   : m_info(NULL)
 {
-  PWaitAndSignal mutex(GetMediaFormatsListMutex());
-  const OpalMediaFormatList & registeredFormats = GetMediaFormatsList();
-
-  OpalMediaFormatList::const_iterator fmt = registeredFormats.FindFormat(pt, clockRate, name, protocol);
-  if (fmt != registeredFormats.end())
+  PSmartPointer snapshot = GetMediaFormatsSnapshot();
+  const OpalMediaFormat * fmt = ((const OpalMediaFormatRegistrySnapshot *)snapshot.GetObject())->FindPayloadType(pt, clockRate, name, protocol);
+  if (fmt != NULL)
     *this = *fmt;
 }
 
@@ -704,6 +997,11 @@ void OpalMediaFormat::Construct(OpalMediaFormatInternal * info)
   else {
     m_info = info;
     registeredFormats.OpalMediaFormatBaseList::Append(this);
+    ++MediaFormatsListSequence;
+    InvalidateMediaFormatsSnapshot();
+
+    PWaitAndSignal mutex2(GetMediaFormatsSnapshotMutex());
+    GetRegisteredMediaFormatObjects().insert(this);
   }
 }
 
@@ -712,13 +1010,11 @@ OpalMediaFormat & OpalMediaFormat::operator=(RTP_DataFrame::PayloadTypes pt)
 {
   PWaitAndSignal m(_mutex);
 
-  PWaitAndSignal mutex(GetMediaFormatsListMutex());
-  const OpalMediaFormatList & registeredFormats = GetMediaFormatsList();
-
-  OpalMediaFormatList::const_iterator fmt = registeredFormats.FindFormat(pt);
-  if (fmt == registeredFormats.end())
+  PSmartPointer snapshot = GetMediaFormatsSnapshot();
+  const OpalMediaFormat * fmt = ((const OpalMediaFormatRegistrySnapshot *)snapshot.GetObject())->FindPayloadType(pt, 0, NULL, NULL);
+  if (fmt == NULL)
     *this = OpalMediaFormat();
-  else if (this != &*fmt)
+  else
     *this = *fmt;
 
   return *this;
@@ -735,11 +1031,20 @@ OpalMediaFormat & OpalMediaFormat::operator=(const char * wildcard)
 OpalMediaFormat & OpalMediaFormat::operator=(const PString & wildcard)
 {
   PWaitAndSignal m(_mutex);
-  PWaitAndSignal mutex(GetMediaFormatsListMutex());
-  const OpalMediaFormatList & registeredFormats = GetMediaFormatsList();
 
-  OpalMediaFormatList::const_iterator fmt = registeredFormats.FindFormat(wildcard);
-  if (fmt == registeredFormats.end())
+  PSmartPointer snapshot = GetMediaFormatsSnapshot();
+  const OpalMediaFormatRegistrySnapshot & registeredFormats = *(const OpalMediaFormatRegistrySnapshot *)snapshot.GetObject();
+
+  // Plain names, by far the most common, are found in the index
+  const OpalMediaFormat * fmt;
+  if (wildcard.IsEmpty() || wildcard[0] == '!' || wildcard[0] == '@' || wildcard.Find('*') != P_MAX_INDEX) {
+    OpalMediaFormatList::const_iterator iter = registeredFormats.GetFormats().FindFormat(wildcard);
+    fmt = iter != registeredFormats.GetFormats().end() ? &*iter : NULL;
+  }
+  else
+    fmt = registeredFormats.FindName(wildcard);
+
+  if (fmt == NULL)
     *this = OpalMediaFormat();
   else
     *this = *fmt;
@@ -753,7 +1058,10 @@ void OpalMediaFormat::CloneContents(const OpalMediaFormat * c)
   PWaitAndSignal m(_mutex);
 
   m_info = (OpalMediaFormatInternal *)c->m_info->Clone();
-  m_info->options.MakeUnique();
+
+  // From MakeUnique() before a change, the snapshot may share the old internal
+  if (c == this)
+    RegisteredMediaFormatChanging(this);
 }
 
 
@@ -842,11 +1150,24 @@ OpalMediaFormatList OpalMediaFormat::GetAllRegisteredMediaFormats()
 
 void OpalMediaFormat::GetAllRegisteredMediaFormats(OpalMediaFormatList & copy)
 {
-  PWaitAndSignal mutex(GetMediaFormatsListMutex());
-  const OpalMediaFormatList & registeredFormats = GetMediaFormatsList();
+  PSmartPointer snapshot = GetMediaFormatsSnapshot();
+  const OpalMediaFormatList & registeredFormats = ((const OpalMediaFormatRegistrySnapshot *)snapshot.GetObject())->GetFormats();
 
-  for (OpalMediaFormatList::const_iterator format = registeredFormats.begin(); format != registeredFormats.end(); ++format)
-    copy += *format;
+  // Registered formats are already unique, so only need checking against what was there
+  bool wasEmpty = copy.IsEmpty();
+  for (OpalMediaFormatList::const_iterator format = registeredFormats.begin(); format != registeredFormats.end(); ++format) {
+    if (!wasEmpty)
+      copy += *format;
+    else if (format->IsValid())
+      copy.OpalMediaFormatBaseList::Append(format->Clone());
+  }
+}
+
+
+unsigned OpalMediaFormat::GetRegistrationSequence()
+{
+  PSmartPointer snapshot = GetMediaFormatsSnapshot();
+  return ((const OpalMediaFormatRegistrySnapshot *)snapshot.GetObject())->GetSequence();
 }
 
 
@@ -862,6 +1183,8 @@ bool OpalMediaFormat::SetRegisteredMediaFormat(const OpalMediaFormat & mediaForm
          is really happening is the above only compares the name, and below
          copies all of the attributes (OpalMediaFormatOtions) across. */
       *format = mediaFormat;
+      ++MediaFormatsListSequence;
+      InvalidateMediaFormatsSnapshot();
       return true;
     }
   }
@@ -945,6 +1268,23 @@ OpalMediaFormatInternal::OpalMediaFormatInternal(const char * fullName,
   }
 
   match->SetPayloadType((RTP_DataFrame::PayloadTypes)nextUnused);
+  InvalidateMediaFormatsSnapshot();
+}
+
+
+OpalMediaFormatInternal::OpalMediaFormatInternal(const OpalMediaFormatInternal & other)
+  : PObject(other)
+  , formatName(other.formatName)
+  , rtpPayloadType(other.rtpPayloadType)
+  , rtpEncodingName(other.rtpEncodingName)
+  , mediaType(other.mediaType)
+  , options(other.options)
+  , codecVersionTime(other.codecVersionTime)
+  , forceIsTransportable(other.forceIsTransportable)
+{
+  // Copy the options themselves, so the index points at our own
+  options.MakeUnique();
+  BuildOptionIndex();
 }
 
 
@@ -965,7 +1305,7 @@ bool OpalMediaFormatInternal::Merge(const OpalMediaFormatInternal & mediaFormat)
   for (PINDEX i = 0; i < options.GetSize(); i++) {
     OpalMediaOption & opt = options[i];
     PString name = opt.GetName();
-    OpalMediaOption * option = mediaFormat.FindOption(opt.GetName());
+    OpalMediaOption * option = mediaFormat.FindOption(opt.GetKey());
     if (option == NULL) {
       PTRACE_IF(2, formatName == mediaFormat.formatName, "MediaFormat\tCannot merge unmatched option " << opt.GetName());
     }
@@ -1026,8 +1366,13 @@ PStringToString OpalMediaFormatInternal::GetOptions() const
 
 bool OpalMediaFormatInternal::GetOptionValue(const PString & name, PString & value) const
 {
-  PWaitAndSignal m(media_format_mutex);
-  OpalMediaOption * option = FindOption(name);
+  return GetOptionValue(OpalMediaOptionKey::Find(name), value);
+}
+
+
+bool OpalMediaFormatInternal::GetOptionValue(const OpalMediaOptionKey & key, PString & value) const
+{
+  OpalMediaOption * option = FindOption(key);
   if (option == NULL)
     return false;
 
@@ -1049,9 +1394,8 @@ bool OpalMediaFormatInternal::SetOptionValue(const PString & name, const PString
 
 
 template <class OptionType, typename ValueType>
-static ValueType GetOptionOfType(const OpalMediaFormatInternal & format, const PString & name, ValueType dflt)
+static ValueType GetOptionOfType(const OpalMediaFormatInternal & format, OpalMediaOption * option, ValueType dflt)
 {
-  OpalMediaOption * option = format.FindOption(name);
   if (option == NULL)
     return dflt;
 
@@ -1059,7 +1403,7 @@ static ValueType GetOptionOfType(const OpalMediaFormatInternal & format, const P
   if (typedOption != NULL)
     return typedOption->GetValue();
 
-  PTRACE(1, "MediaFormat\tInvalid type for getting option " << name << " in " << format);
+  PTRACE(1, "MediaFormat\tInvalid type for getting option " << option->GetName() << " in " << format);
   PAssertAlways(PInvalidCast);
   return dflt;
 }
@@ -1086,12 +1430,18 @@ static bool SetOptionOfType(OpalMediaFormatInternal & format, const PString & na
 
 bool OpalMediaFormatInternal::GetOptionBoolean(const PString & name, bool dflt) const
 {
-  PWaitAndSignal m(media_format_mutex);
-  const OpalMediaOptionEnum * optEnum = dynamic_cast<const OpalMediaOptionEnum *>(FindOption(name));
+  return GetOptionBoolean(OpalMediaOptionKey::Find(name), dflt);
+}
+
+
+bool OpalMediaFormatInternal::GetOptionBoolean(const OpalMediaOptionKey & key, bool dflt) const
+{
+  OpalMediaOption * option = FindOption(key);
+  const OpalMediaOptionEnum * optEnum = dynamic_cast<const OpalMediaOptionEnum *>(option);
   if (optEnum != NULL && optEnum->GetEnumerations().GetSize() == 2)
     return optEnum->GetValue() != 0;
 
-  return GetOptionOfType<OpalMediaOptionBoolean, bool>(*this, name, dflt);
+  return GetOptionOfType<OpalMediaOptionBoolean, bool>(*this, option, dflt);
 }
 
 
@@ -1110,12 +1460,18 @@ bool OpalMediaFormatInternal::SetOptionBoolean(const PString & name, bool value)
 
 int OpalMediaFormatInternal::GetOptionInteger(const PString & name, int dflt) const
 {
-  PWaitAndSignal m(media_format_mutex);
-  OpalMediaOptionUnsigned * optUnsigned = dynamic_cast<OpalMediaOptionUnsigned *>(FindOption(name));
+  return GetOptionInteger(OpalMediaOptionKey::Find(name), dflt);
+}
+
+
+int OpalMediaFormatInternal::GetOptionInteger(const OpalMediaOptionKey & key, int dflt) const
+{
+  OpalMediaOption * option = FindOption(key);
+  OpalMediaOptionUnsigned * optUnsigned = dynamic_cast<OpalMediaOptionUnsigned *>(option);
   if (optUnsigned != NULL)
     return optUnsigned->GetValue();
 
-  return GetOptionOfType<OpalMediaOptionInteger, int>(*this, name, dflt);
+  return GetOptionOfType<OpalMediaOptionInteger, int>(*this, option, dflt);
 }
 
 
@@ -1134,8 +1490,13 @@ bool OpalMediaFormatInternal::SetOptionInteger(const PString & name, int value)
 
 double OpalMediaFormatInternal::GetOptionReal(const PString & name, double dflt) const
 {
-  PWaitAndSignal m(media_format_mutex);
-  return GetOptionOfType<OpalMediaOptionReal, double>(*this, name, dflt);
+  return GetOptionReal(OpalMediaOptionKey::Find(name), dflt);
+}
+
+
+double OpalMediaFormatInternal::GetOptionReal(const OpalMediaOptionKey & key, double dflt) const
+{
+  return GetOptionOfType<OpalMediaOptionReal, double>(*this, FindOption(key), dflt);
 }
 
 
@@ -1148,8 +1509,13 @@ bool OpalMediaFormatInternal::SetOptionReal(const PString & name, double value)
 
 PINDEX OpalMediaFormatInternal::GetOptionEnum(const PString & name, PINDEX dflt) const
 {
-  PWaitAndSignal m(media_format_mutex);
-  return GetOptionOfType<OpalMediaOptionEnum, PINDEX>(*this, name, dflt);
+  return GetOptionEnum(OpalMediaOptionKey::Find(name), dflt);
+}
+
+
+PINDEX OpalMediaFormatInternal::GetOptionEnum(const OpalMediaOptionKey & key, PINDEX dflt) const
+{
+  return GetOptionOfType<OpalMediaOptionEnum, PINDEX>(*this, FindOption(key), dflt);
 }
 
 
@@ -1162,8 +1528,13 @@ bool OpalMediaFormatInternal::SetOptionEnum(const PString & name, PINDEX value)
 
 PString OpalMediaFormatInternal::GetOptionString(const PString & name, const PString & dflt) const
 {
-  PWaitAndSignal m(media_format_mutex);
-  return GetOptionOfType<OpalMediaOptionString, PString>(*this, name, dflt);
+  return GetOptionString(OpalMediaOptionKey::Find(name), dflt);
+}
+
+
+PString OpalMediaFormatInternal::GetOptionString(const OpalMediaOptionKey & key, const PString & dflt) const
+{
+  return GetOptionOfType<OpalMediaOptionString, PString>(*this, FindOption(key), dflt);
 }
 
 
@@ -1176,7 +1547,6 @@ bool OpalMediaFormatInternal::SetOptionString(const PString & name, const PStrin
 
 bool OpalMediaFormatInternal::GetOptionOctets(const PString & name, PBYTEArray & octets) const
 {
-  PWaitAndSignal m(media_format_mutex);
   OpalMediaOption * option = FindOption(name);
   if (option == NULL)
     return false;
@@ -1217,29 +1587,40 @@ bool OpalMediaFormatInternal::AddOption(OpalMediaOption * option, PBoolean overw
   }
 
   options.Append(option);
+  BuildOptionIndex();
   return true;
 }
 
 
-class OpalMediaOptionSearchArg : public OpalMediaOption
+void OpalMediaFormatInternal::BuildOptionIndex()
 {
-public:
-  OpalMediaOptionSearchArg(const PString & name) : OpalMediaOption(name) { }
-  virtual Comparison CompareValue(const OpalMediaOption &) const { return EqualTo; }
-  virtual void Assign(const OpalMediaOption &) { }
-};
+  m_optionIndex.resize(options.GetSize());
+  for (PINDEX i = 0; i < options.GetSize(); i++) {
+    m_optionIndex[i].m_key = options[i].GetKey().GetId();
+    m_optionIndex[i].m_option = &options[i];
+  }
+  std::sort(m_optionIndex.begin(), m_optionIndex.end());
+}
+
 
 OpalMediaOption * OpalMediaFormatInternal::FindOption(const PString & name) const
 {
-  PWaitAndSignal m(media_format_mutex);
-  OpalMediaOptionSearchArg search(name);
-  PINDEX index = options.GetValuesIndex(search);
-  if (index == P_MAX_INDEX)
+  return FindOption(OpalMediaOptionKey::Find(name));
+}
+
+
+OpalMediaOption * OpalMediaFormatInternal::FindOption(const OpalMediaOptionKey & key) const
+{
+  if (!key.IsValid())
     return NULL;
 
-  PAssert(options[index].GetName() == name, "OpalMediaOption name mismatch");
+  OptionIndexEntry search;
+  search.m_key = key.GetId();
+  std::vector<OptionIndexEntry>::const_iterator it = std::lower_bound(m_optionIndex.begin(), m_optionIndex.end(), search);
+  if (it == m_optionIndex.end() || it->m_key != search.m_key)
+    return NULL;
 
-  return &options[index];
+  return it->m_option;
 }
 
 
@@ -0,0 +1,694 @@
+/*
+ * mixerep.cxx
+ *
+ * Conference mixer EndPoint/Connection.
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#pragma implementation "mixerep.h"
+#endif
+
+#include <opal/buildopts.h>
+
+#include <opal/mixerep.h>
+#include <opal/call.h>
+#include <opal/transcoders.h>
+#include <ptclib/delaychan.h>
+
+#include <algorithm>
+
+
+#define new PNEW
+
+
+// All mixing is done at this rate
+#define MIXER_CLOCK_RATE 8000
+
+// Blocks of input buffered per participant
+#define INPUT_RING_BLOCKS 16
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+OpalMixerNode::Participant::Participant(const PString & token, PINDEX frameSamples)
+  : m_token(token)
+  , m_frameTime(frameSamples*1000/MIXER_CLOCK_RATE)
+  , m_input(frameSamples, INPUT_RING_BLOCKS)
+  , m_decoder(NULL)
+  , m_decoded(0)
+  , m_outputChanged(false)
+  , m_output(0)
+  , m_outputReady(false)
+  , m_removed(false)
+  , m_encoder(NULL)
+  , m_encoded(0)
+  , m_encoderOK(false)
+  , m_sharedEncoder(NULL)
+  , m_level(0)
+  , m_speaking(false)
+{
+}
+
+
+OpalMixerNode::Participant::~Participant()
+{
+  delete m_decoder;
+  delete m_encoder;
+}
+
+
+bool OpalMixerNode::Participant::SetInputFormat(const OpalMediaFormat & format)
+{
+  PWaitAndSignal mutex(m_inputMutex);
+
+  if (format == m_inputFormat)
+    return true;
+
+  delete m_decoder;
+  m_decoder = NULL;
+  m_inputFormat = format;
+
+  if (format == OpalPCM16)
+    return true;
+
+  m_decoder = OpalTranscoder::Create(format, OpalPCM16);
+  if (m_decoder != NULL)
+    return true;
+
+  PTRACE(2, "Mixer\tNo decoder from " << format << " for participant " << m_token);
+  return false;
+}
+
+
+bool OpalMixerNode::Participant::SetOutputFormat(const OpalMediaFormat & format)
+{
+  PWaitAndSignal mutex(m_outputMutex);
+
+  if (format != m_outputFormat) {
+    m_outputFormat = format;
+    m_outputChanged = true;
+  }
+  return true;
+}
+
+
+bool OpalMixerNode::Participant::WriteFrame(const RTP_DataFrame & frame)
+{
+  if (frame.GetPayloadSize() == 0)
+    return true;
+
+  PWaitAndSignal mutex(m_inputMutex);
+
+  const RTP_DataFrame * pcm = &frame;
+  if (m_decoder != NULL) {
+    if (!m_decoder->Convert(frame, m_decoded))
+      return false;
+    pcm = &m_decoded;
+  }
+
+  m_input.WriteSamples((const short *)pcm->GetPayloadPtr(), pcm->GetPayloadSize()/2, frame.GetTimestamp());
+  return true;
+}
+
+
+bool OpalMixerNode::Participant::ReadFrame(RTP_DataFrame & frame, const PTimeInterval & timeout)
+{
+  for (;;) {
+    {
+      PWaitAndSignal mutex(m_outputMutex);
+      if (m_outputReady) {
+        PINDEX size = m_output.GetPayloadSize();
+        frame.SetPayloadSize(size);
+        memcpy(frame.GetPayloadPtr(), m_output.GetPayloadPtr(), size);
+        frame.SetTimestamp(m_output.GetTimestamp());
+        m_outputReady = false;
+        return true;
+      }
+
+      if (m_removed)
+        return false;
+    }
+
+    if (!m_outputSignal.Wait(timeout))
+      return false;
+  }
+}
+
+
+void OpalMixerNode::Participant::DeliverFrame(const BYTE * payload, PINDEX size, DWORD timestamp)
+{
+  {
+    PWaitAndSignal mutex(m_outputMutex);
+    m_output.SetPayloadSize(size);
+    memcpy(m_output.GetPayloadPtr(), payload, size);
+    m_output.SetTimestamp(timestamp);
+    m_outputReady = true;
+  }
+
+  m_outputSignal.Signal();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+OpalMixerNode::OpalMixerNode(const PString & name, const Params & params)
+  : m_name(name)
+  , m_params(params)
+  , m_frameSamples(params.m_frameTime*MIXER_CLOCK_RATE/1000)
+  , m_mixed(0)
+  , m_timestamp(0)
+  , m_framesMixed(0)
+  , m_encodes(0)
+  , m_thread(NULL)
+  , m_running(false)
+  , m_autoStart(true)
+{
+  if (m_params.m_maxSpeakers == 0)
+    m_params.m_maxSpeakers = 1;
+
+  m_accumulator.resize(m_frameSamples);
+  m_mixed.SetPayloadSize(m_frameSamples*sizeof(short));
+
+  PTRACE(4, "Mixer\tCreated node \"" << m_name << "\", "
+         << m_params.m_frameTime << "ms frames, " << m_params.m_maxSpeakers << " speakers");
+}
+
+
+OpalMixerNode::~OpalMixerNode()
+{
+  StopThread();
+
+  for (SharedEncoderMap::iterator it = m_sharedEncoders.begin(); it != m_sharedEncoders.end(); ++it)
+    delete it->second.m_transcoder;
+
+  PTRACE(4, "Mixer\tDeleted node \"" << m_name << '"');
+}
+
+
+PSmartPointer OpalMixerNode::AddParticipant(const PString & token)
+{
+  PSmartPointer participant = new Participant(token, m_frameSamples);
+
+  {
+    PWaitAndSignal mutex(m_mutex);
+    m_participants.push_back(participant);
+    m_samples.resize(m_participants.size()*m_frameSamples);
+    m_speakers.reserve(m_participants.size());
+  }
+
+  PTRACE(3, "Mixer\tAdded participant " << token << " to node \"" << m_name << '"');
+
+  if (m_autoStart)
+    StartThread();
+
+  return participant;
+}
+
+
+void OpalMixerNode::RemoveParticipant(const PString & token)
+{
+  PSmartPointer removed;
+
+  {
+    PWaitAndSignal mutex(m_mutex);
+    for (std::vector<PSmartPointer>::iterator it = m_participants.begin(); it != m_participants.end(); ++it) {
+      if (((Participant *)it->GetObject())->GetToken() == token) {
+        removed = *it;
+        m_participants.erase(it);
+        break;
+      }
+    }
+  }
+
+  Participant * participant = (Participant *)removed.GetObject();
+  if (participant == NULL)
+    return;
+
+  {
+    PWaitAndSignal mutex(participant->m_outputMutex);
+    participant->m_removed = true;
+  }
+  participant->m_outputSignal.Signal();
+
+  PTRACE(3, "Mixer\tRemoved participant " << token << " from node \"" << m_name << '"');
+}
+
+
+PINDEX OpalMixerNode::GetParticipantCount() const
+{
+  PWaitAndSignal mutex(m_mutex);
+  return m_participants.size();
+}
+
+
+void OpalMixerNode::GetStatistics(PUInt64 & framesMixed, PUInt64 & encodes) const
+{
+  PWaitAndSignal mutex(m_mutex);
+  framesMixed = m_framesMixed;
+  encodes = m_encodes;
+}
+
+
+void OpalMixerNode::StartThread()
+{
+  PWaitAndSignal mutex(m_threadMutex);
+  if (m_thread != NULL)
+    return;
+
+  m_running = true;
+  m_thread = new PThreadObj<OpalMixerNode>(*this, &OpalMixerNode::ThreadMain);
+  m_thread->SetThreadName("Mixer " + m_name);
+}
+
+
+void OpalMixerNode::StopThread()
+{
+  PWaitAndSignal mutex(m_threadMutex);
+  if (m_thread == NULL)
+    return;
+
+  m_running = false;
+  m_thread->WaitForTermination();
+  delete m_thread;
+  m_thread = NULL;
+}
+
+
+void OpalMixerNode::ThreadMain()
+{
+  PAdaptiveDelay delay;
+
+  while (m_running) {
+    delay.Delay(m_params.m_frameTime);
+    MixFrame();
+  }
+}
+
+
+bool OpalMixerNode::Encode(OpalTranscoder * transcoder, RTP_DataFrame & output, const BYTE * & payload, PINDEX & size)
+{
+  // PCM-16 is sent as mixed
+  if (transcoder == NULL) {
+    payload = m_mixed.GetPayloadPtr();
+    size = m_mixed.GetPayloadSize();
+    return true;
+  }
+
+  ++m_encodes;
+  m_mixed.SetTimestamp(m_timestamp);
+  if (!transcoder->Convert(m_mixed, output))
+    return false;
+
+  payload = output.GetPayloadPtr();
+  size = output.GetPayloadSize();
+  return true;
+}
+
+
+/* Formats whose encoder keeps no state between frames, so participants may
+   switch between their own and a shared one without a glitch. */
+static bool IsStatelessFormat(const OpalMediaFormat & format)
+{
+  return format == OpalPCM16 || format == OpalG711_ULAW_64K || format == OpalG711_ALAW_64K;
+}
+
+
+/* Orders participant indexes loudest first, for picking the speakers. */
+class OpalMixerLouder
+{
+  public:
+    OpalMixerLouder(const std::vector<PSmartPointer> & participants)
+      : m_participants(participants)
+    {
+    }
+
+    bool operator()(PINDEX left, PINDEX right) const
+    {
+      return Level(left) > Level(right);
+    }
+
+  protected:
+    unsigned Level(PINDEX index) const
+    {
+      return ((const OpalMixerNode::Participant *)m_participants[index].GetObject())->GetLevel();
+    }
+
+    const std::vector<PSmartPointer> & m_participants;
+};
+
+
+void OpalMixerNode::MixFrame()
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  ++m_framesMixed;
+  PINDEX count = m_participants.size();
+
+  // Take a block from everybody who sent one, and see how loud it is
+  m_speakers.clear();
+  for (PINDEX i = 0; i < count; ++i) {
+    Participant & participant = *(Participant *)m_participants[i].GetObject();
+    short * samples = &m_samples[i*m_frameSamples];
+    participant.m_speaking = false;
+    if (participant.m_input.ReadSamples(samples)) {
+      participant.m_level = OpalPCM16SilenceDetector::GetAverageLevel(samples, m_frameSamples);
+      m_speakers.push_back(i);
+    }
+    else
+      participant.m_level = 0;
+  }
+
+  // Only the loudest few are mixed
+  if (m_speakers.size() > m_params.m_maxSpeakers) {
+    std::nth_element(m_speakers.begin(),
+                     m_speakers.begin() + m_params.m_maxSpeakers - 1,
+                     m_speakers.end(),
+                     OpalMixerLouder(m_participants));
+    m_speakers.resize(m_params.m_maxSpeakers);
+  }
+
+  std::fill(m_accumulator.begin(), m_accumulator.end(), 0);
+  for (std::vector<PINDEX>::iterator it = m_speakers.begin(); it != m_speakers.end(); ++it) {
+    OpalAudioMixer::AccumulateSamples(&m_accumulator[0], &m_samples[*it*m_frameSamples], m_frameSamples);
+    ((Participant *)m_participants[*it].GetObject())->m_speaking = true;
+  }
+
+  // Bring the encoders up to date with what the readers want
+  for (PINDEX i = 0; i < count; ++i) {
+    Participant & participant = *(Participant *)m_participants[i].GetObject();
+    if (!participant.m_outputChanged)
+      continue;
+
+    {
+      PWaitAndSignal outputMutex(participant.m_outputMutex);
+      participant.m_encoderFormat = participant.m_outputFormat;
+      participant.m_outputChanged = false;
+    }
+
+    delete participant.m_encoder;
+    participant.m_encoder = NULL;
+    participant.m_encoderOK = true;
+    participant.m_sharedEncoder = NULL;
+
+    const OpalMediaFormat & format = participant.m_encoderFormat;
+    if (format != OpalPCM16) {
+      participant.m_encoder = OpalTranscoder::Create(OpalPCM16, format);
+      if (participant.m_encoder == NULL) {
+        PTRACE(2, "Mixer\tNo encoder to " << format << " for participant " << participant.GetToken());
+        participant.m_encoderOK = false;
+        continue;
+      }
+    }
+
+    if (IsStatelessFormat(format)) {
+      SharedEncoder & shared = m_sharedEncoders[format.GetName()];
+      if (shared.m_format != format) {
+        shared.m_format = format;
+        if (format != OpalPCM16)
+          shared.m_transcoder = OpalTranscoder::Create(OpalPCM16, format);
+      }
+      participant.m_sharedEncoder = &shared;
+    }
+  }
+
+  // Speakers hear everyone but themselves, taken out of the mix
+  short * mixed = (short *)m_mixed.GetPayloadPtr();
+  for (std::vector<PINDEX>::iterator it = m_speakers.begin(); it != m_speakers.end(); ++it) {
+    Participant & participant = *(Participant *)m_participants[*it].GetObject();
+    if (!participant.m_encoderOK)
+      continue;
+
+    OpalAudioMixer::SaturateSamples(mixed, &m_accumulator[0], &m_samples[*it*m_frameSamples], m_frameSamples);
+
+    const BYTE * payload;
+    PINDEX size;
+    if (Encode(participant.m_encoder, participant.m_encoded, payload, size))
+      participant.DeliverFrame(payload, size, m_timestamp);
+  }
+
+  // Everybody else hears the whole mix, encoded once per stateless format
+  OpalAudioMixer::SaturateSamples(mixed, &m_accumulator[0], NULL, m_frameSamples);
+  for (PINDEX i = 0; i < count; ++i) {
+    Participant & participant = *(Participant *)m_participants[i].GetObject();
+    if (participant.m_speaking || !participant.m_encoderOK)
+      continue;
+
+    if (participant.m_sharedEncoder == NULL) {
+      const BYTE * payload;
+      PINDEX size;
+      if (Encode(participant.m_encoder, participant.m_encoded, payload, size))
+        participant.DeliverFrame(payload, size, m_timestamp);
+      continue;
+    }
+
+    SharedEncoder & shared = *participant.m_sharedEncoder;
+    if (shared.m_frame != m_framesMixed) {
+      shared.m_frame = m_framesMixed;
+      shared.m_ok = Encode(shared.m_transcoder, shared.m_output, shared.m_payload, shared.m_size);
+    }
+
+    if (shared.m_ok)
+      participant.DeliverFrame(shared.m_payload, shared.m_size, m_timestamp);
+  }
+
+  m_timestamp += m_frameSamples;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+OpalMixerEndPoint::OpalMixerEndPoint(OpalManager & mgr, const char * prefix)
+  : OpalLocalEndPoint(mgr, prefix)
+{
+  PTRACE(3, "Mixer\tCreated endpoint.");
+}
+
+
+OpalMixerEndPoint::~OpalMixerEndPoint()
+{
+  for (NodeMap::iterator it = m_nodes.begin(); it != m_nodes.end(); ++it)
+    delete it->second;
+
+  PTRACE(4, "Mixer\tDeleted endpoint.");
+}
+
+
+PBoolean OpalMixerEndPoint::MakeConnection(OpalCall & call,
+                                      const PString & party,
+                                               void * userData,
+                                       unsigned int   /*options*/,
+                      OpalConnection::StringOptions * /*stringOptions*/)
+{
+  PString name = party;
+  PINDEX colon = name.Find(':');
+  if (colon != P_MAX_INDEX)
+    name.Delete(0, colon+1);
+
+  if (name.IsEmpty()) {
+    PTRACE(2, "Mixer\tNo node name in \"" << party << '"');
+    return false;
+  }
+
+  OpalMixerConnection * connection;
+  {
+    // Held until the participant is added, so RemoveNode() cannot delete the node
+    PWaitAndSignal mutex(m_nodesMutex);
+
+    OpalMixerNode * node = FindNode(name, true);
+    if (node == NULL)
+      return false;
+
+    connection = CreateConnection(*node, call, userData);
+  }
+
+  return AddConnection(connection);
+}
+
+
+OpalMediaFormatList OpalMixerEndPoint::GetMediaFormats() const
+{
+  OpalMediaFormatList formats;
+  formats += OpalPCM16;
+
+  OpalMediaFormatList encoders = OpalTranscoder::GetDestinationFormats(OpalPCM16);
+  OpalMediaFormatList decoders = OpalTranscoder::GetSourceFormats(OpalPCM16);
+  for (OpalMediaFormatList::const_iterator format = encoders.begin(); format != encoders.end(); ++format) {
+    if (format->GetMediaType() == OpalMediaType::Audio() &&
+        format->GetClockRate() == MIXER_CLOCK_RATE &&
+        decoders.HasFormat(format->GetName()))
+      formats += *format;
+  }
+
+  return formats;
+}
+
+
+bool OpalMixerEndPoint::OnReadMediaFrame(const OpalLocalConnection & connection,
+                                         const OpalMediaStream & mediaStream,
+                                         RTP_DataFrame & frame)
+{
+  const OpalMixerConnection * mixerConnection = dynamic_cast<const OpalMixerConnection *>(&connection);
+  if (mixerConnection == NULL)
+    return false;
+
+  // Not the node, which may have gone if the participant has been removed
+  OpalMixerNode::Participant * participant = mixerConnection->GetParticipant();
+  PTimeInterval timeout = participant->GetFrameTime()*2;
+  while (mediaStream.IsOpen() && !participant->IsRemoved()) {
+    if (participant->ReadFrame(frame, timeout))
+      return true;
+  }
+
+  return false;
+}
+
+
+bool OpalMixerEndPoint::OnWriteMediaFrame(const OpalLocalConnection & connection,
+                                          const OpalMediaStream & /*mediaStream*/,
+                                          RTP_DataFrame & frame)
+{
+  const OpalMixerConnection * mixerConnection = dynamic_cast<const OpalMixerConnection *>(&connection);
+  if (mixerConnection == NULL)
+    return false;
+
+  mixerConnection->GetParticipant()->WriteFrame(frame);
+  return true;
+}
+
+
+bool OpalMixerEndPoint::OnReadMediaData(const OpalLocalConnection & /*connection*/,
+                                        const OpalMediaStream & /*mediaStream*/,
+                                        void * /*data*/,
+                                        PINDEX /*size*/,
+                                        PINDEX & /*length*/)
+{
+  return false;
+}
+
+
+OpalMixerConnection * OpalMixerEndPoint::CreateConnection(OpalMixerNode & node, OpalCall & call, void * userData)
+{
+  return new OpalMixerConnection(call, *this, node, userData);
+}
+
+
+OpalMixerNode * OpalMixerEndPoint::CreateNode(const PString & name)
+{
+  return new OpalMixerNode(name, m_nodeParams);
+}
+
+
+OpalMixerNode * OpalMixerEndPoint::FindNode(const PString & name, bool create)
+{
+  PWaitAndSignal mutex(m_nodesMutex);
+
+  NodeMap::iterator it = m_nodes.find(name);
+  if (it != m_nodes.end())
+    return it->second;
+
+  if (!create)
+    return NULL;
+
+  OpalMixerNode * node = CreateNode(name);
+  if (node != NULL)
+    m_nodes[name] = node;
+  return node;
+}
+
+
+bool OpalMixerEndPoint::RemoveNode(const PString & name)
+{
+  OpalMixerNode * node;
+
+  {
+    PWaitAndSignal mutex(m_nodesMutex);
+
+    NodeMap::iterator it = m_nodes.find(name);
+    if (it == m_nodes.end() || it->second->GetParticipantCount() > 0)
+      return false;
+
+    node = it->second;
+    m_nodes.erase(it);
+  }
+
+  node->StopThread();
+  delete node;
+
+  PTRACE(3, "Mixer\tRemoved empty node \"" << name << '"');
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+OpalMixerConnection::OpalMixerConnection(OpalCall & call,
+                                         OpalMixerEndPoint & ep,
+                                         OpalMixerNode & node,
+                                         void * userData)
+  : OpalLocalConnection(call, ep, userData)
+  , m_endpoint(ep)
+  , m_node(node)
+  , m_participant(node.AddParticipant(GetToken()))
+{
+  PTRACE(4, "Mixer\tCreated connection " << *this << " to node \"" << node.GetName() << '"');
+}
+
+
+OpalMixerConnection::~OpalMixerConnection()
+{
+  PTRACE(4, "Mixer\tDeleted connection.");
+}
+
+
+PBoolean OpalMixerConnection::OnOpenMediaStream(OpalMediaStream & stream)
+{
+  if (stream.GetMediaFormat().GetMediaType() == OpalMediaType::Audio()) {
+    OpalMixerNode::Participant * participant = GetParticipant();
+    if (!(stream.IsSource() ? participant->SetOutputFormat(stream.GetMediaFormat())
+                            : participant->SetInputFormat(stream.GetMediaFormat())))
+      return false;
+  }
+
+  return OpalLocalConnection::OnOpenMediaStream(stream);
+}
+
+
+void OpalMixerConnection::OnReleased()
+{
+  // Once our participant is gone another connection may delete the node
+  PString name = m_node.GetName();
+  m_node.RemoveParticipant(GetToken());
+
+  OpalLocalConnection::OnReleased();
+
+  m_endpoint.RemoveNode(name);
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
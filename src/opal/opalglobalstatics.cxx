@@ -39,6 +39,7 @@
 #include <codec/opalpluginmgr.h>
 #include <lids/lidpluginmgr.h>
 #include <rtp/srtp.h>
+#include <rtp/srtpcrypto.h>
 #include <t38/t38proto.h>
 
 #if OPAL_RFC4175
@@ -53,6 +54,10 @@
 #include <codec/g711codec.h>
 OPAL_REGISTER_G711();
 
+// Sample rate conversion between the PCM-16 formats, for the same reason
+#include <codec/resampler.h>
+OPAL_REGISTER_PCM16_RESAMPLERS();
+
 #if defined(P_PLUGINS)
 class PluginLoader : public PProcessStartup
 {
@@ -69,6 +74,9 @@ class PluginLoader : public PProcessStartup
 #if OPAL_SRTP
       PWLibStupidLinkerHacks::libSRTPLoader = 1;
 #endif
+#if OPAL_PTLIB_SSL
+      PWLibStupidLinkerHacks::nativeSRTPLoader = 1;
+#endif
 #if OPAL_FAX
       PWLibStupidLinkerHacks::t38Loader = 1;
 #endif
@@ -3,6 +3,7 @@
 #include <opal/buildopts.h>
 
 #include <opal/opalmixer.h>
+#include <opal/simd.h>
 
 #define MS_TO_BYTES(ms)         (ms*16)
 #define MS_TO_SAMPLES(ms)       (ms*8)
@@ -10,315 +11,465 @@
 #define BYTES_TO_MS(bytes)      (bytes/16)
 #define BYTES_TO_SAMPLES(bytes) (bytes/2)
 
+// Output frames are reused round robin, so OnWriteAudio() may keep one briefly
+#define OUTPUT_FRAME_RING       4
+
+// Mixed output is limited to this, as it always has been
+#define MAX_MIXED_SAMPLE        32765
+
 OpalAudioMixerStream::StreamFrame::StreamFrame(const RTP_DataFrame & rtp)
   :	PMemBuffer<PMutex>(rtp.GetPayloadPtr(), rtp.GetPayloadSize()), timestamp(rtp.GetTimestamp())
   ,	channelNumber(0)
 {
 }
 
-OpalAudioMixerStream::OpalAudioMixerStream()
-{ 
-  active = PFalse; 
-  first  = PTrue;
-  writtenTimeStamp = cacheTimeStamp = 80000000;
-}
-
-void OpalAudioMixerStream::WriteFrame(const StreamFrame & frame)
-{
-  PWaitAndSignal m(mutex);
-  if (frame.GetSize() != 0 && frame.timestamp != writtenTimeStamp) {
-    writtenTimeStamp = frame.timestamp;
-    frameQueue.push(frame);
-    PTRACE(6, "Mixer\tWrite CH=" << channelNumber << " TS=" << frame.timestamp << " SZ=" << frame.GetSize());
-  }
-}
-
-void OpalAudioMixerStream::FillSilence(StreamFrame & retFrame, PINDEX ms)
+OpalAudioMixerStream::OpalAudioMixerStream(PINDEX _blockSamples, PINDEX ringBlocks)
+  : channelNumber(0)
+  , blockSamples(_blockSamples)
+  , written(0)
+  , read(0)
+  , overflows(0)
 {
-  retFrame.SetSize(MS_TO_BYTES(ms));
-  memset(retFrame.GetPointerAndLock(), 0, MS_TO_BYTES(ms));
-  retFrame.Unlock();
+  PINDEX size = 1;
+  while (size < ringBlocks)
+    size <<= 1;
+  ringMask = size-1;
+  ringSamples.resize(size*blockSamples);
+  ringTimestamps.resize(size);
+
+  active = false;
+  first  = true;
+  writtenTimeStamp = cacheTimeStamp = 80000000;
 }
 
-void OpalAudioMixerStream::PopFrame(StreamFrame & retFrame, PINDEX ms)
+/* The writer owns "written" and the reader owns "read". Each fills or drains
+   a block before moving its own counter on, and the atomic increment orders
+   that against the other thread reading the counter, so the two never touch
+   the same block at once. */
+void OpalAudioMixerStream::WriteSamples(const short * samples, PINDEX count, DWORD timestamp)
 {
-  PAssert(frameQueue.size() > 0, "attempt to pop from empty queue");
-
-  // get the top frame
-  StreamFrame & frame = frameQueue.front();
-
-  // if we want the entire frame, return all of it
-  // otherwise return partial frame and put the rest into the cache
-  if (BYTES_TO_MS(frame.GetSize()) == ms) {
+  if (count == 0 || timestamp == writtenTimeStamp)
+    return;
 
-    // zerocopy cached frame to the returned frame
-    retFrame = frame;
+  writtenTimeStamp = timestamp;
+  PTRACE(6, "Mixer\tWrite CH=" << channelNumber << " TS=" << timestamp << " SZ=" << count*2);
 
-    // clear the current frame cache
-    frameCache.SetSize(0);
-    PTRACE(6, "Mixer\tPop full CH=" << channelNumber << " TS=" << frame.timestamp);
-  }
-  else
-  {
-    // zerocopy current frame into cache and returned frame
-    frameCache = frame;
-    retFrame = frameCache;
+  while (count > 0) {
+    long blocks = (long)written;
+    if (blocks - (long)read > ringMask) {
+      ++overflows;
+      PTRACE_IF(4, overflows == 1 || overflows%1000 == 0,
+                "Mixer\tStream CH=" << channelNumber << " overflowed, " << overflows << " blocks dropped");
+      return;
+    }
 
-    // data length is shorter of what we want, or what we got
-    PINDEX len = PMIN(MS_TO_BYTES(ms), frameCache.GetSize());
-    PAssert(len == MS_TO_BYTES(ms), "attempt to copy partial frame");
+    PINDEX slot = blocks & ringMask;
+    short * block = &ringSamples[slot*blockSamples];
+    PINDEX len = PMIN(count, blockSamples);
+    memcpy(block, samples, len*sizeof(short));
+    if (len < blockSamples)
+      memset(block+len, 0, (blockSamples-len)*sizeof(short));
+    ringTimestamps[slot] = timestamp;
 
-    // adjust to correct length
-    retFrame.SetSize(len);
+    ++written;
 
-    // rebase cache to reflect removed data
-    frameCache.Rebase(len);
-//    frameCache.SetSize(frameCache.GetSize() - len);
-    PTRACE(6, "Mixer\tPop part CH=" << channelNumber << " TS=" << frame.timestamp << " SZ=" << len);
+    samples += len;
+    count -= len;
+    timestamp += blockSamples;
   }
+}
 
-  // remove the frame from the queue
-  frameQueue.pop();
+void OpalAudioMixerStream::WriteFrame(const StreamFrame & frame)
+{
+  WriteSamples((const short *)frame.GetPointerAndLock(), BYTES_TO_SAMPLES(frame.GetSize()), frame.timestamp);
+  frame.Unlock();
 }
 
-PBoolean OpalAudioMixerStream::ReadFrame(StreamFrame & retFrame, PINDEX ms)
+bool OpalAudioMixerStream::ReadSamples(short * samples)
 {
-  mutex.Wait();
+  long blocks = (long)read;
+  bool empty = (long)written == blocks;
 
   // always return silence until first frame arrives
   if (first) {
-    if (frameQueue.size() == 0) {
-      mutex.Signal();
+    if (empty) {
       PTRACE(6, "Mixer\tRead queue empty 1 CH=" << channelNumber);
-      return PFalse;
+      return false;
     }
-    cacheTimeStamp = frameQueue.front().timestamp;
-    first = PFalse;
+    cacheTimeStamp = ringTimestamps[blocks & ringMask];
+    first = false;
   }
 
-  // if there is data in the cache, return it
-  if (frameCache.GetSize() > 0) {
-
-    // zercopy cache into returned frame
-    retFrame = frameCache;
+  // if the stream is not active, activate it as soon as there is a block
+  if (!active) {
+    if (empty) {
+      cacheTimeStamp += blockSamples;
+      PTRACE(6, "Mixer\tRead queue empty 2 CH=" << channelNumber);
+      return false;
+    }
 
-    // return lesser of cached data size and what we requested
-    PINDEX len = PMIN(MS_TO_BYTES(ms), frameCache.GetSize());
-    PAssert(len == MS_TO_BYTES(ms), "attempt to copy partial frame");
+    // the stream is now active
+    active = true;
+  }
+  else {
+    // if no data available, deactivate the stream and return silence
+    if (empty) {
+      cacheTimeStamp += blockSamples;
+      active = false;
+      PTRACE(6, "Mixer\tRead queue empty 3 CH=" << channelNumber);
+      return false;
+    }
 
-    // zero out data if needed (we don't do partial frames)
-    if (len < MS_TO_BYTES(ms)) {
-      memset(retFrame.GetPointerAndLock()+len, 0, MS_TO_BYTES(ms) - len);
-      retFrame.Unlock();
+    // if looking for data before the queue, fill with silence and return
+    DWORD timestamp = ringTimestamps[blocks & ringMask];
+    if (cacheTimeStamp < timestamp) {
+      cacheTimeStamp += blockSamples;
+      PTRACE(6, "Mixer\tRead early CH=" << channelNumber << " TS " << cacheTimeStamp << " < " << timestamp);
+      return false;
     }
 
-    // set the timestamp on the returned data
-    retFrame.timestamp = cacheTimeStamp;
+    // realign to current timestamp
+    cacheTimeStamp = timestamp;
+  }
 
-    // rebase cache to reflect removed data
-    frameCache.Rebase(len);
-    //frameCache.SetSize(frameCache.GetSize()-len);
-    cacheTimeStamp += BYTES_TO_SAMPLES(len);
+  PINDEX slot = blocks & ringMask;
+  memcpy(samples, &ringSamples[slot*blockSamples], blockSamples*sizeof(short));
+  PTRACE(6, "Mixer\tRead CH=" << channelNumber << " TS=" << ringTimestamps[slot]);
 
-    mutex.Signal();
+  ++read;
 
-    PTRACE(6, "Mixer\tRead cached CH=" << channelNumber << " TS=" << retFrame.timestamp << " SZ=" << len);
-    return PTrue;
-  }
+  cacheTimeStamp += blockSamples;
+  return true;
+}
 
-  // invariant: no data in the "cache" buffer
+/////////////////////////////////////////////////////////////////////////////
 
-  // if the stream is not active, check if there are two frames
-  // if not, return silence
-  // if there are, activate the stream and return from the first frame
-  if (!active) {
-    if (frameQueue.size() == 0) {
-      cacheTimeStamp += MS_TO_SAMPLES(ms);
-      mutex.Signal();
-      PTRACE(6, "Mixer\tRead queue empty 2 CH=" << channelNumber);
-      return PFalse;
-    }
+/* Samples are summed in 32 bits and saturated once at the end, so the result
+   does not depend on the order of the channels, and a channel can be taken
+   back out of the sum exactly for its own mix. */
 
-    // the stream is now active
-    active = PTrue;
+static void AccumulateSamplesC(int * accumulator, const short * samples, PINDEX i, PINDEX count)
+{
+  for (; i < count; ++i)
+    accumulator[i] += samples[i];
+}
 
-    // get from the first frame
-    PopFrame(retFrame, ms);
+static void SaturateSamplesC(short * samples, const int * accumulator, const short * exclude, PINDEX i, PINDEX count)
+{
+  for (; i < count; ++i) {
+    int v = accumulator[i];
+    if (exclude != NULL)
+      v -= exclude[i];
+    if (v < -MAX_MIXED_SAMPLE)
+      v = -MAX_MIXED_SAMPLE;
+    else if (v > MAX_MIXED_SAMPLE)
+      v = MAX_MIXED_SAMPLE;
+    samples[i] = (short)v;
+  }
+}
 
-    retFrame.timestamp = cacheTimeStamp;
-    cacheTimeStamp += MS_TO_SAMPLES(ms);
+#if OPAL_SIMD
 
-    mutex.Signal();
+static inline OPAL_TARGET_SSE2 __m128i WidenLow(__m128i v)
+{
+  return _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+}
 
-    return PTrue;
-  }
+static inline OPAL_TARGET_SSE2 __m128i WidenHigh(__m128i v)
+{
+  return _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+}
 
-  // invariant: stream is active and cacheTimeStamp is valid
+static OPAL_TARGET_SSE2 void AccumulateSamplesSSE2(int * accumulator, const short * samples, PINDEX count)
+{
+  PINDEX i = 0;
+  for (; i+8 <= count; i += 8) {
+    __m128i * acc = (__m128i *)(accumulator+i);
+    __m128i v = _mm_loadu_si128((const __m128i *)(samples+i));
+    _mm_storeu_si128(acc,   _mm_add_epi32(_mm_loadu_si128(acc),   WidenLow(v)));
+    _mm_storeu_si128(acc+1, _mm_add_epi32(_mm_loadu_si128(acc+1), WidenHigh(v)));
+  }
+  AccumulateSamplesC(accumulator, samples, i, count);
+}
 
-  // if no data available, deactivate the stream and return silence
-  if (frameQueue.size() == 0) {
-    cacheTimeStamp += MS_TO_SAMPLES(ms);
-    active = PFalse;
-    mutex.Signal();
-    PTRACE(6, "Mixer\tRead queue empty 3 CH=" << channelNumber);
-    return PFalse;
+static OPAL_TARGET_SSE2 void SaturateSamplesSSE2(short * samples, const int * accumulator, const short * exclude, PINDEX count)
+{
+  const __m128i maximum = _mm_set1_epi16(MAX_MIXED_SAMPLE);
+  const __m128i minimum = _mm_set1_epi16(-MAX_MIXED_SAMPLE);
+
+  PINDEX i = 0;
+  for (; i+8 <= count; i += 8) {
+    __m128i lo = _mm_loadu_si128((const __m128i *)(accumulator+i));
+    __m128i hi = _mm_loadu_si128((const __m128i *)(accumulator+i+4));
+    if (exclude != NULL) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(exclude+i));
+      lo = _mm_sub_epi32(lo, WidenLow(v));
+      hi = _mm_sub_epi32(hi, WidenHigh(v));
+    }
+    __m128i packed = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(lo, hi), minimum), maximum);
+    _mm_storeu_si128((__m128i *)(samples+i), packed);
   }
+  SaturateSamplesC(samples, accumulator, exclude, i, count);
+}
 
-  // invariant: the queue contains one or more frames of data
+#if OPAL_SIMD_AVX2_OK
 
-  // check timestamp on the top frame 
-  StreamFrame & frame = frameQueue.front();
+static OPAL_TARGET_AVX2 void AccumulateSamplesAVX2(int * accumulator, const short * samples, PINDEX count)
+{
+  PINDEX i = 0;
+  for (; i+16 <= count; i += 16) {
+    __m256i * acc = (__m256i *)(accumulator+i);
+    __m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(samples+i)));
+    __m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(samples+i+8)));
+    _mm256_storeu_si256(acc,   _mm256_add_epi32(_mm256_loadu_si256(acc),   lo));
+    _mm256_storeu_si256(acc+1, _mm256_add_epi32(_mm256_loadu_si256(acc+1), hi));
+  }
+  AccumulateSamplesC(accumulator, samples, i, count);
+}
 
-  // if looking for data before the queue, fill with silence and return
-  if (cacheTimeStamp < frame.timestamp) {
-    cacheTimeStamp += MS_TO_SAMPLES(ms);
-    mutex.Signal();
-    PTRACE(6, "Mixer\tRead early CH=" << channelNumber << " TS " << cacheTimeStamp << " < " << frame.timestamp);
-    return PFalse;
+static OPAL_TARGET_AVX2 void SaturateSamplesAVX2(short * samples, const int * accumulator, const short * exclude, PINDEX count)
+{
+  const __m256i maximum = _mm256_set1_epi16(MAX_MIXED_SAMPLE);
+  const __m256i minimum = _mm256_set1_epi16(-MAX_MIXED_SAMPLE);
+
+  PINDEX i = 0;
+  for (; i+16 <= count; i += 16) {
+    __m256i lo = _mm256_loadu_si256((const __m256i *)(accumulator+i));
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(accumulator+i+8));
+    if (exclude != NULL) {
+      lo = _mm256_sub_epi32(lo, _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(exclude+i))));
+      hi = _mm256_sub_epi32(hi, _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(exclude+i+8))));
+    }
+    // Packing works within each 128 bit lane, so put the quarters back in order
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+    packed = _mm256_min_epi16(_mm256_max_epi16(packed, minimum), maximum);
+    _mm256_storeu_si256((__m256i *)(samples+i), packed);
   }
+  SaturateSamplesC(samples, accumulator, exclude, i, count);
+}
 
-  // get cached data
-  PopFrame(retFrame, ms);
+#endif // OPAL_SIMD_AVX2_OK
+#endif // OPAL_SIMD
 
-  // realign to current timestamp
-  cacheTimeStamp = frame.timestamp;
-  cacheTimeStamp += MS_TO_SAMPLES(ms);
+#if OPAL_SIMD
+static int GetMixerSIMDLevel(int requested)
+{
+  static const int best = OpalGetSIMDLevel();
+  return requested < 0 || requested > best ? best : requested;
+}
+#endif
 
-  mutex.Signal();
+void OpalAudioMixer::AccumulateSamples(int * accumulator, const short * samples, PINDEX count, int simdLevel)
+{
+#if OPAL_SIMD
+  int simd = GetMixerSIMDLevel(simdLevel);
+#if OPAL_SIMD_AVX2_OK
+  if (simd >= OPAL_SIMD_AVX2) {
+    AccumulateSamplesAVX2(accumulator, samples, count);
+    return;
+  }
+#endif
+  if (simd >= OPAL_SIMD_SSE2) {
+    AccumulateSamplesSSE2(accumulator, samples, count);
+    return;
+  }
+#endif
+  AccumulateSamplesC(accumulator, samples, 0, count);
+}
 
-  return PTrue;
+void OpalAudioMixer::SaturateSamples(short * samples, const int * accumulator, const short * exclude, PINDEX count, int simdLevel)
+{
+#if OPAL_SIMD
+  int simd = GetMixerSIMDLevel(simdLevel);
+#if OPAL_SIMD_AVX2_OK
+  if (simd >= OPAL_SIMD_AVX2) {
+    SaturateSamplesAVX2(samples, accumulator, exclude, count);
+    return;
+  }
+#endif
+  if (simd >= OPAL_SIMD_SSE2) {
+    SaturateSamplesSSE2(samples, accumulator, exclude, count);
+    return;
+  }
+#endif
+  SaturateSamplesC(samples, accumulator, exclude, 0, count);
 }
 
 /////////////////////////////////////////////////////////////////////////////
 
 OpalAudioMixer::MixerFrame::MixerFrame(PINDEX _frameLengthSamples)
   : frameLengthSamples(_frameLengthSamples)
+  , timestamp(0)
+  , channelCount(0)
+  , accumulator(_frameLengthSamples)
+  , mixedSamples(_frameLengthSamples)
+  , mixedValid(false)
 {
 }
 
-void OpalAudioMixer::MixerFrame::CreateMixedData() const
+void OpalAudioMixer::MixerFrame::Clear()
 {
   PWaitAndSignal m(mutex);
-  if (mixedData.GetSize() != 0)
-    return;
+  channelCount = 0;
+  mixedValid = false;
+}
 
-  mixedData.SetSize(frameLengthSamples);
-  memset(mixedData.GetPointer(), 0, frameLengthSamples*sizeof(int));
-
-  MixerPCMMap_T::const_iterator r;
-  for (r = channelData.begin(); r != channelData.end(); ++r) {
-    PINDEX i;
-    const short * src = (short *)r->second.GetPointerAndLock();
-    int * dst = mixedData.GetPointer();
-    for (i = 0; i < frameLengthSamples; ++i)
-      *dst++ += *src++;
-    r->second.Unlock();
-  }
+short * OpalAudioMixer::MixerFrame::GetChannelBuffer()
+{
+  PINDEX needed = (channelCount+1)*frameLengthSamples;
+  if ((PINDEX)channelSamples.size() < needed)
+    channelSamples.resize(needed);
+  return &channelSamples[channelCount*frameLengthSamples];
 }
 
-PBoolean OpalAudioMixer::MixerFrame::GetMixedFrame(OpalAudioMixerStream::StreamFrame & frame) const
+void OpalAudioMixer::MixerFrame::InsertChannel(const Key_T & key, unsigned channelNumber)
 {
-  CreateMixedData();
+  PWaitAndSignal m(mutex);
 
-  frame.SetSize(frameLengthSamples * 2);
-  PINDEX i;
-  int *   src = mixedData.GetPointer();
-  short * dst  = (short *)frame.GetPointerAndLock();
-  for (i = 0; i < frameLengthSamples; ++i) {
-    int v = *src++;
-    if (v < -32765)
-      v = -32765;
-    else if (v > 32765)
-      v = 32765;
-    *dst++ = (short)v;
-  }
+  if ((PINDEX)channels.size() <= channelCount)
+    channels.resize(channelCount+1);
+
+  Channel & channel = channels[channelCount++];
+  channel.key = key;
+  channel.channelNumber = channelNumber;
+  mixedValid = false;
+}
+
+void OpalAudioMixer::MixerFrame::InsertFrame(Key_T key, OpalAudioMixerStream::StreamFrame & frame)
+{
+  short * samples = GetChannelBuffer();
+  PINDEX len = PMIN(frame.GetSize(), frameLengthSamples*2);
+  memcpy(samples, frame.GetPointerAndLock(), len);
   frame.Unlock();
-  return PTrue;
+  memset((BYTE *)samples+len, 0, frameLengthSamples*2 - len);
+  InsertChannel(key, frame.channelNumber);
 }
 
-PBoolean OpalAudioMixer::MixerFrame::GetStereoFrame(OpalAudioMixerStream::StreamFrame & frame) const
+PINDEX OpalAudioMixer::MixerFrame::FindChannel(const Key_T & key) const
 {
-  frame.SetSize(frameLengthSamples * 2 * 2);
+  for (PINDEX i = 0; i < channelCount; ++i) {
+    if (channels[i].key == key)
+      return i;
+  }
+  return P_MAX_INDEX;
+}
 
+void OpalAudioMixer::MixerFrame::CreateMixedData() const
+{
   PWaitAndSignal m(mutex);
+  if (mixedValid)
+    return;
 
-  if (channelData.size() == 0 || channelData.size() > 2)
-    return PFalse;
+  memset(&accumulator[0], 0, frameLengthSamples*sizeof(int));
+  for (PINDEX i = 0; i < channelCount; ++i)
+    AccumulateSamples(&accumulator[0], &channelSamples[i*frameLengthSamples], frameLengthSamples);
+  SaturateSamples(&mixedSamples[0], &accumulator[0], NULL, frameLengthSamples);
+
+  mixedValid = true;
+}
 
-  short * dst = (short *)frame.GetPointerAndLock();
+const short * OpalAudioMixer::MixerFrame::GetMixedSamples() const
+{
+  CreateMixedData();
+  return &mixedSamples[0];
+}
 
-  if (channelData.size() == 1) {
-    const OpalAudioMixerStream::StreamFrame & srcFrame = channelData.begin()->second;
-    const short * src = (const short *)srcFrame.GetPointerAndLock();
+bool OpalAudioMixer::MixerFrame::GetStereoSamples(short * dst) const
+{
+  PWaitAndSignal m(mutex);
+
+  if (channelCount == 0 || channelCount > 2)
+    return false;
+
+  if (channelCount == 1) {
+    const short * src = &channelSamples[0];
     PINDEX i = frameLengthSamples;
-    PINDEX offs = srcFrame.channelNumber;
+    PINDEX offs = channels[0].channelNumber;
     PAssert(offs < 2, "cannot create stereo with more than 2 sources");
     while (i-- > 0) {
       dst[offs]     = *src++;
       dst[offs ^ 1] = 0;
       dst += 2;
     }
-    srcFrame.Unlock();
   }
   else {
-    MixerPCMMap_T::const_iterator r = channelData.begin();
-    const OpalAudioMixerStream::StreamFrame & srcFrame1 = (r++)->second;
-    const OpalAudioMixerStream::StreamFrame & srcFrame2 = (r++)->second;
-    const short * src1 = (const short *)srcFrame1.GetPointerAndLock();
-    const short * src2 = (const short *)srcFrame2.GetPointerAndLock();
+    const short * src1 = &channelSamples[0];
+    const short * src2 = &channelSamples[frameLengthSamples];
     PINDEX i = frameLengthSamples;
-    PINDEX offs1 = srcFrame1.channelNumber;
-    PINDEX offs2 = srcFrame2.channelNumber;
+    PINDEX offs1 = channels[0].channelNumber;
+    PINDEX offs2 = channels[1].channelNumber;
     PAssert(offs1 < 2 && offs2 < 2, "cannot create stereo with more than 2 sources");
     while (i-- > 0) {
       dst[offs1] = *src1++;
       dst[offs2] = *src2++;
       dst += 2;
     }
-    srcFrame2.Unlock();
-    srcFrame1.Unlock();
   }
 
-  frame.Unlock();
-
-  return PTrue;
+  return true;
 }
 
-PBoolean OpalAudioMixer::MixerFrame::GetChannelFrame(Key_T key, OpalAudioMixerStream::StreamFrame & frame) const
+bool OpalAudioMixer::MixerFrame::GetChannelSamples(const Key_T & key, short * samples) const
 {
-  MixerPCMMap_T::const_iterator r = channelData.find(key);
-  if (r == channelData.end())
-    return PFalse;
+  PINDEX index = FindChannel(key);
+  if (index == P_MAX_INDEX)
+    return false;
 
   CreateMixedData();
+  SaturateSamples(samples, &accumulator[0], &channelSamples[index*frameLengthSamples], frameLengthSamples);
+  return true;
+}
 
+PBoolean OpalAudioMixer::MixerFrame::GetMixedFrame(OpalAudioMixerStream::StreamFrame & frame) const
+{
   frame.SetSize(frameLengthSamples * 2);
-  PINDEX i;
-  int *   src1 = mixedData.GetPointer();
-  short * src2 = (short *)r->second.GetPointerAndLock();
-  short * dst  = (short *)frame.GetPointerAndLock();
-  for (i = 0; i < frameLengthSamples; ++i) {
-    int v = *src1++ - *src2++;
-    if (v < -32765)
-      v = -32765;
-    else if (v > 32765)
-      v = 32765;
-    *dst++ = (short)v;
-  }
+  memcpy(frame.GetPointerAndLock(), GetMixedSamples(), frameLengthSamples * 2);
+  frame.Unlock();
+  return PTrue;
+}
 
-  r->second.Unlock();
+PBoolean OpalAudioMixer::MixerFrame::GetStereoFrame(OpalAudioMixerStream::StreamFrame & frame) const
+{
+  frame.SetSize(frameLengthSamples * 2 * 2);
+  bool ok = GetStereoSamples((short *)frame.GetPointerAndLock());
   frame.Unlock();
+  return ok;
+}
 
-  return PTrue;
+PBoolean OpalAudioMixer::MixerFrame::GetChannelFrame(Key_T key, OpalAudioMixerStream::StreamFrame & frame) const
+{
+  if (FindChannel(key) == P_MAX_INDEX)
+    return PFalse;
+
+  frame.SetSize(frameLengthSamples * 2);
+  bool ok = GetChannelSamples(key, (short *)frame.GetPointerAndLock());
+  frame.Unlock();
+  return ok;
 }
 
-void OpalAudioMixer::MixerFrame::InsertFrame(Key_T key, OpalAudioMixerStream::StreamFrame &frame)
+/////////////////////////////////////////////////////////////////////////////
+
+OpalAudioMixerStream * OpalAudioMixer::StreamList::Find(const Key_T & key) const
 {
-	channelData.insert(MixerPCMMap_T::value_type(key, frame));
+  PINDEX lo = 0;
+  PINDEX hi = entries.size();
+  while (lo < hi) {
+    PINDEX mid = (lo+hi)/2;
+    if (entries[mid].key < key)
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+
+  if (lo < (PINDEX)entries.size() && entries[lo].key == key)
+    return (OpalAudioMixerStream *)entries[lo].stream.GetObject();
+  return NULL;
 }
 
 OpalAudioMixer::OpalAudioMixer(PBoolean _realTime, PBoolean _pushThread)
   : frameLengthMs(10)
+  , streams(new StreamList)
+  , activeStreams((const StreamList *)streams.GetObject())
   , channelNumber(0)
   , realTime(_realTime)
   , pushThread(_pushThread)
@@ -327,7 +478,19 @@ OpalAudioMixer::OpalAudioMixer(PBoolean _realTime, PBoolean _pushThread)
   , audioStarted(false)
   , firstRead(true)
   , outputTimestamp(10000000)
+  , nextOutputFrame(0)
 {
+  for (PINDEX i = 0; i < OUTPUT_FRAME_RING; ++i)
+    outputFrames.push_back(new MixerFrame(MS_TO_SAMPLES(frameLengthMs)));
+}
+
+
+OpalAudioMixer::~OpalAudioMixer()
+{
+  activeStreams = NULL;
+  retiredStreams.clear();
+  for (PINDEX i = 0; i < (PINDEX)outputFrames.size(); ++i)
+    delete outputFrames[i];
 }
 
 
@@ -336,23 +499,74 @@ PBoolean OpalAudioMixer::OnWriteAudio(const MixerFrame &)
   return true;
 }
 
+PSmartPointer OpalAudioMixer::GetStreams() const
+{
+  PWaitAndSignal m(streamsMutex);
+  return streams;
+}
+
 void OpalAudioMixer::AddStream(const Key_T & key, OpalAudioMixerStream *stream)
 {
-  PWaitAndSignal m(mutex);
-  stream->channelNumber = channelNumber++;
-  streamInfoMap.insert(StreamInfoMap_T::value_type(key, stream));
+  PSmartPointer newStream(stream);
+
+  {
+    PWaitAndSignal m(streamsMutex);
+
+    const StreamList & oldList = *(const StreamList *)streams.GetObject();
+    if (oldList.Find(key) != NULL)
+      return;
+
+    stream->channelNumber = channelNumber++;
+
+    StreamList * newList = new StreamList;
+    newList->entries.reserve(oldList.entries.size()+1);
+    bool inserted = false;
+    for (std::vector<StreamList::Entry>::const_iterator it = oldList.entries.begin(); it != oldList.entries.end(); ++it) {
+      if (!inserted && key < it->key) {
+        newList->entries.push_back(StreamList::Entry());
+        newList->entries.back().key = key;
+        newList->entries.back().stream = newStream;
+        inserted = true;
+      }
+      newList->entries.push_back(*it);
+    }
+    if (!inserted) {
+      newList->entries.push_back(StreamList::Entry());
+      newList->entries.back().key = key;
+      newList->entries.back().stream = newStream;
+    }
+
+    SetStreams(newList);
+  }
+
   StartThread();
 }
 
 
+void OpalAudioMixer::SetStreams(StreamList * newList)
+{
+  // Write() may still be using the old list, it goes when writing stops
+  retiredStreams.push_back(streams);
+  streams = newList;
+  activeStreams = newList;
+}
+
+
 void OpalAudioMixer::RemoveStream(const Key_T & key)
 {
-  PWaitAndSignal m(mutex);
-  StreamInfoMap_T::iterator r = streamInfoMap.find(key);
-  if (r != streamInfoMap.end()) {
-    delete r->second;
-    streamInfoMap.erase(r);
+  PWaitAndSignal m(streamsMutex);
+
+  const StreamList & oldList = *(const StreamList *)streams.GetObject();
+  if (oldList.Find(key) == NULL)
+    return;
+
+  StreamList * newList = new StreamList;
+  for (std::vector<StreamList::Entry>::const_iterator it = oldList.entries.begin(); it != oldList.entries.end(); ++it) {
+    if (it->key != key)
+      newList->entries.push_back(*it);
   }
+
+  SetStreams(newList);
 }
 
 
@@ -365,9 +579,11 @@ void OpalAudioMixer::RemoveAllStreams()
     mixerWorkerThread = NULL;
   }
 
-  while (streamInfoMap.size() > 0)
-    RemoveStream(streamInfoMap.begin()->first);
-
+  // Nothing may be writing now, so the retired lists and their streams can go
+  PWaitAndSignal m(streamsMutex);
+  streams = new StreamList;
+  activeStreams = (const StreamList *)streams.GetObject();
+  retiredStreams.clear();
   channelNumber = 0;
 }
 
@@ -418,37 +634,31 @@ void OpalAudioMixer::ReadRoutine()
 
 void OpalAudioMixer::WriteMixedFrame()
 {
-  // create output frame
-  MixerFrame * mixerFrame = new MixerFrame(MS_TO_SAMPLES(frameLengthMs));
+  // only one thread reads the streams at a time
+  PWaitAndSignal m(mutex);
 
-  // lock the mixer
-  mutex.Wait();
+  // reuse the next output frame
+  MixerFrame & mixerFrame = *outputFrames[nextOutputFrame];
+  nextOutputFrame = (nextOutputFrame+1)%outputFrames.size();
+  mixerFrame.Clear();
+  mixerFrame.SetTimestamp(outputTimestamp);
 
   // iterate through the streams and get an unmixed frame from each one
-  StreamInfoMap_T::iterator r;
-  OpalAudioMixerStream::StreamFrame tempFrame;
-  for (r = streamInfoMap.begin(); r != streamInfoMap.end(); ++r) {
-    OpalAudioMixerStream & stream = *r->second;
-    if (stream.ReadFrame(tempFrame, frameLengthMs)) {
-      tempFrame.timestamp = outputTimestamp;
-      tempFrame.channelNumber = stream.channelNumber;
-      mixerFrame->InsertFrame(r->first, tempFrame);
-    }
+  PSmartPointer currentStreams = GetStreams();
+  const StreamList & list = *(const StreamList *)currentStreams.GetObject();
+  for (std::vector<StreamList::Entry>::const_iterator it = list.entries.begin(); it != list.entries.end(); ++it) {
+    OpalAudioMixerStream & stream = *(OpalAudioMixerStream *)it->stream.GetObject();
+    if (stream.ReadSamples(mixerFrame.GetChannelBuffer()))
+      mixerFrame.InsertChannel(it->key, stream.channelNumber);
   }
 
   // increment the output timestamp
   outputTimestamp += MS_TO_SAMPLES(frameLengthMs);
 
-  // Unlock the mixer before calling the possibly time consuming OnWriteAudio() function
-  mutex.Signal();
-
-  if (!pushThread) {
-    //outputQueue.push_back(mixerFrame);
-  }
-  else {
-    OnWriteAudio(*mixerFrame);
-    delete mixerFrame;
-  }
+  /* Without the push thread the owner calls this itself to pull a frame. The
+     output queue for that case was never written, and the frame just leaked,
+     so OnWriteAudio() is how the frame gets out either way. */
+  OnWriteAudio(mixerFrame);
 }
 
 //
@@ -459,28 +669,20 @@ PBoolean OpalAudioMixer::Write(const Key_T & key, const RTP_DataFrame & rtp)
   if (rtp.GetPayloadSize() == 0)
     return PTrue;
 
-  // copy the data to PMembuffer
-  OpalAudioMixerStream::StreamFrame frame(rtp);
-
-  {
-    PWaitAndSignal m(mutex);
-
-    // find or create the stream we writing to
-    StreamInfoMap_T::iterator r = streamInfoMap.find(key);
-    OpalAudioMixerStream * stream;
-    if (r != streamInfoMap.end()) 
-      stream = r->second;
-    else {
-      stream = new OpalAudioMixerStream();
-      AddStream(key, stream);
-    }
+  // find or create the stream we writing to, lists are only freed once writing stops so no lock
+  OpalAudioMixerStream * stream = activeStreams->Find(key);
+  if (stream == NULL) {
+    AddStream(key, new OpalAudioMixerStream(MS_TO_SAMPLES(frameLengthMs)));
+    stream = activeStreams->Find(key);
+    if (stream == NULL)
+      return PFalse;
+  }
 
-    // write the data
-    stream->WriteFrame(frame);
+  // write the data
+  stream->WriteSamples((const short *)rtp.GetPayloadPtr(), BYTES_TO_SAMPLES(rtp.GetPayloadSize()), rtp.GetTimestamp());
 
-    // and tag the stream as started
-    audioStarted = PTrue;
-  }
+  // and tag the stream as started
+  audioStarted = PTrue;
 
   return PTrue;
 }
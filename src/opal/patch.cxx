@@ -170,8 +170,9 @@ PBoolean OpalMediaPatch::AddSink(const OpalMediaStreamPtr & sinkStream)
             "Destination format:\n" << setw(-1) << destinationFormat);
 
   if (sourceFormat == destinationFormat) {
-    PINDEX framesPerPacket = destinationFormat.GetOptionInteger(OpalAudioFormat::TxFramesPerPacketOption(),
-                                  sourceFormat.GetOptionInteger(OpalAudioFormat::TxFramesPerPacketOption(), 1));
+    static const OpalMediaOptionKey TxFramesPerPacketKey(OpalAudioFormat::TxFramesPerPacketOption());
+    PINDEX framesPerPacket = destinationFormat.GetOptionInteger(TxFramesPerPacketKey,
+                                  sourceFormat.GetOptionInteger(TxFramesPerPacketKey, 1));
     PINDEX packetSize = sourceFormat.GetFrameSize()*framesPerPacket;
     PINDEX packetTime = sourceFormat.GetFrameTime()*framesPerPacket;
     source.SetDataSize(packetSize, packetTime);
@@ -196,17 +197,37 @@ PBoolean OpalMediaPatch::AddSink(const OpalMediaStreamPtr & sinkStream)
            << " using transcoder " << *sink->primaryCodec << ", data size=" << sinkStream->GetDataSize());
   }
   else {
-    OpalMediaFormat intermediateFormat;
-    if (!OpalTranscoder::FindIntermediateFormat(sourceFormat, destinationFormat,
-                                                intermediateFormat)) {
+    OpalMediaFormatList intermediateFormats;
+    if (!OpalTranscoder::FindIntermediateFormats(sourceFormat, destinationFormat, intermediateFormats) ||
+         intermediateFormats.IsEmpty()) {
       PTRACE(1, "Patch\tCould find compatible media format for " << *sinkStream);
       return false;
     }
 
+    OpalMediaFormat intermediateFormat = intermediateFormats.front();
     sink->primaryCodec = OpalTranscoder::Create(sourceFormat, intermediateFormat, (const BYTE *)id, id.GetLength());
-    sink->secondaryCodec = OpalTranscoder::Create(intermediateFormat, destinationFormat, (const BYTE *)id, id.GetLength());
 
-    PTRACE(4, "Patch\tCreated two stage codec " << sourceFormat << "/" << intermediateFormat << "/" << destinationFormat << " with ID " << id);
+    if (intermediateFormats.GetSize() == 1) {
+      sink->secondaryCodec = OpalTranscoder::Create(intermediateFormat, destinationFormat, (const BYTE *)id, id.GetLength());
+      PTRACE(4, "Patch\tCreated two stage codec " << sourceFormat << "/" << intermediateFormat << "/" << destinationFormat << " with ID " << id);
+    }
+    else {
+      // Everything after the first transcoder is run as a single chain
+      OpalMediaFormatList chainFormats = intermediateFormats;
+      chainFormats += destinationFormat;
+      OpalTranscoderChain * chain = new OpalTranscoderChain(chainFormats, (const BYTE *)id, id.GetLength());
+      if (chain->IsValid())
+        sink->secondaryCodec = chain;
+      else
+        delete chain;
+      PTRACE(4, "Patch\tCreated " << intermediateFormats.GetSize()+1 << " stage codec " << sourceFormat << "/"
+             << destinationFormat << " via " << setfill(',') << intermediateFormats << setfill(' ') << " with ID " << id);
+    }
+
+    if (sink->primaryCodec == NULL || sink->secondaryCodec == NULL) {
+      PTRACE(1, "Patch\tCould not create transcoders for " << *sinkStream);
+      return false;
+    }
 
     if (!sinkStream->SetDataSize(sink->secondaryCodec->GetOptimalDataFrameSize(false), sourceFormat.GetFrameTime())) {
       PTRACE(1, "Patch\tSink stream " << *sinkStream << " cannot support data size "
@@ -338,6 +359,9 @@ OpalMediaPatch::Sink::Sink(OpalMediaPatch & p, const OpalMediaStreamPtr & s)
   SetRateControlParameters(stream->GetMediaFormat());
 #endif
 
+  intermediateFrames.SetPool(&patch.framePool);
+  finalFrames.SetPool(&patch.framePool);
+
   PTRACE(3, "Patch\tCreated Sink: format=" << stream->GetMediaFormat());
 }
 
@@ -671,7 +695,7 @@ bool OpalMediaPatch::Sink::WriteFrame(RTP_DataFrame & sourceFrame)
             sourceFrame.SetTimestamp(interFrame->GetTimestamp());
             continue;
           }
-          intermediateFrames.RemoveAll();
+          intermediateFrames.RecycleAll();
         }
       }
       return true;
@@ -704,7 +728,7 @@ bool OpalMediaPatch::Sink::WriteFrame(RTP_DataFrame & sourceFrame)
         sourceFrame.SetTimestamp(interFrame->GetTimestamp());
         continue;
       }
-      intermediateFrames.RemoveAll();
+      intermediateFrames.RecycleAll();
     }
   }
   else 
@@ -779,3 +803,162 @@ PBoolean OpalPassiveMediaPatch::PushFrame(RTP_DataFrame & frame)
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+
+#if OPAL_RTP_AGGREGATE
+
+static RTP_UDP * GetRelaySession(const OpalMediaStream & stream)
+{
+  const OpalRTPMediaStream * rtpStream = dynamic_cast<const OpalRTPMediaStream *>(&stream);
+  if (rtpStream == NULL)
+    return NULL;
+
+  RTP_UDP * session = dynamic_cast<RTP_UDP *>(&rtpStream->GetRtpSession());
+  if (session == NULL || !session->IsReactorAttached())
+    return NULL;
+
+  return session;
+}
+
+
+OpalRelayMediaPatch::OpalRelayMediaPatch(OpalMediaStream & source)
+  : OpalMediaPatch(source)
+  , m_relaySession(NULL)
+  , m_relaySink(NULL)
+{
+}
+
+
+OpalRelayMediaPatch::~OpalRelayMediaPatch()
+{
+  StopRelay();
+}
+
+
+bool OpalRelayMediaPatch::CanRelay(const OpalMediaStream & source, const OpalMediaStream & sink)
+{
+  if (!source.IsSource() || !sink.IsSink())
+    return false;
+
+  if (GetRelaySession(source) == NULL || GetRelaySession(sink) == NULL)
+    return false;
+
+  const OpalMediaFormat & sourceFormat = source.GetMediaFormat();
+  const OpalMediaFormat & sinkFormat = sink.GetMediaFormat();
+  return sourceFormat == sinkFormat && sourceFormat.GetPayloadType() == sinkFormat.GetPayloadType();
+}
+
+
+void OpalRelayMediaPatch::Start()
+{
+  if (!StartRelay())
+    OpalMediaPatch::Start();
+}
+
+
+void OpalRelayMediaPatch::Close()
+{
+  StopRelay();
+  OpalMediaPatch::Close();
+}
+
+
+PBoolean OpalRelayMediaPatch::AddSink(const OpalMediaStreamPtr & stream)
+{
+  bool wasRelaying = IsRelaying();
+  StopRelay();
+
+  if (!OpalMediaPatch::AddSink(stream))
+    return false;
+
+  // More than one sink needs the patch thread to duplicate the packets
+  if (wasRelaying)
+    OpalMediaPatch::Start();
+  return true;
+}
+
+
+void OpalRelayMediaPatch::RemoveSink(const OpalMediaStreamPtr & stream)
+{
+  StopRelay();
+  OpalMediaPatch::RemoveSink(stream);
+}
+
+
+void OpalRelayMediaPatch::AddFilter(const PNotifier & filter, const OpalMediaFormat & stage)
+{
+  bool wasRelaying = IsRelaying();
+  StopRelay();
+
+  OpalMediaPatch::AddFilter(filter, stage);
+
+  // Filters need to see every packet, so the patch thread takes over
+  if (wasRelaying)
+    OpalMediaPatch::Start();
+}
+
+
+bool OpalRelayMediaPatch::StartRelay()
+{
+  PWaitAndSignal mutex(m_relayMutex);
+
+  if (m_relaySession != NULL)
+    return true;
+
+  {
+    PReadWaitAndSignal lock(inUse);
+    if (sinks.GetSize() != 1 || filters.GetSize() != 0 || !CanRelay(source, *sinks.front().stream))
+      return false;
+    m_relaySinkStream = sinks.front().stream;
+  }
+
+  m_relaySession = GetRelaySession(source);
+  m_relaySink = GetRelaySession(*m_relaySinkStream);
+
+  source.OnPatchStart();
+
+  if (!m_relaySession->SetRelayHandler(this)) {
+    source.OnPatchStop();
+    m_relaySession = NULL;
+    m_relaySink = NULL;
+    m_relaySinkStream.SetNULL();
+    return false;
+  }
+
+  PTRACE(3, "Patch\tRelaying " << *this);
+  return true;
+}
+
+
+void OpalRelayMediaPatch::StopRelay()
+{
+  PWaitAndSignal mutex(m_relayMutex);
+
+  if (m_relaySession == NULL)
+    return;
+
+  // Waits for any OnRelayData() in progress, so the sink may then be released
+  m_relaySession->SetRelayHandler(NULL);
+  source.OnPatchStop();
+
+  PTRACE(3, "Patch\tStopped relaying " << *this);
+
+  m_relaySession = NULL;
+  m_relaySink = NULL;
+  m_relaySinkStream.SetNULL();
+}
+
+
+void OpalRelayMediaPatch::OnRelayData(RTP_UDP & /*session*/, RTP_DataFrame * const * frames, PINDEX count)
+{
+  /* Called from a reactor thread with the source session relay mutex held,
+     so must not take inUse as Close() holds that while closing the source. */
+  if (m_relaySinkStream->IsPaused())
+    return;
+
+  if (!m_relaySink->WriteRelayData(frames, count)) {
+    PTRACE(2, "Patch\tRelay write failed for " << *m_relaySinkStream);
+  }
+}
+
+#endif // OPAL_RTP_AGGREGATE
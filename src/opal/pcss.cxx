@@ -362,7 +362,9 @@ OpalPCSSConnection::OpalPCSSConnection(OpalCall & call,
     soundChannelRecordDevice(recordDevice),
     soundChannelBuffers(ep.GetSoundChannelBufferDepth())
 {
-  silenceDetector = new OpalPCM16SilenceDetector(endpoint.GetManager().GetSilenceDetectParams());
+  OpalPCM16SilenceDetector * detector = new OpalPCM16SilenceDetector(endpoint.GetManager().GetSilenceDetectParams());
+  detector->SetWorker(endpoint.GetManager().GetSilenceDetectWorker());
+  silenceDetector = detector;
   echoCanceler = new OpalEchoCanceler;
 
   PTRACE(4, "PCSS\tCreated PC sound system connection: token=\"" << callToken << "\" "
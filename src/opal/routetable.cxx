@@ -0,0 +1,345 @@
+/*
+ * routetable.cxx
+ *
+ * Compiled call routing table
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#pragma implementation "routetable.h"
+#endif
+
+#include <opal/buildopts.h>
+
+#include <opal/routetable.h>
+
+#include <algorithm>
+#include <ctype.h>
+
+
+#define new PNEW
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+OpalCompiledRouteTable::Entry::Entry()
+  : m_kind(RegexEntry)
+  , m_split(false)
+  , m_regex(NULL)
+{
+}
+
+
+OpalCompiledRouteTable::Node::~Node()
+{
+  for (std::map<char, Node *>::iterator it = m_children.begin(); it != m_children.end(); ++it)
+    delete it->second;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+OpalCompiledRouteTable::OpalCompiledRouteTable()
+{
+  for (PINDEX i = 0; i < NumKinds; ++i)
+    m_kindCount[i] = 0;
+}
+
+
+OpalCompiledRouteTable::~OpalCompiledRouteTable()
+{
+  for (std::vector<Entry *>::iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+    delete (*it)->m_regex;
+    delete *it;
+  }
+}
+
+
+PString OpalCompiledRouteTable::GetRegularExpression(const PString & pattern)
+{
+  PString expression = '^';
+
+  // Test for backward compatibility format
+  PINDEX colon = pattern.Find(':');
+  if (colon != P_MAX_INDEX && pattern.Find('\t', colon) == P_MAX_INDEX)
+    expression += pattern.Left(colon+1) + ".*\t" + pattern.Mid(colon+1);
+  else
+    expression += pattern;
+
+  expression += '$';
+  return expression;
+}
+
+
+bool OpalCompiledRouteTable::ParseWildcard(const PString & expression, Wildcard & wildcard)
+{
+  PINDEX length = expression.GetLength();
+  if (length < 2 || expression[0] != '^' || expression[length-1] != '$')
+    return false;
+
+  const char * ptr = (const char *)expression + 1;
+  const char * end = (const char *)expression + length - 1;
+  while (ptr < end) {
+    char c = *ptr++;
+    switch (c) {
+      case '\\' :
+        // Only escaped special characters are literals, anything else varies with the library
+        if (ptr >= end || strchr(".[]()*+?{}|^$\\", *ptr) == NULL)
+          return false;
+        wildcard.push_back(tolower((BYTE)*ptr++));
+        break;
+
+      case '.' :
+        if (ptr < end && *ptr == '*') {
+          ++ptr;
+          if (wildcard.empty() || wildcard.back() != AnySequence)
+            wildcard.push_back(AnySequence);
+        }
+        else
+          wildcard.push_back(AnyChar);
+        break;
+
+      case '[' :
+      case ']' :
+      case '(' :
+      case ')' :
+      case '*' :
+      case '+' :
+      case '?' :
+      case '{' :
+      case '}' :
+      case '|' :
+      case '^' :
+      case '$' :
+        return false;
+
+      default :
+        wildcard.push_back(tolower((BYTE)c));
+    }
+  }
+
+  return true;
+}
+
+
+bool OpalCompiledRouteTable::MatchWildcard(const Wildcard & wildcard, const char * str, PINDEX length)
+{
+  // Iterative match, backtracking only to the most recent ".*"
+  size_t count = wildcard.size();
+  size_t pos = 0;
+  size_t star = count;
+  PINDEX starMatched = 0;
+  PINDEX matched = 0;
+
+  while (matched < length) {
+    if (pos < count && (wildcard[pos] == AnyChar || wildcard[pos] == tolower((BYTE)str[matched]))) {
+      ++pos;
+      ++matched;
+    }
+    else if (pos < count && wildcard[pos] == AnySequence) {
+      star = pos++;
+      starMatched = matched;
+    }
+    else if (star < count) {
+      pos = star + 1;
+      matched = ++starMatched;
+    }
+    else
+      return false;
+  }
+
+  while (pos < count && wildcard[pos] == AnySequence)
+    ++pos;
+
+  return pos == count;
+}
+
+
+bool OpalCompiledRouteTable::Append(const PString & pattern, const PString & destination)
+{
+  PString expression = GetRegularExpression(pattern);
+
+  Entry * entry = new Entry;
+  entry->m_destination = destination;
+
+  if (!ParseWildcard(expression, entry->m_wildcard)) {
+    entry->m_kind = RegexEntry;
+    entry->m_regex = new PRegularExpression(expression, PRegularExpression::IgnoreCase|PRegularExpression::Extended);
+    if (entry->m_regex->GetErrorCode() != PRegularExpression::NoError) {
+      PTRACE(1, "OpalMan\tCould not compile route regular expression \"" << expression << '"');
+      delete entry->m_regex;
+      delete entry;
+      return false;
+    }
+  }
+  else {
+    Wildcard::iterator tab = std::find(entry->m_wildcard.begin(), entry->m_wildcard.end(), (int)'\t');
+    entry->m_split = tab != entry->m_wildcard.end() && std::find(tab+1, entry->m_wildcard.end(), (int)'\t') == entry->m_wildcard.end();
+    if (entry->m_split) {
+      entry->m_aParty.assign(entry->m_wildcard.begin(), tab);
+      entry->m_bParty.assign(tab+1, entry->m_wildcard.end());
+    }
+
+    Wildcard::iterator aWild = entry->m_aParty.begin();
+    while (aWild != entry->m_aParty.end() && *aWild >= 0)
+      ++aWild;
+
+    if (!entry->m_split)
+      entry->m_kind = WildcardEntry;
+    else if (entry->m_bParty.size() == 1 && entry->m_bParty[0] == AnySequence &&
+             aWild != entry->m_aParty.end() && *aWild == AnySequence && aWild+1 == entry->m_aParty.end()) {
+      entry->m_kind = SchemeEntry;
+      for (Wildcard::iterator it = entry->m_aParty.begin(); it != aWild; ++it)
+        entry->m_scheme += (char)*it;
+    }
+    else if (!entry->m_bParty.empty() && entry->m_bParty[0] >= 0)
+      entry->m_kind = PrefixEntry;
+    else
+      entry->m_kind = WildcardEntry;
+  }
+
+  PINDEX index = m_entries.size();
+  m_entries.push_back(entry);
+  ++m_kindCount[entry->m_kind];
+
+  if (entry->m_kind != PrefixEntry)
+    m_unindexed.push_back(index);
+  else {
+    Node * node = &m_root;
+    for (Wildcard::iterator it = entry->m_bParty.begin(); it != entry->m_bParty.end() && *it >= 0; ++it) {
+      Node * & child = node->m_children[(char)*it];
+      if (child == NULL)
+        child = new Node;
+      node = child;
+    }
+    node->m_entries.push_back(index);
+  }
+
+  PTRACE(5, "OpalMan\tCompiled route " << index << " \"" << pattern << "\" as kind " << entry->m_kind);
+  return true;
+}
+
+
+bool OpalCompiledRouteTable::Matches(const Entry & entry, const PString & search, PINDEX tab) const
+{
+  switch (entry.m_kind) {
+    case RegexEntry :
+      {
+        PINDEX pos;
+        return entry.m_regex->Execute(search, pos);
+      }
+
+    case SchemeEntry :
+      if (tab != P_MAX_INDEX) {
+        PINDEX length = entry.m_scheme.GetLength();
+        if (tab < length)
+          return false;
+        for (PINDEX i = 0; i < length; ++i) {
+          if (tolower((BYTE)search[i]) != (BYTE)entry.m_scheme[i])
+            return false;
+        }
+        return true;
+      }
+      break;
+
+    default :
+      if (tab != P_MAX_INDEX && entry.m_split)
+        return MatchWildcard(entry.m_aParty, search, tab) &&
+               MatchWildcard(entry.m_bParty, (const char *)search + tab + 1, search.GetLength() - tab - 1);
+  }
+
+  return MatchWildcard(entry.m_wildcard, search, search.GetLength());
+}
+
+
+bool OpalCompiledRouteTable::Find(const PString & search, PINDEX & index, PString & destination) const
+{
+  PINDEX size = m_entries.size();
+  if (index < 0)
+    index = 0;
+
+  /* A pattern with one literal tab can only match a search with one tab if
+     the two line up, so may be matched a party at a time and the trie used
+     on the B-party. Anything else, e.g. a label, is checked entry by entry. */
+  PINDEX tab = search.Find('\t');
+  if (tab != P_MAX_INDEX && search.Find('\t', tab+1) != P_MAX_INDEX)
+    tab = P_MAX_INDEX;
+
+  if (tab == P_MAX_INDEX) {
+    for (PINDEX i = index; i < size; ++i) {
+      if (Matches(*m_entries[i], search, tab)) {
+        destination = m_entries[i]->m_destination;
+        index = i+1;
+        return true;
+      }
+    }
+    index = size;
+    return false;
+  }
+
+  std::vector<PINDEX> prefixed;
+  const Node * node = &m_root;
+  for (const char * ptr = (const char *)search + tab + 1; ; ++ptr) {
+    for (std::vector<PINDEX>::const_iterator it = node->m_entries.begin(); it != node->m_entries.end(); ++it) {
+      if (*it >= index)
+        prefixed.push_back(*it);
+    }
+
+    if (*ptr == '\0')
+      break;
+
+    std::map<char, Node *>::const_iterator child = node->m_children.find((char)tolower((BYTE)*ptr));
+    if (child == node->m_children.end())
+      break;
+    node = child->second;
+  }
+  std::sort(prefixed.begin(), prefixed.end());
+
+  // Merge with the unindexed entries, so candidates are tried in table order
+  std::vector<PINDEX>::const_iterator other = std::lower_bound(m_unindexed.begin(), m_unindexed.end(), index);
+  std::vector<PINDEX>::const_iterator prefix = prefixed.begin();
+  while (other != m_unindexed.end() || prefix != prefixed.end()) {
+    PINDEX i;
+    if (prefix == prefixed.end() || (other != m_unindexed.end() && *other < *prefix))
+      i = *other++;
+    else
+      i = *prefix++;
+
+    if (Matches(*m_entries[i], search, tab)) {
+      destination = m_entries[i]->m_destination;
+      index = i+1;
+      return true;
+    }
+  }
+
+  index = size;
+  return false;
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
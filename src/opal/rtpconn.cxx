@@ -136,6 +136,10 @@ RTP_Session * OpalRTPConnection::CreateSession(const OpalTransport & transport,
   if (rtpSession == NULL) 
     return NULL;
 
+#if OPAL_RTP_AGGREGATE
+  rtpSession->SetReactor(manager.GetRTPReactor());
+#endif
+
   WORD firstPort = manager.GetRtpIpPortPair();
   WORD nextPort = firstPort;
   while (!rtpSession->Open(localAddress, nextPort, nextPort, manager.GetRtpIpTypeofService(), natMethod, rtpqos)) {
@@ -147,6 +151,11 @@ RTP_Session * OpalRTPConnection::CreateSession(const OpalTransport & transport,
     }
   }
 
+#if OPAL_STATISTICS
+  // Once open, so the local port tells apart the sessions of each connection
+  rtpSession->SetStatisticsRegistry(&manager.GetStatisticsRegistry(), GetCall().GetToken());
+#endif
+
   localAddress = rtpSession->GetLocalAddress();
   if (manager.TranslateIPAddress(localAddress, remoteAddress)){
     rtpSession->SetLocalAddress(localAddress);
@@ -404,6 +413,10 @@ void OpalRTPMediaSession::Close()
 {
   if (rtpSession != NULL) {
     PTRACE(3, "RTP\tDeleting session " << rtpSession->GetSessionID());
+#if OPAL_STATISTICS
+    // While the session is still whole, as an export calls into it virtually
+    rtpSession->SetStatisticsRegistry(NULL, PString::Empty());
+#endif
     rtpSession->Close(PTrue);
     rtpSession->SetJitterBufferSize(0, 0);
     delete rtpSession;
@@ -0,0 +1,444 @@
+/*
+ * scheduler.cxx
+ *
+ * Shared bounded work scheduler
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#pragma implementation "scheduler.h"
+#endif
+
+#include <opal/buildopts.h>
+
+#include <opal/scheduler.h>
+
+
+#define new PNEW
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+/* Calls a notifier as PThread::Create() would, so the existing thread
+   functions can be posted unchanged. */
+class OpalNotifierWork : public OpalWorkScheduler::Work
+{
+  public:
+    OpalNotifierWork(const PNotifier & notifier, INT extra, const PString & key)
+      : OpalWorkScheduler::Work(key)
+      , m_notifier(notifier)
+      , m_extra(extra)
+    {
+    }
+
+    virtual void Run()
+    {
+      m_notifier(*PThread::Current(), m_extra);
+    }
+
+  protected:
+    PNotifier m_notifier;
+    INT       m_extra;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+OpalWorkScheduler::Work::Work(const PString & key)
+  : m_key(key)
+  , m_posted(0)
+{
+}
+
+
+OpalWorkScheduler::Work::~Work()
+{
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+OpalWorkScheduler::Statistics::Statistics()
+  : m_threads(0)
+  , m_idleThreads(0)
+  , m_posted(0)
+  , m_executed(0)
+  , m_stolen(0)
+  , m_serialised(0)
+  , m_queueDepth(0)
+  , m_peakQueueDepth(0)
+  , m_totalLatency(0)
+  , m_maxLatency(0)
+  , m_totalRunTime(0)
+  , m_maxRunTime(0)
+{
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+OpalWorkScheduler::OpalWorkScheduler(unsigned minThreads, unsigned maxThreads, const char * threadName)
+  : m_available(0, INT_MAX)
+  , m_running(true)
+  , m_threadName(threadName)
+  , m_peakQueueDepth(0)
+  , m_posted(0)
+  , m_serialised(0)
+{
+  if (maxThreads == 0)
+    maxThreads = 1;
+  if (minThreads > maxThreads)
+    minThreads = maxThreads;
+  if (minThreads == 0)
+    minThreads = 1;
+
+  // Never reallocated, so workers may be indexed without the mutex
+  m_workers.reserve(maxThreads);
+
+  for (unsigned i = 0; i < minThreads; ++i)
+    AddWorker();
+
+  PTRACE(4, "Scheduler\tStarted " << minThreads << " of up to " << maxThreads << " threads");
+}
+
+
+OpalWorkScheduler::~OpalWorkScheduler()
+{
+  Shutdown();
+
+  for (std::vector<Worker *>::iterator it = m_workers.begin(); it != m_workers.end(); ++it)
+    delete *it;
+}
+
+
+void OpalWorkScheduler::AddWorker()
+{
+  PWaitAndSignal mutex(m_workersMutex);
+
+  if (!m_running || m_workers.size() >= m_workers.capacity())
+    return;
+
+  unsigned index = m_workers.size();
+  m_workers.push_back(new Worker(*this, index, psprintf("%s:%u", (const char *)m_threadName, index)));
+  ++m_workerCount;
+
+  PTRACE_IF(4, index > 0, "Scheduler\tAdded worker thread " << index);
+}
+
+
+OpalWorkScheduler::KeyStripe & OpalWorkScheduler::GetKeyStripe(const PString & key)
+{
+  return m_keyStripes[key.HashFunction() % NumKeyStripes];
+}
+
+
+bool OpalWorkScheduler::Post(Work * work)
+{
+  if (PAssertNULL(work) == NULL)
+    return false;
+
+  // Shutdown() takes this for write, so nothing can be posted after it
+  PReadWaitAndSignal running(m_runningMutex);
+  if (!m_running)
+    return false;
+
+  work->m_posted = PTime().GetTimestamp();
+
+  bool serialised = false;
+  if (!work->m_key.IsEmpty()) {
+    KeyStripe & stripe = GetKeyStripe(work->m_key);
+    PWaitAndSignal mutex(stripe.m_mutex);
+    std::map<PString, WorkQueue>::iterator it = stripe.m_active.find(work->m_key);
+    if (it != stripe.m_active.end()) {
+      // Executed by OnCompleted() when the work ahead of it is done
+      it->second.push_back(work);
+      serialised = true;
+    }
+    else
+      stripe.m_active[work->m_key];
+  }
+
+  PINDEX depth = ++m_queueDepth;
+  {
+    PWaitAndSignal mutex(m_countersMutex);
+    ++m_posted;
+    if (serialised)
+      ++m_serialised;
+    if (depth > m_peakQueueDepth)
+      m_peakQueueDepth = depth;
+  }
+
+  if (!serialised)
+    Enqueue(work, NULL);
+
+  return true;
+}
+
+
+bool OpalWorkScheduler::Post(const PNotifier & notifier, INT extra, const PString & key)
+{
+  Work * work = new OpalNotifierWork(notifier, extra, key);
+  if (Post(work))
+    return true;
+
+  delete work;
+  return false;
+}
+
+
+void OpalWorkScheduler::Enqueue(Work * work, Worker * current)
+{
+  Worker * worker = current;
+  if (worker == NULL) {
+    if (m_idleCount == 0 && (unsigned)m_workerCount < m_workers.capacity())
+      AddWorker();
+    worker = m_workers[(unsigned)++m_nextWorker % (unsigned)m_workerCount];
+  }
+
+  worker->Push(work, current != NULL);
+  m_available.Signal();
+}
+
+
+OpalWorkScheduler::Work * OpalWorkScheduler::TakeWork(Worker & worker)
+{
+  for (;;) {
+    Work * work = worker.Pop();
+    if (work != NULL)
+      return work;
+
+    unsigned count = m_workerCount;
+    for (unsigned i = 1; i < count; ++i) {
+      work = m_workers[(worker.m_index + i) % count]->Steal();
+      if (work != NULL) {
+        worker.m_mutex.Wait();
+        ++worker.m_stolen;
+        worker.m_mutex.Signal();
+        return work;
+      }
+    }
+
+    /* Each Signal() follows a Push(), so while running there is work
+       somewhere for this thread, another thread just got to it first in the
+       order the queues were scanned. */
+    if (!m_running)
+      return NULL;
+
+    PThread::Yield();
+  }
+}
+
+
+void OpalWorkScheduler::Execute(Worker & worker, Work * work)
+{
+  --m_queueDepth;
+
+  PString key = work->m_key;
+  PInt64 start = PTime().GetTimestamp();
+  PUInt64 latency = start > work->m_posted ? start - work->m_posted : 0;
+
+  work->Run();
+  delete work;
+
+  PInt64 end = PTime().GetTimestamp();
+  PUInt64 runTime = end > start ? end - start : 0;
+
+  worker.m_mutex.Wait();
+  ++worker.m_executed;
+  worker.m_totalLatency += latency;
+  if (latency > worker.m_maxLatency)
+    worker.m_maxLatency = latency;
+  worker.m_totalRunTime += runTime;
+  if (runTime > worker.m_maxRunTime)
+    worker.m_maxRunTime = runTime;
+  worker.m_mutex.Signal();
+
+  if (!key.IsEmpty())
+    OnCompleted(worker, key);
+}
+
+
+void OpalWorkScheduler::OnCompleted(Worker & worker, const PString & key)
+{
+  Work * next = NULL;
+
+  {
+    KeyStripe & stripe = GetKeyStripe(key);
+    PWaitAndSignal mutex(stripe.m_mutex);
+    std::map<PString, WorkQueue>::iterator it = stripe.m_active.find(key);
+    if (it == stripe.m_active.end())
+      return;
+
+    if (it->second.empty())
+      stripe.m_active.erase(it);
+    else {
+      next = it->second.front();
+      it->second.pop_front();
+    }
+  }
+
+  // Keep the key on this thread, its data is likely to still be in cache
+  if (next != NULL)
+    Enqueue(next, &worker);
+}
+
+
+void OpalWorkScheduler::Shutdown()
+{
+  {
+    PWriteWaitAndSignal running(m_runningMutex);
+    if (!m_running)
+      return;
+    m_running = false;
+  }
+
+  PTRACE(4, "Scheduler\tShutting down " << (unsigned)m_workerCount << " threads");
+
+  // One extra signal per thread, each exits when it finds nothing to do
+  PINDEX count = m_workerCount;
+  for (PINDEX i = 0; i < count; ++i)
+    m_available.Signal();
+
+  for (PINDEX i = 0; i < count; ++i)
+    m_workers[i]->WaitForTermination();
+
+  // Serialised work released by the last few jobs may be left over
+  if (count > 0) {
+    Work * work;
+    while ((work = TakeWork(*m_workers[0])) != NULL)
+      Execute(*m_workers[0], work);
+  }
+}
+
+
+void OpalWorkScheduler::GetStatistics(Statistics & statistics) const
+{
+  statistics = Statistics();
+
+  unsigned count = m_workerCount;
+  statistics.m_threads = count;
+  statistics.m_idleThreads = m_idleCount;
+  for (unsigned i = 0; i < count; ++i)
+    m_workers[i]->GetStatistics(statistics);
+
+  statistics.m_queueDepth = m_queueDepth;
+
+  PWaitAndSignal mutex(m_countersMutex);
+  statistics.m_posted = m_posted;
+  statistics.m_serialised = m_serialised;
+  statistics.m_peakQueueDepth = m_peakQueueDepth;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+OpalWorkScheduler::Worker::Worker(OpalWorkScheduler & scheduler, unsigned index, const PString & name)
+  : PThread(65536, NoAutoDeleteThread, NormalPriority, name)
+  , m_scheduler(scheduler)
+  , m_index(index)
+  , m_executed(0)
+  , m_stolen(0)
+  , m_totalLatency(0)
+  , m_maxLatency(0)
+  , m_totalRunTime(0)
+  , m_maxRunTime(0)
+{
+  Resume();
+}
+
+
+void OpalWorkScheduler::Worker::Push(Work * work, bool next)
+{
+  PWaitAndSignal mutex(m_mutex);
+  if (next)
+    m_queue.push_front(work);
+  else
+    m_queue.push_back(work);
+}
+
+
+OpalWorkScheduler::Work * OpalWorkScheduler::Worker::Pop()
+{
+  PWaitAndSignal mutex(m_mutex);
+  if (m_queue.empty())
+    return NULL;
+
+  Work * work = m_queue.front();
+  m_queue.pop_front();
+  return work;
+}
+
+
+OpalWorkScheduler::Work * OpalWorkScheduler::Worker::Steal()
+{
+  // Take from the other end to the owner, so rarely contend for the same job
+  PWaitAndSignal mutex(m_mutex);
+  if (m_queue.empty())
+    return NULL;
+
+  Work * work = m_queue.back();
+  m_queue.pop_back();
+  return work;
+}
+
+
+void OpalWorkScheduler::Worker::GetStatistics(Statistics & statistics) const
+{
+  PWaitAndSignal mutex(m_mutex);
+  statistics.m_executed += m_executed;
+  statistics.m_stolen += m_stolen;
+  statistics.m_totalLatency += m_totalLatency;
+  if (m_maxLatency > statistics.m_maxLatency)
+    statistics.m_maxLatency = m_maxLatency;
+  statistics.m_totalRunTime += m_totalRunTime;
+  if (m_maxRunTime > statistics.m_maxRunTime)
+    statistics.m_maxRunTime = m_maxRunTime;
+}
+
+
+void OpalWorkScheduler::Worker::Main()
+{
+  PTRACE(4, "Scheduler\tWorker thread started");
+
+  for (;;) {
+    ++m_scheduler.m_idleCount;
+    m_scheduler.m_available.Wait();
+    --m_scheduler.m_idleCount;
+
+    Work * work = m_scheduler.TakeWork(*this);
+    if (work == NULL)
+      break;
+
+    m_scheduler.Execute(*this, work);
+  }
+
+  PTRACE(4, "Scheduler\tWorker thread ended");
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
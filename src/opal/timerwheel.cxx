@@ -0,0 +1,320 @@
+/*
+ * timerwheel.cxx
+ *
+ * Shared hierarchical timer wheel
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#pragma implementation "timerwheel.h"
+#endif
+
+#include <opal/buildopts.h>
+
+#include <opal/timerwheel.h>
+
+
+#define new PNEW
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+OpalTimerWheel::Timer::Timer()
+  : m_next(NULL)
+  , m_prev(NULL)
+  , m_list(NULL)
+  , m_expiry(0)
+  , m_shard(NULL)
+{
+}
+
+
+OpalTimerWheel::Timer::~Timer()
+{
+  PAssert(m_shard == NULL, "Timer destroyed while still scheduled");
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+OpalTimerWheel::OpalTimerWheel(unsigned threadCount, const PTimeInterval & resolution, const char * threadName)
+  : m_resolution(resolution > 0 ? resolution : PTimeInterval(1))
+  , m_epoch(PTimer::Tick())
+{
+  if (threadCount == 0)
+    threadCount = 1;
+
+  for (unsigned i = 0; i < threadCount; ++i)
+    m_shards.push_back(new Shard(*this, psprintf("%s:%u", threadName, i)));
+
+  PTRACE(4, "TimerWheel\tStarted " << threadCount << " threads, resolution " << m_resolution);
+}
+
+
+OpalTimerWheel::~OpalTimerWheel()
+{
+  for (std::vector<Shard *>::iterator it = m_shards.begin(); it != m_shards.end(); ++it) {
+    (*it)->Shutdown();
+    delete *it;
+  }
+}
+
+
+OpalTimerWheel::Shard & OpalTimerWheel::GetShard(const Timer & timer) const
+{
+  // Timer objects are at least pointer aligned, so discard low bits
+  return *m_shards[((size_t)&timer >> 4) % m_shards.size()];
+}
+
+
+void OpalTimerWheel::Schedule(Timer & timer, const PTimeInterval & delay)
+{
+  GetShard(timer).Schedule(timer, (delay.GetMilliSeconds() + m_resolution.GetMilliSeconds() - 1)/m_resolution.GetMilliSeconds());
+}
+
+
+bool OpalTimerWheel::Cancel(Timer & timer, bool wait)
+{
+  return GetShard(timer).Cancel(timer, wait);
+}
+
+
+PINDEX OpalTimerWheel::GetTimerCount() const
+{
+  PINDEX count = 0;
+  for (std::vector<Shard *>::const_iterator it = m_shards.begin(); it != m_shards.end(); ++it)
+    count += (*it)->GetTimerCount();
+  return count;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+OpalTimerWheel::Shard::Shard(OpalTimerWheel & wheel, const PString & name)
+  : PThread(65536, NoAutoDeleteThread, HighestPriority, name)
+  , m_wheel(wheel)
+  , m_expired(NULL)
+  , m_count(0)
+  , m_running(true)
+{
+  memset(m_slots, 0, sizeof(m_slots));
+  m_currentTick = GetNowTick();
+  Resume();
+}
+
+
+PUInt64 OpalTimerWheel::Shard::GetNowTick() const
+{
+  return (PTimer::Tick() - m_wheel.m_epoch).GetMilliSeconds()/m_wheel.m_resolution.GetMilliSeconds();
+}
+
+
+void OpalTimerWheel::Shard::Shutdown()
+{
+  m_running = false;
+  m_wake.Signal();
+  WaitForTermination();
+
+  // Discard anything left, without calling OnTimeout()
+  PWaitAndSignal mutex(m_mutex);
+  for (PINDEX level = 0; level < NumLevels; ++level) {
+    for (PINDEX slot = 0; slot < SlotsPerLevel; ++slot) {
+      while (m_slots[level][slot] != NULL)
+        Unlink(*m_slots[level][slot]);
+    }
+  }
+  while (m_expired != NULL)
+    Unlink(*m_expired);
+}
+
+
+void OpalTimerWheel::Shard::Insert(Timer & timer)
+{
+  PUInt64 delta = timer.m_expiry - m_currentTick;
+
+  PINDEX level = 0;
+  while (level < NumLevels-1 && delta >= ((PUInt64)1 << (LevelBits*(level+1))))
+    ++level;
+
+  PINDEX slot;
+  if (delta < ((PUInt64)1 << (LevelBits*NumLevels)))
+    slot = (PINDEX)(timer.m_expiry >> (LevelBits*level)) & SlotMask;
+  else {
+    // Beyond the range of the wheel, put in the last slot to be reached at
+    // the top level, it will be re-inserted as it is cascaded down.
+    slot = (PINDEX)((m_currentTick >> (LevelBits*level)) - 1) & SlotMask;
+  }
+
+  Timer ** list = &m_slots[level][slot];
+  timer.m_list = list;
+  timer.m_prev = NULL;
+  timer.m_next = *list;
+  if (*list != NULL)
+    (*list)->m_prev = &timer;
+  *list = &timer;
+  timer.m_shard = this;
+}
+
+
+void OpalTimerWheel::Shard::Unlink(Timer & timer)
+{
+  if (timer.m_prev != NULL)
+    timer.m_prev->m_next = timer.m_next;
+  else
+    *timer.m_list = timer.m_next;
+
+  if (timer.m_next != NULL)
+    timer.m_next->m_prev = timer.m_prev;
+
+  timer.m_next = timer.m_prev = NULL;
+  timer.m_list = NULL;
+  timer.m_shard = NULL;
+  --m_count;
+}
+
+
+void OpalTimerWheel::Shard::Schedule(Timer & timer, PInt64 delay)
+{
+  bool wasIdle;
+  {
+    PWaitAndSignal mutex(m_mutex);
+
+    if (timer.m_shard != NULL)
+      Unlink(timer);
+
+    // Wheel does not advance while idle, so catch up
+    PUInt64 now = GetNowTick();
+    if (m_count == 0)
+      m_currentTick = now;
+
+    // Always at least one tick in the future, as current tick processed
+    timer.m_expiry = now + (delay > 0 ? delay : 0);
+    if (timer.m_expiry <= m_currentTick)
+      timer.m_expiry = m_currentTick + 1;
+    Insert(timer);
+
+    wasIdle = m_count++ == 0;
+  }
+
+  if (wasIdle)
+    m_wake.Signal();
+}
+
+
+bool OpalTimerWheel::Shard::Cancel(Timer & timer, bool wait)
+{
+  bool wasScheduled;
+  {
+    PWaitAndSignal mutex(m_mutex);
+    wasScheduled = timer.m_shard != NULL;
+    if (wasScheduled)
+      Unlink(timer);
+  }
+
+  // Wait for any dispatch in progress, which may include this timer
+  if (wait) {
+    m_dispatchMutex.Wait();
+    m_dispatchMutex.Signal();
+  }
+
+  return wasScheduled;
+}
+
+
+void OpalTimerWheel::Shard::Advance(PUInt64 target)
+{
+  while (m_currentTick < target) {
+    ++m_currentTick;
+
+    // Cascade higher levels down when lower level wraps
+    PUInt64 tick = m_currentTick;
+    for (PINDEX level = 1; level < NumLevels && (tick & SlotMask) == 0; ++level) {
+      tick >>= LevelBits;
+      Timer * list = m_slots[level][tick & SlotMask];
+      m_slots[level][tick & SlotMask] = NULL;
+      while (list != NULL) {
+        Timer * timer = list;
+        list = list->m_next;
+        Insert(*timer);
+      }
+    }
+
+    // Move everything in the current slot to the expired list
+    Timer ** slot = &m_slots[0][m_currentTick & SlotMask];
+    while (*slot != NULL) {
+      Timer * timer = *slot;
+      *slot = timer->m_next;
+      timer->m_prev = NULL;
+      timer->m_next = m_expired;
+      if (m_expired != NULL)
+        m_expired->m_prev = timer;
+      m_expired = timer;
+      timer->m_list = &m_expired;
+    }
+  }
+}
+
+
+void OpalTimerWheel::Shard::Main()
+{
+  PTRACE(4, "TimerWheel\tThread started");
+
+  while (m_running) {
+    bool idle;
+
+    {
+      PWaitAndSignal dispatch(m_dispatchMutex);
+
+      m_mutex.Wait();
+
+      Advance(GetNowTick());
+
+      while (m_expired != NULL) {
+        Timer * timer = m_expired;
+        Unlink(*timer);
+        m_mutex.Signal();
+        timer->OnTimeout();
+        m_mutex.Wait();
+      }
+
+      idle = m_count == 0;
+
+      m_mutex.Signal();
+    }
+
+    if (idle)
+      m_wake.Wait();
+    else
+      m_wake.Wait(m_wheel.m_resolution);
+  }
+
+  PTRACE(4, "TimerWheel\tThread ended");
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
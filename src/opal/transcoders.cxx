@@ -38,6 +38,11 @@
 
 #include <opal/transcoders.h>
 
+#include <map>
+#include <set>
+#include <vector>
+#include <algorithm>
+
 
 #define new PNEW
 
@@ -133,10 +138,10 @@ PBoolean OpalTranscoder::ConvertFrames(const RTP_DataFrame & input, RTP_DataFram
 {
   // make sure there is at least one output frame available
   if (output.IsEmpty())
-    output.Append(new RTP_DataFrame(0, maxOutputSize));
+    output.Append(output.NewFrame(0, maxOutputSize));
   else {
     while (output.GetSize() > 1)
-      output.RemoveAt(1);
+      output.RecycleAt(1);
   }
 
   // set the output timestamp and marker bit
@@ -157,7 +162,7 @@ PBoolean OpalTranscoder::ConvertFrames(const RTP_DataFrame & input, RTP_DataFram
   RTP_DataFrame::PayloadTypes formatPayloadType = inputMediaFormat.GetPayloadType();
   if (formatPayloadType != RTP_DataFrame::MaxPayloadType && packetPayloadType != formatPayloadType && input.GetPayloadSize() > 0) {
     PTRACE(2, "Opal\tExpected payload type " << formatPayloadType << ", but received " << packetPayloadType << ". Ignoring packet");
-    output.RemoveAll();
+    output.RecycleAll();
     return PTrue;
   }
 
@@ -180,6 +185,281 @@ OpalTranscoder * OpalTranscoder::Create(const OpalMediaFormat & srcFormat,
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+
+#define MAX_TRANSCODER_CHAIN 4   // Maximum transcoders in a chain
+#define MAX_CACHED_PATHS     8   // Maximum paths remembered per format pair
+
+// Default relative costs of transcoders and intermediate formats
+enum {
+  RawToRawCost     = 2,
+  CodedToCodedCost = 2,
+  DecoderCost      = 5,
+  EncoderCost      = 10,
+  LossyPenalty     = 20,
+  ClockRatePenalty = 20
+};
+
+
+/* This is the graph of all registered transcoders, nodes being media format
+   names and edges being transcoders. Paths between formats are calculated
+   when first needed and cached. Everything is discarded and rebuilt if the
+   transcoder registrations or the registered media formats change.
+ */
+class OpalTranscoderGraph
+{
+  public:
+    struct Path {
+      unsigned             cost;
+      std::vector<PString> formats;   // Intermediate formats only
+
+      bool operator<(const Path & other) const
+      {
+        return cost < other.cost || (cost == other.cost && formats.size() < other.formats.size());
+      }
+    };
+    typedef std::vector<Path> PathList;
+
+    static OpalTranscoderGraph & GetInstance()
+    {
+      static OpalTranscoderGraph graph;
+      return graph;
+    }
+
+    OpalTranscoderGraph()
+      : transcoderCount(0)
+      , transcoderGeneration(0)
+      , formatSequence(0)
+      , isBuilt(false)
+    {
+    }
+
+    bool HasTranscoder(const PString & srcFormat, const PString & dstFormat)
+    {
+      PWaitAndSignal mutex(graphMutex);
+      CheckForChanges();
+
+      AdjacencyMap::const_iterator adjacent = destinations.find(srcFormat);
+      return adjacent != destinations.end() && adjacent->second.find(dstFormat) != adjacent->second.end();
+    }
+
+    void GetPaths(const PString & srcFormat, const PString & dstFormat, PathList & paths)
+    {
+      PWaitAndSignal mutex(graphMutex);
+      CheckForChanges();
+
+      OpalTranscoderKey key(srcFormat, dstFormat);
+      PathCache::iterator cached = pathCache.find(key);
+      if (cached == pathCache.end()) {
+        cached = pathCache.insert(PathCache::value_type(key, PathList())).first;
+
+        std::vector<PString> route;
+        route.push_back(srcFormat);
+        unsigned minClockRate = std::min(formatInfo[srcFormat].clockRate, formatInfo[dstFormat].clockRate);
+        FindPaths(dstFormat, minClockRate, route, 0, cached->second);
+
+        std::sort(cached->second.begin(), cached->second.end());
+        if (cached->second.size() > MAX_CACHED_PATHS)
+          cached->second.resize(MAX_CACHED_PATHS);
+
+        PTRACE(5, "Opal\tFound " << cached->second.size() << " transcoder paths from " << srcFormat << " to " << dstFormat);
+      }
+
+      paths = cached->second;
+    }
+
+    void GetAdjacent(const PString & format, bool destination, OpalMediaFormatList & list)
+    {
+      PWaitAndSignal mutex(graphMutex);
+      CheckForChanges();
+
+      const AdjacencyMap & adjacency = destination ? destinations : sources;
+      AdjacencyMap::const_iterator adjacent = adjacency.find(format);
+      if (adjacent != adjacency.end()) {
+        for (std::set<PString>::const_iterator name = adjacent->second.begin(); name != adjacent->second.end(); ++name)
+          list += *name;
+      }
+    }
+
+    void SetCost(const OpalTranscoderKey & key, unsigned cost)
+    {
+      PWaitAndSignal mutex(graphMutex);
+      costOverrides[key] = cost;
+      pathCache.clear();
+    }
+
+  protected:
+    void CheckForChanges()
+    {
+      size_t count;
+      {
+        PWaitAndSignal mutex(OpalTranscoderFactory::GetMutex());
+        count = OpalTranscoderFactory::GetKeyMap().size();
+      }
+
+      /* The generation catches a transcoder replaced by another, which the
+         count alone would not, the count catches static registrations made
+         without announcing them, e.g. by OPAL_REGISTER_TRANSCODER. */
+      unsigned generation = OpalTranscoder::GetRegistrationGeneration();
+      unsigned sequence = OpalMediaFormat::GetRegistrationSequence();
+
+      if (isBuilt && count == transcoderCount && generation == transcoderGeneration && sequence == formatSequence)
+        return;
+
+      destinations.clear();
+      sources.clear();
+      formatInfo.clear();
+      pathCache.clear();
+
+      OpalTranscoderList availableTranscoders = OpalTranscoderFactory::GetKeyList();
+      for (OpalTranscoderIterator it = availableTranscoders.begin(); it != availableTranscoders.end(); ++it) {
+        destinations[it->first].insert(it->second);
+        sources[it->second].insert(it->first);
+        AddFormat(it->first);
+        AddFormat(it->second);
+      }
+
+      transcoderCount = count;
+      transcoderGeneration = generation;
+      formatSequence = sequence;
+      isBuilt = true;
+
+      PTRACE(4, "Opal\tBuilt transcoder graph of " << availableTranscoders.size()
+             << " transcoders between " << formatInfo.size() << " formats");
+    }
+
+    void AddFormat(const PString & name)
+    {
+      if (formatInfo.find(name) != formatInfo.end())
+        return;
+
+      OpalMediaFormat mediaFormat = name;
+      FormatInfo & info = formatInfo[name];
+      info.isRaw = mediaFormat.IsValid() && !mediaFormat.IsTransportable();
+      info.clockRate = mediaFormat.IsValid() ? mediaFormat.GetClockRate() : 0;
+    }
+
+    unsigned GetCost(const PString & srcFormat, const PString & dstFormat)
+    {
+      std::map<OpalTranscoderKey, unsigned>::const_iterator cost = costOverrides.find(OpalTranscoderKey(srcFormat, dstFormat));
+      if (cost != costOverrides.end())
+        return cost->second;
+
+      bool srcRaw = formatInfo[srcFormat].isRaw;
+      bool dstRaw = formatInfo[dstFormat].isRaw;
+      if (srcRaw == dstRaw)
+        return srcRaw ? RawToRawCost : CodedToCodedCost;
+      return srcRaw ? EncoderCost : DecoderCost;
+    }
+
+    unsigned GetPenalty(const PString & intermediateFormat, unsigned minClockRate)
+    {
+      const FormatInfo & info = formatInfo[intermediateFormat];
+      unsigned penalty = 0;
+      if (!info.isRaw)
+        penalty += LossyPenalty;
+      if (info.clockRate < minClockRate)
+        penalty += ClockRatePenalty;
+      return penalty;
+    }
+
+    void FindPaths(const PString & dstFormat,
+                   unsigned minClockRate,
+                   std::vector<PString> & route,
+                   unsigned cost,
+                   PathList & paths)
+    {
+      PString node = route.back();
+
+      AdjacencyMap::const_iterator adjacent = destinations.find(node);
+      if (adjacent == destinations.end())
+        return;
+
+      for (std::set<PString>::const_iterator next = adjacent->second.begin(); next != adjacent->second.end(); ++next) {
+        if (*next == dstFormat) {
+          // Direct transcoders are not a path, they are always used first
+          if (route.size() > 1) {
+            Path path;
+            path.cost = cost + GetCost(node, dstFormat);
+            path.formats.assign(route.begin()+1, route.end());
+            paths.push_back(path);
+          }
+          continue;
+        }
+
+        // Room for this transcoder and one more to get to the destination
+        if (route.size() >= MAX_TRANSCODER_CHAIN)
+          continue;
+
+        if (std::find(route.begin(), route.end(), *next) != route.end())
+          continue;
+
+        route.push_back(*next);
+        FindPaths(dstFormat, minClockRate, route, cost + GetCost(node, *next) + GetPenalty(*next, minClockRate), paths);
+        route.pop_back();
+      }
+    }
+
+    struct FormatInfo {
+      FormatInfo() : isRaw(false), clockRate(0) { }
+      bool     isRaw;
+      unsigned clockRate;
+    };
+
+    typedef std::map<PString, std::set<PString> >     AdjacencyMap;
+    typedef std::map<OpalTranscoderKey, PathList>     PathCache;
+
+    AdjacencyMap                          destinations;
+    AdjacencyMap                          sources;
+    std::map<PString, FormatInfo>         formatInfo;
+    std::map<OpalTranscoderKey, unsigned> costOverrides;
+    PathCache                             pathCache;
+    size_t                                transcoderCount;
+    unsigned                              transcoderGeneration;
+    unsigned                              formatSequence;
+    bool                                  isBuilt;
+    PMutex                                graphMutex;
+};
+
+
+static bool FindTranscoderPath(const OpalMediaFormat & srcFormat,
+                               const OpalMediaFormat & dstFormat,
+                               PINDEX maxIntermediates,
+                               OpalMediaFormatList & intermediateFormats)
+{
+  intermediateFormats.RemoveAll();
+
+  OpalTranscoderGraph & graph = OpalTranscoderGraph::GetInstance();
+  if (graph.HasTranscoder(srcFormat.GetName(), dstFormat.GetName()))
+    return true;
+
+  OpalTranscoderGraph::PathList paths;
+  graph.GetPaths(srcFormat.GetName(), dstFormat.GetName(), paths);
+
+  // Paths are in order of cost, use the first whose formats are compatible
+  for (OpalTranscoderGraph::PathList::const_iterator path = paths.begin(); path != paths.end(); ++path) {
+    if ((PINDEX)path->formats.size() > maxIntermediates)
+      continue;
+
+    OpalMediaFormatList probableFormats;
+    std::vector<PString>::const_iterator name;
+    for (name = path->formats.begin(); name != path->formats.end(); ++name) {
+      OpalMediaFormat probableFormat = *name;
+      if (!probableFormat.IsValid() || !probableFormat.Merge(srcFormat) || !probableFormat.Merge(dstFormat))
+        break;
+      probableFormats += probableFormat;
+    }
+
+    if (name == path->formats.end()) {
+      intermediateFormats = probableFormats;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
 static bool MergeFormats(const OpalMediaFormatList & masterFormats,
                          const OpalMediaFormat & srcCapability,
                          const OpalMediaFormat & dstCapability,
@@ -296,22 +576,19 @@ bool OpalTranscoder::SelectFormats(const OpalMediaFormatList & srcFormats,
   }
 
   // Search for a single transcoder to get from a to b
+  OpalTranscoderGraph & graph = OpalTranscoderGraph::GetInstance();
   for (d = dstFormats.begin(); d != dstFormats.end(); ++d) {
     for (s = srcFormats.begin(); s != srcFormats.end(); ++s) {
-      OpalTranscoderKey search(*s, *d);
-      OpalTranscoderList availableTranscoders = OpalTranscoderFactory::GetKeyList();
-      for (OpalTranscoderIterator i = availableTranscoders.begin(); i != availableTranscoders.end(); ++i) {
-        if (search == *i && MergeFormats(allFormats, *s, *d, srcFormat, dstFormat))
-          return true;
-      }
+      if (graph.HasTranscoder(s->GetName(), d->GetName()) && MergeFormats(allFormats, *s, *d, srcFormat, dstFormat))
+        return true;
     }
   }
 
-  // Last gasp search for a double transcoder to get from a to b
+  // Last gasp search for a chain of transcoders to get from a to b
   for (d = dstFormats.begin(); d != dstFormats.end(); ++d) {
     for (s = srcFormats.begin(); s != srcFormats.end(); ++s) {
-      OpalMediaFormat intermediateFormat;
-      if (FindIntermediateFormat(*s, *d, intermediateFormat) && MergeFormats(allFormats, *s, *d, srcFormat, dstFormat))
+      OpalMediaFormatList intermediateFormats;
+      if (FindIntermediateFormats(*s, *d, intermediateFormats) && MergeFormats(allFormats, *s, *d, srcFormat, dstFormat))
         return true;
     }
   }
@@ -326,51 +603,63 @@ bool OpalTranscoder::FindIntermediateFormat(const OpalMediaFormat & srcFormat,
 {
   intermediateFormat = OpalMediaFormat();
 
-  OpalTranscoderList availableTranscoders = OpalTranscoderFactory::GetKeyList();
-  for (OpalTranscoderIterator find1 = availableTranscoders.begin(); find1 != availableTranscoders.end(); ++find1) {
-    if (find1->first == srcFormat) {
-      if (find1->second == dstFormat)
-        return true;
-      for (OpalTranscoderIterator find2 = availableTranscoders.begin(); find2 != availableTranscoders.end(); ++find2) {
-        if (find2->first == find1->second && find2->second == dstFormat) {
-          OpalMediaFormat probableFormat = find1->second;
-          if (probableFormat.Merge(srcFormat) && probableFormat.Merge(dstFormat)) {
-            intermediateFormat = probableFormat;
-            return true;
-          }
-        }
-      }
-    }
-  }
+  OpalMediaFormatList intermediateFormats;
+  if (!FindTranscoderPath(srcFormat, dstFormat, 1, intermediateFormats))
+    return false;
 
-  return PFalse;
+  if (!intermediateFormats.IsEmpty())
+    intermediateFormat = intermediateFormats.front();
+  return true;
 }
 
 
-OpalMediaFormatList OpalTranscoder::GetDestinationFormats(const OpalMediaFormat & srcFormat)
+bool OpalTranscoder::FindIntermediateFormats(const OpalMediaFormat & srcFormat,
+                                             const OpalMediaFormat & dstFormat,
+                                             OpalMediaFormatList & intermediateFormats)
 {
-  OpalMediaFormatList list;
+  return FindTranscoderPath(srcFormat, dstFormat, MAX_TRANSCODER_CHAIN-1, intermediateFormats);
+}
 
-  OpalTranscoderList availableTranscoders = OpalTranscoderFactory::GetKeyList();
-  for (OpalTranscoderIterator find = availableTranscoders.begin(); find != availableTranscoders.end(); ++find) {
-    if (find->first == srcFormat)
-      list += find->second;
-  }
 
-  return list;
+void OpalTranscoder::SetTranscoderCost(const OpalMediaFormat & srcFormat,
+                                       const OpalMediaFormat & dstFormat,
+                                       unsigned cost)
+{
+  OpalTranscoderGraph::GetInstance().SetCost(MakeOpalTranscoderKey(srcFormat, dstFormat), cost);
 }
 
 
-OpalMediaFormatList OpalTranscoder::GetSourceFormats(const OpalMediaFormat & dstFormat)
+static PAtomicInteger & GetTranscoderGeneration()
+{
+  static PAtomicInteger generation;
+  return generation;
+}
+
+
+void OpalTranscoder::RegistrationChanged()
+{
+  ++GetTranscoderGeneration();
+}
+
+
+unsigned OpalTranscoder::GetRegistrationGeneration()
+{
+  return (unsigned)(long)GetTranscoderGeneration();
+}
+
+
+OpalMediaFormatList OpalTranscoder::GetDestinationFormats(const OpalMediaFormat & srcFormat)
 {
   OpalMediaFormatList list;
+  OpalTranscoderGraph::GetInstance().GetAdjacent(srcFormat.GetName(), true, list);
+  return list;
+}
 
-  OpalTranscoderList availableTranscoders = OpalTranscoderFactory::GetKeyList();
-  for (OpalTranscoderIterator find = availableTranscoders.begin(); find != availableTranscoders.end(); ++find) {
-    if (find->second == dstFormat)
-      list += find->first;
-  }
 
+OpalMediaFormatList OpalTranscoder::GetSourceFormats(const OpalMediaFormat & dstFormat)
+{
+  OpalMediaFormatList list;
+  OpalTranscoderGraph::GetInstance().GetAdjacent(dstFormat.GetName(), false, list);
   return list;
 }
 
@@ -771,6 +1060,181 @@ PBoolean OpalStreamedTranscoder::Convert(const RTP_DataFrame & input,
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+
+OpalTranscoderChain::OpalTranscoderChain(const OpalMediaFormatList & formats,
+                                         const BYTE * instance,
+                                         unsigned instanceLen)
+  : OpalTranscoder(formats.front(), formats[formats.GetSize()-1])
+  , isValid(formats.GetSize() > 1)
+{
+  for (PINDEX i = 1; isValid && i < formats.GetSize(); i++) {
+    OpalTranscoder * stage = Create(formats[i-1], formats[i], instance, instanceLen);
+    if (stage == NULL) {
+      PTRACE(2, "Opal\tCould not create transcoder " << formats[i-1] << "->" << formats[i] << " in chain");
+      isValid = false;
+      break;
+    }
+
+    stage->SetCommandNotifier(PCREATE_NOTIFIER(OnStageCommand));
+    stages.Append(stage);
+
+    if (i < formats.GetSize()-1)
+      stageFrames.Append(new RTP_DataFrameList);
+  }
+
+  if (isValid) {
+    acceptEmptyPayload = stages.front().AcceptEmptyPayload();
+    acceptOtherPayloads = stages.front().AcceptOtherPayloads();
+  }
+}
+
+
+bool OpalTranscoderChain::UpdateMediaFormats(const OpalMediaFormat & input, const OpalMediaFormat & output)
+{
+  if (!isValid || !OpalTranscoder::UpdateMediaFormats(input, output))
+    return false;
+
+  if (input.IsValid() && !stages.front().UpdateMediaFormats(input, OpalMediaFormat()))
+    return false;
+
+  if (output.IsValid() && !stages[stages.GetSize()-1].UpdateMediaFormats(OpalMediaFormat(), output))
+    return false;
+
+  return true;
+}
+
+
+PBoolean OpalTranscoderChain::ExecuteCommand(const OpalMediaCommand & command)
+{
+  bool atLeastOne = false;
+
+  for (PINDEX i = stages.GetSize(); i > 0; i--)
+    atLeastOne = stages[i-1].ExecuteCommand(command) || atLeastOne;
+
+  return atLeastOne;
+}
+
+
+PINDEX OpalTranscoderChain::GetOptimalDataFrameSize(PBoolean input) const
+{
+  if (!isValid)
+    return 0;
+
+  return input ? stages.front().GetOptimalDataFrameSize(true) : stages[stages.GetSize()-1].GetOptimalDataFrameSize(false);
+}
+
+
+static bool ConvertChainStage(OpalTranscoder & stage, RTP_DataFrameList & input, RTP_DataFrameList & output)
+{
+  // Usual case of one frame in, can convert straight into the output
+  if (input.GetSize() == 1) {
+    if (input.front().GetPayloadSize() == 0 && !stage.AcceptEmptyPayload()) {
+      output.RecycleAll();
+      return true;
+    }
+    return stage.ConvertFrames(input.front(), output);
+  }
+
+  output.RecycleAll();
+
+  RTP_DataFrameList converted(output.GetPool());
+  for (RTP_DataFrameList::iterator frame = input.begin(); frame != input.end(); ++frame) {
+    if (frame->GetPayloadSize() == 0 && !stage.AcceptEmptyPayload())
+      continue;
+
+    if (!stage.ConvertFrames(*frame, converted))
+      return false;
+
+    // Move the frames across without copying
+    converted.DisallowDeleteObjects();
+    for (PINDEX i = 0; i < converted.GetSize(); i++)
+      output.Append(&converted[i]);
+    converted.RemoveAll();
+    converted.AllowDeleteObjects();
+  }
+
+  return true;
+}
+
+
+PBoolean OpalTranscoderChain::ConvertFrames(const RTP_DataFrame & input, RTP_DataFrameList & output)
+{
+  if (!isValid)
+    return false;
+
+  stages[stages.GetSize()-1].SetMaxOutputSize(maxOutputSize);
+
+  PINDEX lastStage = stages.GetSize()-1;
+
+  if (!stages.front().ConvertFrames(input, lastStage > 0 ? stageFrames.front() : output))
+    return false;
+
+  for (PINDEX i = 1; i <= lastStage; i++) {
+    if (!ConvertChainStage(stages[i], stageFrames[i-1], i < lastStage ? stageFrames[i] : output))
+      return false;
+  }
+
+  return true;
+}
+
+
+PBoolean OpalTranscoderChain::Convert(const RTP_DataFrame & input, RTP_DataFrame & output)
+{
+  RTP_DataFrameList frames;
+  if (!ConvertFrames(input, frames))
+    return false;
+
+  if (frames.IsEmpty())
+    output.SetPayloadSize(0);
+  else
+    output = frames.front();
+
+  return true;
+}
+
+
+void OpalTranscoderChain::SetInstanceID(const BYTE * instance, unsigned instanceLen)
+{
+  for (PINDEX i = 0; i < stages.GetSize(); i++)
+    stages[i].SetInstanceID(instance, instanceLen);
+}
+
+
+bool OpalTranscoderChain::AcceptComfortNoise() const
+{
+  return isValid && stages.front().AcceptComfortNoise();
+}
+
+
+bool OpalTranscoderChain::AcceptEmptyPayload() const
+{
+  return isValid && stages.front().AcceptEmptyPayload();
+}
+
+
+bool OpalTranscoderChain::AcceptOtherPayloads() const
+{
+  return isValid && stages.front().AcceptOtherPayloads();
+}
+
+
+#if OPAL_STATISTICS
+void OpalTranscoderChain::GetStatistics(OpalMediaStatistics & statistics) const
+{
+  for (PINDEX i = 0; i < stages.GetSize(); i++)
+    stages[i].GetStatistics(statistics);
+}
+#endif
+
+
+void OpalTranscoderChain::OnStageCommand(OpalMediaCommand & command, INT extra)
+{
+  if (commandNotifier != PNotifier())
+    commandNotifier(command, extra);
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 
 Opal_Linear16Mono_PCM::Opal_Linear16Mono_PCM()
@@ -887,6 +887,23 @@ PString OpalTransport::GetLastReceivedInterface() const
 }
 
 
+PBoolean OpalTransport::WritePDUTo(const PBYTEArray & pdu, const OpalTransportAddress & address)
+{
+  PWaitAndSignal mutex(m_writeMutex);
+
+  OpalTransportAddress oldAddress = GetRemoteAddress();
+  if (address.IsEmpty() || oldAddress.IsEquivalent(address))
+    return WritePDU(pdu);
+
+  if (!SetRemoteAddress(address))
+    return PFalse;
+
+  PBoolean ok = WritePDU(pdu);
+  SetRemoteAddress(oldAddress);
+  return ok;
+}
+
+
 PBoolean OpalTransport::WriteConnect(WriteConnectCallback function, void * userData)
 {
   return function(*this, userData);
@@ -1397,6 +1414,27 @@ PBoolean OpalTransportUDP::WritePDU(const PBYTEArray & packet)
 }
 
 
+PBoolean OpalTransportUDP::WritePDUTo(const PBYTEArray & packet, const OpalTransportAddress & address)
+{
+  PMonitoredSocketChannel * socket = (PMonitoredSocketChannel *)writeChannel;
+  if (socket == NULL)
+    return SetErrorValues(NotOpen, EBADF, LastWriteError);
+
+  PIPSocket::Address ip;
+  WORD port = 0;
+  if (!address.GetIpAndPort(ip, port) || port == 0)
+    return SetErrorValues(BadParameter, EINVAL, LastWriteError);
+
+  PINDEX count = 0;
+  PChannel::Errors error = socket->GetMonitoredSockets()->WriteToBundle(packet, packet.GetSize(),
+                                                                        ip, port, socket->GetInterface(), count);
+  if (error == NoError)
+    return PTrue;
+
+  return SetErrorValues(error, 0, LastWriteError);
+}
+
+
 PBoolean OpalTransportUDP::WriteConnect(WriteConnectCallback function, void * userData)
 {
   PMonitoredSocketChannel * socket = (PMonitoredSocketChannel *)writeChannel;
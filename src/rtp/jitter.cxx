@@ -70,6 +70,7 @@ class RTP_JitterBufferAnalyser : public PObject
     void In(DWORD time, unsigned depth, const char * extra);
     void Out(DWORD time, unsigned depth, const char * extra);
     void PrintOn(ostream & strm) const;
+    bool IsSame(const RTP_JitterBufferAnalyser & other) const;
 
     struct Info {
       Info() { }
@@ -92,7 +93,7 @@ OpalJitterBuffer::OpalJitterBuffer(unsigned _minJitterTime,
                                    unsigned _maxJitterTime,
                                    unsigned _time,
                                    PINDEX stackSize)
-  : jitterThread(NULL), jitterStackSize(stackSize)
+  : shuttingDown(false), inlineIngest(false), inlineMarkerWarning(false), jitterThread(NULL), jitterStackSize(stackSize)
 {
   timeUnits        = _time;
 
@@ -200,6 +201,15 @@ void OpalJitterBuffer::SetDelay(unsigned _minJitterDelay, unsigned _maxJitterDel
 void OpalJitterBuffer::Resume()
 {
   PWaitAndSignal m(bufferMutex);
+
+  if (inlineIngest) {
+    // Frames arrive via WriteData(), no thread needed
+    PTRACE(4, "RTP\tJitter buffer using inline ingest: " << this);
+    shuttingDown = false;
+    inlineMarkerWarning = false;
+    return;
+  }
+
   if (jitterThread != NULL) {
     if (!shuttingDown)
       return;
@@ -250,6 +260,18 @@ void OpalJitterBuffer::DeInit(Entry * & /*currentReadFrame*/, PBoolean & /*marke
 
 PBoolean OpalJitterBuffer::PreRead(OpalJitterBuffer::Entry * & currentReadFrame, PBoolean & /*markerWarning*/)
 {
+  currentReadFrame = GetFreeFrame();
+
+  bufferMutex.Signal();
+
+  return true;
+}
+
+
+OpalJitterBuffer::Entry * OpalJitterBuffer::GetFreeFrame()
+{
+  Entry * currentReadFrame;
+
   // Get the next free frame available for use for reading from the RTP
   // transport. Place it into a parking spot.
   if (freeFrames.size() > 0) {
@@ -282,9 +304,7 @@ PBoolean OpalJitterBuffer::PreRead(OpalJitterBuffer::Entry * & currentReadFrame,
     }
   }
 
-  bufferMutex.Signal();
-
-  return true;
+  return currentReadFrame;
 }
 
 PBoolean OpalJitterBuffer::OnRead(OpalJitterBuffer::Entry * & currentReadFrame, PBoolean & markerWarning, PBoolean loop)
@@ -301,6 +321,38 @@ PBoolean OpalJitterBuffer::OnRead(OpalJitterBuffer::Entry * & currentReadFrame,
     }
   } while (currentReadFrame->GetSize() == 0);
 
+  // Queue the frame for playing by the thread at other end of jitter buffer
+  bufferMutex.Wait();
+
+  InsertFrame(currentReadFrame, markerWarning);
+
+  return true;
+}
+
+
+PBoolean OpalJitterBuffer::WriteData(const RTP_DataFrame & frame)
+{
+  PWaitAndSignal mutex(bufferMutex);
+
+  if (shuttingDown)
+    return false;
+
+  Entry * entry = GetFreeFrame();
+
+  // Copy into the entries existing storage, so no allocations once running
+  PINDEX payloadSize = frame.GetPayloadSize() + frame.GetPaddingSize();
+  PINDEX frameSize = frame.GetHeaderSize() + payloadSize;
+  memcpy(entry->GetPointer(frameSize), (const BYTE *)frame, frameSize);
+  entry->SetPayloadSize(payloadSize);
+
+  InsertFrame(entry, inlineMarkerWarning);
+
+  return true;
+}
+
+
+void OpalJitterBuffer::InsertFrame(Entry * currentReadFrame, PBoolean & markerWarning)
+{
   currentReadFrame->tick = PTimer::Tick();
 
   if (consecutiveMarkerBits < maxConsecutiveMarkerBits) {
@@ -325,9 +377,6 @@ PBoolean OpalJitterBuffer::OnRead(OpalJitterBuffer::Entry * & currentReadFrame,
   analyser->In(currentReadFrame->GetTimestamp(), jitterBuffer.size(), preBuffering ? "PreBuf" : "");
 #endif
 
-  // Queue the frame for playing by the thread at other end of jitter buffer
-  bufferMutex.Wait();
-
   // Have been reading a frame, put it into the queue now, at correct position
   if (jitterBuffer.size() == 0) {
     PAssertNULL(currentReadFrame);
@@ -352,8 +401,6 @@ PBoolean OpalJitterBuffer::OnRead(OpalJitterBuffer::Entry * & currentReadFrame,
       jitterBuffer.push_back(currentReadFrame);
     }
   }
-
-  return true;
 }
 
 
@@ -626,6 +673,16 @@ RTP_JitterBuffer::RTP_JitterBuffer(RTP_Session & sess,
     PTRACE(6, "RTP_JitterBuffer\tConstructor" << *this);
 }
 
+bool OpalJitterBuffer::HasSameAnalysis(const OpalJitterBuffer & other) const
+{
+#if PTRACING && !defined(NO_ANALYSER)
+  return analyser->IsSame(*other.analyser);
+#else
+  return true;
+#endif
+}
+
+
 PBoolean RTP_JitterBuffer::OnReadPacket(RTP_DataFrame & frame, PBoolean loop)
 {
   PBoolean success = session.ReadData(frame, loop);
@@ -672,6 +729,27 @@ void RTP_JitterBufferAnalyser::Out(DWORD time, unsigned depth, const char * extr
 }
 
 
+static bool IsSameInfo(const RTP_JitterBufferAnalyser::Info * info1,
+                       const RTP_JitterBufferAnalyser::Info * info2,
+                       PINDEX count)
+{
+  for (PINDEX i = 1; i < count; i++) {
+    if (info1[i].time != info2[i].time ||
+        info1[i].depth != info2[i].depth ||
+        strcmp(info1[i].extra, info2[i].extra) != 0)
+      return false;
+  }
+  return true;
+}
+
+
+bool RTP_JitterBufferAnalyser::IsSame(const RTP_JitterBufferAnalyser & other) const
+{
+  return inPos == other.inPos && outPos == other.outPos &&
+         IsSameInfo(in, other.in, inPos) && IsSameInfo(out, other.out, outPos);
+}
+
+
 void RTP_JitterBufferAnalyser::PrintOn(ostream & strm) const
 {
   strm << "Input samples: " << inPos << " Output samples: " << outPos << "\n"
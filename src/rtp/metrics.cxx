@@ -0,0 +1,298 @@
+/*
+ * metrics.cxx
+ *
+ * Call quality metrics for RTCP extended reports (RFC 3611)
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#pragma implementation "metrics.h"
+#endif
+
+#include <opal/buildopts.h>
+
+#include <rtp/metrics.h>
+
+#include <math.h>
+
+
+#define new PNEW
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+void RTP_LossModel::OnLost(unsigned count)
+{
+  if (count == 0)
+    return;
+
+  m_lost += count;
+  if (!m_lastLost && m_received > 0)
+    ++m_toLost;
+  m_lastLost = true;
+
+  if (m_pendingLost > 0 && m_sinceLoss < Gmin) {
+    // Too few received since the last loss, the burst goes on
+    m_pendingPackets += m_sinceLoss + count;
+    m_pendingLost += count;
+  }
+  else {
+    // The burst being built, if any, ended Gmin or more packets ago
+    if (m_pendingLost == 1) {
+      ++m_gapPackets;
+      ++m_gapLost;
+    }
+    else if (m_pendingLost > 1) {
+      m_burstPackets += m_pendingPackets;
+      m_burstLost += m_pendingLost;
+      ++m_bursts;
+    }
+    m_gapPackets += m_sinceLoss;
+
+    m_pendingPackets = count;
+    m_pendingLost = count;
+  }
+
+  m_sinceLoss = 0;
+}
+
+
+static unsigned GetDensity(DWORD lost, DWORD packets)
+{
+  if (packets == 0)
+    return 0;
+
+  PUInt64 density = ((PUInt64)lost << 8)/packets;
+  return density > 255 ? 255 : (unsigned)density;
+}
+
+
+void RTP_LossModel::GetReport(Report & report) const
+{
+  DWORD burstPackets = m_burstPackets;
+  DWORD burstLost    = m_burstLost;
+  DWORD bursts       = m_bursts;
+  DWORD gapPackets   = m_gapPackets + m_sinceLoss;
+  DWORD gapLost      = m_gapLost;
+
+  // A burst in progress counts as a burst, a lone loss as part of the gap
+  if (m_pendingLost == 1) {
+    ++gapPackets;
+    ++gapLost;
+  }
+  else if (m_pendingLost > 1) {
+    burstPackets += m_pendingPackets;
+    burstLost += m_pendingLost;
+    ++bursts;
+  }
+
+  // There is a gap before each burst, and possibly one after the last
+  DWORD gaps = gapPackets > 0 ? bursts + 1 : 0;
+
+  report.m_burstDensity = GetDensity(burstLost, burstPackets);
+  report.m_gapDensity   = GetDensity(gapLost, gapPackets);
+  report.m_burstLength  = bursts > 0 ? (double)burstPackets/bursts : 0;
+  report.m_gapLength    = gaps > 0 ? (double)gapPackets/gaps : 0;
+
+  // From the two state Markov model, 1/(p+q), which is 1 for random loss
+  double p = m_received > 0 ? (double)m_toLost/m_received : 0;
+  double q = m_lost > 0 ? (double)m_toReceived/m_lost : 1;
+  report.m_burstRatio = p+q > 0 ? 1/(p+q) : 1;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+static const struct {
+  unsigned m_payloadType;
+  double   m_Ie;
+  double   m_Bpl;
+} CodecImpairments[] = {
+  {  0,  0, 25.1 }, // G.711 uLaw, with PLC
+  {  4, 15, 16.1 }, // G.723.1 6.3k
+  {  8,  0, 25.1 }, // G.711 ALaw, with PLC
+  { 18, 11, 19.0 }  // G.729A with VAD
+};
+
+
+void RTP_EModel::GetCodecImpairments(unsigned payloadType, double & Ie, double & Bpl)
+{
+  for (PINDEX i = 0; i < (PINDEX)PARRAYSIZE(CodecImpairments); ++i) {
+    if (CodecImpairments[i].m_payloadType == payloadType) {
+      Ie = CodecImpairments[i].m_Ie;
+      Bpl = CodecImpairments[i].m_Bpl;
+      return;
+    }
+  }
+
+  Ie = 0;
+  Bpl = 25.1;
+}
+
+
+double RTP_EModel::GetRFactor(double lossPercent, double burstRatio, unsigned delay, double Ie, double Bpl)
+{
+  // R0 - Is with the G.107 defaults
+  static const double DefaultR = 93.2;
+
+  if (burstRatio < 1)
+    burstRatio = 1;
+
+  double IeEff = Ie + (95 - Ie)*lossPercent/(lossPercent/burstRatio + Bpl);
+
+  // The usual simplification of Id, Cole & Rosenbluth
+  double Id = 0.024*delay;
+  if (delay > 177.3)
+    Id += 0.11*(delay - 177.3);
+
+  double R = DefaultR - Id - IeEff;
+  if (R < 0)
+    return 0;
+  if (R > 100)
+    return 100;
+  return R;
+}
+
+
+double RTP_EModel::GetMOS(double R)
+{
+  if (R <= 0)
+    return 1;
+  if (R >= 100)
+    return 4.5;
+  return 1 + 0.035*R + R*(R - 60)*(100 - R)*7e-6;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+void RTP_VoIPMetrics::SetUnavailable()
+{
+  memset(this, 0, sizeof(*this));
+  m_signalLevel = Unavailable;
+  m_noiseLevel = Unavailable;
+  m_residualEchoReturnLoss = Unavailable;
+  m_gmin = RTP_LossModel::Gmin;
+  m_rFactor = Unavailable;
+  m_externalRFactor = Unavailable;
+  m_mosLQ = Unavailable;
+  m_mosCQ = Unavailable;
+}
+
+
+static inline void SetWord(BYTE * ptr, WORD value)
+{
+  ptr[0] = (BYTE)(value >> 8);
+  ptr[1] = (BYTE)value;
+}
+
+
+static inline WORD GetWord(const BYTE * ptr)
+{
+  return (WORD)((ptr[0] << 8) | ptr[1]);
+}
+
+
+void RTP_VoIPMetrics::Encode(BYTE * block) const
+{
+  block[0] = BlockType;
+  block[1] = 0;
+  SetWord(block+2, BlockSize/4 - 1);
+  SetWord(block+4, (WORD)(m_ssrc >> 16));
+  SetWord(block+6, (WORD)m_ssrc);
+  block[8]  = m_lossRate;
+  block[9]  = m_discardRate;
+  block[10] = m_burstDensity;
+  block[11] = m_gapDensity;
+  SetWord(block+12, m_burstDuration);
+  SetWord(block+14, m_gapDuration);
+  SetWord(block+16, m_roundTripDelay);
+  SetWord(block+18, m_endSystemDelay);
+  block[20] = (BYTE)m_signalLevel;
+  block[21] = (BYTE)m_noiseLevel;
+  block[22] = m_residualEchoReturnLoss;
+  block[23] = m_gmin;
+  block[24] = m_rFactor;
+  block[25] = m_externalRFactor;
+  block[26] = m_mosLQ;
+  block[27] = m_mosCQ;
+  block[28] = m_receiverConfig;
+  block[29] = 0;
+  SetWord(block+30, m_jitterNominal);
+  SetWord(block+32, m_jitterMaximum);
+  SetWord(block+34, m_jitterAbsoluteMaximum);
+}
+
+
+bool RTP_VoIPMetrics::Decode(const BYTE * block, PINDEX size)
+{
+  if (size < BlockSize || block[0] != BlockType || GetWord(block+2) != BlockSize/4 - 1)
+    return false;
+
+  m_ssrc                  = ((DWORD)GetWord(block+4) << 16) | GetWord(block+6);
+  m_lossRate              = block[8];
+  m_discardRate           = block[9];
+  m_burstDensity          = block[10];
+  m_gapDensity            = block[11];
+  m_burstDuration         = GetWord(block+12);
+  m_gapDuration           = GetWord(block+14);
+  m_roundTripDelay        = GetWord(block+16);
+  m_endSystemDelay        = GetWord(block+18);
+  m_signalLevel           = (signed char)block[20];
+  m_noiseLevel            = (signed char)block[21];
+  m_residualEchoReturnLoss= block[22];
+  m_gmin                  = block[23];
+  m_rFactor               = block[24];
+  m_externalRFactor       = block[25];
+  m_mosLQ                 = block[26];
+  m_mosCQ                 = block[27];
+  m_receiverConfig        = block[28];
+  m_jitterNominal         = GetWord(block+30);
+  m_jitterMaximum         = GetWord(block+32);
+  m_jitterAbsoluteMaximum = GetWord(block+34);
+  return true;
+}
+
+
+void RTP_VoIPMetrics::PrintOn(ostream & strm) const
+{
+  strm << "ssrc=" << hex << m_ssrc << dec
+       << " loss=" << (unsigned)m_lossRate
+       << " discard=" << (unsigned)m_discardRate
+       << " burst=" << (unsigned)m_burstDensity << '/' << m_burstDuration << "ms"
+       << " gap=" << (unsigned)m_gapDensity << '/' << m_gapDuration << "ms"
+       << " rtt=" << m_roundTripDelay
+       << " delay=" << m_endSystemDelay
+       << " R=" << (unsigned)m_rFactor
+       << " MOS-LQ=" << (unsigned)m_mosLQ
+       << " MOS-CQ=" << (unsigned)m_mosCQ
+       << " jitter=" << m_jitterNominal << '/' << m_jitterMaximum << '/' << m_jitterAbsoluteMaximum;
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
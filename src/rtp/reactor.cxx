@@ -0,0 +1,325 @@
+/*
+ * reactor.cxx
+ *
+ * Shared RTP socket reactor
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#pragma implementation "reactor.h"
+#endif
+
+#include <opal/buildopts.h>
+
+#include <rtp/reactor.h>
+
+#if OPAL_RTP_AGGREGATE
+
+#include <rtp/rtp.h>
+
+#include <sys/epoll.h>
+#include <fcntl.h>
+
+#define new PNEW
+
+
+#define MAX_EVENTS_PER_WAIT 64
+
+// RTCP timing does not need fine resolution
+#define TIMER_RESOLUTION    10
+
+// The wake pipe uses a tag of zero, sessions have their registration number
+// shifted up one in the tag, with the bottom bit set for the control socket.
+#define WAKE_TAG            0
+#define CONTROL_TAG_BIT     1
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+RTP_Reactor::RTP_Reactor(unsigned threadCount)
+  : m_timerWheel(threadCount, TIMER_RESOLUTION, "RTP Timer")
+{
+  if (threadCount == 0)
+    threadCount = 1;
+
+  for (unsigned i = 0; i < threadCount; ++i) {
+    Worker * worker = new Worker(i);
+    if (worker->IsOpen())
+      m_workers.push_back(worker);
+    else
+      delete worker;
+  }
+
+  PTRACE(3, "RTP_Reactor\tStarted " << m_workers.size() << " worker threads");
+}
+
+
+RTP_Reactor::~RTP_Reactor()
+{
+  for (std::vector<Worker *>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+    PTRACE_IF(2, (*it)->GetSessionCount() > 0, "RTP_Reactor\tShutting down with "
+              << (*it)->GetSessionCount() << " sessions still attached");
+    (*it)->Shutdown();
+    delete *it;
+  }
+
+  PTRACE(3, "RTP_Reactor\tShut down");
+}
+
+
+bool RTP_Reactor::AddSession(RTP_UDP & session)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  if (m_workers.empty())
+    return false;
+
+  Worker * leastLoaded = m_workers[0];
+  PINDEX leastCount = leastLoaded->GetSessionCount();
+  for (size_t i = 1; i < m_workers.size(); ++i) {
+    PINDEX count = m_workers[i]->GetSessionCount();
+    if (count < leastCount) {
+      leastLoaded = m_workers[i];
+      leastCount = count;
+    }
+  }
+
+  return leastLoaded->Add(session);
+}
+
+
+void RTP_Reactor::RemoveSession(RTP_UDP & session)
+{
+  /* Note we do not hold m_mutex while removing, as Remove() waits for any
+     dispatch in progress, and that dispatch may end up in AddSession() if
+     the session is re-opened from a callback. */
+  for (std::vector<Worker *>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+    if ((*it)->Remove(session))
+      return;
+  }
+}
+
+
+PINDEX RTP_Reactor::GetSessionCount() const
+{
+  PINDEX count = 0;
+  for (std::vector<Worker *>::const_iterator it = m_workers.begin(); it != m_workers.end(); ++it)
+    count += (*it)->GetSessionCount();
+  return count;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+RTP_Reactor::Worker::Worker(unsigned index)
+  : PThread(65536, NoAutoDeleteThread, HighestPriority, psprintf("RTP Reactor:%u", index))
+  , m_index(index)
+  , m_running(true)
+  , m_nextRegistration(1)
+{
+  m_wakeFd[0] = m_wakeFd[1] = -1;
+
+  m_epoll = epoll_create(256);
+  if (m_epoll < 0) {
+    PTRACE(1, "RTP_Reactor\tCould not create epoll descriptor: " << strerror(errno));
+    return;
+  }
+
+  if (pipe(m_wakeFd) < 0) {
+    PTRACE(1, "RTP_Reactor\tCould not create wake pipe: " << strerror(errno));
+    ::close(m_epoll);
+    m_epoll = -1;
+    return;
+  }
+
+  fcntl(m_wakeFd[0], F_SETFL, O_NONBLOCK);
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u64 = WAKE_TAG;
+  epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeFd[0], &ev);
+
+  Resume();
+}
+
+
+RTP_Reactor::Worker::~Worker()
+{
+  if (m_wakeFd[0] >= 0)
+    ::close(m_wakeFd[0]);
+  if (m_wakeFd[1] >= 0)
+    ::close(m_wakeFd[1]);
+  if (m_epoll >= 0)
+    ::close(m_epoll);
+}
+
+
+void RTP_Reactor::Worker::Shutdown()
+{
+  m_running = false;
+
+  static const char wake = 0;
+  if (::write(m_wakeFd[1], &wake, 1) < 0) {
+    PTRACE(1, "RTP_Reactor\tCould not wake worker " << m_index << ": " << strerror(errno));
+  }
+
+  WaitForTermination();
+}
+
+
+bool RTP_Reactor::Worker::AddSocket(int handle, PUInt64 registration, bool isControl)
+{
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u64 = (registration << 1) | (isControl ? CONTROL_TAG_BIT : 0);
+
+  if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, handle, &ev) == 0)
+    return true;
+
+  PTRACE(1, "RTP_Reactor\tCould not add " << (isControl ? "control" : "data")
+         << " socket " << handle << " to worker " << m_index << ": " << strerror(errno));
+  return false;
+}
+
+
+bool RTP_Reactor::Worker::Add(RTP_UDP & session)
+{
+  int dataHandle = session.GetDataSocketHandle();
+  int controlHandle = session.GetControlSocketHandle();
+  if (dataHandle < 0 || controlHandle < 0)
+    return false;
+
+  PWaitAndSignal mutex(m_sessionsMutex);
+
+  PUInt64 registration = m_nextRegistration;
+
+  if (!AddSocket(dataHandle, registration, false))
+    return false;
+
+  if (!AddSocket(controlHandle, registration, true)) {
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, dataHandle, NULL);
+    return false;
+  }
+
+  ++m_nextRegistration;
+  m_registrations[registration] = &session;
+  m_sessions[&session] = registration;
+
+  PTRACE(4, "RTP_Reactor\tAdded session " << session.GetSessionID()
+         << " to worker " << m_index << ", count=" << m_sessions.size());
+  return true;
+}
+
+
+bool RTP_Reactor::Worker::Remove(RTP_UDP & session)
+{
+  {
+    PWaitAndSignal mutex(m_sessionsMutex);
+
+    std::map<RTP_UDP *, PUInt64>::iterator it = m_sessions.find(&session);
+    if (it == m_sessions.end())
+      return false;
+
+    m_registrations.erase(it->second);
+    m_sessions.erase(it);
+
+    // Kernel removes closed descriptors automatically, so errors are benign
+    struct epoll_event ev; // Needed for pre 2.6.9 kernels
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, session.GetDataSocketHandle(), &ev);
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, session.GetControlSocketHandle(), &ev);
+  }
+
+  // Wait for any dispatch already in progress to complete
+  m_dispatchMutex.Wait();
+  m_dispatchMutex.Signal();
+
+  PTRACE(4, "RTP_Reactor\tRemoved session " << session.GetSessionID() << " from worker " << m_index);
+  return true;
+}
+
+
+PINDEX RTP_Reactor::Worker::GetSessionCount() const
+{
+  PWaitAndSignal mutex(m_sessionsMutex);
+  return m_sessions.size();
+}
+
+
+void RTP_Reactor::Worker::Main()
+{
+  PTRACE(4, "RTP_Reactor\tWorker " << m_index << " started");
+
+  struct epoll_event events[MAX_EVENTS_PER_WAIT];
+
+  while (m_running) {
+    int count = epoll_wait(m_epoll, events, MAX_EVENTS_PER_WAIT, -1);
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+      PTRACE(1, "RTP_Reactor\tWorker " << m_index << " wait error: " << strerror(errno));
+      break;
+    }
+
+    PWaitAndSignal dispatch(m_dispatchMutex);
+
+    for (int i = 0; i < count; ++i) {
+      PUInt64 tag = events[i].data.u64;
+
+      if (tag == WAKE_TAG) {
+        char buffer[16];
+        while (::read(m_wakeFd[0], buffer, sizeof(buffer)) > 0)
+          ;
+        continue;
+      }
+
+      /* Session may have been removed since epoll_wait() returned, if so it
+         is possibly deleted, so look up its registration rather than using a
+         pointer that may now be to some other session. */
+      RTP_UDP * session;
+      {
+        PWaitAndSignal mutex(m_sessionsMutex);
+        std::map<PUInt64, RTP_UDP *>::iterator it = m_registrations.find(tag >> 1);
+        if (it == m_registrations.end())
+          continue;
+        session = it->second;
+      }
+
+      session->OnReactorReadable((tag & CONTROL_TAG_BIT) == 0);
+    }
+  }
+
+  PTRACE(4, "RTP_Reactor\tWorker " << m_index << " ended");
+}
+
+
+#endif // OPAL_RTP_AGGREGATE
+
+
+/////////////////////////////////////////////////////////////////////////////
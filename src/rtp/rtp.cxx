@@ -42,10 +42,24 @@
 #include <rtp/rtp.h>
 
 #include <rtp/jitter.h>
+#include <rtp/reactor.h>
+#include <rtp/statsreg.h>
 #include <ptclib/random.h>
 #include <ptclib/pstun.h>
 #include <opal/rtpconn.h>
 
+#include <algorithm>
+
+#if OPAL_RTP_AGGREGATE
+#include <sys/socket.h>
+#include <netinet/in.h>
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2,14)
+#define RTP_USE_MMSG 1  // recvmmsg() and sendmmsg() are available
+#endif
+#endif
+#endif
+
 #define new PNEW
 
 #define BAD_TRANSMIT_TIME_MAX 10    //  maximum of seconds of transmit fails before session is killed
@@ -54,6 +68,8 @@ const unsigned SecondsFrom1900to1970 = (70*365+17)*24*60*60U;
 
 #define UDP_BUFFER_SIZE 32768
 
+#define REACTOR_FRAME_SIZE 2048
+
 namespace PWLibStupidLinkerHacks {
 extern int opalLoader;
 
@@ -279,6 +295,176 @@ ostream & operator<<(ostream & o, RTP_DataFrame::PayloadTypes t)
 #endif
 
 
+/////////////////////////////////////////////////////////////////////////////
+
+RTP_DataFramePool::RTP_DataFramePool(PINDEX maxFreeFrames)
+  : m_maxFreeFrames(maxFreeFrames)
+  , m_hits(0)
+  , m_misses(0)
+  , m_discards(0)
+{
+  // Reserve now so returning frames never allocates
+  m_free[AudioClass].reserve(m_maxFreeFrames);
+  m_free[PacketClass].reserve(m_maxFreeFrames);
+  m_free[RawClass].reserve(MaxFreeRawFrames);
+}
+
+
+RTP_DataFramePool::~RTP_DataFramePool()
+{
+  for (PINDEX sizeClass = 0; sizeClass < NumSizeClasses; ++sizeClass) {
+    for (std::vector<RTP_DataFrame *>::iterator it = m_free[sizeClass].begin(); it != m_free[sizeClass].end(); ++it)
+      delete *it;
+  }
+
+  PTRACE(4, "RTP\tFrame pool destroyed: hits=" << m_hits << " misses=" << m_misses << " discards=" << m_discards);
+}
+
+
+RTP_DataFramePool::SizeClasses RTP_DataFramePool::GetSizeClass(PINDEX bufferSize)
+{
+  if (bufferSize <= AudioFrameSize)
+    return AudioClass;
+  if (bufferSize <= PacketFrameSize)
+    return PacketClass;
+  return RawClass;
+}
+
+
+RTP_DataFrame * RTP_DataFramePool::GetFrame(PINDEX payloadSize, PINDEX bufferSize)
+{
+  PINDEX size = std::max(bufferSize, RTP_DataFrame::MinHeaderSize+payloadSize);
+  SizeClasses sizeClass = GetSizeClass(size);
+
+  RTP_DataFrame * frame = NULL;
+
+  {
+    PWaitAndSignal mutex(m_mutex);
+
+    // Most recently returned first, it is more likely to be in the cache
+    std::vector<RTP_DataFrame *> & freeList = m_free[sizeClass];
+    for (size_t i = freeList.size(); i-- > 0; ) {
+      if (freeList[i]->GetSize() >= size) {
+        frame = freeList[i];
+        freeList.erase(freeList.begin()+i);
+        break;
+      }
+    }
+
+    if (frame != NULL)
+      ++m_hits;
+    else
+      ++m_misses;
+  }
+
+  if (frame == NULL) {
+    // Allocate the whole size class so frame can be reused for any in it
+    switch (sizeClass) {
+      case AudioClass :
+        return new RTP_DataFrame(payloadSize, AudioFrameSize);
+      case PacketClass :
+        return new RTP_DataFrame(payloadSize, PacketFrameSize);
+      default :
+        return new RTP_DataFrame(payloadSize, size);
+    }
+  }
+
+  // Make it look like a new frame
+  memset(frame->theArray, 0, RTP_DataFrame::MinHeaderSize);
+  frame->theArray[0] = '\x80';
+  frame->payloadSize = payloadSize;
+  return frame;
+}
+
+
+void RTP_DataFramePool::ReleaseFrame(RTP_DataFrame * frame)
+{
+  if (frame == NULL)
+    return;
+
+  /* Can only reuse if the buffer is not shared with another frame, and it
+     is not some descendant class that may have other members. */
+  if (frame->IsUnique() && strcmp(frame->GetClass(), RTP_DataFrame::Class()) == 0) {
+    SizeClasses sizeClass = GetSizeClass(frame->GetSize());
+    PINDEX maxFree = sizeClass == RawClass ? (PINDEX)MaxFreeRawFrames : m_maxFreeFrames;
+
+    PWaitAndSignal mutex(m_mutex);
+    if ((PINDEX)m_free[sizeClass].size() < maxFree) {
+      m_free[sizeClass].push_back(frame);
+      return;
+    }
+    ++m_discards;
+  }
+  else {
+    PWaitAndSignal mutex(m_mutex);
+    ++m_discards;
+  }
+
+  delete frame;
+}
+
+
+PINDEX RTP_DataFramePool::GetFreeCount() const
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  PINDEX count = 0;
+  for (PINDEX sizeClass = 0; sizeClass < NumSizeClasses; ++sizeClass)
+    count += m_free[sizeClass].size();
+  return count;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+RTP_DataFrame * RTP_DataFrameList::NewFrame(PINDEX payloadSize, PINDEX bufferSize)
+{
+  if (m_pool != NULL)
+    return m_pool->GetFrame(payloadSize, bufferSize);
+  return new RTP_DataFrame(payloadSize, bufferSize);
+}
+
+
+void RTP_DataFrameList::RecycleAt(PINDEX index)
+{
+  if (m_pool == NULL) {
+    RemoveAt(index);
+    return;
+  }
+
+  DisallowDeleteObjects();
+  RTP_DataFrame * frame = (RTP_DataFrame *)RemoveAt(index);
+  AllowDeleteObjects();
+
+  m_pool->ReleaseFrame(frame);
+}
+
+
+void RTP_DataFrameList::RecycleAll()
+{
+  if (m_pool == NULL) {
+    RemoveAll();
+    return;
+  }
+
+  for (iterator it = begin(); it != end(); ++it)
+    m_pool->ReleaseFrame(&*it);
+
+  DisallowDeleteObjects();
+  RemoveAll();
+  AllowDeleteObjects();
+}
+
+
+void RTP_DataFrameList::RecycleFrame(RTP_DataFrame * frame)
+{
+  if (m_pool != NULL)
+    m_pool->ReleaseFrame(frame);
+  else
+    delete frame;
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 
 RTP_ControlFrame::RTP_ControlFrame(PINDEX sz)
@@ -446,10 +632,21 @@ OpalMediaStatistics::OpalMediaStatistics()
   , m_averageJitter(0)
   , m_maximumJitter(0)
 
+    // Loss and quality
+  , m_burstDensity(0)
+  , m_burstDuration(0)
+  , m_gapDensity(0)
+  , m_gapDuration(0)
+  , m_roundTripTime(0)
+  , m_rFactor(RTP_VoIPMetrics::Unavailable)
+  , m_mosListening(RTP_VoIPMetrics::Unavailable)
+  , m_mosConversational(RTP_VoIPMetrics::Unavailable)
+
     // Video
   , m_totalFrames(0)
   , m_keyFrames(0)
 {
+  memset(m_jitterHistogram, 0, sizeof(m_jitterHistogram));
 }
 
 #if OPAL_FAX
@@ -521,8 +718,12 @@ RTP_Session::RTP_Session(const Params & params)
   rxStatisticsInterval = 100;  // Number of data packets between rx reports
   lastSentSequenceNumber = (WORD)PRandom::Number();
   expectedSequenceNumber = 0;
-  lastRRSequenceNumber = 0;
   consecutiveOutOfOrderPackets = 0;
+  m_extendedReports = isAudio;
+#if OPAL_STATISTICS
+  m_statisticsRegistry = NULL;
+  m_statisticsIndex = P_MAX_INDEX;
+#endif
 
   ClearStatistics();
 
@@ -539,24 +740,35 @@ RTP_Session::RTP_Session(const Params & params)
 
 RTP_Session::~RTP_Session()
 {
-  PTRACE_IF(3, packetsSent != 0 || packetsReceived != 0,
+#if OPAL_STATISTICS
+  /* Only a fallback, derived classes are already gone by now, so the owner
+     should have removed the session before deleting it. */
+  PTRACE_IF(2, m_statisticsRegistry != NULL, "RTP\tSession " << sessionID << " still in statistics registry when destroyed");
+  SetStatisticsRegistry(NULL, PString::Empty());
+#endif
+
+#if PTRACING
+  const SendCounters & tx = m_sendCounters.GetWriterValue();
+  const ReceiveCounters & rx = m_receiveCounters.GetWriterValue();
+#endif
+  PTRACE_IF(3, tx.m_packets != 0 || rx.m_packets != 0,
       "RTP\tSession " << sessionID << ", final statistics:\n"
-      "    packetsSent       = " << packetsSent << "\n"
-      "    octetsSent        = " << octetsSent << "\n"
-      "    averageSendTime   = " << averageSendTime << "\n"
-      "    maximumSendTime   = " << maximumSendTime << "\n"
-      "    minimumSendTime   = " << minimumSendTime << "\n"
-      "    packetsReceived   = " << packetsReceived << "\n"
-      "    octetsReceived    = " << octetsReceived << "\n"
-      "    packetsLost       = " << packetsLost << "\n"
+      "    packetsSent       = " << tx.m_packets << "\n"
+      "    octetsSent        = " << tx.m_octets << "\n"
+      "    averageSendTime   = " << tx.m_averageTime << "\n"
+      "    maximumSendTime   = " << tx.m_maximumTime << "\n"
+      "    minimumSendTime   = " << tx.m_minimumTime << "\n"
+      "    packetsReceived   = " << rx.m_packets << "\n"
+      "    octetsReceived    = " << rx.m_octets << "\n"
+      "    packetsLost       = " << rx.m_lost << "\n"
       "    packetsTooLate    = " << GetPacketsTooLate() << "\n"
       "    packetOverruns    = " << GetPacketOverruns() << "\n"
-      "    packetsOutOfOrder = " << packetsOutOfOrder << "\n"
-      "    averageReceiveTime= " << averageReceiveTime << "\n"
-      "    maximumReceiveTime= " << maximumReceiveTime << "\n"
-      "    minimumReceiveTime= " << minimumReceiveTime << "\n"
-      "    averageJitter     = " << (jitterLevel >> 7) << "\n"
-      "    maximumJitter     = " << (maximumJitterLevel >> 7)
+      "    packetsOutOfOrder = " << rx.m_outOfOrder << "\n"
+      "    averageReceiveTime= " << rx.m_averageTime << "\n"
+      "    maximumReceiveTime= " << rx.m_maximumTime << "\n"
+      "    minimumReceiveTime= " << rx.m_minimumTime << "\n"
+      "    averageJitter     = " << (rx.m_jitterLevel >> 7) << "\n"
+      "    maximumJitter     = " << (rx.m_maximumJitterLevel >> 7)
      );
   if (autoDeleteUserData)
     delete userData;
@@ -566,34 +778,24 @@ RTP_Session::~RTP_Session()
 
 void RTP_Session::ClearStatistics()
 {
-  packetsSent = 0;
+  // Must not be called while data is flowing, as this is another writer
+  SendCounters & tx = m_sendCounters.BeginWrite();
+  memset(&tx, 0, sizeof(tx));
+  tx.m_minimumTimeAccum = 0xffffffff;
+  m_sendCounters.EndWrite();
+
+  ReceiveCounters & rx = m_receiveCounters.BeginWrite();
+  memset(&rx, 0, sizeof(rx));
+  rx.m_minimumTimeAccum = 0xffffffff;
+  m_receiveCounters.EndWrite();
+
+  RemoteReports & remote = m_remoteReports.BeginWrite();
+  memset(&remote, 0, sizeof(remote));
+  m_remoteReports.EndWrite();
+
   rtcpPacketsSent = 0;
-  octetsSent = 0;
-  packetsReceived = 0;
-  octetsReceived = 0;
-  packetsLost = 0;
-  packetsOutOfOrder = 0;
-  averageSendTime = 0;
-  maximumSendTime = 0;
-  minimumSendTime = 0;
-  averageReceiveTime = 0;
-  maximumReceiveTime = 0;
-  minimumReceiveTime = 0;
-  jitterLevel = 0;
-  maximumJitterLevel = 0;
-  markerRecvCount = 0;
-  markerSendCount = 0;
-
-  txStatisticsCount = 0;
-  rxStatisticsCount = 0;
-  averageSendTimeAccum = 0;
-  maximumSendTimeAccum = 0;
-  minimumSendTimeAccum = 0xffffffff;
-  averageReceiveTimeAccum = 0;
-  maximumReceiveTimeAccum = 0;
-  minimumReceiveTimeAccum = 0xffffffff;
-  packetsLostSinceLastRR = 0;
-  lastTransitTime = 0;
+  m_lastReportExpected = 0;
+  m_lastReportLost = 0;
 }
 
 
@@ -611,7 +813,7 @@ void RTP_Session::SendBYE()
 
   // if any packets sent, put in a non-zero report 
   // else put in a zero report
-  if (packetsSent != 0 || rtcpPacketsSent != 0) 
+  if (GetPacketsSent() != 0 || rtcpPacketsSent != 0) 
     InsertReportPacket(report);
   else {
     // Send empty RR as nothing has happened
@@ -702,8 +904,10 @@ void RTP_Session::SetJitterBufferSize(unsigned minJitterDelay,
     SetIgnoreOutOfOrderPackets(false);
     if (m_jitterBuffer != NULL)
       m_jitterBuffer->SetDelay(minJitterDelay, maxJitterDelay);
-    else
+    else {
       m_jitterBuffer = new RTP_JitterBuffer(*this, minJitterDelay, maxJitterDelay, timeUnits, stackSize);
+      m_jitterBuffer->SetInlineIngest(UseInlineJitterBuffer());
+    }
     m_jitterBuffer->Resume();
   }
 }
@@ -733,42 +937,63 @@ PBoolean RTP_Session::ReadBufferedData(RTP_DataFrame & frame)
 void RTP_Session::SetTxStatisticsInterval(unsigned packets)
 {
   txStatisticsInterval = PMAX(packets, 2);
-  txStatisticsCount = 0;
-  averageSendTimeAccum = 0;
-  maximumSendTimeAccum = 0;
-  minimumSendTimeAccum = 0xffffffff;
+
+  SendCounters & tx = m_sendCounters.BeginWrite();
+  tx.m_intervalCount = 0;
+  tx.m_averageTimeAccum = 0;
+  tx.m_maximumTimeAccum = 0;
+  tx.m_minimumTimeAccum = 0xffffffff;
+  m_sendCounters.EndWrite();
 }
 
 
 void RTP_Session::SetRxStatisticsInterval(unsigned packets)
 {
   rxStatisticsInterval = PMAX(packets, 2);
-  rxStatisticsCount = 0;
-  averageReceiveTimeAccum = 0;
-  maximumReceiveTimeAccum = 0;
-  minimumReceiveTimeAccum = 0xffffffff;
+
+  ReceiveCounters & rx = m_receiveCounters.BeginWrite();
+  rx.m_intervalCount = 0;
+  rx.m_averageTimeAccum = 0;
+  rx.m_maximumTimeAccum = 0;
+  rx.m_minimumTimeAccum = 0xffffffff;
+  m_receiveCounters.EndWrite();
 }
 
 
 void RTP_Session::AddReceiverReport(RTP_ControlFrame::ReceiverReport & receiver)
 {
-  receiver.ssrc = syncSourceIn;
-  receiver.SetLostPackets(packetsLost);
+  ReceiveCounters rx = GetReceiveCounters();
 
-  if (expectedSequenceNumber > lastRRSequenceNumber)
-    receiver.fraction = (BYTE)((packetsLostSinceLastRR<<8)/(expectedSequenceNumber - lastRRSequenceNumber));
-  else
+  receiver.ssrc = syncSourceIn;
+  receiver.SetLostPackets(rx.m_lost);
+
+  // Fraction lost in the interval since the last report, RFC 3550 A.3
+  DWORD expected = rx.m_packets > 0 ? rx.m_highestSequence - rx.m_baseSequence + 1 : 0;
+  DWORD expectedInterval = expected - m_lastReportExpected;
+  DWORD lostInterval = rx.m_lost - m_lastReportLost;
+  m_lastReportExpected = expected;
+  m_lastReportLost = rx.m_lost;
+  if (expectedInterval == 0 || lostInterval == 0)
     receiver.fraction = 0;
-  packetsLostSinceLastRR = 0;
+  else if (lostInterval >= expectedInterval)
+    receiver.fraction = 255;
+  else
+    receiver.fraction = (BYTE)((lostInterval<<8)/expectedInterval);
 
-  receiver.last_seq = lastRRSequenceNumber;
-  lastRRSequenceNumber = expectedSequenceNumber;
+  receiver.last_seq = rx.m_highestSequence;
 
-  receiver.jitter = jitterLevel >> 4; // Allow for rounding protection bits
+  receiver.jitter = rx.m_jitterLevel >> 4; // Allow for rounding protection bits
 
-  // The following have not been calculated yet.
-  receiver.lsr = 0;
-  receiver.dlsr = 0;
+  // Delay since the last SR, in 1/65536 seconds, for the remote to get the round trip
+  RemoteReports remote = m_remoteReports.Get();
+  if (remote.m_lastSenderReportTick != 0) {
+    receiver.lsr = remote.m_lastSenderReport;
+    receiver.dlsr = (DWORD)(((PTimer::Tick().GetMilliSeconds() - remote.m_lastSenderReportTick) << 16)/1000);
+  }
+  else {
+    receiver.lsr = 0;
+    receiver.dlsr = 0;
+  }
 
   PTRACE(3, "RTP\tSession " << sessionID << ", SentReceiverReport:"
             " ssrc=" << receiver.ssrc
@@ -795,8 +1020,11 @@ RTP_Session::SendReceiveStatus RTP_Session::Internal_OnSendData(RTP_DataFrame &
   frame.SetSequenceNumber(++lastSentSequenceNumber);
   frame.SetSyncSource(syncSourceOut);
 
+  // Senders are serialised by dataMutex, so there is one writer at a time
+  SendCounters & tx = m_sendCounters.BeginWrite();
+
   // special handling for first packet
-  if (packetsSent == 0) {
+  if (tx.m_packets == 0) {
 
     // establish timestamp offset
     if (oobTimeStampBaseEstablished)  {
@@ -838,51 +1066,54 @@ RTP_Session::SendReceiveStatus RTP_Session::Internal_OnSendData(RTP_DataFrame &
     if ( ! (isAudio && frame.GetMarker()) ) {
       DWORD diff = (tick - lastSentPacketTime).GetInterval();
 
-      averageSendTimeAccum += diff;
-      if (diff > maximumSendTimeAccum)
-        maximumSendTimeAccum = diff;
-      if (diff < minimumSendTimeAccum)
-        minimumSendTimeAccum = diff;
-      txStatisticsCount++;
+      tx.m_averageTimeAccum += diff;
+      if (diff > tx.m_maximumTimeAccum)
+        tx.m_maximumTimeAccum = diff;
+      if (diff < tx.m_minimumTimeAccum)
+        tx.m_minimumTimeAccum = diff;
+      tx.m_intervalCount++;
     }
   }
 
   lastSentPacketTime = tick;
 
-  octetsSent += frame.GetPayloadSize();
-  packetsSent++;
+  tx.m_octets += frame.GetPayloadSize();
+  tx.m_packets++;
 
   if (frame.GetMarker())
-    markerSendCount++;
+    tx.m_markers++;
+
+  bool intervalDone = tx.m_intervalCount >= txStatisticsInterval;
+  if (intervalDone) {
+    tx.m_intervalCount = 0;
+
+    tx.m_averageTime = tx.m_averageTimeAccum/txStatisticsInterval;
+    tx.m_maximumTime = tx.m_maximumTimeAccum;
+    tx.m_minimumTime = tx.m_minimumTimeAccum;
+
+    tx.m_averageTimeAccum = 0;
+    tx.m_maximumTimeAccum = 0;
+    tx.m_minimumTimeAccum = 0xffffffff;
+  }
+
+  m_sendCounters.EndWrite();
 
   // Call the statistics call-back on the first PDU with total count == 1
-  if (packetsSent == 1 && userData != NULL)
+  if (tx.m_packets == 1 && userData != NULL)
     userData->OnTxStatistics(*this);
 
   if (!SendReport())
     return e_AbortTransport;
 
-  frame.SetSize(frame.GetHeaderSize()+frame.GetPayloadSize());
-
-  if (txStatisticsCount < txStatisticsInterval)
+  if (!intervalDone)
     return e_ProcessPacket;
 
-  txStatisticsCount = 0;
-
-  averageSendTime = averageSendTimeAccum/txStatisticsInterval;
-  maximumSendTime = maximumSendTimeAccum;
-  minimumSendTime = minimumSendTimeAccum;
-
-  averageSendTimeAccum = 0;
-  maximumSendTimeAccum = 0;
-  minimumSendTimeAccum = 0xffffffff;
-
   PTRACE(3, "RTP\tSession " << sessionID << ", transmit statistics: "
-   " packets=" << packetsSent <<
-   " octets=" << octetsSent <<
-   " avgTime=" << averageSendTime <<
-   " maxTime=" << maximumSendTime <<
-   " minTime=" << minimumSendTime
+   " packets=" << tx.m_packets <<
+   " octets=" << tx.m_octets <<
+   " avgTime=" << tx.m_averageTime <<
+   " maxTime=" << tx.m_maximumTime <<
+   " minTime=" << tx.m_minimumTime
   );
 
   if (userData != NULL)
@@ -920,6 +1151,13 @@ RTP_Session::SendReceiveStatus RTP_Session::OnReceiveData(RTP_DataFrame & frame)
   return EncodingLock(*this)->OnReceiveData(frame);
 }
 
+// Extend a sequence number to 32 bits, to the nearest value to the highest so far
+static DWORD ExtendSequenceNumber(DWORD highest, WORD sequenceNumber)
+{
+  return highest + (short)(WORD)(sequenceNumber - (WORD)highest);
+}
+
+
 RTP_Session::SendReceiveStatus RTP_Session::Internal_OnReceiveData(RTP_DataFrame & frame)
 {
   // Check that the PDU is the right version
@@ -947,9 +1185,13 @@ RTP_Session::SendReceiveStatus RTP_Session::Internal_OnReceiveData(RTP_DataFrame
   if (syncSourceIn == 0)
     syncSourceIn = frame.GetSyncSource();
 
+  // Only this thread changes the counters, readers never hold it up
+  ReceiveCounters & rx = m_receiveCounters.BeginWrite();
+
   // Check packet sequence numbers
-  if (packetsReceived == 0) {
+  if (rx.m_packets == 0) {
     expectedSequenceNumber = (WORD)(frame.GetSequenceNumber() + 1);
+    rx.m_baseSequence = rx.m_highestSequence = frame.GetSequenceNumber();
     PTRACE(3, "RTP\tSession " << sessionID << ", first receive data:"
               " ver=" << frame.GetVersion()
            << " pt=" << frame.GetPayloadType()
@@ -973,6 +1215,7 @@ RTP_Session::SendReceiveStatus RTP_Session::Internal_OnReceiveData(RTP_DataFrame
         allowOneSyncSourceChange = false;
       }
       else {
+        m_receiveCounters.EndWrite();
         PTRACE(2, "RTP\tSession " << sessionID << ", packet from SSRC=" << hex << frame.GetSyncSource() << " ignored, expecting SSRC=" << syncSourceIn << dec);
         return e_IgnorePacket; // Non fatal error, just ignore
       }
@@ -982,42 +1225,50 @@ RTP_Session::SendReceiveStatus RTP_Session::Internal_OnReceiveData(RTP_DataFrame
     if (sequenceNumber == expectedSequenceNumber) {
       expectedSequenceNumber++;
       consecutiveOutOfOrderPackets = 0;
+      rx.m_highestSequence = ExtendSequenceNumber(rx.m_highestSequence, sequenceNumber);
+
       // Only do statistics on packets after first received in talk burst
       if ( ! (isAudio && frame.GetMarker()) ) {
         DWORD diff = (tick - lastReceivedPacketTime).GetInterval();
 
-        averageReceiveTimeAccum += diff;
-        if (diff > maximumReceiveTimeAccum)
-          maximumReceiveTimeAccum = diff;
-        if (diff < minimumReceiveTimeAccum)
-          minimumReceiveTimeAccum = diff;
-        rxStatisticsCount++;
+        rx.m_averageTimeAccum += diff;
+        if (diff > rx.m_maximumTimeAccum)
+          rx.m_maximumTimeAccum = diff;
+        if (diff < rx.m_minimumTimeAccum)
+          rx.m_minimumTimeAccum = diff;
+        rx.m_intervalCount++;
 
         // The following has the implicit assumption that something that has jitter
         // is an audio codec and thus is in 8kHz timestamp units.
         diff *= 8;
-        long variance = diff - lastTransitTime;
-        lastTransitTime = diff;
+        long variance = diff - rx.m_lastTransitTime;
+        rx.m_lastTransitTime = diff;
         if (variance < 0)
           variance = -variance;
-        jitterLevel += variance - ((jitterLevel+8) >> 4);
-        if (jitterLevel > maximumJitterLevel)
-          maximumJitterLevel = jitterLevel;
+        rx.m_jitterLevel += variance - ((rx.m_jitterLevel+8) >> 4);
+        if (rx.m_jitterLevel > rx.m_maximumJitterLevel)
+          rx.m_maximumJitterLevel = rx.m_jitterLevel;
+        rx.m_jitterHistogram.Add(variance >> 3);
       }
 
       if (frame.GetMarker())
-        markerRecvCount++;
+        rx.m_markers++;
     }
     else if (allowSequenceChange) {
       expectedSequenceNumber = (WORD) (sequenceNumber + 1);
       allowSequenceChange = false;
+
+      // Move the base too, so the jump does not look like loss
+      DWORD extended = ExtendSequenceNumber(rx.m_highestSequence, sequenceNumber);
+      rx.m_baseSequence += extended - rx.m_highestSequence - 1;
+      rx.m_highestSequence = extended;
       PTRACE(2, "RTP\tSession " << sessionID << ", adjusting sequence numbers to expect "
              << expectedSequenceNumber << " ssrc=" << syncSourceIn);
     }
     else if (sequenceNumber < expectedSequenceNumber) {
       PTRACE(2, "RTP\tSession " << sessionID << ", out of order packet, received "
              << sequenceNumber << " expected " << expectedSequenceNumber << " ssrc=" << syncSourceIn);
-      packetsOutOfOrder++;
+      rx.m_outOfOrder++;
 
       // Check for Cisco bug where sequence numbers suddenly start incrementing
       // from a different base.
@@ -1027,13 +1278,16 @@ RTP_Session::SendReceiveStatus RTP_Session::Internal_OnReceiveData(RTP_DataFrame
                   " adjusting to expect " << expectedSequenceNumber << " ssrc=" << syncSourceIn);
       }
 
-      if (ignoreOutOfOrderPackets)
+      if (ignoreOutOfOrderPackets) {
+        m_receiveCounters.EndWrite();
         return e_IgnorePacket; // Non fatal error, just ignore
+      }
     }
     else {
       unsigned dropped = sequenceNumber - expectedSequenceNumber;
-      packetsLost += dropped;
-      packetsLostSinceLastRR += dropped;
+      rx.m_lost += dropped;
+      rx.m_lossModel.OnLost(dropped);
+      rx.m_highestSequence = ExtendSequenceNumber(rx.m_highestSequence, sequenceNumber);
       PTRACE(2, "RTP\tSession " << sessionID << ", dropped " << dropped
              << " packet(s) at " << sequenceNumber << ", ssrc=" << syncSourceIn);
       expectedSequenceNumber = (WORD)(sequenceNumber + 1);
@@ -1043,39 +1297,45 @@ RTP_Session::SendReceiveStatus RTP_Session::Internal_OnReceiveData(RTP_DataFrame
 
   lastReceivedPacketTime = tick;
 
-  octetsReceived += frame.GetPayloadSize();
-  packetsReceived++;
+  rx.m_octets += frame.GetPayloadSize();
+  rx.m_packets++;
+  rx.m_payloadType = (BYTE)frame.GetPayloadType();
+  rx.m_lossModel.OnReceived();
 
-  // Call the statistics call-back on the first PDU with total count == 1
-  if (packetsReceived == 1 && userData != NULL)
-    userData->OnRxStatistics(*this);
+  bool intervalDone = rx.m_intervalCount >= rxStatisticsInterval;
+  if (intervalDone) {
+    rx.m_intervalCount = 0;
 
-  if (!SendReport())
-    return e_AbortTransport;
+    rx.m_averageTime = rx.m_averageTimeAccum/rxStatisticsInterval;
+    rx.m_maximumTime = rx.m_maximumTimeAccum;
+    rx.m_minimumTime = rx.m_minimumTimeAccum;
 
-  if (rxStatisticsCount >= rxStatisticsInterval) {
+    rx.m_averageTimeAccum = 0;
+    rx.m_maximumTimeAccum = 0;
+    rx.m_minimumTimeAccum = 0xffffffff;
+  }
 
-    rxStatisticsCount = 0;
+  m_receiveCounters.EndWrite();
 
-    averageReceiveTime = averageReceiveTimeAccum/rxStatisticsInterval;
-    maximumReceiveTime = maximumReceiveTimeAccum;
-    minimumReceiveTime = minimumReceiveTimeAccum;
+  // Call the statistics call-back on the first PDU with total count == 1
+  if (rx.m_packets == 1 && userData != NULL)
+    userData->OnRxStatistics(*this);
 
-    averageReceiveTimeAccum = 0;
-    maximumReceiveTimeAccum = 0;
-    minimumReceiveTimeAccum = 0xffffffff;
+  if (!SendReport())
+    return e_AbortTransport;
 
+  if (intervalDone) {
     PTRACE(4, "RTP\tSession " << sessionID << ", receive statistics:"
-              " packets=" << packetsReceived <<
-              " octets=" << octetsReceived <<
-              " lost=" << packetsLost <<
+              " packets=" << rx.m_packets <<
+              " octets=" << rx.m_octets <<
+              " lost=" << rx.m_lost <<
               " tooLate=" << GetPacketsTooLate() <<
-              " order=" << packetsOutOfOrder <<
-              " avgTime=" << averageReceiveTime <<
-              " maxTime=" << maximumReceiveTime <<
-              " minTime=" << minimumReceiveTime <<
-              " jitter=" << (jitterLevel >> 7) <<
-              " maxJitter=" << (maximumJitterLevel >> 7));
+              " order=" << rx.m_outOfOrder <<
+              " avgTime=" << rx.m_averageTime <<
+              " maxTime=" << rx.m_maximumTime <<
+              " minTime=" << rx.m_minimumTime <<
+              " jitter=" << (rx.m_jitterLevel >> 7) <<
+              " maxJitter=" << (rx.m_maximumJitterLevel >> 7));
 
     if (userData != NULL)
       userData->OnRxStatistics(*this);
@@ -1089,8 +1349,10 @@ RTP_Session::SendReceiveStatus RTP_Session::Internal_OnReceiveData(RTP_DataFrame
 
 PBoolean RTP_Session::InsertReportPacket(RTP_ControlFrame & report)
 {
+  SendCounters tx = GetSendCounters();
+
   // No packets sent yet, so only set RR
-  if (packetsSent == 0) {
+  if (tx.m_packets == 0) {
 
     // Send RR as we are not transmitting
     report.StartNewPacket();
@@ -1123,8 +1385,8 @@ PBoolean RTP_Session::InsertReportPacket(RTP_ControlFrame & report)
     sender->ntp_sec  = (DWORD)(now.GetTimeInSeconds()+SecondsFrom1900to1970); // Convert from 1970 to 1900
     sender->ntp_frac = now.GetMicrosecond()*4294; // Scale microseconds to "fraction" from 0 to 2^32
     sender->rtp_ts   = lastSentTimestamp;
-    sender->psent    = packetsSent;
-    sender->osent    = octetsSent;
+    sender->psent    = tx.m_packets;
+    sender->osent    = tx.m_octets;
 
     PTRACE(3, "RTP\tSession " << sessionID << ", SentSenderReport:"
               " ssrc=" << syncSourceOut
@@ -1161,7 +1423,7 @@ PBoolean RTP_Session::SendReport()
     return true;
 
   // Have not got anything yet, do nothing
-  if (packetsSent == 0 && packetsReceived == 0) {
+  if (GetPacketsSent() == 0 && GetPacketsReceived() == 0) {
     reportTimer = reportTimeInterval;
     return true;
   }
@@ -1180,6 +1442,9 @@ PBoolean RTP_Session::SendReport()
   report.AddSourceDescriptionItem(RTP_ControlFrame::e_TOOL, toolName);
   report.EndPacket();
 
+  if (m_extendedReports)
+    InsertExtendedReport(report);
+
   PBoolean stat = WriteControl(report);
 
   return stat;
@@ -1200,17 +1465,201 @@ void RTP_Session::GetStatistics(OpalMediaStatistics & statistics, bool receiver)
   statistics.m_maximumPacketTime = receiver ? GetMaximumReceiveTime() : GetMaximumSendTime();
   statistics.m_averageJitter     = receiver ? GetAvgJitterTime()      : 0;
   statistics.m_maximumJitter     = receiver ? GetMaxJitterTime()      : 0;
+
+  if (receiver) {
+    ReceiveCounters rx = GetReceiveCounters();
+    for (PINDEX i = 0; i < RTP_JitterHistogram::Buckets; ++i)
+      statistics.m_jitterHistogram[i] = rx.m_jitterHistogram.m_counts[i];
+  }
+  else
+    memset(statistics.m_jitterHistogram, 0, sizeof(statistics.m_jitterHistogram));
+
+  // Our own metrics for what we receive, the remote's for what we send
+  RTP_VoIPMetrics metrics;
+  if (receiver ? GetVoIPMetrics(metrics) : GetRemoteVoIPMetrics(metrics)) {
+    statistics.m_burstDensity      = metrics.m_burstDensity;
+    statistics.m_burstDuration     = metrics.m_burstDuration;
+    statistics.m_gapDensity        = metrics.m_gapDensity;
+    statistics.m_gapDuration       = metrics.m_gapDuration;
+    statistics.m_rFactor           = metrics.m_rFactor;
+    statistics.m_mosListening      = metrics.m_mosLQ;
+    statistics.m_mosConversational = metrics.m_mosCQ;
+  }
+  statistics.m_roundTripTime = GetRoundTripTime();
+}
+#endif
+
+
+bool RTP_Session::GetVoIPMetrics(RTP_VoIPMetrics & metrics) const
+{
+  ReceiveCounters rx = GetReceiveCounters();
+  if (rx.m_packets == 0)
+    return false;
+
+  metrics.SetUnavailable();
+  metrics.m_ssrc = syncSourceIn;
+
+  DWORD expected = rx.m_highestSequence - rx.m_baseSequence + 1;
+  DWORD discarded = GetPacketsTooLate() + GetPacketOverruns();
+  if (expected > 0) {
+    metrics.m_lossRate = (BYTE)PMIN(((PUInt64)rx.m_lost << 8)/expected, 255);
+    metrics.m_discardRate = (BYTE)PMIN(((PUInt64)discarded << 8)/expected, 255);
+  }
+
+  RTP_LossModel::Report loss;
+  rx.m_lossModel.GetReport(loss);
+  unsigned packetTime = rx.m_averageTime > 0 ? rx.m_averageTime : 20;
+  metrics.m_burstDensity = (BYTE)loss.m_burstDensity;
+  metrics.m_gapDensity = (BYTE)loss.m_gapDensity;
+  metrics.m_burstDuration = (WORD)PMIN(loss.m_burstLength*packetTime, 0xffff);
+  metrics.m_gapDuration = (WORD)PMIN(loss.m_gapLength*packetTime, 0xffff);
+
+  // Delay through the jitter buffer, and the network if the round trip is known
+  unsigned jitterDelay = 0, jitterMaximum = 0;
+  {
+    JitterBufferPtr jitter = m_jitterBuffer; // Increase reference count
+    if (jitter != NULL && jitter->GetTimeUnits() > 0) {
+      jitterDelay = jitter->GetJitterTime()/jitter->GetTimeUnits();
+      jitterMaximum = jitter->GetMaxJitterTime()/jitter->GetTimeUnits();
+    }
+  }
+  metrics.m_jitterNominal = (WORD)jitterDelay;
+  metrics.m_jitterMaximum = (WORD)jitterMaximum;
+  metrics.m_jitterAbsoluteMaximum = (WORD)jitterMaximum;
+
+  DWORD roundTrip = GetRoundTripTime();
+  metrics.m_roundTripDelay = (WORD)PMIN(roundTrip, 0xffff);
+  metrics.m_endSystemDelay = (WORD)(jitterDelay + packetTime);
+
+  double Ie, Bpl;
+  RTP_EModel::GetCodecImpairments(rx.m_payloadType, Ie, Bpl);
+  double lossPercent = expected > 0 ? 100.0*(rx.m_lost + discarded)/expected : 0;
+  double listeningR = RTP_EModel::GetRFactor(lossPercent, loss.m_burstRatio, 0, Ie, Bpl);
+  metrics.m_mosLQ = (BYTE)(RTP_EModel::GetMOS(listeningR)*10 + 0.5);
+
+  // Without a round trip, only the delay at this end is known
+  double R = RTP_EModel::GetRFactor(lossPercent, loss.m_burstRatio, roundTrip/2 + metrics.m_endSystemDelay, Ie, Bpl);
+  metrics.m_rFactor = (BYTE)(R + 0.5);
+  metrics.m_mosCQ = (BYTE)(RTP_EModel::GetMOS(R)*10 + 0.5);
+
+  return true;
+}
+
+
+bool RTP_Session::GetRemoteVoIPMetrics(RTP_VoIPMetrics & metrics) const
+{
+  RemoteReports remote = m_remoteReports.Get();
+  if (!remote.m_haveMetrics)
+    return false;
+
+  metrics = remote.m_metrics;
+  return true;
+}
+
+
+DWORD RTP_Session::GetRoundTripTime() const
+{
+  return m_remoteReports.Get().m_roundTripTime;
+}
+
+
+#if OPAL_STATISTICS
+void RTP_Session::SetStatisticsRegistry(RTP_StatisticsRegistry * registry, const PString & label)
+{
+  if (m_statisticsRegistry != NULL)
+    m_statisticsRegistry->Remove(*this);
+  if (registry != NULL)
+    registry->Add(*this, label);
+}
+
+
+void RTP_Session::GetStatisticsRecord(RTP_StatisticsRecord & record) const
+{
+  SendCounters tx = GetSendCounters();
+  ReceiveCounters rx = GetReceiveCounters();
+  RemoteReports remote = m_remoteReports.Get();
+
+  record.m_sessionID         = sessionID;
+  record.m_localPort         = 0;
+  record.m_syncSourceOut     = syncSourceOut;
+  record.m_syncSourceIn      = syncSourceIn;
+  record.m_packetsSent       = tx.m_packets;
+  record.m_octetsSent        = tx.m_octets;
+  record.m_packetsReceived   = rx.m_packets;
+  record.m_octetsReceived    = rx.m_octets;
+  record.m_packetsLost       = rx.m_lost;
+  record.m_packetsOutOfOrder = rx.m_outOfOrder;
+  record.m_averageJitter     = rx.m_jitterLevel >> 7;
+  record.m_maximumJitter     = rx.m_maximumJitterLevel >> 7;
+  record.m_roundTripTime     = remote.m_roundTripTime;
+  for (PINDEX i = 0; i < RTP_JitterHistogram::Buckets; ++i)
+    record.m_jitterHistogram[i] = rx.m_jitterHistogram.m_counts[i];
+
+  DWORD expected = rx.m_highestSequence - rx.m_baseSequence + 1;
+  if (rx.m_packets > 0 && expected > 0) {
+    RTP_LossModel::Report loss;
+    rx.m_lossModel.GetReport(loss);
+    record.m_burstDensity = loss.m_burstDensity;
+    record.m_gapDensity = loss.m_gapDensity;
+
+    // Listening quality only, the delay would need the jitter buffer
+    double Ie, Bpl;
+    RTP_EModel::GetCodecImpairments(rx.m_payloadType, Ie, Bpl);
+    double R = RTP_EModel::GetRFactor(100.0*rx.m_lost/expected, loss.m_burstRatio, 0, Ie, Bpl);
+    record.m_mosListening = (DWORD)(RTP_EModel::GetMOS(R)*10 + 0.5);
+  }
+  else {
+    record.m_burstDensity = 0;
+    record.m_gapDensity = 0;
+    record.m_mosListening = RTP_StatisticsRecord::Unavailable;
+  }
+
+  if (remote.m_haveMetrics) {
+    record.m_remoteRFactor           = remote.m_metrics.m_rFactor;
+    record.m_remoteMOSListening      = remote.m_metrics.m_mosLQ;
+    record.m_remoteMOSConversational = remote.m_metrics.m_mosCQ;
+  }
+  else {
+    record.m_remoteRFactor           = RTP_StatisticsRecord::Unavailable;
+    record.m_remoteMOSListening      = RTP_StatisticsRecord::Unavailable;
+    record.m_remoteMOSConversational = RTP_StatisticsRecord::Unavailable;
+  }
 }
 #endif
 
 
+void RTP_Session::InsertExtendedReport(RTP_ControlFrame & report)
+{
+  RTP_VoIPMetrics metrics;
+  if (!GetVoIPMetrics(metrics))
+    return;
+
+  report.StartNewPacket();
+  report.SetPayloadType(RTP_ControlFrame::e_ExtendedReport);
+  report.SetPayloadSize(4 + RTP_VoIPMetrics::BlockSize);  // SSRC of packet sender plus block
+  report.SetCount(0);
+  BYTE * payload = report.GetPayloadPtr();
+
+  *(PUInt32b *)payload = syncSourceOut;
+  metrics.Encode(payload+4);
+  report.EndPacket();
+
+  PTRACE(4, "RTP\tSession " << sessionID << ", SentVoIPMetrics: " << metrics);
+}
+
+
 static RTP_Session::ReceiverReportArray
 BuildReceiverReportArray(const RTP_ControlFrame & frame, PINDEX offset)
 {
   RTP_Session::ReceiverReportArray reports;
 
+  // The count is from the packet, do not read past the end if it lies
+  PINDEX count = frame.GetCount();
+  if (offset + count*(PINDEX)sizeof(RTP_ControlFrame::ReceiverReport) > frame.GetPayloadSize())
+    return reports;
+
   const RTP_ControlFrame::ReceiverReport * rr = (const RTP_ControlFrame::ReceiverReport *)(frame.GetPayloadPtr()+offset);
-  for (PINDEX repIdx = 0; repIdx < (PINDEX)frame.GetCount(); repIdx++) {
+  for (PINDEX repIdx = 0; repIdx < count; repIdx++) {
     RTP_Session::ReceiverReport * report = new RTP_Session::ReceiverReport;
     report->sourceIdentifier = rr->ssrc;
     report->fractionLost = rr->fraction;
@@ -1241,7 +1690,7 @@ RTP_Session::SendReceiveStatus RTP_Session::OnReceiveControl(RTP_ControlFrame &
     }
     switch (frame.GetPayloadType()) {
     case RTP_ControlFrame::e_SenderReport :
-      if (size >= sizeof(RTP_ControlFrame::SenderReport)) {
+      if (size >= 4+sizeof(RTP_ControlFrame::SenderReport)) {
         SenderReport sender;
         sender.sourceIdentifier = *(const PUInt32b *)payload;
         const RTP_ControlFrame::SenderReport & sr = *(const RTP_ControlFrame::SenderReport *)(payload+4);
@@ -1249,7 +1698,15 @@ RTP_Session::SendReceiveStatus RTP_Session::OnReceiveControl(RTP_ControlFrame &
         sender.rtpTimestamp = sr.rtp_ts;
         sender.packetsSent = sr.psent;
         sender.octetsSent = sr.osent;
-        OnRxSenderReport(sender, BuildReceiverReportArray(frame, sizeof(RTP_ControlFrame::SenderReport)));
+
+        // Kept for the LSR and DLSR of our next receiver report
+        RemoteReports & remote = m_remoteReports.BeginWrite();
+        remote.m_lastSenderReport = (sr.ntp_sec << 16) | (sr.ntp_frac >> 16);
+        remote.m_lastSenderReportTick = PTimer::Tick().GetMilliSeconds();
+        m_remoteReports.EndWrite();
+
+        OnRxReportBlocks(frame, 4+sizeof(RTP_ControlFrame::SenderReport));
+        OnRxSenderReport(sender, BuildReceiverReportArray(frame, 4+sizeof(RTP_ControlFrame::SenderReport)));
       }
       else {
         PTRACE(2, "RTP\tSession " << sessionID << ", SenderReport packet truncated");
@@ -1257,9 +1714,11 @@ RTP_Session::SendReceiveStatus RTP_Session::OnReceiveControl(RTP_ControlFrame &
       break;
 
     case RTP_ControlFrame::e_ReceiverReport :
-      if (size >= 4)
+      if (size >= 4) {
+        OnRxReportBlocks(frame, 4);
         OnRxReceiverReport(*(const PUInt32b *)payload,
         BuildReceiverReportArray(frame, sizeof(PUInt32b)));
+      }
       else {
         PTRACE(2, "RTP\tSession " << sessionID << ", ReceiverReport packet truncated");
       }
@@ -1343,6 +1802,36 @@ RTP_Session::SendReceiveStatus RTP_Session::OnReceiveControl(RTP_ControlFrame &
       }
       break;
 
+    case RTP_ControlFrame::e_ExtendedReport :
+      if (size >= 4) {
+        // Report blocks follow the SSRC, only VoIP metrics are understood
+        DWORD src = *(const PUInt32b *)payload;
+        unsigned offset = 4;
+        while (offset + 4 <= size) {
+          unsigned blockSize = 4 + 4*((payload[offset+2] << 8) | payload[offset+3]);
+          if (offset + blockSize > size) {
+            PTRACE(2, "RTP\tSession " << sessionID << ", ExtendedReport block truncated");
+            break;
+          }
+
+          RTP_VoIPMetrics metrics;
+          if (payload[offset] == RTP_VoIPMetrics::BlockType && metrics.Decode(payload+offset, blockSize)) {
+            if (metrics.m_ssrc == syncSourceOut) {
+              RemoteReports & remote = m_remoteReports.BeginWrite();
+              remote.m_haveMetrics = true;
+              remote.m_metrics = metrics;
+              m_remoteReports.EndWrite();
+            }
+            OnRxVoIPMetrics(src, metrics);
+          }
+          offset += blockSize;
+        }
+      }
+      else {
+        PTRACE(2, "RTP\tSession " << sessionID << ", ExtendedReport packet truncated");
+      }
+      break;
+
 #if OPAL_VIDEO
      case RTP_ControlFrame::e_IntraFrameRequest :
       if(userData != NULL)
@@ -1359,6 +1848,37 @@ RTP_Session::SendReceiveStatus RTP_Session::OnReceiveControl(RTP_ControlFrame &
 }
 
 
+void RTP_Session::OnRxReportBlocks(const RTP_ControlFrame & frame, PINDEX offset)
+{
+  PINDEX count = frame.GetCount();
+  if (offset + count*(PINDEX)sizeof(RTP_ControlFrame::ReceiverReport) > frame.GetPayloadSize())
+    return;
+
+  const RTP_ControlFrame::ReceiverReport * rr = (const RTP_ControlFrame::ReceiverReport *)(frame.GetPayloadPtr()+offset);
+  for (PINDEX i = 0; i < count; ++i, ++rr) {
+    if (rr->ssrc != syncSourceOut || rr->lsr == 0)
+      continue;
+
+    // Round trip is now less the time of our SR and the remote's delay since it, RFC 3550 6.4.1
+    PTime now;
+    DWORD ntp = (DWORD)(((now.GetTimeInSeconds()+SecondsFrom1900to1970) << 16) | ((DWORD)(now.GetMicrosecond()*4294) >> 16));
+    DWORD roundTrip = ntp - rr->lsr - rr->dlsr;
+    if (roundTrip >= 0x80000000)
+      continue; // Clocks are confused
+
+    RemoteReports & remote = m_remoteReports.BeginWrite();
+    remote.m_roundTripTime = (DWORD)(((PUInt64)roundTrip*1000) >> 16);
+    m_remoteReports.EndWrite();
+  }
+}
+
+
+void RTP_Session::OnRxVoIPMetrics(DWORD PTRACE_PARAM(src), const RTP_VoIPMetrics & PTRACE_PARAM(metrics))
+{
+  PTRACE(3, "RTP\tSession " << sessionID << ", OnRxVoIPMetrics: src=" << hex << src << dec << ' ' << metrics);
+}
+
+
 void RTP_Session::OnRxSenderReport(const SenderReport & PTRACE_PARAM(sender),
            const ReceiverReportArray & PTRACE_PARAM(reports))
 {
@@ -1517,8 +2037,13 @@ RTP_UDP::RTP_UDP(const Params & params)
     remoteAddress(0),
     remoteTransmitAddress(0),
     remoteIsNAT(params.remoteIsNAT)
+#if OPAL_RTP_AGGREGATE
+    , m_reactorTimer(*this)
+#endif
 {
   PTRACE(4, "RTP_UDP\tSession " << sessionID << ", created with NAT flag set to " << remoteIsNAT);
+  localDataPort     = 0;
+  localControlPort  = 0;
   remoteDataPort    = 0;
   remoteControlPort = 0;
   shutdownRead      = false;
@@ -1528,11 +2053,27 @@ RTP_UDP::RTP_UDP(const Params & params)
   appliedQOS        = false;
   localHasNAT       = false;
   badTransmitCounter = 0;
+#if OPAL_RTP_AGGREGATE
+  m_reactor         = NULL;
+  m_reactorAttached = false;
+  m_reactorAborted  = false;
+  m_relayHandler    = NULL;
+#endif
 }
 
 
 RTP_UDP::~RTP_UDP()
 {
+#if OPAL_RTP_AGGREGATE
+  // Must be before anything else so no reactor thread can call us
+  DetachReactor();
+#endif
+
+#if OPAL_STATISTICS
+  // Fallback for owners that did not remove us, before our members go
+  SetStatisticsRegistry(NULL, PString::Empty());
+#endif
+
   Close(true);
   Close(false);
 
@@ -1543,6 +2084,13 @@ RTP_UDP::~RTP_UDP()
 
   delete dataSocket;
   delete controlSocket;
+
+#if OPAL_RTP_AGGREGATE
+  while (!m_reactorQueue.empty()) {
+    delete m_reactorQueue.front();
+    m_reactorQueue.pop();
+  }
+#endif
 }
 
 
@@ -1573,12 +2121,27 @@ PBoolean RTP_UDP::ModifyQOS(RTP_QOS * rtpqos)
   return retval;
 }
 
+
+#if OPAL_STATISTICS
+void RTP_UDP::GetStatisticsRecord(RTP_StatisticsRecord & record) const
+{
+  RTP_Session::GetStatisticsRecord(record);
+  record.m_localPort = localDataPort;
+}
+#endif
+
+
 PBoolean RTP_UDP::Open(PIPSocket::Address _localAddress,
                    WORD portBase, WORD portMax,
                    BYTE tos,
                    PNatMethod * natMethod,
                    RTP_QOS * rtpQos)
 {
+#if OPAL_RTP_AGGREGATE
+  // Sockets are about to be deleted, and cannot do this with dataMutex held
+  DetachReactor();
+#endif
+
   PWaitAndSignal mutex(dataMutex);
 
   first = true;
@@ -1690,6 +2253,9 @@ PBoolean RTP_UDP::Open(PIPSocket::Address _localAddress,
          << localAddress << ':' << localDataPort << '-' << localControlPort
          << " ssrc=" << syncSourceOut);
   
+#if OPAL_RTP_AGGREGATE
+  AttachReactor();
+#endif
 
   return true;
 }
@@ -1724,6 +2290,14 @@ void RTP_UDP::Close(PBoolean reading)
           PIPSocket::GetHostAddress(addr);
         dataSocket->WriteTo("", 1, addr, controlSocket->GetPort());
       }
+#if OPAL_RTP_AGGREGATE
+      m_reactorSignal.Signal();
+      if (m_reactorAttached) {
+        JitterBufferPtr jitter = m_jitterBuffer; // Increase reference count
+        if (jitter != NULL && jitter->IsInlineIngest())
+          jitter->Shutdown();
+      }
+#endif
     }
   }
   else {
@@ -1798,6 +2372,11 @@ PBoolean RTP_UDP::ReadData(RTP_DataFrame & frame, PBoolean loop)
 
 PBoolean RTP_UDP::Internal_ReadData(RTP_DataFrame & frame, PBoolean loop)
 {
+#if OPAL_RTP_AGGREGATE
+  if (m_reactorAttached)
+    return ReadReactorData(frame, loop);
+#endif
+
   do {
     int selectStatus = WaitForPDU(*dataSocket, *controlSocket, reportTimer);
 
@@ -1892,54 +2471,574 @@ int RTP_UDP::Internal_WaitForPDU(PUDPSocket & dataSocket, PUDPSocket & controlSo
   return PSocket::Select(dataSocket, controlSocket, timeout);
 }
 
-RTP_Session::SendReceiveStatus RTP_UDP::ReadDataOrControlPDU(BYTE * framePtr,
-                                                             PINDEX frameSize,
-                                                             PBoolean fromDataChannel)
+#if OPAL_RTP_AGGREGATE
+
+bool RTP_UDP::AttachReactor()
 {
-#if PTRACING
-  const char * channelName = fromDataChannel ? "Data" : "Control";
+  if (m_reactor == NULL || dataSocket == NULL || controlSocket == NULL)
+    return false;
+
+  if (GetEncoding() != "rtp/avp") {
+    PTRACE(4, "RTP_UDP\tSession " << sessionID << ", not using reactor for encoding " << GetEncoding());
+    return false;
+  }
+
+  PWaitAndSignal mutex(m_reactorMutex);
+
+  if (m_reactorAttached)
+    return true;
+
+  // Reactor threads must never block in a read
+  dataSocket->SetReadTimeout(0);
+  controlSocket->SetReadTimeout(0);
+
+  if (!m_reactor->AddSession(*this)) {
+    PTRACE(2, "RTP_UDP\tSession " << sessionID << ", could not attach to reactor, using own thread");
+    dataSocket->SetReadTimeout(PMaxTimeInterval);
+    controlSocket->SetReadTimeout(PMaxTimeInterval);
+    return false;
+  }
+
+  m_reactorAttached = true;
+  m_reactorAborted = false;
+
+  ScheduleReactorTimer();
+  return true;
+}
+
+
+void RTP_UDP::DetachReactor()
+{
+  bool aborted;
+  {
+    PWaitAndSignal mutex(m_reactorMutex);
+    if (!m_reactorAttached)
+      return;
+    m_reactorAttached = false;
+    aborted = m_reactorAborted;
+  }
+
+  // Both wait for any in progress dispatch, so cannot hold m_reactorMutex
+  m_reactor->GetTimerWheel().Cancel(m_reactorTimer);
+  m_reactor->RemoveSession(*this);
+
+  if (dataSocket != NULL)
+    dataSocket->SetReadTimeout(PMaxTimeInterval);
+  if (controlSocket != NULL)
+    controlSocket->SetReadTimeout(PMaxTimeInterval);
+
+  // Jitter buffer now needs its own thread to read the sockets
+  if (!aborted) {
+    JitterBufferPtr jitter = m_jitterBuffer; // Increase reference count
+    if (jitter != NULL && jitter->IsInlineIngest()) {
+      jitter->SetInlineIngest(false);
+      jitter->Resume();
+    }
+  }
+
+  // Wake up reader so it can revert to reading the sockets itself
+  m_reactorSignal.Signal();
+}
+
+
+void RTP_UDP::AbortReactor()
+{
+  {
+    PWaitAndSignal mutex(m_reactorMutex);
+    m_reactorAborted = true;
+  }
+
+  JitterBufferPtr jitter = m_jitterBuffer; // Increase reference count
+  if (jitter != NULL && jitter->IsInlineIngest())
+    jitter->Shutdown();
+
+  m_reactorSignal.Signal();
+}
+
+
+void RTP_UDP::ScheduleReactorTimer()
+{
+  // Next RTCP report is due when the report timer runs out
+  PTimeInterval delay = reportTimer.GetMilliSeconds();
+  if (delay <= 0)
+    delay = reportTimeInterval;
+  m_reactor->GetTimerWheel().Schedule(m_reactorTimer, delay);
+}
+
+
+void RTP_UDP::OnReactorTimeout()
+{
+  RTP_DataFrame frame(0);
+  if (OnReadTimeout(frame) == e_AbortTransport) {
+    PTRACE(2, "RTP_UDP\tSession " << sessionID << ", aborted by reactor timeout.");
+    /* Cannot detach here, as that waits for the reactor threads, which may
+       in turn be waiting for this timer thread. Detached on Close(). */
+    AbortReactor();
+    return;
+  }
+
+  PWaitAndSignal mutex(m_reactorMutex);
+  if (m_reactorAttached)
+    ScheduleReactorTimer();
+}
+
+
+void RTP_UDP::SetEncoding(const PString & newEncoding)
+{
+  RTP_Session::SetEncoding(newEncoding);
+
+  if (m_reactorAttached && GetEncoding() != "rtp/avp") {
+    PTRACE(3, "RTP_UDP\tSession " << sessionID << ", detaching from reactor for encoding " << GetEncoding());
+    DetachReactor();
+  }
+}
+
+
+void RTP_UDP::OnReactorReadable(bool fromDataChannel)
+{
+  SendReceiveStatus status;
+
+  if (!fromDataChannel)
+    status = ReadControlPDU();
+  else if (m_relayHandler != NULL && ReadRelayData())
+    return;
+  else {
+    RTP_DataFrame * frame = m_reactor->GetFramePool().GetFrame(0, REACTOR_FRAME_SIZE);
+    status = ReadDataPDU(*frame);
+    if (status == e_ProcessPacket) {
+      if (shutdownRead)
+        status = e_IgnorePacket;
+      else {
+        status = OnReceiveData(*frame);
+        if (status == e_ProcessPacket) {
+          OnReactorData(frame);
+          return;
+        }
+      }
+    }
+    m_reactor->GetFramePool().ReleaseFrame(frame);
+  }
+
+  if (status == e_AbortTransport) {
+    PTRACE(2, "RTP_UDP\tSession " << sessionID << ", aborted by reactor read of "
+           << (fromDataChannel ? "data" : "control") << " channel.");
+    AbortReactor();
+    DetachReactor();
+  }
+}
+
+
+void RTP_UDP::OnReactorData(RTP_DataFrame * frame)
+{
+  // Go straight into the jitter buffer, saving a thread and a context switch
+  JitterBufferPtr jitter = m_jitterBuffer; // Increase reference count
+  if (jitter != NULL && jitter->IsInlineIngest()) {
+    jitter->WriteData(*frame);
+    m_reactor->GetFramePool().ReleaseFrame(frame);
+    return;
+  }
+
+  {
+    PWaitAndSignal mutex(m_reactorMutex);
+
+    if (m_reactorQueue.size() >= MaxReactorQueueSize) {
+      PTRACE(4, "RTP_UDP\tSession " << sessionID << ", reader not keeping up, dropping oldest packet.");
+      m_reactor->GetFramePool().ReleaseFrame(m_reactorQueue.front());
+      m_reactorQueue.pop();
+    }
+
+    m_reactorQueue.push(frame);
+  }
+
+  m_reactorSignal.Signal();
+}
+
+
+PBoolean RTP_UDP::ReadReactorData(RTP_DataFrame & frame, PBoolean loop)
+{
+  for (;;) {
+    RTP_DataFrame * queued = NULL;
+    bool attached, aborted;
+
+    {
+      PWaitAndSignal mutex(m_reactorMutex);
+
+      if (first && isAudio) {
+        PTRACE_IF(2, !m_reactorQueue.empty(), "RTP_UDP\tSession " << sessionID << ", flushed "
+                  << m_reactorQueue.size() << " RTP data packets on startup");
+        while (!m_reactorQueue.empty()) {
+          m_reactor->GetFramePool().ReleaseFrame(m_reactorQueue.front());
+          m_reactorQueue.pop();
+        }
+        first = false;
+      }
+
+      if (!m_reactorQueue.empty()) {
+        queued = m_reactorQueue.front();
+        m_reactorQueue.pop();
+      }
+
+      attached = m_reactorAttached;
+      aborted = m_reactorAborted;
+    }
+
+    {
+      PWaitAndSignal mutex(dataMutex);
+      if (shutdownRead) {
+        PTRACE(3, "RTP_UDP\tSession " << sessionID << ", Read shutdown.");
+        m_reactor->GetFramePool().ReleaseFrame(queued);
+        return false;
+      }
+    }
+
+    if (queued != NULL) {
+      /* Copy rather than share, so the queued frame can go back to the pool
+         and the callers frame keeps its own buffer. */
+      PINDEX payloadSize = queued->GetPayloadSize() + queued->GetPaddingSize();
+      PINDEX frameSize = queued->GetHeaderSize() + payloadSize;
+      memcpy(frame.GetPointer(frameSize), (const BYTE *)*queued, frameSize);
+      frame.SetPayloadSize(payloadSize);
+      m_reactor->GetFramePool().ReleaseFrame(queued);
+      return true;
+    }
+
+    if (aborted)
+      return false;
+
+    if (!attached)
+      return Internal_ReadData(frame, loop);
+
+    // RTCP reports and timeouts are handled by the reactor timer wheel
+    m_reactorSignal.Wait();
+  }
+}
+
+bool RTP_UDP::SetRelayHandler(RelayHandler * handler)
+{
+  if (handler != NULL && !m_reactorAttached) {
+    PTRACE(3, "RTP_UDP\tSession " << sessionID << ", cannot relay as not attached to reactor");
+    return false;
+  }
+
+  // Waits for any batch currently being passed to the old handler
+  PWaitAndSignal relay(m_relayMutex);
+
+  PTRACE_IF(3, (m_relayHandler != NULL) != (handler != NULL),
+            "RTP_UDP\tSession " << sessionID << ", " << (handler != NULL ? "started" : "stopped") << " relaying");
+  m_relayHandler = handler;
+  return true;
+}
+
+
+#if RTP_USE_MMSG
+
+static bool GetRelayAddress(const sockaddr_storage & storage, PIPSocket::Address & addr, WORD & port)
+{
+  switch (storage.ss_family) {
+    case AF_INET :
+      addr = PIPSocket::Address(((const sockaddr_in &)storage).sin_addr);
+      port = ntohs(((const sockaddr_in &)storage).sin_port);
+      return true;
+
+#if P_HAS_IPV6
+    case AF_INET6 :
+      addr = PIPSocket::Address(((const sockaddr_in6 &)storage).sin6_addr);
+      port = ntohs(((const sockaddr_in6 &)storage).sin6_port);
+      return true;
 #endif
-  PUDPSocket & socket = *(fromDataChannel ? dataSocket : controlSocket);
-  PIPSocket::Address addr;
-  WORD port;
+  }
+
+  return false;
+}
+
+
+static socklen_t SetRelayAddress(sockaddr_storage & storage, const PIPSocket::Address & addr, WORD port)
+{
+  memset(&storage, 0, sizeof(storage));
 
-  if (socket.ReadFrom(framePtr, frameSize, addr, port)) {
-    // If remote address never set from higher levels, then try and figure
-    // it out from the first packet received.
-    if (!remoteAddress.IsValid()) {
-      remoteAddress = addr;
-      PTRACE(4, "RTP\tSession " << sessionID << ", set remote address from first "
-             << channelName << " PDU from " << addr << ':' << port);
+#if P_HAS_IPV6
+  if (addr.GetVersion() == 6) {
+    sockaddr_in6 & sin6 = (sockaddr_in6 &)storage;
+    sin6.sin6_family = AF_INET6;
+    sin6.sin6_addr = addr;
+    sin6.sin6_port = htons(port);
+    return sizeof(sin6);
+  }
+#endif
+
+  sockaddr_in & sin = (sockaddr_in &)storage;
+  sin.sin_family = AF_INET;
+  sin.sin_addr = addr;
+  sin.sin_port = htons(port);
+  return sizeof(sin);
+}
+
+#endif // RTP_USE_MMSG
+
+
+bool RTP_UDP::ReadRelayData()
+{
+  PWaitAndSignal relay(m_relayMutex);
+
+  // May have been stopped since the caller checked
+  if (m_relayHandler == NULL)
+    return false;
+
+  RTP_DataFramePool & pool = m_reactor->GetFramePool();
+  RTP_DataFrame * frames[RelayBatchSize];
+  RTP_DataFrame * accepted[RelayBatchSize];
+  PINDEX acceptedCount = 0;
+
+#if RTP_USE_MMSG
+  struct mmsghdr   messages[RelayBatchSize];
+  struct iovec     vectors[RelayBatchSize];
+  sockaddr_storage addresses[RelayBatchSize];
+
+  memset(messages, 0, sizeof(messages));
+  for (PINDEX i = 0; i < RelayBatchSize; ++i) {
+    frames[i] = pool.GetFrame(0, RelayFrameSize+RelayTrailerSize);
+    vectors[i].iov_base = frames[i]->GetPointer();
+    vectors[i].iov_len = RelayFrameSize;
+    messages[i].msg_hdr.msg_iov = &vectors[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+    messages[i].msg_hdr.msg_name = &addresses[i];
+    messages[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+  }
+
+  // Reading everything available in one system call is the point of relaying
+  int received = recvmmsg(dataSocket->GetHandle(), messages, RelayBatchSize, MSG_DONTWAIT, NULL);
+  if (received < 0) {
+    PTRACE_IF(2, errno != EAGAIN && errno != EINTR && errno != ECONNREFUSED && errno != ECONNRESET,
+              "RTP_UDP\tSession " << sessionID << ", relay read error: " << strerror(errno));
+    received = 0;
+  }
+
+  for (int i = 0; i < received; ++i) {
+    PIPSocket::Address addr;
+    WORD port;
+    if (!GetRelayAddress(addresses[i], addr, port) || CheckReceivedAddress(addr, port, true) != e_ProcessPacket)
+      continue;
+
+    RTP_DataFrame & frame = *frames[i];
+    PINDEX pduSize = messages[i].msg_len;
+    if (pduSize < RTP_DataFrame::MinHeaderSize || pduSize < frame.GetHeaderSize()) {
+      PTRACE(2, "RTP_UDP\tSession " << sessionID << ", Received data packet too small: " << pduSize << " bytes");
+      continue;
     }
-    if (fromDataChannel) {
-      if (remoteDataPort == 0)
-        remoteDataPort = port;
+    frame.SetPayloadSize(pduSize - frame.GetHeaderSize());
+    accepted[acceptedCount++] = &frame;
+  }
+
+  const PINDEX frameCount = RelayBatchSize;
+#else
+  // No batch read available, so one PDU per readable event
+  frames[0] = pool.GetFrame(0, RelayFrameSize+RelayTrailerSize);
+  if (ReadDataPDU(*frames[0]) == e_ProcessPacket)
+    accepted[acceptedCount++] = frames[0];
+
+  const PINDEX frameCount = 1;
+#endif
+
+  if (shutdownRead)
+    acceptedCount = 0;
+  else if (acceptedCount > 0)
+    OnReceiveRelayData(accepted, acceptedCount);
+
+  if (acceptedCount > 0)
+    m_relayHandler->OnRelayData(*this, accepted, acceptedCount);
+
+  for (PINDEX i = 0; i < frameCount; ++i)
+    pool.ReleaseFrame(frames[i]);
+
+  return true;
+}
+
+
+bool RTP_UDP::WriteRelayData(RTP_DataFrame * const * frames, PINDEX count)
+{
+  {
+    PWaitAndSignal mutex(dataMutex);
+    if (shutdownWrite) {
+      PTRACE(3, "RTP_UDP\tSession " << sessionID << ", write shutdown.");
+      return false;
     }
-    else {
-      if (remoteControlPort == 0)
-        remoteControlPort = port;
+  }
+
+  // Trying to send a PDU before we are set up!
+  if (!remoteAddress.IsValid() || remoteDataPort == 0)
+    return true;
+
+#if RTP_USE_MMSG
+  // Only plain RTP/AVP sessions are attached, others must use their own WriteDataPDU()
+  if (m_reactorAttached) {
+    struct mmsghdr   messages[RelayBatchSize];
+    struct iovec     vectors[RelayBatchSize];
+    sockaddr_storage address;
+    socklen_t addressLength = SetRelayAddress(address, remoteAddress, remoteDataPort);
+
+    PINDEX index = 0;
+    while (index < count) {
+      RTP_DataFrame * batch[RelayBatchSize];
+      PINDEX queued = std::min(count - index, (PINDEX)RelayBatchSize);
+      std::copy(frames+index, frames+index+queued, batch);
+      index += queued;
+
+      if (OnSendRelayData(batch, queued) == e_AbortTransport)
+        return false;
+
+      memset(messages, 0, sizeof(messages));
+      for (PINDEX i = 0; i < queued; ++i) {
+        vectors[i].iov_base = batch[i]->GetPointer();
+        vectors[i].iov_len = batch[i]->GetPacketSize();
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_name = &address;
+        messages[i].msg_hdr.msg_namelen = addressLength;
+      }
+
+      int sent = 0;
+      while (sent < queued) {
+        int result = sendmmsg(dataSocket->GetHandle(), &messages[sent], queued-sent, 0);
+        if (result > 0) {
+          sent += result;
+          continue;
+        }
+
+        switch (errno) {
+          case EINTR :
+            break;
+
+          case EAGAIN :
+          case ECONNRESET :
+          case ECONNREFUSED :
+            // Remote not ready, or socket buffer full, drop the packet as WriteTo() would
+            ++sent;
+            break;
+
+          default :
+            PTRACE(1, "RTP_UDP\tSession " << sessionID << ", relay write error: " << strerror(errno));
+            return false;
+        }
+      }
     }
 
-    if (!remoteTransmitAddress.IsValid())
-      remoteTransmitAddress = addr;
-    else if (allowRemoteTransmitAddressChange && remoteAddress == addr) {
-      remoteTransmitAddress = addr;
-      allowRemoteTransmitAddressChange = false;
+    return true;
+  }
+#endif
+
+  for (PINDEX i = 0; i < count; ++i) {
+    if (!WriteData(*frames[i]))
+      return false;
+  }
+
+  return true;
+}
+
+
+RTP_Session::SendReceiveStatus RTP_UDP::OnSendRelayData(RTP_DataFrame ** frames, PINDEX & count)
+{
+  PINDEX kept = 0;
+  for (PINDEX i = 0; i < count; ++i) {
+    switch (OnSendData(*frames[i])) {
+      case e_ProcessPacket :
+        frames[kept++] = frames[i];
+        break;
+      case e_IgnorePacket :
+        break;
+      case e_AbortTransport :
+        count = kept;
+        return e_AbortTransport;
     }
-    else if (remoteTransmitAddress != addr && !allowRemoteTransmitAddressChange) {
-      PTRACE(2, "RTP_UDP\tSession " << sessionID << ", "
-             << channelName << " PDU from incorrect host, "
-                " is " << addr << " should be " << remoteTransmitAddress);
-      return RTP_Session::e_IgnorePacket;
+  }
+
+  count = kept;
+  return e_ProcessPacket;
+}
+
+
+RTP_Session::SendReceiveStatus RTP_UDP::OnReceiveRelayData(RTP_DataFrame ** frames, PINDEX & count)
+{
+  PINDEX kept = 0;
+  for (PINDEX i = 0; i < count; ++i) {
+    switch (OnReceiveData(*frames[i])) {
+      case e_ProcessPacket :
+        frames[kept++] = frames[i];
+        break;
+      case e_IgnorePacket :
+        break;
+      case e_AbortTransport :
+        count = kept;
+        return e_AbortTransport;
     }
+  }
+
+  count = kept;
+  return e_ProcessPacket;
+}
 
-    if (remoteAddress.IsValid() && !appliedQOS) 
-      ApplyQOS(remoteAddress);
 
-    badTransmitCounter = 0;
+#endif // OPAL_RTP_AGGREGATE
 
-    return RTP_Session::e_ProcessPacket;
+
+RTP_Session::SendReceiveStatus RTP_UDP::CheckReceivedAddress(const PIPSocket::Address & addr,
+                                                             WORD port,
+                                                             PBoolean fromDataChannel)
+{
+#if PTRACING
+  const char * channelName = fromDataChannel ? "Data" : "Control";
+#endif
+
+  // If remote address never set from higher levels, then try and figure
+  // it out from the first packet received.
+  if (!remoteAddress.IsValid()) {
+    remoteAddress = addr;
+    PTRACE(4, "RTP\tSession " << sessionID << ", set remote address from first "
+           << channelName << " PDU from " << addr << ':' << port);
+  }
+  if (fromDataChannel) {
+    if (remoteDataPort == 0)
+      remoteDataPort = port;
   }
+  else {
+    if (remoteControlPort == 0)
+      remoteControlPort = port;
+  }
+
+  if (!remoteTransmitAddress.IsValid())
+    remoteTransmitAddress = addr;
+  else if (allowRemoteTransmitAddressChange && remoteAddress == addr) {
+    remoteTransmitAddress = addr;
+    allowRemoteTransmitAddressChange = false;
+  }
+  else if (remoteTransmitAddress != addr && !allowRemoteTransmitAddressChange) {
+    PTRACE(2, "RTP_UDP\tSession " << sessionID << ", "
+           << channelName << " PDU from incorrect host, "
+              " is " << addr << " should be " << remoteTransmitAddress);
+    return RTP_Session::e_IgnorePacket;
+  }
+
+  if (remoteAddress.IsValid() && !appliedQOS) 
+    ApplyQOS(remoteAddress);
+
+  badTransmitCounter = 0;
+
+  return RTP_Session::e_ProcessPacket;
+}
+
+
+RTP_Session::SendReceiveStatus RTP_UDP::ReadDataOrControlPDU(BYTE * framePtr,
+                                                             PINDEX frameSize,
+                                                             PBoolean fromDataChannel)
+{
+#if PTRACING
+  const char * channelName = fromDataChannel ? "Data" : "Control";
+#endif
+  PUDPSocket & socket = *(fromDataChannel ? dataSocket : controlSocket);
+  PIPSocket::Address addr;
+  WORD port;
+
+  if (socket.ReadFrom(framePtr, frameSize, addr, port))
+    return CheckReceivedAddress(addr, port, fromDataChannel);
 
   switch (socket.GetErrorNumber()) {
     case ECONNRESET :
@@ -2249,7 +3348,7 @@ RTP_Session::SendReceiveStatus RTP_Encoding::OnSendControl(RTP_ControlFrame & fr
 
 bool RTP_Encoding::WriteDataPDU(RTP_DataFrame & frame)
 {
-  return rtpUDP->WriteDataOrControlPDU(frame.GetPointer(), frame.GetSize(), true);
+  return rtpUDP->WriteDataOrControlPDU(frame.GetPointer(), frame.GetPacketSize(), true);
 }
 
 RTP_Session::SendReceiveStatus RTP_Encoding::ReadDataPDU(RTP_DataFrame & frame)
@@ -39,18 +39,9 @@
 
 #include <opal/buildopts.h>
 
-#if OPAL_SRTP
+#if OPAL_SRTP || OPAL_PTLIB_SSL
 
 #include <rtp/srtp.h>
-#include <opal/connection.h>
-#include <h323/h323caps.h>
-#include <h323/h235auth.h>
-
-
-class PNatMethod;
-
-
-// default key = 2687012454
 
 
 ////////////////////////////////////////////////////////////////////
@@ -63,6 +54,21 @@ OpalSRTP_UDP::OpalSRTP_UDP(const Params & params)
 {
 }
 
+#endif // OPAL_SRTP || OPAL_PTLIB_SSL
+
+
+#if OPAL_SRTP
+
+#include <opal/connection.h>
+#include <h323/h323caps.h>
+#include <h323/h235auth.h>
+
+
+class PNatMethod;
+
+
+// default key = 2687012454
+
 
 /////////////////////////////////////////////////////////////////////////////////////
 //
@@ -207,6 +213,13 @@ PBoolean LibSRTPSecurityMode_Base::Open()
 }
 
 
+// The in-tree implementation takes the plain names when it is available
+#if OPAL_PTLIB_SSL
+#define LIBSRTP_FACTORY_PREFIX "LibSRTP|"
+#else
+#define LIBSRTP_FACTORY_PREFIX "SRTP|"
+#endif
+
 #define DECLARE_LIBSRTP_CRYPTO_ALG(name, policy_fn) \
 class LibSRTPSecurityMode_##name : public LibSRTPSecurityMode_Base \
 { \
@@ -220,7 +233,7 @@ class LibSRTPSecurityMode_##name : public LibSRTPSecurityMode_Base \
       Init(); \
     } \
 }; \
-static PFactory<OpalSecurityMode>::Worker<LibSRTPSecurityMode_##name> factoryLibSRTPSecurityMode_##name("SRTP|" #name); \
+static PFactory<OpalSecurityMode>::Worker<LibSRTPSecurityMode_##name> factoryLibSRTPSecurityMode_##name(LIBSRTP_FACTORY_PREFIX #name); \
 
 DECLARE_LIBSRTP_CRYPTO_ALG(AES_CM_128_HMAC_SHA1_80,  crypto_policy_set_aes_cm_128_hmac_sha1_80);
 DECLARE_LIBSRTP_CRYPTO_ALG(AES_CM_128_HMAC_SHA1_32,  crypto_policy_set_aes_cm_128_hmac_sha1_32);
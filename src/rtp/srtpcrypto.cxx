@@ -0,0 +1,1238 @@
+/*
+ * srtpcrypto.cxx
+ *
+ * SRTP and SRTCP packet protection using OpenSSL
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#pragma implementation "srtpcrypto.h"
+#endif
+
+#include <opal/buildopts.h>
+
+#if OPAL_PTLIB_SSL
+
+// The HMAC pads are hashed once using the SHA1 block functions
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include <rtp/srtpcrypto.h>
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+
+#ifdef _MSC_VER
+#pragma comment(lib, P_SSL_LIB1)
+#pragma comment(lib, P_SSL_LIB2)
+#endif
+
+
+#define new PNEW
+
+
+namespace PWLibStupidLinkerHacks {
+  int nativeSRTPLoader;
+};
+
+
+// Key derivation labels, RFC 3711 section 4.3.1
+enum {
+  LabelRTPEncryption,
+  LabelRTPAuthentication,
+  LabelRTPSalt,
+  LabelRTCPEncryption,
+  LabelRTCPAuthentication,
+  LabelRTCPSalt
+};
+
+#define AES_BLOCK         16
+#define CM_SALT_LENGTH    14
+#define GCM_IV_LENGTH     12
+#define SHA1_LENGTH       20
+#define SHA1_BLOCK        64
+#define SRTCP_E_BIT       0x80000000
+#define SRTCP_INDEX_MASK  0x7fffffff
+
+
+static const OpalSRTPCryptoSuite CryptoSuites[] = {
+  // name                        cipher                           key salt auth rtp rtcp
+  { "AES_CM_128_HMAC_SHA1_80",  OpalSRTPCryptoSuite::e_AES_CM,     16, 14, 20, 10, 10 },
+  { "AES_CM_128_HMAC_SHA1_32",  OpalSRTPCryptoSuite::e_AES_CM,     16, 14, 20,  4, 10 },
+  { "AES_CM_128_NULL_AUTH",     OpalSRTPCryptoSuite::e_AES_CM,     16, 14,  0,  0,  0 },
+  { "NULL_CIPHER_HMAC_SHA1_80", OpalSRTPCryptoSuite::e_NullCipher, 16, 14, 20, 10, 10 },
+  { "STRONGHOLD",               OpalSRTPCryptoSuite::e_AES_CM,     16, 14, 20, 10, 10 },
+  { "AEAD_AES_128_GCM",         OpalSRTPCryptoSuite::e_AES_GCM,    16, 12,  0, 16, 16 },
+  { "AEAD_AES_256_GCM",         OpalSRTPCryptoSuite::e_AES_GCM,    32, 12,  0, 16, 16 },
+  { NULL,                       OpalSRTPCryptoSuite::e_NullCipher,  0,  0,  0,  0,  0 }
+};
+
+
+const OpalSRTPCryptoSuite * OpalSRTPCryptoSuite::GetSuites()
+{
+  return CryptoSuites;
+}
+
+
+const OpalSRTPCryptoSuite * OpalSRTPCryptoSuite::Find(const PString & name)
+{
+  for (const OpalSRTPCryptoSuite * suite = CryptoSuites; suite->m_name != NULL; ++suite) {
+    if (name == suite->m_name)
+      return suite;
+  }
+  return NULL;
+}
+
+
+static const EVP_CIPHER * GetECBCipher(PINDEX keyLength)
+{
+  return keyLength == 32 ? EVP_aes_256_ecb() : EVP_aes_128_ecb();
+}
+
+
+static const EVP_CIPHER * GetGCMCipher(PINDEX keyLength)
+{
+  return keyLength == 32 ? EVP_aes_256_gcm() : EVP_aes_128_gcm();
+}
+
+
+static inline DWORD GetBigEndian32(const BYTE * ptr)
+{
+  return ((DWORD)ptr[0] << 24) | ((DWORD)ptr[1] << 16) | ((DWORD)ptr[2] << 8) | ptr[3];
+}
+
+
+static inline void SetBigEndian32(BYTE * ptr, DWORD value)
+{
+  ptr[0] = (BYTE)(value >> 24);
+  ptr[1] = (BYTE)(value >> 16);
+  ptr[2] = (BYTE)(value >> 8);
+  ptr[3] = (BYTE)value;
+}
+
+
+static PINDEX GetRTPHeaderSize(const BYTE * packet, PINDEX length)
+{
+  if (length < RTP_DataFrame::MinHeaderSize || (packet[0]&0xc0) != 0x80)
+    return 0;
+
+  PINDEX size = RTP_DataFrame::MinHeaderSize + 4*(packet[0]&0x0f);
+  if ((packet[0]&0x10) != 0) {
+    if (size+4 > length)
+      return 0;
+    size += 4 + 4*((packet[size+2] << 8) | packet[size+3]);
+  }
+
+  return size <= length ? size : 0;
+}
+
+
+static inline void XorKeyStream(BYTE * data, const BYTE * keyStream, PINDEX length)
+{
+  // A word at a time, memcpy keeps it safe for unaligned payloads
+  PINDEX i = 0;
+  for (; i + 8 <= length; i += 8) {
+    PUInt64 d, k;
+    memcpy(&d, data+i, 8);
+    memcpy(&k, keyStream+i, 8);
+    d ^= k;
+    memcpy(data+i, &d, 8);
+  }
+  for (; i < length; ++i)
+    data[i] ^= keyStream[i];
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**Session keys for SRTP or SRTCP. The cipher is AES in ECB mode keyed with
+   the session key, for making the counter mode keystream, or AES-GCM.
+  */
+struct OpalSRTPContext::SessionKeys
+{
+  SessionKeys()
+    : m_cipher(EVP_CIPHER_CTX_new())
+  {
+    memset(m_salt, 0, sizeof(m_salt));
+  }
+
+  ~SessionKeys()
+  {
+    EVP_CIPHER_CTX_free(m_cipher);
+    OPENSSL_cleanse(m_salt, sizeof(m_salt));
+    OPENSSL_cleanse(&m_inner, sizeof(m_inner));
+    OPENSSL_cleanse(&m_outer, sizeof(m_outer));
+  }
+
+  bool Derive(const OpalSRTPCryptoSuite & suite, const BYTE * masterKey, const BYTE * masterSalt, BYTE firstLabel)
+  {
+    BYTE key[32];
+    if (!OpalSRTPContext::DeriveSessionKey(suite, masterKey, masterSalt, firstLabel, key, suite.m_keyLength) ||
+        !OpalSRTPContext::DeriveSessionKey(suite, masterKey, masterSalt, firstLabel+2, m_salt, suite.m_saltLength))
+      return false;
+
+    bool ok;
+    if (suite.m_cipher == OpalSRTPCryptoSuite::e_AES_GCM)
+      ok = EVP_CipherInit_ex(m_cipher, GetGCMCipher(suite.m_keyLength), NULL, key, NULL, 1) > 0;
+    else
+      ok = EVP_EncryptInit_ex(m_cipher, GetECBCipher(suite.m_keyLength), NULL, key, NULL) > 0 &&
+           EVP_CIPHER_CTX_set_padding(m_cipher, 0) > 0;
+    OPENSSL_cleanse(key, sizeof(key));
+    if (!ok)
+      return false;
+
+    if (suite.m_authKeyLength == 0)
+      return true;
+
+    BYTE authKey[SHA1_BLOCK];
+    memset(authKey, 0, sizeof(authKey));
+    if (!OpalSRTPContext::DeriveSessionKey(suite, masterKey, masterSalt, firstLabel+1, authKey, suite.m_authKeyLength))
+      return false;
+
+    // The key is shorter than a block so the pads are the key and padding
+    BYTE pad[SHA1_BLOCK];
+    for (PINDEX i = 0; i < SHA1_BLOCK; ++i)
+      pad[i] = authKey[i] ^ 0x36;
+    SHA1_Init(&m_inner);
+    SHA1_Update(&m_inner, pad, SHA1_BLOCK);
+    for (PINDEX i = 0; i < SHA1_BLOCK; ++i)
+      pad[i] = authKey[i] ^ 0x5c;
+    SHA1_Init(&m_outer);
+    SHA1_Update(&m_outer, pad, SHA1_BLOCK);
+
+    OPENSSL_cleanse(authKey, sizeof(authKey));
+    OPENSSL_cleanse(pad, sizeof(pad));
+    return true;
+  }
+
+  // HMAC-SHA1 of the data, with the rollover counter appended for SRTP
+  void Authenticate(const BYTE * data, PINDEX length, const BYTE * roc, BYTE * tag, PINDEX tagLength) const
+  {
+    BYTE digest[SHA1_LENGTH];
+    SHA_CTX ctx = m_inner;
+    SHA1_Update(&ctx, data, length);
+    if (roc != NULL)
+      SHA1_Update(&ctx, roc, 4);
+    SHA1_Final(digest, &ctx);
+
+    ctx = m_outer;
+    SHA1_Update(&ctx, digest, SHA1_LENGTH);
+    SHA1_Final(digest, &ctx);
+    memcpy(tag, digest, tagLength);
+  }
+
+  // The AES-CM counter blocks for a packet, RFC 3711 section 4.1.1
+  void SetCounters(BYTE * blocks, PINDEX count, DWORD ssrc, PUInt64 index) const
+  {
+    memcpy(blocks, m_salt, CM_SALT_LENGTH);
+    blocks[4]  ^= (BYTE)(ssrc >> 24);
+    blocks[5]  ^= (BYTE)(ssrc >> 16);
+    blocks[6]  ^= (BYTE)(ssrc >> 8);
+    blocks[7]  ^= (BYTE)ssrc;
+    blocks[8]  ^= (BYTE)(index >> 40);
+    blocks[9]  ^= (BYTE)(index >> 32);
+    blocks[10] ^= (BYTE)(index >> 24);
+    blocks[11] ^= (BYTE)(index >> 16);
+    blocks[12] ^= (BYTE)(index >> 8);
+    blocks[13] ^= (BYTE)index;
+    blocks[14] = blocks[15] = 0;
+
+    for (PINDEX i = 1; i < count; ++i) {
+      BYTE * block = blocks + i*AES_BLOCK;
+      memcpy(block, blocks, AES_BLOCK-2);
+      block[14] = (BYTE)(i >> 8);
+      block[15] = (BYTE)i;
+    }
+  }
+
+  // The AES-GCM IV, RFC 7714 sections 8.1 and 9.1
+  void SetIV(BYTE * iv, DWORD ssrc, DWORD high, DWORD low) const
+  {
+    iv[0] = m_salt[0];
+    iv[1] = m_salt[1];
+    SetBigEndian32(iv+2, ssrc);
+    iv[6] = (BYTE)(high >> 8);
+    iv[7] = (BYTE)high;
+    SetBigEndian32(iv+8, low);
+    for (PINDEX i = 2; i < GCM_IV_LENGTH; ++i)
+      iv[i] ^= m_salt[i];
+  }
+
+  // AES-GCM over one packet, the tag is written or checked at tag
+  bool Seal(bool encrypt, const BYTE * iv,
+            const BYTE * aad, PINDEX aadLength,
+            const BYTE * aad2, PINDEX aad2Length,
+            BYTE * data, PINDEX length, BYTE * tag, PINDEX tagLength)
+  {
+    int outLength;
+    if (EVP_CipherInit_ex(m_cipher, NULL, NULL, NULL, iv, encrypt ? 1 : 0) <= 0 ||
+        EVP_CipherUpdate(m_cipher, NULL, &outLength, aad, aadLength) <= 0 ||
+        (aad2Length > 0 && EVP_CipherUpdate(m_cipher, NULL, &outLength, aad2, aad2Length) <= 0) ||
+        (length > 0 && EVP_CipherUpdate(m_cipher, data, &outLength, data, length) <= 0))
+      return false;
+
+    if (encrypt)
+      return EVP_CipherFinal_ex(m_cipher, data+length, &outLength) > 0 &&
+             EVP_CIPHER_CTX_ctrl(m_cipher, EVP_CTRL_GCM_GET_TAG, tagLength, tag) > 0;
+
+    return EVP_CIPHER_CTX_ctrl(m_cipher, EVP_CTRL_GCM_SET_TAG, tagLength, tag) > 0 &&
+           EVP_CipherFinal_ex(m_cipher, data+length, &outLength) > 0;
+  }
+
+  EVP_CIPHER_CTX * m_cipher;
+  BYTE             m_salt[CM_SALT_LENGTH];
+  SHA_CTX          m_inner;
+  SHA_CTX          m_outer;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+OpalSRTPContext::Statistics::Statistics()
+  : m_packets(0)
+  , m_octets(0)
+  , m_streams(0)
+  , m_authFailures(0)
+  , m_replays(0)
+  , m_malformed(0)
+{
+}
+
+
+bool OpalSRTPContext::ReplayWindow::IsReplay(PUInt64 index) const
+{
+  if (!m_started || index > m_highest)
+    return false;
+
+  PUInt64 delta = m_highest - index;
+  if (delta >= ReplayWindowSize)
+    return true;
+
+  return (m_bits[delta/64] & ((PUInt64)1 << (delta%64))) != 0;
+}
+
+
+void OpalSRTPContext::ReplayWindow::Update(PUInt64 index)
+{
+  if (!m_started) {
+    m_started = true;
+    m_highest = index;
+    m_bits[0] = 1;
+    m_bits[1] = 0;
+    return;
+  }
+
+  if (index <= m_highest) {
+    PUInt64 delta = m_highest - index;
+    if (delta < ReplayWindowSize)
+      m_bits[delta/64] |= (PUInt64)1 << (delta%64);
+    return;
+  }
+
+  PUInt64 shift = index - m_highest;
+  if (shift >= 128)
+    m_bits[0] = m_bits[1] = 0;
+  else if (shift >= 64) {
+    m_bits[1] = m_bits[0] << (shift-64);
+    m_bits[0] = 0;
+  }
+  else {
+    m_bits[1] = (m_bits[1] << shift) | (m_bits[0] >> (64-shift));
+    m_bits[0] <<= shift;
+  }
+
+  m_bits[0] |= 1;
+  m_highest = index;
+}
+
+
+// Guess the rollover counter for a sequence number, RFC 3711 Appendix A
+static PInt64 EstimateIndex(bool started, PUInt64 highest, WORD seq)
+{
+  if (!started)
+    return seq;
+
+  PInt64 roc = (PInt64)(highest >> 16);
+  int lastSeq = (int)(highest & 0xffff);
+  if (lastSeq < 0x8000) {
+    if ((int)seq - lastSeq > 0x8000)
+      --roc;
+  }
+  else {
+    if (lastSeq - 0x8000 > (int)seq)
+      ++roc;
+  }
+
+  return roc*65536 + seq;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+OpalSRTPContext::OpalSRTPContext(const OpalSRTPCryptoSuite & suite)
+  : m_suite(suite)
+  , m_rtp(NULL)
+  , m_rtcp(NULL)
+  , m_lastSSRC(0)
+  , m_lastStream(NULL)
+{
+}
+
+
+OpalSRTPContext::~OpalSRTPContext()
+{
+  delete m_rtp;
+  delete m_rtcp;
+}
+
+
+bool OpalSRTPContext::DeriveSessionKey(const OpalSRTPCryptoSuite & suite,
+                                       const BYTE * masterKey,
+                                       const BYTE * masterSalt,
+                                       BYTE label,
+                                       BYTE * sessionKey,
+                                       PINDEX length)
+{
+  BYTE blocks[64];
+  PINDEX count = (length + AES_BLOCK - 1)/AES_BLOCK;
+  if (length <= 0 || count*AES_BLOCK > (PINDEX)sizeof(blocks))
+    return false;
+
+  // The AES-CM PRF, the 96 bit GCM salt is padded to the 112 bits of AES-CM
+  for (PINDEX i = 0; i < count; ++i) {
+    BYTE * block = blocks + i*AES_BLOCK;
+    memset(block, 0, AES_BLOCK);
+    memcpy(block, masterSalt, std::min(suite.m_saltLength, (PINDEX)CM_SALT_LENGTH));
+    block[7] ^= label;
+    block[15] = (BYTE)i;
+  }
+
+  EVP_CIPHER_CTX * ctx = EVP_CIPHER_CTX_new();
+  int outLength;
+  bool ok = ctx != NULL &&
+            EVP_EncryptInit_ex(ctx, GetECBCipher(suite.m_keyLength), NULL, masterKey, NULL) > 0 &&
+            EVP_CIPHER_CTX_set_padding(ctx, 0) > 0 &&
+            EVP_EncryptUpdate(ctx, blocks, &outLength, blocks, count*AES_BLOCK) > 0;
+  EVP_CIPHER_CTX_free(ctx);
+
+  if (ok)
+    memcpy(sessionKey, blocks, length);
+  OPENSSL_cleanse(blocks, sizeof(blocks));
+  return ok;
+}
+
+
+bool OpalSRTPContext::SetMasterKey(const BYTE * key, const BYTE * salt)
+{
+  SessionKeys * rtp = new SessionKeys;
+  SessionKeys * rtcp = new SessionKeys;
+  if (!rtp->Derive(m_suite, key, salt, LabelRTPEncryption) ||
+      !rtcp->Derive(m_suite, key, salt, LabelRTCPEncryption)) {
+    PTRACE(1, "SRTP\tCould not derive session keys for " << m_suite.m_name);
+    delete rtp;
+    delete rtcp;
+    return false;
+  }
+
+  PWaitAndSignal mutex(m_mutex);
+
+  delete m_rtp;
+  delete m_rtcp;
+  m_rtp = rtp;
+  m_rtcp = rtcp;
+
+  m_streams.clear();
+  m_lastStream = NULL;
+  m_statistics.m_streams = 0;
+
+  PTRACE(4, "SRTP\tKeyed " << m_suite.m_name);
+  return true;
+}
+
+
+OpalSRTPContext::Stream * OpalSRTPContext::FindStream(DWORD ssrc)
+{
+  if (m_lastStream != NULL && m_lastSSRC == ssrc)
+    return m_lastStream;
+
+  StreamMap::iterator it = m_streams.find(ssrc);
+  if (it == m_streams.end())
+    return NULL;
+
+  m_lastSSRC = ssrc;
+  m_lastStream = &it->second;
+  return m_lastStream;
+}
+
+
+OpalSRTPContext::Stream & OpalSRTPContext::GetStream(DWORD ssrc)
+{
+  Stream * stream = FindStream(ssrc);
+  if (stream != NULL)
+    return *stream;
+
+  // Map nodes do not move, so the cached pointer stays valid
+  m_lastSSRC = ssrc;
+  m_lastStream = &m_streams[ssrc];
+  m_statistics.m_streams = (unsigned)m_streams.size();
+  return *m_lastStream;
+}
+
+
+BYTE * OpalSRTPContext::GetKeyStream(PINDEX blocks)
+{
+  PINDEX size = blocks*AES_BLOCK;
+  if ((PINDEX)m_keyStream.size() < size)
+    m_keyStream.resize(size);
+  return &m_keyStream[0];
+}
+
+
+void OpalSRTPContext::ProtectBatch(Packet * packets, PINDEX count)
+{
+  PINDEX headers[MaxBatchSize];
+  PINDEX blocks[MaxBatchSize];
+  PINDEX totalBlocks = 0;
+
+  // First pass assigns the indexes, and for AES-CM the counter blocks
+  BYTE rocs[MaxBatchSize][4];
+  for (PINDEX i = 0; i < count; ++i) {
+    Packet & packet = packets[i];
+    packet.m_ok = false;
+    headers[i] = GetRTPHeaderSize(packet.m_data, packet.m_length);
+    if (headers[i] == 0) {
+      ++m_statistics.m_malformed;
+      continue;
+    }
+
+    DWORD ssrc = GetBigEndian32(packet.m_data+8);
+    WORD seq = (WORD)((packet.m_data[2] << 8) | packet.m_data[3]);
+    ReplayWindow & window = GetStream(ssrc).m_rtp;
+    PInt64 index = EstimateIndex(window.m_started, window.m_highest, seq);
+    if (index < 0) {
+      // Sequence number from before the first one sent, cannot be encrypted
+      ++m_statistics.m_malformed;
+      continue;
+    }
+    window.Update(index);
+    SetBigEndian32(rocs[i], (DWORD)(index >> 16));
+    packet.m_ok = true;
+
+    PINDEX payloadLength = packet.m_length - headers[i];
+    if (m_suite.m_cipher == OpalSRTPCryptoSuite::e_AES_GCM) {
+      BYTE iv[GCM_IV_LENGTH];
+      m_rtp->SetIV(iv, ssrc, (DWORD)(index >> 32), (DWORD)index);
+      if (!m_rtp->Seal(true, iv, packet.m_data, headers[i], NULL, 0,
+                       packet.m_data+headers[i], payloadLength,
+                       packet.m_data+packet.m_length, m_suite.m_rtpTagLength))
+        packet.m_ok = false;
+      blocks[i] = 0;
+      continue;
+    }
+
+    blocks[i] = m_suite.m_cipher == OpalSRTPCryptoSuite::e_AES_CM ? (payloadLength + AES_BLOCK - 1)/AES_BLOCK : 0;
+    if (blocks[i] > 0) {
+      BYTE * counter = GetKeyStream(totalBlocks + blocks[i]) + totalBlocks*AES_BLOCK;
+      m_rtp->SetCounters(counter, blocks[i], ssrc, index);
+      totalBlocks += blocks[i];
+    }
+  }
+
+  if (m_suite.m_cipher == OpalSRTPCryptoSuite::e_AES_GCM) {
+    for (PINDEX i = 0; i < count; ++i) {
+      if (packets[i].m_ok) {
+        ++m_statistics.m_packets;
+        m_statistics.m_octets += packets[i].m_length;
+        packets[i].m_length += m_suite.m_rtpTagLength;
+      }
+    }
+    return;
+  }
+
+  // The keystream for every packet, in one go
+  const BYTE * keyStream = NULL;
+  if (totalBlocks > 0) {
+    int outLength;
+    BYTE * counters = GetKeyStream(totalBlocks);
+    if (EVP_EncryptUpdate(m_rtp->m_cipher, counters, &outLength, counters, totalBlocks*AES_BLOCK) <= 0) {
+      PTRACE(1, "SRTP\tKeystream generation failed");
+      for (PINDEX i = 0; i < count; ++i)
+        packets[i].m_ok = false;
+      return;
+    }
+    keyStream = counters;
+  }
+
+  for (PINDEX i = 0; i < count; ++i) {
+    Packet & packet = packets[i];
+    if (!packet.m_ok)
+      continue;
+
+    if (blocks[i] > 0) {
+      XorKeyStream(packet.m_data+headers[i], keyStream, packet.m_length - headers[i]);
+      keyStream += blocks[i]*AES_BLOCK;
+    }
+
+    ++m_statistics.m_packets;
+    m_statistics.m_octets += packet.m_length;
+
+    if (m_suite.m_rtpTagLength > 0) {
+      m_rtp->Authenticate(packet.m_data, packet.m_length, rocs[i], packet.m_data+packet.m_length, m_suite.m_rtpTagLength);
+      packet.m_length += m_suite.m_rtpTagLength;
+    }
+  }
+}
+
+
+void OpalSRTPContext::UnprotectBatch(Packet * packets, PINDEX count)
+{
+  PINDEX headers[MaxBatchSize];
+  PINDEX blocks[MaxBatchSize];
+  PUInt64 indexes[MaxBatchSize];
+  PINDEX totalBlocks = 0;
+
+  // Authenticate first, only the authentic are decrypted
+  for (PINDEX i = 0; i < count; ++i) {
+    Packet & packet = packets[i];
+    packet.m_ok = false;
+    headers[i] = GetRTPHeaderSize(packet.m_data, packet.m_length);
+    if (headers[i] == 0 || packet.m_length < headers[i] + m_suite.m_rtpTagLength) {
+      ++m_statistics.m_malformed;
+      continue;
+    }
+
+    DWORD ssrc = GetBigEndian32(packet.m_data+8);
+    WORD seq = (WORD)((packet.m_data[2] << 8) | packet.m_data[3]);
+
+    // No stream state for an SSRC until one of its packets is authentic
+    Stream * stream = FindStream(ssrc);
+    PInt64 index = stream != NULL ? EstimateIndex(stream->m_rtp.m_started, stream->m_rtp.m_highest, seq) : seq;
+    if (index < 0 || (stream != NULL && stream->m_rtp.IsReplay(index))) {
+      ++m_statistics.m_replays;
+      continue;
+    }
+    indexes[i] = index;
+
+    PINDEX length = packet.m_length - m_suite.m_rtpTagLength;
+    PINDEX payloadLength = length - headers[i];
+    BYTE * tag = packet.m_data + length;
+
+    if (m_suite.m_cipher == OpalSRTPCryptoSuite::e_AES_GCM) {
+      BYTE iv[GCM_IV_LENGTH];
+      m_rtp->SetIV(iv, ssrc, (DWORD)(index >> 32), (DWORD)index);
+      if (!m_rtp->Seal(false, iv, packet.m_data, headers[i], NULL, 0,
+                       packet.m_data+headers[i], payloadLength, tag, m_suite.m_rtpTagLength)) {
+        ++m_statistics.m_authFailures;
+        continue;
+      }
+      blocks[i] = 0;
+    }
+    else {
+      if (m_suite.m_rtpTagLength > 0) {
+        BYTE roc[4], expected[SHA1_LENGTH];
+        SetBigEndian32(roc, (DWORD)(index >> 16));
+        m_rtp->Authenticate(packet.m_data, length, roc, expected, m_suite.m_rtpTagLength);
+        if (CRYPTO_memcmp(expected, tag, m_suite.m_rtpTagLength) != 0) {
+          ++m_statistics.m_authFailures;
+          continue;
+        }
+      }
+
+      blocks[i] = m_suite.m_cipher == OpalSRTPCryptoSuite::e_AES_CM ? (payloadLength + AES_BLOCK - 1)/AES_BLOCK : 0;
+      if (blocks[i] > 0) {
+        BYTE * counter = GetKeyStream(totalBlocks + blocks[i]) + totalBlocks*AES_BLOCK;
+        m_rtp->SetCounters(counter, blocks[i], ssrc, index);
+        totalBlocks += blocks[i];
+      }
+    }
+
+    packet.m_length = length;
+    packet.m_ok = true;
+  }
+
+  const BYTE * keyStream = NULL;
+  if (totalBlocks > 0) {
+    int outLength;
+    BYTE * counters = GetKeyStream(totalBlocks);
+    if (EVP_EncryptUpdate(m_rtp->m_cipher, counters, &outLength, counters, totalBlocks*AES_BLOCK) <= 0) {
+      PTRACE(1, "SRTP\tKeystream generation failed");
+      for (PINDEX i = 0; i < count; ++i)
+        packets[i].m_ok = false;
+      return;
+    }
+    keyStream = counters;
+  }
+
+  for (PINDEX i = 0; i < count; ++i) {
+    Packet & packet = packets[i];
+    if (!packet.m_ok)
+      continue;
+
+    if (blocks[i] > 0) {
+      XorKeyStream(packet.m_data+headers[i], keyStream, packet.m_length - headers[i]);
+      keyStream += blocks[i]*AES_BLOCK;
+    }
+
+    // Checked again as the same packet may be in the batch twice
+    ReplayWindow & window = GetStream(GetBigEndian32(packet.m_data+8)).m_rtp;
+    if (window.IsReplay(indexes[i])) {
+      ++m_statistics.m_replays;
+      packet.m_ok = false;
+      continue;
+    }
+    window.Update(indexes[i]);
+
+    ++m_statistics.m_packets;
+    m_statistics.m_octets += packet.m_length + m_suite.m_rtpTagLength;
+  }
+}
+
+
+bool OpalSRTPContext::ProtectRTP(BYTE * packet, PINDEX & length)
+{
+  Packet batch = { packet, length, false };
+  if (ProtectRTP(&batch, 1) == 0)
+    return false;
+
+  length = batch.m_length;
+  return true;
+}
+
+
+bool OpalSRTPContext::UnprotectRTP(BYTE * packet, PINDEX & length)
+{
+  Packet batch = { packet, length, false };
+  if (UnprotectRTP(&batch, 1) == 0)
+    return false;
+
+  length = batch.m_length;
+  return true;
+}
+
+
+PINDEX OpalSRTPContext::ProtectRTP(Packet * packets, PINDEX count)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  if (m_rtp == NULL) {
+    for (PINDEX i = 0; i < count; ++i)
+      packets[i].m_ok = false;
+    return 0;
+  }
+
+  PINDEX protectedCount = 0;
+  for (PINDEX offset = 0; offset < count; offset += MaxBatchSize) {
+    PINDEX batchSize = std::min(count - offset, (PINDEX)MaxBatchSize);
+    ProtectBatch(packets+offset, batchSize);
+    for (PINDEX i = 0; i < batchSize; ++i) {
+      if (packets[offset+i].m_ok)
+        ++protectedCount;
+    }
+  }
+
+  return protectedCount;
+}
+
+
+PINDEX OpalSRTPContext::UnprotectRTP(Packet * packets, PINDEX count)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  if (m_rtp == NULL) {
+    for (PINDEX i = 0; i < count; ++i)
+      packets[i].m_ok = false;
+    return 0;
+  }
+
+  PINDEX unprotectedCount = 0;
+  for (PINDEX offset = 0; offset < count; offset += MaxBatchSize) {
+    PINDEX batchSize = std::min(count - offset, (PINDEX)MaxBatchSize);
+    UnprotectBatch(packets+offset, batchSize);
+    for (PINDEX i = 0; i < batchSize; ++i) {
+      if (packets[offset+i].m_ok)
+        ++unprotectedCount;
+    }
+  }
+
+  return unprotectedCount;
+}
+
+
+bool OpalSRTPContext::ProtectRTCP(BYTE * packet, PINDEX & length)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  if (m_rtcp == NULL)
+    return false;
+
+  if (length < 8 || (packet[0]&0xc0) != 0x80) {
+    ++m_statistics.m_malformed;
+    return false;
+  }
+
+  DWORD ssrc = GetBigEndian32(packet+4);
+  Stream & stream = GetStream(ssrc);
+  DWORD index = stream.m_rtcpIndex;
+  stream.m_rtcpIndex = (index + 1) & SRTCP_INDEX_MASK;
+
+  BYTE eIndex[4];
+  SetBigEndian32(eIndex, m_suite.m_cipher != OpalSRTPCryptoSuite::e_NullCipher ? (index | SRTCP_E_BIT) : index);
+
+  if (m_suite.m_cipher == OpalSRTPCryptoSuite::e_AES_GCM) {
+    // Header, ciphertext, tag, E flag and index, RFC 7714 section 9
+    BYTE iv[GCM_IV_LENGTH];
+    m_rtcp->SetIV(iv, ssrc, 0, index);
+    if (!m_rtcp->Seal(true, iv, packet, 8, eIndex, 4, packet+8, length-8, packet+length, m_suite.m_rtcpTagLength))
+      return false;
+    ++m_statistics.m_packets;
+    m_statistics.m_octets += length;
+    length += m_suite.m_rtcpTagLength;
+    memcpy(packet+length, eIndex, 4);
+    length += 4;
+    return true;
+  }
+
+  // Header, ciphertext, E flag and index, tag, RFC 3711 section 3.4
+  if (m_suite.m_cipher == OpalSRTPCryptoSuite::e_AES_CM && length > 8) {
+    PINDEX blocks = (length - 8 + AES_BLOCK - 1)/AES_BLOCK;
+    BYTE * keyStream = GetKeyStream(blocks);
+    m_rtcp->SetCounters(keyStream, blocks, ssrc, index);
+    int outLength;
+    if (EVP_EncryptUpdate(m_rtcp->m_cipher, keyStream, &outLength, keyStream, blocks*AES_BLOCK) <= 0)
+      return false;
+    XorKeyStream(packet+8, keyStream, length-8);
+  }
+
+  ++m_statistics.m_packets;
+  m_statistics.m_octets += length;
+
+  memcpy(packet+length, eIndex, 4);
+  length += 4;
+
+  if (m_suite.m_rtcpTagLength > 0) {
+    m_rtcp->Authenticate(packet, length, NULL, packet+length, m_suite.m_rtcpTagLength);
+    length += m_suite.m_rtcpTagLength;
+  }
+
+  return true;
+}
+
+
+bool OpalSRTPContext::UnprotectRTCP(BYTE * packet, PINDEX & length)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  if (m_rtcp == NULL)
+    return false;
+
+  PINDEX tagLength = m_suite.m_rtcpTagLength;
+  if (length < 8 + 4 + tagLength || (packet[0]&0xc0) != 0x80) {
+    ++m_statistics.m_malformed;
+    return false;
+  }
+
+  DWORD ssrc = GetBigEndian32(packet+4);
+  Stream * stream = FindStream(ssrc);
+
+  PINDEX payloadLength;
+  DWORD eIndex;
+  if (m_suite.m_cipher == OpalSRTPCryptoSuite::e_AES_GCM) {
+    payloadLength = length - 8 - tagLength - 4;
+    eIndex = GetBigEndian32(packet+length-4);
+  }
+  else {
+    payloadLength = length - 8 - 4 - tagLength;
+    eIndex = GetBigEndian32(packet+length-tagLength-4);
+  }
+
+  DWORD index = eIndex & SRTCP_INDEX_MASK;
+  if (stream != NULL && stream->m_rtcp.IsReplay(index)) {
+    ++m_statistics.m_replays;
+    return false;
+  }
+
+  bool encrypted = (eIndex & SRTCP_E_BIT) != 0;
+
+  if (m_suite.m_cipher == OpalSRTPCryptoSuite::e_AES_GCM) {
+    BYTE iv[GCM_IV_LENGTH];
+    m_rtcp->SetIV(iv, ssrc, 0, index);
+
+    // Unencrypted packets are all additional authenticated data
+    bool ok;
+    if (encrypted)
+      ok = m_rtcp->Seal(false, iv, packet, 8, packet+length-4, 4, packet+8, payloadLength, packet+8+payloadLength, tagLength);
+    else
+      ok = m_rtcp->Seal(false, iv, packet, 8+payloadLength, packet+length-4, 4, NULL, 0, packet+8+payloadLength, tagLength);
+    if (!ok) {
+      ++m_statistics.m_authFailures;
+      return false;
+    }
+  }
+  else {
+    if (tagLength > 0) {
+      BYTE expected[SHA1_LENGTH];
+      m_rtcp->Authenticate(packet, length-tagLength, NULL, expected, tagLength);
+      if (CRYPTO_memcmp(expected, packet+length-tagLength, tagLength) != 0) {
+        ++m_statistics.m_authFailures;
+        return false;
+      }
+    }
+
+    if (encrypted && m_suite.m_cipher == OpalSRTPCryptoSuite::e_AES_CM && payloadLength > 0) {
+      PINDEX blocks = (payloadLength + AES_BLOCK - 1)/AES_BLOCK;
+      BYTE * keyStream = GetKeyStream(blocks);
+      m_rtcp->SetCounters(keyStream, blocks, ssrc, index);
+      int outLength;
+      if (EVP_EncryptUpdate(m_rtcp->m_cipher, keyStream, &outLength, keyStream, blocks*AES_BLOCK) <= 0)
+        return false;
+      XorKeyStream(packet+8, keyStream, payloadLength);
+    }
+  }
+
+  GetStream(ssrc).m_rtcp.Update(index);
+
+  ++m_statistics.m_packets;
+  m_statistics.m_octets += length;
+
+  length = 8 + payloadLength;
+  return true;
+}
+
+
+bool OpalSRTPContext::ProtectRTP(RTP_DataFrame & frame)
+{
+  PINDEX length = frame.GetPacketSize();
+  frame.SetMinSize(length + GetRTPTrailerSize());
+  if (!ProtectRTP(frame.GetPointer(), length))
+    return false;
+
+  frame.SetPayloadSize(length - frame.GetHeaderSize());
+  return true;
+}
+
+
+bool OpalSRTPContext::UnprotectRTP(RTP_DataFrame & frame)
+{
+  PINDEX length = frame.GetPacketSize();
+  if (!UnprotectRTP(frame.GetPointer(), length))
+    return false;
+
+  frame.SetPayloadSize(length - frame.GetHeaderSize());
+  return true;
+}
+
+
+PINDEX OpalSRTPContext::ProtectRTP(RTP_DataFrame ** frames, PINDEX count)
+{
+  PINDEX kept = 0;
+  for (PINDEX offset = 0; offset < count; offset += MaxBatchSize) {
+    PINDEX batchSize = std::min(count - offset, (PINDEX)MaxBatchSize);
+
+    Packet packets[MaxBatchSize];
+    for (PINDEX i = 0; i < batchSize; ++i) {
+      RTP_DataFrame & frame = *frames[offset+i];
+      packets[i].m_length = frame.GetPacketSize();
+      frame.SetMinSize(packets[i].m_length + GetRTPTrailerSize());
+      packets[i].m_data = frame.GetPointer();
+    }
+
+    ProtectRTP(packets, batchSize);
+
+    for (PINDEX i = 0; i < batchSize; ++i) {
+      if (packets[i].m_ok) {
+        RTP_DataFrame * frame = frames[offset+i];
+        frame->SetPayloadSize(packets[i].m_length - frame->GetHeaderSize());
+        frames[kept++] = frame;
+      }
+    }
+  }
+
+  return kept;
+}
+
+
+PINDEX OpalSRTPContext::UnprotectRTP(RTP_DataFrame ** frames, PINDEX count)
+{
+  PINDEX kept = 0;
+  for (PINDEX offset = 0; offset < count; offset += MaxBatchSize) {
+    PINDEX batchSize = std::min(count - offset, (PINDEX)MaxBatchSize);
+
+    Packet packets[MaxBatchSize];
+    for (PINDEX i = 0; i < batchSize; ++i) {
+      RTP_DataFrame & frame = *frames[offset+i];
+      packets[i].m_length = frame.GetPacketSize();
+      packets[i].m_data = frame.GetPointer();
+    }
+
+    UnprotectRTP(packets, batchSize);
+
+    for (PINDEX i = 0; i < batchSize; ++i) {
+      if (packets[i].m_ok) {
+        RTP_DataFrame * frame = frames[offset+i];
+        frame->SetPayloadSize(packets[i].m_length - frame->GetHeaderSize());
+        frames[kept++] = frame;
+      }
+    }
+  }
+
+  return kept;
+}
+
+
+OpalSRTPContext::Statistics OpalSRTPContext::GetStatistics() const
+{
+  PWaitAndSignal mutex(m_mutex);
+  return m_statistics;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+class OpalNativeSRTPSecurityMode : public OpalSRTPSecurityMode
+{
+  PCLASSINFO(OpalNativeSRTPSecurityMode, OpalSRTPSecurityMode);
+  public:
+    OpalNativeSRTPSecurityMode(const OpalSRTPCryptoSuite & suite)
+      : m_suite(suite)
+      , m_outbound(suite)
+      , m_inbound(suite)
+      , m_outgoingSSRC(0)
+      , m_incomingSSRC(0)
+      , m_outgoingSSRCSet(false)
+      , m_incomingSSRCSet(false)
+    {
+      PINDEX length = suite.m_keyLength + suite.m_saltLength;
+      if (RAND_bytes(m_outgoingKey.key.GetPointer(length), length) <= 0) {
+        PTRACE(1, "SRTP\tCould not generate random master key");
+        m_outgoingKey.key.SetSize(0);
+      }
+    }
+
+    RTP_UDP * CreateRTPSession(OpalRTPConnection & /*connection*/, const RTP_Session::Params & options)
+    {
+      OpalNativeSRTP_UDP * session = new OpalNativeSRTP_UDP(options);
+      session->SetSecurityMode(this);
+      return session;
+    }
+
+    PBoolean SetOutgoingKey(const KeySalt & key)  { m_outgoingKey = key; return PTrue; }
+    PBoolean GetOutgoingKey(KeySalt & key) const  { key = m_outgoingKey; return PTrue; }
+    PBoolean SetOutgoingSSRC(DWORD ssrc)          { m_outgoingSSRC = ssrc; m_outgoingSSRCSet = true; return PTrue; }
+    PBoolean GetOutgoingSSRC(DWORD & ssrc) const  { ssrc = m_outgoingSSRC; return m_outgoingSSRCSet; }
+
+    PBoolean SetIncomingKey(const KeySalt & key)  { m_incomingKey = key; return PTrue; }
+    PBoolean GetIncomingKey(KeySalt & key) const  { key = m_incomingKey; return PTrue; }
+    PBoolean SetIncomingSSRC(DWORD ssrc)          { m_incomingSSRC = ssrc; m_incomingSSRCSet = true; return PTrue; }
+    PBoolean GetIncomingSSRC(DWORD & ssrc) const  { ssrc = m_incomingSSRC; return m_incomingSSRCSet; }
+
+    PBoolean Open()
+    {
+      return SetKey(m_outbound, m_outgoingKey, "outgoing") && SetKey(m_inbound, m_incomingKey, "incoming");
+    }
+
+    OpalSRTPContext & GetOutbound() { return m_outbound; }
+    OpalSRTPContext & GetInbound()  { return m_inbound; }
+
+  protected:
+    bool SetKey(OpalSRTPContext & context, const KeySalt & keySalt, const char * PTRACE_PARAM(direction))
+    {
+      // Salt either separate, or following the key as in SDES
+      PBYTEArray data = keySalt.key;
+      if (keySalt.salt.GetSize() > 0)
+        data.Concatenate(keySalt.salt);
+
+      if (data.GetSize() < m_suite.m_keyLength + m_suite.m_saltLength) {
+        PTRACE(2, "SRTP\tNo " << direction << " master key for " << m_suite.m_name);
+        return false;
+      }
+
+      const BYTE * key = data;
+      return context.SetMasterKey(key, key + m_suite.m_keyLength);
+    }
+
+    const OpalSRTPCryptoSuite & m_suite;
+    OpalSRTPContext m_outbound;
+    OpalSRTPContext m_inbound;
+    KeySalt m_outgoingKey;
+    KeySalt m_incomingKey;
+    DWORD m_outgoingSSRC;
+    DWORD m_incomingSSRC;
+    bool  m_outgoingSSRCSet;
+    bool  m_incomingSSRCSet;
+};
+
+
+#define DECLARE_NATIVE_SRTP_CRYPTO_ALG(name, index) \
+class OpalNativeSRTPSecurityMode_##name : public OpalNativeSRTPSecurityMode \
+{ \
+  public: \
+    OpalNativeSRTPSecurityMode_##name() \
+      : OpalNativeSRTPSecurityMode(CryptoSuites[index]) \
+    { \
+    } \
+}; \
+static PFactory<OpalSecurityMode>::Worker<OpalNativeSRTPSecurityMode_##name> factoryNativeSRTPSecurityMode_##name("SRTP|" #name); \
+
+DECLARE_NATIVE_SRTP_CRYPTO_ALG(AES_CM_128_HMAC_SHA1_80,  0);
+DECLARE_NATIVE_SRTP_CRYPTO_ALG(AES_CM_128_HMAC_SHA1_32,  1);
+DECLARE_NATIVE_SRTP_CRYPTO_ALG(AES_CM_128_NULL_AUTH,     2);
+DECLARE_NATIVE_SRTP_CRYPTO_ALG(NULL_CIPHER_HMAC_SHA1_80, 3);
+DECLARE_NATIVE_SRTP_CRYPTO_ALG(STRONGHOLD,               4);
+DECLARE_NATIVE_SRTP_CRYPTO_ALG(AEAD_AES_128_GCM,         5);
+DECLARE_NATIVE_SRTP_CRYPTO_ALG(AEAD_AES_256_GCM,         6);
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+OpalNativeSRTP_UDP::OpalNativeSRTP_UDP(const Params & params)
+  : OpalSRTP_UDP(params)
+{
+}
+
+
+PBoolean OpalNativeSRTP_UDP::Open(PIPSocket::Address localAddress,
+                                  WORD portBase,
+                                  WORD portMax,
+                                  BYTE ipTypeOfService,
+                                  PNatMethod * nat,
+                                  RTP_QOS * rtpqos)
+{
+  if (securityParms == NULL || !PIsDescendant(securityParms, OpalNativeSRTPSecurityMode))
+    return PFalse;
+
+  OpalNativeSRTPSecurityMode * srtp = (OpalNativeSRTPSecurityMode *)securityParms;
+
+  // get the inbound and outbound SSRC from the SRTP parms and into the RTP session
+  srtp->GetOutgoingSSRC(syncSourceOut);
+  srtp->GetIncomingSSRC(syncSourceIn);
+
+  return OpalSRTP_UDP::Open(localAddress, portBase, portMax, ipTypeOfService, nat, rtpqos);
+}
+
+
+RTP_UDP::SendReceiveStatus OpalNativeSRTP_UDP::OnSendData(RTP_DataFrame & frame)
+{
+  SendReceiveStatus status = RTP_UDP::OnSendData(frame);
+  if (status != e_ProcessPacket)
+    return status;
+
+  OpalNativeSRTPSecurityMode * srtp = (OpalNativeSRTPSecurityMode *)securityParms;
+  return srtp->GetOutbound().ProtectRTP(frame) ? e_ProcessPacket : e_IgnorePacket;
+}
+
+
+RTP_UDP::SendReceiveStatus OpalNativeSRTP_UDP::OnReceiveData(RTP_DataFrame & frame)
+{
+  OpalNativeSRTPSecurityMode * srtp = (OpalNativeSRTPSecurityMode *)securityParms;
+  if (!srtp->GetInbound().UnprotectRTP(frame))
+    return e_IgnorePacket;
+
+  return RTP_UDP::OnReceiveData(frame);
+}
+
+
+RTP_UDP::SendReceiveStatus OpalNativeSRTP_UDP::OnSendControl(RTP_ControlFrame & frame, PINDEX & transmittedLen)
+{
+  SendReceiveStatus status = RTP_UDP::OnSendControl(frame, transmittedLen);
+  if (status != e_ProcessPacket)
+    return status;
+
+  OpalNativeSRTPSecurityMode * srtp = (OpalNativeSRTPSecurityMode *)securityParms;
+  frame.SetMinSize(transmittedLen + srtp->GetOutbound().GetRTCPTrailerSize());
+  return srtp->GetOutbound().ProtectRTCP(frame.GetPointer(), transmittedLen) ? e_ProcessPacket : e_IgnorePacket;
+}
+
+
+RTP_UDP::SendReceiveStatus OpalNativeSRTP_UDP::OnReceiveControl(RTP_ControlFrame & frame)
+{
+  OpalNativeSRTPSecurityMode * srtp = (OpalNativeSRTPSecurityMode *)securityParms;
+
+  PINDEX length = frame.GetSize();
+  if (!srtp->GetInbound().UnprotectRTCP(frame.GetPointer(), length))
+    return e_IgnorePacket;
+  frame.SetSize(length);
+
+  return RTP_UDP::OnReceiveControl(frame);
+}
+
+
+#if OPAL_RTP_AGGREGATE
+
+RTP_UDP::SendReceiveStatus OpalNativeSRTP_UDP::OnSendRelayData(RTP_DataFrame ** frames, PINDEX & count)
+{
+  PINDEX kept = 0;
+  for (PINDEX i = 0; i < count; ++i) {
+    switch (RTP_UDP::OnSendData(*frames[i])) {
+      case e_ProcessPacket :
+        frames[kept++] = frames[i];
+        break;
+      case e_IgnorePacket :
+        break;
+      case e_AbortTransport :
+        count = kept;
+        return e_AbortTransport;
+    }
+  }
+
+  OpalNativeSRTPSecurityMode * srtp = (OpalNativeSRTPSecurityMode *)securityParms;
+  count = srtp->GetOutbound().ProtectRTP(frames, kept);
+  return e_ProcessPacket;
+}
+
+
+RTP_UDP::SendReceiveStatus OpalNativeSRTP_UDP::OnReceiveRelayData(RTP_DataFrame ** frames, PINDEX & count)
+{
+  OpalNativeSRTPSecurityMode * srtp = (OpalNativeSRTPSecurityMode *)securityParms;
+  PINDEX authentic = srtp->GetInbound().UnprotectRTP(frames, count);
+
+  PINDEX kept = 0;
+  for (PINDEX i = 0; i < authentic; ++i) {
+    switch (RTP_UDP::OnReceiveData(*frames[i])) {
+      case e_ProcessPacket :
+        frames[kept++] = frames[i];
+        break;
+      case e_IgnorePacket :
+        break;
+      case e_AbortTransport :
+        count = kept;
+        return e_AbortTransport;
+    }
+  }
+
+  count = kept;
+  return e_ProcessPacket;
+}
+
+#endif // OPAL_RTP_AGGREGATE
+
+
+#endif // OPAL_PTLIB_SSL
+
+
+// End of File ///////////////////////////////////////////////////////////////
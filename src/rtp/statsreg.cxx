@@ -0,0 +1,282 @@
+/*
+ * statsreg.cxx
+ *
+ * Registry of RTP session statistics for bulk export
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2010 Equivalence Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Equivalence Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#pragma implementation "statsreg.h"
+#endif
+
+#include <opal/buildopts.h>
+
+#include <rtp/statsreg.h>
+
+#if OPAL_STATISTICS
+
+#include <rtp/rtp.h>
+
+
+#define new PNEW
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+RTP_StatisticsRegistry::RTP_StatisticsRegistry()
+{
+}
+
+
+RTP_StatisticsRegistry::~RTP_StatisticsRegistry()
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  PTRACE_IF(2, !m_entries.empty(), "RTP\tStatistics registry destroyed with " << m_entries.size() << " sessions");
+
+  // Stop any stragglers removing themselves from a dead registry
+  for (std::vector<Entry>::iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+    it->m_session->m_statisticsRegistry = NULL;
+    it->m_session->m_statisticsIndex = P_MAX_INDEX;
+  }
+}
+
+
+void RTP_StatisticsRegistry::Add(RTP_Session & session, const PString & label)
+{
+  Entry entry;
+  entry.m_session = &session;
+  strncpy(entry.m_label, label, sizeof(entry.m_label)-1);
+  entry.m_label[sizeof(entry.m_label)-1] = '\0';
+
+  for (;;) {
+    RTP_StatisticsRegistry * previous;
+    {
+      PWaitAndSignal mutex(m_mutex);
+
+      // Only read under our lock, as Remove() and the destructor change it
+      previous = session.m_statisticsRegistry;
+
+      if (previous == this) {
+        m_entries[session.m_statisticsIndex] = entry;
+        return;
+      }
+
+      if (previous == NULL) {
+        session.m_statisticsRegistry = this;
+        session.m_statisticsIndex = m_entries.size();
+        m_entries.push_back(entry);
+        return;
+      }
+    }
+
+    // Not while holding ours, the other registry takes its own lock
+    previous->Remove(session);
+  }
+}
+
+
+void RTP_StatisticsRegistry::Remove(RTP_Session & session)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  PINDEX index = session.m_statisticsIndex;
+  if (session.m_statisticsRegistry != this || index >= (PINDEX)m_entries.size() || m_entries[index].m_session != &session)
+    return;
+
+  // Move the last entry into the hole, so removal does not depend on the count
+  m_entries[index] = m_entries.back();
+  m_entries[index].m_session->m_statisticsIndex = index;
+  m_entries.pop_back();
+
+  session.m_statisticsRegistry = NULL;
+  session.m_statisticsIndex = P_MAX_INDEX;
+}
+
+
+PINDEX RTP_StatisticsRegistry::GetSessionCount() const
+{
+  PWaitAndSignal mutex(m_mutex);
+  return m_entries.size();
+}
+
+
+static inline void GetRecord(RTP_Session & session, const char * label, RTP_StatisticsRecord & record)
+{
+  memcpy(record.m_label, label, sizeof(record.m_label));
+  session.GetStatisticsRecord(record);
+}
+
+
+void RTP_StatisticsRegistry::GetRecords(std::vector<RTP_StatisticsRecord> & records) const
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  records.resize(m_entries.size());
+  for (size_t i = 0; i < m_entries.size(); ++i)
+    GetRecord(*m_entries[i].m_session, m_entries[i].m_label, records[i]);
+}
+
+
+void RTP_StatisticsRegistry::ExportBinary(PBYTEArray & data) const
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  PINDEX count = m_entries.size();
+  PINDEX size = sizeof(RTP_StatisticsHeader) + count*sizeof(RTP_StatisticsRecord);
+  data.SetSize(size);
+  BYTE * ptr = data.GetPointer();
+
+  RTP_StatisticsHeader & header = *(RTP_StatisticsHeader *)ptr;
+  header.m_magic      = RTP_StatisticsHeader::Magic;
+  header.m_version    = RTP_StatisticsHeader::Version;
+  header.m_recordSize = sizeof(RTP_StatisticsRecord);
+  header.m_count      = (DWORD)count;
+  header.m_timestamp  = PTime().GetTimestamp();
+
+  // Straight into the buffer, there is no intermediate copy
+  RTP_StatisticsRecord * records = (RTP_StatisticsRecord *)(ptr + sizeof(RTP_StatisticsHeader));
+  for (PINDEX i = 0; i < count; ++i)
+    GetRecord(*m_entries[i].m_session, m_entries[i].m_label, records[i]);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+static const struct {
+  const char * m_name;
+  const char * m_type;
+  const char * m_help;
+  DWORD RTP_StatisticsRecord::* m_field;
+  unsigned     m_divisor;     // Exported as value/divisor
+  bool         m_optional;    // Not exported if Unavailable
+} PrometheusMetrics[] = {
+  { "opal_rtp_packets_sent_total",         "counter", "RTP packets sent",
+    &RTP_StatisticsRecord::m_packetsSent,             1,   false },
+  { "opal_rtp_octets_sent_total",          "counter", "RTP payload octets sent",
+    &RTP_StatisticsRecord::m_octetsSent,              1,   false },
+  { "opal_rtp_packets_received_total",     "counter", "RTP packets received",
+    &RTP_StatisticsRecord::m_packetsReceived,         1,   false },
+  { "opal_rtp_octets_received_total",      "counter", "RTP payload octets received",
+    &RTP_StatisticsRecord::m_octetsReceived,          1,   false },
+  { "opal_rtp_packets_lost_total",         "counter", "RTP packets lost in the network",
+    &RTP_StatisticsRecord::m_packetsLost,             1,   false },
+  { "opal_rtp_packets_out_of_order_total", "counter", "RTP packets received out of order",
+    &RTP_StatisticsRecord::m_packetsOutOfOrder,       1,   false },
+  { "opal_rtp_jitter_milliseconds",        "gauge",   "Average interarrival jitter",
+    &RTP_StatisticsRecord::m_averageJitter,           1,   false },
+  { "opal_rtp_jitter_maximum_milliseconds","gauge",   "Maximum interarrival jitter",
+    &RTP_StatisticsRecord::m_maximumJitter,           1,   false },
+  { "opal_rtp_round_trip_milliseconds",    "gauge",   "Round trip time from RTCP, zero if not known",
+    &RTP_StatisticsRecord::m_roundTripTime,           1,   false },
+  { "opal_rtp_burst_density_ratio",        "gauge",   "Fraction of packets lost in bursts, RFC 3611",
+    &RTP_StatisticsRecord::m_burstDensity,            256, false },
+  { "opal_rtp_gap_density_ratio",          "gauge",   "Fraction of packets lost in gaps, RFC 3611",
+    &RTP_StatisticsRecord::m_gapDensity,              256, false },
+  { "opal_rtp_mos_listening",              "gauge",   "Listening quality MOS of received media, from loss",
+    &RTP_StatisticsRecord::m_mosListening,            10,  true  },
+  { "opal_rtp_remote_r_factor",            "gauge",   "R factor of sent media, as reported by the remote",
+    &RTP_StatisticsRecord::m_remoteRFactor,           1,   true  },
+  { "opal_rtp_remote_mos_listening",       "gauge",   "Listening quality MOS of sent media, as reported by the remote",
+    &RTP_StatisticsRecord::m_remoteMOSListening,      10,  true  },
+  { "opal_rtp_remote_mos_conversational",  "gauge",   "Conversational quality MOS of sent media, as reported by the remote",
+    &RTP_StatisticsRecord::m_remoteMOSConversational, 10,  true  }
+};
+
+
+static void EscapeLabel(ostream & strm, const char * label)
+{
+  for (; *label != '\0'; ++label) {
+    switch (*label) {
+      case '\\' :
+        strm << "\\\\";
+        break;
+      case '"' :
+        strm << "\\\"";
+        break;
+      case '\n' :
+        strm << "\\n";
+        break;
+      default :
+        strm << *label;
+    }
+  }
+}
+
+
+void RTP_StatisticsRegistry::ExportPrometheus(ostream & strm) const
+{
+  // Copy under the lock, format without it
+  std::vector<RTP_StatisticsRecord> records;
+  GetRecords(records);
+
+  std::vector<PString> labels(records.size());
+  for (size_t i = 0; i < records.size(); ++i) {
+    PStringStream label;
+    label << "call=\"";
+    EscapeLabel(label, records[i].m_label);
+    label << "\",session=\"" << records[i].m_sessionID << "\",port=\"" << records[i].m_localPort << '"';
+    labels[i] = label;
+  }
+
+  // Prometheus wants all the samples of a metric together
+  for (PINDEX metric = 0; metric < (PINDEX)PARRAYSIZE(PrometheusMetrics); ++metric) {
+    const char * name = PrometheusMetrics[metric].m_name;
+    strm << "# HELP " << name << ' ' << PrometheusMetrics[metric].m_help << "\n"
+            "# TYPE " << name << ' ' << PrometheusMetrics[metric].m_type << '\n';
+
+    DWORD RTP_StatisticsRecord::* field = PrometheusMetrics[metric].m_field;
+    unsigned divisor = PrometheusMetrics[metric].m_divisor;
+    for (size_t i = 0; i < records.size(); ++i) {
+      DWORD value = records[i].*field;
+      if (PrometheusMetrics[metric].m_optional && value == RTP_StatisticsRecord::Unavailable)
+        continue;
+      strm << name << '{' << labels[i] << "} ";
+      if (divisor == 1)
+        strm << value;
+      else
+        strm << (double)value/divisor;
+      strm << '\n';
+    }
+  }
+
+  static const char JitterName[] = "opal_rtp_jitter_variation_packets_total";
+  strm << "# HELP " << JitterName << " Packets by variation of interarrival time, from the bucket's lower bound in milliseconds\n"
+          "# TYPE " << JitterName << " counter\n";
+  for (size_t i = 0; i < records.size(); ++i) {
+    for (PINDEX bucket = 0; bucket < RTP_JitterHistogram::Buckets; ++bucket)
+      strm << JitterName << '{' << labels[i] << ",from=\"" << RTP_JitterHistogram::GetBucketStart(bucket) << "\"} "
+           << records[i].m_jitterHistogram[bucket] << '\n';
+  }
+}
+
+
+#endif // OPAL_STATISTICS
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -47,6 +47,8 @@
 #include <ptclib/pxml.h>
 #endif
 
+#include <algorithm>
+
 
 #define new PNEW
 
@@ -181,7 +183,12 @@ void SIPHandler::SetState(SIPHandler::State newState)
 {
   PTRACE(4, "SIP\tChanging " << GetMethod() << " handler from " << state << " to " << newState
          << ", target=" << GetAddressOfRecord() << ", id=" << GetCallID());
+
+  bool unsubscribed = newState == Unsubscribed && state != Unsubscribed;
   state = newState;
+
+  if (unsubscribed)
+    endpoint.OnHandlerUnsubscribed(*this);
 }
 
 
@@ -540,6 +547,7 @@ void SIPHandler::OnReceivedAuthenticationRequired(SIPTransaction & transaction,
   m_realm    = newAuth->GetAuthRealm();
   m_username = username;
   m_password = password;
+  endpoint.OnHandlerCredentialsChanged(*this);
 
   // Restart the transaction with new authentication handler
   State oldState = state;
@@ -816,6 +824,7 @@ void SIPRegisterHandler::UpdateParameters(const SIPRegister::Params & params)
     m_realm = m_parameters.m_realm = params.m_realm;   // Adjust the realm if required 
   if (!params.m_password.IsEmpty())
     m_password = m_parameters.m_password = params.m_password; // Adjust the password if required 
+  endpoint.OnHandlerCredentialsChanged(*this);
 
   if (params.m_expire > 0)
     SetExpire(m_parameters.m_expire = params.m_expire);
@@ -938,6 +947,7 @@ void SIPSubscribeHandler::UpdateParameters(const SIPSubscribe::Params & params)
     m_realm = params.m_realm;   // Adjust the realm if required 
   if (!params.m_password.IsEmpty())
     m_password = params.m_password; // Adjust the password if required 
+  endpoint.OnHandlerCredentialsChanged(*this);
 
   m_parameters.m_contactAddress = params.m_contactAddress;
 
@@ -1631,11 +1641,167 @@ SIPTransaction * SIPPingHandler::CreateTransaction(OpalTransport &t)
 
 //////////////////////////////////////////////////////////////////
 
-/* All of the bwlow search loops run through the list with only
-   PSafeReference rather than PSafeReadOnly, even though they are
-   reading fields from the handler instances. We can get away with
-   this becuase the information being tested, e.g. AOR, is constant
-   for the life of the handler instance, once constructed.
+static PString MethodKey(SIP_PDU::Methods meth)
+{
+  return psprintf("%u", meth);
+}
+
+
+/* Only the parts of the URL that must be equal for SIPURL::Compare() to
+   match. The scheme and host compare without regard to case, so are folded
+   to lower case, the user name is case sensitive so is left alone. */
+static PString AddressOfRecordKey(SIP_PDU::Methods meth, const SIPURL & url)
+{
+  return psprintf("%u %s:%s@%s:%u", meth,
+                  (const char *)url.GetScheme().ToLower(),
+                  (const char *)url.GetUserName(),
+                  (const char *)url.GetHostName().ToLower(),
+                  url.GetPort());
+}
+
+
+// Host names compare without regard to case
+static PString DomainKey(SIP_PDU::Methods meth, const PString & domain)
+{
+  return psprintf("%u ", meth) + domain.ToLower();
+}
+
+
+void SIPHandlersList::Append(SIPHandler * handler)
+{
+  if (handler == NULL)
+    return;
+
+  m_handlersList.Append(handler);
+
+  PWaitAndSignal lock(m_indexMutex);
+
+  if (m_indexed.find(handler) != m_indexed.end())
+    return;
+
+  SIP_PDU::Methods meth = handler->GetMethod();
+  const SIPURL & aor = handler->GetAddressOfRecord();
+
+  IndexKeys & keys = m_indexed[handler];
+  keys.m_method = MethodKey(meth);
+  keys.m_callID = handler->GetCallID();
+  keys.m_addressOfRecord = AddressOfRecordKey(meth, aor);
+  keys.m_domain = DomainKey(meth, aor.GetHostName());
+  keys.m_aorUserName = aor.GetUserName();
+  keys.m_username = handler->GetUsername();
+  keys.m_realm = handler->GetRealm();
+
+  AddToIndex(m_byMethod, keys.m_method, handler);
+  AddToIndex(m_byCallID, keys.m_callID, handler);
+  AddToIndex(m_byAddressOfRecord, keys.m_addressOfRecord, handler);
+  AddToIndex(m_byDomain, keys.m_domain, handler);
+  AddToIndex(m_byAORUserName, keys.m_aorUserName, handler);
+  AddToIndex(m_byUsername, keys.m_username, handler);
+  AddToIndex(m_byRealm, keys.m_realm, handler);
+}
+
+
+void SIPHandlersList::Remove(SIPHandler * handler)
+{
+  if (handler == NULL)
+    return;
+
+  /* Must be out of the indexes before it can be deleted, which cannot
+     happen until it is removed from the list. */
+  {
+    PWaitAndSignal lock(m_indexMutex);
+
+    std::map<SIPHandler *, IndexKeys>::iterator it = m_indexed.find(handler);
+    if (it != m_indexed.end()) {
+      const IndexKeys & keys = it->second;
+      RemoveFromIndex(m_byMethod, keys.m_method, handler);
+      RemoveFromIndex(m_byCallID, keys.m_callID, handler);
+      RemoveFromIndex(m_byAddressOfRecord, keys.m_addressOfRecord, handler);
+      RemoveFromIndex(m_byDomain, keys.m_domain, handler);
+      RemoveFromIndex(m_byAORUserName, keys.m_aorUserName, handler);
+      RemoveFromIndex(m_byUsername, keys.m_username, handler);
+      RemoveFromIndex(m_byRealm, keys.m_realm, handler);
+      m_indexed.erase(it);
+    }
+  }
+
+  m_handlersList.Remove(handler);
+}
+
+
+void SIPHandlersList::Refresh(SIPHandler * handler)
+{
+  PWaitAndSignal lock(m_indexMutex);
+
+  std::map<SIPHandler *, IndexKeys>::iterator it = m_indexed.find(handler);
+  if (it == m_indexed.end())
+    return;
+
+  IndexKeys & keys = it->second;
+
+  if (keys.m_username != handler->GetUsername()) {
+    RemoveFromIndex(m_byUsername, keys.m_username, handler);
+    keys.m_username = handler->GetUsername();
+    AddToIndex(m_byUsername, keys.m_username, handler);
+  }
+
+  if (keys.m_realm != handler->GetRealm()) {
+    RemoveFromIndex(m_byRealm, keys.m_realm, handler);
+    keys.m_realm = handler->GetRealm();
+    AddToIndex(m_byRealm, keys.m_realm, handler);
+  }
+}
+
+
+void SIPHandlersList::AddToIndex(Index & index, const PString & key, SIPHandler * handler)
+{
+  index[key].push_back(handler);
+}
+
+
+void SIPHandlersList::RemoveFromIndex(Index & index, const PString & key, SIPHandler * handler)
+{
+  Index::iterator it = index.find(key);
+  if (it == index.end())
+    return;
+
+  std::vector<SIPHandler *> & handlers = it->second;
+  std::vector<SIPHandler *>::iterator pos = std::find(handlers.begin(), handlers.end(), handler);
+  if (pos != handlers.end())
+    handlers.erase(pos);
+
+  if (handlers.empty())
+    index.erase(it);
+}
+
+
+/* A handler is in the indexes from before it is appended to the list until
+   after it is removed from it, and so cannot be deleted while the index
+   mutex is held. References are taken to the candidates then, so they may
+   be examined and locked after the mutex is released. */
+void SIPHandlersList::GetCandidates(const Index & index, const PString & key, Candidates & candidates) const
+{
+  PWaitAndSignal lock(m_indexMutex);
+
+  Index::const_iterator it = index.find(key);
+  if (it == index.end())
+    return;
+
+  candidates.reserve(it->second.size());
+  for (std::vector<SIPHandler *>::const_iterator handler = it->second.begin(); handler != it->second.end(); ++handler) {
+    PSafePtr<SIPHandler> ref(*handler, PSafeReference);
+    if (ref != NULL)
+      candidates.push_back(ref);
+  }
+}
+
+
+/* All of the below searches check the handlers with only PSafeReference
+   rather than PSafeReadOnly, even though they are reading fields from the
+   handler instances. We can get away with this becuase the information
+   being tested, e.g. AOR, is constant for the life of the handler
+   instance, once constructed. The user name and realm may change, but the
+   handler then calls Refresh() to update the indexes.
 
    We need to use PSafeReference as there are some cases where
    deadlocks can occur when locked handlers look for information
@@ -1643,11 +1809,14 @@ SIPTransaction * SIPPingHandler::CreateTransaction(OpalTransport &t)
  */
 unsigned SIPHandlersList::GetCount(SIP_PDU::Methods meth, const PString & eventPackage) const
 {
+  Candidates candidates;
+  GetCandidates(m_byMethod, MethodKey(meth), candidates);
+
   unsigned count = 0;
-  for (PSafePtr<SIPHandler> handler(m_handlersList, PSafeReference); handler != NULL; ++handler)
-    if (handler->GetState () == SIPHandler::Subscribed &&
-        handler->GetMethod() == meth &&
-        (eventPackage.IsEmpty() || handler->GetEventPackage() == eventPackage))
+  for (Candidates::iterator handler = candidates.begin(); handler != candidates.end(); ++handler)
+    if ((*handler)->GetState () == SIPHandler::Subscribed &&
+        (*handler)->GetMethod() == meth &&
+        (eventPackage.IsEmpty() || (*handler)->GetEventPackage() == eventPackage))
       count++;
   return count;
 }
@@ -1655,13 +1824,16 @@ unsigned SIPHandlersList::GetCount(SIP_PDU::Methods meth, const PString & eventP
 
 PStringList SIPHandlersList::GetAddresses(bool includeOffline, SIP_PDU::Methods meth, const PString & eventPackage) const
 {
+  Candidates candidates;
+  GetCandidates(m_byMethod, MethodKey(meth), candidates);
+
   PStringList addresses;
-  for (PSafePtr<SIPHandler> handler(m_handlersList, PSafeReference); handler != NULL; ++handler)
-    if ((includeOffline ? handler->GetState () != SIPHandler::Unsubscribed
-                        : handler->GetState () == SIPHandler::Subscribed) &&
-        handler->GetMethod() == meth &&
-        (eventPackage.IsEmpty() || handler->GetEventPackage() == eventPackage))
-      addresses.AppendString(handler->GetAddressOfRecord().AsString());
+  for (Candidates::iterator handler = candidates.begin(); handler != candidates.end(); ++handler)
+    if ((includeOffline ? (*handler)->GetState () != SIPHandler::Unsubscribed
+                        : (*handler)->GetState () == SIPHandler::Subscribed) &&
+        (*handler)->GetMethod() == meth &&
+        (eventPackage.IsEmpty() || (*handler)->GetEventPackage() == eventPackage))
+      addresses.AppendString((*handler)->GetAddressOfRecord().AsString());
   return addresses;
 }
 
@@ -1671,9 +1843,12 @@ PStringList SIPHandlersList::GetAddresses(bool includeOffline, SIP_PDU::Methods
  */
 PSafePtr<SIPHandler> SIPHandlersList::FindSIPHandlerByCallID(const PString & callID, PSafetyMode mode)
 {
-  for (PSafePtr<SIPHandler> handler(m_handlersList, PSafeReference); handler != NULL; ++handler) {
-    if (callID == handler->GetCallID() && handler.SetSafetyMode(mode))
-      return handler;
+  Candidates candidates;
+  GetCandidates(m_byCallID, callID, candidates);
+
+  for (Candidates::iterator handler = candidates.begin(); handler != candidates.end(); ++handler) {
+    if (callID == (*handler)->GetCallID() && handler->SetSafetyMode(mode))
+      return *handler;
   }
   return NULL;
 }
@@ -1685,52 +1860,64 @@ PSafePtr<SIPHandler> SIPHandlersList::FindSIPHandlerByCallID(const PString & cal
 PSafePtr<SIPHandler> SIPHandlersList::FindSIPHandlerByAuthRealm (const PString & authRealm, const PString & userName, PSafetyMode mode)
 {
   PIPSocket::Address handlerRealmAddress, authRealmAddress;
-  PIPSocket::GetHostAddress(authRealm, authRealmAddress);
+  bool authRealmResolved = false;
 
   // if username is specified, look for exact matches
   if (!userName.IsEmpty()) {
+    Candidates candidates;
 
     // look for a match to exact user name and realm
-    for (PSafePtr<SIPHandler> handler(m_handlersList, PSafeReference); handler != NULL; ++handler) {
-      if ( handler->GetUsername() == userName &&
-          (handler->GetRealm().IsEmpty() || handler->GetRealm() == authRealm) &&
-           handler.SetSafetyMode(mode)) {
+    GetCandidates(m_byUsername, userName, candidates);
+    for (Candidates::iterator handler = candidates.begin(); handler != candidates.end(); ++handler) {
+      if ( (*handler)->GetUsername() == userName &&
+          ((*handler)->GetRealm().IsEmpty() || (*handler)->GetRealm() == authRealm) &&
+           handler->SetSafetyMode(mode)) {
         PTRACE(4, "SIP\tLocated existing credentials for ID \"" << userName << "\" at realm \"" << authRealm << '"');
-        return handler;
+        return *handler;
       }
     }
 
     // look for a match to exact AOR name and realm
-    for (PSafePtr<SIPHandler> handler(m_handlersList, PSafeReference); handler != NULL; ++handler) {
-      if ( handler->GetAddressOfRecord().GetUserName() == userName &&
-          (handler->GetRealm().IsEmpty() || handler->GetRealm() == authRealm) &&
-           handler.SetSafetyMode(mode)) {
+    Candidates aorCandidates;
+    GetCandidates(m_byAORUserName, userName, aorCandidates);
+    for (Candidates::iterator handler = aorCandidates.begin(); handler != aorCandidates.end(); ++handler) {
+      if ( (*handler)->GetAddressOfRecord().GetUserName() == userName &&
+          ((*handler)->GetRealm().IsEmpty() || (*handler)->GetRealm() == authRealm) &&
+           handler->SetSafetyMode(mode)) {
         PTRACE(4, "SIP\tLocated existing credentials for AOR user \"" << userName << "\" at realm \"" << authRealm << '"');
-        return handler;
+        return *handler;
       }
     }
 
     // look for a match to exact username and realm as hostname
-    for (PSafePtr<SIPHandler> handler(m_handlersList, PSafeReference); handler != NULL; ++handler) {
-      if (userName == handler->GetUsername() &&
-          PIPSocket::GetHostAddress(handler->GetRealm(), handlerRealmAddress) &&
+    if (!candidates.empty()) {
+      PIPSocket::GetHostAddress(authRealm, authRealmAddress);
+      authRealmResolved = true;
+    }
+    for (Candidates::iterator handler = candidates.begin(); handler != candidates.end(); ++handler) {
+      if (userName == (*handler)->GetUsername() &&
+          PIPSocket::GetHostAddress((*handler)->GetRealm(), handlerRealmAddress) &&
           handlerRealmAddress  == authRealmAddress &&
-          handler.SetSafetyMode(mode)) {
+          handler->SetSafetyMode(mode)) {
         PTRACE(4, "SIP\tLocated existing credentials for ID \"" << userName << "\" at host/address \"" << authRealm << '"');
-        return handler;
+        return *handler;
       }
     }
   }
 
   // look for a match to exact realm
-  for (PSafePtr<SIPHandler> handler(m_handlersList, PSafeReference); handler != NULL; ++handler) {
-    if (handler->GetRealm() == authRealm && handler.SetSafetyMode(mode)) {
+  Candidates candidates;
+  GetCandidates(m_byRealm, authRealm, candidates);
+  for (Candidates::iterator handler = candidates.begin(); handler != candidates.end(); ++handler) {
+    if ((*handler)->GetRealm() == authRealm && handler->SetSafetyMode(mode)) {
       PTRACE(4, "SIP\tLocated existing credentials for realm \"" << authRealm << '"');
-      return handler;
+      return *handler;
     }
   }
 
-  // look for a match to exact realm as hostname
+  // look for a match to exact realm as hostname, which can only be a search
+  if (!authRealmResolved)
+    PIPSocket::GetHostAddress(authRealm, authRealmAddress);
   for (PSafePtr<SIPHandler> handler(m_handlersList, PSafeReference); handler != NULL; ++handler) {
     if (PIPSocket::GetHostAddress(handler->GetRealm(), handlerRealmAddress) &&
         handlerRealmAddress == authRealmAddress &&
@@ -1753,11 +1940,15 @@ PSafePtr<SIPHandler> SIPHandlersList::FindSIPHandlerByAuthRealm (const PString &
 PSafePtr<SIPHandler> SIPHandlersList::FindSIPHandlerByUrl(const PString & remoteAddress, SIP_PDU::Methods meth, PSafetyMode mode)
 {
   SIPURL remoteURL = remoteAddress;
-  for (PSafePtr<SIPHandler> handler(m_handlersList, PSafeReference); handler != NULL; ++handler) {
-    if (handler->GetMethod() == meth &&
-        handler->GetAddressOfRecord() == remoteURL &&
-        handler.SetSafetyMode(mode))
-      return handler;
+
+  Candidates candidates;
+  GetCandidates(m_byAddressOfRecord, AddressOfRecordKey(meth, remoteURL), candidates);
+
+  for (Candidates::iterator handler = candidates.begin(); handler != candidates.end(); ++handler) {
+    if ((*handler)->GetMethod() == meth &&
+        (*handler)->GetAddressOfRecord() == remoteURL &&
+        handler->SetSafetyMode(mode))
+      return *handler;
   }
   return NULL;
 }
@@ -1766,12 +1957,16 @@ PSafePtr<SIPHandler> SIPHandlersList::FindSIPHandlerByUrl(const PString & remote
 PSafePtr<SIPHandler> SIPHandlersList::FindSIPHandlerByUrl(const PString & aor, SIP_PDU::Methods meth, const PString & eventPackage, PSafetyMode mode)
 {
   SIPURL aorURL = aor;
-  for (PSafePtr<SIPHandler> handler(m_handlersList, PSafeReference); handler != NULL; ++handler) {
-    if (handler->GetMethod() == meth &&
-        handler->GetAddressOfRecord() == aorURL &&
-        handler->GetEventPackage() == eventPackage &&
-        handler.SetSafetyMode(mode))
-      return handler;
+
+  Candidates candidates;
+  GetCandidates(m_byAddressOfRecord, AddressOfRecordKey(meth, aorURL), candidates);
+
+  for (Candidates::iterator handler = candidates.begin(); handler != candidates.end(); ++handler) {
+    if ((*handler)->GetMethod() == meth &&
+        (*handler)->GetAddressOfRecord() == aorURL &&
+        (*handler)->GetEventPackage() == eventPackage &&
+        handler->SetSafetyMode(mode))
+      return *handler;
   }
   return NULL;
 }
@@ -1781,14 +1976,26 @@ PSafePtr<SIPHandler> SIPHandlersList::FindSIPHandlerByUrl(const PString & aor, S
  * Find the SIPHandler object with the specified registration host.
  * For example, in the above case, the name parameter
  * could be "sip.seconix.com" or "seconix.com".
+ * An exact match of the host name is preferred, failing that the
+ * handlers are searched for a host address equivalent to the name.
  */
 PSafePtr<SIPHandler> SIPHandlersList::FindSIPHandlerByDomain(const PString & name, SIP_PDU::Methods meth, PSafetyMode mode)
 {
+  Candidates candidates;
+  GetCandidates(m_byDomain, DomainKey(meth, name), candidates);
+
+  for (Candidates::iterator handler = candidates.begin(); handler != candidates.end(); ++handler) {
+    if ( (*handler)->GetMethod() == meth &&
+         (*handler)->GetState() != SIPHandler::Unsubscribed &&
+         (*handler)->GetAddressOfRecord().GetHostName() == name &&
+         handler->SetSafetyMode(mode))
+      return *handler;
+  }
+
   for (PSafePtr<SIPHandler> handler(m_handlersList, PSafeReference); handler != NULL; ++handler) {
     if ( handler->GetMethod() == meth &&
          handler->GetState() != SIPHandler::Unsubscribed &&
-        (handler->GetAddressOfRecord().GetHostName() == name ||
-         handler->GetAddressOfRecord().GetHostAddress().IsEquivalent(name)) &&
+         handler->GetAddressOfRecord().GetHostAddress().IsEquivalent(name) &&
          handler.SetSafetyMode(mode))
       return handler;
   }
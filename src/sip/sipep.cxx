@@ -64,6 +64,7 @@ SIPEndPoint::SIPEndPoint(OpalManager & mgr)
   , notifierTimeToLive(0, 0, 0, 1)   // 1 hour
   , natBindingTimeout(0, 0, 1)       // 1 minute
   , m_shuttingDown(false)
+  , m_transactionTimers(2, 10, "SIP Timers")
   , m_defaultAppearanceCode(-1)
 
 #ifdef _MSC_VER
@@ -138,9 +139,9 @@ void SIPEndPoint::ShutDown()
 
   // Clean up transactions still in progress, waiting for them to complete.
   PSafePtr<SIPTransaction> transaction;
-  while ((transaction = transactions.GetAt(0, PSafeReference)) != NULL) {
+  while ((transaction = transactions.GetFirst(PSafeReference)) != NULL) {
     transaction->WaitForCompletion();
-    transactions.RemoveAt(transaction->GetTransactionID());
+    transactions.Remove(transaction->GetTransactionID());
   }
 
   // Now shut down listeners and aggregators
@@ -393,18 +394,7 @@ PBoolean SIPEndPoint::GarbageCollection()
 {
   PTRACE(5, "SIP\tMONITOR:transactions=" << transactions.GetSize() << ",connections=" << connectionsActive.GetSize());
 
-  PSafePtr<SIPTransaction> transaction(transactions, PSafeReadOnly);
-  while (transaction != NULL) {
-    if (transaction->IsTerminated()) {
-      PString id = transaction->GetTransactionID();
-      ++transaction;
-      transactions.RemoveAt(id);
-    }
-    else
-      ++transaction;
-  }
-
-  bool transactionsDone = transactions.DeleteObjectsToBeRemoved();
+  bool transactionsDone = transactions.ReapTerminated();
 
 
   PSafePtr<SIPHandler> handler = activeSIPHandlers.GetFirstHandler();
@@ -429,6 +419,53 @@ PBoolean SIPEndPoint::GarbageCollection()
 }
 
 
+bool SIPEndPoint::CollectQueuedGarbage()
+{
+  bool transactionsDone = transactions.ReapTerminated();
+
+  std::vector<PString> unsubscribed;
+  m_unsubscribedHandlersMutex.Wait();
+  unsubscribed.swap(m_unsubscribedHandlers);
+  m_unsubscribedHandlersMutex.Signal();
+
+  std::vector<PString> notShutDown;
+  for (std::vector<PString>::iterator callID = unsubscribed.begin(); callID != unsubscribed.end(); ++callID) {
+    // May have gone already, or been subscribed again
+    PSafePtr<SIPHandler> handler = activeSIPHandlers.FindSIPHandlerByCallID(*callID, PSafeReference);
+    if (handler == NULL || handler->GetState() != SIPHandler::Unsubscribed)
+      continue;
+
+    if (handler->ShutDown())
+      activeSIPHandlers.Remove(handler);
+    else
+      notShutDown.push_back(*callID);
+  }
+
+  /* Put back for the retry the manager makes when this returns false, not
+     through OnHandlerUnsubscribed(), as signalling the garbage collector from
+     within its own pass would have it spin until the handler shuts down. */
+  if (!notShutDown.empty()) {
+    m_unsubscribedHandlersMutex.Wait();
+    m_unsubscribedHandlers.insert(m_unsubscribedHandlers.end(), notShutDown.begin(), notShutDown.end());
+    m_unsubscribedHandlersMutex.Signal();
+  }
+
+  bool handlersDone = activeSIPHandlers.DeleteObjectsToBeRemoved() && notShutDown.empty();
+
+  return OpalEndPoint::CollectQueuedGarbage() && transactionsDone && handlersDone;
+}
+
+
+void SIPEndPoint::OnHandlerUnsubscribed(SIPHandler & handler)
+{
+  m_unsubscribedHandlersMutex.Wait();
+  m_unsubscribedHandlers.push_back(handler.GetCallID());
+  m_unsubscribedHandlersMutex.Signal();
+
+  GetManager().QueueGarbageCollection(*this);
+}
+
+
 PBoolean SIPEndPoint::IsAcceptedAddress(const SIPURL & /*toAddr*/)
 {
   return PTrue;
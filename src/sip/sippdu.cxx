@@ -45,6 +45,7 @@
 #include <opal/manager.h>
 #include <opal/connection.h>
 #include <opal/transports.h>
+#include <opal/strhash.h>
 
 #include <ptclib/cypher.h>
 #include <ptclib/pdns.h>
@@ -88,6 +89,12 @@ ostream & operator<<(ostream & strm, SIP_PDU::Methods method)
 #endif
 
 
+const char * SIP_PDU::GetMethodName(Methods method)
+{
+  return method < NumMethods ? MethodNames[method] : "";
+}
+
+
 const char * SIP_PDU::GetStatusCodeDescription(int code)
 {
   static struct {
@@ -620,7 +627,12 @@ void SIPMIMEInfo::PrintOn(ostream & strm) const
 void SIPMIMEInfo::ReadFrom(istream & strm)
 {
   PMIMEInfo::ReadFrom(strm);
+  ExpandCompactForms();
+}
 
+
+void SIPMIMEInfo::ExpandCompactForms()
+{
   for (PINDEX i = 0; i < PARRAYSIZE(CompactForms); ++i) {
     PCaselessString compact(CompactForms[i].compact);
     if (Contains(compact)) {
@@ -1337,6 +1349,205 @@ PString SIPMIMEInfo::InsertFieldParameter(const PString & fieldValue,
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////
+
+static inline bool IsWhiteSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+
+static bool CaselessEqual(const char * str, PINDEX length, const char * name)
+{
+  for (PINDEX i = 0; i < length; ++i) {
+    if (name[i] == '\0' || tolower((unsigned char)str[i]) != tolower((unsigned char)name[i]))
+      return false;
+  }
+  return name[length] == '\0';
+}
+
+
+static PString TrimmedString(const char * data, PINDEX start, PINDEX end)
+{
+  while (start < end && IsWhiteSpace(data[start]))
+    ++start;
+  while (end > start && IsWhiteSpace(data[end-1]))
+    --end;
+  return PString(data+start, end-start);
+}
+
+
+/* Find the end of the line starting at pos, less one trailing CR as for a
+   PString read from a stream, and the start of the following line. */
+static PINDEX FindLineEnd(const char * data, PINDEX pos, PINDEX length, PINDEX & next)
+{
+  const char * lf = (const char *)memchr(data+pos, '\n', length-pos);
+  if (lf == NULL)
+    return P_MAX_INDEX;
+
+  PINDEX end = lf - data;
+  next = end+1;
+  if (end > pos && data[end-1] == '\r')
+    --end;
+  return end;
+}
+
+
+SIPMessageParser::SIPMessageParser()
+  : m_data(NULL)
+  , m_length(0)
+  , m_startLineEnd(0)
+  , m_bodyOffset(0)
+{
+  m_headers.reserve(32);
+}
+
+
+SIPMessageParser::Result SIPMessageParser::Parse(const char * data, PINDEX length)
+{
+  m_data = data;
+  m_length = length;
+  m_startLineEnd = 0;
+  m_bodyOffset = length;
+  m_headers.clear();
+
+  PINDEX next;
+  PINDEX end = FindLineEnd(data, 0, length, next);
+  if (end == P_MAX_INDEX || end == 0)
+    return BadStartLine;
+  m_startLineEnd = end;
+
+  for (PINDEX pos = next; ; pos = next) {
+    end = FindLineEnd(data, pos, length, next);
+    if (end == P_MAX_INDEX)
+      return BadHeaders;
+
+    if (end == pos) {
+      m_bodyOffset = next;
+      return Parsed;
+    }
+
+    // RFC 822 section 3.1.1, a line starting with white space continues the previous one
+    if ((data[pos] == ' ' || data[pos] == '\t') && !m_headers.empty()) {
+      Line & line = m_headers.back();
+      line.m_end = end;
+      line.m_folded = true;
+    }
+    else {
+      const char * colon = (const char *)memchr(data+pos, ':', end-pos);
+      Line line;
+      line.m_start = pos;
+      line.m_end = end;
+      line.m_colon = colon != NULL ? colon - data : P_MAX_INDEX;
+      line.m_folded = false;
+      m_headers.push_back(line);
+    }
+  }
+}
+
+
+PString SIPMessageParser::GetStartLine() const
+{
+  return PString(m_data, m_startLineEnd);
+}
+
+
+PString SIPMessageParser::GetFoldedLine(const Line & line) const
+{
+  // Join the lines without their terminators, keeping the leading white space
+  PString str;
+  char * ptr = str.GetPointer(line.m_end - line.m_start + 1);
+  for (PINDEX i = line.m_start; i < line.m_end; ++i) {
+    char c = m_data[i];
+    if (c != '\n' && !(c == '\r' && m_data[i+1] == '\n'))
+      *ptr++ = c;
+  }
+  *ptr = '\0';
+  str.MakeMinimumSize();
+  return str;
+}
+
+
+bool SIPMessageParser::GetHeader(PINDEX index, PCaselessString & name, PString & value) const
+{
+  const Line & line = m_headers[index];
+
+  if (line.m_folded) {
+    PString text = GetFoldedLine(line);
+    PINDEX colon = text.Find(':');
+    if (colon == P_MAX_INDEX)
+      return false;
+    name = text.Left(colon).Trim();
+    value = text.Mid(colon+1).Trim();
+    return true;
+  }
+
+  if (line.m_colon == P_MAX_INDEX)
+    return false;
+
+  name = TrimmedString(m_data, line.m_start, line.m_colon);
+  value = TrimmedString(m_data, line.m_colon+1, line.m_end);
+  return true;
+}
+
+
+PINDEX SIPMessageParser::FindHeader(const char * name, char compact) const
+{
+  PINDEX nameLength = strlen(name);
+
+  for (PINDEX i = 0; i < GetHeaderCount(); ++i) {
+    const Line & line = m_headers[i];
+
+    if (line.m_colon == P_MAX_INDEX) {
+      // Name may only be complete once continuation lines are joined
+      PCaselessString lineName;
+      PString lineValue;
+      if (line.m_folded && GetHeader(i, lineName, lineValue) &&
+            (lineName == name || (compact != '\0' && lineName == PString(compact))))
+        return i;
+      continue;
+    }
+
+    PINDEX start = line.m_start;
+    PINDEX end = line.m_colon;
+    while (start < end && IsWhiteSpace(m_data[start]))
+      ++start;
+    while (end > start && IsWhiteSpace(m_data[end-1]))
+      --end;
+
+    if (end - start == 1 && compact != '\0' && tolower((unsigned char)m_data[start]) == tolower((unsigned char)compact))
+      return i;
+
+    if (end - start == nameLength && CaselessEqual(m_data+start, nameLength, name))
+      return i;
+  }
+
+  return P_MAX_INDEX;
+}
+
+
+void SIPMessageParser::GetMIME(SIPMIMEInfo & mime) const
+{
+  PCaselessString name;
+  PString value;
+
+  for (PINDEX i = 0; i < GetHeaderCount(); ++i) {
+    if (!GetHeader(i, name, value))
+      continue;
+
+    PString * existing = mime.GetAt(name);
+    if (existing == NULL)
+      mime.SetAt(name, value);
+    else {
+      *existing += '\n';
+      *existing += value;
+    }
+  }
+
+  mime.ExpandCompactForms();
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////
 
 SIPAuthentication::SIPAuthentication()
@@ -1797,7 +2008,7 @@ SIP_PDU::SIP_PDU(const SIP_PDU & pdu)
   : PSafeObject(pdu)
   , method(pdu.method)
   , statusCode(pdu.statusCode)
-  , uri(pdu.uri)
+  , uri(pdu.GetURI())
   , versionMajor(pdu.versionMajor)
   , versionMinor(pdu.versionMinor)
   , info(pdu.info)
@@ -1812,7 +2023,7 @@ SIP_PDU & SIP_PDU::operator=(const SIP_PDU & pdu)
 {
   method = pdu.method;
   statusCode = pdu.statusCode;
-  uri = pdu.uri;
+  SetURI(pdu.GetURI());
   versionMajor = pdu.versionMajor;
   versionMinor = pdu.versionMinor;
   info = pdu.info;
@@ -1923,7 +2134,7 @@ bool SIP_PDU::SetRoute(const PStringList & set)
     // this procedure is specified in RFC3261:12.2.1.1 for backwards compatibility with RFC2543
     routeSet.MakeUnique();
     routeSet.RemoveAt(0);
-    routeSet.AppendString(uri.AsString());
+    routeSet.AppendString(GetURI().AsString());
     uri = firstRoute;
     uri.Sanitise(SIPURL::RouteURI);
   }
@@ -2111,7 +2322,7 @@ void SIP_PDU::PrintOn(ostream & strm) const
 {
   strm << mime.GetCSeq() << ' ';
   if (method != NumMethods)
-    strm << uri;
+    strm << GetURI();
   else if (statusCode != IllegalStatusCode)
     strm << '<' << (unsigned)statusCode << '>';
   else
@@ -2119,6 +2330,46 @@ void SIP_PDU::PrintOn(ostream & strm) const
 }
 
 
+const SIPURL & SIP_PDU::GetURI() const
+{
+  /* A received request URI is only parsed if someone wants it, as this is a
+     const function it may be called by several threads at once. Once parsed
+     uri does not change, so the reference returned is safe to use. */
+  PWaitAndSignal mutex(m_uriMutex);
+  if (!m_uriText.IsEmpty()) {
+    uri = m_uriText;
+    m_uriText.MakeEmpty();
+  }
+  return uri;
+}
+
+
+// Read up to and including the blank line after the headers, or to end of stream
+static PINDEX ReadHeaderBlock(istream & strm, PBYTEArray & buffer)
+{
+  PINDEX length = 0;
+  PINDEX lineStart = 0;
+
+  int c;
+  while ((c = strm.get()) != EOF) {
+    if (length >= buffer.GetSize())
+      buffer.SetSize(length*2 + 1024);
+    buffer[length++] = (BYTE)c;
+
+    if (c == '\n') {
+      PINDEX lineLength = length - 1 - lineStart;
+      if (lineLength > 0 && buffer[length-2] == '\r')
+        --lineLength;
+      if (lineLength == 0)
+        break;
+      lineStart = length;
+    }
+  }
+
+  return length;
+}
+
+
 PBoolean SIP_PDU::Read(OpalTransport & transport)
 {
   if (!transport.IsOpen()) {
@@ -2126,40 +2377,116 @@ PBoolean SIP_PDU::Read(OpalTransport & transport)
     return PFalse;
   }
 
-  PStringStream datagram;
   PBYTEArray pdu;
+  PINDEX length;
 
-  istream * stream;
   if (transport.IsReliable())
-    stream = &transport;
+    length = ReadHeaderBlock(transport, pdu);
   else {
-    stream = &datagram;
-
     if (!transport.ReadPDU(pdu))
       return false;
+    length = pdu.GetSize();
+  }
+
+  const char * data = (const char *)(const BYTE *)pdu;
+
+  SIPMessageParser parser;
+  switch (DecodeHeaders(parser, data, length)) {
+    case DecodedHeaders :
+      break;
+
+    case UnreadableStartLine :
+      if (!transport.IsReliable()) {
+        transport.setstate(ios::failbit);
+        PTRACE(1, "SIP\tInvalid datagram from " << transport.GetLastReceivedAddress()
+                  << " - " << pdu.GetSize() << " bytes.\n" << hex << setprecision(2) << pdu << dec);
+      }
+      return PFalse;
+
+    case InvalidMIME :
+      PTRACE(2, "SIP\tInvalid MIME received on " << transport);
+      transport.clear(); // Clear flags so BadRequest response is sent by caller
+      return PFalse;
 
-    datagram = PString((char *)pdu.GetPointer(), pdu.GetSize());
+    default :
+      PTRACE(2, "SIP\tInvalid start line received on " << transport);
+      return PFalse;
   }
 
-  // get the message from transport/datagram into cmd and parse MIME
-  PString cmd;
-  *stream >> cmd;
+  if (!transport.IsReliable())
+    DecodeBody(parser, data, length);
+  else {
+    PINDEX contentLength = GetBodyLength(1000000);
+    if (contentLength != P_MAX_INDEX) {
+      if (contentLength > 0)
+        transport.read(entityBody.GetPointer(contentLength+1), contentLength);
+    }
+    else {
+      contentLength = 0;
+      int c;
+      while ((c = transport.get()) != EOF) {
+        entityBody.SetMinSize((++contentLength/1000+1)*1000);
+        entityBody += (char)c;
+      }
+    }
+
+    entityBody[contentLength] = '\0';
+  }
 
-  if (!stream->good() || cmd.IsEmpty()) {
-    if (stream == &datagram) {
-      transport.setstate(ios::failbit);
-      PTRACE(1, "SIP\tInvalid datagram from " << transport.GetLastReceivedAddress()
-                << " - " << pdu.GetSize() << " bytes.\n" << hex << setprecision(2) << pdu << dec);
+#if PTRACING
+  if (PTrace::CanTrace(3)) {
+    ostream & trace = PTrace::Begin(3, __FILE__, __LINE__);
+
+    trace << "SIP\tPDU ";
+
+    if (!PTrace::CanTrace(4)) {
+      if (method != NumMethods)
+        trace << MethodNames[method] << ' ' << GetURI();
+      else
+        trace << (unsigned)statusCode << ' ' << info;
+      trace << ' ';
     }
-    return PFalse;
+
+    trace << "received: rem=" << transport.GetLastReceivedAddress()
+          << ",local=" << transport.GetLocalAddress()
+          << ",if=" << transport.GetLastReceivedInterface();
+
+    if (PTrace::CanTrace(4))
+      trace << '\n' << parser.GetStartLine() << '\n' << mime << entityBody;
+
+    trace << PTrace::End;
   }
+#endif
+
+  return PTrue;
+}
+
+
+bool SIP_PDU::Decode(const char * data, PINDEX length)
+{
+  SIPMessageParser parser;
+  if (DecodeHeaders(parser, data, length) != DecodedHeaders)
+    return false;
+
+  DecodeBody(parser, data, length);
+  return true;
+}
+
+
+SIP_PDU::DecodeResult SIP_PDU::DecodeHeaders(SIPMessageParser & parser, const char * data, PINDEX length)
+{
+  SIPMessageParser::Result result = parser.Parse(data, length);
+  if (result == SIPMessageParser::BadStartLine)
+    return UnreadableStartLine;
+
+  PString cmd = parser.GetStartLine();
 
   if (cmd.Left(4) *= "SIP/") {
     // parse Response version, code & reason (ie: "SIP/2.0 200 OK")
     PINDEX space = cmd.Find(' ');
     if (space == P_MAX_INDEX) {
-      PTRACE(2, "SIP\tBad Status-Line \"" << cmd << "\" received on " << transport);
-      return PFalse;
+      PTRACE(2, "SIP\tBad Status-Line \"" << cmd << '"');
+      return InvalidStartLine;
     }
 
     versionMajor = cmd.Mid(4).AsUnsigned();
@@ -2167,106 +2494,80 @@ PBoolean SIP_PDU::Read(OpalTransport & transport)
     statusCode = (StatusCodes)cmd.Mid(++space).AsUnsigned();
     info    = cmd.Mid(cmd.Find(' ', space));
     uri     = PString();
+    m_uriText.MakeEmpty();
   }
   else {
-    // parse the method, URI and version
-    PStringArray cmds = cmd.Tokenise( ' ', PFalse);
-    if (cmds.GetSize() < 3) {
-      PTRACE(2, "SIP\tBad Request-Line \"" << cmd << "\" received on " << transport);
-      return PFalse;
+    // parse the method, URI and version, each separated by a single space
+    PINDEX uriStart = cmd.Find(' ');
+    PINDEX versionStart = uriStart != P_MAX_INDEX ? cmd.Find(' ', uriStart+1) : P_MAX_INDEX;
+    if (versionStart == P_MAX_INDEX) {
+      PTRACE(2, "SIP\tBad Request-Line \"" << cmd << '"');
+      return InvalidStartLine;
     }
 
     int i = 0;
-    while (!(cmds[0] *= MethodNames[i])) {
+    while (!CaselessEqual(cmd, uriStart, MethodNames[i])) {
       i++;
       if (i >= NumMethods) {
-        PTRACE(2, "SIP\tUnknown method name " << cmds[0] << " received on " << transport);
-        return PFalse;
+        PTRACE(2, "SIP\tUnknown method name " << cmd.Left(uriStart));
+        return InvalidStartLine;
       }
     }
     method = (Methods)i;
 
-    uri = cmds[1];
-    versionMajor = cmds[2].Mid(4).AsUnsigned();
-    versionMinor = cmds[2].Mid(cmds[2].Find('.')+1).AsUnsigned();
+    m_uriText = cmd(uriStart+1, versionStart-1);
+    if (m_uriText.IsEmpty())
+      uri = m_uriText; // Nothing to defer
+    PString version = cmd(versionStart+1, cmd.Find(' ', versionStart+1)-1);
+    versionMajor = version.Mid(4).AsUnsigned();
+    versionMinor = version.Mid(version.Find('.')+1).AsUnsigned();
     info = PString();
   }
 
   if (versionMajor < 2) {
-    PTRACE(2, "SIP\tInvalid version (" << versionMajor << ") received on " << transport);
-    return PFalse;
+    PTRACE(2, "SIP\tInvalid version (" << versionMajor << ')');
+    return InvalidStartLine;
   }
 
-  // Getthe MIME fields
-  *stream >> mime;
-  if (!stream->good() || mime.IsEmpty()) {
-    PTRACE(2, "SIP\tInvalid MIME received on " << transport);
-    transport.clear(); // Clear flags so BadRequest response is sent by caller
-    return PFalse;
-  }
-
-
-  // get the SDP content body
-  // if a content length is specified, read that length
-  // if no content length is specified (which is not the same as zero length)
-  // then read until end of datagram or stream
-  PINDEX contentLength = mime.GetContentLength();
-  bool contentLengthPresent = mime.IsContentLengthPresent();
+  if (result != SIPMessageParser::Parsed)
+    return InvalidMIME;
 
-  if (!contentLengthPresent) {
-    PTRACE(2, "SIP\tNo Content-Length present from " << transport << ", reading till end of datagram/stream.");
-  }
-  else if (contentLength < 0) {
-    PTRACE(2, "SIP\tImpossible negative Content-Length from " << transport << ", reading till end of datagram/stream.");
-    contentLengthPresent = false;
-  }
-  else if (contentLength > (transport.IsReliable() ? 1000000 : datagram.GetLength())) {
-    PTRACE(2, "SIP\tImplausibly long Content-Length " << contentLength << " received from " << transport << ", reading to end of datagram/stream.");
-    contentLengthPresent = false;
-  }
-
-  if (contentLengthPresent) {
-    if (contentLength > 0)
-      stream->read(entityBody.GetPointer(contentLength+1), contentLength);
-  }
-  else {
-    contentLength = 0;
-    int c;
-    while ((c = stream->get()) != EOF) {
-      entityBody.SetMinSize((++contentLength/1000+1)*1000);
-      entityBody += (char)c;
-    }
-  }
+  parser.GetMIME(mime);
+  return mime.IsEmpty() ? InvalidMIME : DecodedHeaders;
+}
 
-  ////////////////
-  entityBody[contentLength] = '\0';
 
-#if PTRACING
-  if (PTrace::CanTrace(3)) {
-    ostream & trace = PTrace::Begin(3, __FILE__, __LINE__);
+void SIP_PDU::DecodeBody(const SIPMessageParser & parser, const char * data, PINDEX length)
+{
+  PINDEX contentLength = GetBodyLength(length);
+  if (contentLength > parser.GetBodyLength())
+    contentLength = parser.GetBodyLength();
 
-    trace << "SIP\tPDU ";
+  entityBody = PString(data + parser.GetBodyOffset(), contentLength);
+}
 
-    if (!PTrace::CanTrace(4)) {
-      if (method != NumMethods)
-        trace << MethodNames[method] << ' ' << uri;
-      else
-        trace << (unsigned)statusCode << ' ' << info;
-      trace << ' ';
-    }
 
-    trace << "received: rem=" << transport.GetLastReceivedAddress()
-          << ",local=" << transport.GetLocalAddress()
-          << ",if=" << transport.GetLastReceivedInterface();
+/* Get the body length from the Content-Length, or P_MAX_INDEX to read until
+   end of datagram or stream, which is not the same as zero length. */
+PINDEX SIP_PDU::GetBodyLength(PINDEX maxLength) const
+{
+  if (!mime.IsContentLengthPresent()) {
+    PTRACE(2, "SIP\tNo Content-Length present, reading till end of datagram/stream.");
+    return P_MAX_INDEX;
+  }
 
-    if (PTrace::CanTrace(4))
-      trace << '\n' << cmd << '\n' << mime << entityBody;
+  PINDEX contentLength = mime.GetContentLength();
+  if (contentLength < 0) {
+    PTRACE(2, "SIP\tImpossible negative Content-Length, reading till end of datagram/stream.");
+    return P_MAX_INDEX;
+  }
 
-    trace << PTrace::End;
+  if (contentLength > maxLength) {
+    PTRACE(2, "SIP\tImplausibly long Content-Length " << contentLength << ", reading to end of datagram/stream.");
+    return P_MAX_INDEX;
   }
-#endif
 
-  return PTrue;
+  return contentLength;
 }
 
 
@@ -2315,7 +2616,7 @@ PBoolean SIP_PDU::Write(OpalTransport & transport, const OpalTransportAddress &
 
     if (!PTrace::CanTrace(4)) {
       if (method != NumMethods)
-        trace << MethodNames[method] << ' ' << uri;
+        trace << MethodNames[method] << ' ' << GetURI();
       else
         trace << (unsigned)statusCode << ' ' << info;
       trace << ' ';
@@ -2355,7 +2656,7 @@ PString SIP_PDU::Build()
   mime.SetContentLength(entityBody.GetLength());
 
   if (method != NumMethods)
-    str << MethodNames[method] << ' ' << uri << ' ';
+    str << MethodNames[method] << ' ' << GetURI() << ' ';
 
   str << "SIP/" << versionMajor << '.' << versionMinor;
 
@@ -2548,6 +2849,14 @@ SIPTransaction::SIPTransaction(SIPEndPoint & ep,
                                const PTimeInterval & maxRetryTime)
   : endpoint(ep)
   , transport(trans)
+#ifdef _MSC_VER
+#pragma warning(disable:4355)
+#endif
+  , retryTimer(*this, &SIPTransaction::OnRetry)
+  , completionTimer(*this, &SIPTransaction::OnTimeout)
+#ifdef _MSC_VER
+#pragma warning(default:4355)
+#endif
 {
   Construct(minRetryTime, maxRetryTime);
   PTRACE(4, "SIP\tTransaction created.");
@@ -2560,6 +2869,14 @@ SIPTransaction::SIPTransaction(SIPConnection & conn,
   : SIP_PDU(meth, conn, trans),
     endpoint(conn.GetEndPoint()),
     transport(trans)
+#ifdef _MSC_VER
+#pragma warning(disable:4355)
+#endif
+  , retryTimer(*this, &SIPTransaction::OnRetry)
+  , completionTimer(*this, &SIPTransaction::OnTimeout)
+#ifdef _MSC_VER
+#pragma warning(default:4355)
+#endif
 {
   connection = &conn;
   Construct();
@@ -2569,9 +2886,6 @@ SIPTransaction::SIPTransaction(SIPConnection & conn,
 
 void SIPTransaction::Construct(const PTimeInterval & minRetryTime, const PTimeInterval & maxRetryTime)
 {
-  retryTimer.SetNotifier(PCREATE_NOTIFIER(OnRetry));
-  completionTimer.SetNotifier(PCREATE_NOTIFIER(OnTimeout));
-
   retry = 1;
   state = NotStarted;
 
@@ -2595,6 +2909,10 @@ void SIPTransaction::Construct(Methods method, SIPDialogContext & dialog)
 
 SIPTransaction::~SIPTransaction()
 {
+  // Make sure no timer callback is still running on the wheel
+  retryTimer.Stop(true);
+  completionTimer.Stop(true);
+
   PTRACE_IF(1, state < Terminated_Success, "SIP\tDestroying transaction id="
             << GetTransactionID() << " which is not yet terminated.");
   PTRACE(4, "SIP\tTransaction id=" << GetTransactionID() << " destroyed.");
@@ -2629,7 +2947,7 @@ PBoolean SIPTransaction::Start()
 
   /* Get the address to which the request PDU should be sent, according to
      the RFC, for a request in a dialog. */
-  SIPURL destination = uri;
+  SIPURL destination = GetURI();
 
   PStringList routeSet = GetMIME().GetRoute();
   if (!routeSet.IsEmpty()) {
@@ -2650,13 +2968,13 @@ PBoolean SIPTransaction::Start()
     return PFalse;
   }
 
-  retryTimer = retryTimeoutMin;
+  retryTimer.Start(retryTimeoutMin);
   if (method == Method_INVITE)
-    completionTimer = endpoint.GetInviteTimeout();
+    completionTimer.Start(endpoint.GetInviteTimeout());
   else
-    completionTimer = endpoint.GetNonInviteTimeout();
+    completionTimer.Start(endpoint.GetNonInviteTimeout());
 
-  PTRACE(4, "SIP\tTransaction timers set: retry=" << retryTimer << ", completion=" << completionTimer);
+  PTRACE(4, "SIP\tTransaction timers set: retry=" << retryTimer.GetResetTime() << ", completion=" << completionTimer.GetResetTime());
   return true;
 }
 
@@ -2685,8 +3003,8 @@ PBoolean SIPTransaction::Cancel()
   PTRACE(4, "SIP\t" << GetMethod() << " transaction id=" << GetTransactionID() << " cancelled.");
   state = Cancelling;
   retry = 0;
-  retryTimer = retryTimeoutMin;
-  completionTimer = endpoint.GetPduCleanUpTimeout();
+  retryTimer.Start(retryTimeoutMin);
+  completionTimer.Start(endpoint.GetPduCleanUpTimeout());
   return ResendCANCEL();
 }
 
@@ -2715,7 +3033,7 @@ bool SIPTransaction::SendPDU(SIP_PDU & pdu)
 bool SIPTransaction::ResendCANCEL()
 {
   SIP_PDU cancel(Method_CANCEL,
-                 uri,
+                 GetURI(),
                  mime.GetTo(),
                  mime.GetFrom(),
                  mime.GetCallID(),
@@ -2739,7 +3057,7 @@ PBoolean SIPTransaction::OnReceivedResponse(SIP_PDU & response)
   /* If is the response to a CANCEL we sent, then we stop retransmissions
      and wait for the 487 Request Terminated to come in */
   if (cseq.Find(MethodNames[Method_CANCEL]) != P_MAX_INDEX) {
-    completionTimer = endpoint.GetPduCleanUpTimeout();
+    completionTimer.Start(endpoint.GetPduCleanUpTimeout());
     return PFalse;
   }
 
@@ -2747,8 +3065,8 @@ PBoolean SIPTransaction::OnReceivedResponse(SIP_PDU & response)
   if (cseq.Find(MethodNames[method]) == P_MAX_INDEX) {
     PTRACE(2, "SIP\tTransaction " << cseq << " response not for " << *this);
     // Restart timer as haven't finished yet
-    retryTimer = retryTimer.GetResetTime();
-    completionTimer = completionTimer.GetResetTime();
+    retryTimer.Restart();
+    completionTimer.Restart();
     return PFalse;
   }
 
@@ -2769,15 +3087,15 @@ PBoolean SIPTransaction::OnReceivedResponse(SIP_PDU & response)
         state = Proceeding;
 
       retry = 0;
-      retryTimer = retryTimeoutMax;
+      retryTimer.Start(retryTimeoutMax);
 
       int expiry = mime.GetExpires();
       if (expiry > 0)
-        completionTimer.SetInterval(0, expiry);
+        completionTimer.Start(PTimeInterval(0, expiry));
       else if (method == Method_INVITE)
-        completionTimer = endpoint.GetInviteTimeout();
+        completionTimer.Start(endpoint.GetInviteTimeout());
       else
-        completionTimer = endpoint.GetNonInviteTimeout();
+        completionTimer.Start(endpoint.GetNonInviteTimeout());
     }
     else {
       PTRACE(3, "SIP\t" << GetMethod() << " transaction id=" << GetTransactionID() << " completed.");
@@ -2795,7 +3113,7 @@ PBoolean SIPTransaction::OnReceivedResponse(SIP_PDU & response)
   }
 
   if (response.GetStatusCode() >= 200) {
-    completionTimer = endpoint.GetPduCleanUpTimeout();
+    completionTimer.Start(endpoint.GetPduCleanUpTimeout());
     completed.Signal();
   }
 
@@ -2809,7 +3127,7 @@ PBoolean SIPTransaction::OnCompleted(SIP_PDU & /*response*/)
 }
 
 
-void SIPTransaction::OnRetry(PTimer &, INT)
+void SIPTransaction::OnRetry()
 {
   PSafeLockReadWrite lock(*this);
 
@@ -2824,16 +3142,16 @@ void SIPTransaction::OnRetry(PTimer &, INT)
   }
 
   if (state > Trying)
-    retryTimer = retryTimeoutMax;
+    retryTimer.Start(retryTimeoutMax);
   else {
     PTimeInterval timeout = retryTimeoutMin*(1<<retry);
     if (timeout > retryTimeoutMax)
       timeout = retryTimeoutMax;
-    retryTimer = timeout;
+    retryTimer.Start(timeout);
   }
 
   PTRACE(3, "SIP\t" << GetMethod() << " transaction id=" << GetTransactionID()
-         << " timeout, making retry " << retry << ", timeout " << retryTimer);
+         << " timeout, making retry " << retry << ", timeout " << retryTimer.GetResetTime());
 
   if (state == Cancelling)
     ResendCANCEL();
@@ -2842,7 +3160,7 @@ void SIPTransaction::OnRetry(PTimer &, INT)
 }
 
 
-void SIPTransaction::OnTimeout(PTimer &, INT)
+void SIPTransaction::OnTimeout()
 {
   PSafeLockReadWrite lock(*this);
 
@@ -2913,6 +3231,9 @@ void SIPTransaction::SetTerminated(States newState)
   PTRACE(3, "SIP\tSet state " << StateNames[newState] << " for "
          << GetMethod() << " transaction id=" << GetTransactionID());
 
+  // Reaped on next garbage collection, without scanning every transaction
+  endpoint.OnTransactionTerminated(*this);
+
   // Transaction failed, tell the endpoint
   if (state > Terminated_Success) {
     switch (state) {
@@ -2950,6 +3271,144 @@ PString SIPTransaction::GenerateCallID()
 }
 
 
+SIPTransaction::Timer::Timer(SIPTransaction & transaction, Callback callback)
+  : m_transaction(transaction)
+  , m_callback(callback)
+{
+}
+
+
+SIPTransaction::Timer::~Timer()
+{
+  Stop(true);
+}
+
+
+void SIPTransaction::Timer::Start(const PTimeInterval & interval)
+{
+  m_interval = interval;
+
+  // As for PTimer, a zero interval means stopped
+  if (interval == 0)
+    Stop(false);
+  else
+    m_transaction.endpoint.GetTransactionTimers().Schedule(*this, interval);
+}
+
+
+void SIPTransaction::Timer::Stop(bool wait)
+{
+  m_transaction.endpoint.GetTransactionTimers().Cancel(*this, wait);
+}
+
+
+void SIPTransaction::Timer::OnTimeout()
+{
+  (m_transaction.*m_callback)();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////
+
+SIPTransactionTable::SIPTransactionTable(PINDEX shardCount)
+{
+  PINDEX count = 1;
+  while (count < shardCount)
+    count <<= 1;
+
+  m_shardMask = count-1;
+  for (PINDEX i = 0; i < count; ++i)
+    m_shards.push_back(new Shard);
+}
+
+
+SIPTransactionTable::~SIPTransactionTable()
+{
+  for (std::vector<Shard *>::iterator it = m_shards.begin(); it != m_shards.end(); ++it)
+    delete *it;
+}
+
+
+SIPTransactionTable::Shard & SIPTransactionTable::GetShard(const PString & transactionID) const
+{
+  return *m_shards[OpalStringHash(transactionID) & m_shardMask];
+}
+
+
+void SIPTransactionTable::Add(SIPTransaction * transaction)
+{
+  PString id = transaction->GetTransactionID();
+  GetShard(id).SetAt(id, transaction);
+
+  // May have been aborted before it was started
+  if (transaction->IsTerminated())
+    OnTerminated(*transaction);
+}
+
+
+PSafePtr<SIPTransaction> SIPTransactionTable::Find(const PString & transactionID, PSafetyMode mode) const
+{
+  return GetShard(transactionID).FindWithLock(transactionID, mode);
+}
+
+
+bool SIPTransactionTable::Remove(const PString & transactionID)
+{
+  return GetShard(transactionID).RemoveAt(transactionID);
+}
+
+
+PSafePtr<SIPTransaction> SIPTransactionTable::GetFirst(PSafetyMode mode) const
+{
+  for (std::vector<Shard *>::const_iterator it = m_shards.begin(); it != m_shards.end(); ++it) {
+    PSafePtr<SIPTransaction> transaction = (*it)->GetAt(0, mode);
+    if (transaction != NULL)
+      return transaction;
+  }
+
+  return NULL;
+}
+
+
+void SIPTransactionTable::OnTerminated(const SIPTransaction & transaction)
+{
+  PString id = transaction.GetTransactionID();
+  PWaitAndSignal mutex(m_terminatedMutex);
+  m_terminated.push_back(id);
+}
+
+
+bool SIPTransactionTable::ReapTerminated()
+{
+  std::vector<PString> terminated;
+  {
+    PWaitAndSignal mutex(m_terminatedMutex);
+    terminated.swap(m_terminated);
+  }
+
+  for (std::vector<PString>::iterator id = terminated.begin(); id != terminated.end(); ++id)
+    Remove(*id);
+
+  PTRACE_IF(4, !terminated.empty(), "SIP\tReaped " << terminated.size() << " terminated transactions");
+
+  bool allDeleted = true;
+  for (std::vector<Shard *>::iterator it = m_shards.begin(); it != m_shards.end(); ++it) {
+    if (!(*it)->DeleteObjectsToBeRemoved())
+      allDeleted = false;
+  }
+  return allDeleted;
+}
+
+
+PINDEX SIPTransactionTable::GetSize() const
+{
+  PINDEX size = 0;
+  for (std::vector<Shard *>::const_iterator it = m_shards.begin(); it != m_shards.end(); ++it)
+    size += (*it)->GetSize();
+  return size;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////
 
 SIPInvite::SIPInvite(SIPConnection & connection, OpalTransport & transport, const OpalRTPSessionManager & sm)
@@ -37,6 +37,7 @@
 #include <opal/buildopts.h>
 
 #include <t38/t38proto.h>
+#include <opal/manager.h>
 
 
 /////////////////////////////////////////////////////////////////////////////
@@ -1149,7 +1150,9 @@ void OpalT38Connection::RequestFaxMode(bool toFax)
   if (m_syncMode == Mode_UserInput)
     OnUserInputTone('\0', 0);
 
-  PThread::Create(PCREATE_NOTIFIER(OpenFaxStreams));
+  // Keyed on the call so it cannot overlap the release of the connection
+  if (!endpoint.GetManager().GetWorkScheduler().Post(PCREATE_NOTIFIER(OpenFaxStreams), 0, ownerCall.GetToken()))
+    PThread::Create(PCREATE_NOTIFIER(OpenFaxStreams));
 }
 
 